@@ -0,0 +1,109 @@
+#pragma once
+
+// Header-only coroutine client over the NSPI stub. It shares the executors of the EMSMDB coroutine client, so one
+// executor can drive both address book and mailbox steps of a workload:
+//
+//     PropertyRowSet_r *rows = NULL;
+//     long status = co_await nspi.QueryRows(0, &stat, 0, NULL, 50, &columns, &rows);
+//
+// The NSPI interface has no [async] methods, so each call runs on a blocking thread and resumes the awaiting
+// coroutine on its executor; executor threads are never blocked by an NSPI round trip.
+
+#include "MS-OXNSPI.h"
+#include "..\OXCRPCStub\CoroutineExecutor.h"
+
+namespace StubCoroutines
+{
+    /// <summary>
+    /// A coroutine-friendly session on the NSPI interface.
+    /// </summary>
+    class NspiClient
+    {
+    public:
+        NspiClient(Executor &executor)
+            : executor(executor), contextHandle(NULL)
+        {
+        }
+
+        /// <summary>
+        /// Initiate a session with NspiBind on the given binding handle.
+        /// </summary>
+        BlockingCallAwaitable<long> Bind(handle_t hRpc, DWORD dwFlags, STAT *pStat, FlatUID_r *pServerGuid)
+        {
+            NSPI_HANDLE *pContextHandle = &this->contextHandle;
+            return this->Call([=]() { return NspiBind(hRpc, dwFlags, pStat, pServerGuid, pContextHandle); });
+        }
+
+        /// <summary>
+        /// End the session with NspiUnbind.
+        /// </summary>
+        BlockingCallAwaitable<long> Unbind()
+        {
+            NSPI_HANDLE *pContextHandle = &this->contextHandle;
+            return this->Call([=]() { return (long)NspiUnbind(pContextHandle, 0); });
+        }
+
+        /// <summary>
+        /// Return rows of the current address book container with NspiQueryRows.
+        /// </summary>
+        BlockingCallAwaitable<long> QueryRows(DWORD dwFlags, STAT *pStat, DWORD dwETableCount, DWORD *lpETable, DWORD Count, PropertyTagArray_r *pPropTags, PropertyRowSet_r **ppRows)
+        {
+            NSPI_HANDLE hRpc = this->contextHandle;
+            return this->Call([=]() { return NspiQueryRows(hRpc, dwFlags, pStat, dwETableCount, lpETable, Count, pPropTags, ppRows); });
+        }
+
+        /// <summary>
+        /// Return an explicit table that matches a restriction with NspiGetMatches.
+        /// </summary>
+        BlockingCallAwaitable<long> GetMatches(STAT *pStat, Restriction_r *Filter, PropertyName_r *lpPropName, DWORD ulRequested, PropertyTagArray_r **ppOutMIds, PropertyTagArray_r *pPropTags, PropertyRowSet_r **ppRows)
+        {
+            NSPI_HANDLE hRpc = this->contextHandle;
+            return this->Call([=]() { return NspiGetMatches(hRpc, 0, pStat, NULL, 0, Filter, lpPropName, ulRequested, ppOutMIds, pPropTags, ppRows); });
+        }
+
+        /// <summary>
+        /// Resolve ambiguous names with NspiResolveNamesW.
+        /// </summary>
+        BlockingCallAwaitable<long> ResolveNamesW(STAT *pStat, PropertyTagArray_r *pPropTags, WStringsArray_r *paWStr, PropertyTagArray_r **ppMIds, PropertyRowSet_r **ppRows)
+        {
+            NSPI_HANDLE hRpc = this->contextHandle;
+            return this->Call([=]() { return NspiResolveNamesW(hRpc, 0, pStat, pPropTags, paWStr, ppMIds, ppRows); });
+        }
+
+        /// <summary>
+        /// Return the properties of the current object with NspiGetProps.
+        /// </summary>
+        BlockingCallAwaitable<long> GetProps(DWORD dwFlags, STAT *pStat, PropertyTagArray_r *pPropTags, PropertyRow_r **ppRows)
+        {
+            NSPI_HANDLE hRpc = this->contextHandle;
+            return this->Call([=]() { return NspiGetProps(hRpc, dwFlags, pStat, pPropTags, ppRows); });
+        }
+
+        NSPI_HANDLE Handle() const { return this->contextHandle; }
+
+    private:
+        /// <summary>
+        /// Run an NSPI method on a blocking thread, translating RPC exceptions into return values.
+        /// </summary>
+        BlockingCallAwaitable<long> Call(std::function<long()> call)
+        {
+            return BlockingCallAwaitable<long>(this->executor, [call]() -> long
+            {
+                long status = 0;
+                RpcTryExcept
+                {
+                    status = call();
+                }
+                RpcExcept(EXCEPTION_EXECUTE_HANDLER)
+                {
+                    status = ::RpcExceptionCode();
+                }
+                RpcEndExcept;
+                return status;
+            });
+        }
+
+        Executor &executor;
+        NSPI_HANDLE contextHandle;
+    };
+}
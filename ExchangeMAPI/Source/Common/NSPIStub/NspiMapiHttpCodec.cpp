@@ -0,0 +1,1546 @@
+#include "NspiMapiHttpCodec.h"
+#include <string.h>
+#include <wchar.h>
+
+// The request and response bodies of the address book requests of MS-OXCMAPIHTTP section 2.2.5, for a client that
+// sends them to the /mapi/nspi/ endpoint itself. The encoders write a request body from the same parameters as the
+// NSPI method of the RPC stub, with an empty auxiliary buffer. The decoders read a response body, after its meta-tags
+// and additional headers, into the structures the NSPI method returns over RPC, so that one parser serves both
+// transports. A rowset is decoded in two passes over the body: the first measures the rows, their values and the data
+// they point to, the second fills one block of that size from midl_user_allocate. The block is freed with a single
+// midl_user_free, by NspiHttpFreeRow or NspiHttpFreeRowSet, and reading a row touches memory in the order it was
+// received. The routines of NspiMemory walk the separate blocks of an RPC output and cannot free a decoded one.
+//
+// The values are AddressBookPropertyValue structures, as specified in MS-OXCMAPIHTTP section 2.2.1.1: string,
+// binary and multi-valued values start with a HasValue byte, and their COUNT fields are 4 bytes.
+
+#define PROP_TYPE(tag)          ((tag) & 0x0000FFFF)
+#define PROP_TAG(tag, type)     (((tag) & 0xFFFF0000) | (type))
+
+static const DWORD PtypUnspecified = 0x0000;
+static const DWORD PtypNull = 0x0001;
+static const DWORD PtypInteger16 = 0x0002;
+static const DWORD PtypInteger32 = 0x0003;
+static const DWORD PtypErrorCode = 0x000A;
+static const DWORD PtypBoolean = 0x000B;
+static const DWORD PtypString8 = 0x001E;
+static const DWORD PtypString = 0x001F;
+static const DWORD PtypTime = 0x0040;
+static const DWORD PtypGuid = 0x0048;
+static const DWORD PtypBinary = 0x0102;
+static const DWORD PtypMultipleFlag = 0x1000;
+
+/// <summary>
+/// The error the RPC stub returns for a column the row has no value for.
+/// </summary>
+static const long MapiErrorNotFound = 0x8004010F;
+
+/// <summary>
+/// The HasValue byte of a string, binary or multi-valued AddressBookPropertyValue.
+/// </summary>
+static const unsigned char HasValueAbsent = 0x00;
+static const unsigned char HasValuePresent = 0xFF;
+
+/// <summary>
+/// The Flag of an AddressBookPropertyRow or of an AddressBookFlaggedPropertyValue.
+/// </summary>
+static const unsigned char RowFlagPlain = 0x00;
+static const unsigned char RowFlagFlagged = 0x01;
+static const unsigned char ValueFlagPresent = 0x00;
+static const unsigned char ValueFlagAbsent = 0x01;
+static const unsigned char ValueFlagError = 0x0A;
+
+/// <summary>
+/// The restriction types of MS-OXCDATA section 2.12.
+/// </summary>
+static const unsigned char RES_AND = 0x00;
+static const unsigned char RES_OR = 0x01;
+static const unsigned char RES_NOT = 0x02;
+static const unsigned char RES_CONTENT = 0x03;
+static const unsigned char RES_PROPERTY = 0x04;
+static const unsigned char RES_COMPAREPROPS = 0x05;
+static const unsigned char RES_BITMASK = 0x06;
+static const unsigned char RES_SIZE = 0x07;
+static const unsigned char RES_EXIST = 0x08;
+static const unsigned char RES_SUBRESTRICTION = 0x09;
+
+/// <summary>
+/// The deepest nesting of restrictions the encoder follows, which stops a cycle in the caller's restriction.
+/// </summary>
+static const int MaxRestrictionDepth = 64;
+
+/// <summary>
+/// The most rows, and the most values, rows times columns, a decoded rowset may have. A PtypNull or PtypUnspecified
+/// column takes no byte of the body, so the size of the body alone does not bound the PropertyValue_r structures to
+/// allocate.
+/// </summary>
+static const unsigned __int64 MaxRowSetValues = 0x400000;
+
+/// <summary>
+/// The output of an encoder.
+/// </summary>
+struct BodyWriter
+{
+    unsigned char *output;
+    unsigned long capacity;
+    unsigned long position;
+    bool overflow;
+
+    void PutBytes(const void *data, unsigned long size)
+    {
+        if (capacity - position < size)
+        {
+            overflow = true;
+            position = capacity;
+            return;
+        }
+
+        memcpy(output + position, data, size);
+        position += size;
+    }
+
+    void PutByte(unsigned char value)
+    {
+        PutBytes(&value, 1);
+    }
+
+    void PutBool(bool value)
+    {
+        PutByte(value ? 1 : 0);
+    }
+
+    void PutUShort(unsigned short value)
+    {
+        unsigned char bytes[2] = { (unsigned char)value, (unsigned char)(value >> 8) };
+        PutBytes(bytes, 2);
+    }
+
+    void PutULong(unsigned long value)
+    {
+        unsigned char bytes[4] = { (unsigned char)value, (unsigned char)(value >> 8), (unsigned char)(value >> 16), (unsigned char)(value >> 24) };
+        PutBytes(bytes, 4);
+    }
+
+    void PutWideString(const wchar_t *value)
+    {
+        size_t length = wcslen(value);
+        for (size_t i = 0; i <= length; i++)
+        {
+            PutUShort((unsigned short)value[i]);
+        }
+    }
+};
+
+/// <summary>
+/// The input of a decoder. A read past the end of the body marks it malformed and returns zeros.
+/// </summary>
+struct BodyReader
+{
+    const unsigned char *input;
+    unsigned long size;
+    unsigned long position;
+    bool malformed;
+
+    unsigned long Remaining() const
+    {
+        return size - position;
+    }
+
+    const unsigned char *GetBytes(unsigned long count)
+    {
+        if (malformed || Remaining() < count)
+        {
+            malformed = true;
+            return NULL;
+        }
+
+        const unsigned char *bytes = input + position;
+        position += count;
+        return bytes;
+    }
+
+    unsigned char GetByte()
+    {
+        const unsigned char *bytes = GetBytes(1);
+        return bytes == NULL ? 0 : bytes[0];
+    }
+
+    bool GetBool()
+    {
+        return GetByte() != 0;
+    }
+
+    unsigned short GetUShort()
+    {
+        const unsigned char *bytes = GetBytes(2);
+        return bytes == NULL ? 0 : (unsigned short)(bytes[0] | (bytes[1] << 8));
+    }
+
+    unsigned long GetULong()
+    {
+        const unsigned char *bytes = GetBytes(4);
+        return bytes == NULL ? 0 : (unsigned long)bytes[0] | ((unsigned long)bytes[1] << 8) | ((unsigned long)bytes[2] << 16) | ((unsigned long)bytes[3] << 24);
+    }
+
+    /// <summary>
+    /// Read a count of items of at least minimumSize bytes each, and mark the body malformed if they cannot all be in it.
+    /// </summary>
+    unsigned long GetCount(unsigned long minimumSize)
+    {
+        unsigned long count = GetULong();
+        if (!malformed && minimumSize != 0 && count > Remaining() / minimumSize)
+        {
+            malformed = true;
+            return 0;
+        }
+
+        return count;
+    }
+};
+
+/// <summary>
+/// The block a decoded rowset is written to. While base is NULL, Take only measures the block and returns NULL. A size
+/// that does not fit in a size_t sets overflow, after which Take returns NULL and the block cannot be allocated.
+/// </summary>
+struct FlatBlock
+{
+    unsigned char *base;
+    size_t size;
+    bool overflow;
+
+    void *Take(size_t count)
+    {
+        return Take(count, 1);
+    }
+
+    void *Take(size_t count, size_t itemSize)
+    {
+        if (overflow || size > (size_t)-1 - 7 || (itemSize != 0 && count > ((size_t)-1 - 7 - size) / itemSize))
+        {
+            overflow = true;
+            return NULL;
+        }
+
+        size_t offset = (size + 7) & ~(size_t)7;
+        size = offset + count * itemSize;
+        return base == NULL ? NULL : base + offset;
+    }
+};
+
+static void PutState(BodyWriter &writer, const STAT *pStat)
+{
+    writer.PutBool(pStat != NULL);
+    if (pStat != NULL)
+    {
+        writer.PutULong(pStat->SortType);
+        writer.PutULong(pStat->ContainerID);
+        writer.PutULong(pStat->CurrentRec);
+        writer.PutULong((unsigned long)pStat->Delta);
+        writer.PutULong(pStat->NumPos);
+        writer.PutULong(pStat->TotalRecs);
+        writer.PutULong(pStat->CodePage);
+        writer.PutULong(pStat->TemplateLocale);
+        writer.PutULong(pStat->SortLocale);
+    }
+}
+
+static void PutTagArray(BodyWriter &writer, const PropertyTagArray_r *tags)
+{
+    writer.PutBool(tags != NULL);
+    if (tags != NULL)
+    {
+        writer.PutULong(tags->cValues);
+        for (DWORD i = 0; i < tags->cValues; i++)
+        {
+            writer.PutULong(tags->aulPropTag[i]);
+        }
+    }
+}
+
+static void PutBinary(BodyWriter &writer, const Binary_r &value)
+{
+    writer.PutULong(value.cb);
+    writer.PutBytes(value.lpb, value.cb);
+}
+
+/// <summary>
+/// Write an AddressBookPropertyValue of the type of the property tag.
+/// </summary>
+/// <returns>If success, it returns 0. ERROR_INVALID_PARAMETER indicates a type the MAPI/HTTP address book does not carry.</returns>
+static long PutValue(BodyWriter &writer, DWORD ulPropTag, const PROP_VAL_UNION &value)
+{
+    DWORD type = PROP_TYPE(ulPropTag);
+    switch (type)
+    {
+    case PtypNull:
+        return 0;
+    case PtypInteger16:
+        writer.PutUShort((unsigned short)value.i);
+        return 0;
+    case PtypInteger32:
+        writer.PutULong((unsigned long)value.l);
+        return 0;
+    case PtypErrorCode:
+        writer.PutULong((unsigned long)value.err);
+        return 0;
+    case PtypBoolean:
+        writer.PutBool(value.b != 0);
+        return 0;
+    case PtypTime:
+        writer.PutULong(value.ft.dwLowDateTime);
+        writer.PutULong(value.ft.dwHighDateTime);
+        return 0;
+    case PtypGuid:
+        if (value.lpguid == NULL)
+        {
+            return ERROR_INVALID_PARAMETER;
+        }
+
+        writer.PutBytes(value.lpguid->ab, sizeof(value.lpguid->ab));
+        return 0;
+    case PtypString8:
+        writer.PutByte(value.lpszA == NULL ? HasValueAbsent : HasValuePresent);
+        if (value.lpszA != NULL)
+        {
+            writer.PutBytes(value.lpszA, (unsigned long)strlen((const char *)value.lpszA) + 1);
+        }
+
+        return 0;
+    case PtypString:
+        writer.PutByte(value.lpszW == NULL ? HasValueAbsent : HasValuePresent);
+        if (value.lpszW != NULL)
+        {
+            writer.PutWideString(value.lpszW);
+        }
+
+        return 0;
+    case PtypBinary:
+        writer.PutByte(HasValuePresent);
+        PutBinary(writer, value.bin);
+        return 0;
+    case PtypMultipleFlag | PtypInteger16:
+        writer.PutByte(HasValuePresent);
+        writer.PutULong(value.MVi.cValues);
+        for (DWORD i = 0; i < value.MVi.cValues; i++)
+        {
+            writer.PutUShort((unsigned short)value.MVi.lpi[i]);
+        }
+
+        return 0;
+    case PtypMultipleFlag | PtypInteger32:
+        writer.PutByte(HasValuePresent);
+        writer.PutULong(value.MVl.cValues);
+        for (DWORD i = 0; i < value.MVl.cValues; i++)
+        {
+            writer.PutULong((unsigned long)value.MVl.lpl[i]);
+        }
+
+        return 0;
+    case PtypMultipleFlag | PtypString8:
+        writer.PutByte(HasValuePresent);
+        writer.PutULong(value.MVszA.cValues);
+        for (DWORD i = 0; i < value.MVszA.cValues; i++)
+        {
+            writer.PutBytes(value.MVszA.lppszA[i], (unsigned long)strlen((const char *)value.MVszA.lppszA[i]) + 1);
+        }
+
+        return 0;
+    case PtypMultipleFlag | PtypString:
+        writer.PutByte(HasValuePresent);
+        writer.PutULong(value.MVszW.cValues);
+        for (DWORD i = 0; i < value.MVszW.cValues; i++)
+        {
+            writer.PutWideString(value.MVszW.lppszW[i]);
+        }
+
+        return 0;
+    case PtypMultipleFlag | PtypBinary:
+        writer.PutByte(HasValuePresent);
+        writer.PutULong(value.MVbin.cValues);
+        for (DWORD i = 0; i < value.MVbin.cValues; i++)
+        {
+            PutBinary(writer, value.MVbin.lpbin[i]);
+        }
+
+        return 0;
+    case PtypMultipleFlag | PtypGuid:
+        writer.PutByte(HasValuePresent);
+        writer.PutULong(value.MVguid.cValues);
+        for (DWORD i = 0; i < value.MVguid.cValues; i++)
+        {
+            writer.PutBytes(value.MVguid.lpguid[i]->ab, sizeof(value.MVguid.lpguid[i]->ab));
+        }
+
+        return 0;
+    case PtypMultipleFlag | PtypTime:
+        writer.PutByte(HasValuePresent);
+        writer.PutULong(value.MVft.cValues);
+        for (DWORD i = 0; i < value.MVft.cValues; i++)
+        {
+            writer.PutULong(value.MVft.lpft[i].dwLowDateTime);
+            writer.PutULong(value.MVft.lpft[i].dwHighDateTime);
+        }
+
+        return 0;
+    default:
+        return ERROR_INVALID_PARAMETER;
+    }
+}
+
+/// <summary>
+/// Write an AddressBookTaggedPropertyValue: the property tag and the value.
+/// </summary>
+static long PutTaggedValue(BodyWriter &writer, const PropertyValue_r *value)
+{
+    if (value == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    writer.PutULong(value->ulPropTag);
+    return PutValue(writer, value->ulPropTag, value->Value);
+}
+
+/// <summary>
+/// Write a restriction, as specified in MS-OXCDATA section 2.12, with 4-byte counts.
+/// </summary>
+static long PutRestriction(BodyWriter &writer, const Restriction_r *restriction, int depth)
+{
+    if (restriction == NULL || depth > MaxRestrictionDepth)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    long status = 0;
+    writer.PutByte((unsigned char)restriction->rt);
+    switch (restriction->rt)
+    {
+    case RES_AND:
+    case RES_OR:
+        writer.PutULong(restriction->res.resAnd.cRes);
+        for (DWORD i = 0; i < restriction->res.resAnd.cRes && status == 0; i++)
+        {
+            status = PutRestriction(writer, &restriction->res.resAnd.lpRes[i], depth + 1);
+        }
+
+        return status;
+    case RES_NOT:
+        return PutRestriction(writer, restriction->res.resNot.lpRes, depth + 1);
+    case RES_CONTENT:
+        writer.PutULong(restriction->res.resContent.ulFuzzyLevel);
+        writer.PutULong(restriction->res.resContent.ulPropTag);
+        return PutTaggedValue(writer, restriction->res.resContent.lpProp);
+    case RES_PROPERTY:
+        writer.PutByte((unsigned char)restriction->res.resProperty.relop);
+        writer.PutULong(restriction->res.resProperty.ulPropTag);
+        return PutTaggedValue(writer, restriction->res.resProperty.lpProp);
+    case RES_COMPAREPROPS:
+        writer.PutByte((unsigned char)restriction->res.resCompareProps.relop);
+        writer.PutULong(restriction->res.resCompareProps.ulPropTag1);
+        writer.PutULong(restriction->res.resCompareProps.ulPropTag2);
+        return 0;
+    case RES_BITMASK:
+        writer.PutByte((unsigned char)restriction->res.resBitMask.relBMR);
+        writer.PutULong(restriction->res.resBitMask.ulPropTag);
+        writer.PutULong(restriction->res.resBitMask.ulMask);
+        return 0;
+    case RES_SIZE:
+        writer.PutByte((unsigned char)restriction->res.resSize.relop);
+        writer.PutULong(restriction->res.resSize.ulPropTag);
+        writer.PutULong(restriction->res.resSize.cb);
+        return 0;
+    case RES_EXIST:
+        writer.PutULong(restriction->res.resExist.ulPropTag);
+        return 0;
+    case RES_SUBRESTRICTION:
+        writer.PutULong(restriction->res.resSubRestriction.ulSubObject);
+        return PutRestriction(writer, restriction->res.resSubRestriction.lpRes, depth + 1);
+    default:
+        return ERROR_INVALID_PARAMETER;
+    }
+}
+
+static BodyWriter BeginBody(unsigned char *body, unsigned long cbBody)
+{
+    BodyWriter writer;
+    writer.output = body;
+    writer.capacity = cbBody;
+    writer.position = 0;
+    writer.overflow = false;
+    return writer;
+}
+
+/// <summary>
+/// Write the empty auxiliary buffer that ends every request body, and return its size.
+/// </summary>
+static long EndBody(BodyWriter &writer, unsigned long *pcbBody)
+{
+    writer.PutULong(0);
+    if (writer.overflow)
+    {
+        return ERROR_INSUFFICIENT_BUFFER;
+    }
+
+    *pcbBody = writer.position;
+    return 0;
+}
+
+/// <summary>
+/// Encode the body of a QueryRows request, as specified in MS-OXCMAPIHTTP section 2.2.5.11.
+/// </summary>
+/// <param name="dwFlags">The Flags of NspiQueryRows.</param>
+/// <param name="pStat">The STAT of the table, or NULL.</param>
+/// <param name="dwETableCount">The number of Minimal Entry IDs in lpETable.</param>
+/// <param name="lpETable">The explicit table, or NULL.</param>
+/// <param name="Count">The number of rows to return.</param>
+/// <param name="pPropTags">The columns to return, or NULL for the default columns.</param>
+/// <param name="body">The buffer to write the body to.</param>
+/// <param name="cbBody">The size of the buffer.</param>
+/// <param name="pcbBody">Receives the size of the body.</param>
+/// <returns>If success, it returns 0. ERROR_INSUFFICIENT_BUFFER indicates the body does not fit in cbBody bytes.</returns>
+long __stdcall NspiHttpEncodeQueryRows(
+    DWORD dwFlags,
+    STAT *pStat,
+    DWORD dwETableCount,
+    DWORD *lpETable,
+    DWORD Count,
+    PropertyTagArray_r *pPropTags,
+    unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pcbBody)
+{
+    if (body == NULL || pcbBody == NULL || (lpETable == NULL && dwETableCount != 0))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    BodyWriter writer = BeginBody(body, cbBody);
+    writer.PutULong(dwFlags);
+    PutState(writer, pStat);
+    writer.PutULong(dwETableCount);
+    for (DWORD i = 0; i < dwETableCount; i++)
+    {
+        writer.PutULong(lpETable[i]);
+    }
+
+    writer.PutULong(Count);
+    PutTagArray(writer, pPropTags);
+    return EndBody(writer, pcbBody);
+}
+
+/// <summary>
+/// Encode the body of a SeekEntries request, as specified in MS-OXCMAPIHTTP section 2.2.5.15.
+/// </summary>
+/// <param name="pStat">The STAT of the table, or NULL.</param>
+/// <param name="pTarget">The value to seek to.</param>
+/// <param name="lpETable">The explicit table, or NULL.</param>
+/// <param name="pPropTags">The columns to return, or NULL.</param>
+/// <param name="body">The buffer to write the body to.</param>
+/// <param name="cbBody">The size of the buffer.</param>
+/// <param name="pcbBody">Receives the size of the body.</param>
+/// <returns>If success, it returns 0. ERROR_INSUFFICIENT_BUFFER indicates the body does not fit in cbBody bytes.</returns>
+long __stdcall NspiHttpEncodeSeekEntries(
+    STAT *pStat,
+    PropertyValue_r *pTarget,
+    PropertyTagArray_r *lpETable,
+    PropertyTagArray_r *pPropTags,
+    unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pcbBody)
+{
+    if (body == NULL || pcbBody == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    BodyWriter writer = BeginBody(body, cbBody);
+    writer.PutULong(0);
+    PutState(writer, pStat);
+    writer.PutBool(pTarget != NULL);
+    if (pTarget != NULL)
+    {
+        long status = PutTaggedValue(writer, pTarget);
+        if (status != 0)
+        {
+            return status;
+        }
+    }
+
+    PutTagArray(writer, lpETable);
+    PutTagArray(writer, pPropTags);
+    return EndBody(writer, pcbBody);
+}
+
+/// <summary>
+/// Encode the body of a GetMatches request, as specified in MS-OXCMAPIHTTP section 2.2.5.5.
+/// </summary>
+/// <param name="pStat">The STAT of the table, or NULL.</param>
+/// <param name="pInMIds">The Minimal Entry IDs to restrict, or NULL.</param>
+/// <param name="ulInterfaceOptions">The Reserved2 of NspiGetMatches.</param>
+/// <param name="Filter">The restriction, or NULL.</param>
+/// <param name="lpPropName">The property name of a table property, or NULL.</param>
+/// <param name="ulRequested">The number of rows to return.</param>
+/// <param name="pPropTags">The columns to return, or NULL.</param>
+/// <param name="body">The buffer to write the body to.</param>
+/// <param name="cbBody">The size of the buffer.</param>
+/// <param name="pcbBody">Receives the size of the body.</param>
+/// <returns>If success, it returns 0. ERROR_INSUFFICIENT_BUFFER indicates the body does not fit in cbBody bytes.</returns>
+long __stdcall NspiHttpEncodeGetMatches(
+    STAT *pStat,
+    PropertyTagArray_r *pInMIds,
+    DWORD ulInterfaceOptions,
+    Restriction_r *Filter,
+    PropertyName_r *lpPropName,
+    DWORD ulRequested,
+    PropertyTagArray_r *pPropTags,
+    unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pcbBody)
+{
+    if (body == NULL || pcbBody == NULL || (lpPropName != NULL && lpPropName->lpguid == NULL))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    BodyWriter writer = BeginBody(body, cbBody);
+    writer.PutULong(0);
+    PutState(writer, pStat);
+    PutTagArray(writer, pInMIds);
+    writer.PutULong(ulInterfaceOptions);
+    writer.PutBool(Filter != NULL);
+    if (Filter != NULL)
+    {
+        long status = PutRestriction(writer, Filter, 0);
+        if (status != 0)
+        {
+            return status;
+        }
+    }
+
+    writer.PutBool(lpPropName != NULL);
+    if (lpPropName != NULL)
+    {
+        writer.PutBytes(lpPropName->lpguid->ab, sizeof(lpPropName->lpguid->ab));
+        writer.PutULong((unsigned long)lpPropName->lID);
+    }
+
+    writer.PutULong(ulRequested);
+    PutTagArray(writer, pPropTags);
+    return EndBody(writer, pcbBody);
+}
+
+/// <summary>
+/// Encode the body of a ResolveNames request, as specified in MS-OXCMAPIHTTP section 2.2.5.14.
+/// </summary>
+/// <param name="pStat">The STAT of the request, or NULL.</param>
+/// <param name="pPropTags">The columns to return, or NULL.</param>
+/// <param name="paWStr">The names to resolve, or NULL.</param>
+/// <param name="body">The buffer to write the body to.</param>
+/// <param name="cbBody">The size of the buffer.</param>
+/// <param name="pcbBody">Receives the size of the body.</param>
+/// <returns>If success, it returns 0. ERROR_INSUFFICIENT_BUFFER indicates the body does not fit in cbBody bytes.</returns>
+long __stdcall NspiHttpEncodeResolveNames(
+    STAT *pStat,
+    PropertyTagArray_r *pPropTags,
+    WStringsArray_r *paWStr,
+    unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pcbBody)
+{
+    if (body == NULL || pcbBody == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    BodyWriter writer = BeginBody(body, cbBody);
+    writer.PutULong(0);
+    PutState(writer, pStat);
+    PutTagArray(writer, pPropTags);
+    writer.PutBool(paWStr != NULL);
+    if (paWStr != NULL)
+    {
+        writer.PutULong(paWStr->Count);
+        for (DWORD i = 0; i < paWStr->Count; i++)
+        {
+            writer.PutWideString(paWStr->Strings[i] == NULL ? L"" : paWStr->Strings[i]);
+        }
+    }
+
+    return EndBody(writer, pcbBody);
+}
+
+/// <summary>
+/// Encode the body of a GetProps request, as specified in MS-OXCMAPIHTTP section 2.2.5.7.
+/// </summary>
+/// <param name="dwFlags">The Flags of NspiGetProps.</param>
+/// <param name="pStat">The STAT whose CurrentRec is the object, or NULL.</param>
+/// <param name="pPropTags">The properties to return, or NULL for all of them.</param>
+/// <param name="body">The buffer to write the body to.</param>
+/// <param name="cbBody">The size of the buffer.</param>
+/// <param name="pcbBody">Receives the size of the body.</param>
+/// <returns>If success, it returns 0. ERROR_INSUFFICIENT_BUFFER indicates the body does not fit in cbBody bytes.</returns>
+long __stdcall NspiHttpEncodeGetProps(
+    DWORD dwFlags,
+    STAT *pStat,
+    PropertyTagArray_r *pPropTags,
+    unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pcbBody)
+{
+    if (body == NULL || pcbBody == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    BodyWriter writer = BeginBody(body, cbBody);
+    writer.PutULong(dwFlags);
+    PutState(writer, pStat);
+    PutTagArray(writer, pPropTags);
+    return EndBody(writer, pcbBody);
+}
+
+/// <summary>
+/// Encode the body of a GetSpecialTable request, as specified in MS-OXCMAPIHTTP section 2.2.5.8.
+/// </summary>
+/// <param name="dwFlags">The Flags of NspiGetSpecialTable.</param>
+/// <param name="pStat">The STAT of the request, or NULL.</param>
+/// <param name="lpVersion">The version of the hierarchy table the client has, or NULL.</param>
+/// <param name="body">The buffer to write the body to.</param>
+/// <param name="cbBody">The size of the buffer.</param>
+/// <param name="pcbBody">Receives the size of the body.</param>
+/// <returns>If success, it returns 0. ERROR_INSUFFICIENT_BUFFER indicates the body does not fit in cbBody bytes.</returns>
+long __stdcall NspiHttpEncodeGetSpecialTable(
+    DWORD dwFlags,
+    STAT *pStat,
+    DWORD *lpVersion,
+    unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pcbBody)
+{
+    if (body == NULL || pcbBody == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    BodyWriter writer = BeginBody(body, cbBody);
+    writer.PutULong(dwFlags);
+    PutState(writer, pStat);
+    writer.PutBool(lpVersion != NULL);
+    if (lpVersion != NULL)
+    {
+        writer.PutULong(*lpVersion);
+    }
+
+    return EndBody(writer, pcbBody);
+}
+
+static void GetState(BodyReader &reader, STAT *pStat)
+{
+    if (!reader.GetBool())
+    {
+        return;
+    }
+
+    STAT stat;
+    stat.SortType = reader.GetULong();
+    stat.ContainerID = reader.GetULong();
+    stat.CurrentRec = reader.GetULong();
+    stat.Delta = (long)reader.GetULong();
+    stat.NumPos = reader.GetULong();
+    stat.TotalRecs = reader.GetULong();
+    stat.CodePage = reader.GetULong();
+    stat.TemplateLocale = reader.GetULong();
+    stat.SortLocale = reader.GetULong();
+    if (pStat != NULL && !reader.malformed)
+    {
+        *pStat = stat;
+    }
+}
+
+/// <summary>
+/// Copy count bytes of the body to the block.
+/// </summary>
+static void *CopyBytes(BodyReader &reader, FlatBlock &block, unsigned long count)
+{
+    const unsigned char *bytes = reader.GetBytes(count);
+    void *to = block.Take(count);
+    if (to != NULL && bytes != NULL)
+    {
+        memcpy(to, bytes, count);
+    }
+
+    return to;
+}
+
+static unsigned char *GetString8(BodyReader &reader, FlatBlock &block)
+{
+    const unsigned char *start = reader.input + reader.position;
+    const unsigned char *end = reader.malformed ? NULL : (const unsigned char *)memchr(start, 0, reader.Remaining());
+    if (end == NULL)
+    {
+        reader.malformed = true;
+        return NULL;
+    }
+
+    return (unsigned char *)CopyBytes(reader, block, (unsigned long)(end - start) + 1);
+}
+
+/// <summary>
+/// Copy a null-terminated UTF-16 string of the body to the block as a wchar_t string.
+/// </summary>
+static wchar_t *GetWideString(BodyReader &reader, FlatBlock &block)
+{
+    unsigned long length = 0;
+    for (;;)
+    {
+        if (reader.malformed || reader.Remaining() - length * 2 < 2)
+        {
+            reader.malformed = true;
+            return NULL;
+        }
+
+        const unsigned char *at = reader.input + reader.position + length * 2;
+        if (at[0] == 0 && at[1] == 0)
+        {
+            break;
+        }
+
+        length++;
+    }
+
+    wchar_t *to = (wchar_t *)block.Take(length + 1, sizeof(wchar_t));
+    for (unsigned long i = 0; i <= length; i++)
+    {
+        unsigned short value = reader.GetUShort();
+        if (to != NULL)
+        {
+            to[i] = (wchar_t)value;
+        }
+    }
+
+    return to;
+}
+
+static void GetBinary(BodyReader &reader, FlatBlock &block, Binary_r &value)
+{
+    value.cb = reader.GetCount(1);
+    value.lpb = (BYTE *)CopyBytes(reader, block, value.cb);
+}
+
+static void GetFileTime(BodyReader &reader, FILETIME &value)
+{
+    value.dwLowDateTime = reader.GetULong();
+    value.dwHighDateTime = reader.GetULong();
+}
+
+/// <summary>
+/// Read an AddressBookPropertyValue of the given type into value, and the data it points to into the block.
+/// </summary>
+/// <returns>If success, it returns 0. ERROR_INVALID_DATA indicates a malformed value or a type that PROP_VAL_UNION cannot hold.</returns>
+static long GetValue(BodyReader &reader, FlatBlock &block, DWORD type, PROP_VAL_UNION &value)
+{
+    memset(&value, 0, sizeof(value));
+    if (type == PtypString8 || type == PtypString || type == PtypBinary || (type & PtypMultipleFlag) != 0)
+    {
+        unsigned char hasValue = reader.GetByte();
+        if (hasValue == HasValueAbsent)
+        {
+            return reader.malformed ? ERROR_INVALID_DATA : 0;
+        }
+
+        if (hasValue != HasValuePresent)
+        {
+            return ERROR_INVALID_DATA;
+        }
+    }
+
+    unsigned long count = 0;
+    switch (type)
+    {
+    case PtypNull:
+        break;
+    case PtypInteger16:
+        value.i = (short)reader.GetUShort();
+        break;
+    case PtypInteger32:
+        value.l = (long)reader.GetULong();
+        break;
+    case PtypErrorCode:
+        value.err = (long)reader.GetULong();
+        break;
+    case PtypBoolean:
+        value.b = reader.GetByte();
+        break;
+    case PtypTime:
+        GetFileTime(reader, value.ft);
+        break;
+    case PtypGuid:
+        value.lpguid = (FlatUID_r *)CopyBytes(reader, block, sizeof(FlatUID_r));
+        break;
+    case PtypString8:
+        value.lpszA = GetString8(reader, block);
+        break;
+    case PtypString:
+        value.lpszW = GetWideString(reader, block);
+        break;
+    case PtypBinary:
+        GetBinary(reader, block, value.bin);
+        break;
+    case PtypMultipleFlag | PtypInteger16:
+        count = reader.GetCount(2);
+        value.MVi.cValues = count;
+        value.MVi.lpi = (short *)block.Take(count, sizeof(short));
+        for (unsigned long i = 0; i < count; i++)
+        {
+            short item = (short)reader.GetUShort();
+            if (value.MVi.lpi != NULL)
+            {
+                value.MVi.lpi[i] = item;
+            }
+        }
+
+        break;
+    case PtypMultipleFlag | PtypInteger32:
+        count = reader.GetCount(4);
+        value.MVl.cValues = count;
+        value.MVl.lpl = (long *)block.Take(count, sizeof(long));
+        for (unsigned long i = 0; i < count; i++)
+        {
+            long item = (long)reader.GetULong();
+            if (value.MVl.lpl != NULL)
+            {
+                value.MVl.lpl[i] = item;
+            }
+        }
+
+        break;
+    case PtypMultipleFlag | PtypString8:
+        count = reader.GetCount(1);
+        value.MVszA.cValues = count;
+        value.MVszA.lppszA = (unsigned char **)block.Take(count, sizeof(unsigned char *));
+        for (unsigned long i = 0; i < count; i++)
+        {
+            unsigned char *item = GetString8(reader, block);
+            if (value.MVszA.lppszA != NULL)
+            {
+                value.MVszA.lppszA[i] = item;
+            }
+        }
+
+        break;
+    case PtypMultipleFlag | PtypString:
+        count = reader.GetCount(2);
+        value.MVszW.cValues = count;
+        value.MVszW.lppszW = (wchar_t **)block.Take(count, sizeof(wchar_t *));
+        for (unsigned long i = 0; i < count; i++)
+        {
+            wchar_t *item = GetWideString(reader, block);
+            if (value.MVszW.lppszW != NULL)
+            {
+                value.MVszW.lppszW[i] = item;
+            }
+        }
+
+        break;
+    case PtypMultipleFlag | PtypBinary:
+        count = reader.GetCount(4);
+        value.MVbin.cValues = count;
+        value.MVbin.lpbin = (Binary_r *)block.Take(count, sizeof(Binary_r));
+        for (unsigned long i = 0; i < count; i++)
+        {
+            Binary_r item;
+            GetBinary(reader, block, item);
+            if (value.MVbin.lpbin != NULL)
+            {
+                value.MVbin.lpbin[i] = item;
+            }
+        }
+
+        break;
+    case PtypMultipleFlag | PtypGuid:
+        count = reader.GetCount(sizeof(FlatUID_r));
+        value.MVguid.cValues = count;
+        value.MVguid.lpguid = (FlatUID_r **)block.Take(count, sizeof(FlatUID_r *));
+        for (unsigned long i = 0; i < count; i++)
+        {
+            FlatUID_r *item = (FlatUID_r *)CopyBytes(reader, block, sizeof(FlatUID_r));
+            if (value.MVguid.lpguid != NULL)
+            {
+                value.MVguid.lpguid[i] = item;
+            }
+        }
+
+        break;
+    case PtypMultipleFlag | PtypTime:
+        count = reader.GetCount(8);
+        value.MVft.cValues = count;
+        value.MVft.lpft = (FILETIME *)block.Take(count, sizeof(FILETIME));
+        for (unsigned long i = 0; i < count; i++)
+        {
+            FILETIME item;
+            GetFileTime(reader, item);
+            if (value.MVft.lpft != NULL)
+            {
+                value.MVft.lpft[i] = item;
+            }
+        }
+
+        break;
+    default:
+        return ERROR_INVALID_DATA;
+    }
+
+    return reader.malformed ? ERROR_INVALID_DATA : 0;
+}
+
+/// <summary>
+/// Read an AddressBookPropertyRow of the given columns into row, as specified in MS-OXCMAPIHTTP section 2.2.1.7.
+/// A column the server has no value for becomes a PtypErrorCode value of MapiErrorNotFound, as over RPC.
+/// </summary>
+static long GetPropertyRow(BodyReader &reader, FlatBlock &block, const unsigned char *columns, unsigned long columnCount, PropertyRow_r &row)
+{
+    unsigned char rowFlag = reader.GetByte();
+    if (reader.malformed || (rowFlag != RowFlagPlain && rowFlag != RowFlagFlagged))
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    row.Reserved = 0;
+    row.cValues = columnCount;
+    row.lpProps = (PropertyValue_r *)block.Take(columnCount, sizeof(PropertyValue_r));
+    for (unsigned long i = 0; i < columnCount; i++)
+    {
+        const unsigned char *column = columns + i * 4;
+        DWORD ulPropTag = (DWORD)column[0] | ((DWORD)column[1] << 8) | ((DWORD)column[2] << 16) | ((DWORD)column[3] << 24);
+        DWORD type = PROP_TYPE(ulPropTag);
+        if (type == PtypUnspecified)
+        {
+            type = reader.GetUShort();
+        }
+
+        unsigned char valueFlag = rowFlag == RowFlagFlagged ? reader.GetByte() : ValueFlagPresent;
+        PropertyValue_r value;
+        value.ulReserved = 0;
+        long status = 0;
+        switch (valueFlag)
+        {
+        case ValueFlagPresent:
+            value.ulPropTag = PROP_TAG(ulPropTag, type);
+            status = GetValue(reader, block, type, value.Value);
+            break;
+        case ValueFlagAbsent:
+            value.ulPropTag = PROP_TAG(ulPropTag, PtypErrorCode);
+            value.Value.err = MapiErrorNotFound;
+            break;
+        case ValueFlagError:
+            value.ulPropTag = PROP_TAG(ulPropTag, PtypErrorCode);
+            value.Value.err = (long)reader.GetULong();
+            break;
+        default:
+            status = ERROR_INVALID_DATA;
+            break;
+        }
+
+        if (status != 0 || reader.malformed)
+        {
+            return ERROR_INVALID_DATA;
+        }
+
+        if (row.lpProps != NULL)
+        {
+            row.lpProps[i] = value;
+        }
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Read an AddressBookPropValueList into row, as specified in MS-OXCMAPIHTTP section 2.2.1.3.
+/// </summary>
+static long GetPropertyValueList(BodyReader &reader, FlatBlock &block, PropertyRow_r &row)
+{
+    unsigned long count = reader.GetCount(4);
+    row.Reserved = 0;
+    row.cValues = count;
+    row.lpProps = (PropertyValue_r *)block.Take(count, sizeof(PropertyValue_r));
+    for (unsigned long i = 0; i < count; i++)
+    {
+        PropertyValue_r value;
+        value.ulPropTag = reader.GetULong();
+        value.ulReserved = 0;
+        if (reader.malformed || GetValue(reader, block, PROP_TYPE(value.ulPropTag), value.Value) != 0)
+        {
+            return ERROR_INVALID_DATA;
+        }
+
+        if (row.lpProps != NULL)
+        {
+            row.lpProps[i] = value;
+        }
+    }
+
+    return reader.malformed ? ERROR_INVALID_DATA : 0;
+}
+
+/// <summary>
+/// The layouts of the rows in a response body.
+/// </summary>
+enum RowLayout
+{
+    ColumnsAndRows,     // A LargePropTagArray, a RowCount and AddressBookPropertyRow structures, into a PropertyRowSet_r.
+    ValueLists,         // A RowCount and AddressBookPropValueList structures, into a PropertyRowSet_r.
+    ValueList           // One AddressBookPropValueList, into a PropertyRow_r.
+};
+
+static long GetRows(BodyReader &reader, FlatBlock &block, RowLayout layout)
+{
+    if (layout == ValueList)
+    {
+        PropertyRow_r row;
+        PropertyRow_r *to = (PropertyRow_r *)block.Take(sizeof(PropertyRow_r));
+        long status = GetPropertyValueList(reader, block, row);
+        if (to != NULL)
+        {
+            *to = row;
+        }
+
+        return status;
+    }
+
+    const unsigned char *columns = NULL;
+    unsigned long columnCount = 0;
+    if (layout == ColumnsAndRows)
+    {
+        columnCount = reader.GetCount(4);
+        columns = reader.GetBytes(columnCount * 4);
+    }
+
+    // Every row has at least its flag byte or its count.
+    unsigned long rowCount = reader.GetCount(layout == ColumnsAndRows ? 1 : 4);
+    if (reader.malformed || rowCount > MaxRowSetValues || (unsigned __int64)rowCount * columnCount > MaxRowSetValues)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    PropertyRowSet_r *rows = (PropertyRowSet_r *)block.Take(sizeof(PropertyRowSet_r) + (rowCount == 0 ? 0 : rowCount - 1) * sizeof(PropertyRow_r));
+    if (rows != NULL)
+    {
+        rows->cRows = rowCount;
+    }
+
+    for (unsigned long i = 0; i < rowCount; i++)
+    {
+        PropertyRow_r row;
+        long status = layout == ColumnsAndRows ? GetPropertyRow(reader, block, columns, columnCount, row) : GetPropertyValueList(reader, block, row);
+        if (status != 0)
+        {
+            return status;
+        }
+
+        if (rows != NULL)
+        {
+            rows->aRow[i] = row;
+        }
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Decode the rows at the position of the reader into one block from midl_user_allocate.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+static long DecodeRows(BodyReader &reader, RowLayout layout, void **ppRows)
+{
+    BodyReader start = reader;
+    FlatBlock block = { NULL, 0, false };
+    long status = GetRows(reader, block, layout);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    if (block.overflow)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    block.base = (unsigned char *)midl_user_allocate(block.size);
+    if (block.base == NULL)
+    {
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    // The body was read through once already, so the second pass cannot fail.
+    block.size = 0;
+    reader = start;
+    GetRows(reader, block, layout);
+    *ppRows = block.base;
+    return 0;
+}
+
+/// <summary>
+/// Read a HasMinimalIds, MinimalIdCount and MinimalIds into a PropertyTagArray_r from midl_user_allocate.
+/// </summary>
+static long DecodeMinimalIds(BodyReader &reader, PropertyTagArray_r **ppMIds)
+{
+    if (!reader.GetBool())
+    {
+        return reader.malformed ? ERROR_INVALID_DATA : 0;
+    }
+
+    unsigned long count = reader.GetCount(4);
+    const unsigned char *ids = reader.GetBytes(count * 4);
+    if (reader.malformed)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    PropertyTagArray_r *mids = (PropertyTagArray_r *)midl_user_allocate(sizeof(PropertyTagArray_r) + (count == 0 ? 0 : count - 1) * sizeof(DWORD));
+    if (mids == NULL)
+    {
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    mids->cValues = count;
+    for (unsigned long i = 0; i < count; i++)
+    {
+        const unsigned char *id = ids + i * 4;
+        mids->aulPropTag[i] = (DWORD)id[0] | ((DWORD)id[1] << 8) | ((DWORD)id[2] << 16) | ((DWORD)id[3] << 24);
+    }
+
+    *ppMIds = mids;
+    return 0;
+}
+
+/// <summary>
+/// Read the StatusCode and ErrorCode that start every response body. The other fields follow only if StatusCode is 0.
+/// </summary>
+/// <returns>True if the rest of the body is to be read.</returns>
+static bool GetResult(BodyReader &reader, unsigned long *pStatusCode, long *pErrorCode)
+{
+    *pStatusCode = reader.GetULong();
+    if (reader.malformed || *pStatusCode != 0)
+    {
+        *pErrorCode = 0;
+        return false;
+    }
+
+    *pErrorCode = (long)reader.GetULong();
+    return !reader.malformed;
+}
+
+static BodyReader BeginResponse(const unsigned char *body, unsigned long cbBody)
+{
+    BodyReader reader;
+    reader.input = body;
+    reader.size = cbBody;
+    reader.position = 0;
+    reader.malformed = false;
+    return reader;
+}
+
+/// <summary>
+/// Decode the body of a QueryRows or SeekEntries response; both carry a STAT and the columns and rows.
+/// </summary>
+static long DecodeStateAndRows(const unsigned char *body, unsigned long cbBody, unsigned long *pStatusCode, long *pErrorCode, STAT *pStat, PropertyRowSet_r **ppRows)
+{
+    if (body == NULL || pStatusCode == NULL || pErrorCode == NULL || ppRows == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    *ppRows = NULL;
+    BodyReader reader = BeginResponse(body, cbBody);
+    if (!GetResult(reader, pStatusCode, pErrorCode))
+    {
+        return reader.malformed ? ERROR_INVALID_DATA : 0;
+    }
+
+    GetState(reader, pStat);
+    if (!reader.GetBool())
+    {
+        return reader.malformed ? ERROR_INVALID_DATA : 0;
+    }
+
+    return DecodeRows(reader, ColumnsAndRows, (void **)ppRows);
+}
+
+/// <summary>
+/// Decode the body of a QueryRows response, as specified in MS-OXCMAPIHTTP section 2.2.5.11.
+/// </summary>
+/// <param name="body">The response body, after its meta-tags and additional headers.</param>
+/// <param name="cbBody">The size of the response body.</param>
+/// <param name="pStatusCode">Receives the StatusCode of the response; if it is not 0, no other output is set.</param>
+/// <param name="pErrorCode">Receives the ErrorCode of the response, the value NspiQueryRows returns.</param>
+/// <param name="pStat">Receives the STAT of the response, if it has one; can be NULL.</param>
+/// <param name="ppRows">Receives the rows in one block to free with NspiHttpFreeRowSet, or NULL if the response has none.</param>
+/// <returns>If success, it returns 0. ERROR_INVALID_DATA indicates a malformed body.</returns>
+long __stdcall NspiHttpDecodeQueryRows(
+    const unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pStatusCode,
+    long *pErrorCode,
+    STAT *pStat,
+    PropertyRowSet_r **ppRows)
+{
+    return DecodeStateAndRows(body, cbBody, pStatusCode, pErrorCode, pStat, ppRows);
+}
+
+/// <summary>
+/// Decode the body of a SeekEntries response, as specified in MS-OXCMAPIHTTP section 2.2.5.15.
+/// </summary>
+/// <param name="body">The response body, after its meta-tags and additional headers.</param>
+/// <param name="cbBody">The size of the response body.</param>
+/// <param name="pStatusCode">Receives the StatusCode of the response; if it is not 0, no other output is set.</param>
+/// <param name="pErrorCode">Receives the ErrorCode of the response, the value NspiSeekEntries returns.</param>
+/// <param name="pStat">Receives the STAT of the response, if it has one; can be NULL.</param>
+/// <param name="ppRows">Receives the rows in one block to free with NspiHttpFreeRowSet, or NULL if the response has none.</param>
+/// <returns>If success, it returns 0. ERROR_INVALID_DATA indicates a malformed body.</returns>
+long __stdcall NspiHttpDecodeSeekEntries(
+    const unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pStatusCode,
+    long *pErrorCode,
+    STAT *pStat,
+    PropertyRowSet_r **ppRows)
+{
+    return DecodeStateAndRows(body, cbBody, pStatusCode, pErrorCode, pStat, ppRows);
+}
+
+/// <summary>
+/// Decode the body of a GetMatches response, as specified in MS-OXCMAPIHTTP section 2.2.5.5.
+/// </summary>
+/// <param name="body">The response body, after its meta-tags and additional headers.</param>
+/// <param name="cbBody">The size of the response body.</param>
+/// <param name="pStatusCode">Receives the StatusCode of the response; if it is not 0, no other output is set.</param>
+/// <param name="pErrorCode">Receives the ErrorCode of the response, the value NspiGetMatches returns.</param>
+/// <param name="pStat">Receives the STAT of the response, if it has one; can be NULL.</param>
+/// <param name="ppOutMIds">Receives the Minimal Entry IDs to free with NspiFreeBuffer, or NULL if the response has none.</param>
+/// <param name="ppRows">Receives the rows in one block to free with NspiHttpFreeRowSet, or NULL if the response has none.</param>
+/// <returns>If success, it returns 0. ERROR_INVALID_DATA indicates a malformed body.</returns>
+long __stdcall NspiHttpDecodeGetMatches(
+    const unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pStatusCode,
+    long *pErrorCode,
+    STAT *pStat,
+    PropertyTagArray_r **ppOutMIds,
+    PropertyRowSet_r **ppRows)
+{
+    if (body == NULL || pStatusCode == NULL || pErrorCode == NULL || ppOutMIds == NULL || ppRows == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    *ppOutMIds = NULL;
+    *ppRows = NULL;
+    BodyReader reader = BeginResponse(body, cbBody);
+    if (!GetResult(reader, pStatusCode, pErrorCode))
+    {
+        return reader.malformed ? ERROR_INVALID_DATA : 0;
+    }
+
+    GetState(reader, pStat);
+    long status = DecodeMinimalIds(reader, ppOutMIds);
+    if (status == 0 && reader.GetBool())
+    {
+        status = DecodeRows(reader, ColumnsAndRows, (void **)ppRows);
+    }
+
+    if (status == 0 && reader.malformed)
+    {
+        status = ERROR_INVALID_DATA;
+    }
+
+    if (status != 0)
+    {
+        midl_user_free(*ppOutMIds);
+        *ppOutMIds = NULL;
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Decode the body of a ResolveNames response, as specified in MS-OXCMAPIHTTP section 2.2.5.14.
+/// </summary>
+/// <param name="body">The response body, after its meta-tags and additional headers.</param>
+/// <param name="cbBody">The size of the response body.</param>
+/// <param name="pStatusCode">Receives the StatusCode of the response; if it is not 0, no other output is set.</param>
+/// <param name="pErrorCode">Receives the ErrorCode of the response, the value NspiResolveNamesW returns.</param>
+/// <param name="pCodePage">Receives the code page of the response; can be NULL.</param>
+/// <param name="ppMIds">Receives the Minimal Entry IDs to free with NspiFreeBuffer, or NULL if the response has none.</param>
+/// <param name="ppRows">Receives the rows in one block to free with NspiHttpFreeRowSet, or NULL if the response has none.</param>
+/// <returns>If success, it returns 0. ERROR_INVALID_DATA indicates a malformed body.</returns>
+long __stdcall NspiHttpDecodeResolveNames(
+    const unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pStatusCode,
+    long *pErrorCode,
+    DWORD *pCodePage,
+    PropertyTagArray_r **ppMIds,
+    PropertyRowSet_r **ppRows)
+{
+    if (body == NULL || pStatusCode == NULL || pErrorCode == NULL || ppMIds == NULL || ppRows == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    *ppMIds = NULL;
+    *ppRows = NULL;
+    BodyReader reader = BeginResponse(body, cbBody);
+    if (!GetResult(reader, pStatusCode, pErrorCode))
+    {
+        return reader.malformed ? ERROR_INVALID_DATA : 0;
+    }
+
+    DWORD codePage = reader.GetULong();
+    if (pCodePage != NULL)
+    {
+        *pCodePage = codePage;
+    }
+
+    long status = reader.malformed ? ERROR_INVALID_DATA : DecodeMinimalIds(reader, ppMIds);
+    if (status == 0 && reader.GetBool())
+    {
+        status = DecodeRows(reader, ColumnsAndRows, (void **)ppRows);
+    }
+
+    if (status == 0 && reader.malformed)
+    {
+        status = ERROR_INVALID_DATA;
+    }
+
+    if (status != 0)
+    {
+        midl_user_free(*ppMIds);
+        *ppMIds = NULL;
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Decode the body of a GetProps response, as specified in MS-OXCMAPIHTTP section 2.2.5.7.
+/// </summary>
+/// <param name="body">The response body, after its meta-tags and additional headers.</param>
+/// <param name="cbBody">The size of the response body.</param>
+/// <param name="pStatusCode">Receives the StatusCode of the response; if it is not 0, no other output is set.</param>
+/// <param name="pErrorCode">Receives the ErrorCode of the response, the value NspiGetProps returns.</param>
+/// <param name="pCodePage">Receives the code page of the response; can be NULL.</param>
+/// <param name="ppRows">Receives the properties in one block to free with NspiHttpFreeRow, or NULL if the response has none.</param>
+/// <returns>If success, it returns 0. ERROR_INVALID_DATA indicates a malformed body.</returns>
+long __stdcall NspiHttpDecodeGetProps(
+    const unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pStatusCode,
+    long *pErrorCode,
+    DWORD *pCodePage,
+    PropertyRow_r **ppRows)
+{
+    if (body == NULL || pStatusCode == NULL || pErrorCode == NULL || ppRows == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    *ppRows = NULL;
+    BodyReader reader = BeginResponse(body, cbBody);
+    if (!GetResult(reader, pStatusCode, pErrorCode))
+    {
+        return reader.malformed ? ERROR_INVALID_DATA : 0;
+    }
+
+    DWORD codePage = reader.GetULong();
+    if (pCodePage != NULL)
+    {
+        *pCodePage = codePage;
+    }
+
+    if (!reader.GetBool())
+    {
+        return reader.malformed ? ERROR_INVALID_DATA : 0;
+    }
+
+    return DecodeRows(reader, ValueList, (void **)ppRows);
+}
+
+/// <summary>
+/// Decode the body of a GetSpecialTable response, as specified in MS-OXCMAPIHTTP section 2.2.5.8.
+/// </summary>
+/// <param name="body">The response body, after its meta-tags and additional headers.</param>
+/// <param name="cbBody">The size of the response body.</param>
+/// <param name="pStatusCode">Receives the StatusCode of the response; if it is not 0, no other output is set.</param>
+/// <param name="pErrorCode">Receives the ErrorCode of the response, the value NspiGetSpecialTable returns.</param>
+/// <param name="pCodePage">Receives the code page of the response; can be NULL.</param>
+/// <param name="lpVersion">Receives the version of the hierarchy table, if the response has one; can be NULL.</param>
+/// <param name="ppRows">Receives the rows in one block to free with NspiHttpFreeRowSet, or NULL if the response has none.</param>
+/// <returns>If success, it returns 0. ERROR_INVALID_DATA indicates a malformed body.</returns>
+long __stdcall NspiHttpDecodeGetSpecialTable(
+    const unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pStatusCode,
+    long *pErrorCode,
+    DWORD *pCodePage,
+    DWORD *lpVersion,
+    PropertyRowSet_r **ppRows)
+{
+    if (body == NULL || pStatusCode == NULL || pErrorCode == NULL || ppRows == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    *ppRows = NULL;
+    BodyReader reader = BeginResponse(body, cbBody);
+    if (!GetResult(reader, pStatusCode, pErrorCode))
+    {
+        return reader.malformed ? ERROR_INVALID_DATA : 0;
+    }
+
+    DWORD codePage = reader.GetULong();
+    if (pCodePage != NULL)
+    {
+        *pCodePage = codePage;
+    }
+
+    if (reader.GetBool())
+    {
+        DWORD version = reader.GetULong();
+        if (lpVersion != NULL)
+        {
+            *lpVersion = version;
+        }
+    }
+
+    if (!reader.GetBool())
+    {
+        return reader.malformed ? ERROR_INVALID_DATA : 0;
+    }
+
+    return DecodeRows(reader, ValueLists, (void **)ppRows);
+}
+
+/// <summary>
+/// Free the row of NspiHttpDecodeGetProps, which is a single block.
+/// </summary>
+/// <param name="row">The output, or NULL.</param>
+void __stdcall NspiHttpFreeRow(PropertyRow_r *row)
+{
+    if (row != NULL)
+    {
+        midl_user_free(row);
+    }
+}
+
+/// <summary>
+/// Free the rows of an NspiHttpDecode routine, which are a single block.
+/// </summary>
+/// <param name="rows">The output, or NULL.</param>
+void __stdcall NspiHttpFreeRowSet(PropertyRowSet_r *rows)
+{
+    if (rows != NULL)
+    {
+        midl_user_free(rows);
+    }
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "MS-OXNSPI.h"
+
+long __stdcall NspiHttpEncodeQueryRows(
+    DWORD dwFlags,
+    STAT *pStat,
+    DWORD dwETableCount,
+    DWORD *lpETable,
+    DWORD Count,
+    PropertyTagArray_r *pPropTags,
+    unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pcbBody);
+
+long __stdcall NspiHttpEncodeSeekEntries(
+    STAT *pStat,
+    PropertyValue_r *pTarget,
+    PropertyTagArray_r *lpETable,
+    PropertyTagArray_r *pPropTags,
+    unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pcbBody);
+
+long __stdcall NspiHttpEncodeGetMatches(
+    STAT *pStat,
+    PropertyTagArray_r *pInMIds,
+    DWORD ulInterfaceOptions,
+    Restriction_r *Filter,
+    PropertyName_r *lpPropName,
+    DWORD ulRequested,
+    PropertyTagArray_r *pPropTags,
+    unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pcbBody);
+
+long __stdcall NspiHttpEncodeResolveNames(
+    STAT *pStat,
+    PropertyTagArray_r *pPropTags,
+    WStringsArray_r *paWStr,
+    unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pcbBody);
+
+long __stdcall NspiHttpEncodeGetProps(
+    DWORD dwFlags,
+    STAT *pStat,
+    PropertyTagArray_r *pPropTags,
+    unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pcbBody);
+
+long __stdcall NspiHttpEncodeGetSpecialTable(
+    DWORD dwFlags,
+    STAT *pStat,
+    DWORD *lpVersion,
+    unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pcbBody);
+
+long __stdcall NspiHttpDecodeQueryRows(
+    const unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pStatusCode,
+    long *pErrorCode,
+    STAT *pStat,
+    PropertyRowSet_r **ppRows);
+
+long __stdcall NspiHttpDecodeSeekEntries(
+    const unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pStatusCode,
+    long *pErrorCode,
+    STAT *pStat,
+    PropertyRowSet_r **ppRows);
+
+long __stdcall NspiHttpDecodeGetMatches(
+    const unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pStatusCode,
+    long *pErrorCode,
+    STAT *pStat,
+    PropertyTagArray_r **ppOutMIds,
+    PropertyRowSet_r **ppRows);
+
+long __stdcall NspiHttpDecodeResolveNames(
+    const unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pStatusCode,
+    long *pErrorCode,
+    DWORD *pCodePage,
+    PropertyTagArray_r **ppMIds,
+    PropertyRowSet_r **ppRows);
+
+long __stdcall NspiHttpDecodeGetProps(
+    const unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pStatusCode,
+    long *pErrorCode,
+    DWORD *pCodePage,
+    PropertyRow_r **ppRows);
+
+long __stdcall NspiHttpDecodeGetSpecialTable(
+    const unsigned char *body,
+    unsigned long cbBody,
+    unsigned long *pStatusCode,
+    long *pErrorCode,
+    DWORD *pCodePage,
+    DWORD *lpVersion,
+    PropertyRowSet_r **ppRows);
+
+void __stdcall NspiHttpFreeRow(PropertyRow_r *row);
+
+void __stdcall NspiHttpFreeRowSet(PropertyRowSet_r *rows);
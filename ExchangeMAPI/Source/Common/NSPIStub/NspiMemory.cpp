@@ -0,0 +1,146 @@
+#include "NspiMemory.h"
+
+// Release of the [out] parameters of the NSPI methods. The RPC runtime allocates each pointer of an output with
+// midl_user_allocate of this DLL, so a caller in another module cannot free them itself without sharing its heap;
+// these routines walk the structures and free every block with midl_user_free.
+
+/// <summary>
+/// Free the blocks a property value points to, by the property type in the low word of its tag.
+/// </summary>
+static void FreePropertyValue(PropertyValue_r *value)
+{
+    switch (value->ulPropTag & 0xFFFF)
+    {
+    case 0x001E:    // PtypString8
+        midl_user_free(value->Value.lpszA);
+        break;
+    case 0x001F:    // PtypString
+        midl_user_free(value->Value.lpszW);
+        break;
+    case 0x0048:    // PtypGuid
+        midl_user_free(value->Value.lpguid);
+        break;
+    case 0x0102:    // PtypBinary
+        midl_user_free(value->Value.bin.lpb);
+        break;
+    case 0x1002:    // PtypMultipleInteger16
+        midl_user_free(value->Value.MVi.lpi);
+        break;
+    case 0x1003:    // PtypMultipleInteger32
+        midl_user_free(value->Value.MVl.lpl);
+        break;
+    case 0x1040:    // PtypMultipleTime
+        midl_user_free(value->Value.MVft.lpft);
+        break;
+    case 0x101E:    // PtypMultipleString8
+        if (value->Value.MVszA.lppszA != NULL)
+        {
+            for (DWORD i = 0; i < value->Value.MVszA.cValues; i++)
+            {
+                midl_user_free(value->Value.MVszA.lppszA[i]);
+            }
+        }
+
+        midl_user_free(value->Value.MVszA.lppszA);
+        break;
+    case 0x101F:    // PtypMultipleString
+        if (value->Value.MVszW.lppszW != NULL)
+        {
+            for (DWORD i = 0; i < value->Value.MVszW.cValues; i++)
+            {
+                midl_user_free(value->Value.MVszW.lppszW[i]);
+            }
+        }
+
+        midl_user_free(value->Value.MVszW.lppszW);
+        break;
+    case 0x1048:    // PtypMultipleGuid
+        if (value->Value.MVguid.lpguid != NULL)
+        {
+            for (DWORD i = 0; i < value->Value.MVguid.cValues; i++)
+            {
+                midl_user_free(value->Value.MVguid.lpguid[i]);
+            }
+        }
+
+        midl_user_free(value->Value.MVguid.lpguid);
+        break;
+    case 0x1102:    // PtypMultipleBinary
+        if (value->Value.MVbin.lpbin != NULL)
+        {
+            for (DWORD i = 0; i < value->Value.MVbin.cValues; i++)
+            {
+                midl_user_free(value->Value.MVbin.lpbin[i].lpb);
+            }
+        }
+
+        midl_user_free(value->Value.MVbin.lpbin);
+        break;
+    default:
+        // The other types, PtypErrorCode included, are held in the union itself.
+        break;
+    }
+}
+
+/// <summary>
+/// Free the property values of a row, but not the row itself.
+/// </summary>
+static void FreeRowValues(PropertyRow_r *row)
+{
+    if (row->lpProps == NULL)
+    {
+        return;
+    }
+
+    for (DWORD i = 0; i < row->cValues; i++)
+    {
+        FreePropertyValue(&row->lpProps[i]);
+    }
+
+    midl_user_free(row->lpProps);
+}
+
+/// <summary>
+/// Free an output that is a single block, such as the PropertyTagArray_r of NspiDNToMId, NspiGetMatches or
+/// NspiResolveNamesW.
+/// </summary>
+/// <param name="buffer">The output, or NULL.</param>
+void __stdcall NspiFreeBuffer(void *buffer)
+{
+    if (buffer != NULL)
+    {
+        midl_user_free(buffer);
+    }
+}
+
+/// <summary>
+/// Free a PropertyRow_r output of an RPC method, such as the row of NspiGetProps, with its property values. The row of
+/// NspiHttpDecodeGetProps is a single block; free it with NspiHttpFreeRow.
+/// </summary>
+/// <param name="row">The output, or NULL.</param>
+void __stdcall NspiFreeRow(PropertyRow_r *row)
+{
+    if (row != NULL)
+    {
+        FreeRowValues(row);
+        midl_user_free(row);
+    }
+}
+
+/// <summary>
+/// Free a PropertyRowSet_r output of an RPC method, such as the rows of NspiQueryRows, with the property values of every
+/// row. The rows of an NspiHttpDecode routine are a single block; free them with NspiHttpFreeRowSet.
+/// </summary>
+/// <param name="rows">The output, or NULL.</param>
+void __stdcall NspiFreeRowSet(PropertyRowSet_r *rows)
+{
+    if (rows != NULL)
+    {
+        for (DWORD i = 0; i < rows->cRows; i++)
+        {
+            FreeRowValues(&rows->aRow[i]);
+        }
+
+        midl_user_free(rows);
+    }
+}
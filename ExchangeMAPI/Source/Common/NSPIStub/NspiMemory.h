@@ -0,0 +1,9 @@
+#pragma once
+
+#include "MS-OXNSPI.h"
+
+void __stdcall NspiFreeBuffer(void *buffer);
+
+void __stdcall NspiFreeRow(PropertyRow_r *row);
+
+void __stdcall NspiFreeRowSet(PropertyRowSet_r *rows);
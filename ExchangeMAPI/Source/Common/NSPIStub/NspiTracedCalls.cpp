@@ -0,0 +1,232 @@
+#include "MS-OXNSPI.h"
+#include "..\OXCRPCStub\StubTrace.h"
+
+// The NSPI methods as this stub exports them. Each routine traces the call around the client stub routine MIDL
+// generates, which stays as generated; MS-OXNSPI.def exports these routines under the names of the methods. A call
+// that raises an RPC exception is recorded as a fault once the handler has run, out of the filter, and the exception
+// is then raised again for the caller.
+
+/// <summary>
+/// Trace an NSPI call made on a context handle.
+/// </summary>
+/// <param name="opnum">The opnum of the method.</param>
+/// <param name="hRpc">The context handle the call is made on.</param>
+/// <param name="call">The call of the client stub routine.</param>
+/// <returns>The return value of the method.</returns>
+template <typename TCall>
+static long TraceCall(unsigned char opnum, NSPI_HANDLE hRpc, TCall call)
+{
+    long status = 0;
+    unsigned long exceptionCode = 0;
+    STUB_TRACE_CALL trace;
+
+    StubTraceBegin(&trace, STUB_TRACE_NSPI, opnum, hRpc, 0);
+    RpcTryExcept
+    {
+        status = call();
+    }
+    RpcExcept(RpcExceptionFilter(RpcExceptionCode()))
+    {
+        exceptionCode = RpcExceptionCode();
+    }
+    RpcEndExcept
+
+    if (exceptionCode != 0)
+    {
+        StubTraceFault(&trace, exceptionCode);
+        RpcRaiseException(exceptionCode);
+    }
+
+    StubTraceEnd(&trace, status, NULL, NULL, 0, 0);
+    return status;
+}
+
+/// <summary>
+/// Traced NspiBind, as specified in MS-OXNSPI section 3.1.4.1.1.
+/// </summary>
+extern "C" long TracedNspiBind(handle_t hRpc, DWORD dwFlags, STAT *pStat, FlatUID_r *pServerGuid, NSPI_HANDLE *contextHandle)
+{
+    long status = 0;
+    unsigned long exceptionCode = 0;
+    STUB_TRACE_CALL trace;
+
+    StubTraceBegin(&trace, STUB_TRACE_NSPI, 0, NULL, 0);
+    RpcTryExcept
+    {
+        status = NspiBind(hRpc, dwFlags, pStat, pServerGuid, contextHandle);
+    }
+    RpcExcept(RpcExceptionFilter(RpcExceptionCode()))
+    {
+        exceptionCode = RpcExceptionCode();
+    }
+    RpcEndExcept
+
+    if (exceptionCode != 0)
+    {
+        StubTraceFault(&trace, exceptionCode);
+        RpcRaiseException(exceptionCode);
+    }
+
+    StubTraceEnd(&trace, status, contextHandle != NULL ? *contextHandle : NULL, NULL, 0, 0);
+    return status;
+}
+
+/// <summary>
+/// Traced NspiUnbind, as specified in MS-OXNSPI section 3.1.4.1.2.
+/// </summary>
+extern "C" DWORD TracedNspiUnbind(NSPI_HANDLE *contextHandle, DWORD Reserved)
+{
+    DWORD status = 0;
+    unsigned long exceptionCode = 0;
+    STUB_TRACE_CALL trace;
+
+    StubTraceBegin(&trace, STUB_TRACE_NSPI, 1, contextHandle != NULL ? *contextHandle : NULL, 0);
+    RpcTryExcept
+    {
+        status = NspiUnbind(contextHandle, Reserved);
+    }
+    RpcExcept(RpcExceptionFilter(RpcExceptionCode()))
+    {
+        exceptionCode = RpcExceptionCode();
+    }
+    RpcEndExcept
+
+    if (exceptionCode != 0)
+    {
+        StubTraceFault(&trace, exceptionCode);
+        RpcRaiseException(exceptionCode);
+    }
+
+    StubTraceEnd(&trace, (long)status, contextHandle != NULL ? *contextHandle : NULL, NULL, 0, 0);
+    return status;
+}
+
+extern "C" long TracedNspiUpdateStat(NSPI_HANDLE hRpc, DWORD Reserved, STAT *pStat, long *plDelta)
+{
+    return TraceCall(2, hRpc, [&]() { return NspiUpdateStat(hRpc, Reserved, pStat, plDelta); });
+}
+
+extern "C" long TracedNspiQueryRows(
+    NSPI_HANDLE hRpc,
+    DWORD dwFlags,
+    STAT *pStat,
+    DWORD dwETableCount,
+    DWORD *lpETable,
+    DWORD Count,
+    PropertyTagArray_r *pPropTags,
+    PropertyRowSet_r **ppRows)
+{
+    return TraceCall(3, hRpc, [&]() { return NspiQueryRows(hRpc, dwFlags, pStat, dwETableCount, lpETable, Count, pPropTags, ppRows); });
+}
+
+extern "C" long TracedNspiSeekEntries(
+    NSPI_HANDLE hRpc,
+    DWORD Reserved,
+    STAT *pStat,
+    PropertyValue_r *pTarget,
+    PropertyTagArray_r *lpETable,
+    PropertyTagArray_r *pPropTags,
+    PropertyRowSet_r **ppRows)
+{
+    return TraceCall(4, hRpc, [&]() { return NspiSeekEntries(hRpc, Reserved, pStat, pTarget, lpETable, pPropTags, ppRows); });
+}
+
+extern "C" long TracedNspiGetMatches(
+    NSPI_HANDLE hRpc,
+    DWORD Reserved1,
+    STAT *pStat,
+    PropertyTagArray_r *pReserved,
+    DWORD Reserved2,
+    Restriction_r *Filter,
+    PropertyName_r *lpPropName,
+    DWORD ulRequested,
+    PropertyTagArray_r **ppOutMIds,
+    PropertyTagArray_r *pPropTags,
+    PropertyRowSet_r **ppRows)
+{
+    return TraceCall(5, hRpc, [&]()
+    {
+        return NspiGetMatches(hRpc, Reserved1, pStat, pReserved, Reserved2, Filter, lpPropName, ulRequested, ppOutMIds, pPropTags, ppRows);
+    });
+}
+
+extern "C" long TracedNspiResortRestriction(NSPI_HANDLE hRpc, DWORD Reserved, STAT *pStat, PropertyTagArray_r *pInMIds, PropertyTagArray_r **ppOutMIds)
+{
+    return TraceCall(6, hRpc, [&]() { return NspiResortRestriction(hRpc, Reserved, pStat, pInMIds, ppOutMIds); });
+}
+
+extern "C" long TracedNspiDNToMId(NSPI_HANDLE hRpc, DWORD Reserved, StringsArray_r *pNames, PropertyTagArray_r **ppOutMIds)
+{
+    return TraceCall(7, hRpc, [&]() { return NspiDNToMId(hRpc, Reserved, pNames, ppOutMIds); });
+}
+
+extern "C" long TracedNspiGetPropList(NSPI_HANDLE hRpc, DWORD dwFlags, DWORD dwMId, DWORD CodePage, PropertyTagArray_r **ppPropTags)
+{
+    return TraceCall(8, hRpc, [&]() { return NspiGetPropList(hRpc, dwFlags, dwMId, CodePage, ppPropTags); });
+}
+
+extern "C" long TracedNspiGetProps(NSPI_HANDLE hRpc, DWORD dwFlags, STAT *pStat, PropertyTagArray_r *pPropTags, PropertyRow_r **ppRows)
+{
+    return TraceCall(9, hRpc, [&]() { return NspiGetProps(hRpc, dwFlags, pStat, pPropTags, ppRows); });
+}
+
+extern "C" long TracedNspiCompareMIds(NSPI_HANDLE hRpc, DWORD Reserved, STAT *pStat, DWORD MId1, DWORD MId2, long *plResult)
+{
+    return TraceCall(10, hRpc, [&]() { return NspiCompareMIds(hRpc, Reserved, pStat, MId1, MId2, plResult); });
+}
+
+extern "C" long TracedNspiModProps(NSPI_HANDLE hRpc, DWORD Reserved, STAT *pStat, PropertyTagArray_r *pPropTags, PropertyRow_r *pRow)
+{
+    return TraceCall(11, hRpc, [&]() { return NspiModProps(hRpc, Reserved, pStat, pPropTags, pRow); });
+}
+
+extern "C" long TracedNspiGetSpecialTable(NSPI_HANDLE hRpc, DWORD dwFlags, STAT *pStat, DWORD *lpVersion, PropertyRowSet_r **ppRows)
+{
+    return TraceCall(12, hRpc, [&]() { return NspiGetSpecialTable(hRpc, dwFlags, pStat, lpVersion, ppRows); });
+}
+
+extern "C" long TracedNspiGetTemplateInfo(
+    NSPI_HANDLE hRpc,
+    DWORD dwFlags,
+    DWORD ulType,
+    unsigned char *pDN,
+    DWORD dwCodePage,
+    DWORD dwLocaleID,
+    PropertyRow_r **ppData)
+{
+    return TraceCall(13, hRpc, [&]() { return NspiGetTemplateInfo(hRpc, dwFlags, ulType, pDN, dwCodePage, dwLocaleID, ppData); });
+}
+
+extern "C" long TracedNspiModLinkAtt(NSPI_HANDLE hRpc, DWORD dwFlags, DWORD ulPropTag, DWORD dwMId, BinaryArray_r *lpEntryIds)
+{
+    return TraceCall(14, hRpc, [&]() { return NspiModLinkAtt(hRpc, dwFlags, ulPropTag, dwMId, lpEntryIds); });
+}
+
+extern "C" long TracedNspiQueryColumns(NSPI_HANDLE hRpc, DWORD Reserved, DWORD dwFlags, PropertyTagArray_r **ppColumns)
+{
+    return TraceCall(16, hRpc, [&]() { return NspiQueryColumns(hRpc, Reserved, dwFlags, ppColumns); });
+}
+
+extern "C" long TracedNspiResolveNames(
+    NSPI_HANDLE hRpc,
+    DWORD Reserved,
+    STAT *pStat,
+    PropertyTagArray_r *pPropTags,
+    StringsArray_r *paStr,
+    PropertyTagArray_r **ppMIds,
+    PropertyRowSet_r **ppRows)
+{
+    return TraceCall(19, hRpc, [&]() { return NspiResolveNames(hRpc, Reserved, pStat, pPropTags, paStr, ppMIds, ppRows); });
+}
+
+extern "C" long TracedNspiResolveNamesW(
+    NSPI_HANDLE hRpc,
+    DWORD Reserved,
+    STAT *pStat,
+    PropertyTagArray_r *pPropTags,
+    WStringsArray_r *paWStr,
+    PropertyTagArray_r **ppMIds,
+    PropertyRowSet_r **ppRows)
+{
+    return TraceCall(20, hRpc, [&]() { return NspiResolveNamesW(hRpc, Reserved, pStat, pPropTags, paWStr, ppMIds, ppRows); });
+}
@@ -2,6 +2,7 @@
 #include "winsock2.h"
 #include "winsock.h"
 #include "MS-OXNSPI.h"
+#include "..\OXCRPCStub\StubMetrics.h"
 #pragma   comment(lib,"ws2_32.lib")
 #include <fstream>
 #include <tchar.h>
@@ -138,6 +139,7 @@ unsigned long __stdcall BindToServer(const char * server, int encryptionMethod,
 			
 		    if (status == 0)
 		    {
+			    StubMetricsBindingHandle(1);
 			    status = RpcEpResolveBinding(m_hBind, nspi_v56_0_c_ifspec); // Resolve the created partially-bound server binding handle into a fully-bound server binding handle.
 			    if (status == 0)
 			    {
@@ -254,7 +256,13 @@ handle_t __stdcall GetBindHandle( )
 /// </summary>
 void* __RPC_USER midl_user_allocate(size_t size)
 {
-    return malloc(size);
+    void *p = malloc(size);
+    if (p != NULL)
+    {
+        StubMetricsAllocate(size);
+    }
+
+    return p;
 }
 
 /// <summary>
@@ -262,5 +270,10 @@ void* __RPC_USER midl_user_allocate(size_t size)
 /// </summary>
 void __RPC_USER midl_user_free(void* p)
 {
+    if (p != NULL)
+    {
+        StubMetricsFree();
+    }
+
     free(p);
 }
\ No newline at end of file
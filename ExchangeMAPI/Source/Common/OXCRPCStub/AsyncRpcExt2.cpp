@@ -0,0 +1,189 @@
+#include "AsyncRpcExt2.h"
+#include "MS-OXCRPC_Async.h"
+#include "RpcException.h"
+#include "Keepalive.h"
+
+/// <summary>
+/// The state of one outstanding asynchronous EcDoRpcExt2 call.
+/// The RPC_ASYNC_STATE is the first member so that the notification routine can recover the call from it.
+/// </summary>
+struct RpcExt2AsyncCall
+{
+    RPC_ASYNC_STATE async;
+    RPCEXT2_COMPLETION_ROUTINE completion;
+    void *context;
+    CXH cxh;                                // The session of the call, whose binding a completed call touches.
+};
+
+/// <summary>
+/// The number of asynchronous EcDoRpcExt2 calls that have been started but not completed.
+/// </summary>
+static volatile LONG m_pendingCalls = 0;
+
+/// <summary>
+/// The RPC notification routine, called by the RPC run-time library on one of its own threads when the call completes.
+/// </summary>
+static void RPC_ENTRY RpcExt2AsyncNotify(PRPC_ASYNC_STATE pAsync, void *Context, RPC_ASYNC_EVENT Event)
+{
+    RpcExt2AsyncCall *call = (RpcExt2AsyncCall *)pAsync->UserInfo;
+    long reply = 0;
+
+    // Invoke RpcAsyncCompleteCall function to receive the output parameters and the return value of EcDoRpcExt2.
+    RPC_STATUS status = RpcAsyncCompleteCall(pAsync, &reply);
+    if (status != RPC_S_OK)
+    {
+        reply = status;
+    }
+    else
+    {
+        KeepaliveTouchSession(call->cxh);
+    }
+
+    InterlockedDecrement(&m_pendingCalls);
+    call->completion(call->context, reply);
+    delete call;
+}
+
+/// <summary>
+/// Start an EcDoRpcExt2 call without blocking the calling thread.
+/// All buffers and output parameters MUST stay valid until the completion routine is invoked.
+/// </summary>
+/// <param name="pcxh">The CXH that was created by calling EcDoConnectEx.</param>
+/// <param name="pulFlags">On input, the flags to the server. On output, the flags returned by the server.</param>
+/// <param name="rgbIn">The ROP request payload, prefixed by an RPC_HEADER_EXT header.</param>
+/// <param name="cbIn">The size of the ROP request payload.</param>
+/// <param name="rgbOut">The buffer that receives the ROP response payload.</param>
+/// <param name="pcbOut">On input, the maximum size of rgbOut. On output, the size of the response payload.</param>
+/// <param name="rgbAuxIn">The auxiliary payload buffer.</param>
+/// <param name="cbAuxIn">The size of the auxiliary payload buffer.</param>
+/// <param name="rgbAuxOut">The buffer that receives the auxiliary payload returned by the server.</param>
+/// <param name="pcbAuxOut">On input, the maximum size of rgbAuxOut. On output, the size of the auxiliary payload.</param>
+/// <param name="pulTransTime">Receives the time in milliseconds the server spent processing the request.</param>
+/// <param name="completion">The routine invoked once the call completes.</param>
+/// <param name="context">The caller context passed back to the completion routine.</param>
+/// <returns>If the call is started, it returns 0, else returns the error code. The completion routine is not invoked on failure.</returns>
+long __stdcall EcDoRpcExt2Begin(
+    CXH *pcxh,
+    unsigned long *pulFlags,
+    unsigned char *rgbIn,
+    unsigned long cbIn,
+    unsigned char *rgbOut,
+    unsigned long *pcbOut,
+    unsigned char *rgbAuxIn,
+    unsigned long cbAuxIn,
+    unsigned char *rgbAuxOut,
+    unsigned long *pcbAuxOut,
+    unsigned long *pulTransTime,
+    RPCEXT2_COMPLETION_ROUTINE completion,
+    void *context)
+{
+    if (completion == NULL)
+    {
+        return RPC_S_INVALID_ARG;
+    }
+
+    RpcExt2AsyncCall *call = new RpcExt2AsyncCall();
+    long status = RpcAsyncInitializeHandle(&call->async, sizeof(RPC_ASYNC_STATE));
+    if (status)
+    {
+        delete call;
+        return status;
+    }
+
+    call->completion = completion;
+    call->context = context;
+    call->cxh = pcxh != NULL ? *pcxh : NULL;
+    call->async.UserInfo = call;
+    call->async.NotificationType = RpcNotificationTypeCallback;
+    call->async.u.NotificationRoutine = RpcExt2AsyncNotify;
+
+    InterlockedIncrement(&m_pendingCalls);
+    RpcTryExcept
+    {
+        EcDoRpcExt2Async(
+            &call->async,
+            pcxh,
+            pulFlags,
+            rgbIn,
+            cbIn,
+            rgbOut,
+            pcbOut,
+            rgbAuxIn,
+            cbAuxIn,
+            rgbAuxOut,
+            pcbAuxOut,
+            pulTransTime);
+    }
+    RpcExcept( HandleException(::RpcExceptionCode()) )
+    {
+        // The call did not start, so the notification routine will never run.
+        status = ::RpcExceptionCode();
+        InterlockedDecrement(&m_pendingCalls);
+        delete call;
+    }
+    RpcEndExcept;
+
+    return status;
+}
+
+/// <summary>
+/// The context of EcDoRpcExt2Wait, signaled by its completion routine.
+/// </summary>
+struct RpcExt2WaitContext
+{
+    HANDLE completed;
+    long reply;
+};
+
+static void __stdcall RpcExt2WaitCompleted(void *context, long reply)
+{
+    RpcExt2WaitContext *waitContext = (RpcExt2WaitContext *)context;
+    waitContext->reply = reply;
+    SetEvent(waitContext->completed);
+}
+
+/// <summary>
+/// Make an EcDoRpcExt2 call through the asynchronous interface and wait for it to complete.
+/// The parameters are the same as EcDoRpcExt2.
+/// </summary>
+/// <returns>The return value of EcDoRpcExt2, or the RPC status code if the call could not be completed.</returns>
+long __stdcall EcDoRpcExt2Wait(
+    CXH *pcxh,
+    unsigned long *pulFlags,
+    unsigned char *rgbIn,
+    unsigned long cbIn,
+    unsigned char *rgbOut,
+    unsigned long *pcbOut,
+    unsigned char *rgbAuxIn,
+    unsigned long cbAuxIn,
+    unsigned char *rgbAuxOut,
+    unsigned long *pcbAuxOut,
+    unsigned long *pulTransTime)
+{
+    RpcExt2WaitContext waitContext;
+    waitContext.reply = 0;
+    waitContext.completed = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (waitContext.completed == NULL)
+    {
+        return GetLastError();
+    }
+
+    long status = EcDoRpcExt2Begin(pcxh, pulFlags, rgbIn, cbIn, rgbOut, pcbOut, rgbAuxIn, cbAuxIn, rgbAuxOut, pcbAuxOut, pulTransTime, RpcExt2WaitCompleted, &waitContext);
+    if (status == 0)
+    {
+        WaitForSingleObject(waitContext.completed, INFINITE);
+        status = waitContext.reply;
+    }
+
+    CloseHandle(waitContext.completed);
+    return status;
+}
+
+/// <summary>
+/// Return the number of asynchronous EcDoRpcExt2 calls that are in flight.
+/// </summary>
+/// <returns>The number of started calls whose completion routine has not been invoked yet.</returns>
+unsigned long __stdcall GetPendingRpcExt2Count()
+{
+    return (unsigned long)m_pendingCalls;
+}
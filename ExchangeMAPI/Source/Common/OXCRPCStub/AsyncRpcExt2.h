@@ -0,0 +1,40 @@
+#pragma once
+
+#include "MS-OXCRPC.h"
+
+/// <summary>
+/// Completion routine invoked when an asynchronous EcDoRpcExt2 call finishes.
+/// </summary>
+/// <param name="context">The caller context passed to EcDoRpcExt2Begin.</param>
+/// <param name="reply">The return value of EcDoRpcExt2, or the RPC status code if the call could not be completed.</param>
+typedef void (__stdcall *RPCEXT2_COMPLETION_ROUTINE)(void *context, long reply);
+
+long __stdcall EcDoRpcExt2Begin(
+    CXH *pcxh,
+    unsigned long *pulFlags,
+    unsigned char *rgbIn,
+    unsigned long cbIn,
+    unsigned char *rgbOut,
+    unsigned long *pcbOut,
+    unsigned char *rgbAuxIn,
+    unsigned long cbAuxIn,
+    unsigned char *rgbAuxOut,
+    unsigned long *pcbAuxOut,
+    unsigned long *pulTransTime,
+    RPCEXT2_COMPLETION_ROUTINE completion,
+    void *context);
+
+long __stdcall EcDoRpcExt2Wait(
+    CXH *pcxh,
+    unsigned long *pulFlags,
+    unsigned char *rgbIn,
+    unsigned long cbIn,
+    unsigned char *rgbOut,
+    unsigned long *pcbOut,
+    unsigned char *rgbAuxIn,
+    unsigned long cbAuxIn,
+    unsigned char *rgbAuxOut,
+    unsigned long *pcbAuxOut,
+    unsigned long *pulTransTime);
+
+unsigned long __stdcall GetPendingRpcExt2Count();
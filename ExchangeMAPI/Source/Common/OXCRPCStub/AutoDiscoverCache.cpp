@@ -0,0 +1,651 @@
+#include "AutoDiscoverCache.h"
+#include "MappedFile.h"
+#include <vector>
+
+// The AutoDiscover properties of a user rarely change, yet a connect or reconnect would otherwise pay an AutoDiscover
+// round trip before it binds. The cache keeps them, per user, domain and transport, in a small memory-mapped file that
+// the test processes of a run share, and that outlives them for the next run. Entries carry absolute UTC times, so
+// that a process honors the TTL an entry was stored with, whichever process stored it.
+//
+// The file has a fixed number of slots and every access holds a named mutex derived from the path of the file. A slot
+// is marked SlotWriting before it is changed and SlotUsed once complete, so a process that dies while it writes leaves
+// a slot that is never read. A refresh thread resolves the entries that were used since they were resolved once three
+// quarters of their TTL have passed; it claims an entry in the file first, so that only one process refreshes it.
+
+/// <summary>
+/// The signature of the file header, "ADCF".
+/// </summary>
+#define AUTODISCOVER_CACHE_SIGNATURE    0x46434441
+#define AUTODISCOVER_CACHE_VERSION      1
+
+/// <summary>
+/// The FILETIME units in a second.
+/// </summary>
+static const unsigned __int64 TicksPerSecond = 10000000;
+
+/// <summary>
+/// The time after which the claim of a refresh that did not complete lapses, and another refresh can be tried.
+/// </summary>
+static const unsigned __int64 RefreshClaimTimeout = 60 * TicksPerSecond;
+
+/// <summary>
+/// The bounds of the time between two passes of the refresh thread, in milliseconds.
+/// </summary>
+static const unsigned long MinRefreshInterval = 1000;
+static const unsigned long MaxRefreshInterval = 60000;
+
+/// <summary>
+/// The states of a slot.
+/// </summary>
+static const LONG SlotEmpty = 0;
+static const LONG SlotWriting = 1;
+static const LONG SlotUsed = 2;
+
+struct AutoDiscoverFileHeader
+{
+    unsigned long signature;
+    unsigned long version;
+    unsigned long slotCount;
+    unsigned long slotSize;
+};
+
+struct AutoDiscoverSlot
+{
+    volatile LONG state;
+    unsigned long keyHash;
+    char userName[AUTODISCOVER_USER_LENGTH];
+    char domain[AUTODISCOVER_DOMAIN_LENGTH];
+    char transport[AUTODISCOVER_TRANSPORT_LENGTH];
+    unsigned __int64 resolvedAt;
+    unsigned __int64 expiresAt;
+    unsigned __int64 lastUsedAt;
+    unsigned __int64 refreshClaimedAt;  // When a process began to refresh the entry, or 0.
+    AUTODISCOVER_PROPERTIES properties;
+};
+
+struct _AUTODISCOVER_CACHE
+{
+    MappedFile file;
+    HANDLE mutex;
+    AutoDiscoverSlot *slots;
+    unsigned __int64 ttl;
+    AUTODISCOVER_RESOLVE_ROUTINE routine;
+    void *context;
+    HANDLE refreshThread;
+    HANDLE stopEvent;
+    unsigned long refreshInterval;
+    volatile LONG hitCount;
+    volatile LONG missCount;
+    volatile LONG resolveCount;
+    volatile LONG resolveFailureCount;
+    volatile LONG refreshCount;
+    volatile LONG refreshFailureCount;
+};
+
+/// <summary>
+/// The user, domain and transport of an entry to refresh, copied out of the file.
+/// </summary>
+struct AutoDiscoverKey
+{
+    char userName[AUTODISCOVER_USER_LENGTH];
+    char domain[AUTODISCOVER_DOMAIN_LENGTH];
+    char transport[AUTODISCOVER_TRANSPORT_LENGTH];
+};
+
+static unsigned __int64 Now()
+{
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    return ((unsigned __int64)now.dwHighDateTime << 32) | now.dwLowDateTime;
+}
+
+/// <summary>
+/// The case-insensitive FNV-1a hash of the fields of a key.
+/// </summary>
+static unsigned long HashKey(const char *userName, const char *domain, const char *transport)
+{
+    const char *fields[3] = { userName, domain, transport };
+    unsigned long hash = 2166136261UL;
+    for (int i = 0; i < 3; i++)
+    {
+        for (const char *c = fields[i]; *c != '\0'; c++)
+        {
+            char value = *c >= 'A' && *c <= 'Z' ? *c - 'A' + 'a' : *c;
+            hash = (hash ^ (unsigned char)value) * 16777619UL;
+        }
+
+        hash = (hash ^ 0xFF) * 16777619UL;
+    }
+
+    return hash;
+}
+
+static bool IsValidKey(const char *userName, const char *domain, const char *transport)
+{
+    return userName != NULL && domain != NULL && transport != NULL
+        && strlen(userName) < AUTODISCOVER_USER_LENGTH
+        && strlen(domain) < AUTODISCOVER_DOMAIN_LENGTH
+        && strlen(transport) < AUTODISCOVER_TRANSPORT_LENGTH;
+}
+
+/// <summary>
+/// Null-terminate every field of properties; a field that is not would be read past its end by the users of the
+/// properties.
+/// </summary>
+static void TerminateProperties(AUTODISCOVER_PROPERTIES *properties)
+{
+    properties->PrivateMailboxServer[AUTODISCOVER_NAME_LENGTH - 1] = '\0';
+    properties->PrivateMailboxProxy[AUTODISCOVER_NAME_LENGTH - 1] = '\0';
+    properties->PublicMailboxServer[AUTODISCOVER_NAME_LENGTH - 1] = '\0';
+    properties->PublicMailboxProxy[AUTODISCOVER_NAME_LENGTH - 1] = '\0';
+    properties->PrivateMailStoreUrl[AUTODISCOVER_URL_LENGTH - 1] = '\0';
+    properties->PublicMailStoreUrl[AUTODISCOVER_URL_LENGTH - 1] = '\0';
+    properties->AddressBookUrl[AUTODISCOVER_URL_LENGTH - 1] = '\0';
+}
+
+/// <summary>
+/// Acquire the mutex of the file. A process that died holding it leaves at most one slot in SlotWriting.
+/// </summary>
+static bool LockFile(AUTODISCOVER_CACHE *cache)
+{
+    DWORD wait = WaitForSingleObject(cache->mutex, INFINITE);
+    return wait == WAIT_OBJECT_0 || wait == WAIT_ABANDONED;
+}
+
+static void UnlockFile(AUTODISCOVER_CACHE *cache)
+{
+    ReleaseMutex(cache->mutex);
+}
+
+/// <summary>
+/// Find the used slot of a key. The caller MUST hold the mutex of the file.
+/// </summary>
+static AutoDiscoverSlot *FindSlot(AUTODISCOVER_CACHE *cache, unsigned long hash, const char *userName, const char *domain, const char *transport)
+{
+    for (unsigned long i = 0; i < AUTODISCOVER_CACHE_SLOTS; i++)
+    {
+        AutoDiscoverSlot *slot = &cache->slots[i];
+        if (slot->state == SlotUsed
+            && slot->keyHash == hash
+            && _stricmp(slot->userName, userName) == 0
+            && _stricmp(slot->domain, domain) == 0
+            && _stricmp(slot->transport, transport) == 0)
+        {
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+/// <summary>
+/// Choose the slot to store a key in: its own, else a free one, else the least recently used one. The caller MUST
+/// hold the mutex of the file.
+/// </summary>
+static AutoDiscoverSlot *ChooseSlot(AUTODISCOVER_CACHE *cache, unsigned long hash, const char *userName, const char *domain, const char *transport)
+{
+    AutoDiscoverSlot *slot = FindSlot(cache, hash, userName, domain, transport);
+    if (slot != NULL)
+    {
+        return slot;
+    }
+
+    AutoDiscoverSlot *oldest = NULL;
+    for (unsigned long i = 0; i < AUTODISCOVER_CACHE_SLOTS; i++)
+    {
+        slot = &cache->slots[i];
+        if (slot->state != SlotUsed)
+        {
+            return slot;
+        }
+
+        if (oldest == NULL || slot->lastUsedAt < oldest->lastUsedAt)
+        {
+            oldest = slot;
+        }
+    }
+
+    return oldest;
+}
+
+/// <summary>
+/// Store the properties of a key with the TTL of the cache.
+/// </summary>
+/// <param name="used">True if the caller uses the properties now; false for a refresh, which keeps the last use of the entry.</param>
+static long StoreEntry(
+    AUTODISCOVER_CACHE *cache,
+    const char *userName,
+    const char *domain,
+    const char *transport,
+    const AUTODISCOVER_PROPERTIES *properties,
+    bool used)
+{
+    unsigned long hash = HashKey(userName, domain, transport);
+    if (!LockFile(cache))
+    {
+        return GetLastError();
+    }
+
+    // A refresh only replaces the entry it was claimed for; the entry may have been invalidated or evicted meanwhile.
+    AutoDiscoverSlot *slot = used ? ChooseSlot(cache, hash, userName, domain, transport) : FindSlot(cache, hash, userName, domain, transport);
+    if (slot == NULL)
+    {
+        UnlockFile(cache);
+        return 0;
+    }
+
+    unsigned __int64 now = Now();
+    unsigned __int64 lastUsedAt = used ? now : slot->lastUsedAt;
+    InterlockedExchange(&slot->state, SlotWriting);
+    slot->keyHash = hash;
+    strcpy_s(slot->userName, userName);
+    strcpy_s(slot->domain, domain);
+    strcpy_s(slot->transport, transport);
+    slot->resolvedAt = now;
+    slot->expiresAt = now + cache->ttl;
+    slot->lastUsedAt = lastUsedAt;
+    slot->refreshClaimedAt = 0;
+    slot->properties = *properties;
+    TerminateProperties(&slot->properties);
+    InterlockedExchange(&slot->state, SlotUsed);
+    UnlockFile(cache);
+    return 0;
+}
+
+/// <summary>
+/// Claim the entries due for a refresh, and copy their keys out of the file.
+/// </summary>
+static void ClaimRefreshes(AUTODISCOVER_CACHE *cache, std::vector<AutoDiscoverKey> &keys)
+{
+    keys.clear();
+    if (!LockFile(cache))
+    {
+        return;
+    }
+
+    unsigned __int64 now = Now();
+    for (unsigned long i = 0; i < AUTODISCOVER_CACHE_SLOTS; i++)
+    {
+        AutoDiscoverSlot *slot = &cache->slots[i];
+        if (slot->state != SlotUsed || slot->expiresAt <= slot->resolvedAt)
+        {
+            continue;
+        }
+
+        // An entry not used since it was resolved is left to expire.
+        unsigned __int64 refreshAt = slot->resolvedAt + (slot->expiresAt - slot->resolvedAt) / 4 * 3;
+        if (now < refreshAt || slot->lastUsedAt < slot->resolvedAt)
+        {
+            continue;
+        }
+
+        if (slot->refreshClaimedAt != 0 && now - slot->refreshClaimedAt < RefreshClaimTimeout)
+        {
+            continue;
+        }
+
+        slot->refreshClaimedAt = now;
+        AutoDiscoverKey key;
+        strcpy_s(key.userName, slot->userName);
+        strcpy_s(key.domain, slot->domain);
+        strcpy_s(key.transport, slot->transport);
+        keys.push_back(key);
+    }
+
+    UnlockFile(cache);
+}
+
+/// <summary>
+/// Resolve the claimed entries again until the cache is closed. A failed refresh keeps its claim, so that the entry
+/// is tried again once the claim lapses rather than on every pass.
+/// </summary>
+static DWORD WINAPI RefreshThread(LPVOID parameter)
+{
+    AUTODISCOVER_CACHE *cache = (AUTODISCOVER_CACHE *)parameter;
+    std::vector<AutoDiscoverKey> keys;
+    while (WaitForSingleObject(cache->stopEvent, cache->refreshInterval) == WAIT_TIMEOUT)
+    {
+        ClaimRefreshes(cache, keys);
+        for (size_t i = 0; i < keys.size() && WaitForSingleObject(cache->stopEvent, 0) == WAIT_TIMEOUT; i++)
+        {
+            AUTODISCOVER_PROPERTIES properties;
+            memset(&properties, 0, sizeof(properties));
+            long status = cache->routine(cache->context, keys[i].userName, keys[i].domain, keys[i].transport, &properties);
+            if (status == 0)
+            {
+                status = StoreEntry(cache, keys[i].userName, keys[i].domain, keys[i].transport, &properties, false);
+            }
+
+            InterlockedIncrement(status == 0 ? &cache->refreshCount : &cache->refreshFailureCount);
+        }
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Map the file of a cache, and initialize it if it is new or was written by another version.
+/// </summary>
+static long LoadCache(AUTODISCOVER_CACHE *cache, const wchar_t *path)
+{
+    const unsigned long size = sizeof(AutoDiscoverFileHeader) + AUTODISCOVER_CACHE_SLOTS * sizeof(AutoDiscoverSlot);
+    long status = cache->file.OpenShared(path, size);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    unsigned long available;
+    AutoDiscoverFileHeader *header = (AutoDiscoverFileHeader *)cache->file.At(0, &available);
+    if (header == NULL)
+    {
+        return GetLastError();
+    }
+
+    if (available < size)
+    {
+        return ERROR_FILE_CORRUPT;
+    }
+
+    cache->slots = (AutoDiscoverSlot *)(header + 1);
+    if (header->signature != AUTODISCOVER_CACHE_SIGNATURE
+        || header->version != AUTODISCOVER_CACHE_VERSION
+        || header->slotCount != AUTODISCOVER_CACHE_SLOTS
+        || header->slotSize != sizeof(AutoDiscoverSlot))
+    {
+        memset(cache->slots, 0, AUTODISCOVER_CACHE_SLOTS * sizeof(AutoDiscoverSlot));
+        header->signature = AUTODISCOVER_CACHE_SIGNATURE;
+        header->version = AUTODISCOVER_CACHE_VERSION;
+        header->slotCount = AUTODISCOVER_CACHE_SLOTS;
+        header->slotSize = sizeof(AutoDiscoverSlot);
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Open an AutoDiscover cache, creating its file if it does not exist. Processes that open the same file share its
+/// entries.
+/// </summary>
+/// <param name="path">The file of the cache.</param>
+/// <param name="ttlSeconds">The time an entry stored by this process stays valid.</param>
+/// <param name="routine">The routine that resolves a miss and refreshes entries, or NULL to only use stored entries.</param>
+/// <param name="context">The caller context passed to the routine.</param>
+/// <param name="cache">Receives the cache.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall AutoDiscoverCacheOpen(
+    const wchar_t *path,
+    unsigned long ttlSeconds,
+    AUTODISCOVER_RESOLVE_ROUTINE routine,
+    void *context,
+    AUTODISCOVER_CACHE **cache)
+{
+    if (path == NULL || ttlSeconds == 0 || cache == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    *cache = NULL;
+
+    // Name the mutex after the full path, so that every process that opens the file agrees on it.
+    wchar_t fullPath[MAX_PATH];
+    DWORD length = GetFullPathNameW(path, MAX_PATH, fullPath, NULL);
+    if (length == 0 || length >= MAX_PATH)
+    {
+        return length == 0 ? GetLastError() : ERROR_FILENAME_EXCED_RANGE;
+    }
+
+    unsigned __int64 pathHash = 14695981039346656037ULL;
+    for (DWORD i = 0; i < length; i++)
+    {
+        wchar_t value = fullPath[i] >= L'A' && fullPath[i] <= L'Z' ? fullPath[i] - L'A' + L'a' : fullPath[i];
+        pathHash = (pathHash ^ (unsigned short)value) * 1099511628211ULL;
+    }
+
+    wchar_t mutexName[64];
+    swprintf_s(mutexName, L"Local\\AutoDiscoverCache.%016I64x", pathHash);
+
+    AUTODISCOVER_CACHE *created = new AUTODISCOVER_CACHE();
+    created->ttl = ttlSeconds * TicksPerSecond;
+    created->routine = routine;
+    created->context = context;
+    created->refreshInterval = ttlSeconds >= MaxRefreshInterval * 8 / 1000 ? MaxRefreshInterval : ttlSeconds * 1000 / 8;
+    if (created->refreshInterval < MinRefreshInterval)
+    {
+        created->refreshInterval = MinRefreshInterval;
+    }
+
+    created->mutex = CreateMutexW(NULL, FALSE, mutexName);
+    if (created->mutex == NULL)
+    {
+        long status = GetLastError();
+        delete created;
+        return status;
+    }
+
+    long status;
+    if (LockFile(created))
+    {
+        status = LoadCache(created, path);
+        UnlockFile(created);
+    }
+    else
+    {
+        status = GetLastError();
+    }
+
+    if (status == 0 && routine != NULL)
+    {
+        created->stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        created->refreshThread = created->stopEvent == NULL ? NULL : CreateThread(NULL, 0, RefreshThread, created, 0, NULL);
+        if (created->refreshThread == NULL)
+        {
+            status = GetLastError();
+        }
+    }
+
+    if (status != 0)
+    {
+        AutoDiscoverCacheClose(created);
+        return status;
+    }
+
+    *cache = created;
+    return 0;
+}
+
+/// <summary>
+/// Stop the refresh thread of a cache and close it. The entries stay in the file.
+/// </summary>
+void __stdcall AutoDiscoverCacheClose(AUTODISCOVER_CACHE *cache)
+{
+    if (cache == NULL)
+    {
+        return;
+    }
+
+    if (cache->refreshThread != NULL)
+    {
+        SetEvent(cache->stopEvent);
+        WaitForSingleObject(cache->refreshThread, INFINITE);
+        CloseHandle(cache->refreshThread);
+    }
+
+    if (cache->stopEvent != NULL)
+    {
+        CloseHandle(cache->stopEvent);
+    }
+
+    cache->file.Close();
+    if (cache->mutex != NULL)
+    {
+        CloseHandle(cache->mutex);
+    }
+
+    delete cache;
+}
+
+/// <summary>
+/// Copy the stored properties of a user, if they have not expired.
+/// </summary>
+/// <param name="cache">The cache.</param>
+/// <param name="userName">The user name.</param>
+/// <param name="domain">The domain.</param>
+/// <param name="transport">The transport the properties are for.</param>
+/// <param name="properties">Receives the properties.</param>
+/// <returns>If success, it returns 0. ERROR_NOT_FOUND indicates the user has no entry, or that it has expired.</returns>
+long __stdcall AutoDiscoverCacheLookup(
+    AUTODISCOVER_CACHE *cache,
+    const char *userName,
+    const char *domain,
+    const char *transport,
+    AUTODISCOVER_PROPERTIES *properties)
+{
+    if (cache == NULL || properties == NULL || !IsValidKey(userName, domain, transport))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    unsigned long hash = HashKey(userName, domain, transport);
+    if (!LockFile(cache))
+    {
+        return GetLastError();
+    }
+
+    long status = ERROR_NOT_FOUND;
+    unsigned __int64 now = Now();
+    AutoDiscoverSlot *slot = FindSlot(cache, hash, userName, domain, transport);
+    if (slot != NULL && now < slot->expiresAt)
+    {
+        *properties = slot->properties;
+        slot->lastUsedAt = now;
+        status = 0;
+    }
+
+    UnlockFile(cache);
+    InterlockedIncrement(status == 0 ? &cache->hitCount : &cache->missCount);
+    return status;
+}
+
+/// <summary>
+/// Copy the stored properties of a user, or resolve them with the routine of the cache and store them on a miss.
+/// Call it in place of AutoDiscover before BindToServer or MapiHttpConnect.
+/// </summary>
+/// <param name="cache">The cache.</param>
+/// <param name="userName">The user name.</param>
+/// <param name="domain">The domain.</param>
+/// <param name="transport">The transport the properties are for.</param>
+/// <param name="properties">Receives the properties.</param>
+/// <returns>If success, it returns 0. ERROR_NOT_FOUND indicates a miss on a cache without a routine; other codes are returned by the routine.</returns>
+long __stdcall AutoDiscoverCacheResolve(
+    AUTODISCOVER_CACHE *cache,
+    const char *userName,
+    const char *domain,
+    const char *transport,
+    AUTODISCOVER_PROPERTIES *properties)
+{
+    long status = AutoDiscoverCacheLookup(cache, userName, domain, transport, properties);
+    if (status != ERROR_NOT_FOUND || cache->routine == NULL)
+    {
+        return status;
+    }
+
+    memset(properties, 0, sizeof(*properties));
+    InterlockedIncrement(&cache->resolveCount);
+    status = cache->routine(cache->context, userName, domain, transport, properties);
+    if (status != 0)
+    {
+        InterlockedIncrement(&cache->resolveFailureCount);
+        return status;
+    }
+
+    TerminateProperties(properties);
+    return StoreEntry(cache, userName, domain, transport, properties, true);
+}
+
+/// <summary>
+/// Store the properties of a user that the caller resolved itself.
+/// </summary>
+/// <param name="cache">The cache.</param>
+/// <param name="userName">The user name.</param>
+/// <param name="domain">The domain.</param>
+/// <param name="transport">The transport the properties are for.</param>
+/// <param name="properties">The properties.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall AutoDiscoverCachePut(
+    AUTODISCOVER_CACHE *cache,
+    const char *userName,
+    const char *domain,
+    const char *transport,
+    const AUTODISCOVER_PROPERTIES *properties)
+{
+    if (cache == NULL || properties == NULL || !IsValidKey(userName, domain, transport))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    return StoreEntry(cache, userName, domain, transport, properties, true);
+}
+
+/// <summary>
+/// Remove the entry of a user, for example after a connect to the stored server failed, so that the next resolve runs
+/// AutoDiscover again.
+/// </summary>
+/// <returns>If success, it returns 0. ERROR_NOT_FOUND indicates the user has no entry.</returns>
+long __stdcall AutoDiscoverCacheInvalidate(AUTODISCOVER_CACHE *cache, const char *userName, const char *domain, const char *transport)
+{
+    if (cache == NULL || !IsValidKey(userName, domain, transport))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    unsigned long hash = HashKey(userName, domain, transport);
+    if (!LockFile(cache))
+    {
+        return GetLastError();
+    }
+
+    AutoDiscoverSlot *slot = FindSlot(cache, hash, userName, domain, transport);
+    if (slot != NULL)
+    {
+        InterlockedExchange(&slot->state, SlotEmpty);
+    }
+
+    UnlockFile(cache);
+    return slot != NULL ? 0 : ERROR_NOT_FOUND;
+}
+
+/// <summary>
+/// Get the counters of a cache.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall AutoDiscoverCacheGetStats(AUTODISCOVER_CACHE *cache, AUTODISCOVER_CACHE_STATS *stats)
+{
+    if (cache == NULL || stats == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    if (!LockFile(cache))
+    {
+        return GetLastError();
+    }
+
+    for (unsigned long i = 0; i < AUTODISCOVER_CACHE_SLOTS; i++)
+    {
+        if (cache->slots[i].state == SlotUsed)
+        {
+            stats->EntryCount++;
+        }
+    }
+
+    UnlockFile(cache);
+    stats->HitCount = (unsigned long)cache->hitCount;
+    stats->MissCount = (unsigned long)cache->missCount;
+    stats->ResolveCount = (unsigned long)cache->resolveCount;
+    stats->ResolveFailureCount = (unsigned long)cache->resolveFailureCount;
+    stats->RefreshCount = (unsigned long)cache->refreshCount;
+    stats->RefreshFailureCount = (unsigned long)cache->refreshFailureCount;
+    return 0;
+}
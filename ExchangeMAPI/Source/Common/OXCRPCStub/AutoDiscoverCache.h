@@ -0,0 +1,103 @@
+#pragma once
+
+#include <windows.h>
+
+/// <summary>
+/// The capacity, terminating null included, of the server and proxy names and of the URLs of AUTODISCOVER_PROPERTIES.
+/// </summary>
+#define AUTODISCOVER_NAME_LENGTH    256
+#define AUTODISCOVER_URL_LENGTH     512
+
+/// <summary>
+/// The capacity, terminating null included, of the user name, domain and transport that identify a cache entry.
+/// </summary>
+#define AUTODISCOVER_USER_LENGTH        256
+#define AUTODISCOVER_DOMAIN_LENGTH      256
+#define AUTODISCOVER_TRANSPORT_LENGTH   32
+
+/// <summary>
+/// The number of entries of a cache file.
+/// </summary>
+#define AUTODISCOVER_CACHE_SLOTS 128
+
+/// <summary>
+/// The AutoDiscover properties of a user, as the AutoDiscover class of the test suites returns them. Unused fields
+/// are empty strings.
+/// </summary>
+typedef struct _AUTODISCOVER_PROPERTIES
+{
+    char PrivateMailboxServer[AUTODISCOVER_NAME_LENGTH];
+    char PrivateMailboxProxy[AUTODISCOVER_NAME_LENGTH];
+    char PublicMailboxServer[AUTODISCOVER_NAME_LENGTH];
+    char PublicMailboxProxy[AUTODISCOVER_NAME_LENGTH];
+    char PrivateMailStoreUrl[AUTODISCOVER_URL_LENGTH];
+    char PublicMailStoreUrl[AUTODISCOVER_URL_LENGTH];
+    char AddressBookUrl[AUTODISCOVER_URL_LENGTH];
+} AUTODISCOVER_PROPERTIES;
+
+/// <summary>
+/// Routine that runs AutoDiscover for a user. It is invoked by AutoDiscoverCacheResolve on a miss, on the thread of
+/// the caller, and by the refresh thread of the cache before an entry expires.
+/// </summary>
+/// <param name="context">The caller context passed to AutoDiscoverCacheOpen.</param>
+/// <param name="userName">The user name of the entry.</param>
+/// <param name="domain">The domain of the entry.</param>
+/// <param name="transport">The transport of the entry, for example "ncacn_http" or "mapi_http".</param>
+/// <param name="properties">Receives the AutoDiscover properties of the user.</param>
+/// <returns>0 if the properties were resolved, else an error code that is returned to the caller of AutoDiscoverCacheResolve.</returns>
+typedef long (__stdcall *AUTODISCOVER_RESOLVE_ROUTINE)(
+    void *context,
+    const char *userName,
+    const char *domain,
+    const char *transport,
+    AUTODISCOVER_PROPERTIES *properties);
+
+/// <summary>
+/// The counters of a cache. The entry count covers all processes that share the file, the others this process only.
+/// </summary>
+typedef struct _AUTODISCOVER_CACHE_STATS
+{
+    unsigned long EntryCount;           // Entries in the file.
+    unsigned long HitCount;             // Lookups answered from the file.
+    unsigned long MissCount;            // Lookups of an absent or expired entry.
+    unsigned long ResolveCount;         // Resolve routine calls for a miss.
+    unsigned long ResolveFailureCount;  // Resolve routine calls for a miss that failed.
+    unsigned long RefreshCount;         // Entries refreshed by the refresh thread.
+    unsigned long RefreshFailureCount;  // Refreshes that failed; the entry is tried again later and expires meanwhile.
+} AUTODISCOVER_CACHE_STATS;
+
+typedef struct _AUTODISCOVER_CACHE AUTODISCOVER_CACHE;
+
+long __stdcall AutoDiscoverCacheOpen(
+    const wchar_t *path,
+    unsigned long ttlSeconds,
+    AUTODISCOVER_RESOLVE_ROUTINE routine,
+    void *context,
+    AUTODISCOVER_CACHE **cache);
+
+void __stdcall AutoDiscoverCacheClose(AUTODISCOVER_CACHE *cache);
+
+long __stdcall AutoDiscoverCacheLookup(
+    AUTODISCOVER_CACHE *cache,
+    const char *userName,
+    const char *domain,
+    const char *transport,
+    AUTODISCOVER_PROPERTIES *properties);
+
+long __stdcall AutoDiscoverCacheResolve(
+    AUTODISCOVER_CACHE *cache,
+    const char *userName,
+    const char *domain,
+    const char *transport,
+    AUTODISCOVER_PROPERTIES *properties);
+
+long __stdcall AutoDiscoverCachePut(
+    AUTODISCOVER_CACHE *cache,
+    const char *userName,
+    const char *domain,
+    const char *transport,
+    const AUTODISCOVER_PROPERTIES *properties);
+
+long __stdcall AutoDiscoverCacheInvalidate(AUTODISCOVER_CACHE *cache, const char *userName, const char *domain, const char *transport);
+
+long __stdcall AutoDiscoverCacheGetStats(AUTODISCOVER_CACHE *cache, AUTODISCOVER_CACHE_STATS *stats);
@@ -0,0 +1,52 @@
+#pragma once
+
+// The pure codecs of this stub (RPC_HEADER_EXT, LZ77 DIRECT2, ROP layouts, property rows, FastTransfer and IDSET/GLOBSET)
+// use only this part of the Windows SDK, so that StubBenchmark can build them on other platforms too. Everything they
+// read from or write to a buffer goes through the fixed-width types of stdint.h, never through long or wchar_t, whose
+// widths differ between Windows and LP64 platforms.
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <intrin.h>
+#else
+#include <stddef.h>
+#include <string.h>
+
+#define __stdcall
+#define __int64 long long
+
+typedef int BOOL;
+#define TRUE 1
+#define FALSE 0
+
+typedef struct _GUID
+{
+    uint32_t Data1;
+    uint16_t Data2;
+    uint16_t Data3;
+    uint8_t Data4[8];
+} GUID;
+
+#define ERROR_FILE_NOT_FOUND        2
+#define ERROR_BAD_FORMAT            11
+#define ERROR_INVALID_DATA          13
+#define ERROR_READ_FAULT            30
+#define ERROR_NOT_SUPPORTED         50
+#define ERROR_INVALID_PARAMETER     87
+#define ERROR_INSUFFICIENT_BUFFER   122
+#define ERROR_NO_MORE_ITEMS         259
+#define ERROR_NOT_FOUND             1168
+
+inline unsigned char _BitScanForward(unsigned long *index, unsigned long mask)
+{
+    if (mask == 0)
+    {
+        return 0;
+    }
+
+    *index = (unsigned long)__builtin_ctzl(mask);
+    return 1;
+}
+#endif
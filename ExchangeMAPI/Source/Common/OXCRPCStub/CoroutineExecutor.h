@@ -0,0 +1,731 @@
+#pragma once
+
+// Header-only coroutine support shared by the EMSMDB and NSPI coroutine clients.
+// It builds with the C++20 <coroutine> header, or with <experimental/coroutine> and /await on older toolsets.
+// StubCoroutineTest compiles it, with both clients, and drives Task, Spawn, SyncWait and BlockingCallAwaitable.
+
+#if defined(__has_include)
+#if __has_include(<coroutine>) && (defined(__cpp_impl_coroutine) || defined(__cpp_lib_coroutine))
+#define STUB_COROUTINE_STD 1
+#endif
+#endif
+
+#ifdef STUB_COROUTINE_STD
+#include <coroutine>
+#else
+#include <experimental/coroutine>
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace StubCoroutines
+{
+#ifdef STUB_COROUTINE_STD
+    template <typename TPromise = void>
+    using coroutine_handle = std::coroutine_handle<TPromise>;
+    using suspend_always = std::suspend_always;
+    using suspend_never = std::suspend_never;
+    inline coroutine_handle<> noop_coroutine() noexcept { return std::noop_coroutine(); }
+#else
+    template <typename TPromise = void>
+    using coroutine_handle = std::experimental::coroutine_handle<TPromise>;
+    using suspend_always = std::experimental::suspend_always;
+    using suspend_never = std::experimental::suspend_never;
+    inline coroutine_handle<> noop_coroutine() noexcept { return std::experimental::noop_coroutine(); }
+#endif
+
+    /// <summary>
+    /// A scheduler that resumes coroutines. Awaitables that complete on foreign threads,
+    /// such as the RPC run-time library threads, post the continuation back to the executor of the awaiting coroutine.
+    /// </summary>
+    class Executor
+    {
+    public:
+        virtual ~Executor() {}
+
+        /// <summary>
+        /// Queue a suspended coroutine to be resumed on one of the executor threads.
+        /// </summary>
+        virtual void Post(coroutine_handle<> handle) = 0;
+
+        /// <summary>
+        /// Return an awaitable that moves the awaiting coroutine onto this executor.
+        /// </summary>
+        auto Schedule()
+        {
+            struct ScheduleAwaitable
+            {
+                Executor *executor;
+                bool await_ready() const noexcept { return false; }
+                void await_suspend(coroutine_handle<> handle) { executor->Post(handle); }
+                void await_resume() const noexcept {}
+            };
+
+            return ScheduleAwaitable{ this };
+        }
+    };
+
+    /// <summary>
+    /// A single-threaded executor. The thread that calls Run resumes every posted coroutine in FIFO order until Stop is called.
+    /// </summary>
+    class RunLoop : public Executor
+    {
+    public:
+        RunLoop() : stopped(false) {}
+
+        void Post(coroutine_handle<> handle) override
+        {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->queue.push_back(handle);
+            }
+
+            this->signal.notify_one();
+        }
+
+        /// <summary>
+        /// Resume posted coroutines on the calling thread until Stop is called.
+        /// </summary>
+        void Run()
+        {
+            for (;;)
+            {
+                coroutine_handle<> handle;
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    this->signal.wait(lock, [this] { return this->stopped || !this->queue.empty(); });
+                    if (this->queue.empty())
+                    {
+                        return;
+                    }
+
+                    handle = this->queue.front();
+                    this->queue.pop_front();
+                }
+
+                handle.resume();
+            }
+        }
+
+        /// <summary>
+        /// Make Run return once the queue is drained.
+        /// </summary>
+        void Stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->stopped = true;
+            }
+
+            this->signal.notify_all();
+        }
+
+    private:
+        std::mutex mutex;
+        std::condition_variable signal;
+        std::deque<coroutine_handle<> > queue;
+        bool stopped;
+    };
+
+    /// <summary>
+    /// A work-stealing executor. Each worker owns a deque; coroutines posted from a worker go to its own deque,
+    /// and idle workers steal from the opposite end of the other deques.
+    /// </summary>
+    class WorkStealingExecutor : public Executor
+    {
+    public:
+        explicit WorkStealingExecutor(unsigned int workerCount = std::thread::hardware_concurrency())
+            : stopped(false), nextWorker(0), queuedCount(0)
+        {
+            if (workerCount == 0)
+            {
+                workerCount = 1;
+            }
+
+            for (unsigned int i = 0; i < workerCount; i++)
+            {
+                this->workers.emplace_back(new Worker());
+            }
+
+            for (unsigned int i = 0; i < workerCount; i++)
+            {
+                this->workers[i]->thread = std::thread([this, i] { this->WorkerLoop(i); });
+            }
+        }
+
+        ~WorkStealingExecutor()
+        {
+            {
+                std::lock_guard<std::mutex> lock(this->idleMutex);
+                this->stopped = true;
+            }
+
+            this->idleSignal.notify_all();
+            for (size_t i = 0; i < this->workers.size(); i++)
+            {
+                this->workers[i]->thread.join();
+            }
+        }
+
+        void Post(coroutine_handle<> handle) override
+        {
+            size_t index;
+            WorkerIdentity &identity = CurrentIdentity();
+            if (identity.owner == this)
+            {
+                index = identity.index;
+            }
+            else
+            {
+                index = this->nextWorker.fetch_add(1, std::memory_order_relaxed) % this->workers.size();
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(this->workers[index]->mutex);
+                this->workers[index]->queue.push_back(handle);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(this->idleMutex);
+                this->queuedCount++;
+            }
+
+            this->idleSignal.notify_one();
+        }
+
+    private:
+        struct Worker
+        {
+            std::mutex mutex;
+            std::deque<coroutine_handle<> > queue;
+            std::thread thread;
+        };
+
+        /// <summary>
+        /// Identifies the executor and worker that the calling thread belongs to.
+        /// </summary>
+        struct WorkerIdentity
+        {
+            WorkStealingExecutor *owner;
+            size_t index;
+        };
+
+        static WorkerIdentity &CurrentIdentity()
+        {
+            thread_local WorkerIdentity identity = { nullptr, 0 };
+            return identity;
+        }
+
+        bool TryTake(size_t self, coroutine_handle<> &handle)
+        {
+            {
+                Worker &own = *this->workers[self];
+                std::lock_guard<std::mutex> lock(own.mutex);
+                if (!own.queue.empty())
+                {
+                    handle = own.queue.back();
+                    own.queue.pop_back();
+                    return true;
+                }
+            }
+
+            for (size_t i = 1; i < this->workers.size(); i++)
+            {
+                Worker &victim = *this->workers[(self + i) % this->workers.size()];
+                std::lock_guard<std::mutex> lock(victim.mutex);
+                if (!victim.queue.empty())
+                {
+                    handle = victim.queue.front();
+                    victim.queue.pop_front();
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        void WorkerLoop(size_t self)
+        {
+            CurrentIdentity().owner = this;
+            CurrentIdentity().index = self;
+            for (;;)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(this->idleMutex);
+                    this->idleSignal.wait(lock, [this] { return this->stopped || this->queuedCount > 0; });
+                    if (this->queuedCount == 0)
+                    {
+                        return;
+                    }
+                }
+
+                coroutine_handle<> handle;
+                if (this->TryTake(self, handle))
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(this->idleMutex);
+                        this->queuedCount--;
+                    }
+
+                    handle.resume();
+                }
+                else
+                {
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        std::vector<std::unique_ptr<Worker> > workers;
+        std::mutex idleMutex;
+        std::condition_variable idleSignal;
+        bool stopped;
+        std::atomic<size_t> nextWorker;
+        size_t queuedCount;
+    };
+
+    template <typename T>
+    class Task;
+
+    namespace Detail
+    {
+        /// <summary>
+        /// The final awaiter of a task transfers to the coroutine that awaited it, if any. The transfer is symmetric,
+        /// so a chain of tasks that complete synchronously does not grow the stack.
+        /// </summary>
+        struct FinalAwaiter
+        {
+            bool await_ready() const noexcept { return false; }
+
+            template <typename TPromise>
+            coroutine_handle<> await_suspend(coroutine_handle<TPromise> handle) noexcept
+            {
+                coroutine_handle<> continuation = handle.promise().continuation;
+                if (continuation)
+                {
+                    return continuation;
+                }
+
+                return noop_coroutine();
+            }
+
+            void await_resume() const noexcept {}
+        };
+
+        struct PromiseBase
+        {
+            coroutine_handle<> continuation;
+            std::exception_ptr exception;
+
+            suspend_always initial_suspend() const noexcept { return suspend_always(); }
+            FinalAwaiter final_suspend() const noexcept { return FinalAwaiter(); }
+            void unhandled_exception() { this->exception = std::current_exception(); }
+        };
+    }
+
+    /// <summary>
+    /// A lazily started coroutine that produces a value of type T. The body runs when the task is awaited.
+    /// </summary>
+    template <typename T>
+    class Task
+    {
+    public:
+        struct promise_type : Detail::PromiseBase
+        {
+            T value;
+
+            Task get_return_object() { return Task(coroutine_handle<promise_type>::from_promise(*this)); }
+            void return_value(T result) { this->value = std::move(result); }
+        };
+
+        Task(Task &&other) noexcept : handle(other.handle) { other.handle = nullptr; }
+        ~Task() { if (this->handle) this->handle.destroy(); }
+
+        bool await_ready() const noexcept { return false; }
+
+        coroutine_handle<> await_suspend(coroutine_handle<> awaiting)
+        {
+            this->handle.promise().continuation = awaiting;
+            return this->handle;
+        }
+
+        T await_resume()
+        {
+            if (this->handle.promise().exception)
+            {
+                std::rethrow_exception(this->handle.promise().exception);
+            }
+
+            return std::move(this->handle.promise().value);
+        }
+
+    private:
+        explicit Task(coroutine_handle<promise_type> h) : handle(h) {}
+        Task(const Task &) = delete;
+        Task &operator=(const Task &) = delete;
+
+        coroutine_handle<promise_type> handle;
+    };
+
+    /// <summary>
+    /// A lazily started coroutine that produces no value.
+    /// </summary>
+    template <>
+    class Task<void>
+    {
+    public:
+        struct promise_type : Detail::PromiseBase
+        {
+            Task get_return_object() { return Task(coroutine_handle<promise_type>::from_promise(*this)); }
+            void return_void() {}
+        };
+
+        Task(Task &&other) noexcept : handle(other.handle) { other.handle = nullptr; }
+        ~Task() { if (this->handle) this->handle.destroy(); }
+
+        bool await_ready() const noexcept { return false; }
+
+        coroutine_handle<> await_suspend(coroutine_handle<> awaiting)
+        {
+            this->handle.promise().continuation = awaiting;
+            return this->handle;
+        }
+
+        void await_resume()
+        {
+            if (this->handle.promise().exception)
+            {
+                std::rethrow_exception(this->handle.promise().exception);
+            }
+        }
+
+    private:
+        explicit Task(coroutine_handle<promise_type> h) : handle(h) {}
+        Task(const Task &) = delete;
+        Task &operator=(const Task &) = delete;
+
+        coroutine_handle<promise_type> handle;
+    };
+
+    namespace Detail
+    {
+        /// <summary>
+        /// A fire-and-forget coroutine used to drive a task to completion. It destroys itself when it finishes.
+        /// RunDetached catches what the task throws, so an exception never reaches std::terminate on an executor thread;
+        /// one thrown by the failure callback itself is dropped.
+        /// </summary>
+        struct DetachedTask
+        {
+            struct promise_type
+            {
+                DetachedTask get_return_object() { return DetachedTask(); }
+                suspend_never initial_suspend() const noexcept { return suspend_never(); }
+                suspend_never final_suspend() const noexcept { return suspend_never(); }
+                void return_void() {}
+                void unhandled_exception() {}
+            };
+        };
+
+        template <typename T>
+        DetachedTask RunDetached(Executor &executor, Task<T> task, std::function<void(T)> onCompleted, std::function<void(std::exception_ptr)> onFailed)
+        {
+            co_await executor.Schedule();
+            std::exception_ptr exception;
+            try
+            {
+                T result = co_await task;
+                if (onCompleted)
+                {
+                    onCompleted(std::move(result));
+                }
+            }
+            catch (...)
+            {
+                exception = std::current_exception();
+            }
+
+            if (exception && onFailed)
+            {
+                onFailed(exception);
+            }
+        }
+
+        inline DetachedTask RunDetached(Executor &executor, Task<void> task, std::function<void()> onCompleted, std::function<void(std::exception_ptr)> onFailed)
+        {
+            co_await executor.Schedule();
+            std::exception_ptr exception;
+            try
+            {
+                co_await task;
+                if (onCompleted)
+                {
+                    onCompleted();
+                }
+            }
+            catch (...)
+            {
+                exception = std::current_exception();
+            }
+
+            if (exception && onFailed)
+            {
+                onFailed(exception);
+            }
+        }
+
+        /// <summary>
+        /// The state SyncWait shares with the task it waits for.
+        /// </summary>
+        struct SyncWaitState
+        {
+            std::mutex mutex;
+            std::condition_variable signal;
+            bool done;
+            std::exception_ptr exception;
+
+            SyncWaitState() : done(false) {}
+
+            void Complete(std::exception_ptr error)
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->exception = error;
+                this->done = true;
+                this->signal.notify_one();
+            }
+
+            void Wait()
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->signal.wait(lock, [this] { return this->done; });
+                if (this->exception)
+                {
+                    std::rethrow_exception(this->exception);
+                }
+            }
+        };
+    }
+
+    /// <summary>
+    /// Start a task on the executor without waiting for it. The completion callback receives the result of the task;
+    /// the failure callback receives the exception the task, or the completion callback, threw. Without a failure
+    /// callback the exception is dropped.
+    /// </summary>
+    template <typename T>
+    void Spawn(
+        Executor &executor,
+        Task<T> task,
+        std::function<void(T)> onCompleted = std::function<void(T)>(),
+        std::function<void(std::exception_ptr)> onFailed = std::function<void(std::exception_ptr)>())
+    {
+        Detail::RunDetached<T>(executor, std::move(task), std::move(onCompleted), std::move(onFailed));
+    }
+
+    /// <summary>
+    /// Start a task that produces no value on the executor without waiting for it.
+    /// </summary>
+    inline void Spawn(
+        Executor &executor,
+        Task<void> task,
+        std::function<void()> onCompleted = std::function<void()>(),
+        std::function<void(std::exception_ptr)> onFailed = std::function<void(std::exception_ptr)>())
+    {
+        Detail::RunDetached(executor, std::move(task), std::move(onCompleted), std::move(onFailed));
+    }
+
+    /// <summary>
+    /// Run a task on the executor and block the calling thread until it completes. An exception the task throws is
+    /// thrown again on the calling thread.
+    /// The calling thread MUST NOT be the thread that runs a RunLoop executor.
+    /// </summary>
+    template <typename T>
+    T SyncWait(Executor &executor, Task<T> task)
+    {
+        Detail::SyncWaitState state;
+        T result = T();
+        Spawn<T>(executor, std::move(task), [&](T value)
+        {
+            result = std::move(value);
+            state.Complete(std::exception_ptr());
+        },
+        [&](std::exception_ptr exception)
+        {
+            state.Complete(exception);
+        });
+
+        state.Wait();
+        return result;
+    }
+
+    /// <summary>
+    /// Run a task that produces no value on the executor and block the calling thread until it completes.
+    /// </summary>
+    inline void SyncWait(Executor &executor, Task<void> task)
+    {
+        Detail::SyncWaitState state;
+        Spawn(executor, std::move(task), [&]()
+        {
+            state.Complete(std::exception_ptr());
+        },
+        [&](std::exception_ptr exception)
+        {
+            state.Complete(exception);
+        });
+
+        state.Wait();
+    }
+
+    /// <summary>
+    /// A fixed set of threads that run blocking calls in FIFO order. Calls beyond the number of threads wait in the
+    /// queue, so a burst of blocking calls cannot create a thread each.
+    /// </summary>
+    class BlockingCallPool
+    {
+    public:
+        static const unsigned int DefaultThreadCount = 8;
+
+        explicit BlockingCallPool(unsigned int threadCount = DefaultThreadCount)
+            : stopped(false)
+        {
+            if (threadCount == 0)
+            {
+                threadCount = 1;
+            }
+
+            for (unsigned int i = 0; i < threadCount; i++)
+            {
+                this->threads.emplace_back([this] { this->ThreadLoop(); });
+            }
+        }
+
+        /// <summary>
+        /// Run the queued calls, then stop the threads.
+        /// </summary>
+        ~BlockingCallPool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->stopped = true;
+            }
+
+            this->signal.notify_all();
+            for (size_t i = 0; i < this->threads.size(); i++)
+            {
+                this->threads[i].join();
+            }
+        }
+
+        /// <summary>
+        /// Queue a call to run on one of the threads.
+        /// </summary>
+        void Submit(std::function<void()> work)
+        {
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->queue.push_back(std::move(work));
+            }
+
+            this->signal.notify_one();
+        }
+
+        /// <summary>
+        /// The pool the clients use by default. It is never destroyed, because joining its threads while a DLL that
+        /// includes this header unloads would wait under the loader lock.
+        /// </summary>
+        static BlockingCallPool &Shared()
+        {
+            static BlockingCallPool *pool = new BlockingCallPool();
+            return *pool;
+        }
+
+    private:
+        BlockingCallPool(const BlockingCallPool &) = delete;
+        BlockingCallPool &operator=(const BlockingCallPool &) = delete;
+
+        void ThreadLoop()
+        {
+            for (;;)
+            {
+                std::function<void()> work;
+                {
+                    std::unique_lock<std::mutex> lock(this->mutex);
+                    this->signal.wait(lock, [this] { return this->stopped || !this->queue.empty(); });
+                    if (this->queue.empty())
+                    {
+                        return;
+                    }
+
+                    work = std::move(this->queue.front());
+                    this->queue.pop_front();
+                }
+
+                work();
+            }
+        }
+
+        std::mutex mutex;
+        std::condition_variable signal;
+        std::deque<std::function<void()> > queue;
+        std::vector<std::thread> threads;
+        bool stopped;
+    };
+
+    /// <summary>
+    /// Awaitable that runs a blocking call on a BlockingCallPool and resumes the awaiting coroutine on its executor.
+    /// It is used for stub methods that have no asynchronous RPC form, so that they do not block the executor threads.
+    /// An exception the call throws is thrown again in the awaiting coroutine.
+    /// </summary>
+    template <typename TResult>
+    class BlockingCallAwaitable
+    {
+    public:
+        BlockingCallAwaitable(Executor &executor, std::function<TResult()> call, BlockingCallPool &pool = BlockingCallPool::Shared())
+            : executor(executor), pool(pool), call(std::move(call)), result()
+        {
+        }
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(coroutine_handle<> handle)
+        {
+            this->pool.Submit([this, handle]
+            {
+                try
+                {
+                    this->result = this->call();
+                }
+                catch (...)
+                {
+                    this->exception = std::current_exception();
+                }
+
+                this->executor.Post(handle);
+            });
+        }
+
+        TResult await_resume()
+        {
+            if (this->exception)
+            {
+                std::rethrow_exception(this->exception);
+            }
+
+            return this->result;
+        }
+
+    private:
+        Executor &executor;
+        BlockingCallPool &pool;
+        std::function<TResult()> call;
+        TResult result;
+        std::exception_ptr exception;
+    };
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+// Header-only coroutine client over the EMSMDB stub. A load generator links against MS-OXCRPC_RPCStub and writes
+// ROP sequences as straight-line code:
+//
+//     Task<long> LogonAndOpenInbox(EmsmdbClient &client)
+//     {
+//         RpcExt2Result logon = co_await client.RpcExt2(logonRequest, logonSize, response, sizeof(response));
+//         ...
+//         RpcExt2Result open = co_await client.RpcExt2(openFolderRequest, openFolderSize, response, sizeof(response));
+//         co_return open.reply;
+//     }
+//
+// Each RpcExt2 call is started with EcDoRpcExt2Begin, so a suspended session does not hold an executor thread.
+
+#include "AsyncRpcExt2.h"
+#include "CoroutineExecutor.h"
+#include "RpcExt2Flags.h"
+
+namespace StubCoroutines
+{
+    /// <summary>
+    /// The outcome of one EcDoRpcExt2 call.
+    /// </summary>
+    struct RpcExt2Result
+    {
+        long reply;
+        unsigned long flags;
+        unsigned long cbOut;
+        unsigned long cbAuxOut;
+        unsigned long transTime;
+    };
+
+    /// <summary>
+    /// Awaitable that starts an asynchronous EcDoRpcExt2 call and resumes the awaiting coroutine on the executor once it completes.
+    /// </summary>
+    class RpcExt2Awaitable
+    {
+    public:
+        RpcExt2Awaitable(Executor &executor, CXH *pcxh, unsigned long flags, unsigned char *rgbIn, unsigned long cbIn, unsigned char *rgbOut, unsigned long cbOut, unsigned char *rgbAuxOut, unsigned long cbAuxOut)
+            : executor(executor), pcxh(pcxh), rgbIn(rgbIn), cbIn(cbIn), rgbOut(rgbOut), rgbAuxOut(rgbAuxOut)
+        {
+            this->result.reply = 0;
+            this->result.flags = flags;
+            this->result.cbOut = cbOut;
+            this->result.cbAuxOut = cbAuxOut;
+            this->result.transTime = 0;
+        }
+
+        bool await_ready() const noexcept { return false; }
+
+        bool await_suspend(coroutine_handle<> handle)
+        {
+            this->continuation = handle;
+            long status = EcDoRpcExt2Begin(
+                this->pcxh,
+                &this->result.flags,
+                this->rgbIn,
+                this->cbIn,
+                this->rgbOut,
+                &this->result.cbOut,
+                NULL,
+                0,
+                this->rgbAuxOut,
+                &this->result.cbAuxOut,
+                &this->result.transTime,
+                RpcExt2Awaitable::Completed,
+                this);
+            if (status != 0)
+            {
+                // The call did not start, so resume the awaiting coroutine immediately with the error.
+                this->result.reply = status;
+                return false;
+            }
+
+            return true;
+        }
+
+        RpcExt2Result await_resume() const noexcept { return this->result; }
+
+    private:
+        static void __stdcall Completed(void *context, long reply)
+        {
+            RpcExt2Awaitable *awaitable = (RpcExt2Awaitable *)context;
+            awaitable->result.reply = reply;
+            awaitable->executor.Post(awaitable->continuation);
+        }
+
+        Executor &executor;
+        CXH *pcxh;
+        unsigned char *rgbIn;
+        unsigned long cbIn;
+        unsigned char *rgbOut;
+        unsigned char *rgbAuxOut;
+        coroutine_handle<> continuation;
+        RpcExt2Result result;
+    };
+
+    /// <summary>
+    /// A coroutine-friendly session on the EMSMDB interface. Calls on one client MUST NOT overlap, as specified
+    /// for a single CXH in MS-OXCRPC; use one client per session and run many clients on one executor.
+    /// </summary>
+    class EmsmdbClient
+    {
+    public:
+        /// <summary>
+        /// Create a client for a session that was opened with Connect or EcDoConnectEx.
+        /// </summary>
+        EmsmdbClient(Executor &executor, CXH cxh)
+            : executor(executor), cxh(cxh)
+        {
+        }
+
+        /// <summary>
+        /// Send a ROP request buffer, prefixed by an RPC_HEADER_EXT header, and receive the ROP response buffer.
+        /// </summary>
+        /// <param name="rgbIn">The ROP request payload. It MUST stay valid until the awaitable completes.</param>
+        /// <param name="cbIn">The size of the ROP request payload.</param>
+        /// <param name="rgbOut">The buffer that receives the ROP response payload.</param>
+        /// <param name="cbOut">The size of rgbOut, at most 0x40000.</param>
+        /// <param name="flags">The pulFlags value of EcDoRpcExt2. RPCEXT2_FLAG_NO_COMPRESSION | RPCEXT2_FLAG_NO_XORMAGIC asks the server not to compress or obfuscate the response.</param>
+        RpcExt2Awaitable RpcExt2(unsigned char *rgbIn, unsigned long cbIn, unsigned char *rgbOut, unsigned long cbOut, unsigned long flags = 0x00000003)
+        {
+            return RpcExt2Awaitable(this->executor, &this->cxh, flags, rgbIn, cbIn, rgbOut, cbOut, this->auxOut, sizeof(this->auxOut));
+        }
+
+        /// <summary>
+        /// Close the session with EcDoDisconnect. The call runs on a blocking thread because EcDoDisconnect has no asynchronous form.
+        /// </summary>
+        BlockingCallAwaitable<long> Disconnect()
+        {
+            CXH *pcxh = &this->cxh;
+            return BlockingCallAwaitable<long>(this->executor, [pcxh]() -> long
+            {
+                long status = 0;
+                RpcTryExcept
+                {
+                    status = EcDoDisconnect(pcxh);
+                }
+                RpcExcept(EXCEPTION_EXECUTE_HANDLER)
+                {
+                    status = ::RpcExceptionCode();
+                }
+                RpcEndExcept;
+                return status;
+            });
+        }
+
+        CXH Handle() const { return this->cxh; }
+
+        Executor &GetExecutor() { return this->executor; }
+
+    private:
+        Executor &executor;
+        CXH cxh;
+
+        // The auxiliary output buffer; its size is the SMALL_RANGE_ULONG limit of pcbAuxOut.
+        unsigned char auxOut[0x1008];
+    };
+}
@@ -0,0 +1,334 @@
+#include "FastTransferDownload.h"
+#include "PipelinedRpcCall.h"
+
+// Downloads a FastTransfer stream with RopFastTransferSourceGetBuffer. Once a response arrives, its TransferStatus
+// is checked and the next request is started before its TransferBuffers are lexed, so lexing overlaps the next
+// round trip. BufferSize starts small, so the first tokens arrive early, and grows while doing so raises throughput.
+
+/// <summary>
+/// The smallest and largest BufferSize requested. A response of the largest size still fits in one response buffer.
+/// </summary>
+#define FX_MIN_BUFFER_SIZE 0x1000
+#define FX_MAX_BUFFER_SIZE 0x7F00
+
+/// <summary>
+/// The TransferStatus values of MS-OXCROPS section 2.2.13.5.2.
+/// </summary>
+#define FX_TRANSFER_STATUS_ERROR    0x0000
+#define FX_TRANSFER_STATUS_PARTIAL  0x0001
+#define FX_TRANSFER_STATUS_NOROOM   0x0002
+#define FX_TRANSFER_STATUS_DONE     0x0003
+
+/// <summary>
+/// ecError, returned for a stream the server ended with TransferStatus Error but without an error code in FXErrorInfo.
+/// </summary>
+#define FX_EC_ERROR                 0x80004005
+
+/// <summary>
+/// The fields of the responses of one call that decide the next request.
+/// </summary>
+struct GetBufferSummary
+{
+    unsigned long responseCount;
+    unsigned long bytes;
+    unsigned long returnValue;          // The first ReturnValue that is not 0.
+    unsigned long backoffTime;
+    unsigned short transferStatus;      // Of the last successful response.
+    unsigned short inProgressCount;
+    unsigned short totalStepCount;
+};
+
+static void PrepareGetBufferCall(PipelinedRpcCall *call, unsigned char logonId, unsigned long transferHandle, unsigned short bufferSize)
+{
+    RopCodec::RopRequestWriter writer(call->rgbIn, sizeof(call->rgbIn));
+    writer.Append<RopCodec::FastTransferSourceGetBuffer>(logonId, (unsigned char)0, bufferSize);
+    call->cbIn = writer.Finish(&transferHandle, 1);
+    call->ropCount = 1;
+    call->bytesRequested = bufferSize;
+}
+
+/// <summary>
+/// Read the fixed fields of the RopFastTransferSourceGetBuffer responses of a completed call, without lexing them.
+/// </summary>
+static long SummarizeResponse(PipelinedRpcCall *call, GetBufferSummary *summary)
+{
+    memset(summary, 0, sizeof(GetBufferSummary));
+    RopCodec::RopResponseReader reader(call->rgbOut, call->cbOut);
+    long status = 0;
+    while (summary->returnValue == 0 && (status = reader.NextBuffer()) == 0)
+    {
+        RopCodec::Byte ropId;
+        RopCodec::Byte inputHandleIndex;
+        RopCodec::Byte reserved;
+        RopCodec::ULong returnValue;
+        RopCodec::UShort transferBufferSize;
+        while (reader.Peek(ropId, returnValue) && ropId == RopCodec::FastTransferSourceGetBuffer::Id)
+        {
+            summary->responseCount++;
+            if (returnValue == RopCodec::FastTransferSourceGetBuffer::ServerBusy)
+            {
+                if (!reader.ReadLayout<RopCodec::Layout<RopCodec::Byte, RopCodec::Byte, RopCodec::ULong, RopCodec::ULong> >(
+                    ropId, inputHandleIndex, summary->returnValue, summary->backoffTime))
+                {
+                    return ERROR_INVALID_DATA;
+                }
+
+                break;
+            }
+
+            if (returnValue != 0)
+            {
+                summary->returnValue = returnValue;
+                break;
+            }
+
+            if (!reader.Read<RopCodec::FastTransferSourceGetBuffer>(
+                    ropId,
+                    inputHandleIndex,
+                    returnValue,
+                    summary->transferStatus,
+                    summary->inProgressCount,
+                    summary->totalStepCount,
+                    reserved,
+                    transferBufferSize)
+                || reader.Take(transferBufferSize) == NULL)
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            summary->bytes += transferBufferSize;
+        }
+    }
+
+    if (summary->returnValue == 0 && status != ERROR_NO_MORE_ITEMS)
+    {
+        return status;
+    }
+
+    return summary->responseCount == 0 ? ERROR_INVALID_DATA : 0;
+}
+
+/// <summary>
+/// Feed the TransferBuffers of the successful responses of a completed call to the lexer, in order.
+/// </summary>
+static long LexResponse(PipelinedRpcCall *call, FX_LEXER *lexer)
+{
+    ROP_RESPONSE_READER reader;
+    RopResponseBegin(&reader, call->rgbOut, call->cbOut);
+    long status;
+    while ((status = RopResponseNextBuffer(&reader)) == 0)
+    {
+        unsigned char ropId;
+        unsigned long returnValue;
+        while (RopResponsePeek(&reader, &ropId, &returnValue) == 0 && ropId == RopCodec::FastTransferSourceGetBuffer::Id)
+        {
+            if (returnValue != 0)
+            {
+                return 0;
+            }
+
+            FX_GETBUFFER_RESPONSE response;
+            status = FxLexerFeedResponse(lexer, &reader, &response);
+            if (status != 0)
+            {
+                return status;
+            }
+        }
+    }
+
+    return status == ERROR_NO_MORE_ITEMS ? 0 : status;
+}
+
+/// <summary>
+/// Choose the BufferSize of the next request from the responses and the throughput of the last call.
+/// </summary>
+/// <param name="bufferSize">The BufferSize of the last request.</param>
+/// <param name="summary">The responses of the last call.</param>
+/// <param name="throughput">The bytes per second of the last call, from start to completion.</param>
+/// <param name="bestThroughput">The best throughput seen since the last back-off; updated by this call.</param>
+static unsigned short AdaptBufferSize(unsigned short bufferSize, const GetBufferSummary &summary, unsigned long throughput, unsigned long &bestThroughput)
+{
+    if (summary.returnValue == RopCodec::FastTransferSourceGetBuffer::ServerBusy)
+    {
+        bestThroughput = 0;
+        return bufferSize / 2 < FX_MIN_BUFFER_SIZE ? FX_MIN_BUFFER_SIZE : bufferSize / 2;
+    }
+
+    // The next atomic element does not fit: more room is required, whatever the throughput.
+    bool grow = summary.transferStatus == FX_TRANSFER_STATUS_NOROOM;
+
+    // Grow while the buffers come back full and a larger size keeps paying off, unless the transfer is about to end.
+    bool filled = summary.bytes >= (unsigned long)bufferSize * summary.responseCount;
+    bool lastStep = summary.totalStepCount != 0 && summary.inProgressCount + 1 >= summary.totalStepCount;
+    if (filled && !lastStep && (unsigned __int64)throughput * 10 >= (unsigned __int64)bestThroughput * 11)
+    {
+        grow = true;
+    }
+
+    if (throughput > bestThroughput)
+    {
+        bestThroughput = throughput;
+    }
+
+    if (!grow)
+    {
+        return bufferSize;
+    }
+
+    return (unsigned long)bufferSize * 2 > FX_MAX_BUFFER_SIZE ? FX_MAX_BUFFER_SIZE : (unsigned short)(bufferSize * 2);
+}
+
+/// <summary>
+/// Download the FastTransfer stream of a FastTransfer download context and lex it as it arrives.
+/// </summary>
+/// <param name="pcxh">The CXH that was created by calling EcDoConnectEx.</param>
+/// <param name="logonId">The LogonId of the logon the download context belongs to.</param>
+/// <param name="transferHandle">The server object handle of the download context, such as returned by RopFastTransferSourceCopyTo.</param>
+/// <param name="lexer">The lexer the stream is fed to; FxLexerEnd is called on it once the stream is done.</param>
+/// <param name="progress">An optional routine invoked after every call.</param>
+/// <param name="context">The caller context passed back to the progress routine.</param>
+/// <param name="stats">Receives the statistics of the download.</param>
+/// <returns>If success, it returns 0, else returns the error code, or the ReturnValue of the failed ROP. If the server
+/// ends the stream with TransferStatus Error, it returns the error code of the FXErrorInfo of the stream, or ecError
+/// if there is none, and sets ErrorCode and ErrorInfoOffset in stats.</returns>
+long __stdcall FxDownload(
+    CXH *pcxh,
+    unsigned char logonId,
+    unsigned long transferHandle,
+    FX_LEXER *lexer,
+    FX_PROGRESS_ROUTINE progress,
+    void *context,
+    FX_DOWNLOAD_STATS *stats)
+{
+    if (pcxh == NULL || lexer == NULL || stats == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    memset(stats, 0, sizeof(FX_DOWNLOAD_STATS));
+    PipelinedCallRing calls(2);
+    if (!calls.IsValid())
+    {
+        return GetLastError();
+    }
+
+    LARGE_INTEGER start;
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&start);
+
+    unsigned short bufferSize = FX_MIN_BUFFER_SIZE;
+    unsigned long bestThroughput = 0;
+    unsigned long k = 0;
+    bool done = false;
+    bool failed = false;
+
+    PrepareGetBufferCall(calls[0], logonId, transferHandle, bufferSize);
+    long status = BeginPipelinedCall(pcxh, calls[0], PIPELINED_RPC_FLAGS);
+    while (status == 0)
+    {
+        LARGE_INTEGER waitStart;
+        QueryPerformanceCounter(&waitStart);
+        status = EndPipelinedCall(calls[k]);
+        QueryPerformanceCounter(&now);
+        stats->StallMilliseconds += PipelinedElapsedMilliseconds(waitStart, now);
+        if (status != 0)
+        {
+            break;
+        }
+
+        stats->RequestCount++;
+        stats->BufferSize = bufferSize;
+
+        GetBufferSummary summary;
+        status = SummarizeResponse(calls[k], &summary);
+        if (status != 0)
+        {
+            break;
+        }
+
+        bool busy = summary.returnValue == RopCodec::FastTransferSourceGetBuffer::ServerBusy;
+        if (summary.returnValue != 0 && !busy)
+        {
+            status = (long)summary.returnValue;
+            break;
+        }
+
+        if (busy)
+        {
+            stats->BusyCount++;
+        }
+        else
+        {
+            stats->TransferStatus = summary.transferStatus;
+            stats->InProgressCount = summary.inProgressCount;
+            stats->TotalStepCount = summary.totalStepCount;
+            failed = summary.transferStatus == FX_TRANSFER_STATUS_ERROR;
+            done = summary.transferStatus == FX_TRANSFER_STATUS_DONE || failed;
+        }
+
+        unsigned long roundTrip = PipelinedElapsedMilliseconds(calls[k]->begun, calls[k]->finished);
+        unsigned long throughput = (unsigned long)((unsigned __int64)summary.bytes * 1000 / (roundTrip == 0 ? 1 : roundTrip));
+        bufferSize = AdaptBufferSize(bufferSize, summary, throughput, bestThroughput);
+
+        // Start the next request before lexing, unless the server asked to back off.
+        bool nextStarted = false;
+        if (!done && !busy)
+        {
+            PrepareGetBufferCall(calls[k + 1], logonId, transferHandle, bufferSize);
+            status = BeginPipelinedCall(pcxh, calls[k + 1], PIPELINED_RPC_FLAGS);
+            if (status != 0)
+            {
+                break;
+            }
+
+            nextStarted = true;
+        }
+
+        status = LexResponse(calls[k], lexer);
+        stats->BytesReceived += summary.bytes;
+        QueryPerformanceCounter(&now);
+        stats->ElapsedMilliseconds = PipelinedElapsedMilliseconds(start, now);
+        stats->BytesPerSecond = (unsigned long)(stats->BytesReceived * 1000 / (stats->ElapsedMilliseconds == 0 ? 1 : stats->ElapsedMilliseconds));
+        if (status == 0 && progress != NULL)
+        {
+            status = progress(context, stats);
+        }
+
+        if (status != 0 || done)
+        {
+            break;
+        }
+
+        if (!nextStarted)
+        {
+            Sleep(summary.backoffTime);
+            PrepareGetBufferCall(calls[k + 1], logonId, transferHandle, bufferSize);
+            status = BeginPipelinedCall(pcxh, calls[k + 1], PIPELINED_RPC_FLAGS);
+            if (status != 0)
+            {
+                break;
+            }
+        }
+
+        k++;
+    }
+
+    // Wait for a request still in flight, so that its buffers are not released while the RPC run-time library uses them.
+    EndPipelinedCall(calls[k + 1]);
+    QueryPerformanceCounter(&now);
+    stats->ElapsedMilliseconds = PipelinedElapsedMilliseconds(start, now);
+    if (status == 0 && failed)
+    {
+        // The server aborted the stream; the errorInfo element, if any, was passed to the token routine.
+        unsigned long errorCode = 0;
+        if (FxLexerGetErrorInfo(lexer, &stats->ErrorInfoOffset, &errorCode) != 0 || errorCode == 0)
+        {
+            errorCode = FX_EC_ERROR;
+        }
+
+        stats->ErrorCode = errorCode;
+        return (long)errorCode;
+    }
+
+    return status == 0 ? FxLexerEnd(lexer) : status;
+}
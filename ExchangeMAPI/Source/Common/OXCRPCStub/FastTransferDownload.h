@@ -0,0 +1,40 @@
+#pragma once
+
+#include "MS-OXCRPC.h"
+#include "FastTransferLexer.h"
+
+/// <summary>
+/// The statistics of a FastTransfer download, updated after every EcDoRpcExt2 call.
+/// </summary>
+typedef struct _FX_DOWNLOAD_STATS
+{
+    unsigned __int64 BytesReceived;     // The TransferBuffer bytes fed to the lexer.
+    unsigned long RequestCount;         // The number of EcDoRpcExt2 calls.
+    unsigned long BusyCount;            // The number of responses that asked to back off.
+    unsigned long ElapsedMilliseconds;
+    unsigned long StallMilliseconds;    // The time spent waiting for a response after the previous one was lexed.
+    unsigned long BytesPerSecond;       // BytesReceived over ElapsedMilliseconds.
+    unsigned short BufferSize;          // The BufferSize of the last RopFastTransferSourceGetBuffer request.
+    unsigned short TransferStatus;      // The TransferStatus of the last response.
+    unsigned short InProgressCount;
+    unsigned short TotalStepCount;
+    unsigned long ErrorCode;            // Set if the server ended the stream with TransferStatus Error; see FxDownload.
+    unsigned __int64 ErrorInfoOffset;   // The offset of the PidTagFXErrorInfo marker in the stream, if ErrorCode is set.
+} FX_DOWNLOAD_STATS;
+
+/// <summary>
+/// Routine invoked after every EcDoRpcExt2 call of a download, once its TransferBuffers have been lexed.
+/// </summary>
+/// <param name="context">The caller context passed to FxDownload.</param>
+/// <param name="stats">The statistics so far.</param>
+/// <returns>0 to continue; any other value stops the download and is returned by FxDownload.</returns>
+typedef long (__stdcall *FX_PROGRESS_ROUTINE)(void *context, const FX_DOWNLOAD_STATS *stats);
+
+long __stdcall FxDownload(
+    CXH *pcxh,
+    unsigned char logonId,
+    unsigned long transferHandle,
+    FX_LEXER *lexer,
+    FX_PROGRESS_ROUTINE progress,
+    void *context,
+    FX_DOWNLOAD_STATS *stats);
@@ -0,0 +1,667 @@
+#include "FastTransferLexer.h"
+
+// A resumable lexer for FastTransfer streams. The stream arrives in TransferBuffers of arbitrary size, so any field
+// can be split across two buffers: fields of up to 16 bytes are gathered in a small scratch buffer, and
+// variable-size values are passed to the token routine in chunks that point into the fed buffer. Nothing larger
+// than a property name is ever held by the lexer, whatever the size of the stream.
+
+#define FX_PTYP_INTEGER16           0x0002
+#define FX_PTYP_INTEGER32           0x0003
+#define FX_PTYP_FLOATING32          0x0004
+#define FX_PTYP_FLOATING64          0x0005
+#define FX_PTYP_CURRENCY            0x0006
+#define FX_PTYP_FLOATINGTIME        0x0007
+#define FX_PTYP_ERRORCODE           0x000A
+#define FX_PTYP_BOOLEAN             0x000B
+#define FX_PTYP_OBJECT              0x000D
+#define FX_PTYP_INTEGER64           0x0014
+#define FX_PTYP_STRING8             0x001E
+#define FX_PTYP_STRING              0x001F
+#define FX_PTYP_TIME                0x0040
+#define FX_PTYP_GUID                0x0048
+#define FX_PTYP_SERVERID            0x00FB
+#define FX_PTYP_BINARY              0x0102
+#define FX_PTYP_MULTIPLE_FLAG       0x1000
+#define FX_PTYP_CODEPAGE_FLAG       0x8000
+
+/// <summary>
+/// PidTagIdsetGiven is declared PtypInteger32 but is serialized as a PtypBinary value, as specified in MS-OXCFXICS section 2.2.1.1.1.
+/// </summary>
+#define FX_PIDTAG_IDSETGIVEN        0x40170003
+
+/// <summary>
+/// The marker of the errorInfo element a server writes when it cannot complete a stream, as specified in MS-OXCFXICS
+/// section 2.2.4.3.
+/// </summary>
+#define FX_PIDTAG_FXERRORINFO       0x40180003
+
+/// <summary>
+/// The longest property name accepted, in UTF-16 code units.
+/// </summary>
+#define FX_MAX_NAME_LENGTH          0x400
+
+/// <summary>
+/// The markers of MS-OXCFXICS section 2.2.4.1.4. The meta-properties PidTagEcWarning, PidTagNewFXFolder,
+/// PidTagFXDelProp, MetaTagIncrSyncGroupId and MetaTagIncrementalSyncMessagePartial carry values and are not markers.
+/// </summary>
+static const unsigned long m_markers[] =
+{
+    0x40090003,     // PidTagStartTopFld
+    0x400B0003,     // PidTagEndFolder
+    0x400A0003,     // PidTagStartSubFld
+    0x400C0003,     // PidTagStartMessage
+    0x400D0003,     // PidTagEndMessage
+    0x40100003,     // PidTagStartFAIMsg
+    0x40010003,     // PidTagStartEmbed
+    0x40020003,     // PidTagEndEmbed
+    0x40030003,     // PidTagStartRecip
+    0x40040003,     // PidTagEndToRecip
+    0x40000003,     // PidTagNewAttach
+    0x400E0003,     // PidTagEndAttach
+    0x40120003,     // PidTagIncrSyncChg
+    0x407D0003,     // PidTagIncrSyncChgPartial
+    0x40130003,     // PidTagIncrSyncDel
+    0x40140003,     // PidTagIncrSyncEnd
+    0x402F0003,     // PidTagIncrSyncRead
+    0x403A0003,     // PidTagIncrSyncStateBegin
+    0x403B0003,     // PidTagIncrSyncStateEnd
+    0x4074000B,     // PidTagIncrSyncProgressMode
+    0x4075000B,     // PidTagIncrSyncProgressPerMsg
+    0x40150003,     // PidTagIncrSyncMessage
+    0x407B0102,     // PidTagIncrSyncGroupInfo
+    FX_PIDTAG_FXERRORINFO
+};
+
+enum FxLexerState
+{
+    FxStateTag,
+    FxStateNamedGuid,
+    FxStateNamedKind,
+    FxStateNamedDispid,
+    FxStateNamedName,
+    FxStateFixedValue,
+    FxStateLength,
+    FxStateVariableData,
+    FxStateMultiCount,
+    FxStateFailed
+};
+
+struct _FX_LEXER
+{
+    FX_TOKEN_ROUTINE routine;
+    void *context;
+    FxLexerState state;
+    long failure;                   // The status returned once the lexer has failed.
+    unsigned __int64 offset;        // The bytes consumed from the whole stream.
+    unsigned char scratch[16];      // A field split across buffers.
+    unsigned long have;             // The bytes of the field gathered in scratch.
+    FX_TOKEN token;                 // The property being lexed.
+    unsigned short valueType;       // The type of the value, or of each element of a multi-valued property.
+    bool multiValued;
+    unsigned long remaining;        // The bytes of the variable-size value still to come.
+    wchar_t name[FX_MAX_NAME_LENGTH + 1];
+    unsigned long nameLength;
+    bool errorInfo;                 // Set once the PidTagFXErrorInfo marker was lexed.
+    unsigned __int64 errorInfoOffset;
+    unsigned long errorCode;        // The first PtypErrorCode value after the marker, or 0.
+};
+
+/// <summary>
+/// Read a little-endian 32-bit field.
+/// </summary>
+static inline unsigned long ReadULong(const unsigned char *field)
+{
+    uint32_t value;
+    memcpy(&value, field, sizeof(value));
+    return value;
+}
+
+static bool IsMarker(unsigned long tag)
+{
+    for (size_t i = 0; i < sizeof(m_markers) / sizeof(m_markers[0]); i++)
+    {
+        if (m_markers[i] == tag)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// <summary>
+/// The size of a fixedSizeValue of MS-OXCFXICS section 2.2.4.1.3, or 0 for other types. PtypBoolean takes 2 bytes here.
+/// </summary>
+static unsigned long FixedSizeOf(unsigned short propertyType)
+{
+    switch (propertyType)
+    {
+    case FX_PTYP_INTEGER16:
+    case FX_PTYP_BOOLEAN:
+        return 2;
+    case FX_PTYP_INTEGER32:
+    case FX_PTYP_FLOATING32:
+    case FX_PTYP_ERRORCODE:
+        return 4;
+    case FX_PTYP_FLOATING64:
+    case FX_PTYP_CURRENCY:
+    case FX_PTYP_FLOATINGTIME:
+    case FX_PTYP_INTEGER64:
+    case FX_PTYP_TIME:
+        return 8;
+    case FX_PTYP_GUID:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+/// <summary>
+/// Whether a type is serialized as a length followed by the value, including the code page string types.
+/// </summary>
+static bool IsVariableType(unsigned short propertyType)
+{
+    if ((propertyType & FX_PTYP_CODEPAGE_FLAG) != 0)
+    {
+        return true;
+    }
+
+    switch (propertyType)
+    {
+    case FX_PTYP_STRING:
+    case FX_PTYP_STRING8:
+    case FX_PTYP_BINARY:
+    case FX_PTYP_SERVERID:
+    case FX_PTYP_OBJECT:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/// <summary>
+/// Return a field of needed bytes once all of it is available. A field that is whole in the fed buffer is returned
+/// in place; a split field is gathered in the scratch buffer across calls.
+/// </summary>
+/// <returns>The field, or NULL if the fed buffer ended first.</returns>
+static const unsigned char *Gather(FX_LEXER *lexer, const unsigned char *&data, unsigned long &size, unsigned long needed)
+{
+    if (lexer->have == 0 && size >= needed)
+    {
+        const unsigned char *field = data;
+        data += needed;
+        size -= needed;
+        lexer->offset += needed;
+        return field;
+    }
+
+    unsigned long count = needed - lexer->have < size ? needed - lexer->have : size;
+    memcpy(lexer->scratch + lexer->have, data, count);
+    lexer->have += count;
+    data += count;
+    size -= count;
+    lexer->offset += count;
+    if (lexer->have < needed)
+    {
+        return NULL;
+    }
+
+    lexer->have = 0;
+    return lexer->scratch;
+}
+
+static long Fail(FX_LEXER *lexer, long status)
+{
+    lexer->state = FxStateFailed;
+    lexer->failure = status;
+    return status;
+}
+
+static long Emit(FX_LEXER *lexer)
+{
+    const FX_TOKEN &token = lexer->token;
+    if (token.Kind == FxTokenMarker && token.PropertyTag == FX_PIDTAG_FXERRORINFO && !lexer->errorInfo)
+    {
+        lexer->errorInfo = true;
+        lexer->errorInfoOffset = token.StreamOffset;
+    }
+    else if (lexer->errorInfo && lexer->errorCode == 0 && token.Kind == FxTokenFixedValue
+        && (token.PropertyTag & 0xFFFF) == FX_PTYP_ERRORCODE && token.DataSize == 4)
+    {
+        lexer->errorCode = (unsigned long)token.Data[0] | ((unsigned long)token.Data[1] << 8) | ((unsigned long)token.Data[2] << 16) | ((unsigned long)token.Data[3] << 24);
+    }
+
+    long status = lexer->routine(lexer->context, &lexer->token);
+    return status == 0 ? 0 : Fail(lexer, status);
+}
+
+/// <summary>
+/// Move to the state that reads the next value, or the next element of a multi-valued property.
+/// </summary>
+static void NextValue(FX_LEXER *lexer)
+{
+    lexer->token.Offset = 0;
+    lexer->token.ValueSize = 0;
+    lexer->token.LastChunk = FALSE;
+    if (FixedSizeOf(lexer->valueType) != 0)
+    {
+        lexer->state = FxStateFixedValue;
+    }
+    else
+    {
+        lexer->state = FxStateLength;
+    }
+}
+
+/// <summary>
+/// Finish a value: move to the next element of a multi-valued property, or to the next property tag.
+/// </summary>
+static void EndValue(FX_LEXER *lexer)
+{
+    if (lexer->multiValued && ++lexer->token.ValueIndex < lexer->token.ValueCount)
+    {
+        NextValue(lexer);
+    }
+    else
+    {
+        lexer->state = FxStateTag;
+    }
+}
+
+/// <summary>
+/// Decide how the value of the current property tag is serialized, once its propInfo has been read.
+/// </summary>
+static long BeginValue(FX_LEXER *lexer)
+{
+    unsigned short propertyType = (unsigned short)(lexer->token.PropertyTag & 0xFFFF);
+    lexer->multiValued = false;
+    if (lexer->token.PropertyTag == FX_PIDTAG_IDSETGIVEN)
+    {
+        lexer->valueType = FX_PTYP_BINARY;
+    }
+    else if ((propertyType & FX_PTYP_CODEPAGE_FLAG) == 0 && (propertyType & FX_PTYP_MULTIPLE_FLAG) != 0)
+    {
+        lexer->valueType = propertyType & ~FX_PTYP_MULTIPLE_FLAG;
+        lexer->multiValued = true;
+        if (FixedSizeOf(lexer->valueType) == 0 && !IsVariableType(lexer->valueType))
+        {
+            return Fail(lexer, ERROR_INVALID_DATA);
+        }
+
+        lexer->state = FxStateMultiCount;
+        return 0;
+    }
+    else
+    {
+        lexer->valueType = propertyType;
+        if (FixedSizeOf(propertyType) == 0 && !IsVariableType(propertyType))
+        {
+            return Fail(lexer, ERROR_INVALID_DATA);
+        }
+    }
+
+    NextValue(lexer);
+    return 0;
+}
+
+/// <summary>
+/// Create a lexer for one FastTransfer stream.
+/// </summary>
+/// <param name="routine">The routine the tokens are passed to.</param>
+/// <param name="context">The caller context passed back to the routine.</param>
+/// <param name="lexer">Receives the lexer; release it with FxLexerDestroy.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall FxLexerCreate(FX_TOKEN_ROUTINE routine, void *context, FX_LEXER **lexer)
+{
+    if (routine == NULL || lexer == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    FX_LEXER *created = new FX_LEXER();
+    memset(created, 0, sizeof(FX_LEXER));
+    created->routine = routine;
+    created->context = context;
+    created->state = FxStateTag;
+    *lexer = created;
+    return 0;
+}
+
+void __stdcall FxLexerDestroy(FX_LEXER *lexer)
+{
+    delete lexer;
+}
+
+/// <summary>
+/// Lex the next part of the stream, typically one TransferBuffer. Tokens are passed to the routine before it returns.
+/// </summary>
+/// <param name="lexer">The lexer.</param>
+/// <param name="data">The next bytes of the stream.</param>
+/// <param name="size">The number of bytes.</param>
+/// <returns>If success, it returns 0. ERROR_INVALID_DATA indicates a malformed stream; a value returned by the routine stops lexing and is returned.</returns>
+long __stdcall FxLexerFeed(FX_LEXER *lexer, const unsigned char *data, unsigned long size)
+{
+    if (lexer == NULL || (data == NULL && size != 0))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    const unsigned char *field;
+    long status = 0;
+    while (status == 0 && lexer->state != FxStateFailed)
+    {
+        // A variable-size value of length 0 completes without input, so check for input in each state instead.
+        switch (lexer->state)
+        {
+        case FxStateTag:
+            {
+                if (size == 0)
+                {
+                    return 0;
+                }
+
+                unsigned __int64 tagOffset = lexer->offset - lexer->have;
+                if ((field = Gather(lexer, data, size, sizeof(uint32_t))) == NULL)
+                {
+                    return 0;
+                }
+
+                memset(&lexer->token, 0, sizeof(FX_TOKEN));
+                lexer->token.PropertyTag = ReadULong(field);
+                lexer->token.StreamOffset = tagOffset;
+                if (IsMarker(lexer->token.PropertyTag))
+                {
+                    lexer->token.Kind = FxTokenMarker;
+                    status = Emit(lexer);
+                }
+                else if ((lexer->token.PropertyTag >> 16) >= 0x8000)
+                {
+                    lexer->token.IsNamed = TRUE;
+                    lexer->state = FxStateNamedGuid;
+                }
+                else
+                {
+                    status = BeginValue(lexer);
+                }
+            }
+
+            break;
+
+        case FxStateNamedGuid:
+            if ((field = Gather(lexer, data, size, sizeof(GUID))) == NULL)
+            {
+                return 0;
+            }
+
+            memcpy(&lexer->token.PropertySet, field, sizeof(GUID));
+            lexer->state = FxStateNamedKind;
+            break;
+
+        case FxStateNamedKind:
+            if ((field = Gather(lexer, data, size, 1)) == NULL)
+            {
+                return 0;
+            }
+
+            lexer->token.NameKind = *field;
+            if (*field == 0x00)
+            {
+                lexer->state = FxStateNamedDispid;
+            }
+            else if (*field == 0x01)
+            {
+                lexer->nameLength = 0;
+                lexer->state = FxStateNamedName;
+            }
+            else
+            {
+                status = Fail(lexer, ERROR_INVALID_DATA);
+            }
+
+            break;
+
+        case FxStateNamedDispid:
+            if ((field = Gather(lexer, data, size, sizeof(uint32_t))) == NULL)
+            {
+                return 0;
+            }
+
+            lexer->token.Dispid = ReadULong(field);
+            status = BeginValue(lexer);
+            break;
+
+        case FxStateNamedName:
+            {
+                // The name is UTF-16 on the wire; each code unit is kept in one wchar_t, whatever its width.
+                if ((field = Gather(lexer, data, size, sizeof(uint16_t))) == NULL)
+                {
+                    return 0;
+                }
+
+                uint16_t character;
+                memcpy(&character, field, sizeof(uint16_t));
+                if (character != 0 && lexer->nameLength == FX_MAX_NAME_LENGTH)
+                {
+                    status = Fail(lexer, ERROR_INVALID_DATA);
+                    break;
+                }
+
+                lexer->name[lexer->nameLength] = (wchar_t)character;
+                if (character == 0)
+                {
+                    lexer->token.Name = lexer->name;
+                    status = BeginValue(lexer);
+                }
+                else
+                {
+                    lexer->nameLength++;
+                }
+            }
+
+            break;
+
+        case FxStateFixedValue:
+            {
+                unsigned long fixedSize = FixedSizeOf(lexer->valueType);
+                if ((field = Gather(lexer, data, size, fixedSize)) == NULL)
+                {
+                    return 0;
+                }
+
+                lexer->token.Kind = FxTokenFixedValue;
+                lexer->token.ValueSize = fixedSize;
+                lexer->token.Data = field;
+                lexer->token.DataSize = fixedSize;
+                lexer->token.LastChunk = TRUE;
+                status = Emit(lexer);
+                if (status == 0)
+                {
+                    EndValue(lexer);
+                }
+            }
+
+            break;
+
+        case FxStateLength:
+            if ((field = Gather(lexer, data, size, sizeof(uint32_t))) == NULL)
+            {
+                return 0;
+            }
+
+            lexer->token.ValueSize = ReadULong(field);
+            lexer->remaining = lexer->token.ValueSize;
+            lexer->token.Offset = 0;
+            lexer->state = FxStateVariableData;
+            break;
+
+        case FxStateVariableData:
+            {
+                // An empty value is still passed as one chunk, so that every value produces a token.
+                if (size == 0 && lexer->remaining != 0)
+                {
+                    return 0;
+                }
+
+                unsigned long count = lexer->remaining < size ? lexer->remaining : size;
+                lexer->token.Kind = FxTokenVariableValue;
+                lexer->token.Data = data;
+                lexer->token.DataSize = count;
+                lexer->token.LastChunk = count == lexer->remaining ? TRUE : FALSE;
+                data += count;
+                size -= count;
+                lexer->offset += count;
+                lexer->remaining -= count;
+                status = Emit(lexer);
+                lexer->token.Offset += count;
+                if (status == 0 && lexer->remaining == 0)
+                {
+                    EndValue(lexer);
+                }
+            }
+
+            break;
+
+        case FxStateMultiCount:
+            if ((field = Gather(lexer, data, size, sizeof(uint32_t))) == NULL)
+            {
+                return 0;
+            }
+
+            lexer->token.ValueCount = ReadULong(field);
+            lexer->token.Kind = FxTokenMultiValueBegin;
+            lexer->token.ValueIndex = 0;
+            status = Emit(lexer);
+            if (status == 0)
+            {
+                if (lexer->token.ValueCount == 0)
+                {
+                    lexer->state = FxStateTag;
+                }
+                else
+                {
+                    NextValue(lexer);
+                }
+            }
+
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return lexer->state == FxStateFailed ? lexer->failure : status;
+}
+
+/// <summary>
+/// Feed the TransferBuffer of the next RopFastTransferSourceGetBuffer response of a response reader to the lexer.
+/// A failed response, including one that asks to back off, is read and returned in response without lexing.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code of the lexer or of the response format.</returns>
+long __stdcall FxLexerFeedResponse(FX_LEXER *lexer, ROP_RESPONSE_READER *reader, FX_GETBUFFER_RESPONSE *response)
+{
+    if (lexer == NULL || reader == NULL || response == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    memset(response, 0, sizeof(FX_GETBUFFER_RESPONSE));
+    RopCodec::RopResponseReader resumed(reader->Buffer + reader->Cursor, reader->Buffer + reader->RopEnd, reader->HandleCount);
+    RopCodec::Byte ropId;
+    RopCodec::Byte inputHandleIndex;
+    RopCodec::Byte reserved;
+    if (!resumed.Peek(ropId, response->ReturnValue) || ropId != RopCodec::FastTransferSourceGetBuffer::Id)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    const unsigned char *transferBuffer = NULL;
+    if (response->ReturnValue == RopCodec::FastTransferSourceGetBuffer::ServerBusy)
+    {
+        if (!resumed.ReadLayout<RopCodec::Layout<RopCodec::Byte, RopCodec::Byte, RopCodec::ULong, RopCodec::ULong> >(
+            ropId, inputHandleIndex, response->ReturnValue, response->BackoffTime))
+        {
+            return ERROR_INVALID_DATA;
+        }
+    }
+    else if (response->ReturnValue != 0)
+    {
+        if (!resumed.ReadLayout<RopCodec::ResponseHeader>(ropId, inputHandleIndex, response->ReturnValue))
+        {
+            return ERROR_INVALID_DATA;
+        }
+    }
+    else
+    {
+        if (!resumed.Read<RopCodec::FastTransferSourceGetBuffer>(
+            ropId,
+            inputHandleIndex,
+            response->ReturnValue,
+            response->TransferStatus,
+            response->InProgressCount,
+            response->TotalStepCount,
+            reserved,
+            response->TransferBufferSize))
+        {
+            return ERROR_INVALID_DATA;
+        }
+
+        if ((transferBuffer = resumed.Take(response->TransferBufferSize)) == NULL)
+        {
+            return ERROR_INVALID_DATA;
+        }
+    }
+
+    reader->Cursor = (unsigned long)(resumed.Cursor() - reader->Buffer);
+    return transferBuffer == NULL ? 0 : FxLexerFeed(lexer, transferBuffer, response->TransferBufferSize);
+}
+
+/// <summary>
+/// Check that the stream ended on a token boundary, once the last TransferBuffer has been fed.
+/// </summary>
+/// <returns>If success, it returns 0. ERROR_INVALID_DATA indicates the stream ended inside a token.</returns>
+long __stdcall FxLexerEnd(FX_LEXER *lexer)
+{
+    if (lexer == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (lexer->state == FxStateFailed)
+    {
+        return lexer->failure;
+    }
+
+    return lexer->state == FxStateTag && lexer->have == 0 ? 0 : ERROR_INVALID_DATA;
+}
+
+/// <summary>
+/// Return the number of bytes of the stream consumed so far, to locate a malformed token.
+/// </summary>
+unsigned __int64 __stdcall FxLexerGetOffset(FX_LEXER *lexer)
+{
+    return lexer == NULL ? 0 : lexer->offset;
+}
+
+/// <summary>
+/// Return the errorInfo element of the stream, which a server writes when it cannot complete the stream.
+/// </summary>
+/// <param name="offset">Receives the offset of the PidTagFXErrorInfo marker in the stream.</param>
+/// <param name="errorCode">Receives the first PtypErrorCode value after the marker, or 0 if none was lexed.</param>
+/// <returns>If success, it returns 0. ERROR_NOT_FOUND indicates the stream has no errorInfo so far.</returns>
+long __stdcall FxLexerGetErrorInfo(FX_LEXER *lexer, unsigned __int64 *offset, unsigned long *errorCode)
+{
+    if (lexer == NULL || offset == NULL || errorCode == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (!lexer->errorInfo)
+    {
+        return ERROR_NOT_FOUND;
+    }
+
+    *offset = lexer->errorInfoOffset;
+    *errorCode = lexer->errorCode;
+    return 0;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "RopCodec.h"
+
+/// <summary>
+/// The kind of a lexical element of a FastTransfer stream, as specified in MS-OXCFXICS section 2.2.4.1.
+/// </summary>
+typedef enum _FX_TOKEN_KIND
+{
+    FxTokenMarker = 0,              // A marker; PropertyTag is the marker and there is no value.
+    FxTokenFixedValue = 1,          // A fixed-size value, or one element of a multi-valued fixed-size property; Data holds all of it.
+    FxTokenVariableValue = 2,       // A chunk of a variable-size value, or of one element of a multi-valued variable-size property.
+    FxTokenMultiValueBegin = 3      // A multi-valued property; ValueCount element tokens follow.
+} FX_TOKEN_KIND;
+
+/// <summary>
+/// A token passed to the token routine. Pointers are valid only during the call.
+/// </summary>
+typedef struct _FX_TOKEN
+{
+    FX_TOKEN_KIND Kind;
+    unsigned long PropertyTag;      // PropertyType in the low word and PropertyId in the high word.
+    BOOL IsNamed;                   // Set if PropertyId is 0x8000 or above; the named property fields are then valid.
+    GUID PropertySet;
+    unsigned char NameKind;         // 0x00 if Dispid is valid, 0x01 if Name is valid.
+    unsigned long Dispid;
+    const wchar_t *Name;
+    unsigned long ValueCount;       // The number of elements of a multi-valued property.
+    unsigned long ValueIndex;       // The element the value token belongs to.
+    unsigned long ValueSize;        // The size of the whole value, or of the whole element.
+    unsigned long Offset;           // The offset of Data within the value.
+    const unsigned char *Data;
+    unsigned long DataSize;
+    BOOL LastChunk;                 // Set on the last chunk of a value.
+    unsigned __int64 StreamOffset;  // The offset of the property tag or marker in the whole stream.
+} FX_TOKEN;
+
+/// <summary>
+/// Routine invoked for every token, in stream order.
+/// </summary>
+/// <param name="context">The caller context passed to FxLexerCreate.</param>
+/// <param name="token">The token.</param>
+/// <returns>0 to continue; any other value stops lexing and is returned by FxLexerFeed.</returns>
+typedef long (__stdcall *FX_TOKEN_ROUTINE)(void *context, const FX_TOKEN *token);
+
+/// <summary>
+/// The fields of a RopFastTransferSourceGetBuffer response fed to the lexer.
+/// </summary>
+typedef struct _FX_GETBUFFER_RESPONSE
+{
+    unsigned long ReturnValue;
+    unsigned short TransferStatus;
+    unsigned short InProgressCount;
+    unsigned short TotalStepCount;
+    unsigned short TransferBufferSize;
+    unsigned long BackoffTime;      // Set if ReturnValue is 0x00000480.
+} FX_GETBUFFER_RESPONSE;
+
+typedef struct _FX_LEXER FX_LEXER;
+
+long __stdcall FxLexerCreate(FX_TOKEN_ROUTINE routine, void *context, FX_LEXER **lexer);
+
+void __stdcall FxLexerDestroy(FX_LEXER *lexer);
+
+long __stdcall FxLexerFeed(FX_LEXER *lexer, const unsigned char *data, unsigned long size);
+
+long __stdcall FxLexerFeedResponse(FX_LEXER *lexer, ROP_RESPONSE_READER *reader, FX_GETBUFFER_RESPONSE *response);
+
+long __stdcall FxLexerEnd(FX_LEXER *lexer);
+
+unsigned __int64 __stdcall FxLexerGetOffset(FX_LEXER *lexer);
+
+long __stdcall FxLexerGetErrorInfo(FX_LEXER *lexer, unsigned __int64 *offset, unsigned long *errorCode);
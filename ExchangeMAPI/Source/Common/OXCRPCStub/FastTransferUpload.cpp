@@ -0,0 +1,545 @@
+#include "FastTransferUpload.h"
+#include "PipelinedRpcCall.h"
+#include "MappedFile.h"
+#include <vector>
+
+// Uploads a FastTransfer stream with RopFastTransferDestinationPutBuffer. A worker thread fills a window of request
+// buffers from the source, a MappedFile or a caller routine, while the calling thread sends them, so producing the
+// stream overlaps the round trips. Only one call is in flight at a time on a CXH; the rest of the window is ready to be
+// sent the moment it completes.
+//
+// Data the server did not use, as reported by BufferUsedSize, is packed again and resent, after a back-off if the
+// server was busy.
+
+/// <summary>
+/// The default and largest number of request buffers of an upload.
+/// </summary>
+#define FX_DEFAULT_WINDOW 4
+#define FX_MAX_WINDOW 16
+
+/// <summary>
+/// The TransferStatus of a response after which the server accepts no more data.
+/// </summary>
+#define FX_TRANSFER_STATUS_ERROR 0x0000
+
+/// <summary>
+/// The back-off after a busy response, in milliseconds; doubled on every busy response in a row, as PutBuffer
+/// responses carry no BackoffTime.
+/// </summary>
+#define FX_MIN_BACKOFF 50
+#define FX_MAX_BACKOFF 5000
+#define FX_MAX_BUSY_RETRIES 10
+
+/// <summary>
+/// The stream being uploaded: either a file or a caller routine.
+/// </summary>
+struct UploadSource
+{
+    MappedFile *file;
+    unsigned __int64 offset;
+    FX_SOURCE_ROUTINE routine;
+    void *context;
+    bool ended;
+};
+
+/// <summary>
+/// The state shared by the calling thread and the worker thread of an upload.
+/// </summary>
+struct UploadPipeline
+{
+    PipelinedCallRing *calls;
+    UploadSource source;
+    unsigned char logonId;
+    unsigned long transferHandle;
+    bool extended;
+    unsigned short chunkSize;
+    HANDLE freeCalls;                   // Released when a request buffer may be filled.
+    HANDLE readyCalls;                  // Released when a request buffer is filled; no ROPs means the stream is complete.
+    volatile LONG abort;
+    long status;                        // The error that stopped the worker thread.
+};
+
+/// <summary>
+/// Read up to size bytes of the stream; fewer only once the stream is complete.
+/// </summary>
+static long ReadSource(UploadSource &source, unsigned char *buffer, unsigned long size, unsigned long *produced)
+{
+    *produced = 0;
+    if (source.file != NULL)
+    {
+        unsigned __int64 left = source.file->Size() - source.offset;
+        unsigned long count = left < size ? (unsigned long)left : size;
+        long status = count == 0 ? 0 : source.file->Read(source.offset, buffer, count);
+        if (status == 0)
+        {
+            source.offset += count;
+            *produced = count;
+        }
+
+        return status;
+    }
+
+    // A routine may return less than asked for; call it until the chunk is full or the stream is complete.
+    while (!source.ended && *produced < size)
+    {
+        unsigned long count = 0;
+        long status = source.routine(source.context, buffer + *produced, size - *produced, &count);
+        if (status != 0)
+        {
+            return status;
+        }
+
+        if (count > size - *produced)
+        {
+            return ERROR_INVALID_DATA;
+        }
+
+        source.ended = count == 0;
+        *produced += count;
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Pack PutBuffer requests with the data returned by fill into a request buffer.
+/// </summary>
+template <typename TRop, typename TFill>
+static long PackPutBuffers(PipelinedRpcCall *call, const UploadPipeline &pipeline, TFill fill)
+{
+    const unsigned long ropOverhead = TRop::Request::Size;
+    RopCodec::RopRequestWriter writer(call->rgbIn, sizeof(call->rgbIn));
+    call->ropCount = 0;
+    call->bytesRequested = 0;
+    for (;;)
+    {
+        // Leave room for the handle table, and do not split a chunk over two ROPs of one request buffer.
+        unsigned long remaining = writer.Remaining();
+        if (remaining <= ropOverhead + sizeof(unsigned long))
+        {
+            break;
+        }
+
+        unsigned long room = remaining - ropOverhead - sizeof(unsigned long);
+        if (room < pipeline.chunkSize && call->ropCount != 0)
+        {
+            break;
+        }
+
+        // The data is produced straight into the request buffer, after the fixed part of its ROP.
+        unsigned long dataSize = room < pipeline.chunkSize ? room : pipeline.chunkSize;
+        unsigned char *target = call->rgbIn + writer.Length() + ropOverhead;
+        unsigned long produced = 0;
+        long status = fill(target, dataSize, &produced);
+        if (status != 0)
+        {
+            return status;
+        }
+
+        if (produced == 0)
+        {
+            break;
+        }
+
+        writer.Append<TRop>(pipeline.logonId, (unsigned char)0, (unsigned short)produced);
+        writer.Commit(produced);
+        call->ropCount++;
+        call->bytesRequested += produced;
+        if (produced < dataSize)
+        {
+            break;
+        }
+    }
+
+    call->cbIn = writer.Finish(&pipeline.transferHandle, 1);
+    return call->cbIn == 0 ? ERROR_INSUFFICIENT_BUFFER : 0;
+}
+
+template <typename TFill>
+static long FillRequest(PipelinedRpcCall *call, const UploadPipeline &pipeline, TFill fill)
+{
+    if (pipeline.extended)
+    {
+        return PackPutBuffers<RopCodec::FastTransferDestinationPutBufferExtended>(call, pipeline, fill);
+    }
+
+    return PackPutBuffers<RopCodec::FastTransferDestinationPutBuffer>(call, pipeline, fill);
+}
+
+/// <summary>
+/// Pack the data of a request buffer that the server did not use into the same buffer again.
+/// </summary>
+/// <param name="consumed">The number of leading data bytes the server used.</param>
+static long RepackPutBuffers(PipelinedRpcCall *call, const UploadPipeline &pipeline, unsigned long consumed)
+{
+    std::vector<unsigned char> left;
+    left.reserve(call->bytesRequested - consumed);
+    const unsigned char *request = call->rgbIn + sizeof(RPC_HEADER_EXT) + sizeof(unsigned short);
+    for (unsigned long i = 0; i < call->ropCount; i++)
+    {
+        // RopId, LogonId, InputHandleIndex, TransferDataSize, TransferData.
+        unsigned short transferDataSize;
+        memcpy(&transferDataSize, request + 3, sizeof(transferDataSize));
+        const unsigned char *data = request + RopCodec::FastTransferDestinationPutBuffer::Request::Size;
+        unsigned long skip = consumed < transferDataSize ? consumed : transferDataSize;
+        left.insert(left.end(), data + skip, data + transferDataSize);
+        consumed -= skip;
+        request = data + transferDataSize;
+    }
+
+    size_t position = 0;
+    return FillRequest(call, pipeline, [&left, &position](unsigned char *buffer, unsigned long size, unsigned long *produced)
+    {
+        size_t count = left.size() - position < size ? left.size() - position : size;
+        memcpy(buffer, left.data() + position, count);
+        position += count;
+        *produced = (unsigned long)count;
+        return 0L;
+    });
+}
+
+/// <summary>
+/// Read the PutBuffer responses of a completed call, in the order of its requests.
+/// </summary>
+/// <param name="consumed">Receives the number of leading data bytes the server used, up to the first ROP that did not use all of its data.</param>
+/// <param name="returnValue">Receives the first ReturnValue that is not 0.</param>
+template <typename TRop, typename TCount>
+static long ProcessPutBufferResponse(PipelinedRpcCall *call, unsigned long *consumed, unsigned long *returnValue, FX_UPLOAD_STATS *stats)
+{
+    RopCodec::RopResponseReader reader(call->rgbOut, call->cbOut);
+    const unsigned char *request = call->rgbIn + sizeof(RPC_HEADER_EXT) + sizeof(unsigned short);
+    unsigned long processed = 0;
+    bool complete = true;
+    long status = 0;
+    *consumed = 0;
+    *returnValue = 0;
+    while (complete && (status = reader.NextBuffer()) == 0)
+    {
+        RopCodec::Byte ropId;
+        RopCodec::Byte inputHandleIndex;
+        RopCodec::Byte reserved;
+        RopCodec::ULong ropReturnValue;
+        RopCodec::UShort transferStatus;
+        TCount inProgressCount;
+        TCount totalStepCount;
+        RopCodec::UShort bufferUsedSize;
+        while (complete && processed < call->ropCount && reader.Peek(ropId, ropReturnValue) && ropId == TRop::Id)
+        {
+            if (!reader.Read<TRop>(
+                    ropId,
+                    inputHandleIndex,
+                    ropReturnValue,
+                    transferStatus,
+                    inProgressCount,
+                    totalStepCount,
+                    reserved,
+                    bufferUsedSize))
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            unsigned short transferDataSize;
+            memcpy(&transferDataSize, request + 3, sizeof(transferDataSize));
+            request += TRop::Request::Size + transferDataSize;
+            if (bufferUsedSize > transferDataSize)
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            processed++;
+            stats->RopCount++;
+            stats->TransferStatus = transferStatus;
+            stats->InProgressCount = inProgressCount;
+            stats->TotalStepCount = totalStepCount;
+            *consumed += bufferUsedSize;
+            *returnValue = ropReturnValue;
+
+            // Data after a ROP that did not use all of its own would leave a gap in the stream; it is resent instead.
+            complete = ropReturnValue == 0 && bufferUsedSize == transferDataSize && transferStatus != FX_TRANSFER_STATUS_ERROR;
+        }
+    }
+
+    if (complete && status != ERROR_NO_MORE_ITEMS)
+    {
+        return status;
+    }
+
+    return processed == 0 ? ERROR_INVALID_DATA : 0;
+}
+
+static long ProcessPutBufferResponse(PipelinedRpcCall *call, bool extended, unsigned long *consumed, unsigned long *returnValue, FX_UPLOAD_STATS *stats)
+{
+    if (extended)
+    {
+        return ProcessPutBufferResponse<RopCodec::FastTransferDestinationPutBufferExtended, RopCodec::ULong>(call, consumed, returnValue, stats);
+    }
+
+    return ProcessPutBufferResponse<RopCodec::FastTransferDestinationPutBuffer, RopCodec::UShort>(call, consumed, returnValue, stats);
+}
+
+/// <summary>
+/// Send a request buffer, and whatever part of its data the server did not use, until all of it is used.
+/// </summary>
+static long SendPutBuffers(CXH *pcxh, PipelinedRpcCall *call, const UploadPipeline &pipeline, FX_UPLOAD_STATS *stats)
+{
+    unsigned long backoff = FX_MIN_BACKOFF;
+    unsigned long busyCount = 0;
+    for (;;)
+    {
+        long status = BeginPipelinedCall(pcxh, call, PIPELINED_RPC_FLAGS);
+        if (status == 0)
+        {
+            status = EndPipelinedCall(call);
+        }
+
+        if (status != 0)
+        {
+            return status;
+        }
+
+        stats->RequestCount++;
+        unsigned long consumed;
+        unsigned long returnValue;
+        status = ProcessPutBufferResponse(call, pipeline.extended, &consumed, &returnValue, stats);
+        if (status != 0)
+        {
+            return status;
+        }
+
+        stats->BytesSent += consumed;
+        if (returnValue == RopCodec::FastTransferDestinationPutBuffer::ServerBusy)
+        {
+            stats->BusyCount++;
+            if (++busyCount > FX_MAX_BUSY_RETRIES)
+            {
+                return (long)returnValue;
+            }
+
+            Sleep(backoff);
+            backoff = backoff * 2 > FX_MAX_BACKOFF ? FX_MAX_BACKOFF : backoff * 2;
+        }
+        else if (returnValue != 0)
+        {
+            return (long)returnValue;
+        }
+        else if (stats->TransferStatus == FX_TRANSFER_STATUS_ERROR)
+        {
+            return ERROR_WRITE_FAULT;
+        }
+        else if (consumed == call->bytesRequested)
+        {
+            return 0;
+        }
+        else if (consumed == 0)
+        {
+            // The server neither used the data nor asked to back off; sending it again would not help.
+            return ERROR_WRITE_FAULT;
+        }
+
+        status = RepackPutBuffers(call, pipeline, consumed);
+        if (status != 0)
+        {
+            return status;
+        }
+    }
+}
+
+/// <summary>
+/// The worker thread of an upload: fills free request buffers from the source, in order, until the stream is complete.
+/// </summary>
+static DWORD WINAPI UploadWorker(void *parameter)
+{
+    UploadPipeline *pipeline = (UploadPipeline *)parameter;
+    for (unsigned long k = 0;; k++)
+    {
+        WaitForSingleObject(pipeline->freeCalls, INFINITE);
+        if (pipeline->abort)
+        {
+            return 0;
+        }
+
+        PipelinedRpcCall *call = (*pipeline->calls)[k];
+        long status = FillRequest(call, *pipeline, [pipeline](unsigned char *buffer, unsigned long size, unsigned long *produced)
+        {
+            return ReadSource(pipeline->source, buffer, size, produced);
+        });
+        if (status != 0)
+        {
+            pipeline->status = status;
+            call->ropCount = 0;
+        }
+
+        bool last = call->ropCount == 0;
+        ReleaseSemaphore(pipeline->readyCalls, 1, NULL);
+        if (last)
+        {
+            return 0;
+        }
+    }
+}
+
+/// <summary>
+/// Upload the stream of a source through the request buffers filled by the worker thread.
+/// </summary>
+static long RunUpload(
+    CXH *pcxh,
+    unsigned char logonId,
+    unsigned long transferHandle,
+    const UploadSource &source,
+    const FX_UPLOAD_OPTIONS *options,
+    FX_UPLOAD_PROGRESS_ROUTINE progress,
+    void *context,
+    FX_UPLOAD_STATS *stats)
+{
+    unsigned long window = options == NULL || options->Window == 0 ? FX_DEFAULT_WINDOW : options->Window;
+    if (window < 2 || window > FX_MAX_WINDOW)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    PipelinedCallRing calls(window);
+    if (!calls.IsValid())
+    {
+        return GetLastError();
+    }
+
+    UploadPipeline pipeline;
+    pipeline.calls = &calls;
+    pipeline.source = source;
+    pipeline.logonId = logonId;
+    pipeline.transferHandle = transferHandle;
+    pipeline.extended = options != NULL && options->Extended != FALSE;
+    pipeline.chunkSize = options == NULL || options->ChunkSize == 0 ? 0xFFFF : options->ChunkSize;
+    pipeline.abort = 0;
+    pipeline.status = 0;
+    pipeline.freeCalls = CreateSemaphore(NULL, (LONG)window, (LONG)window, NULL);
+    pipeline.readyCalls = CreateSemaphore(NULL, 0, (LONG)window, NULL);
+    HANDLE worker = pipeline.freeCalls == NULL || pipeline.readyCalls == NULL ? NULL : CreateThread(NULL, 0, UploadWorker, &pipeline, 0, NULL);
+    long status = worker == NULL ? (long)GetLastError() : 0;
+
+    LARGE_INTEGER start;
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&start);
+    for (unsigned long k = 0; status == 0; k++)
+    {
+        LARGE_INTEGER waitStart;
+        QueryPerformanceCounter(&waitStart);
+        WaitForSingleObject(pipeline.readyCalls, INFINITE);
+        QueryPerformanceCounter(&now);
+        stats->StallMilliseconds += PipelinedElapsedMilliseconds(waitStart, now);
+
+        PipelinedRpcCall *call = calls[k];
+        if (call->ropCount == 0)
+        {
+            status = pipeline.status;
+            break;
+        }
+
+        status = SendPutBuffers(pcxh, call, pipeline, stats);
+        QueryPerformanceCounter(&now);
+        stats->ElapsedMilliseconds = PipelinedElapsedMilliseconds(start, now);
+        stats->BytesPerSecond = (unsigned long)(stats->BytesSent * 1000 / (stats->ElapsedMilliseconds == 0 ? 1 : stats->ElapsedMilliseconds));
+        if (status == 0 && progress != NULL)
+        {
+            status = progress(context, stats);
+        }
+
+        ReleaseSemaphore(pipeline.freeCalls, 1, NULL);
+    }
+
+    if (worker != NULL)
+    {
+        // A worker waiting for a free request buffer wakes up and sees the abort flag.
+        InterlockedExchange(&pipeline.abort, 1);
+        ReleaseSemaphore(pipeline.freeCalls, 1, NULL);
+        WaitForSingleObject(worker, INFINITE);
+        CloseHandle(worker);
+    }
+
+    if (pipeline.freeCalls != NULL)
+    {
+        CloseHandle(pipeline.freeCalls);
+    }
+
+    if (pipeline.readyCalls != NULL)
+    {
+        CloseHandle(pipeline.readyCalls);
+    }
+
+    QueryPerformanceCounter(&now);
+    stats->ElapsedMilliseconds = PipelinedElapsedMilliseconds(start, now);
+    return status;
+}
+
+/// <summary>
+/// Upload a FastTransfer stream from a file to a FastTransfer upload context.
+/// </summary>
+/// <param name="pcxh">The CXH that was created by calling EcDoConnectEx.</param>
+/// <param name="logonId">The LogonId of the logon the upload context belongs to.</param>
+/// <param name="transferHandle">The server object handle of the upload context, such as returned by RopFastTransferDestinationConfigure.</param>
+/// <param name="filePath">The file that holds the stream.</param>
+/// <param name="options">The upload options, or NULL for the defaults.</param>
+/// <param name="progress">An optional routine invoked after every call.</param>
+/// <param name="context">The caller context passed back to the progress routine.</param>
+/// <param name="stats">Receives the statistics of the upload.</param>
+/// <returns>If success, it returns 0, else returns the error code, or the ReturnValue of the failed ROP.</returns>
+long __stdcall FxUploadFromFile(
+    CXH *pcxh,
+    unsigned char logonId,
+    unsigned long transferHandle,
+    const wchar_t *filePath,
+    const FX_UPLOAD_OPTIONS *options,
+    FX_UPLOAD_PROGRESS_ROUTINE progress,
+    void *context,
+    FX_UPLOAD_STATS *stats)
+{
+    if (pcxh == NULL || filePath == NULL || stats == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    memset(stats, 0, sizeof(FX_UPLOAD_STATS));
+    MappedFile file;
+    long status = file.Open(filePath);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    UploadSource source = { &file, 0, NULL, NULL, false };
+    return RunUpload(pcxh, logonId, transferHandle, source, options, progress, context, stats);
+}
+
+/// <summary>
+/// Upload a FastTransfer stream produced by a caller routine to a FastTransfer upload context.
+/// </summary>
+/// <param name="pcxh">The CXH that was created by calling EcDoConnectEx.</param>
+/// <param name="logonId">The LogonId of the logon the upload context belongs to.</param>
+/// <param name="transferHandle">The server object handle of the upload context, such as returned by RopFastTransferDestinationConfigure.</param>
+/// <param name="source">The routine that produces the stream; it runs ahead of the server by up to the window of request buffers.</param>
+/// <param name="sourceContext">The caller context passed back to the source routine.</param>
+/// <param name="options">The upload options, or NULL for the defaults.</param>
+/// <param name="progress">An optional routine invoked after every call.</param>
+/// <param name="context">The caller context passed back to the progress routine.</param>
+/// <param name="stats">Receives the statistics of the upload.</param>
+/// <returns>If success, it returns 0, else returns the error code, or the ReturnValue of the failed ROP.</returns>
+long __stdcall FxUploadFromRoutine(
+    CXH *pcxh,
+    unsigned char logonId,
+    unsigned long transferHandle,
+    FX_SOURCE_ROUTINE source,
+    void *sourceContext,
+    const FX_UPLOAD_OPTIONS *options,
+    FX_UPLOAD_PROGRESS_ROUTINE progress,
+    void *context,
+    FX_UPLOAD_STATS *stats)
+{
+    if (pcxh == NULL || source == NULL || stats == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    memset(stats, 0, sizeof(FX_UPLOAD_STATS));
+    UploadSource routineSource = { NULL, 0, source, sourceContext, false };
+    return RunUpload(pcxh, logonId, transferHandle, routineSource, options, progress, context, stats);
+}
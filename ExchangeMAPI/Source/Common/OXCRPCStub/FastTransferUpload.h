@@ -0,0 +1,69 @@
+#pragma once
+
+#include "MS-OXCRPC.h"
+
+/// <summary>
+/// How a FastTransfer stream is uploaded.
+/// </summary>
+typedef struct _FX_UPLOAD_OPTIONS
+{
+    BOOL Extended;                      // Use RopFastTransferDestinationPutBufferExtended instead of RopFastTransferDestinationPutBuffer.
+    unsigned long Window;               // The number of request buffers filled ahead of the server; 2 to 16, 0 for the default.
+    unsigned short ChunkSize;           // The TransferDataSize of each ROP; 0 for the largest that fits in one request buffer.
+} FX_UPLOAD_OPTIONS;
+
+/// <summary>
+/// The statistics of a FastTransfer upload, updated after every EcDoRpcExt2 call.
+/// </summary>
+typedef struct _FX_UPLOAD_STATS
+{
+    unsigned __int64 BytesSent;         // The TransferData bytes the server reported as used.
+    unsigned long RequestCount;         // The number of EcDoRpcExt2 calls.
+    unsigned long RopCount;             // The number of PutBuffer responses processed.
+    unsigned long BusyCount;            // The number of responses that asked to back off.
+    unsigned long ElapsedMilliseconds;
+    unsigned long StallMilliseconds;    // The time spent waiting for the source to fill a request buffer.
+    unsigned long BytesPerSecond;       // BytesSent over ElapsedMilliseconds.
+    unsigned short TransferStatus;      // The TransferStatus of the last response.
+    unsigned long InProgressCount;
+    unsigned long TotalStepCount;
+} FX_UPLOAD_STATS;
+
+/// <summary>
+/// Routine that produces the next bytes of a FastTransfer stream. It is invoked on a worker thread.
+/// </summary>
+/// <param name="context">The caller context passed to FxUploadFromRoutine.</param>
+/// <param name="buffer">The buffer to fill.</param>
+/// <param name="size">The size of the buffer.</param>
+/// <param name="produced">Receives the number of bytes written to the buffer; 0 once the stream is complete.</param>
+/// <returns>0 to continue; any other value stops the upload and is returned by FxUploadFromRoutine.</returns>
+typedef long (__stdcall *FX_SOURCE_ROUTINE)(void *context, unsigned char *buffer, unsigned long size, unsigned long *produced);
+
+/// <summary>
+/// Routine invoked after every EcDoRpcExt2 call of an upload.
+/// </summary>
+/// <param name="context">The caller context passed to the upload function.</param>
+/// <param name="stats">The statistics so far.</param>
+/// <returns>0 to continue; any other value stops the upload and is returned by the upload function.</returns>
+typedef long (__stdcall *FX_UPLOAD_PROGRESS_ROUTINE)(void *context, const FX_UPLOAD_STATS *stats);
+
+long __stdcall FxUploadFromFile(
+    CXH *pcxh,
+    unsigned char logonId,
+    unsigned long transferHandle,
+    const wchar_t *filePath,
+    const FX_UPLOAD_OPTIONS *options,
+    FX_UPLOAD_PROGRESS_ROUTINE progress,
+    void *context,
+    FX_UPLOAD_STATS *stats);
+
+long __stdcall FxUploadFromRoutine(
+    CXH *pcxh,
+    unsigned char logonId,
+    unsigned long transferHandle,
+    FX_SOURCE_ROUTINE source,
+    void *sourceContext,
+    const FX_UPLOAD_OPTIONS *options,
+    FX_UPLOAD_PROGRESS_ROUTINE progress,
+    void *context,
+    FX_UPLOAD_STATS *stats);
@@ -0,0 +1,554 @@
+#include "Keepalive.h"
+#include "TracedCalls.h"
+#include "RpcException.h"
+#include <map>
+#include <vector>
+
+// Proxies in front of RPC over HTTP drop connections that stay idle. The keepalive monitor issues EcDummyRpc on
+// bindings that have been idle for a full interval, and marks a binding dead once EcDummyRpc fails a number of times
+// in a row, so that the owner rebinds it before the next real call instead of paying a failed call plus a reconnect.
+// Bindings are kept in a hashed timer wheel and their first probe is offset by a hash of the handle, so that probes
+// of many bindings registered together are spread over the interval. A probe runs on a thread pool thread and uses the
+// binding and the dead routine of the owner, so unregistering a binding waits for its probe, and stopping the monitor
+// waits for all probes, before returning.
+//
+// Start, stop and register are serialized by the control lock. Stop moves the monitor to the stopping state under the
+// exclusive lock and tears it down without the lock, so that a dead routine that registers or rearms a binding while
+// stop waits for its probe fails with ERROR_NOT_READY instead of blocking; a register holds the lock shared from its
+// state check until its entry is on the wheel, so no entry is inserted once the teardown has started.
+//
+// Real calls keep a binding off the probe schedule: TracedEcDoRpcExt2 and the asynchronous EcDoRpcExt2 touch the
+// binding that the session was connected on. A binding marked dead leaves the wheel and is not probed again until its
+// owner rebinds it and calls KeepaliveRearmBinding.
+
+/// <summary>
+/// The number of slots of the timer wheel.
+/// </summary>
+static const unsigned long WheelSlotCount = 512;
+
+/// <summary>
+/// The time in milliseconds between two slots of the timer wheel.
+/// </summary>
+static const unsigned long TickMilliseconds = 100;
+
+/// <summary>
+/// The states of the monitor, guarded by m_controlLock.
+/// </summary>
+enum KeepaliveMonitorState
+{
+    KeepaliveMonitorStopped = 0,
+    KeepaliveMonitorRunning = 1,
+    KeepaliveMonitorStopping = 2
+};
+
+/// <summary>
+/// A registered binding. It is referenced by the binding map, by the timer wheel while it is scheduled, and by an
+/// in-flight probe.
+/// </summary>
+struct KeepaliveEntry
+{
+    handle_t binding;
+    volatile LONG refCount;
+    volatile LONG removed;
+    volatile LONG probing;                  // 1 from the time a probe is queued until it is done; see m_probeLock.
+    volatile LONG probeThread;              // The thread running the probe, so that the dead routine does not wait for itself.
+    volatile LONG state;
+    volatile LONG failures;
+    volatile LONGLONG lastActivity;
+    unsigned long rounds;
+    bool scheduled;                         // Whether the entry is on the wheel; see m_wheelLock.
+};
+
+static std::map<handle_t, KeepaliveEntry *> m_entries;
+static SRWLOCK m_entriesLock = SRWLOCK_INIT;
+static std::map<CXH, handle_t> m_sessionBindings;
+static SRWLOCK m_sessionBindingsLock = SRWLOCK_INIT;
+static std::vector<KeepaliveEntry *> m_wheel[WheelSlotCount];
+static SRWLOCK m_wheelLock = SRWLOCK_INIT;
+static unsigned long m_currentSlot = 0;
+static SRWLOCK m_controlLock = SRWLOCK_INIT;
+static volatile LONG m_state = KeepaliveMonitorStopped;
+static HANDLE m_timerThread = NULL;
+static HANDLE m_stopEvent = NULL;
+static unsigned long m_interval = 0;
+static unsigned long m_failureThreshold = 0;
+static KEEPALIVE_DEAD_ROUTINE m_deadRoutine = NULL;
+static SRWLOCK m_probeLock = SRWLOCK_INIT;
+static CONDITION_VARIABLE m_probeDone = CONDITION_VARIABLE_INIT;
+static volatile LONG m_probeCount = 0;
+
+static void ReleaseEntry(KeepaliveEntry *entry)
+{
+    if (InterlockedDecrement(&entry->refCount) == 0)
+    {
+        delete entry;
+    }
+}
+
+/// <summary>
+/// Put an entry in the wheel so that it expires after the given delay. The caller MUST hold m_wheelLock.
+/// </summary>
+static void PlaceEntry(KeepaliveEntry *entry, unsigned long delayMilliseconds)
+{
+    unsigned long ticks = delayMilliseconds / TickMilliseconds;
+    if (ticks == 0)
+    {
+        ticks = 1;
+    }
+
+    entry->rounds = (ticks - 1) / WheelSlotCount;
+    entry->scheduled = true;
+    m_wheel[(m_currentSlot + ticks) % WheelSlotCount].push_back(entry);
+}
+
+/// <summary>
+/// Mark the probe of an entry as done and wake the threads waiting for it. It MUST be called with a reference on the entry.
+/// </summary>
+static void EndProbe(KeepaliveEntry *entry)
+{
+    AcquireSRWLockExclusive(&m_probeLock);
+    InterlockedExchange(&entry->probing, 0);
+    InterlockedDecrement(&m_probeCount);
+    ReleaseSRWLockExclusive(&m_probeLock);
+    WakeAllConditionVariable(&m_probeDone);
+}
+
+/// <summary>
+/// Wait until the probe of an entry is done, unless the calling thread is the one running it.
+/// </summary>
+static void WaitForProbe(KeepaliveEntry *entry)
+{
+    AcquireSRWLockExclusive(&m_probeLock);
+    while (entry->probing != 0 && (DWORD)entry->probeThread != GetCurrentThreadId())
+    {
+        SleepConditionVariableSRW(&m_probeDone, &m_probeLock, INFINITE, 0);
+    }
+    ReleaseSRWLockExclusive(&m_probeLock);
+}
+
+/// <summary>
+/// Probe a binding with EcDummyRpc on a thread pool thread and update its state.
+/// </summary>
+static DWORD WINAPI ProbeBinding(LPVOID parameter)
+{
+    KeepaliveEntry *entry = (KeepaliveEntry *)parameter;
+    long status = 0;
+    InterlockedExchange(&entry->probeThread, (LONG)GetCurrentThreadId());
+
+    RpcTryExcept
+    {
+        status = TracedEcDummyRpc(entry->binding);
+    }
+    RpcExcept( HandleException(::RpcExceptionCode()) )
+    {
+        status = ::RpcExceptionCode();
+    }
+    RpcEndExcept;
+
+    if (status == 0)
+    {
+        InterlockedExchange(&entry->failures, 0);
+        InterlockedExchange(&entry->state, KeepaliveBindingAlive);
+        InterlockedExchange64(&entry->lastActivity, (LONGLONG)GetTickCount64());
+    }
+    else
+    {
+        LONG failures = InterlockedIncrement(&entry->failures);
+        if ((unsigned long)failures >= m_failureThreshold)
+        {
+            LONG previous = InterlockedExchange(&entry->state, KeepaliveBindingDead);
+            if (previous != KeepaliveBindingDead && m_deadRoutine != NULL && !entry->removed)
+            {
+                m_deadRoutine(entry->binding, status);
+            }
+        }
+        else
+        {
+            InterlockedExchange(&entry->state, KeepaliveBindingSuspect);
+        }
+    }
+
+    InterlockedExchange(&entry->probeThread, 0);
+    EndProbe(entry);
+    ReleaseEntry(entry);
+    return 0;
+}
+
+/// <summary>
+/// Handle the entries of the current slot: probe the ones idle for a full interval, reschedule the others, and drop
+/// the dead ones until they are rearmed.
+/// </summary>
+static void AdvanceWheel()
+{
+    std::vector<KeepaliveEntry *> expired;
+    AcquireSRWLockExclusive(&m_wheelLock);
+    m_currentSlot = (m_currentSlot + 1) % WheelSlotCount;
+    expired.swap(m_wheel[m_currentSlot]);
+
+    ULONGLONG now = GetTickCount64();
+    for (size_t i = 0; i < expired.size(); i++)
+    {
+        KeepaliveEntry *entry = expired[i];
+        if (entry->removed || entry->state == KeepaliveBindingDead)
+        {
+            entry->scheduled = false;
+            ReleaseEntry(entry);
+            continue;
+        }
+
+        if (entry->rounds > 0)
+        {
+            entry->rounds--;
+            m_wheel[m_currentSlot].push_back(entry);
+            continue;
+        }
+
+        ULONGLONG idle = now - (ULONGLONG)entry->lastActivity;
+        if (idle < m_interval)
+        {
+            PlaceEntry(entry, (unsigned long)(m_interval - idle));
+            continue;
+        }
+
+        if (InterlockedCompareExchange(&entry->probing, 1, 0) == 0)
+        {
+            InterlockedIncrement(&entry->refCount);
+            InterlockedIncrement(&m_probeCount);
+            if (!QueueUserWorkItem(ProbeBinding, entry, WT_EXECUTEDEFAULT))
+            {
+                EndProbe(entry);
+                ReleaseEntry(entry);
+            }
+        }
+
+        PlaceEntry(entry, m_interval);
+    }
+    ReleaseSRWLockExclusive(&m_wheelLock);
+}
+
+static DWORD WINAPI KeepaliveTimerProc(LPVOID parameter)
+{
+    while (WaitForSingleObject(m_stopEvent, TickMilliseconds) == WAIT_TIMEOUT)
+    {
+        AdvanceWheel();
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Start the keepalive monitor.
+/// </summary>
+/// <param name="intervalMilliseconds">The idle time after which a binding is probed with EcDummyRpc.</param>
+/// <param name="failureThreshold">The number of consecutive EcDummyRpc failures after which a binding is marked dead. 0 means 1.</param>
+/// <param name="deadRoutine">Optional routine invoked when a binding is marked dead.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall KeepaliveStart(unsigned long intervalMilliseconds, unsigned long failureThreshold, KEEPALIVE_DEAD_ROUTINE deadRoutine)
+{
+    if (intervalMilliseconds < TickMilliseconds)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    AcquireSRWLockExclusive(&m_controlLock);
+    if (m_state != KeepaliveMonitorStopped)
+    {
+        long state = m_state;
+        ReleaseSRWLockExclusive(&m_controlLock);
+        return state == KeepaliveMonitorRunning ? ERROR_ALREADY_INITIALIZED : ERROR_BUSY;
+    }
+
+    m_interval = intervalMilliseconds;
+    m_failureThreshold = failureThreshold == 0 ? 1 : failureThreshold;
+    m_deadRoutine = deadRoutine;
+
+    m_stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (m_stopEvent == NULL)
+    {
+        ReleaseSRWLockExclusive(&m_controlLock);
+        return GetLastError();
+    }
+
+    m_timerThread = CreateThread(NULL, 0, KeepaliveTimerProc, NULL, 0, NULL);
+    if (m_timerThread == NULL)
+    {
+        long status = GetLastError();
+        CloseHandle(m_stopEvent);
+        m_stopEvent = NULL;
+        ReleaseSRWLockExclusive(&m_controlLock);
+        return status;
+    }
+
+    m_state = KeepaliveMonitorRunning;
+    ReleaseSRWLockExclusive(&m_controlLock);
+    return 0;
+}
+
+/// <summary>
+/// Stop the keepalive monitor and forget every registered binding. It waits for the probes already queued, so it MUST
+/// NOT be called from the dead routine. A stop that finds the monitor already stopping returns at once.
+/// </summary>
+void __stdcall KeepaliveStop()
+{
+    AcquireSRWLockExclusive(&m_controlLock);
+    if (m_state != KeepaliveMonitorRunning)
+    {
+        ReleaseSRWLockExclusive(&m_controlLock);
+        return;
+    }
+
+    // Registers fail from now on, and none is still inserting, so the maps and the wheel only shrink below.
+    m_state = KeepaliveMonitorStopping;
+    ReleaseSRWLockExclusive(&m_controlLock);
+
+    SetEvent(m_stopEvent);
+    WaitForSingleObject(m_timerThread, INFINITE);
+    CloseHandle(m_timerThread);
+    CloseHandle(m_stopEvent);
+    m_timerThread = NULL;
+    m_stopEvent = NULL;
+
+    // No probe is queued once the timer thread has exited; the ones queued before still use the dead routine.
+    AcquireSRWLockExclusive(&m_probeLock);
+    while (m_probeCount != 0)
+    {
+        SleepConditionVariableSRW(&m_probeDone, &m_probeLock, INFINITE, 0);
+    }
+    ReleaseSRWLockExclusive(&m_probeLock);
+
+    AcquireSRWLockExclusive(&m_entriesLock);
+    for (std::map<handle_t, KeepaliveEntry *>::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+    {
+        InterlockedExchange(&it->second->removed, 1);
+        ReleaseEntry(it->second);
+    }
+
+    m_entries.clear();
+    ReleaseSRWLockExclusive(&m_entriesLock);
+
+    for (unsigned long i = 0; i < WheelSlotCount; i++)
+    {
+        for (size_t j = 0; j < m_wheel[i].size(); j++)
+        {
+            ReleaseEntry(m_wheel[i][j]);
+        }
+
+        m_wheel[i].clear();
+    }
+
+    AcquireSRWLockExclusive(&m_controlLock);
+    m_state = KeepaliveMonitorStopped;
+    ReleaseSRWLockExclusive(&m_controlLock);
+}
+
+/// <summary>
+/// Watch a binding, for example the one returned by GetBindHandle after BindToServer.
+/// </summary>
+/// <param name="hBinding">The binding handle to keep alive.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall KeepaliveRegisterBinding(handle_t hBinding)
+{
+    if (hBinding == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    AcquireSRWLockShared(&m_controlLock);
+    if (m_state != KeepaliveMonitorRunning)
+    {
+        ReleaseSRWLockShared(&m_controlLock);
+        return ERROR_NOT_READY;
+    }
+
+    KeepaliveEntry *entry = new KeepaliveEntry();
+    entry->binding = hBinding;
+    entry->refCount = 2; // One reference for the binding map and one for the timer wheel.
+    entry->removed = 0;
+    entry->probing = 0;
+    entry->probeThread = 0;
+    entry->state = KeepaliveBindingAlive;
+    entry->failures = 0;
+    entry->lastActivity = (LONGLONG)GetTickCount64();
+    entry->rounds = 0;
+    entry->scheduled = false;
+
+    AcquireSRWLockExclusive(&m_entriesLock);
+    std::map<handle_t, KeepaliveEntry *>::iterator found = m_entries.find(hBinding);
+    if (found != m_entries.end())
+    {
+        ReleaseSRWLockExclusive(&m_entriesLock);
+        ReleaseSRWLockShared(&m_controlLock);
+        delete entry;
+        return ERROR_ALREADY_EXISTS;
+    }
+
+    m_entries[hBinding] = entry;
+    ReleaseSRWLockExclusive(&m_entriesLock);
+
+    // Offset the first probe by a hash of the handle so that bindings registered together are not probed together.
+    unsigned long jitter = (unsigned long)(((ULONG_PTR)hBinding >> 4) * 2654435761u) % m_interval;
+    AcquireSRWLockExclusive(&m_wheelLock);
+    PlaceEntry(entry, m_interval / 2 + jitter / 2);
+    ReleaseSRWLockExclusive(&m_wheelLock);
+    ReleaseSRWLockShared(&m_controlLock);
+
+    return 0;
+}
+
+/// <summary>
+/// Watch a binding again once its owner has rebound it after it was marked dead. The binding is marked alive and its
+/// next probe is a full interval away.
+/// </summary>
+/// <param name="hBinding">The binding handle passed to KeepaliveRegisterBinding.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall KeepaliveRearmBinding(handle_t hBinding)
+{
+    AcquireSRWLockShared(&m_controlLock);
+    if (m_state != KeepaliveMonitorRunning)
+    {
+        ReleaseSRWLockShared(&m_controlLock);
+        return ERROR_NOT_READY;
+    }
+
+    KeepaliveEntry *entry = NULL;
+    AcquireSRWLockShared(&m_entriesLock);
+    std::map<handle_t, KeepaliveEntry *>::iterator found = m_entries.find(hBinding);
+    if (found != m_entries.end())
+    {
+        entry = found->second;
+        InterlockedIncrement(&entry->refCount);
+    }
+    ReleaseSRWLockShared(&m_entriesLock);
+
+    if (entry == NULL)
+    {
+        ReleaseSRWLockShared(&m_controlLock);
+        return ERROR_NOT_FOUND;
+    }
+
+    InterlockedExchange(&entry->failures, 0);
+    InterlockedExchange(&entry->state, KeepaliveBindingAlive);
+    InterlockedExchange64(&entry->lastActivity, (LONGLONG)GetTickCount64());
+
+    AcquireSRWLockExclusive(&m_wheelLock);
+    if (!entry->scheduled && !entry->removed)
+    {
+        InterlockedIncrement(&entry->refCount);
+        PlaceEntry(entry, m_interval);
+    }
+    ReleaseSRWLockExclusive(&m_wheelLock);
+    ReleaseSRWLockShared(&m_controlLock);
+
+    ReleaseEntry(entry);
+    return 0;
+}
+
+/// <summary>
+/// Stop watching a binding. It MUST be called before the binding handle is freed. If a probe of the binding is running,
+/// it waits for the probe, so that neither EcDummyRpc nor the dead routine uses the binding once it returns; called
+/// from the dead routine of the binding, it returns at once.
+/// </summary>
+/// <param name="hBinding">The binding handle passed to KeepaliveRegisterBinding.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall KeepaliveUnregisterBinding(handle_t hBinding)
+{
+    KeepaliveEntry *entry = NULL;
+    AcquireSRWLockExclusive(&m_entriesLock);
+    std::map<handle_t, KeepaliveEntry *>::iterator found = m_entries.find(hBinding);
+    if (found != m_entries.end())
+    {
+        entry = found->second;
+        m_entries.erase(found);
+    }
+    ReleaseSRWLockExclusive(&m_entriesLock);
+
+    if (entry == NULL)
+    {
+        return ERROR_NOT_FOUND;
+    }
+
+    InterlockedExchange(&entry->removed, 1);
+    WaitForProbe(entry);
+    ReleaseEntry(entry);
+    return 0;
+}
+
+/// <summary>
+/// Record that a binding was just used by a real call, which postpones its next probe by a full interval.
+/// </summary>
+/// <param name="hBinding">The binding handle passed to KeepaliveRegisterBinding.</param>
+void __stdcall KeepaliveTouchBinding(handle_t hBinding)
+{
+    AcquireSRWLockShared(&m_entriesLock);
+    std::map<handle_t, KeepaliveEntry *>::iterator found = m_entries.find(hBinding);
+    if (found != m_entries.end())
+    {
+        InterlockedExchange64(&found->second->lastActivity, (LONGLONG)GetTickCount64());
+    }
+    ReleaseSRWLockShared(&m_entriesLock);
+}
+
+/// <summary>
+/// Remember the binding a session was connected on, so that its calls touch the binding. It is called by
+/// TracedEcDoConnectEx whether the monitor runs or not, since the binding may be registered later.
+/// </summary>
+void KeepaliveBindSession(CXH cxh, handle_t hBinding)
+{
+    AcquireSRWLockExclusive(&m_sessionBindingsLock);
+    m_sessionBindings[cxh] = hBinding;
+    ReleaseSRWLockExclusive(&m_sessionBindingsLock);
+}
+
+/// <summary>
+/// Forget the binding of a session, before EcDoDisconnect destroys its CXH.
+/// </summary>
+void KeepaliveUnbindSession(CXH cxh)
+{
+    AcquireSRWLockExclusive(&m_sessionBindingsLock);
+    m_sessionBindings.erase(cxh);
+    ReleaseSRWLockExclusive(&m_sessionBindingsLock);
+}
+
+/// <summary>
+/// Record that a call on a session reached the server, which postpones the next probe of its binding.
+/// </summary>
+void KeepaliveTouchSession(CXH cxh)
+{
+    if (m_state != KeepaliveMonitorRunning)
+    {
+        return;
+    }
+
+    handle_t hBinding = NULL;
+    AcquireSRWLockShared(&m_sessionBindingsLock);
+    std::map<CXH, handle_t>::iterator found = m_sessionBindings.find(cxh);
+    if (found != m_sessionBindings.end())
+    {
+        hBinding = found->second;
+    }
+    ReleaseSRWLockShared(&m_sessionBindingsLock);
+
+    if (hBinding != NULL)
+    {
+        KeepaliveTouchBinding(hBinding);
+    }
+}
+
+/// <summary>
+/// Return the liveness state of a binding.
+/// </summary>
+/// <param name="hBinding">The binding handle passed to KeepaliveRegisterBinding.</param>
+/// <returns>The state of the binding. KeepaliveBindingDead indicates it needs to be rebound before it is used.</returns>
+KEEPALIVE_BINDING_STATE __stdcall KeepaliveGetBindingState(handle_t hBinding)
+{
+    KEEPALIVE_BINDING_STATE state = KeepaliveBindingUnknown;
+    AcquireSRWLockShared(&m_entriesLock);
+    std::map<handle_t, KeepaliveEntry *>::iterator found = m_entries.find(hBinding);
+    if (found != m_entries.end())
+    {
+        state = (KEEPALIVE_BINDING_STATE)found->second->state;
+    }
+    ReleaseSRWLockShared(&m_entriesLock);
+
+    return state;
+}
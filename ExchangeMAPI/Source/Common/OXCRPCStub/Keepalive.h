@@ -0,0 +1,41 @@
+#pragma once
+
+#include "MS-OXCRPC.h"
+
+/// <summary>
+/// The liveness state of a binding watched by the keepalive monitor.
+/// </summary>
+typedef enum _KEEPALIVE_BINDING_STATE
+{
+    KeepaliveBindingAlive = 0,      // The last EcDummyRpc succeeded, or the binding has not been probed yet.
+    KeepaliveBindingSuspect = 1,    // At least one EcDummyRpc failed, but fewer than the failure threshold.
+    KeepaliveBindingDead = 2,       // The failure threshold was reached; it is no longer probed until it is rebound and rearmed.
+    KeepaliveBindingUnknown = 3     // The binding is not registered.
+} KEEPALIVE_BINDING_STATE;
+
+/// <summary>
+/// Routine invoked on a thread pool thread when a binding is marked dead, so that the owner can rebind before the next call.
+/// </summary>
+/// <param name="hBinding">The binding that was marked dead.</param>
+/// <param name="status">The status of the last failed EcDummyRpc call.</param>
+typedef void (__stdcall *KEEPALIVE_DEAD_ROUTINE)(handle_t hBinding, long status);
+
+long __stdcall KeepaliveStart(unsigned long intervalMilliseconds, unsigned long failureThreshold, KEEPALIVE_DEAD_ROUTINE deadRoutine);
+
+void __stdcall KeepaliveStop();
+
+long __stdcall KeepaliveRegisterBinding(handle_t hBinding);
+
+long __stdcall KeepaliveUnregisterBinding(handle_t hBinding);
+
+long __stdcall KeepaliveRearmBinding(handle_t hBinding);
+
+void __stdcall KeepaliveTouchBinding(handle_t hBinding);
+
+KEEPALIVE_BINDING_STATE __stdcall KeepaliveGetBindingState(handle_t hBinding);
+
+void KeepaliveBindSession(CXH cxh, handle_t hBinding);
+
+void KeepaliveUnbindSession(CXH cxh);
+
+void KeepaliveTouchSession(CXH cxh);
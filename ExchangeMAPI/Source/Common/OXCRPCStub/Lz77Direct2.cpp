@@ -0,0 +1,402 @@
+#include "Lz77Direct2.h"
+
+// The LZ77 compression of RPC_HEADER_EXT payloads with the DIRECT2 encoding, as specified in MS-OXCRPC section
+// 3.1.7.2. A 32-bit bitmask precedes every 32 tokens, its most significant bit first; a 0 bit is a literal byte and a
+// 1 bit is a match whose 2-byte metadata holds the offset minus 1 in its high 13 bits and the length minus 3 in its
+// low 3 bits. Longer lengths continue in a nibble shared by two matches, then in a byte, then in 2 bytes. The stream
+// ends with a bitmask whose unused bits are all 1, so that the decoder finds a match with no metadata after the last
+// token. The compressor finds matches through a hash of the next 3 bytes and a short chain of earlier positions with
+// the same hash, which keeps it fast enough for every request buffer.
+
+/// <summary>
+/// The number of bits of the hash of the next 3 bytes.
+/// </summary>
+static const unsigned long HashBits = 12;
+
+/// <summary>
+/// The number of earlier positions tried for each match.
+/// </summary>
+static const int MaxChainLength = 16;
+
+/// <summary>
+/// The longest match the compressor emits; the 2-byte length holds the length minus 3.
+/// </summary>
+static const unsigned long MaxMatchLength = 0xFFFF + LZ77_MIN_MATCH;
+
+/// <summary>
+/// The output of the compressor: the bitmask being filled, the byte whose high nibble is still free, and the overflow.
+/// </summary>
+struct Direct2Writer
+{
+    unsigned char *output;
+    unsigned long capacity;
+    unsigned long position;
+    unsigned long flagsPosition;
+    unsigned long flags;
+    unsigned long flagCount;
+    unsigned long nibblePosition;       // The byte whose high nibble the next long match uses, or 0 if there is none.
+    bool overflow;
+
+    void PutByte(unsigned char value)
+    {
+        if (position >= capacity)
+        {
+            overflow = true;
+            return;
+        }
+
+        output[position++] = value;
+    }
+
+    void PutUShort(unsigned short value)
+    {
+        PutByte((unsigned char)value);
+        PutByte((unsigned char)(value >> 8));
+    }
+
+    void PutFlags(unsigned long at, unsigned long value)
+    {
+        if (at + 4 > capacity)
+        {
+            overflow = true;
+            return;
+        }
+
+        output[at] = (unsigned char)value;
+        output[at + 1] = (unsigned char)(value >> 8);
+        output[at + 2] = (unsigned char)(value >> 16);
+        output[at + 3] = (unsigned char)(value >> 24);
+    }
+
+    void AddFlag(unsigned long bit)
+    {
+        flags = (flags << 1) | bit;
+        flagCount++;
+        if (flagCount == 32)
+        {
+            PutFlags(flagsPosition, flags);
+            flags = 0;
+            flagCount = 0;
+            flagsPosition = position;
+            position += 4;
+        }
+    }
+
+    void PutNibble(unsigned char value)
+    {
+        if (nibblePosition == 0)
+        {
+            nibblePosition = position;
+            PutByte(value);
+        }
+        else
+        {
+            if (nibblePosition < capacity)
+            {
+                output[nibblePosition] |= (unsigned char)(value << 4);
+            }
+
+            nibblePosition = 0;
+        }
+    }
+
+    void PutLiteral(unsigned char value)
+    {
+        PutByte(value);
+        AddFlag(0);
+    }
+
+    void PutMatch(unsigned long offset, unsigned long length)
+    {
+        unsigned long remaining = length - LZ77_MIN_MATCH;
+        unsigned short metadata = (unsigned short)((offset - 1) << 3);
+        if (remaining < 7)
+        {
+            PutUShort((unsigned short)(metadata | remaining));
+        }
+        else
+        {
+            PutUShort((unsigned short)(metadata | 7));
+            remaining -= 7;
+            if (remaining < 15)
+            {
+                PutNibble((unsigned char)remaining);
+            }
+            else
+            {
+                PutNibble(15);
+                remaining -= 15;
+                if (remaining < 255)
+                {
+                    PutByte((unsigned char)remaining);
+                }
+                else
+                {
+                    PutByte(255);
+                    PutUShort((unsigned short)(length - LZ77_MIN_MATCH));
+                }
+            }
+        }
+
+        AddFlag(1);
+    }
+};
+
+static unsigned long HashAt(const unsigned char *data)
+{
+    unsigned long value = (unsigned long)data[0] | ((unsigned long)data[1] << 8) | ((unsigned long)data[2] << 16);
+    return ((value * 2654435761UL) >> (32 - HashBits)) & ((1UL << HashBits) - 1);
+}
+
+/// <summary>
+/// Compress a payload with LZ77 and the DIRECT2 encoding.
+/// </summary>
+/// <param name="input">The payload to compress.</param>
+/// <param name="cbInput">The size of the payload.</param>
+/// <param name="output">The buffer to write the compressed payload to.</param>
+/// <param name="cbOutput">The size of the buffer. Pass less than cbInput to accept only a compressed payload that is smaller.</param>
+/// <param name="pcbOutput">Receives the size of the compressed payload.</param>
+/// <returns>If success, it returns 0. ERROR_INSUFFICIENT_BUFFER indicates the compressed payload does not fit in cbOutput bytes.</returns>
+long __stdcall Lz77Direct2Compress(const unsigned char *input, unsigned long cbInput, unsigned char *output, unsigned long cbOutput, unsigned long *pcbOutput)
+{
+    if ((input == NULL && cbInput != 0) || output == NULL || pcbOutput == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    // head holds the last position of each hash and chain the position before it with the same hash, for the positions
+    // within LZ77_MAX_OFFSET of the current one.
+    long head[1 << HashBits];
+    long chain[LZ77_MAX_OFFSET];
+    memset(head, 0xFF, sizeof(head));
+
+    Direct2Writer writer;
+    memset(&writer, 0, sizeof(writer));
+    writer.output = output;
+    writer.capacity = cbOutput;
+    writer.position = 4;
+
+    unsigned long position = 0;
+    while (position < cbInput && !writer.overflow)
+    {
+        unsigned long bestLength = 0;
+        unsigned long bestOffset = 0;
+        if (cbInput - position >= LZ77_MIN_MATCH)
+        {
+            unsigned long limit = cbInput - position < MaxMatchLength ? cbInput - position : MaxMatchLength;
+            unsigned long hash = HashAt(input + position);
+            long candidate = head[hash];
+            for (int tries = 0; candidate >= 0 && position - (unsigned long)candidate <= LZ77_MAX_OFFSET && tries < MaxChainLength; tries++)
+            {
+                const unsigned char *from = input + candidate;
+                const unsigned char *to = input + position;
+                unsigned long length = 0;
+                while (length < limit && from[length] == to[length])
+                {
+                    length++;
+                }
+
+                if (length > bestLength)
+                {
+                    bestLength = length;
+                    bestOffset = position - (unsigned long)candidate;
+                    if (length == limit)
+                    {
+                        break;
+                    }
+                }
+
+                long next = chain[candidate & (LZ77_MAX_OFFSET - 1)];
+                if (next >= candidate)
+                {
+                    break;
+                }
+
+                candidate = next;
+            }
+        }
+
+        unsigned long advance = bestLength >= LZ77_MIN_MATCH ? bestLength : 1;
+        if (advance == 1)
+        {
+            writer.PutLiteral(input[position]);
+        }
+        else
+        {
+            writer.PutMatch(bestOffset, bestLength);
+        }
+
+        for (unsigned long end = position + advance; position < end; position++)
+        {
+            if (cbInput - position >= LZ77_MIN_MATCH)
+            {
+                unsigned long hash = HashAt(input + position);
+                chain[position & (LZ77_MAX_OFFSET - 1)] = head[hash];
+                head[hash] = (long)position;
+            }
+        }
+    }
+
+    // Fill the unused bits of the last bitmask with 1, the end of the stream.
+    unsigned long unused = 32 - writer.flagCount;
+    unsigned long flags = unused == 32 ? 0xFFFFFFFF : (writer.flags << unused) | ((1UL << unused) - 1);
+    writer.PutFlags(writer.flagsPosition, flags);
+    if (writer.overflow || writer.position > cbOutput)
+    {
+        return ERROR_INSUFFICIENT_BUFFER;
+    }
+
+    *pcbOutput = writer.position;
+    return 0;
+}
+
+/// <summary>
+/// Decompress a payload compressed with LZ77 and the DIRECT2 encoding.
+/// </summary>
+/// <param name="input">The compressed payload.</param>
+/// <param name="cbInput">The size of the compressed payload.</param>
+/// <param name="output">The buffer to write the payload to.</param>
+/// <param name="cbOutput">The size of the buffer; the SizeActual of the RPC_HEADER_EXT is enough.</param>
+/// <param name="pcbOutput">Receives the size of the payload.</param>
+/// <returns>If success, it returns 0. ERROR_INVALID_DATA indicates a malformed payload; ERROR_INSUFFICIENT_BUFFER indicates the payload does not fit in cbOutput bytes.</returns>
+long __stdcall Lz77Direct2Decompress(const unsigned char *input, unsigned long cbInput, unsigned char *output, unsigned long cbOutput, unsigned long *pcbOutput)
+{
+    if ((input == NULL && cbInput != 0) || (output == NULL && cbOutput != 0) || pcbOutput == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    unsigned long in = 0;
+    unsigned long out = 0;
+    unsigned long flags = 0;
+    unsigned long flagCount = 0;
+    unsigned long nibblePosition = 0;
+    bool hasNibble = false;
+    for (;;)
+    {
+        if (flagCount == 0)
+        {
+            if (in == cbInput)
+            {
+                break;
+            }
+
+            if (cbInput - in < 4)
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            flags = (unsigned long)input[in] | ((unsigned long)input[in + 1] << 8) | ((unsigned long)input[in + 2] << 16) | ((unsigned long)input[in + 3] << 24);
+            in += 4;
+            flagCount = 32;
+        }
+
+        flagCount--;
+        if (in == cbInput)
+        {
+            // The bits after the last token; a well-formed stream has a match bit here.
+            break;
+        }
+
+        if ((flags & (1UL << flagCount)) == 0)
+        {
+            if (out == cbOutput)
+            {
+                return ERROR_INSUFFICIENT_BUFFER;
+            }
+
+            output[out++] = input[in++];
+            continue;
+        }
+
+        if (cbInput - in < 2)
+        {
+            return ERROR_INVALID_DATA;
+        }
+
+        unsigned long metadata = (unsigned long)input[in] | ((unsigned long)input[in + 1] << 8);
+        in += 2;
+        unsigned long offset = (metadata >> 3) + 1;
+        unsigned long length = metadata & 7;
+        if (length == 7)
+        {
+            if (!hasNibble)
+            {
+                if (in == cbInput)
+                {
+                    return ERROR_INVALID_DATA;
+                }
+
+                nibblePosition = in++;
+                length = input[nibblePosition] & 0x0F;
+                hasNibble = true;
+            }
+            else
+            {
+                length = input[nibblePosition] >> 4;
+                hasNibble = false;
+            }
+
+            if (length == 15)
+            {
+                if (in == cbInput)
+                {
+                    return ERROR_INVALID_DATA;
+                }
+
+                length = input[in++];
+                if (length == 255)
+                {
+                    if (cbInput - in < 2)
+                    {
+                        return ERROR_INVALID_DATA;
+                    }
+
+                    length = (unsigned long)input[in] | ((unsigned long)input[in + 1] << 8);
+                    in += 2;
+                    if (length < 15 + 7)
+                    {
+                        return ERROR_INVALID_DATA;
+                    }
+
+                    length -= 15 + 7;
+                }
+
+                length += 15;
+            }
+
+            length += 7;
+        }
+
+        length += LZ77_MIN_MATCH;
+        if (offset > out)
+        {
+            return ERROR_INVALID_DATA;
+        }
+
+        if (length > cbOutput - out)
+        {
+            return ERROR_INSUFFICIENT_BUFFER;
+        }
+
+        // An offset shorter than the length repeats the bytes being written, so it is copied forward byte by byte.
+        unsigned char *to = output + out;
+        const unsigned char *from = to - offset;
+        if (offset >= length)
+        {
+            memcpy(to, from, length);
+        }
+        else
+        {
+            for (unsigned long i = 0; i < length; i++)
+            {
+                to[i] = from[i];
+            }
+        }
+
+        out += length;
+    }
+
+    *pcbOutput = out;
+    return 0;
+}
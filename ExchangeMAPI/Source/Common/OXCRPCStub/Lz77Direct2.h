@@ -0,0 +1,17 @@
+#pragma once
+
+#include "CodecPlatform.h"
+
+/// <summary>
+/// The largest distance back a DIRECT2 match can reach; the metadata holds the offset minus 1 in 13 bits.
+/// </summary>
+#define LZ77_MAX_OFFSET 0x2000
+
+/// <summary>
+/// The smallest number of bytes a DIRECT2 match covers.
+/// </summary>
+#define LZ77_MIN_MATCH 3
+
+long __stdcall Lz77Direct2Compress(const unsigned char *input, unsigned long cbInput, unsigned char *output, unsigned long cbOutput, unsigned long *pcbOutput);
+
+long __stdcall Lz77Direct2Decompress(const unsigned char *input, unsigned long cbInput, unsigned char *output, unsigned long cbOutput, unsigned long *pcbOutput);
@@ -0,0 +1,1348 @@
+#include "MapiHttpClient.h"
+#include "MapiHttpResponseParser.h"
+#include "RpcHeaderExt.h"
+#include <winhttp.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A native MAPI/HTTP client for the mailbox endpoint, as specified in MS-OXCMAPIHTTP, with the call shape of
+// EcDoConnectEx, EcDoRpcExt2, EcDoAsyncWaitEx and EcDoDisconnect. Each host, user and scheme gets one pooled WinHTTP
+// session and connection handle whose HTTP/1.1 keep-alive connections are shared by all the sessions on it and kept
+// after they disconnect, so that a new session reuses an already authenticated connection. Cookies are kept per
+// session and the automatic cookie store of WinHTTP is disabled, so that the sid and sequence cookies of one session
+// never leak into another session on the same connection. Request bodies are written as a list of segments straight
+// from the caller buffers. The body of an Execute response is parsed as it arrives and its RopBuffer is read straight
+// into rgbOut, so the caller can start on the first RPC_HEADER_EXT buffer while the rest is still on the wire; the
+// small bodies of the other requests are read into a buffer kept by the session.
+//
+// StubMapiHttpTest drives these entry points against a loopback server: chunked meta-tag responses, the request bodies,
+// the cookies of each session, the reuse of a pooled connection, and failures reported by X-ResponseCode or an HTTP 503.
+
+/// <summary>
+/// The user agent of the pooled WinHTTP sessions.
+/// </summary>
+static const wchar_t UserAgent[] = L"MS-OXCRPC_RPCStub/MAPIHTTP";
+
+/// <summary>
+/// The X-ClientApplication header sent with every request; the same value as the managed adapter.
+/// </summary>
+static const wchar_t ClientApplication[] = L"Outlook/15.00.0856.000";
+
+/// <summary>
+/// The number of times a request is sent again after a 401 response before the call fails.
+/// </summary>
+static const int MaxAuthRetries = 3;
+
+/// <summary>
+/// The initial size of the response buffer of a session.
+/// </summary>
+static const unsigned long InitialResponseSize = 0x10000;
+
+/// <summary>
+/// The size of the reads of an Execute response before its body, small enough that little of the body is read along
+/// with the meta-tags and has to be copied.
+/// </summary>
+static const unsigned long PreludeReadSize = 0x100;
+
+/// <summary>
+/// A pooled connection to one host for one user.
+/// </summary>
+struct MapiHttpHost
+{
+    std::wstring key;
+    HINTERNET session;
+    HINTERNET connect;
+    BOOL secure;
+    std::wstring userName;              // DOMAIN\user, or user if there is no domain.
+    std::wstring password;
+    volatile LONG authScheme;           // The WINHTTP_AUTH_SCHEME the server accepted, or 0 before the first challenge.
+    volatile LONG refCount;             // One for the pool and one for each session.
+};
+
+/// <summary>
+/// A segment of a request body.
+/// </summary>
+struct BodySegment
+{
+    const void *data;
+    unsigned long size;
+};
+
+/// <summary>
+/// The part of an Execute response body an ExecuteSink expects next.
+/// </summary>
+enum ExecutePhase
+{
+    ExecutePhaseFields,         // StatusCode, ErrorCode, Flags and RopBufferSize.
+    ExecutePhaseRopBuffer,
+    ExecutePhaseAuxiliarySize,
+    ExecutePhaseAuxiliary,
+    ExecutePhaseDiscard         // Anything after AuxiliaryBuffer, or the rest of a response that does not fit.
+};
+
+/// <summary>
+/// Places the body of an Execute response as it arrives: the fixed fields in small buffers, the RopBuffer in rgbOut
+/// and the AuxiliaryBuffer in rgbAuxOut. Window returns where the next bytes go, so that they can be read there.
+/// </summary>
+struct ExecuteSink
+{
+    ExecutePhase phase;
+    unsigned char fields[16];
+    unsigned long fieldsSize;
+    unsigned char *rgbOut;
+    unsigned long cbOut;
+    unsigned long ropSize;
+    unsigned long ropReceived;
+    unsigned long nextBuffer;           // The offset in rgbOut of the first RPC_HEADER_EXT buffer not yet reported.
+    unsigned char auxField[4];
+    unsigned long auxFieldSize;
+    unsigned char *rgbAuxOut;
+    unsigned long cbAuxOut;             // 0 if the auxiliary buffer is dropped.
+    unsigned long auxSize;
+    unsigned long auxReceived;
+    long status;
+    MAPIHTTP_BUFFER_ROUTINE routine;
+    void *context;
+
+    static unsigned long ToULong(const unsigned char *value)
+    {
+        return (unsigned long)value[0] | ((unsigned long)value[1] << 8) | ((unsigned long)value[2] << 16) | ((unsigned long)value[3] << 24);
+    }
+
+    BOOL Window(unsigned char **destination, unsigned long *size)
+    {
+        switch (phase)
+        {
+        case ExecutePhaseFields:
+            // Read StatusCode alone first: the fields after it depend on its value.
+            *destination = fields + fieldsSize;
+            *size = (fieldsSize < 4 ? 4 : (unsigned long)sizeof(fields)) - fieldsSize;
+            return TRUE;
+
+        case ExecutePhaseRopBuffer:
+            *destination = rgbOut + ropReceived;
+            *size = ropSize - ropReceived;
+            return TRUE;
+
+        case ExecutePhaseAuxiliarySize:
+            *destination = auxField + auxFieldSize;
+            *size = sizeof(auxField) - auxFieldSize;
+            return TRUE;
+
+        case ExecutePhaseAuxiliary:
+            *destination = rgbAuxOut + auxReceived;
+            *size = auxSize - auxReceived;
+            return cbAuxOut != 0;
+
+        default:
+            return FALSE;
+        }
+    }
+
+    /// <summary>
+    /// Pass each RPC_HEADER_EXT buffer of the RopBuffer that arrived completely to the routine.
+    /// </summary>
+    void ReportBuffers()
+    {
+        while (routine != NULL && ropReceived - nextBuffer >= sizeof(RPC_HEADER_EXT))
+        {
+            unsigned long size = sizeof(RPC_HEADER_EXT) + ((unsigned long)rgbOut[nextBuffer + 4] | ((unsigned long)rgbOut[nextBuffer + 5] << 8));
+            if (ropReceived - nextBuffer < size)
+            {
+                break;
+            }
+
+            routine(context, rgbOut + nextBuffer, size);
+            nextBuffer += size;
+        }
+    }
+
+    void Consume(const unsigned char *data, unsigned long size)
+    {
+        while (size != 0 && phase != ExecutePhaseDiscard)
+        {
+            unsigned char *destination = NULL;
+            unsigned long take = 0;
+            BOOL placed = Window(&destination, &take);
+            take = size < take ? size : take;
+            if (placed && destination != data)
+            {
+                memcpy(destination, data, take);
+            }
+
+            data += take;
+            size -= take;
+            switch (phase)
+            {
+            case ExecutePhaseFields:
+                fieldsSize += take;
+                if (fieldsSize == 4 && ToULong(fields) != 0)
+                {
+                    // A failed request has only AuxiliaryBufferSize and AuxiliaryBuffer after StatusCode.
+                    phase = ExecutePhaseAuxiliarySize;
+                }
+                else if (fieldsSize == sizeof(fields))
+                {
+                    ropSize = ToULong(fields + 12);
+                    if (ToULong(fields + 4) != 0)
+                    {
+                        routine = NULL;
+                    }
+
+                    if (ropSize > cbOut)
+                    {
+                        status = ERROR_INSUFFICIENT_BUFFER;
+                        phase = ExecutePhaseDiscard;
+                    }
+                    else
+                    {
+                        phase = ropSize == 0 ? ExecutePhaseAuxiliarySize : ExecutePhaseRopBuffer;
+                    }
+                }
+
+                break;
+
+            case ExecutePhaseRopBuffer:
+                ropReceived += take;
+                ReportBuffers();
+                if (ropReceived == ropSize)
+                {
+                    phase = ExecutePhaseAuxiliarySize;
+                }
+
+                break;
+
+            case ExecutePhaseAuxiliarySize:
+                auxFieldSize += take;
+                if (auxFieldSize == sizeof(auxField))
+                {
+                    auxSize = ToULong(auxField);
+                    if (cbAuxOut != 0 && auxSize > cbAuxOut)
+                    {
+                        status = ERROR_INSUFFICIENT_BUFFER;
+                        phase = ExecutePhaseDiscard;
+                    }
+                    else
+                    {
+                        phase = auxSize == 0 ? ExecutePhaseDiscard : ExecutePhaseAuxiliary;
+                    }
+                }
+
+                break;
+
+            case ExecutePhaseAuxiliary:
+                auxReceived += take;
+                if (auxReceived == auxSize)
+                {
+                    phase = ExecutePhaseDiscard;
+                }
+
+                break;
+
+            default:
+                break;
+            }
+        }
+    }
+};
+
+struct _MAPIHTTP_SESSION
+{
+    MapiHttpHost *host;
+    std::wstring path;
+    std::wstring clientInfo;
+    unsigned long requestCount;
+    std::vector<std::pair<std::wstring, std::wstring> > cookies;
+    std::wstring cookieHeader;
+    std::vector<unsigned char> response;
+    unsigned long responseSize;
+    MAPIHTTP_PARSER *parser;
+    ExecuteSink *sink;                  // The sink of the Execute response being read, or NULL to locate the body in response.
+    const unsigned char *body;
+    unsigned long bodySize;
+    unsigned long elapsedTime;          // The X-ElapsedTime additional header of the last response.
+    unsigned long httpStatus;
+    unsigned long responseCode;
+};
+
+static std::map<std::wstring, MapiHttpHost *> m_hosts;
+static SRWLOCK m_hostsLock = SRWLOCK_INIT;
+static volatile LONG m_sessionCount = 0;
+static volatile LONG m_requestCount = 0;
+static volatile LONG m_authChallengeCount = 0;
+static volatile LONGLONG m_bytesSent = 0;
+static volatile LONGLONG m_bytesReceived = 0;
+
+static std::wstring ToWide(const char *value)
+{
+    std::wstring result;
+    if (value != NULL && *value != 0)
+    {
+        int length = MultiByteToWideChar(CP_ACP, 0, value, -1, NULL, 0);
+        if (length > 1)
+        {
+            result.resize(length - 1);
+            MultiByteToWideChar(CP_ACP, 0, value, -1, &result[0], length);
+        }
+    }
+
+    return result;
+}
+
+static void ReleaseHost(MapiHttpHost *host)
+{
+    if (InterlockedDecrement(&host->refCount) == 0)
+    {
+        WinHttpCloseHandle(host->connect);
+        WinHttpCloseHandle(host->session);
+        delete host;
+    }
+}
+
+static void FreeSession(MAPIHTTP_SESSION *session)
+{
+    ReleaseHost(session->host);
+    MapiHttpParserDestroy(session->parser);
+    delete session;
+}
+
+/// <summary>
+/// Find the pooled host of a URL and user, or create it.
+/// </summary>
+/// <param name="mailStoreUrl">The mailbox endpoint URL, for example https://server/mapi/emsmdb/?MailboxId=id.</param>
+/// <param name="domain">The domain of the user, or NULL.</param>
+/// <param name="userName">The user name.</param>
+/// <param name="password">The password of the user.</param>
+/// <param name="host">Receives the host with a reference for the caller.</param>
+/// <param name="path">Receives the path and query of the URL.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+static long AcquireHost(const char *mailStoreUrl, const char *domain, const char *userName, const char *password, MapiHttpHost **host, std::wstring *path)
+{
+    std::wstring url = ToWide(mailStoreUrl);
+    URL_COMPONENTS components;
+    memset(&components, 0, sizeof(components));
+    components.dwStructSize = sizeof(components);
+    components.dwSchemeLength = (DWORD)-1;
+    components.dwHostNameLength = (DWORD)-1;
+    components.dwUrlPathLength = (DWORD)-1;
+    components.dwExtraInfoLength = (DWORD)-1;
+    if (url.empty() || !WinHttpCrackUrl(url.c_str(), (DWORD)url.size(), 0, &components))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    std::wstring hostName(components.lpszHostName, components.dwHostNameLength);
+    path->assign(components.lpszUrlPath, components.dwUrlPathLength);
+    path->append(components.lpszExtraInfo, components.dwExtraInfoLength);
+
+    std::wstring user = ToWide(domain);
+    if (!user.empty())
+    {
+        user += L'\\';
+    }
+
+    user += ToWide(userName);
+
+    wchar_t port[8];
+    swprintf_s(port, 8, L"%u", (unsigned int)components.nPort);
+    std::wstring key = user + L'@' + (components.nScheme == INTERNET_SCHEME_HTTPS ? L"https://" : L"http://") + hostName + L':' + port;
+
+    AcquireSRWLockExclusive(&m_hostsLock);
+    std::map<std::wstring, MapiHttpHost *>::iterator it = m_hosts.find(key);
+    if (it != m_hosts.end())
+    {
+        *host = it->second;
+        InterlockedIncrement(&(*host)->refCount);
+        ReleaseSRWLockExclusive(&m_hostsLock);
+        return 0;
+    }
+
+    // Each user gets its own WinHTTP session, because connections authenticated with NTLM or Negotiate belong to one
+    // identity and WinHTTP pools connections per session.
+    HINTERNET session = WinHttpOpen(UserAgent, WINHTTP_ACCESS_TYPE_DEFAULT_PROXY, WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0);
+    HINTERNET connect = session == NULL ? NULL : WinHttpConnect(session, hostName.c_str(), components.nPort, 0);
+    if (connect == NULL)
+    {
+        long status = (long)GetLastError();
+        if (session != NULL)
+        {
+            WinHttpCloseHandle(session);
+        }
+
+        ReleaseSRWLockExclusive(&m_hostsLock);
+        return status;
+    }
+
+    MapiHttpHost *created = new MapiHttpHost();
+    created->key = key;
+    created->session = session;
+    created->connect = connect;
+    created->secure = components.nScheme == INTERNET_SCHEME_HTTPS;
+    created->userName = user;
+    created->password = ToWide(password);
+    created->authScheme = 0;
+    created->refCount = 2;
+    m_hosts[key] = created;
+    ReleaseSRWLockExclusive(&m_hostsLock);
+
+    *host = created;
+    return 0;
+}
+
+/// <summary>
+/// Keep the cookies of a response, replacing the ones of the same name.
+/// </summary>
+static void SaveCookies(MAPIHTTP_SESSION *session, HINTERNET request)
+{
+    wchar_t value[1024];
+    BOOL changed = FALSE;
+    for (DWORD index = 0; ; )
+    {
+        DWORD size = sizeof(value);
+        if (!WinHttpQueryHeaders(request, WINHTTP_QUERY_SET_COOKIE, WINHTTP_HEADER_NAME_BY_INDEX, value, &size, &index))
+        {
+            if (GetLastError() == ERROR_INSUFFICIENT_BUFFER)
+            {
+                // A cookie that does not fit is not a MAPI/HTTP session cookie; skip it.
+                index++;
+                continue;
+            }
+
+            break;
+        }
+
+        std::wstring cookie(value, size / sizeof(wchar_t));
+        size_t end = cookie.find(L';');
+        if (end != std::wstring::npos)
+        {
+            cookie.resize(end);
+        }
+
+        size_t separator = cookie.find(L'=');
+        if (separator == std::wstring::npos || separator == 0)
+        {
+            continue;
+        }
+
+        std::wstring name = cookie.substr(0, separator);
+        std::wstring content = cookie.substr(separator + 1);
+        size_t i = 0;
+        for (; i < session->cookies.size() && session->cookies[i].first != name; i++)
+        {
+        }
+
+        if (i == session->cookies.size())
+        {
+            session->cookies.push_back(std::make_pair(name, content));
+        }
+        else
+        {
+            session->cookies[i].second = content;
+        }
+
+        changed = TRUE;
+    }
+
+    if (changed)
+    {
+        session->cookieHeader.clear();
+        for (size_t i = 0; i < session->cookies.size(); i++)
+        {
+            if (session->cookies[i].second.empty())
+            {
+                continue;
+            }
+
+            session->cookieHeader += session->cookieHeader.empty() ? L"Cookie: " : L"; ";
+            session->cookieHeader += session->cookies[i].first;
+            session->cookieHeader += L'=';
+            session->cookieHeader += session->cookies[i].second;
+        }
+
+        if (!session->cookieHeader.empty())
+        {
+            session->cookieHeader += L"\r\n";
+        }
+    }
+}
+
+/// <summary>
+/// Read the whole response body into the buffer of the session.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+static long ReadResponse(MAPIHTTP_SESSION *session, HINTERNET request)
+{
+    session->responseSize = 0;
+    if (session->response.size() < InitialResponseSize)
+    {
+        session->response.resize(InitialResponseSize);
+    }
+
+    for (;;)
+    {
+        DWORD available = 0;
+        if (!WinHttpQueryDataAvailable(request, &available))
+        {
+            return (long)GetLastError();
+        }
+
+        if (available == 0)
+        {
+            break;
+        }
+
+        if (session->response.size() - session->responseSize < available)
+        {
+            size_t size = session->response.size() * 2;
+            while (size - session->responseSize < available)
+            {
+                size *= 2;
+            }
+
+            session->response.resize(size);
+        }
+
+        DWORD read = 0;
+        if (!WinHttpReadData(request, &session->response[session->responseSize], (DWORD)(session->response.size() - session->responseSize), &read))
+        {
+            return (long)GetLastError();
+        }
+
+        session->responseSize += read;
+    }
+
+    InterlockedExchangeAdd64(&m_bytesReceived, session->responseSize);
+    return 0;
+}
+
+/// <summary>
+/// Send a request on the session and wait for the status and headers of its response.
+/// </summary>
+/// <param name="session">The session.</param>
+/// <param name="requestType">The X-RequestType header.</param>
+/// <param name="segments">The segments of the request body, in order.</param>
+/// <param name="segmentCount">The number of segments.</param>
+/// <param name="response">Receives the request handle, positioned at the response body; close it with WinHttpCloseHandle.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+static long SendRequest(MAPIHTTP_SESSION *session, const wchar_t *requestType, const BodySegment *segments, unsigned long segmentCount, HINTERNET *response)
+{
+    MapiHttpHost *host = session->host;
+    DWORD contentLength = 0;
+    for (unsigned long i = 0; i < segmentCount; i++)
+    {
+        contentLength += segments[i].size;
+    }
+
+    session->requestCount++;
+    wchar_t number[16];
+    swprintf_s(number, 16, L"%lu", session->requestCount);
+    std::wstring headers = L"Content-Type: application/mapi-http\r\nX-RequestType: ";
+    headers += requestType;
+    headers += L"\r\nX-ClientInfo: ";
+    headers += session->clientInfo;
+    headers += L"-1\r\nX-RequestId: ";
+    headers += session->clientInfo;
+    headers += L':';
+    headers += number;
+    headers += L"\r\nX-ClientApplication: ";
+    headers += ClientApplication;
+    headers += L"\r\n";
+    headers += session->cookieHeader;
+
+    static const wchar_t *acceptTypes[] = { L"application/mapi-http", NULL };
+    long status = 0;
+    for (int attempt = 0; ; attempt++)
+    {
+        HINTERNET request = WinHttpOpenRequest(host->connect, L"POST", session->path.c_str(), NULL, WINHTTP_NO_REFERER, acceptTypes, host->secure ? WINHTTP_FLAG_SECURE : 0);
+        if (request == NULL)
+        {
+            return (long)GetLastError();
+        }
+
+        DWORD option = WINHTTP_DISABLE_COOKIES;
+        WinHttpSetOption(request, WINHTTP_OPTION_DISABLE_FEATURE, &option, sizeof(option));
+        if (host->secure)
+        {
+            // The same certificate policy as Common.ValidateServerCertificate in the managed adapter.
+            option = SECURITY_FLAG_IGNORE_UNKNOWN_CA | SECURITY_FLAG_IGNORE_CERT_CN_INVALID | SECURITY_FLAG_IGNORE_CERT_DATE_INVALID;
+            WinHttpSetOption(request, WINHTTP_OPTION_SECURITY_FLAGS, &option, sizeof(option));
+        }
+
+        DWORD scheme = (DWORD)host->authScheme;
+        if (scheme != 0)
+        {
+            WinHttpSetCredentials(request, WINHTTP_AUTH_TARGET_SERVER, scheme, host->userName.c_str(), host->password.c_str(), NULL);
+        }
+
+        InterlockedIncrement(&m_requestCount);
+        BOOL sent = WinHttpSendRequest(request, headers.c_str(), (DWORD)headers.size(), WINHTTP_NO_REQUEST_DATA, 0, contentLength, 0);
+        for (unsigned long i = 0; sent && i < segmentCount; i++)
+        {
+            DWORD written = 0;
+            sent = segments[i].size == 0 || WinHttpWriteData(request, segments[i].data, segments[i].size, &written);
+        }
+
+        if (!sent || !WinHttpReceiveResponse(request, NULL))
+        {
+            status = (long)GetLastError();
+            WinHttpCloseHandle(request);
+            return status;
+        }
+
+        InterlockedExchangeAdd64(&m_bytesSent, contentLength);
+        DWORD httpStatus = 0;
+        DWORD size = sizeof(httpStatus);
+        WinHttpQueryHeaders(request, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER, WINHTTP_HEADER_NAME_BY_INDEX, &httpStatus, &size, WINHTTP_NO_HEADER_INDEX);
+        session->httpStatus = httpStatus;
+        if (httpStatus == 401 && attempt < MaxAuthRetries)
+        {
+            DWORD supported = 0;
+            DWORD first = 0;
+            DWORD target = 0;
+            if (WinHttpQueryAuthSchemes(request, &supported, &first, &target))
+            {
+                scheme = (supported & WINHTTP_AUTH_SCHEME_NEGOTIATE) ? WINHTTP_AUTH_SCHEME_NEGOTIATE
+                    : (supported & WINHTTP_AUTH_SCHEME_NTLM) ? WINHTTP_AUTH_SCHEME_NTLM
+                    : (supported & WINHTTP_AUTH_SCHEME_BASIC) ? WINHTTP_AUTH_SCHEME_BASIC : 0;
+                if (scheme != 0)
+                {
+                    InterlockedExchange(&host->authScheme, (LONG)scheme);
+                    InterlockedIncrement(&m_authChallengeCount);
+
+                    // Drain the challenge so that the connection stays open for the next attempt.
+                    ReadResponse(session, request);
+                    WinHttpCloseHandle(request);
+                    continue;
+                }
+            }
+        }
+
+        wchar_t value[16];
+        size = sizeof(value);
+        session->responseCode = MAPIHTTP_RESPONSE_SUCCESS;
+        if (WinHttpQueryHeaders(request, WINHTTP_QUERY_CUSTOM, L"X-ResponseCode", value, &size, WINHTTP_NO_HEADER_INDEX))
+        {
+            session->responseCode = wcstoul(value, NULL, 10);
+        }
+
+        SaveCookies(session, request);
+        if (session->httpStatus != 200 || session->responseCode != MAPIHTTP_RESPONSE_SUCCESS)
+        {
+            // A failure response has no meta-tags; drain it so that the connection stays open.
+            ReadResponse(session, request);
+            WinHttpCloseHandle(request);
+            return ERROR_WINHTTP_INVALID_SERVER_RESPONSE;
+        }
+
+        *response = request;
+        return 0;
+    }
+}
+
+/// <summary>
+/// Token routine of the parser of a session: keeps X-ElapsedTime, and passes the body to the Execute sink or locates
+/// it in the response buffer.
+/// </summary>
+static long __stdcall ResponseTokenRoutine(void *context, const MAPIHTTP_TOKEN *token)
+{
+    MAPIHTTP_SESSION *session = (MAPIHTTP_SESSION *)context;
+    if (token->Kind == MapiHttpTokenHeader)
+    {
+        if (token->NameSize == 13 && _strnicmp(token->Name, "X-ElapsedTime", 13) == 0)
+        {
+            session->elapsedTime = strtoul(std::string(token->Value, token->ValueSize).c_str(), NULL, 10);
+        }
+    }
+    else if (token->Kind == MapiHttpTokenBody)
+    {
+        if (session->sink != NULL)
+        {
+            session->sink->Consume(token->Data, token->DataSize);
+        }
+        else
+        {
+            // The response buffer is fed in one piece, so the body is contiguous.
+            if (session->body == NULL)
+            {
+                session->body = token->Data;
+            }
+
+            session->bodySize += token->DataSize;
+        }
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Send a request on the session, read the whole response into the buffer of the session and locate its body, as
+/// specified in MS-OXCMAPIHTTP section 2.2.7.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+static long Transact(MAPIHTTP_SESSION *session, const wchar_t *requestType, const BodySegment *segments, unsigned long segmentCount)
+{
+    HINTERNET request = NULL;
+    long status = SendRequest(session, requestType, segments, segmentCount, &request);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    status = ReadResponse(session, request);
+    WinHttpCloseHandle(request);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    MapiHttpParserReset(session->parser);
+    session->sink = NULL;
+    session->body = NULL;
+    session->bodySize = 0;
+    session->elapsedTime = 0;
+    status = MapiHttpParserFeed(session->parser, session->responseSize == 0 ? NULL : &session->response[0], session->responseSize);
+    return status != 0 ? status : MapiHttpParserEnd(session->parser);
+}
+
+/// <summary>
+/// A bounded reader of a response body.
+/// </summary>
+struct BodyReader
+{
+    const unsigned char *data;
+    unsigned long size;
+    unsigned long offset;
+
+    BOOL ReadULong(unsigned long *value)
+    {
+        if (size - offset < 4)
+        {
+            return FALSE;
+        }
+
+        *value = (unsigned long)data[offset] | ((unsigned long)data[offset + 1] << 8) | ((unsigned long)data[offset + 2] << 16) | ((unsigned long)data[offset + 3] << 24);
+        offset += 4;
+        return TRUE;
+    }
+
+    BOOL ReadBytes(unsigned long count, const unsigned char **value)
+    {
+        if (size - offset < count)
+        {
+            return FALSE;
+        }
+
+        *value = data + offset;
+        offset += count;
+        return TRUE;
+    }
+};
+
+static BodyReader GetBody(MAPIHTTP_SESSION *session)
+{
+    BodyReader reader;
+    reader.data = session->body;
+    reader.size = session->bodySize;
+    reader.offset = 0;
+    return reader;
+}
+
+/// <summary>
+/// Read the StatusCode and ErrorCode fields that start every response body. A response whose StatusCode is not 0
+/// carries only AuxiliaryBufferSize and AuxiliaryBuffer after it, as specified in MS-OXCMAPIHTTP section 2.2.2.
+/// </summary>
+/// <returns>The StatusCode if it is not 0, the ErrorCode otherwise.</returns>
+static long ReadStatus(BodyReader *reader, BOOL *succeeded)
+{
+    unsigned long statusCode = 0;
+    unsigned long errorCode = 0;
+    *succeeded = FALSE;
+    if (!reader->ReadULong(&statusCode))
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    if (statusCode != 0)
+    {
+        return (long)statusCode;
+    }
+
+    if (!reader->ReadULong(&errorCode))
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    *succeeded = TRUE;
+    return (long)errorCode;
+}
+
+/// <summary>
+/// Copy the AuxiliaryBufferSize and AuxiliaryBuffer fields of a response body to the caller.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+static long ReadAuxiliary(BodyReader *reader, unsigned char *rgbAuxOut, unsigned long *pcbAuxOut)
+{
+    unsigned long size = 0;
+    const unsigned char *aux = NULL;
+    if (!reader->ReadULong(&size) || !reader->ReadBytes(size, &aux))
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    if (pcbAuxOut == NULL)
+    {
+        return 0;
+    }
+
+    if (size > *pcbAuxOut || (size != 0 && rgbAuxOut == NULL))
+    {
+        return ERROR_INSUFFICIENT_BUFFER;
+    }
+
+    if (size != 0)
+    {
+        memcpy(rgbAuxOut, aux, size);
+    }
+
+    *pcbAuxOut = size;
+    return 0;
+}
+
+/// <summary>
+/// Create a session context on a mailbox endpoint with a MAPI/HTTP Connect request. This is the MAPI/HTTP form of
+/// EcDoConnectEx: the connection of the endpoint is taken from the pool, and the returned session carries its own
+/// cookies.
+/// </summary>
+/// <param name="mailStoreUrl">The mailbox endpoint URL, for example https://server/mapi/emsmdb/?MailboxId=id.</param>
+/// <param name="domain">The domain of the user, or NULL.</param>
+/// <param name="userName">The user name.</param>
+/// <param name="password">The password of the user.</param>
+/// <param name="pcxh">Receives the session.</param>
+/// <param name="szUserDN">The DN of the user who is calling Connect.</param>
+/// <param name="ulFlags">The Flags field of the request.</param>
+/// <param name="ulCpid">The code page of the client.</param>
+/// <param name="ulLcidString">The locale for everything other than sorting.</param>
+/// <param name="ulLcidSort">The locale for sorting.</param>
+/// <param name="pcmsPollsMax">Receives the polling interval in milliseconds, or NULL.</param>
+/// <param name="pcRetry">Receives the number of times to retry a busy server, or NULL.</param>
+/// <param name="pcmsRetryDelay">Receives the time in milliseconds between retries, or NULL.</param>
+/// <param name="szDNPrefix">Receives the DN prefix allocated with midl_user_allocate, or NULL.</param>
+/// <param name="szDisplayName">Receives the display name of the user allocated with midl_user_allocate, or NULL.</param>
+/// <param name="rgbAuxIn">The auxiliary buffer of the request.</param>
+/// <param name="cbAuxIn">The size of rgbAuxIn.</param>
+/// <param name="rgbAuxOut">Receives the auxiliary buffer of the response.</param>
+/// <param name="pcbAuxOut">On input, the size of rgbAuxOut, or NULL to drop the auxiliary buffer. On output, the size of the auxiliary buffer.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long __stdcall MapiHttpConnect(
+    const char *mailStoreUrl,
+    const char *domain,
+    const char *userName,
+    const char *password,
+    MAPIHTTP_SESSION **pcxh,
+    unsigned char *szUserDN,
+    unsigned long ulFlags,
+    unsigned long ulCpid,
+    unsigned long ulLcidString,
+    unsigned long ulLcidSort,
+    unsigned long *pcmsPollsMax,
+    unsigned long *pcRetry,
+    unsigned long *pcmsRetryDelay,
+    unsigned char **szDNPrefix,
+    unsigned char **szDisplayName,
+    unsigned char *rgbAuxIn,
+    unsigned long cbAuxIn,
+    unsigned char *rgbAuxOut,
+    unsigned long *pcbAuxOut)
+{
+    if (mailStoreUrl == NULL || pcxh == NULL || szUserDN == NULL || (cbAuxIn != 0 && rgbAuxIn == NULL))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    *pcxh = NULL;
+    MAPIHTTP_SESSION *session = new MAPIHTTP_SESSION();
+    long status = AcquireHost(mailStoreUrl, domain, userName, password, &session->host, &session->path);
+    if (status != 0)
+    {
+        delete session;
+        return status;
+    }
+
+    MapiHttpParserCreate(0, ResponseTokenRoutine, session, &session->parser);
+
+    UUID uuid;
+    unsigned short *text = NULL;
+    UuidCreate(&uuid);
+    if (UuidToStringW(&uuid, &text) == RPC_S_OK)
+    {
+        session->clientInfo = L'{';
+        session->clientInfo += (const wchar_t *)text;
+        session->clientInfo += L'}';
+        RpcStringFreeW(&text);
+    }
+
+    session->requestCount = 0;
+    session->responseSize = 0;
+    session->sink = NULL;
+    session->body = NULL;
+    session->bodySize = 0;
+    session->elapsedTime = 0;
+    session->httpStatus = 0;
+    session->responseCode = 0;
+
+    unsigned long fields[5];
+    fields[0] = ulFlags;
+    fields[1] = ulCpid;
+    fields[2] = ulLcidSort;
+    fields[3] = ulLcidString;
+    fields[4] = cbAuxIn;
+    BodySegment segments[3];
+    segments[0].data = szUserDN;
+    segments[0].size = (unsigned long)strlen((const char *)szUserDN) + 1;
+    segments[1].data = fields;
+    segments[1].size = sizeof(fields);
+    segments[2].data = rgbAuxIn;
+    segments[2].size = cbAuxIn;
+    status = Transact(session, L"Connect", segments, 3);
+
+    BOOL succeeded = FALSE;
+    BodyReader reader = GetBody(session);
+    if (status == 0)
+    {
+        status = ReadStatus(&reader, &succeeded);
+    }
+
+    unsigned long pollsMax = 0;
+    unsigned long retryCount = 0;
+    unsigned long retryDelay = 0;
+    if (succeeded && !(reader.ReadULong(&pollsMax) && reader.ReadULong(&retryCount) && reader.ReadULong(&retryDelay)))
+    {
+        status = ERROR_INVALID_DATA;
+        succeeded = FALSE;
+    }
+
+    const unsigned char *prefix = NULL;
+    unsigned long prefixSize = 0;
+    const unsigned char *displayName = NULL;
+    unsigned long displayNameSize = 0;
+    if (succeeded)
+    {
+        prefix = reader.data + reader.offset;
+        while (reader.offset < reader.size && reader.data[reader.offset] != 0)
+        {
+            reader.offset++;
+        }
+
+        prefixSize = (unsigned long)(reader.data + reader.offset - prefix);
+        reader.offset++;
+        displayName = reader.data + reader.offset;
+        while (reader.offset + 1 < reader.size && (reader.data[reader.offset] != 0 || reader.data[reader.offset + 1] != 0))
+        {
+            reader.offset += 2;
+        }
+
+        displayNameSize = (unsigned long)(reader.data + reader.offset - displayName);
+        reader.offset += 2;
+        if (reader.offset > reader.size)
+        {
+            status = ERROR_INVALID_DATA;
+            succeeded = FALSE;
+        }
+    }
+
+    if (succeeded)
+    {
+        long auxStatus = ReadAuxiliary(&reader, rgbAuxOut, pcbAuxOut);
+        if (auxStatus != 0)
+        {
+            status = auxStatus;
+        }
+    }
+
+    if (status != 0)
+    {
+        FreeSession(session);
+        return status;
+    }
+
+    if (pcmsPollsMax != NULL)
+    {
+        *pcmsPollsMax = pollsMax;
+    }
+
+    if (pcRetry != NULL)
+    {
+        *pcRetry = retryCount;
+    }
+
+    if (pcmsRetryDelay != NULL)
+    {
+        *pcmsRetryDelay = retryDelay;
+    }
+
+    if (szDNPrefix != NULL)
+    {
+        *szDNPrefix = (unsigned char *)midl_user_allocate(prefixSize + 1);
+        if (*szDNPrefix != NULL)
+        {
+            memcpy(*szDNPrefix, prefix, prefixSize);
+            (*szDNPrefix)[prefixSize] = 0;
+        }
+    }
+
+    if (szDisplayName != NULL)
+    {
+        // EcDoConnectEx returns the display name in the code page of the client; MAPI/HTTP sends it as UTF-16LE.
+        std::wstring name(displayNameSize / 2, L'\0');
+        for (unsigned long i = 0; i < displayNameSize / 2; i++)
+        {
+            name[i] = (wchar_t)(displayName[i * 2] | (displayName[i * 2 + 1] << 8));
+        }
+
+        int length = WideCharToMultiByte(CP_ACP, 0, name.c_str(), -1, NULL, 0, NULL, NULL);
+        *szDisplayName = (unsigned char *)midl_user_allocate(length);
+        if (*szDisplayName != NULL)
+        {
+            WideCharToMultiByte(CP_ACP, 0, name.c_str(), -1, (char *)*szDisplayName, length, NULL, NULL);
+        }
+    }
+
+    InterlockedIncrement(&m_sessionCount);
+    *pcxh = session;
+    return 0;
+}
+
+/// <summary>
+/// Send ROP requests on a session with a MAPI/HTTP Execute request. This is the MAPI/HTTP form of EcDoRpcExt2:
+/// rgbIn and rgbOut hold an RPC_HEADER_EXT followed by its payload, exactly as for EcDoRpcExt2.
+/// </summary>
+/// <param name="pcxh">The session returned by MapiHttpConnect.</param>
+/// <param name="pulFlags">On input, the Flags field of the request. On output, the Flags field of the response.</param>
+/// <param name="rgbIn">The ROP request buffer; it is written to the connection without being copied.</param>
+/// <param name="cbIn">The size of rgbIn.</param>
+/// <param name="rgbOut">Receives the ROP response buffer.</param>
+/// <param name="pcbOut">On input, the size of rgbOut, sent as MaxRopOut. On output, the size of the ROP response buffer.</param>
+/// <param name="rgbAuxIn">The auxiliary buffer of the request.</param>
+/// <param name="cbAuxIn">The size of rgbAuxIn.</param>
+/// <param name="rgbAuxOut">Receives the auxiliary buffer of the response.</param>
+/// <param name="pcbAuxOut">On input, the size of rgbAuxOut, or NULL to drop the auxiliary buffer. On output, the size of the auxiliary buffer.</param>
+/// <param name="pulTransTime">Receives the X-ElapsedTime of the response in milliseconds, or NULL.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long __stdcall MapiHttpExecute(
+    MAPIHTTP_SESSION **pcxh,
+    unsigned long *pulFlags,
+    unsigned char *rgbIn,
+    unsigned long cbIn,
+    unsigned char *rgbOut,
+    unsigned long *pcbOut,
+    unsigned char *rgbAuxIn,
+    unsigned long cbAuxIn,
+    unsigned char *rgbAuxOut,
+    unsigned long *pcbAuxOut,
+    unsigned long *pulTransTime)
+{
+    return MapiHttpExecuteEx(pcxh, pulFlags, rgbIn, cbIn, rgbOut, pcbOut, rgbAuxIn, cbAuxIn, rgbAuxOut, pcbAuxOut, pulTransTime, NULL, NULL);
+}
+
+/// <summary>
+/// Send ROP requests on a session with a MAPI/HTTP Execute request, like MapiHttpExecute, and pass each
+/// RPC_HEADER_EXT buffer of the response to a routine as soon as it has arrived. The response is parsed as it arrives
+/// and its RopBuffer is read straight into rgbOut, so a chained response can be decoded while its later buffers are
+/// still being received.
+/// </summary>
+/// <param name="routine">The routine invoked on the calling thread for each buffer of a response whose ErrorCode is 0, or NULL.</param>
+/// <param name="context">The caller context passed to the routine.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long __stdcall MapiHttpExecuteEx(
+    MAPIHTTP_SESSION **pcxh,
+    unsigned long *pulFlags,
+    unsigned char *rgbIn,
+    unsigned long cbIn,
+    unsigned char *rgbOut,
+    unsigned long *pcbOut,
+    unsigned char *rgbAuxIn,
+    unsigned long cbAuxIn,
+    unsigned char *rgbAuxOut,
+    unsigned long *pcbAuxOut,
+    unsigned long *pulTransTime,
+    MAPIHTTP_BUFFER_ROUTINE routine,
+    void *context)
+{
+    if (pcxh == NULL || *pcxh == NULL || pulFlags == NULL || rgbIn == NULL || rgbOut == NULL || pcbOut == NULL || (cbAuxIn != 0 && rgbAuxIn == NULL))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    MAPIHTTP_SESSION *session = *pcxh;
+    unsigned long header[2];
+    header[0] = *pulFlags;
+    header[1] = cbIn;
+    unsigned long trailer[2];
+    trailer[0] = *pcbOut;
+    trailer[1] = cbAuxIn;
+    BodySegment segments[4];
+    segments[0].data = header;
+    segments[0].size = sizeof(header);
+    segments[1].data = rgbIn;
+    segments[1].size = cbIn;
+    segments[2].data = trailer;
+    segments[2].size = sizeof(trailer);
+    segments[3].data = rgbAuxIn;
+    segments[3].size = cbAuxIn;
+    HINTERNET request = NULL;
+    long status = SendRequest(session, L"Execute", segments, 4, &request);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    ExecuteSink sink;
+    memset(&sink, 0, sizeof(sink));
+    sink.phase = ExecutePhaseFields;
+    sink.rgbOut = rgbOut;
+    sink.cbOut = *pcbOut;
+    sink.rgbAuxOut = rgbAuxOut;
+    sink.cbAuxOut = pcbAuxOut != NULL && rgbAuxOut != NULL ? *pcbAuxOut : 0;
+    sink.routine = routine;
+    sink.context = context;
+
+    MapiHttpParserReset(session->parser);
+    session->sink = &sink;
+    session->elapsedTime = 0;
+    if (session->response.size() < PreludeReadSize)
+    {
+        session->response.resize(InitialResponseSize);
+    }
+
+    unsigned long received = 0;
+    for (;;)
+    {
+        // Once the parser is in the body, read each part of it where it belongs; the parser then passes the same
+        // bytes to the sink, which sees that they are already in place.
+        unsigned char *destination = NULL;
+        unsigned long size = 0;
+        if (MapiHttpParserGetState(session->parser) != MapiHttpParserBody || !sink.Window(&destination, &size))
+        {
+            destination = &session->response[0];
+            size = sink.phase == ExecutePhaseDiscard ? (unsigned long)session->response.size() : PreludeReadSize;
+        }
+
+        DWORD read = 0;
+        if (!WinHttpReadData(request, destination, size, &read))
+        {
+            status = (long)GetLastError();
+            break;
+        }
+
+        if (read == 0)
+        {
+            break;
+        }
+
+        received += read;
+        status = MapiHttpParserFeed(session->parser, destination, read);
+        if (status != 0)
+        {
+            break;
+        }
+    }
+
+    session->sink = NULL;
+    WinHttpCloseHandle(request);
+    InterlockedExchangeAdd64(&m_bytesReceived, received);
+    if (status == 0)
+    {
+        status = MapiHttpParserEnd(session->parser);
+    }
+
+    if (status != 0)
+    {
+        return status;
+    }
+
+    if (sink.fieldsSize < 4)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    if (ExecuteSink::ToULong(sink.fields) != 0)
+    {
+        return (long)ExecuteSink::ToULong(sink.fields);
+    }
+
+    if (sink.status != 0)
+    {
+        return sink.status;
+    }
+
+    if (sink.phase != ExecutePhaseDiscard || sink.fieldsSize != sizeof(sink.fields))
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    *pcbOut = sink.ropSize;
+    *pulFlags = ExecuteSink::ToULong(sink.fields + 8);
+    if (pcbAuxOut != NULL)
+    {
+        *pcbAuxOut = sink.cbAuxOut != 0 ? sink.auxSize : 0;
+    }
+
+    if (pulTransTime != NULL)
+    {
+        *pulTransTime = session->elapsedTime;
+    }
+
+    return (long)ExecuteSink::ToULong(sink.fields + 4);
+}
+
+/// <summary>
+/// Wait for a pending event on a session with a MAPI/HTTP NotificationWait request. This is the MAPI/HTTP form of
+/// EcDoAsyncWaitEx; the server holds the request open, sending PENDING lines, until an event is pending or its
+/// timeout passes.
+/// </summary>
+/// <param name="session">The session returned by MapiHttpConnect.</param>
+/// <param name="ulFlagsIn">The Flags field of the request; it has to be 0.</param>
+/// <param name="pulFlagsOut">Receives 0x00000001 (NotificationPending) if an event is pending, 0 otherwise.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long __stdcall MapiHttpNotificationWait(MAPIHTTP_SESSION *session, unsigned long ulFlagsIn, unsigned long *pulFlagsOut)
+{
+    if (session == NULL || pulFlagsOut == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    unsigned long fields[2];
+    fields[0] = ulFlagsIn;
+    fields[1] = 0;
+    BodySegment segment;
+    segment.data = fields;
+    segment.size = sizeof(fields);
+    long status = Transact(session, L"NotificationWait", &segment, 1);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    BOOL succeeded = FALSE;
+    BodyReader reader = GetBody(session);
+    status = ReadStatus(&reader, &succeeded);
+    if (!succeeded)
+    {
+        return status;
+    }
+
+    unsigned long eventPending = 0;
+    if (!reader.ReadULong(&eventPending))
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    *pulFlagsOut = eventPending != 0 ? 0x00000001 : 0;
+    return status;
+}
+
+/// <summary>
+/// Destroy the session context of a session with a MAPI/HTTP Disconnect request, and free the session. The pooled
+/// connection of its endpoint stays open for later sessions.
+/// </summary>
+/// <param name="pcxh">The session returned by MapiHttpConnect; it is set to NULL.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long __stdcall MapiHttpDisconnect(MAPIHTTP_SESSION **pcxh)
+{
+    if (pcxh == NULL || *pcxh == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    MAPIHTTP_SESSION *session = *pcxh;
+    *pcxh = NULL;
+    long status = 0;
+    if (!session->cookies.empty())
+    {
+        unsigned long auxSize = 0;
+        BodySegment segment;
+        segment.data = &auxSize;
+        segment.size = sizeof(auxSize);
+        status = Transact(session, L"Disconnect", &segment, 1);
+        if (status == 0)
+        {
+            BOOL succeeded = FALSE;
+            BodyReader reader = GetBody(session);
+            status = ReadStatus(&reader, &succeeded);
+        }
+    }
+
+    FreeSession(session);
+    InterlockedDecrement(&m_sessionCount);
+    return status;
+}
+
+/// <summary>
+/// Get the HTTP status and the X-ResponseCode header of the last response of a session, to tell apart the failures
+/// that a call returns as ERROR_WINHTTP_INVALID_SERVER_RESPONSE.
+/// </summary>
+/// <param name="session">The session returned by MapiHttpConnect.</param>
+/// <param name="httpStatus">Receives the HTTP status code, or NULL.</param>
+/// <param name="responseCode">Receives one of the MAPIHTTP_RESPONSE values, or NULL.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long __stdcall MapiHttpGetLastResponse(MAPIHTTP_SESSION *session, unsigned long *httpStatus, unsigned long *responseCode)
+{
+    if (session == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (httpStatus != NULL)
+    {
+        *httpStatus = session->httpStatus;
+    }
+
+    if (responseCode != NULL)
+    {
+        *responseCode = session->responseCode;
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Close the pooled connections of the hosts that no session uses. Hosts still in use are removed from the pool and
+/// closed when their last session disconnects.
+/// </summary>
+void __stdcall MapiHttpPoolFlush()
+{
+    AcquireSRWLockExclusive(&m_hostsLock);
+    std::map<std::wstring, MapiHttpHost *> hosts;
+    hosts.swap(m_hosts);
+    ReleaseSRWLockExclusive(&m_hostsLock);
+
+    for (std::map<std::wstring, MapiHttpHost *>::iterator it = hosts.begin(); it != hosts.end(); ++it)
+    {
+        ReleaseHost(it->second);
+    }
+}
+
+/// <summary>
+/// Get the counters of the MAPI/HTTP connection pool.
+/// </summary>
+/// <param name="stats">Receives the counters.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long __stdcall MapiHttpGetPoolStats(MAPIHTTP_POOL_STATS *stats)
+{
+    if (stats == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    AcquireSRWLockShared(&m_hostsLock);
+    stats->HostCount = (unsigned long)m_hosts.size();
+    ReleaseSRWLockShared(&m_hostsLock);
+    stats->SessionCount = (unsigned long)m_sessionCount;
+    stats->RequestCount = (unsigned long)m_requestCount;
+    stats->AuthChallengeCount = (unsigned long)m_authChallengeCount;
+    stats->BytesSent = (unsigned __int64)m_bytesSent;
+    stats->BytesReceived = (unsigned __int64)m_bytesReceived;
+    return 0;
+}
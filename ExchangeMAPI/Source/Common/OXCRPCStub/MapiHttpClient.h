@@ -0,0 +1,109 @@
+#pragma once
+
+#include "MS-OXCRPC.h"
+
+/// <summary>
+/// The X-ResponseCode values of a MAPI/HTTP response, as specified in MS-OXCMAPIHTTP section 2.2.3.3.3.
+/// </summary>
+#define MAPIHTTP_RESPONSE_SUCCESS                   0
+#define MAPIHTTP_RESPONSE_UNKNOWN_FAILURE           1
+#define MAPIHTTP_RESPONSE_INVALID_VERB              2
+#define MAPIHTTP_RESPONSE_INVALID_PATH              3
+#define MAPIHTTP_RESPONSE_INVALID_HEADER            4
+#define MAPIHTTP_RESPONSE_INVALID_REQUEST_TYPE      5
+#define MAPIHTTP_RESPONSE_INVALID_CONTEXT_COOKIE    6
+#define MAPIHTTP_RESPONSE_MISSING_HEADER            7
+#define MAPIHTTP_RESPONSE_ANONYMOUS_NOT_ALLOWED     8
+#define MAPIHTTP_RESPONSE_TOO_LARGE                 9
+#define MAPIHTTP_RESPONSE_CONTEXT_NOT_FOUND         10
+#define MAPIHTTP_RESPONSE_NO_PRIVILEGE              11
+#define MAPIHTTP_RESPONSE_INVALID_REQUEST_BODY      12
+#define MAPIHTTP_RESPONSE_MISSING_COOKIE            13
+#define MAPIHTTP_RESPONSE_RESERVED                  14
+#define MAPIHTTP_RESPONSE_INVALID_SEQUENCE          15
+#define MAPIHTTP_RESPONSE_ENDPOINT_DISABLED         16
+#define MAPIHTTP_RESPONSE_INVALID_RESPONSE          17
+#define MAPIHTTP_RESPONSE_ENDPOINT_SHUTTING_DOWN    18
+
+/// <summary>
+/// The counters of the MAPI/HTTP connection pool, summed over all hosts.
+/// </summary>
+typedef struct _MAPIHTTP_POOL_STATS
+{
+    unsigned long HostCount;            // Pooled hosts, each with its own keep-alive connections.
+    unsigned long SessionCount;         // Sessions connected and not yet disconnected.
+    unsigned long RequestCount;         // HTTP requests sent, including the ones repeated for authentication.
+    unsigned long AuthChallengeCount;   // 401 responses that made a request be sent again.
+    unsigned __int64 BytesSent;         // Request body bytes.
+    unsigned __int64 BytesReceived;     // Response body bytes.
+} MAPIHTTP_POOL_STATS;
+
+/// <summary>
+/// Routine invoked by MapiHttpExecuteEx as soon as an RPC_HEADER_EXT buffer of the ROP response has arrived completely,
+/// while the rest of the response is still being received. The buffer can be read with RopResponseBegin.
+/// </summary>
+/// <param name="context">The caller context passed to MapiHttpExecuteEx.</param>
+/// <param name="buffer">The RPC_HEADER_EXT and its payload, in rgbOut.</param>
+/// <param name="size">The size of the RPC_HEADER_EXT and its payload.</param>
+typedef void (__stdcall *MAPIHTTP_BUFFER_ROUTINE)(void *context, unsigned char *buffer, unsigned long size);
+
+typedef struct _MAPIHTTP_SESSION MAPIHTTP_SESSION;
+
+long __stdcall MapiHttpConnect(
+    const char *mailStoreUrl,
+    const char *domain,
+    const char *userName,
+    const char *password,
+    MAPIHTTP_SESSION **pcxh,
+    unsigned char *szUserDN,
+    unsigned long ulFlags,
+    unsigned long ulCpid,
+    unsigned long ulLcidString,
+    unsigned long ulLcidSort,
+    unsigned long *pcmsPollsMax,
+    unsigned long *pcRetry,
+    unsigned long *pcmsRetryDelay,
+    unsigned char **szDNPrefix,
+    unsigned char **szDisplayName,
+    unsigned char *rgbAuxIn,
+    unsigned long cbAuxIn,
+    unsigned char *rgbAuxOut,
+    unsigned long *pcbAuxOut);
+
+long __stdcall MapiHttpExecute(
+    MAPIHTTP_SESSION **pcxh,
+    unsigned long *pulFlags,
+    unsigned char *rgbIn,
+    unsigned long cbIn,
+    unsigned char *rgbOut,
+    unsigned long *pcbOut,
+    unsigned char *rgbAuxIn,
+    unsigned long cbAuxIn,
+    unsigned char *rgbAuxOut,
+    unsigned long *pcbAuxOut,
+    unsigned long *pulTransTime);
+
+long __stdcall MapiHttpExecuteEx(
+    MAPIHTTP_SESSION **pcxh,
+    unsigned long *pulFlags,
+    unsigned char *rgbIn,
+    unsigned long cbIn,
+    unsigned char *rgbOut,
+    unsigned long *pcbOut,
+    unsigned char *rgbAuxIn,
+    unsigned long cbAuxIn,
+    unsigned char *rgbAuxOut,
+    unsigned long *pcbAuxOut,
+    unsigned long *pulTransTime,
+    MAPIHTTP_BUFFER_ROUTINE routine,
+    void *context);
+
+long __stdcall MapiHttpNotificationWait(MAPIHTTP_SESSION *session, unsigned long ulFlagsIn, unsigned long *pulFlagsOut);
+
+long __stdcall MapiHttpDisconnect(MAPIHTTP_SESSION **pcxh);
+
+long __stdcall MapiHttpGetLastResponse(MAPIHTTP_SESSION *session, unsigned long *httpStatus, unsigned long *responseCode);
+
+void __stdcall MapiHttpPoolFlush();
+
+long __stdcall MapiHttpGetPoolStats(MAPIHTTP_POOL_STATS *stats);
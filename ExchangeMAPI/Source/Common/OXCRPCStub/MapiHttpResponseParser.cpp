@@ -0,0 +1,384 @@
+#include "MapiHttpResponseParser.h"
+
+// A resumable parser for MAPI/HTTP response bodies. The server keeps a request alive by sending PROCESSING and
+// PENDING lines before DONE, then a few additional headers and the response body, all in HTTP/1.1 chunks of any size.
+// The parser takes the bytes as they arrive and reports each meta-tag and header as soon as its line is complete, so
+// the caller sees DONE without waiting for the body. Body bytes are passed to the token routine pointing into the
+// fed buffer, so a caller that reads the body straight into its own buffer and feeds that buffer gets no copy at all.
+// Only a line that is split across two feeds is gathered, in a buffer of MAPIHTTP_PARSER_MAX_LINE bytes.
+
+enum MapiHttpChunkState
+{
+    ChunkStateSize,             // The hexadecimal chunk size.
+    ChunkStateExtension,        // A chunk extension after the size, up to the end of the line.
+    ChunkStateData,             // The data of a chunk.
+    ChunkStateDataEnd,          // The CRLF after the data of a chunk.
+    ChunkStateTrailer,          // The trailer after the last chunk, up to an empty line.
+    ChunkStateComplete,         // The empty line after the last chunk was read.
+    ChunkStateFailed
+};
+
+struct _MAPIHTTP_PARSER
+{
+    MAPIHTTP_TOKEN_ROUTINE routine;
+    void *context;
+    unsigned long flags;
+    MAPIHTTP_PARSER_STATE state;
+    MapiHttpChunkState chunkState;
+    unsigned long chunkRemaining;
+    unsigned long chunkDigits;
+    unsigned long trailerLineSize;
+    unsigned __int64 bodySize;
+    long failure;
+    unsigned long lineSize;
+    char line[MAPIHTTP_PARSER_MAX_LINE];
+};
+
+/// <summary>
+/// Report a complete meta-tag or additional header line, without its CRLF.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+static long ParseLine(MAPIHTTP_PARSER *parser, const char *line, unsigned long size)
+{
+    MAPIHTTP_TOKEN token;
+    memset(&token, 0, sizeof(token));
+    if (parser->state == MapiHttpParserMetaTags)
+    {
+        if ((size == 10 && _strnicmp(line, "PROCESSING", 10) == 0) || (size == 7 && _strnicmp(line, "PENDING", 7) == 0))
+        {
+            token.Kind = MapiHttpTokenMetaTag;
+        }
+        else if (size == 4 && _strnicmp(line, "DONE", 4) == 0)
+        {
+            token.Kind = MapiHttpTokenMetaTag;
+            parser->state = MapiHttpParserHeaders;
+        }
+        else
+        {
+            return ERROR_INVALID_DATA;
+        }
+
+        token.Name = line;
+        token.NameSize = size;
+        return parser->routine(parser->context, &token);
+    }
+
+    if (size == 0)
+    {
+        parser->state = MapiHttpParserBody;
+        return 0;
+    }
+
+    const char *colon = (const char *)memchr(line, ':', size);
+    if (colon == NULL || colon == line)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    const char *value = colon + 1;
+    const char *end = line + size;
+    while (value < end && (*value == ' ' || *value == '\t'))
+    {
+        value++;
+    }
+
+    while (end > value && (end[-1] == ' ' || end[-1] == '\t'))
+    {
+        end--;
+    }
+
+    token.Kind = MapiHttpTokenHeader;
+    token.Name = line;
+    token.NameSize = (unsigned long)(colon - line);
+    token.Value = value;
+    token.ValueSize = (unsigned long)(end - value);
+    return parser->routine(parser->context, &token);
+}
+
+/// <summary>
+/// Parse bytes of the response body once the chunk framing is removed.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+static long ParseContent(MAPIHTTP_PARSER *parser, const unsigned char *data, unsigned long size)
+{
+    long status = 0;
+    while (status == 0 && size != 0)
+    {
+        if (parser->state == MapiHttpParserBody)
+        {
+            MAPIHTTP_TOKEN token;
+            memset(&token, 0, sizeof(token));
+            token.Kind = MapiHttpTokenBody;
+            token.Data = data;
+            token.DataSize = size;
+            token.BodyOffset = parser->bodySize;
+            parser->bodySize += size;
+            return parser->routine(parser->context, &token);
+        }
+
+        const unsigned char *newLine = (const unsigned char *)memchr(data, '\n', size);
+        unsigned long take = newLine == NULL ? size : (unsigned long)(newLine - data) + 1;
+        if (newLine != NULL && parser->lineSize == 0)
+        {
+            // The whole line is in the fed buffer; parse it in place.
+            unsigned long lineSize = take - 1;
+            if (lineSize != 0 && data[lineSize - 1] == '\r')
+            {
+                lineSize--;
+            }
+
+            status = ParseLine(parser, (const char *)data, lineSize);
+        }
+        else
+        {
+            if (parser->lineSize + take > MAPIHTTP_PARSER_MAX_LINE)
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            memcpy(parser->line + parser->lineSize, data, take);
+            parser->lineSize += take;
+            if (newLine != NULL)
+            {
+                unsigned long lineSize = parser->lineSize - 1;
+                if (lineSize != 0 && parser->line[lineSize - 1] == '\r')
+                {
+                    lineSize--;
+                }
+
+                parser->lineSize = 0;
+                status = ParseLine(parser, parser->line, lineSize);
+            }
+        }
+
+        data += take;
+        size -= take;
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Remove the chunk framing of MAPIHTTP_PARSER_CHUNKED input and parse the chunk data.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+static long ParseChunked(MAPIHTTP_PARSER *parser, const unsigned char *data, unsigned long size)
+{
+    long status = 0;
+    while (status == 0 && size != 0)
+    {
+        unsigned char value = *data;
+        switch (parser->chunkState)
+        {
+        case ChunkStateSize:
+        case ChunkStateExtension:
+            if (value == '\n')
+            {
+                if (parser->chunkDigits == 0)
+                {
+                    return ERROR_INVALID_DATA;
+                }
+
+                parser->chunkDigits = 0;
+                parser->chunkState = parser->chunkRemaining == 0 ? ChunkStateTrailer : ChunkStateData;
+                parser->trailerLineSize = 0;
+            }
+            else if (parser->chunkState == ChunkStateExtension || value == '\r')
+            {
+            }
+            else if (value == ';' || value == ' ' || value == '\t')
+            {
+                parser->chunkState = ChunkStateExtension;
+            }
+            else
+            {
+                unsigned long digit = value >= '0' && value <= '9' ? value - '0'
+                    : value >= 'a' && value <= 'f' ? value - 'a' + 10
+                    : value >= 'A' && value <= 'F' ? value - 'A' + 10 : 16;
+                if (digit == 16 || parser->chunkDigits == 8)
+                {
+                    return ERROR_INVALID_DATA;
+                }
+
+                parser->chunkRemaining = parser->chunkRemaining * 16 + digit;
+                parser->chunkDigits++;
+            }
+
+            data++;
+            size--;
+            break;
+
+        case ChunkStateData:
+            {
+                unsigned long take = size < parser->chunkRemaining ? size : parser->chunkRemaining;
+                status = ParseContent(parser, data, take);
+                parser->chunkRemaining -= take;
+                if (parser->chunkRemaining == 0)
+                {
+                    parser->chunkState = ChunkStateDataEnd;
+                }
+
+                data += take;
+                size -= take;
+            }
+            break;
+
+        case ChunkStateDataEnd:
+            if (value == '\n')
+            {
+                parser->chunkState = ChunkStateSize;
+            }
+            else if (value != '\r')
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            data++;
+            size--;
+            break;
+
+        case ChunkStateTrailer:
+            if (value == '\n')
+            {
+                if (parser->trailerLineSize == 0)
+                {
+                    parser->chunkState = ChunkStateComplete;
+                }
+
+                parser->trailerLineSize = 0;
+            }
+            else if (value != '\r')
+            {
+                parser->trailerLineSize++;
+            }
+
+            data++;
+            size--;
+            break;
+
+        default:
+            return ERROR_INVALID_DATA;
+        }
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Create a parser for one response at a time.
+/// </summary>
+/// <param name="flags">0, or MAPIHTTP_PARSER_CHUNKED if the fed bytes still carry the chunk framing.</param>
+/// <param name="routine">The routine invoked for every token.</param>
+/// <param name="context">The caller context passed to the routine.</param>
+/// <param name="parser">Receives the parser; release it with MapiHttpParserDestroy.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall MapiHttpParserCreate(unsigned long flags, MAPIHTTP_TOKEN_ROUTINE routine, void *context, MAPIHTTP_PARSER **parser)
+{
+    if (routine == NULL || parser == NULL || (flags & ~MAPIHTTP_PARSER_CHUNKED) != 0)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    MAPIHTTP_PARSER *created = new MAPIHTTP_PARSER();
+    created->routine = routine;
+    created->context = context;
+    created->flags = flags;
+    MapiHttpParserReset(created);
+    *parser = created;
+    return 0;
+}
+
+void __stdcall MapiHttpParserDestroy(MAPIHTTP_PARSER *parser)
+{
+    delete parser;
+}
+
+/// <summary>
+/// Prepare the parser for the next response, keeping its routine and flags.
+/// </summary>
+void __stdcall MapiHttpParserReset(MAPIHTTP_PARSER *parser)
+{
+    if (parser == NULL)
+    {
+        return;
+    }
+
+    parser->state = MapiHttpParserMetaTags;
+    parser->chunkState = ChunkStateSize;
+    parser->chunkRemaining = 0;
+    parser->chunkDigits = 0;
+    parser->trailerLineSize = 0;
+    parser->bodySize = 0;
+    parser->failure = 0;
+    parser->lineSize = 0;
+}
+
+/// <summary>
+/// Parse the next bytes of the response as they arrive. Tokens are passed to the routine before it returns.
+/// </summary>
+/// <param name="parser">The parser.</param>
+/// <param name="data">The next bytes of the response.</param>
+/// <param name="size">The number of bytes.</param>
+/// <returns>If success, it returns 0. ERROR_INVALID_DATA indicates a malformed response; a value returned by the routine stops parsing and is returned.</returns>
+long __stdcall MapiHttpParserFeed(MAPIHTTP_PARSER *parser, const unsigned char *data, unsigned long size)
+{
+    if (parser == NULL || (data == NULL && size != 0))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (parser->failure != 0)
+    {
+        return parser->failure;
+    }
+
+    long status = (parser->flags & MAPIHTTP_PARSER_CHUNKED) != 0 ? ParseChunked(parser, data, size) : ParseContent(parser, data, size);
+    if (status != 0)
+    {
+        parser->failure = status;
+        parser->chunkState = ChunkStateFailed;
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Check that the whole response was fed.
+/// </summary>
+/// <returns>If success, it returns 0. ERROR_HANDLE_EOF indicates the response ended before its body, or before its last chunk.</returns>
+long __stdcall MapiHttpParserEnd(MAPIHTTP_PARSER *parser)
+{
+    if (parser == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (parser->failure != 0)
+    {
+        return parser->failure;
+    }
+
+    if (parser->state != MapiHttpParserBody || ((parser->flags & MAPIHTTP_PARSER_CHUNKED) != 0 && parser->chunkState != ChunkStateComplete))
+    {
+        return ERROR_HANDLE_EOF;
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Return the part of the response the parser is in. Once it is MapiHttpParserBody and the input has no chunk
+/// framing, the caller can read the rest of the response straight into the buffer it is meant for and feed it from there.
+/// </summary>
+MAPIHTTP_PARSER_STATE __stdcall MapiHttpParserGetState(MAPIHTTP_PARSER *parser)
+{
+    return parser == NULL ? MapiHttpParserMetaTags : parser->state;
+}
+
+/// <summary>
+/// Return the number of body bytes parsed so far.
+/// </summary>
+unsigned __int64 __stdcall MapiHttpParserGetBodySize(MAPIHTTP_PARSER *parser)
+{
+    return parser == NULL ? 0 : parser->bodySize;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "MS-OXCRPC.h"
+
+/// <summary>
+/// The fed bytes still carry the HTTP/1.1 chunked transfer coding, for transports that do not remove it.
+/// </summary>
+#define MAPIHTTP_PARSER_CHUNKED 0x00000001
+
+/// <summary>
+/// The longest meta-tag, additional header or chunk size line the parser accepts.
+/// </summary>
+#define MAPIHTTP_PARSER_MAX_LINE 1024
+
+/// <summary>
+/// The part of a MAPI/HTTP response body the parser is in, as specified in MS-OXCMAPIHTTP section 2.2.7.
+/// </summary>
+typedef enum _MAPIHTTP_PARSER_STATE
+{
+    MapiHttpParserMetaTags = 0,     // PROCESSING and PENDING lines, up to and including DONE.
+    MapiHttpParserHeaders = 1,      // The additional headers after DONE, up to the empty line.
+    MapiHttpParserBody = 2          // The response body of the request type.
+} MAPIHTTP_PARSER_STATE;
+
+/// <summary>
+/// The kind of a token passed to the token routine.
+/// </summary>
+typedef enum _MAPIHTTP_TOKEN_KIND
+{
+    MapiHttpTokenMetaTag = 0,       // PROCESSING, PENDING or DONE; Name holds it.
+    MapiHttpTokenHeader = 1,        // An additional header; Name and Value hold it, without the colon and the spaces around the value.
+    MapiHttpTokenBody = 2           // Bytes of the response body; Data points into the buffer passed to MapiHttpParserFeed.
+} MAPIHTTP_TOKEN_KIND;
+
+/// <summary>
+/// A token passed to the token routine. Pointers are valid only during the call, and strings are not null-terminated.
+/// </summary>
+typedef struct _MAPIHTTP_TOKEN
+{
+    MAPIHTTP_TOKEN_KIND Kind;
+    const char *Name;
+    unsigned long NameSize;
+    const char *Value;
+    unsigned long ValueSize;
+    const unsigned char *Data;
+    unsigned long DataSize;
+    unsigned __int64 BodyOffset;    // The offset of Data within the response body.
+} MAPIHTTP_TOKEN;
+
+/// <summary>
+/// Routine invoked for every token, in stream order.
+/// </summary>
+/// <param name="context">The caller context passed to MapiHttpParserCreate.</param>
+/// <param name="token">The token.</param>
+/// <returns>0 to continue; any other value stops parsing and is returned by MapiHttpParserFeed.</returns>
+typedef long (__stdcall *MAPIHTTP_TOKEN_ROUTINE)(void *context, const MAPIHTTP_TOKEN *token);
+
+typedef struct _MAPIHTTP_PARSER MAPIHTTP_PARSER;
+
+long __stdcall MapiHttpParserCreate(unsigned long flags, MAPIHTTP_TOKEN_ROUTINE routine, void *context, MAPIHTTP_PARSER **parser);
+
+void __stdcall MapiHttpParserDestroy(MAPIHTTP_PARSER *parser);
+
+void __stdcall MapiHttpParserReset(MAPIHTTP_PARSER *parser);
+
+long __stdcall MapiHttpParserFeed(MAPIHTTP_PARSER *parser, const unsigned char *data, unsigned long size);
+
+long __stdcall MapiHttpParserEnd(MAPIHTTP_PARSER *parser);
+
+MAPIHTTP_PARSER_STATE __stdcall MapiHttpParserGetState(MAPIHTTP_PARSER *parser);
+
+unsigned __int64 __stdcall MapiHttpParserGetBodySize(MAPIHTTP_PARSER *parser);
@@ -0,0 +1,681 @@
+#include "MapiSession.h"
+#include "MapiHttpClient.h"
+#include "RpcHeaderExt.h"
+#include "TracedCalls.h"
+#include "RpcException.h"
+#include "RpcExt2Flags.h"
+#include <winhttp.h>
+#include <vector>
+
+// A session with the same connect, execute, wait and disconnect calls whichever transport carries it. The transport
+// is a table of backend routines: one over the EMSMDB stub and one over the native MAPI/HTTP client, or one of the
+// caller. Everything above the backend is shared: the response buffers come from one process-wide pool, request
+// buffers are compressed and obfuscated and response buffers revealed by the same code, a request the server did not
+// run is retried under one policy, and the counters are kept the same way. A session is used by one thread at a time.
+
+/// <summary>
+/// The retry policy of MapiSessionConnect, and of a session whose server returned no retry values.
+/// </summary>
+static const unsigned long DefaultRetries = 3;
+static const unsigned long DefaultRetryDelay = 1000;
+
+/// <summary>
+/// The number of free buffers the pool keeps; buffers released beyond it are freed.
+/// </summary>
+static const unsigned short MaxIdleBuffers = 64;
+
+/// <summary>
+/// The size of the rgbAuxOut buffer of a session, the largest an EcDoRpcExt2 call can return.
+/// </summary>
+static const unsigned long AuxOutSize = 0x1008;
+
+/// <summary>
+/// The session context of the RPC backend.
+/// </summary>
+struct RpcBackendContext
+{
+    CXH cxh;
+    ACXH acxh;                          // Created by the first NotificationWait.
+};
+
+/// <summary>
+/// A buffer of MAPI_SESSION_BUFFER_SIZE bytes in the pool.
+/// </summary>
+struct PooledBuffer
+{
+    SLIST_ENTRY entry;                  // The link in the pool; it MUST be the first member.
+    unsigned char data[MAPI_SESSION_BUFFER_SIZE];
+};
+
+struct _MAPI_SESSION
+{
+    const MAPI_SESSION_BACKEND *backend;
+    void *context;
+    unsigned long flags;
+    unsigned long maxRetries;
+    unsigned long retryDelay;
+    PooledBuffer *response;             // The rgbOut of the backend.
+    PooledBuffer *scratch;              // The packed request, then the expanded response; acquired on first use.
+    std::vector<unsigned char> expanded;    // An expanded response that does not fit in a pooled buffer.
+    unsigned char auxOut[AuxOutSize];
+    MAPI_SESSION_STATS stats;
+};
+
+long __stdcall EcDoAsyncWaitExWrap(ACXH acxh, unsigned long ulFlagsIn, unsigned long waitSecondThreshold, BOOL makeEvent, unsigned long *pulFlagsOut);
+handle_t __stdcall GetBindHandle();
+
+static PSLIST_HEADER CreateBufferPool()
+{
+    PSLIST_HEADER pool = (PSLIST_HEADER)_aligned_malloc(sizeof(SLIST_HEADER), MEMORY_ALLOCATION_ALIGNMENT);
+    if (pool != NULL)
+    {
+        InitializeSListHead(pool);
+    }
+
+    return pool;
+}
+
+static PSLIST_HEADER m_bufferPool = CreateBufferPool();
+static MAPI_SESSION_STATS m_totals;
+static SRWLOCK m_totalsLock = SRWLOCK_INIT;
+static LARGE_INTEGER m_frequency;
+
+static PooledBuffer *AcquireBuffer()
+{
+    PooledBuffer *buffer = m_bufferPool == NULL ? NULL : (PooledBuffer *)InterlockedPopEntrySList(m_bufferPool);
+    if (buffer == NULL)
+    {
+        buffer = (PooledBuffer *)_aligned_malloc(sizeof(PooledBuffer), MEMORY_ALLOCATION_ALIGNMENT);
+        if (buffer != NULL)
+        {
+            AcquireSRWLockExclusive(&m_totalsLock);
+            m_totals.BufferAllocationCount++;
+            ReleaseSRWLockExclusive(&m_totalsLock);
+        }
+    }
+
+    return buffer;
+}
+
+static void ReleaseBuffer(PooledBuffer *buffer)
+{
+    if (buffer == NULL)
+    {
+        return;
+    }
+
+    if (m_bufferPool != NULL && QueryDepthSList(m_bufferPool) < MaxIdleBuffers)
+    {
+        InterlockedPushEntrySList(m_bufferPool, &buffer->entry);
+    }
+    else
+    {
+        _aligned_free(buffer);
+    }
+}
+
+/// <summary>
+/// Whether a backend reported that the server did not run a connect or a wait, so that it can be sent again.
+/// </summary>
+static bool IsRetryable(long status)
+{
+    return status == RPC_S_SERVER_UNAVAILABLE || status == RPC_S_SERVER_TOO_BUSY;
+}
+
+/// <summary>
+/// Whether a backend reported that an EcDoRpcExt2 request was refused before the server ran it. RPC_S_SERVER_UNAVAILABLE
+/// and RPC_S_CALL_FAILED can also be raised once the request was sent, and its ROPs may then have been run; sending
+/// it again could run them twice, so these failures are returned to the caller.
+/// </summary>
+static bool IsExecuteRetryable(long status)
+{
+    return status == RPC_S_SERVER_TOO_BUSY;
+}
+
+static long __stdcall RpcBackendConnect(const MAPI_SESSION_CONFIG *config, void **context, unsigned long *pcRetry, unsigned long *pcmsRetryDelay)
+{
+    RpcBackendContext *created = new RpcBackendContext();
+    unsigned long cmsPollsMax = 0;
+    unsigned short iCxr = 0;
+    unsigned char *pszDNPrefix = NULL;
+    unsigned char *pszDisplayName = NULL;
+    unsigned short rgwClientVersion[3] = { 0x000c, 0x183e, 0x03e8 };
+    unsigned short rgwServerVersion[3] = { 0 };
+    unsigned short rgwBestVersion[3] = { 0 };
+    unsigned long ulTimeStamp = 0;
+    unsigned char rgbAuxOut[AuxOutSize];
+    unsigned long cbAuxOut = AuxOutSize;
+    long status = 0;
+
+    // The same parameters as Connect, with the retry values kept for the session.
+    RpcTryExcept
+    {
+        status = TracedEcDoConnectEx(GetBindHandle(), &created->cxh, (unsigned char *)config->UserDN, 0, 0, 0, 0x000004E4, 0x00000409, 0x00000409, 0xFFFFFFFF, 0x01,
+            &cmsPollsMax, pcRetry, pcmsRetryDelay, &iCxr, &pszDNPrefix, &pszDisplayName, rgwClientVersion, rgwServerVersion, rgwBestVersion, &ulTimeStamp,
+            NULL, 0, rgbAuxOut, &cbAuxOut);
+    }
+    RpcExcept(HandleException(::RpcExceptionCode()))
+    {
+        status = ::RpcExceptionCode();
+    }
+    RpcEndExcept;
+
+    midl_user_free(pszDNPrefix);
+    midl_user_free(pszDisplayName);
+    if (status != 0)
+    {
+        delete created;
+        return status;
+    }
+
+    *context = created;
+    return 0;
+}
+
+static long __stdcall RpcBackendExecute(
+    void *context,
+    unsigned long *pulFlags,
+    unsigned char *rgbIn,
+    unsigned long cbIn,
+    unsigned char *rgbOut,
+    unsigned long *pcbOut,
+    unsigned char *rgbAuxOut,
+    unsigned long *pcbAuxOut,
+    unsigned long *pulTransTime)
+{
+    RpcBackendContext *rpc = (RpcBackendContext *)context;
+    long status = 0;
+    RpcTryExcept
+    {
+        status = TracedEcDoRpcExt2(&rpc->cxh, pulFlags, rgbIn, cbIn, rgbOut, pcbOut, NULL, 0, rgbAuxOut, pcbAuxOut, pulTransTime);
+    }
+    RpcExcept(HandleException(::RpcExceptionCode()))
+    {
+        status = ::RpcExceptionCode();
+    }
+    RpcEndExcept;
+
+    return status;
+}
+
+static long __stdcall RpcBackendNotificationWait(void *context, unsigned long *pulFlagsOut)
+{
+    RpcBackendContext *rpc = (RpcBackendContext *)context;
+    long status = 0;
+    if (rpc->acxh == NULL)
+    {
+        RpcTryExcept
+        {
+            status = TracedEcDoAsyncConnectEx(rpc->cxh, &rpc->acxh);
+        }
+        RpcExcept(HandleException(::RpcExceptionCode()))
+        {
+            status = ::RpcExceptionCode();
+        }
+        RpcEndExcept;
+
+        if (status != 0)
+        {
+            return status;
+        }
+    }
+
+    // The server completes the call within 5 minutes even if there is no event, as specified in MS-OXCRPC section 3.3.4.1.
+    return EcDoAsyncWaitExWrap(rpc->acxh, 0, 300, FALSE, pulFlagsOut);
+}
+
+static long __stdcall RpcBackendDisconnect(void *context)
+{
+    RpcBackendContext *rpc = (RpcBackendContext *)context;
+    long status = 0;
+    RpcTryExcept
+    {
+        if (rpc->acxh != NULL)
+        {
+            RpcSsDestroyClientContext(&rpc->acxh);
+        }
+
+        status = TracedEcDoDisconnect(&rpc->cxh);
+    }
+    RpcExcept(HandleException(::RpcExceptionCode()))
+    {
+        status = ::RpcExceptionCode();
+    }
+    RpcEndExcept;
+
+    delete rpc;
+    return status;
+}
+
+/// <summary>
+/// Report a MAPI/HTTP failure the server did not run the request for with the status of the RPC backend.
+/// </summary>
+static long MapMapiHttpStatus(MAPIHTTP_SESSION *session, long status)
+{
+    if (status == ERROR_WINHTTP_CANNOT_CONNECT || status == ERROR_WINHTTP_NAME_NOT_RESOLVED)
+    {
+        return RPC_S_SERVER_UNAVAILABLE;
+    }
+
+    unsigned long httpStatus = 0;
+    unsigned long responseCode = 0;
+    if (status == ERROR_WINHTTP_INVALID_SERVER_RESPONSE && session != NULL && MapiHttpGetLastResponse(session, &httpStatus, &responseCode) == 0
+        && (httpStatus == 503 || responseCode == MAPIHTTP_RESPONSE_ENDPOINT_SHUTTING_DOWN))
+    {
+        return RPC_S_SERVER_TOO_BUSY;
+    }
+
+    return status;
+}
+
+static long __stdcall MapiHttpBackendConnect(const MAPI_SESSION_CONFIG *config, void **context, unsigned long *pcRetry, unsigned long *pcmsRetryDelay)
+{
+    MAPIHTTP_SESSION *session = NULL;
+    unsigned long cmsPollsMax = 0;
+    unsigned char *szDNPrefix = NULL;
+    unsigned char *szDisplayName = NULL;
+    unsigned char rgbAuxOut[AuxOutSize];
+    unsigned long cbAuxOut = AuxOutSize;
+    long status = MapiHttpConnect(config->MailStoreUrl, config->Domain, config->UserName, config->Password, &session, (unsigned char *)config->UserDN, 0,
+        0x000004E4, 0x00000409, 0x00000409, &cmsPollsMax, pcRetry, pcmsRetryDelay, &szDNPrefix, &szDisplayName, NULL, 0, rgbAuxOut, &cbAuxOut);
+    if (status != 0)
+    {
+        // A failed connect leaves no session, so the last response cannot be read; only connection failures are retried.
+        return MapMapiHttpStatus(NULL, status);
+    }
+
+    midl_user_free(szDNPrefix);
+    midl_user_free(szDisplayName);
+    *context = session;
+    return 0;
+}
+
+static long __stdcall MapiHttpBackendExecute(
+    void *context,
+    unsigned long *pulFlags,
+    unsigned char *rgbIn,
+    unsigned long cbIn,
+    unsigned char *rgbOut,
+    unsigned long *pcbOut,
+    unsigned char *rgbAuxOut,
+    unsigned long *pcbAuxOut,
+    unsigned long *pulTransTime)
+{
+    MAPIHTTP_SESSION *session = (MAPIHTTP_SESSION *)context;
+    long status = MapiHttpExecute(&session, pulFlags, rgbIn, cbIn, rgbOut, pcbOut, NULL, 0, rgbAuxOut, pcbAuxOut, pulTransTime);
+    return MapMapiHttpStatus(session, status);
+}
+
+static long __stdcall MapiHttpBackendNotificationWait(void *context, unsigned long *pulFlagsOut)
+{
+    MAPIHTTP_SESSION *session = (MAPIHTTP_SESSION *)context;
+    return MapMapiHttpStatus(session, MapiHttpNotificationWait(session, 0, pulFlagsOut));
+}
+
+static long __stdcall MapiHttpBackendDisconnect(void *context)
+{
+    MAPIHTTP_SESSION *session = (MAPIHTTP_SESSION *)context;
+    return MapiHttpDisconnect(&session);
+}
+
+static const MAPI_SESSION_BACKEND m_rpcBackend =
+{
+    RpcBackendConnect,
+    RpcBackendExecute,
+    RpcBackendNotificationWait,
+    RpcBackendDisconnect
+};
+
+static const MAPI_SESSION_BACKEND m_mapiHttpBackend =
+{
+    MapiHttpBackendConnect,
+    MapiHttpBackendExecute,
+    MapiHttpBackendNotificationWait,
+    MapiHttpBackendDisconnect
+};
+
+static unsigned __int64 ElapsedMicroseconds(const LARGE_INTEGER &start, const LARGE_INTEGER &end)
+{
+    return (unsigned __int64)((end.QuadPart - start.QuadPart) * 1000000 / m_frequency.QuadPart);
+}
+
+/// <summary>
+/// Add the counters of one call to the counters of its session and of all sessions.
+/// </summary>
+static void AddStats(MAPI_SESSION_STATS *stats, const MAPI_SESSION_STATS &call)
+{
+    MAPI_SESSION_STATS *targets[2] = { stats, &m_totals };
+    AcquireSRWLockExclusive(&m_totalsLock);
+    for (int i = 0; i < 2; i++)
+    {
+        MAPI_SESSION_STATS *target = targets[i];
+        target->ExecuteCount += call.ExecuteCount;
+        target->FailureCount += call.FailureCount;
+        target->RetryCount += call.RetryCount;
+        target->NotificationWaitCount += call.NotificationWaitCount;
+        target->CompressedBufferCount += call.CompressedBufferCount;
+        target->RequestBytes += call.RequestBytes;
+        target->RequestWireBytes += call.RequestWireBytes;
+        target->ResponseWireBytes += call.ResponseWireBytes;
+        target->ResponseBytes += call.ResponseBytes;
+        target->TotalExecuteMicroseconds += call.TotalExecuteMicroseconds;
+        if (call.MaxExecuteMicroseconds > target->MaxExecuteMicroseconds)
+        {
+            target->MaxExecuteMicroseconds = call.MaxExecuteMicroseconds;
+        }
+    }
+    ReleaseSRWLockExclusive(&m_totalsLock);
+}
+
+/// <summary>
+/// Return the backend of a transport, for a caller that wraps it in its own MAPI_SESSION_BACKEND.
+/// </summary>
+/// <returns>The backend, or NULL if the transport is unknown.</returns>
+const MAPI_SESSION_BACKEND * __stdcall MapiSessionGetBackend(MAPI_TRANSPORT transport)
+{
+    switch (transport)
+    {
+    case MapiTransportRpc:
+        return &m_rpcBackend;
+    case MapiTransportMapiHttp:
+        return &m_mapiHttpBackend;
+    default:
+        return NULL;
+    }
+}
+
+/// <summary>
+/// Create a session context on a transport. A connect the server did not run is sent again up to MaxRetries times,
+/// or 3 times if the server values are selected; after that the session follows the retry values of its config or
+/// the ones the server returned.
+/// </summary>
+/// <param name="config">The transport, the user and the options of the session.</param>
+/// <param name="session">Receives the session; release it with MapiSessionDisconnect.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long __stdcall MapiSessionConnect(const MAPI_SESSION_CONFIG *config, MAPI_SESSION **session)
+{
+    if (config == NULL || session == NULL || config->UserDN == NULL
+        || (config->Flags & ~(MAPI_SESSION_COMPRESS | MAPI_SESSION_XORMAGIC | MAPI_SESSION_CHAIN)) != 0)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    const MAPI_SESSION_BACKEND *backend = config->Backend != NULL ? config->Backend : MapiSessionGetBackend(config->Transport);
+    if (backend == NULL || (backend == &m_mapiHttpBackend && config->MailStoreUrl == NULL))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    MAPI_SESSION *created = new MAPI_SESSION();
+    created->backend = backend;
+    created->flags = config->Flags;
+    created->response = AcquireBuffer();
+    if (created->response == NULL)
+    {
+        delete created;
+        return ERROR_OUTOFMEMORY;
+    }
+
+    QueryPerformanceFrequency(&m_frequency);
+    unsigned long maxRetries = config->MaxRetries == MAPI_SESSION_SERVER_RETRY ? DefaultRetries : config->MaxRetries;
+    unsigned long retryDelay = config->RetryDelay == MAPI_SESSION_SERVER_RETRY ? DefaultRetryDelay : config->RetryDelay;
+    unsigned long serverRetries = 0;
+    unsigned long serverRetryDelay = 0;
+    MAPI_SESSION_STATS call;
+    memset(&call, 0, sizeof(call));
+    long status = 0;
+    for (unsigned long attempt = 0; ; attempt++)
+    {
+        status = backend->Connect(config, &created->context, &serverRetries, &serverRetryDelay);
+        if (status == 0 || !IsRetryable(status) || attempt >= maxRetries)
+        {
+            break;
+        }
+
+        call.RetryCount++;
+        Sleep(retryDelay);
+    }
+
+    AddStats(&created->stats, call);
+    if (status != 0)
+    {
+        ReleaseBuffer(created->response);
+        delete created;
+        return status;
+    }
+
+    bool serverValues = serverRetries != 0 || serverRetryDelay != 0;
+    created->maxRetries = config->MaxRetries != MAPI_SESSION_SERVER_RETRY ? config->MaxRetries : serverValues ? serverRetries : DefaultRetries;
+    created->retryDelay = config->RetryDelay != MAPI_SESSION_SERVER_RETRY ? config->RetryDelay : serverValues ? serverRetryDelay : DefaultRetryDelay;
+
+    AcquireSRWLockExclusive(&m_totalsLock);
+    m_totals.SessionCount++;
+    ReleaseSRWLockExclusive(&m_totalsLock);
+
+    *session = created;
+    return 0;
+}
+
+/// <summary>
+/// Send an rgbIn payload on a session and return its response. The request buffers are compressed and obfuscated as
+/// the session flags ask, and the response buffers are revealed and decompressed, so the caller always works with
+/// plain RPC_HEADER_EXT buffers that RopResponseBegin can read.
+/// </summary>
+/// <param name="session">The session.</param>
+/// <param name="rgbIn">The plain RPC_HEADER_EXT chain to send, such as the one RopRequestEnd builds; it is not changed.</param>
+/// <param name="cbIn">The size of the chain.</param>
+/// <param name="rgbOut">Receives the response chain. It belongs to the session and is valid until the next call on it.</param>
+/// <param name="pcbOut">Receives the size of the response chain.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long __stdcall MapiSessionExecute(MAPI_SESSION *session, unsigned char *rgbIn, unsigned long cbIn, unsigned char **rgbOut, unsigned long *pcbOut)
+{
+    if (session == NULL || rgbIn == NULL || cbIn == 0 || cbIn > MAPI_SESSION_BUFFER_SIZE || rgbOut == NULL || pcbOut == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+    MAPI_SESSION_STATS call;
+    memset(&call, 0, sizeof(call));
+    call.ExecuteCount = 1;
+    call.RequestBytes = cbIn;
+
+    long status = 0;
+    unsigned char *request = rgbIn;
+    unsigned long cbRequest = cbIn;
+    unsigned short packFlags = ((session->flags & MAPI_SESSION_COMPRESS) != 0 ? RHE_FLAG_COMPRESSED : 0)
+        | ((session->flags & MAPI_SESSION_XORMAGIC) != 0 ? RHE_FLAG_XORMAGIC : 0);
+    if (packFlags != 0)
+    {
+        if (session->scratch == NULL)
+        {
+            session->scratch = AcquireBuffer();
+        }
+
+        if (session->scratch == NULL)
+        {
+            status = ERROR_OUTOFMEMORY;
+        }
+        else
+        {
+            request = session->scratch->data;
+            status = PackRpcHeaderExtChain(rgbIn, cbIn, packFlags, request, MAPI_SESSION_BUFFER_SIZE, &cbRequest);
+        }
+    }
+
+    call.RequestWireBytes = cbRequest;
+    unsigned long cbResponse = 0;
+    // The MAPI/HTTP Execute request takes the same flags as EcDoRpcExt2.
+    unsigned long ulFlags = ((session->flags & MAPI_SESSION_COMPRESS) != 0 ? 0 : RPCEXT2_FLAG_NO_COMPRESSION)
+        | ((session->flags & MAPI_SESSION_XORMAGIC) != 0 ? 0 : RPCEXT2_FLAG_NO_XORMAGIC)
+        | ((session->flags & MAPI_SESSION_CHAIN) != 0 ? RPCEXT2_FLAG_CHAIN : 0);
+    for (unsigned long attempt = 0; status == 0; attempt++)
+    {
+        unsigned long flags = ulFlags;
+        unsigned long cbAuxOut = AuxOutSize;
+        unsigned long ulTransTime = 0;
+        cbResponse = MAPI_SESSION_BUFFER_SIZE;
+        status = session->backend->Execute(session->context, &flags, request, cbRequest, session->response->data, &cbResponse, session->auxOut, &cbAuxOut, &ulTransTime);
+        if (status == 0 || !IsExecuteRetryable(status) || attempt >= session->maxRetries)
+        {
+            break;
+        }
+
+        // The server refused the request before it ran it; send it again.
+        call.RetryCount++;
+        status = 0;
+        Sleep(session->retryDelay);
+    }
+
+    unsigned char *response = session->response->data;
+    if (status == 0)
+    {
+        call.ResponseWireBytes = cbResponse;
+
+        // Find out whether a buffer is compressed and how large the chain is once expanded.
+        unsigned long expandedSize = 0;
+        unsigned long offset = 0;
+        RPC_HEADER_EXT_BUFFER parsed;
+        parsed.Header.Flags = 0;
+        while (status == 0 && offset < cbResponse && (parsed.Header.Flags & RHE_FLAG_LAST) == 0)
+        {
+            status = ParseRpcHeaderExt(response, cbResponse, offset, &parsed);
+            if (status == 0)
+            {
+                call.CompressedBufferCount += (parsed.Header.Flags & RHE_FLAG_COMPRESSED) != 0 ? 1 : 0;
+                expandedSize += sizeof(RPC_HEADER_EXT) + parsed.Header.SizeActual;
+                offset += sizeof(RPC_HEADER_EXT) + parsed.Header.Size;
+            }
+        }
+
+        if (status == 0 && call.CompressedBufferCount != 0)
+        {
+            if (session->scratch == NULL)
+            {
+                session->scratch = AcquireBuffer();
+            }
+
+            unsigned char *target = session->scratch == NULL ? NULL : session->scratch->data;
+            if (expandedSize > MAPI_SESSION_BUFFER_SIZE || target == NULL)
+            {
+                session->expanded.resize(expandedSize);
+                target = &session->expanded[0];
+            }
+
+            status = ExpandRpcHeaderExtChain(response, cbResponse, target, expandedSize, &cbResponse);
+            response = target;
+        }
+        else
+        {
+            // Reveal obfuscated buffers in place; RopResponseNextBuffer finds them already revealed.
+            offset = 0;
+            parsed.Header.Flags = 0;
+            while (status == 0 && offset < cbResponse && (parsed.Header.Flags & RHE_FLAG_LAST) == 0)
+            {
+                status = ParseRpcHeaderExt(response, cbResponse, offset, &parsed);
+                if (status == 0)
+                {
+                    status = RevealRpcHeaderExtPayload(&parsed);
+                    offset += sizeof(RPC_HEADER_EXT) + parsed.Header.Size;
+                }
+            }
+        }
+    }
+
+    if (status == 0)
+    {
+        call.ResponseBytes = cbResponse;
+        *rgbOut = response;
+        *pcbOut = cbResponse;
+    }
+    else
+    {
+        call.FailureCount = 1;
+    }
+
+    LARGE_INTEGER end;
+    QueryPerformanceCounter(&end);
+    call.TotalExecuteMicroseconds = ElapsedMicroseconds(start, end);
+    call.MaxExecuteMicroseconds = call.TotalExecuteMicroseconds;
+    AddStats(&session->stats, call);
+    return status;
+}
+
+/// <summary>
+/// Wait until the server has pending events for the session, like EcDoAsyncWaitEx. A wait changes nothing on the
+/// server, so it is retried on the same failures as a connect.
+/// </summary>
+/// <param name="session">The session.</param>
+/// <param name="pulFlagsOut">Receives 0x00000001 (NotificationPending) if the server has events for the session.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long __stdcall MapiSessionNotificationWait(MAPI_SESSION *session, unsigned long *pulFlagsOut)
+{
+    if (session == NULL || pulFlagsOut == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    MAPI_SESSION_STATS call;
+    memset(&call, 0, sizeof(call));
+    call.NotificationWaitCount = 1;
+    long status = 0;
+    for (unsigned long attempt = 0; ; attempt++)
+    {
+        status = session->backend->NotificationWait(session->context, pulFlagsOut);
+        if (status == 0 || !IsRetryable(status) || attempt >= session->maxRetries)
+        {
+            break;
+        }
+
+        call.RetryCount++;
+        Sleep(session->retryDelay);
+    }
+
+    AddStats(&session->stats, call);
+    return status;
+}
+
+/// <summary>
+/// Destroy the session context and release the session. The session is released even if the call fails.
+/// </summary>
+/// <param name="session">On input, the session; on output, NULL.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long __stdcall MapiSessionDisconnect(MAPI_SESSION **session)
+{
+    if (session == NULL || *session == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    MAPI_SESSION *released = *session;
+    *session = NULL;
+    long status = released->backend->Disconnect(released->context);
+    ReleaseBuffer(released->response);
+    ReleaseBuffer(released->scratch);
+    delete released;
+
+    AcquireSRWLockExclusive(&m_totalsLock);
+    m_totals.SessionCount--;
+    ReleaseSRWLockExclusive(&m_totalsLock);
+    return status;
+}
+
+/// <summary>
+/// Read the counters of a session, or of all the sessions of the process.
+/// </summary>
+/// <param name="session">The session, or NULL for all sessions.</param>
+/// <param name="stats">Receives the counters.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long __stdcall MapiSessionGetStats(MAPI_SESSION *session, MAPI_SESSION_STATS *stats)
+{
+    if (stats == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    AcquireSRWLockShared(&m_totalsLock);
+    *stats = session == NULL ? m_totals : session->stats;
+    ReleaseSRWLockShared(&m_totalsLock);
+    return 0;
+}
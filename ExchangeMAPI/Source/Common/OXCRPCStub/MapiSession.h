@@ -0,0 +1,129 @@
+#pragma once
+
+#include "MS-OXCRPC.h"
+
+/// <summary>
+/// Compress request buffers and let the server compress response buffers, as specified in MS-OXCRPC section 3.1.7.2.
+/// </summary>
+#define MAPI_SESSION_COMPRESS   0x00000001
+
+/// <summary>
+/// Obfuscate request buffers and let the server obfuscate response buffers, as specified in MS-OXCRPC section 3.1.7.3.
+/// </summary>
+#define MAPI_SESSION_XORMAGIC   0x00000002
+
+/// <summary>
+/// Let the server chain additional response buffers into rgbOut, as specified in MS-OXCRPC section 3.1.4.2.1.1.
+/// </summary>
+#define MAPI_SESSION_CHAIN      0x00000004
+
+/// <summary>
+/// The MaxRetries and RetryDelay value that selects the pcRetry and pcmsRetryDelay the server returned on connect.
+/// </summary>
+#define MAPI_SESSION_SERVER_RETRY 0xFFFFFFFF
+
+/// <summary>
+/// The size of the pooled response buffers, the largest rgbOut an EcDoRpcExt2 call can return.
+/// </summary>
+#define MAPI_SESSION_BUFFER_SIZE 0x40000
+
+/// <summary>
+/// The transport of a session.
+/// </summary>
+typedef enum _MAPI_TRANSPORT
+{
+    MapiTransportRpc = 0,           // EcDoConnectEx and EcDoRpcExt2 on the binding of BindToServer, over ncacn_ip_tcp or ncacn_http.
+    MapiTransportMapiHttp = 1       // The Connect and Execute requests of MS-OXCMAPIHTTP, through MapiHttpConnect and MapiHttpExecute.
+} MAPI_TRANSPORT;
+
+typedef struct _MAPI_SESSION_CONFIG MAPI_SESSION_CONFIG;
+
+/// <summary>
+/// The routines of a transport. A backend reports a request the server did not run, and that can be sent again, as
+/// RPC_S_SERVER_UNAVAILABLE if the server could not be reached, or as RPC_S_SERVER_TOO_BUSY if the server refused it.
+/// The session retries a connect or a wait on these two, but an Execute only on RPC_S_SERVER_TOO_BUSY, since a
+/// transport can also report RPC_S_SERVER_UNAVAILABLE after the request was sent. Other failures are returned as the
+/// transport reported them.
+/// </summary>
+typedef struct _MAPI_SESSION_BACKEND
+{
+    /// <summary>
+    /// Create a session context. pcRetry and pcmsRetryDelay receive the values the server returned, or 0.
+    /// </summary>
+    long (__stdcall *Connect)(const MAPI_SESSION_CONFIG *config, void **context, unsigned long *pcRetry, unsigned long *pcmsRetryDelay);
+
+    /// <summary>
+    /// Send an rgbIn payload with the parameters of EcDoRpcExt2.
+    /// </summary>
+    long (__stdcall *Execute)(
+        void *context,
+        unsigned long *pulFlags,
+        unsigned char *rgbIn,
+        unsigned long cbIn,
+        unsigned char *rgbOut,
+        unsigned long *pcbOut,
+        unsigned char *rgbAuxOut,
+        unsigned long *pcbAuxOut,
+        unsigned long *pulTransTime);
+
+    /// <summary>
+    /// Wait until the server has pending events for the session context, like EcDoAsyncWaitEx.
+    /// </summary>
+    long (__stdcall *NotificationWait)(void *context, unsigned long *pulFlagsOut);
+
+    /// <summary>
+    /// Destroy the session context and release the context, whether or not the server could be reached.
+    /// </summary>
+    long (__stdcall *Disconnect)(void *context);
+} MAPI_SESSION_BACKEND;
+
+/// <summary>
+/// The parameters of MapiSessionConnect.
+/// </summary>
+struct _MAPI_SESSION_CONFIG
+{
+    MAPI_TRANSPORT Transport;
+    const MAPI_SESSION_BACKEND *Backend;    // NULL for the backend of Transport, or a backend of the caller, for example one that wraps it.
+    const char *UserDN;
+    const char *MailStoreUrl;               // MAPI/HTTP only; the RPC backend uses the binding of BindToServer and the identity of CreateIdentity.
+    const char *Domain;                     // MAPI/HTTP only.
+    const char *UserName;                   // MAPI/HTTP only.
+    const char *Password;                   // MAPI/HTTP only.
+    unsigned long Flags;                    // A combination of MAPI_SESSION_COMPRESS, MAPI_SESSION_XORMAGIC and MAPI_SESSION_CHAIN.
+    unsigned long MaxRetries;               // The times a request the server did not run is sent again, or MAPI_SESSION_SERVER_RETRY.
+    unsigned long RetryDelay;               // The milliseconds before a request is sent again, or MAPI_SESSION_SERVER_RETRY.
+};
+
+/// <summary>
+/// The counters of a session, or of all sessions.
+/// </summary>
+typedef struct _MAPI_SESSION_STATS
+{
+    unsigned long SessionCount;             // Connected sessions; only in the counters of all sessions.
+    unsigned long BufferAllocationCount;    // Buffers allocated because the pool was empty; only in the counters of all sessions.
+    unsigned long ExecuteCount;             // MapiSessionExecute calls.
+    unsigned long FailureCount;             // MapiSessionExecute calls that failed after their retries.
+    unsigned long RetryCount;               // Requests sent again under the retry policy, by all the calls.
+    unsigned long NotificationWaitCount;    // MapiSessionNotificationWait calls.
+    unsigned long CompressedBufferCount;    // Response buffers that arrived compressed.
+    unsigned __int64 RequestBytes;          // rgbIn bytes passed by the caller.
+    unsigned __int64 RequestWireBytes;      // rgbIn bytes sent, after compression.
+    unsigned __int64 ResponseWireBytes;     // rgbOut bytes received.
+    unsigned __int64 ResponseBytes;         // rgbOut bytes returned to the caller, after decompression.
+    unsigned __int64 TotalExecuteMicroseconds;  // Sum of the MapiSessionExecute times, including retries.
+    unsigned __int64 MaxExecuteMicroseconds;    // The longest MapiSessionExecute time.
+} MAPI_SESSION_STATS;
+
+typedef struct _MAPI_SESSION MAPI_SESSION;
+
+const MAPI_SESSION_BACKEND * __stdcall MapiSessionGetBackend(MAPI_TRANSPORT transport);
+
+long __stdcall MapiSessionConnect(const MAPI_SESSION_CONFIG *config, MAPI_SESSION **session);
+
+long __stdcall MapiSessionExecute(MAPI_SESSION *session, unsigned char *rgbIn, unsigned long cbIn, unsigned char **rgbOut, unsigned long *pcbOut);
+
+long __stdcall MapiSessionNotificationWait(MAPI_SESSION *session, unsigned long *pulFlagsOut);
+
+long __stdcall MapiSessionDisconnect(MAPI_SESSION **session);
+
+long __stdcall MapiSessionGetStats(MAPI_SESSION *session, MAPI_SESSION_STATS *stats);
@@ -0,0 +1,318 @@
+#pragma once
+
+#include <windows.h>
+
+/// <summary>
+/// The size of the memory-mapped view of the file; a multiple of the allocation granularity.
+/// </summary>
+#define MAPPED_FILE_VIEW_SIZE (64 * 1024 * 1024)
+
+/// <summary>
+/// A file accessed through a sliding memory-mapped view.
+/// </summary>
+class MappedFile
+{
+public:
+    MappedFile()
+        : file(INVALID_HANDLE_VALUE), mapping(NULL), view(NULL), viewOffset(0), viewSize(0), fileSize(0), writable(false)
+    {
+    }
+
+    ~MappedFile()
+    {
+        this->Close();
+    }
+
+    /// <summary>
+    /// Create or truncate a file of the given size to write a downloaded stream to.
+    /// </summary>
+    long Create(const wchar_t *path, unsigned __int64 size)
+    {
+        this->writable = true;
+        this->file = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (this->file == INVALID_HANDLE_VALUE)
+        {
+            return GetLastError();
+        }
+
+        this->fileSize = size;
+        if (size == 0)
+        {
+            return 0;
+        }
+
+        this->mapping = CreateFileMappingW(this->file, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)size, NULL);
+        return this->mapping == NULL ? GetLastError() : 0;
+    }
+
+    /// <summary>
+    /// Open an existing file to upload as a stream.
+    /// </summary>
+    long Open(const wchar_t *path)
+    {
+        this->writable = false;
+        this->file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (this->file == INVALID_HANDLE_VALUE)
+        {
+            return GetLastError();
+        }
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(this->file, &size))
+        {
+            return GetLastError();
+        }
+
+        this->fileSize = (unsigned __int64)size.QuadPart;
+        if (this->fileSize == 0)
+        {
+            return 0;
+        }
+
+        this->mapping = CreateFileMappingW(this->file, NULL, PAGE_READONLY, 0, 0, NULL);
+        return this->mapping == NULL ? GetLastError() : 0;
+    }
+
+    /// <summary>
+    /// Open a file for reading and appending, creating an empty one if it does not exist.
+    /// </summary>
+    long OpenForUpdate(const wchar_t *path)
+    {
+        this->writable = true;
+        this->file = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (this->file == INVALID_HANDLE_VALUE)
+        {
+            return GetLastError();
+        }
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(this->file, &size))
+        {
+            return GetLastError();
+        }
+
+        this->fileSize = (unsigned __int64)size.QuadPart;
+        if (this->fileSize == 0)
+        {
+            return 0;
+        }
+
+        this->mapping = CreateFileMappingW(this->file, NULL, PAGE_READWRITE, 0, 0, NULL);
+        return this->mapping == NULL ? GetLastError() : 0;
+    }
+
+    /// <summary>
+    /// Open a file that other processes map at the same time, creating it if it does not exist and growing it to at
+    /// least the given size. Only the first process can grow it, while no other process has it mapped.
+    /// </summary>
+    long OpenShared(const wchar_t *path, unsigned __int64 size)
+    {
+        this->writable = true;
+        this->file = CreateFileW(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (this->file == INVALID_HANDLE_VALUE)
+        {
+            return GetLastError();
+        }
+
+        LARGE_INTEGER current;
+        if (!GetFileSizeEx(this->file, &current))
+        {
+            return GetLastError();
+        }
+
+        this->fileSize = (unsigned __int64)current.QuadPart;
+        if (this->fileSize < size)
+        {
+            return this->Extend(size);
+        }
+
+        this->mapping = CreateFileMappingW(this->file, NULL, PAGE_READWRITE, 0, 0, NULL);
+        return this->mapping == NULL ? GetLastError() : 0;
+    }
+
+    /// <summary>
+    /// Grow a file opened for update; the new bytes read as zeros.
+    /// </summary>
+    long Extend(unsigned __int64 size)
+    {
+        this->CloseMapping();
+        LARGE_INTEGER position;
+        position.QuadPart = (LONGLONG)size;
+        if (!SetFilePointerEx(this->file, position, NULL, FILE_BEGIN) || !SetEndOfFile(this->file))
+        {
+            return GetLastError();
+        }
+
+        this->fileSize = size;
+        this->mapping = CreateFileMappingW(this->file, NULL, PAGE_READWRITE, 0, 0, NULL);
+        return this->mapping == NULL ? GetLastError() : 0;
+    }
+
+    /// <summary>
+    /// Write the bytes from offset on to disk, and return once they are there.
+    /// </summary>
+    long Flush(unsigned __int64 offset, unsigned long size)
+    {
+        while (size > 0)
+        {
+            unsigned long available;
+            unsigned char *target = this->At(offset, &available);
+            if (target == NULL)
+            {
+                return GetLastError();
+            }
+
+            unsigned long count = size < available ? size : available;
+            if (!FlushViewOfFile(target, count))
+            {
+                return GetLastError();
+            }
+
+            offset += count;
+            size -= count;
+        }
+
+        return FlushFileBuffers(this->file) ? 0 : GetLastError();
+    }
+
+    unsigned __int64 Size() const
+    {
+        return this->fileSize;
+    }
+
+    /// <summary>
+    /// Return a pointer to the byte at offset, and the number of bytes mapped contiguously from there.
+    /// </summary>
+    unsigned char *At(unsigned __int64 offset, unsigned long *available)
+    {
+        if (this->view == NULL || offset < this->viewOffset || offset >= this->viewOffset + this->viewSize)
+        {
+            if (this->view != NULL)
+            {
+                UnmapViewOfFile(this->view);
+                this->view = NULL;
+            }
+
+            this->viewOffset = offset - offset % MAPPED_FILE_VIEW_SIZE;
+            unsigned __int64 remaining = this->fileSize - this->viewOffset;
+            this->viewSize = remaining < MAPPED_FILE_VIEW_SIZE ? (size_t)remaining : MAPPED_FILE_VIEW_SIZE;
+            this->view = (unsigned char *)MapViewOfFile(
+                this->mapping,
+                this->writable ? FILE_MAP_WRITE : FILE_MAP_READ,
+                (DWORD)(this->viewOffset >> 32),
+                (DWORD)this->viewOffset,
+                this->viewSize);
+            if (this->view == NULL)
+            {
+                return NULL;
+            }
+        }
+
+        *available = (unsigned long)(this->viewOffset + this->viewSize - offset);
+        return this->view + (offset - this->viewOffset);
+    }
+
+    /// <summary>
+    /// Copy bytes to the file at offset, across view boundaries if needed.
+    /// </summary>
+    long Write(unsigned __int64 offset, const unsigned char *data, unsigned long size)
+    {
+        while (size > 0)
+        {
+            unsigned long available;
+            unsigned char *target = this->At(offset, &available);
+            if (target == NULL)
+            {
+                return GetLastError();
+            }
+
+            unsigned long count = size < available ? size : available;
+            memcpy(target, data, count);
+            offset += count;
+            data += count;
+            size -= count;
+        }
+
+        return 0;
+    }
+
+    /// <summary>
+    /// Copy bytes from the file at offset, across view boundaries if needed.
+    /// </summary>
+    long Read(unsigned __int64 offset, unsigned char *data, unsigned long size)
+    {
+        while (size > 0)
+        {
+            unsigned long available;
+            unsigned char *source = this->At(offset, &available);
+            if (source == NULL)
+            {
+                return GetLastError();
+            }
+
+            unsigned long count = size < available ? size : available;
+            memcpy(data, source, count);
+            offset += count;
+            data += count;
+            size -= count;
+        }
+
+        return 0;
+    }
+
+    /// <summary>
+    /// Shrink a downloaded file to the number of bytes actually received.
+    /// </summary>
+    long Truncate(unsigned __int64 size)
+    {
+        this->CloseMapping();
+        LARGE_INTEGER position;
+        position.QuadPart = (LONGLONG)size;
+        if (!SetFilePointerEx(this->file, position, NULL, FILE_BEGIN) || !SetEndOfFile(this->file))
+        {
+            return GetLastError();
+        }
+
+        this->fileSize = size;
+        return 0;
+    }
+
+    void Close()
+    {
+        this->CloseMapping();
+        if (this->file != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(this->file);
+            this->file = INVALID_HANDLE_VALUE;
+        }
+    }
+
+private:
+    void CloseMapping()
+    {
+        if (this->view != NULL)
+        {
+            if (this->writable)
+            {
+                FlushViewOfFile(this->view, 0);
+            }
+
+            UnmapViewOfFile(this->view);
+            this->view = NULL;
+        }
+
+        if (this->mapping != NULL)
+        {
+            CloseHandle(this->mapping);
+            this->mapping = NULL;
+        }
+    }
+
+    HANDLE file;
+    HANDLE mapping;
+    unsigned char *view;
+    unsigned __int64 viewOffset;
+    size_t viewSize;
+    unsigned __int64 fileSize;
+    bool writable;
+};
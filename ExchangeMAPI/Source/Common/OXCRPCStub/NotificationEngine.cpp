@@ -0,0 +1,1005 @@
+#include "NotificationEngine.h"
+#include <map>
+#include <malloc.h>
+#include <new>
+
+// RopNotify and RopPending responses trail the ROP responses of an EcDoRpcExt2 call. The engine decodes them in place,
+// copies the raw RopNotify bytes into a queue entry and hands the entry to the subscription of its notification
+// handle. Each subscription has an intrusive multi-producer, single-consumer queue, drained in order by at most one
+// thread pool work item at a time, so feeding threads never wait for subscribers and never block each other.
+//
+// Queue entries come from a lock-free pool. When the pool is empty, or a notification does not fit in a pooled entry,
+// an entry is allocated instead of dropping the notification; pooled entries return to the pool after delivery, so a
+// burst of table changes grows the pool once and later bursts run without allocation.
+
+using namespace RopCodec;
+
+/// <summary>
+/// The number of NotificationData bytes a pooled queue entry holds.
+/// </summary>
+static const unsigned long PooledDataSize = 960;
+
+/// <summary>
+/// The number of pooled queue entries allocated up front when the caller does not choose.
+/// </summary>
+static const unsigned long DefaultPoolSize = 256;
+
+/// <summary>
+/// The maximum number of notifications a work item delivers for one subscription before it yields the thread pool thread.
+/// </summary>
+static const unsigned long DeliveryBatchSize = 64;
+
+/// <summary>
+/// The EventPending flag of a NotificationWait response, as specified in MS-OXCMAPIHTTP section 2.2.4.4.2.
+/// </summary>
+#define NOTIFICATION_WAIT_EVENT_PENDING 0x00000001
+
+/// <summary>
+/// The fixed part of a NotificationWait response body: StatusCode, ErrorCode, EventPending, AuxiliaryBufferSize.
+/// </summary>
+typedef Layout<ULong, ULong, ULong, ULong> NotificationWaitResponse;
+
+/// <summary>
+/// A queued RopNotify response. Pooled entries hold PooledDataSize bytes; other entries are sized to their notification.
+/// </summary>
+struct NotificationNode
+{
+    SLIST_ENTRY poolEntry;              // The link in the pool; it MUST be the first member.
+    NotificationNode * volatile next;   // The link in the subscription queue.
+    unsigned long size;
+    bool pooled;
+    unsigned char data[1];
+};
+
+/// <summary>
+/// A subscriber and the queue of its notifications. It is referenced by the subscription map, by the producers that
+/// are enqueueing to it and by the work item that delivers its notifications.
+/// </summary>
+struct NotificationSubscription
+{
+    NOTIFICATION_ENGINE *engine;
+    unsigned long notificationHandle;
+    NOTIFICATION_ROUTINE routine;
+    void *context;
+    NotificationNode *stub;
+    NotificationNode * volatile head;
+    NotificationNode *tail;
+
+    // Notifications queued or being delivered. The producer that raises it from 0 schedules a work item, and the work item stops when it drops to 0.
+    volatile LONG pending;
+    volatile LONG refCount;
+    volatile LONG removed;
+
+    void Push(NotificationNode *node)
+    {
+        node->next = NULL;
+        NotificationNode *previous = (NotificationNode *)InterlockedExchangePointer((PVOID volatile *)&this->head, node);
+        previous->next = node;
+    }
+
+    /// <summary>
+    /// Remove the oldest notification. Returns NULL if the queue is empty or a producer is between its exchange and its link.
+    /// </summary>
+    NotificationNode *Pop()
+    {
+        NotificationNode *first = this->tail;
+        NotificationNode *next = first->next;
+        if (first == this->stub)
+        {
+            if (next == NULL)
+            {
+                return NULL;
+            }
+
+            this->tail = next;
+            first = next;
+            next = next->next;
+        }
+
+        if (next != NULL)
+        {
+            this->tail = next;
+            return first;
+        }
+
+        if (first != this->head)
+        {
+            return NULL;
+        }
+
+        this->Push(this->stub);
+        next = first->next;
+        if (next != NULL)
+        {
+            this->tail = next;
+            return first;
+        }
+
+        return NULL;
+    }
+};
+
+struct _NOTIFICATION_ENGINE
+{
+    PSLIST_HEADER pool;
+    std::map<unsigned long, NotificationSubscription *> subscriptions;
+    SRWLOCK subscriptionsLock;
+    NOTIFICATION_PENDING_ROUTINE pendingRoutine;
+    void *context;
+
+    // Woken when queued or deliveries drops to 0.
+    SRWLOCK idleLock;
+    CONDITION_VARIABLE idle;
+    volatile LONG deliveries;
+
+    volatile LONG received;
+    volatile LONG delivered;
+    volatile LONG unmatched;
+    volatile LONG discarded;
+    volatile LONG pendingCount;
+    volatile LONG poolMisses;
+    volatile LONG queued;
+    volatile LONG maxQueued;
+};
+
+/// <summary>
+/// Reads the fields of a NotificationData structure with bounds checks. A read past the end marks the reader failed and returns 0.
+/// </summary>
+class NotificationFieldReader
+{
+public:
+    NotificationFieldReader(const unsigned char *data, unsigned long size)
+        : cursor(data), end(data + size), failed(false)
+    {
+    }
+
+    template <typename TField>
+    TField Read()
+    {
+        TField value = 0;
+        if (this->failed || (size_t)(this->end - this->cursor) < sizeof(TField))
+        {
+            this->failed = true;
+            return value;
+        }
+
+        memcpy(&value, this->cursor, sizeof(TField));
+        this->cursor += sizeof(TField);
+        return value;
+    }
+
+    const unsigned char *Take(unsigned __int64 count)
+    {
+        if (this->failed || (unsigned __int64)(this->end - this->cursor) < count)
+        {
+            this->failed = true;
+            return NULL;
+        }
+
+        const unsigned char *data = this->cursor;
+        this->cursor += (size_t)count;
+        return data;
+    }
+
+    /// <summary>
+    /// Take a null-terminated string of 1-byte or 2-byte characters, including its terminator.
+    /// </summary>
+    const unsigned char *TakeString(bool unicode, unsigned long &size)
+    {
+        size_t step = unicode ? 2 : 1;
+        for (const unsigned char *scan = this->cursor; !this->failed && (size_t)(this->end - scan) >= step; scan += step)
+        {
+            if (scan[0] == 0 && (!unicode || scan[1] == 0))
+            {
+                size = (unsigned long)(scan + step - this->cursor);
+                return this->Take(size);
+            }
+        }
+
+        this->failed = true;
+        return NULL;
+    }
+
+    bool Failed() const
+    {
+        return this->failed;
+    }
+
+    unsigned long Consumed(const unsigned char *start) const
+    {
+        return (unsigned long)(this->cursor - start);
+    }
+
+private:
+    const unsigned char *cursor;
+    const unsigned char *end;
+    bool failed;
+};
+
+/// <summary>
+/// Decode a RopNotify response in place, as specified in MS-OXCROPS section 2.2.14.2 and MS-OXCNOTIF section 2.2.1.4.1.2.
+/// </summary>
+/// <param name="data">The RopNotify response, starting at its RopId.</param>
+/// <param name="size">The number of bytes available from data on.</param>
+/// <param name="notification">Receives the notification; its pointers refer to data.</param>
+/// <param name="consumed">Receives the size of the RopNotify response.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall NotificationDecode(
+    const unsigned char *data,
+    unsigned long size,
+    NOTIFICATION *notification,
+    unsigned long *consumed)
+{
+    if (data == NULL || notification == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    memset(notification, 0, sizeof(NOTIFICATION));
+    if (size < Notify::Response::Size)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    Byte ropId;
+    Notify::Response::Read(data, ropId, notification->NotificationHandle, notification->LogonId);
+    if (ropId != Notify::Id)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    NotificationFieldReader reader(data + Notify::Response::Size, size - (unsigned long)Notify::Response::Size);
+    unsigned short flags = reader.Read<UShort>();
+    bool message = (flags & NOTIFICATION_FLAG_MESSAGE) != 0;
+    notification->NotificationFlags = flags;
+
+    if ((flags & NOTIFICATION_TABLE_MODIFIED) != 0)
+    {
+        notification->TableEventType = reader.Read<UShort>();
+        notification->Fields |= NOTIFICATION_FIELD_TABLE_EVENT;
+
+        unsigned short tableEvent = notification->TableEventType;
+        if (tableEvent == TABLE_EVENT_ROW_ADDED || tableEvent == TABLE_EVENT_ROW_DELETED || tableEvent == TABLE_EVENT_ROW_MODIFIED)
+        {
+            notification->TableRowFolderId = reader.Read<ULongLong>();
+            notification->Fields |= NOTIFICATION_FIELD_TABLE_ROW;
+            if (message)
+            {
+                notification->TableRowMessageId = reader.Read<ULongLong>();
+                notification->TableRowInstance = reader.Read<ULong>();
+                notification->Fields |= NOTIFICATION_FIELD_TABLE_ROW_MESSAGE;
+            }
+
+            if (tableEvent != TABLE_EVENT_ROW_DELETED)
+            {
+                notification->InsertAfterTableRowFolderId = reader.Read<ULongLong>();
+                if (message)
+                {
+                    notification->InsertAfterTableRowId = reader.Read<ULongLong>();
+                    notification->InsertAfterTableRowInstance = reader.Read<ULong>();
+                    notification->Fields |= NOTIFICATION_FIELD_INSERT_AFTER_MESSAGE;
+                }
+
+                notification->TableRowDataSize = reader.Read<UShort>();
+                notification->TableRowData = reader.Take(notification->TableRowDataSize);
+                notification->Fields |= NOTIFICATION_FIELD_INSERT_AFTER;
+            }
+        }
+    }
+
+    if ((flags & NOTIFICATION_ICS) != 0)
+    {
+        notification->HierarchyChanged = reader.Read<Byte>();
+        notification->FolderIdCount = reader.Read<ULong>();
+        notification->FolderIds = reader.Take((unsigned __int64)notification->FolderIdCount * NOTIFICATION_FOLDER_ID_SIZE);
+        notification->IcsChangeNumbers = reader.Take((unsigned __int64)notification->FolderIdCount * sizeof(ULong));
+        notification->Fields |= NOTIFICATION_FIELD_ICS;
+    }
+
+    if ((flags & (NOTIFICATION_TABLE_MODIFIED | NOTIFICATION_ICS | NOTIFICATION_RESERVED)) == 0)
+    {
+        notification->FolderId = reader.Read<ULongLong>();
+        notification->Fields |= NOTIFICATION_FIELD_FOLDER_ID;
+        if (message)
+        {
+            notification->MessageId = reader.Read<ULongLong>();
+            notification->Fields |= NOTIFICATION_FIELD_MESSAGE_ID;
+        }
+    }
+
+    // ParentFolderId is present for a folder, or for a message in a search folder.
+    bool searchFolder = (flags & NOTIFICATION_FLAG_SEARCH_FOLDER) != 0;
+    if ((flags & (NOTIFICATION_OBJECT_CREATED | NOTIFICATION_OBJECT_DELETED | NOTIFICATION_OBJECT_MOVED | NOTIFICATION_OBJECT_COPIED)) != 0 &&
+        searchFolder == message)
+    {
+        notification->ParentFolderId = reader.Read<ULongLong>();
+        notification->Fields |= NOTIFICATION_FIELD_PARENT_FOLDER_ID;
+    }
+
+    if ((flags & (NOTIFICATION_OBJECT_MOVED | NOTIFICATION_OBJECT_COPIED)) != 0)
+    {
+        notification->OldFolderId = reader.Read<ULongLong>();
+        notification->Fields |= NOTIFICATION_FIELD_OLD_FOLDER_ID;
+        if (message)
+        {
+            notification->OldMessageId = reader.Read<ULongLong>();
+            notification->Fields |= NOTIFICATION_FIELD_OLD_MESSAGE_ID;
+        }
+        else
+        {
+            notification->OldParentFolderId = reader.Read<ULongLong>();
+            notification->Fields |= NOTIFICATION_FIELD_OLD_PARENT_FOLDER_ID;
+        }
+    }
+
+    if ((flags & (NOTIFICATION_OBJECT_CREATED | NOTIFICATION_OBJECT_MODIFIED)) != 0)
+    {
+        notification->TagCount = reader.Read<UShort>();
+        notification->Fields |= NOTIFICATION_FIELD_TAGS;
+        if (notification->TagCount != 0 && notification->TagCount != 0xFFFF)
+        {
+            notification->Tags = reader.Take((unsigned __int64)notification->TagCount * sizeof(ULong));
+        }
+    }
+
+    if ((flags & NOTIFICATION_FLAG_TOTAL_COUNT) != 0)
+    {
+        notification->TotalMessageCount = reader.Read<ULong>();
+        notification->Fields |= NOTIFICATION_FIELD_TOTAL_COUNT;
+    }
+
+    if ((flags & NOTIFICATION_FLAG_UNREAD_COUNT) != 0)
+    {
+        notification->UnreadMessageCount = reader.Read<ULong>();
+        notification->Fields |= NOTIFICATION_FIELD_UNREAD_COUNT;
+    }
+
+    if ((flags & NOTIFICATION_TYPE_MASK) == NOTIFICATION_NEW_MAIL)
+    {
+        notification->MessageFlags = reader.Read<ULong>();
+        notification->UnicodeFlag = reader.Read<Byte>();
+        notification->MessageClass = reader.TakeString(notification->UnicodeFlag != 0, notification->MessageClassSize);
+        notification->Fields |= NOTIFICATION_FIELD_NEW_MAIL;
+    }
+
+    if (reader.Failed())
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    if (consumed != NULL)
+    {
+        *consumed = (unsigned long)Notify::Response::Size + reader.Consumed(data + Notify::Response::Size);
+    }
+
+    return 0;
+}
+
+static NotificationNode *CreateNode(unsigned long capacity, bool pooled)
+{
+    NotificationNode *node = (NotificationNode *)_aligned_malloc(offsetof(NotificationNode, data) + capacity, MEMORY_ALLOCATION_ALIGNMENT);
+    if (node != NULL)
+    {
+        node->next = NULL;
+        node->size = 0;
+        node->pooled = pooled;
+    }
+
+    return node;
+}
+
+/// <summary>
+/// Take a queue entry for a notification of the given size from the pool, or allocate one.
+/// </summary>
+static NotificationNode *AcquireNode(NOTIFICATION_ENGINE *engine, unsigned long size)
+{
+    NotificationNode *node = NULL;
+    if (size <= PooledDataSize)
+    {
+        node = (NotificationNode *)InterlockedPopEntrySList(engine->pool);
+        if (node == NULL)
+        {
+            node = CreateNode(PooledDataSize, true);
+        }
+        else
+        {
+            return node;
+        }
+    }
+    else
+    {
+        node = CreateNode(size, false);
+    }
+
+    InterlockedIncrement(&engine->poolMisses);
+    return node;
+}
+
+static void ReleaseNode(NOTIFICATION_ENGINE *engine, NotificationNode *node)
+{
+    if (node->pooled)
+    {
+        InterlockedPushEntrySList(engine->pool, &node->poolEntry);
+    }
+    else
+    {
+        _aligned_free(node);
+    }
+}
+
+static void ReleaseSubscription(NotificationSubscription *subscription)
+{
+    if (InterlockedDecrement(&subscription->refCount) == 0)
+    {
+        _aligned_free(subscription->stub);
+        delete subscription;
+    }
+}
+
+/// <summary>
+/// Wake the threads waiting in NotificationEngineDrain. The lock orders the wake after a waiter's check of the counters.
+/// </summary>
+static void WakeIdle(NOTIFICATION_ENGINE *engine)
+{
+    AcquireSRWLockExclusive(&engine->idleLock);
+    WakeAllConditionVariable(&engine->idle);
+    ReleaseSRWLockExclusive(&engine->idleLock);
+}
+
+/// <summary>
+/// Deliver queued notifications of a subscription in order. The caller owns the queue until pending drops to 0.
+/// </summary>
+/// <returns>true if the queue is empty and the caller no longer owns it; false if the batch is used up.</returns>
+static bool DeliverBatch(NotificationSubscription *subscription)
+{
+    NOTIFICATION_ENGINE *engine = subscription->engine;
+    for (unsigned long i = 0; i < DeliveryBatchSize; i++)
+    {
+        NotificationNode *node = subscription->Pop();
+        while (node == NULL)
+        {
+            // pending is raised before the push is linked, so a short spin covers a producer between its exchange and its link.
+            YieldProcessor();
+            node = subscription->Pop();
+        }
+
+        // The entry was decoded when it was queued; decoding it again here is what lets the queue hold raw bytes only.
+        NOTIFICATION notification;
+        if (!subscription->removed && NotificationDecode(node->data, node->size, &notification, NULL) == 0)
+        {
+            subscription->routine(subscription->context, &notification);
+            InterlockedIncrement(&engine->delivered);
+        }
+        else
+        {
+            InterlockedIncrement(&engine->discarded);
+        }
+
+        ReleaseNode(engine, node);
+        if (InterlockedDecrement(&engine->queued) == 0)
+        {
+            WakeIdle(engine);
+        }
+
+        if (InterlockedDecrement(&subscription->pending) == 0)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static DWORD WINAPI DeliverProc(LPVOID parameter)
+{
+    NotificationSubscription *subscription = (NotificationSubscription *)parameter;
+    NOTIFICATION_ENGINE *engine = subscription->engine;
+    while (!DeliverBatch(subscription))
+    {
+        // Requeue so that other subscriptions get a turn; if that fails, keep delivering here rather than strand the queue.
+        if (QueueUserWorkItem(DeliverProc, subscription, WT_EXECUTEDEFAULT))
+        {
+            return 0;
+        }
+    }
+
+    ReleaseSubscription(subscription);
+
+    // Decrement under the lock, so that NotificationEngineDestroy cannot free the engine before the wake is done.
+    AcquireSRWLockExclusive(&engine->idleLock);
+    if (InterlockedDecrement(&engine->deliveries) == 0)
+    {
+        WakeAllConditionVariable(&engine->idle);
+    }
+
+    ReleaseSRWLockExclusive(&engine->idleLock);
+    return 0;
+}
+
+/// <summary>
+/// Append a queue entry to a subscription and schedule a work item if the subscription was idle.
+/// </summary>
+static void EnqueueNode(NotificationSubscription *subscription, NotificationNode *node)
+{
+    NOTIFICATION_ENGINE *engine = subscription->engine;
+    LONG queued = InterlockedIncrement(&engine->queued);
+    LONG maxQueued = engine->maxQueued;
+    while (queued > maxQueued)
+    {
+        LONG observed = InterlockedCompareExchange(&engine->maxQueued, queued, maxQueued);
+        if (observed == maxQueued)
+        {
+            break;
+        }
+
+        maxQueued = observed;
+    }
+
+    LONG depth = InterlockedIncrement(&subscription->pending);
+    subscription->Push(node);
+    if (depth == 1)
+    {
+        InterlockedIncrement(&subscription->refCount);
+        InterlockedIncrement(&engine->deliveries);
+        if (!QueueUserWorkItem(DeliverProc, subscription, WT_EXECUTEDEFAULT))
+        {
+            // Deliver on the feeding thread rather than lose the notifications.
+            DeliverProc(subscription);
+        }
+    }
+}
+
+/// <summary>
+/// Decode one RopNotify response and queue it for the subscription of its notification handle.
+/// </summary>
+static long EnqueueNotification(NOTIFICATION_ENGINE *engine, const unsigned char *data, unsigned long size, unsigned long *consumed)
+{
+    NOTIFICATION notification;
+    long status = NotificationDecode(data, size, &notification, consumed);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    NotificationSubscription *subscription = NULL;
+    AcquireSRWLockShared(&engine->subscriptionsLock);
+    std::map<unsigned long, NotificationSubscription *>::iterator found = engine->subscriptions.find(notification.NotificationHandle);
+    if (found == engine->subscriptions.end())
+    {
+        found = engine->subscriptions.find(NOTIFICATION_HANDLE_ANY);
+    }
+
+    if (found != engine->subscriptions.end())
+    {
+        subscription = found->second;
+        InterlockedIncrement(&subscription->refCount);
+    }
+
+    ReleaseSRWLockShared(&engine->subscriptionsLock);
+
+    InterlockedIncrement(&engine->received);
+    if (subscription == NULL)
+    {
+        InterlockedIncrement(&engine->unmatched);
+        return 0;
+    }
+
+    NotificationNode *node = AcquireNode(engine, *consumed);
+    if (node == NULL)
+    {
+        // The reader is not advanced, so the caller can feed the same response again.
+        InterlockedDecrement(&engine->received);
+        ReleaseSubscription(subscription);
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    memcpy(node->data, data, *consumed);
+    node->size = *consumed;
+    EnqueueNode(subscription, node);
+    ReleaseSubscription(subscription);
+    return 0;
+}
+
+static void SignalPending(NOTIFICATION_ENGINE *engine, unsigned short sessionIndex)
+{
+    InterlockedIncrement(&engine->pendingCount);
+    if (engine->pendingRoutine != NULL)
+    {
+        engine->pendingRoutine(engine->context, sessionIndex);
+    }
+}
+
+/// <summary>
+/// Create a notification engine.
+/// </summary>
+/// <param name="poolSize">The number of queue entries allocated up front. 0 means the default.</param>
+/// <param name="pendingRoutine">The routine invoked for RopPending responses and pending NotificationWait events; it can be NULL.</param>
+/// <param name="context">The caller context passed to pendingRoutine.</param>
+/// <param name="engine">Receives the engine.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall NotificationEngineCreate(
+    unsigned long poolSize,
+    NOTIFICATION_PENDING_ROUTINE pendingRoutine,
+    void *context,
+    NOTIFICATION_ENGINE **engine)
+{
+    if (engine == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    *engine = NULL;
+    NOTIFICATION_ENGINE *created = new (std::nothrow) NOTIFICATION_ENGINE();
+    if (created == NULL)
+    {
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    created->pool = (PSLIST_HEADER)_aligned_malloc(sizeof(SLIST_HEADER), MEMORY_ALLOCATION_ALIGNMENT);
+    if (created->pool == NULL)
+    {
+        delete created;
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    InitializeSListHead(created->pool);
+    InitializeSRWLock(&created->subscriptionsLock);
+    InitializeSRWLock(&created->idleLock);
+    InitializeConditionVariable(&created->idle);
+    created->pendingRoutine = pendingRoutine;
+    created->context = context;
+
+    for (unsigned long i = 0; i < (poolSize == 0 ? DefaultPoolSize : poolSize); i++)
+    {
+        NotificationNode *node = CreateNode(PooledDataSize, true);
+        if (node == NULL)
+        {
+            NotificationEngineDestroy(created);
+            return ERROR_NOT_ENOUGH_MEMORY;
+        }
+
+        InterlockedPushEntrySList(created->pool, &node->poolEntry);
+    }
+
+    *engine = created;
+    return 0;
+}
+
+/// <summary>
+/// Remove every subscription, wait for the work items in progress, and free the engine.
+/// It MUST NOT be called from a notification routine or while another thread feeds the engine.
+/// </summary>
+void __stdcall NotificationEngineDestroy(NOTIFICATION_ENGINE *engine)
+{
+    if (engine == NULL)
+    {
+        return;
+    }
+
+    AcquireSRWLockExclusive(&engine->subscriptionsLock);
+    for (std::map<unsigned long, NotificationSubscription *>::iterator it = engine->subscriptions.begin(); it != engine->subscriptions.end(); ++it)
+    {
+        InterlockedExchange(&it->second->removed, 1);
+        ReleaseSubscription(it->second);
+    }
+
+    engine->subscriptions.clear();
+    ReleaseSRWLockExclusive(&engine->subscriptionsLock);
+
+    NotificationEngineDrain(engine, INFINITE);
+
+    PSLIST_ENTRY entry;
+    while ((entry = InterlockedPopEntrySList(engine->pool)) != NULL)
+    {
+        _aligned_free(entry);
+    }
+
+    _aligned_free(engine->pool);
+    delete engine;
+}
+
+/// <summary>
+/// Subscribe to the notifications of a notification handle, the server object handle returned by RopRegisterNotification.
+/// </summary>
+/// <param name="notificationHandle">The notification handle, or NOTIFICATION_HANDLE_ANY for the handles without a subscription.</param>
+/// <param name="routine">The routine that receives the notifications.</param>
+/// <param name="context">The caller context passed to routine.</param>
+/// <returns>If success, it returns 0. ERROR_ALREADY_EXISTS indicates the handle already has a subscription.</returns>
+long __stdcall NotificationEngineSubscribe(
+    NOTIFICATION_ENGINE *engine,
+    unsigned long notificationHandle,
+    NOTIFICATION_ROUTINE routine,
+    void *context)
+{
+    if (engine == NULL || routine == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    NotificationSubscription *subscription = new (std::nothrow) NotificationSubscription();
+    if (subscription == NULL)
+    {
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    subscription->stub = CreateNode(0, false);
+    if (subscription->stub == NULL)
+    {
+        delete subscription;
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    subscription->engine = engine;
+    subscription->notificationHandle = notificationHandle;
+    subscription->routine = routine;
+    subscription->context = context;
+    subscription->head = subscription->stub;
+    subscription->tail = subscription->stub;
+    subscription->pending = 0;
+    subscription->refCount = 1;
+    subscription->removed = 0;
+
+    long status = 0;
+    AcquireSRWLockExclusive(&engine->subscriptionsLock);
+    if (engine->subscriptions.find(notificationHandle) != engine->subscriptions.end())
+    {
+        status = ERROR_ALREADY_EXISTS;
+    }
+    else
+    {
+        engine->subscriptions[notificationHandle] = subscription;
+    }
+
+    ReleaseSRWLockExclusive(&engine->subscriptionsLock);
+
+    if (status != 0)
+    {
+        ReleaseSubscription(subscription);
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Remove a subscription. Its queued notifications are discarded; a routine already running is not waited for.
+/// </summary>
+/// <returns>If success, it returns 0. ERROR_NOT_FOUND indicates the handle has no subscription.</returns>
+long __stdcall NotificationEngineUnsubscribe(NOTIFICATION_ENGINE *engine, unsigned long notificationHandle)
+{
+    if (engine == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    NotificationSubscription *subscription = NULL;
+    AcquireSRWLockExclusive(&engine->subscriptionsLock);
+    std::map<unsigned long, NotificationSubscription *>::iterator found = engine->subscriptions.find(notificationHandle);
+    if (found != engine->subscriptions.end())
+    {
+        subscription = found->second;
+        engine->subscriptions.erase(found);
+    }
+
+    ReleaseSRWLockExclusive(&engine->subscriptionsLock);
+
+    if (subscription == NULL)
+    {
+        return ERROR_NOT_FOUND;
+    }
+
+    InterlockedExchange(&subscription->removed, 1);
+    ReleaseSubscription(subscription);
+    return 0;
+}
+
+/// <summary>
+/// Queue the RopNotify responses and signal the RopPending responses at the position of a response reader, across
+/// RPC_HEADER_EXT buffers. It stops at the first other ROP response, which is left for the caller, or at the end of the response.
+/// </summary>
+/// <param name="reader">A reader positioned after the responses to the caller's own ROP requests.</param>
+/// <param name="count">Receives the number of RopNotify responses consumed; it can be NULL.</param>
+/// <returns>If success, it returns 0, else returns the error code. On failure the reader is positioned at the response that failed.</returns>
+long __stdcall NotificationEngineFeedReader(NOTIFICATION_ENGINE *engine, ROP_RESPONSE_READER *reader, unsigned long *count)
+{
+    if (engine == NULL || reader == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    long status = 0;
+    unsigned long fed = 0;
+    for (;;)
+    {
+        if (reader->Cursor >= reader->RopEnd)
+        {
+            status = RopResponseNextBuffer(reader);
+            if (status != 0)
+            {
+                if (status == ERROR_NO_MORE_ITEMS)
+                {
+                    status = 0;
+                }
+
+                break;
+            }
+
+            continue;
+        }
+
+        const unsigned char *rop = reader->Buffer + reader->Cursor;
+        unsigned long available = reader->RopEnd - reader->Cursor;
+        unsigned long consumed = 0;
+        if (rop[0] == Notify::Id)
+        {
+            status = EnqueueNotification(engine, rop, available, &consumed);
+            if (status != 0)
+            {
+                break;
+            }
+
+            fed++;
+        }
+        else if (rop[0] == Pending::Id)
+        {
+            if (available < Pending::Response::Size)
+            {
+                status = ERROR_INVALID_DATA;
+                break;
+            }
+
+            Byte ropId;
+            UShort sessionIndex;
+            Pending::Response::Read(rop, ropId, sessionIndex);
+            SignalPending(engine, sessionIndex);
+            consumed = (unsigned long)Pending::Response::Size;
+        }
+        else
+        {
+            break;
+        }
+
+        reader->Cursor += consumed;
+    }
+
+    if (count != NULL)
+    {
+        *count = fed;
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Queue the notifications of an EcDoRpcExt2 rgbOut buffer that holds only RopNotify and RopPending responses, such as
+/// the response to the call made after EcDoAsyncWaitEx reports pending notifications.
+/// </summary>
+/// <returns>If success, it returns 0. ERROR_INVALID_DATA indicates a response that is neither RopNotify nor RopPending.</returns>
+long __stdcall NotificationEngineFeedResponse(NOTIFICATION_ENGINE *engine, unsigned char *rgbOut, unsigned long cbOut, unsigned long *count)
+{
+    ROP_RESPONSE_READER reader;
+    long status = RopResponseBegin(&reader, rgbOut, cbOut);
+    if (status == 0)
+    {
+        status = NotificationEngineFeedReader(engine, &reader, count);
+    }
+
+    if (status == 0 && reader.Cursor < reader.RopEnd)
+    {
+        status = ERROR_INVALID_DATA;
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Read the body of a MAPI/HTTP NotificationWait response, after its meta-tags and headers, and signal a pending event.
+/// </summary>
+/// <param name="body">The binary response body.</param>
+/// <param name="size">The size of the body.</param>
+/// <param name="eventPending">Receives whether the server has notifications pending; it can be NULL.</param>
+/// <returns>If success, it returns 0; a non-zero StatusCode or ErrorCode of the response is returned as is.</returns>
+long __stdcall NotificationEngineFeedNotificationWait(
+    NOTIFICATION_ENGINE *engine,
+    const unsigned char *body,
+    unsigned long size,
+    BOOL *eventPending)
+{
+    if (engine == NULL || (body == NULL && size != 0))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (eventPending != NULL)
+    {
+        *eventPending = FALSE;
+    }
+
+    if (size < NotificationWaitResponse::Size)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    ULong statusCode, errorCode, flags, auxiliaryBufferSize;
+    NotificationWaitResponse::Read(body, statusCode, errorCode, flags, auxiliaryBufferSize);
+    if (statusCode != 0)
+    {
+        return (long)statusCode;
+    }
+
+    if (errorCode != 0)
+    {
+        return (long)errorCode;
+    }
+
+    if (auxiliaryBufferSize > size - NotificationWaitResponse::Size)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    if ((flags & NOTIFICATION_WAIT_EVENT_PENDING) != 0)
+    {
+        if (eventPending != NULL)
+        {
+            *eventPending = TRUE;
+        }
+
+        SignalPending(engine, NOTIFICATION_SESSION_ANY);
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Wait until every queued notification has been delivered or discarded.
+/// </summary>
+/// <param name="timeoutMilliseconds">The time to wait, or INFINITE.</param>
+/// <returns>If success, it returns 0. ERROR_TIMEOUT indicates notifications were still queued when the time ran out.</returns>
+long __stdcall NotificationEngineDrain(NOTIFICATION_ENGINE *engine, unsigned long timeoutMilliseconds)
+{
+    if (engine == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    long status = 0;
+    ULONGLONG start = GetTickCount64();
+    AcquireSRWLockExclusive(&engine->idleLock);
+    while (engine->queued != 0 || engine->deliveries != 0)
+    {
+        DWORD wait = INFINITE;
+        if (timeoutMilliseconds != INFINITE)
+        {
+            ULONGLONG elapsed = GetTickCount64() - start;
+            if (elapsed >= timeoutMilliseconds)
+            {
+                status = ERROR_TIMEOUT;
+                break;
+            }
+
+            wait = (DWORD)(timeoutMilliseconds - elapsed);
+        }
+
+        SleepConditionVariableSRW(&engine->idle, &engine->idleLock, wait, 0);
+    }
+
+    ReleaseSRWLockExclusive(&engine->idleLock);
+    return status;
+}
+
+long __stdcall NotificationEngineGetStats(NOTIFICATION_ENGINE *engine, NOTIFICATION_ENGINE_STATS *stats)
+{
+    if (engine == NULL || stats == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    stats->ReceivedCount = (unsigned long)engine->received;
+    stats->DeliveredCount = (unsigned long)engine->delivered;
+    stats->UnmatchedCount = (unsigned long)engine->unmatched;
+    stats->DiscardedCount = (unsigned long)engine->discarded;
+    stats->PendingCount = (unsigned long)engine->pendingCount;
+    stats->PoolMissCount = (unsigned long)engine->poolMisses;
+    stats->QueuedCount = (unsigned long)engine->queued;
+    stats->MaxQueuedCount = (unsigned long)engine->maxQueued;
+    return 0;
+}
@@ -0,0 +1,177 @@
+#pragma once
+
+#include "RopCodec.h"
+
+/// <summary>
+/// The NotificationType values of the NotificationFlags field, as specified in MS-OXCNOTIF section 2.2.1.4.1.1.
+/// </summary>
+#define NOTIFICATION_TYPE_MASK          0x0FFF
+#define NOTIFICATION_NEW_MAIL           0x0002
+#define NOTIFICATION_OBJECT_CREATED     0x0004
+#define NOTIFICATION_OBJECT_DELETED     0x0008
+#define NOTIFICATION_OBJECT_MODIFIED    0x0010
+#define NOTIFICATION_OBJECT_MOVED       0x0020
+#define NOTIFICATION_OBJECT_COPIED      0x0040
+#define NOTIFICATION_SEARCH_COMPLETE    0x0080
+#define NOTIFICATION_TABLE_MODIFIED     0x0100
+#define NOTIFICATION_ICS                0x0200
+#define NOTIFICATION_RESERVED           0x0400
+
+/// <summary>
+/// The bits of the NotificationFlags field above NotificationType: T, U, S and M.
+/// </summary>
+#define NOTIFICATION_FLAG_TOTAL_COUNT   0x1000
+#define NOTIFICATION_FLAG_UNREAD_COUNT  0x2000
+#define NOTIFICATION_FLAG_SEARCH_FOLDER 0x4000
+#define NOTIFICATION_FLAG_MESSAGE       0x8000
+
+/// <summary>
+/// The TableEventType values of a table-modified notification.
+/// </summary>
+#define TABLE_EVENT_CHANGED             0x0001
+#define TABLE_EVENT_ROW_ADDED           0x0003
+#define TABLE_EVENT_ROW_DELETED         0x0004
+#define TABLE_EVENT_ROW_MODIFIED        0x0005
+#define TABLE_EVENT_RESTRICTION_CHANGED 0x0007
+
+/// <summary>
+/// The bits of NOTIFICATION.Fields, one for each optional part of NotificationData that was present.
+/// </summary>
+#define NOTIFICATION_FIELD_TABLE_EVENT          0x00000001
+#define NOTIFICATION_FIELD_TABLE_ROW            0x00000002  // TableRowFolderId.
+#define NOTIFICATION_FIELD_TABLE_ROW_MESSAGE    0x00000004  // TableRowMessageId and TableRowInstance.
+#define NOTIFICATION_FIELD_INSERT_AFTER         0x00000008  // InsertAfterTableRowFolderId, TableRowDataSize and TableRowData.
+#define NOTIFICATION_FIELD_INSERT_AFTER_MESSAGE 0x00000010  // InsertAfterTableRowId and InsertAfterTableRowInstance.
+#define NOTIFICATION_FIELD_ICS                  0x00000020  // HierarchyChanged, FolderIdCount, FolderIds and IcsChangeNumbers.
+#define NOTIFICATION_FIELD_FOLDER_ID            0x00000040
+#define NOTIFICATION_FIELD_MESSAGE_ID           0x00000080
+#define NOTIFICATION_FIELD_PARENT_FOLDER_ID     0x00000100
+#define NOTIFICATION_FIELD_OLD_FOLDER_ID        0x00000200
+#define NOTIFICATION_FIELD_OLD_MESSAGE_ID       0x00000400
+#define NOTIFICATION_FIELD_OLD_PARENT_FOLDER_ID 0x00000800
+#define NOTIFICATION_FIELD_TAGS                 0x00001000  // TagCount, and Tags unless TagCount is 0 or 0xFFFF.
+#define NOTIFICATION_FIELD_TOTAL_COUNT          0x00002000
+#define NOTIFICATION_FIELD_UNREAD_COUNT         0x00004000
+#define NOTIFICATION_FIELD_NEW_MAIL             0x00008000  // MessageFlags, UnicodeFlag and MessageClass.
+
+/// <summary>
+/// The size of a LongTermId in the FolderIds array of an ICS notification: ReplGuid and GlobalCounter.
+/// </summary>
+#define NOTIFICATION_FOLDER_ID_SIZE 22
+
+/// <summary>
+/// The notification handle that subscribes to the notifications of every handle without a subscription of its own.
+/// </summary>
+#define NOTIFICATION_HANDLE_ANY 0xFFFFFFFF
+
+/// <summary>
+/// The session index passed to the pending routine for a NotificationWait response, which carries none.
+/// </summary>
+#define NOTIFICATION_SESSION_ANY 0xFFFF
+
+/// <summary>
+/// A decoded RopNotify response. The variable-size parts point into the decoded buffer; nothing is copied or allocated.
+/// Multi-byte arrays are unaligned little-endian values and are exposed as bytes.
+/// </summary>
+typedef struct _NOTIFICATION
+{
+    unsigned long NotificationHandle;
+    unsigned char LogonId;
+    unsigned short NotificationFlags;
+    unsigned long Fields;                       // A combination of the NOTIFICATION_FIELD bits.
+    unsigned short TableEventType;
+    unsigned __int64 TableRowFolderId;
+    unsigned __int64 TableRowMessageId;
+    unsigned long TableRowInstance;
+    unsigned __int64 InsertAfterTableRowFolderId;
+    unsigned __int64 InsertAfterTableRowId;
+    unsigned long InsertAfterTableRowInstance;
+    unsigned short TableRowDataSize;
+    const unsigned char *TableRowData;          // A PropertyRow in the columns of the table.
+    unsigned char HierarchyChanged;
+    unsigned long FolderIdCount;
+    const unsigned char *FolderIds;             // FolderIdCount entries of NOTIFICATION_FOLDER_ID_SIZE bytes.
+    const unsigned char *IcsChangeNumbers;      // FolderIdCount 32-bit values.
+    unsigned __int64 FolderId;
+    unsigned __int64 MessageId;
+    unsigned __int64 ParentFolderId;
+    unsigned __int64 OldFolderId;
+    unsigned __int64 OldMessageId;
+    unsigned __int64 OldParentFolderId;
+    unsigned short TagCount;
+    const unsigned char *Tags;                  // TagCount 32-bit property tags.
+    unsigned long TotalMessageCount;
+    unsigned long UnreadMessageCount;
+    unsigned long MessageFlags;
+    unsigned char UnicodeFlag;
+    const unsigned char *MessageClass;          // Null-terminated; UTF-16LE if UnicodeFlag is not 0.
+    unsigned long MessageClassSize;             // The size in bytes, including the terminator.
+} NOTIFICATION;
+
+/// <summary>
+/// The counters of a notification engine.
+/// </summary>
+typedef struct _NOTIFICATION_ENGINE_STATS
+{
+    unsigned long ReceivedCount;        // RopNotify responses decoded.
+    unsigned long DeliveredCount;       // Notifications passed to a subscriber.
+    unsigned long UnmatchedCount;       // Notifications of a handle without a subscription.
+    unsigned long DiscardedCount;       // Notifications still queued when their subscription was removed.
+    unsigned long PendingCount;         // RopPending responses and NotificationWait responses with a pending event.
+    unsigned long PoolMissCount;        // Queue entries that had to be allocated because the pool was empty or the notification too large.
+    unsigned long QueuedCount;          // Notifications queued and not yet delivered.
+    unsigned long MaxQueuedCount;       // The highest value QueuedCount has reached.
+} NOTIFICATION_ENGINE_STATS;
+
+/// <summary>
+/// Routine invoked on a thread pool thread for each notification of a subscription, in the order they were received.
+/// The notification and the buffers it points to are valid only until the routine returns.
+/// </summary>
+/// <param name="context">The caller context passed to NotificationEngineSubscribe.</param>
+/// <param name="notification">The decoded notification.</param>
+typedef void (__stdcall *NOTIFICATION_ROUTINE)(void *context, const NOTIFICATION *notification);
+
+/// <summary>
+/// Routine invoked on the feeding thread when the server reports that more notifications are pending.
+/// </summary>
+/// <param name="context">The caller context passed to NotificationEngineCreate.</param>
+/// <param name="sessionIndex">The SessionIndex of the RopPending response, or NOTIFICATION_SESSION_ANY.</param>
+typedef void (__stdcall *NOTIFICATION_PENDING_ROUTINE)(void *context, unsigned short sessionIndex);
+
+typedef struct _NOTIFICATION_ENGINE NOTIFICATION_ENGINE;
+
+long __stdcall NotificationDecode(
+    const unsigned char *data,
+    unsigned long size,
+    NOTIFICATION *notification,
+    unsigned long *consumed);
+
+long __stdcall NotificationEngineCreate(
+    unsigned long poolSize,
+    NOTIFICATION_PENDING_ROUTINE pendingRoutine,
+    void *context,
+    NOTIFICATION_ENGINE **engine);
+
+void __stdcall NotificationEngineDestroy(NOTIFICATION_ENGINE *engine);
+
+long __stdcall NotificationEngineSubscribe(
+    NOTIFICATION_ENGINE *engine,
+    unsigned long notificationHandle,
+    NOTIFICATION_ROUTINE routine,
+    void *context);
+
+long __stdcall NotificationEngineUnsubscribe(NOTIFICATION_ENGINE *engine, unsigned long notificationHandle);
+
+long __stdcall NotificationEngineFeedReader(NOTIFICATION_ENGINE *engine, ROP_RESPONSE_READER *reader, unsigned long *count);
+
+long __stdcall NotificationEngineFeedResponse(NOTIFICATION_ENGINE *engine, unsigned char *rgbOut, unsigned long cbOut, unsigned long *count);
+
+long __stdcall NotificationEngineFeedNotificationWait(
+    NOTIFICATION_ENGINE *engine,
+    const unsigned char *body,
+    unsigned long size,
+    BOOL *eventPending);
+
+long __stdcall NotificationEngineDrain(NOTIFICATION_ENGINE *engine, unsigned long timeoutMilliseconds);
+
+long __stdcall NotificationEngineGetStats(NOTIFICATION_ENGINE *engine, NOTIFICATION_ENGINE_STATS *stats);
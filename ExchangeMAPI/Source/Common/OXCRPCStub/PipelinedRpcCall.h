@@ -0,0 +1,176 @@
+#pragma once
+
+#include "AsyncRpcExt2.h"
+#include "RopCodec.h"
+#include "RpcExt2Flags.h"
+
+// EcDoRpcExt2 calls used in turn by the transfer engines: while the server processes one, the response of another
+// is consumed or its next request is produced. Only one of them is in flight at a time on a CXH.
+
+/// <summary>
+/// The largest ROP request buffer, RopSize included, as specified in MS-OXCRPC section 3.1.4.2.1.1.
+/// </summary>
+#define PIPELINED_MAX_REQUEST 0x8000
+
+/// <summary>
+/// The largest rgbOut buffer of an EcDoRpcExt2 call.
+/// </summary>
+#define PIPELINED_MAX_RESPONSE 0x40000
+
+/// <summary>
+/// The pulFlags of the pipelined calls: Chain, so that the server may return additional responses in chained buffers,
+/// and NoCompression.
+/// </summary>
+#define PIPELINED_RPC_FLAGS (RPCEXT2_FLAG_CHAIN | RPCEXT2_FLAG_NO_COMPRESSION)
+
+/// <summary>
+/// One EcDoRpcExt2 call and its buffers.
+/// </summary>
+struct PipelinedRpcCall
+{
+    HANDLE completed;
+    long reply;
+    bool pending;
+    unsigned long ulFlags;
+    unsigned long cbIn;
+    unsigned long cbOut;
+    unsigned long cbAuxOut;
+    unsigned long ulTransTime;
+    unsigned long ropCount;             // The number of ROP requests packed into rgbIn.
+    unsigned long bytesRequested;       // The bytes requested by, or sent with, the packed ROPs.
+    LARGE_INTEGER begun;                // QueryPerformanceCounter when the call was started.
+    LARGE_INTEGER finished;             // QueryPerformanceCounter when the call completed.
+    unsigned char rgbIn[PIPELINED_MAX_REQUEST + sizeof(RPC_HEADER_EXT)];
+    unsigned char rgbOut[PIPELINED_MAX_RESPONSE];
+    unsigned char rgbAuxOut[0x1008];
+};
+
+static void __stdcall PipelinedCallCompleted(void *context, long reply)
+{
+    PipelinedRpcCall *call = (PipelinedRpcCall *)context;
+    QueryPerformanceCounter(&call->finished);
+    call->reply = reply;
+    SetEvent(call->completed);
+}
+
+/// <summary>
+/// Start the EcDoRpcExt2 call of a prepared request buffer.
+/// </summary>
+inline long BeginPipelinedCall(CXH *pcxh, PipelinedRpcCall *call, unsigned long ulFlags)
+{
+    call->ulFlags = ulFlags;
+    call->cbOut = PIPELINED_MAX_RESPONSE;
+    call->cbAuxOut = sizeof(call->rgbAuxOut);
+    call->ulTransTime = 0;
+    call->reply = 0;
+    ResetEvent(call->completed);
+    QueryPerformanceCounter(&call->begun);
+
+    long status = EcDoRpcExt2Begin(
+        pcxh,
+        &call->ulFlags,
+        call->rgbIn,
+        call->cbIn,
+        call->rgbOut,
+        &call->cbOut,
+        NULL,
+        0,
+        call->rgbAuxOut,
+        &call->cbAuxOut,
+        &call->ulTransTime,
+        PipelinedCallCompleted,
+        call);
+    call->pending = status == 0;
+    return status;
+}
+
+/// <summary>
+/// Wait for the EcDoRpcExt2 call of a request buffer to complete.
+/// </summary>
+inline long EndPipelinedCall(PipelinedRpcCall *call)
+{
+    if (!call->pending)
+    {
+        return 0;
+    }
+
+    WaitForSingleObject(call->completed, INFINITE);
+    call->pending = false;
+    return call->reply;
+}
+
+/// <summary>
+/// Convert a QueryPerformanceCounter interval to milliseconds.
+/// </summary>
+inline unsigned long PipelinedElapsedMilliseconds(const LARGE_INTEGER &from, const LARGE_INTEGER &to)
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return (unsigned long)((to.QuadPart - from.QuadPart) * 1000 / frequency.QuadPart);
+}
+
+/// <summary>
+/// The calls of a transfer, indexed by the call sequence number.
+/// </summary>
+class PipelinedCallRing
+{
+public:
+    explicit PipelinedCallRing(unsigned long count)
+        : count(count < 2 ? 2 : count)
+    {
+        this->calls = new PipelinedRpcCall *[this->count];
+        for (unsigned long i = 0; i < this->count; i++)
+        {
+            this->calls[i] = new PipelinedRpcCall();
+            this->calls[i]->pending = false;
+            this->calls[i]->completed = CreateEvent(NULL, TRUE, FALSE, NULL);
+        }
+    }
+
+    ~PipelinedCallRing()
+    {
+        for (unsigned long i = 0; i < this->count; i++)
+        {
+            // Buffers of a pending call are still referenced by the RPC run-time library.
+            EndPipelinedCall(this->calls[i]);
+            if (this->calls[i]->completed != NULL)
+            {
+                CloseHandle(this->calls[i]->completed);
+            }
+
+            delete this->calls[i];
+        }
+
+        delete[] this->calls;
+    }
+
+    bool IsValid() const
+    {
+        for (unsigned long i = 0; i < this->count; i++)
+        {
+            if (this->calls[i]->completed == NULL)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    unsigned long Count() const
+    {
+        return this->count;
+    }
+
+    PipelinedRpcCall *operator[](unsigned long index)
+    {
+        return this->calls[index % this->count];
+    }
+
+private:
+    PipelinedCallRing(const PipelinedCallRing &);
+    PipelinedCallRing &operator=(const PipelinedCallRing &);
+
+    unsigned long count;
+    PipelinedRpcCall **calls;
+};
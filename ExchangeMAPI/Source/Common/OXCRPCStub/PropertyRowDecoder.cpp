@@ -0,0 +1,806 @@
+#include "PropertyRowDecoder.h"
+#include <emmintrin.h>
+#include <vector>
+
+// Decodes the PropertyRow structures of RopQueryRows and RopGetPropertiesSpecific responses, as specified in
+// MS-OXCDATA section 2.8.1, into one buffer per column. The column set is analyzed once: consecutive fixed-width
+// columns form a run that is bounds-checked once per row, and a column set without variable-width columns has a
+// constant row stride, so standard rows are transposed column by column without per-value checks.
+
+#define PTYP_UNSPECIFIED            0x0000
+#define PTYP_INTEGER16              0x0002
+#define PTYP_INTEGER32              0x0003
+#define PTYP_FLOATING32             0x0004
+#define PTYP_FLOATING64             0x0005
+#define PTYP_CURRENCY               0x0006
+#define PTYP_FLOATINGTIME           0x0007
+#define PTYP_ERRORCODE              0x000A
+#define PTYP_BOOLEAN                0x000B
+#define PTYP_INTEGER64              0x0014
+#define PTYP_STRING8                0x001E
+#define PTYP_STRING                 0x001F
+#define PTYP_TIME                   0x0040
+#define PTYP_GUID                   0x0048
+#define PTYP_SERVERID               0x00FB
+#define PTYP_RULEACTION             0x00FE
+#define PTYP_BINARY                 0x0102
+#define PTYP_MULTIPLE_FLAG          0x1000
+#define PTYP_MULTIPLE_STRING8       0x101E
+#define PTYP_MULTIPLE_STRING        0x101F
+#define PTYP_MULTIPLE_BINARY        0x1102
+
+#define ROW_FLAG_STANDARD           0x00
+#define ROW_FLAG_FLAGGED            0x01
+#define VALUE_FLAG_PRESENT          0x00
+#define VALUE_FLAG_NOT_PRESENT      0x01
+#define VALUE_FLAG_ERROR            0x0A
+
+/// <summary>
+/// A column of the decode plan and its output buffers.
+/// </summary>
+struct DecodeColumn
+{
+    unsigned long propertyTag;
+    unsigned short propertyType;
+    unsigned short fixedSize;
+    std::vector<unsigned char> values;
+    std::vector<ROW_VALUE_REF> refs;
+    std::vector<unsigned char> flags;
+};
+
+/// <summary>
+/// Consecutive columns that are all fixed-width, or a single variable-width column.
+/// </summary>
+struct DecodeRun
+{
+    unsigned short firstColumn;
+    unsigned short columnCount;
+    unsigned long width;                // The total width of a fixed-width run, or 0 for a variable-width column.
+};
+
+struct _ROW_DECODER
+{
+    std::vector<DecodeColumn> columns;
+    std::vector<DecodeRun> runs;
+    unsigned long rowCapacity;
+    unsigned long rowCount;
+    unsigned long fixedRowWidth;        // The width of a standard row if every column is fixed-width, else 0.
+    std::vector<unsigned long> rowOffsets;  // The offset of each decoded row, and of the end of the last one.
+};
+
+/// <summary>
+/// The width of a value of a fixed-width property type in a ROP buffer, or 0 for a variable-width type.
+/// </summary>
+static unsigned short FixedSizeOf(unsigned short propertyType)
+{
+    switch (propertyType)
+    {
+    case PTYP_BOOLEAN:
+        return 1;
+    case PTYP_INTEGER16:
+        return 2;
+    case PTYP_INTEGER32:
+    case PTYP_FLOATING32:
+    case PTYP_ERRORCODE:
+        return 4;
+    case PTYP_FLOATING64:
+    case PTYP_CURRENCY:
+    case PTYP_FLOATINGTIME:
+    case PTYP_INTEGER64:
+    case PTYP_TIME:
+        return 8;
+    case PTYP_GUID:
+        return 16;
+    default:
+        return 0;
+    }
+}
+
+/// <summary>
+/// Find the null terminator of a PtypString8 value with 16-byte compares.
+/// </summary>
+/// <returns>True if the terminator was found; size receives the length of the value including the terminator.</returns>
+static bool ScanString8(const unsigned char *data, unsigned long available, unsigned long *size)
+{
+    unsigned long index = 0;
+    const __m128i zero = _mm_setzero_si128();
+    for (; index + 16 <= available; index += 16)
+    {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(data + index)), zero));
+        if (mask != 0)
+        {
+            unsigned long bit;
+            _BitScanForward(&bit, (unsigned long)mask);
+            *size = index + bit + 1;
+            return true;
+        }
+    }
+
+    for (; index < available; index++)
+    {
+        if (data[index] == 0)
+        {
+            *size = index + 1;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// <summary>
+/// Find the null terminator of a PtypString value with 16-byte compares of eight UTF-16 code units at a time.
+/// </summary>
+/// <returns>True if the terminator was found; size receives the length of the value including the terminator.</returns>
+static bool ScanString(const unsigned char *data, unsigned long available, unsigned long *size)
+{
+    unsigned long index = 0;
+    const __m128i zero = _mm_setzero_si128();
+    for (; index + 16 <= available; index += 16)
+    {
+        // Both bytes of a matching code unit are set in the mask, so the lowest set bit is on a code unit boundary.
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(data + index)), zero));
+        if (mask != 0)
+        {
+            unsigned long bit;
+            _BitScanForward(&bit, (unsigned long)mask);
+            *size = index + bit + 2;
+            return true;
+        }
+    }
+
+    for (; index + 2 <= available; index += 2)
+    {
+        if (data[index] == 0 && data[index + 1] == 0)
+        {
+            *size = index + 2;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// <summary>
+/// Read a 16-bit COUNT field and check that count elements of elementSize bytes follow it.
+/// </summary>
+static bool MeasureCounted(const unsigned char *data, unsigned long available, unsigned long elementSize, unsigned long *size)
+{
+    unsigned short count;
+    if (available < sizeof(count))
+    {
+        return false;
+    }
+
+    memcpy(&count, data, sizeof(count));
+    unsigned long total = sizeof(count) + (unsigned long)count * elementSize;
+    if (total > available)
+    {
+        return false;
+    }
+
+    *size = total;
+    return true;
+}
+
+/// <summary>
+/// Measure a property value of the given type at the start of data, using the COUNT widths of ROP buffers.
+/// </summary>
+/// <returns>If success, it returns 0. ERROR_INVALID_DATA indicates the value is truncated; ERROR_NOT_SUPPORTED indicates a type the decoder does not handle.</returns>
+static long MeasureValue(unsigned short propertyType, const unsigned char *data, unsigned long available, unsigned long *size)
+{
+    unsigned short fixedSize = FixedSizeOf(propertyType);
+    if (fixedSize != 0)
+    {
+        if (fixedSize > available)
+        {
+            return ERROR_INVALID_DATA;
+        }
+
+        *size = fixedSize;
+        return 0;
+    }
+
+    switch (propertyType)
+    {
+    case PTYP_UNSPECIFIED:
+        {
+            // A TypedPropertyValue: the actual PropertyType precedes the value.
+            unsigned short actualType;
+            unsigned long valueSize;
+            if (available < sizeof(actualType))
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            memcpy(&actualType, data, sizeof(actualType));
+            if (actualType == PTYP_UNSPECIFIED)
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            long status = MeasureValue(actualType, data + sizeof(actualType), available - sizeof(actualType), &valueSize);
+            *size = sizeof(actualType) + valueSize;
+            return status;
+        }
+
+    case PTYP_STRING8:
+        return ScanString8(data, available, size) ? 0 : ERROR_INVALID_DATA;
+
+    case PTYP_STRING:
+        return ScanString(data, available, size) ? 0 : ERROR_INVALID_DATA;
+
+    case PTYP_BINARY:
+    case PTYP_SERVERID:
+        return MeasureCounted(data, available, 1, size) ? 0 : ERROR_INVALID_DATA;
+
+    case PTYP_RULEACTION:
+        {
+            // NoOfActions, then ActionLength and the action block for each action.
+            unsigned short actionCount;
+            unsigned long offset = sizeof(actionCount);
+            if (available < offset)
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            memcpy(&actionCount, data, sizeof(actionCount));
+            for (unsigned short i = 0; i < actionCount; i++)
+            {
+                unsigned long blockSize;
+                if (!MeasureCounted(data + offset, available - offset, 1, &blockSize))
+                {
+                    return ERROR_INVALID_DATA;
+                }
+
+                offset += blockSize;
+            }
+
+            *size = offset;
+            return 0;
+        }
+
+    case PTYP_MULTIPLE_STRING8:
+    case PTYP_MULTIPLE_STRING:
+        {
+            unsigned short count;
+            unsigned long offset = sizeof(count);
+            if (available < offset)
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            memcpy(&count, data, sizeof(count));
+            for (unsigned short i = 0; i < count; i++)
+            {
+                unsigned long stringSize;
+                bool found = propertyType == PTYP_MULTIPLE_STRING
+                    ? ScanString(data + offset, available - offset, &stringSize)
+                    : ScanString8(data + offset, available - offset, &stringSize);
+                if (!found)
+                {
+                    return ERROR_INVALID_DATA;
+                }
+
+                offset += stringSize;
+            }
+
+            *size = offset;
+            return 0;
+        }
+
+    case PTYP_MULTIPLE_BINARY:
+        {
+            // The only multi-valued type whose COUNT is 32 bits wide in ROP buffers.
+            uint32_t count;
+            unsigned long offset = sizeof(count);
+            if (available < offset)
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            memcpy(&count, data, sizeof(count));
+            for (uint32_t i = 0; i < count; i++)
+            {
+                unsigned long binarySize;
+                if (!MeasureCounted(data + offset, available - offset, 1, &binarySize))
+                {
+                    return ERROR_INVALID_DATA;
+                }
+
+                offset += binarySize;
+            }
+
+            *size = offset;
+            return 0;
+        }
+
+    default:
+        if ((propertyType & PTYP_MULTIPLE_FLAG) != 0 && FixedSizeOf(propertyType & ~PTYP_MULTIPLE_FLAG) != 0)
+        {
+            return MeasureCounted(data, available, FixedSizeOf(propertyType & ~PTYP_MULTIPLE_FLAG), size) ? 0 : ERROR_INVALID_DATA;
+        }
+
+        return ERROR_NOT_SUPPORTED;
+    }
+}
+
+/// <summary>
+/// Copy one fixed-width value.
+/// </summary>
+static inline void CopyFixed(unsigned char *destination, const unsigned char *source, unsigned short size)
+{
+    switch (size)
+    {
+    case 1:
+        *destination = *source;
+        break;
+    case 2:
+        memcpy(destination, source, 2);
+        break;
+    case 4:
+        memcpy(destination, source, 4);
+        break;
+    case 8:
+        memcpy(destination, source, 8);
+        break;
+    case 16:
+        _mm_storeu_si128((__m128i *)destination, _mm_loadu_si128((const __m128i *)source));
+        break;
+    default:
+        memcpy(destination, source, size);
+        break;
+    }
+}
+
+/// <summary>
+/// Transpose one fixed-width column out of rows with a constant stride.
+/// </summary>
+/// <param name="destination">The column buffer.</param>
+/// <param name="source">The first value of the column in the row block.</param>
+/// <param name="stride">The distance between two rows.</param>
+/// <param name="rows">The number of rows.</param>
+/// <param name="size">The width of a value.</param>
+static void GatherColumn(unsigned char *destination, const unsigned char *source, unsigned long stride, unsigned long rows, unsigned short size)
+{
+    unsigned long row = 0;
+    if (size == 4)
+    {
+        // Four values per 16-byte store.
+        for (; row + 4 <= rows; row += 4)
+        {
+            int values[4];
+            for (int i = 0; i < 4; i++)
+            {
+                memcpy(&values[i], source + (row + i) * stride, 4);
+            }
+
+            _mm_storeu_si128((__m128i *)(destination + row * 4), _mm_setr_epi32(values[0], values[1], values[2], values[3]));
+        }
+    }
+    else if (size == 8)
+    {
+        // Two values per 16-byte store.
+        for (; row + 2 <= rows; row += 2)
+        {
+            __m128i low = _mm_loadl_epi64((const __m128i *)(source + row * stride));
+            __m128i high = _mm_loadl_epi64((const __m128i *)(source + (row + 1) * stride));
+            _mm_storeu_si128((__m128i *)(destination + row * 8), _mm_unpacklo_epi64(low, high));
+        }
+    }
+
+    for (; row < rows; row++)
+    {
+        CopyFixed(destination + row * size, source + row * stride, size);
+    }
+}
+
+/// <summary>
+/// Decode a row block in which every column is fixed-width and every row is a StandardPropertyRow.
+/// </summary>
+/// <returns>True if the block has that shape; otherwise nothing is written and the general path is taken.</returns>
+static bool DecodeFixedRows(ROW_DECODER *decoder, const unsigned char *rowData, unsigned long cbRowData, unsigned long rowCount)
+{
+    unsigned long stride = 1 + decoder->fixedRowWidth;
+    if (decoder->fixedRowWidth == 0 || (unsigned __int64)stride * rowCount > cbRowData)
+    {
+        return false;
+    }
+
+    for (unsigned long row = 0; row < rowCount; row++)
+    {
+        if (rowData[row * stride] != ROW_FLAG_STANDARD)
+        {
+            return false;
+        }
+    }
+
+    unsigned long columnOffset = 1;
+    for (size_t i = 0; i < decoder->columns.size(); i++)
+    {
+        DecodeColumn &column = decoder->columns[i];
+        GatherColumn(&column.values[0], rowData + columnOffset, stride, rowCount, column.fixedSize);
+        memset(&column.flags[0], VALUE_FLAG_PRESENT, rowCount);
+        columnOffset += column.fixedSize;
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Decode the value of one column of one row at offset, and advance offset past it.
+/// </summary>
+static long DecodeValue(DecodeColumn &column, unsigned long row, unsigned short propertyType, const unsigned char *rowData, unsigned long cbRowData, unsigned long &offset, unsigned long refOffset)
+{
+    if (column.fixedSize != 0)
+    {
+        if (column.fixedSize > cbRowData - offset)
+        {
+            return ERROR_INVALID_DATA;
+        }
+
+        CopyFixed(&column.values[row * column.fixedSize], rowData + offset, column.fixedSize);
+        offset += column.fixedSize;
+        return 0;
+    }
+
+    unsigned long size;
+    long status = MeasureValue(propertyType, rowData + offset, cbRowData - offset, &size);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    offset += size;
+    column.refs[row].Offset = refOffset;
+    column.refs[row].Length = offset - refOffset;
+    return 0;
+}
+
+/// <summary>
+/// Decode a StandardPropertyRow, checking the bounds of each fixed-width run once.
+/// </summary>
+static long DecodeStandardRow(ROW_DECODER *decoder, unsigned long row, const unsigned char *rowData, unsigned long cbRowData, unsigned long &offset)
+{
+    for (size_t r = 0; r < decoder->runs.size(); r++)
+    {
+        const DecodeRun &run = decoder->runs[r];
+        if (run.width != 0)
+        {
+            if (run.width > cbRowData - offset)
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            for (unsigned short i = 0; i < run.columnCount; i++)
+            {
+                DecodeColumn &column = decoder->columns[run.firstColumn + i];
+                CopyFixed(&column.values[row * column.fixedSize], rowData + offset, column.fixedSize);
+                column.flags[row] = VALUE_FLAG_PRESENT;
+                offset += column.fixedSize;
+            }
+        }
+        else
+        {
+            DecodeColumn &column = decoder->columns[run.firstColumn];
+            long status = DecodeValue(column, row, column.propertyType, rowData, cbRowData, offset, offset);
+            if (status != 0)
+            {
+                return status;
+            }
+
+            column.flags[row] = VALUE_FLAG_PRESENT;
+        }
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Decode a FlaggedPropertyRow, in which every value is preceded by its Flag.
+/// For PtypUnspecified columns, the PropertyType precedes the Flag and the value reference starts at the type.
+/// </summary>
+static long DecodeFlaggedRow(ROW_DECODER *decoder, unsigned long row, const unsigned char *rowData, unsigned long cbRowData, unsigned long &offset)
+{
+    for (size_t i = 0; i < decoder->columns.size(); i++)
+    {
+        DecodeColumn &column = decoder->columns[i];
+        unsigned long refOffset = offset;
+        unsigned short propertyType = column.propertyType;
+        if (propertyType == PTYP_UNSPECIFIED)
+        {
+            if (cbRowData - offset < sizeof(propertyType))
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            memcpy(&propertyType, rowData + offset, sizeof(propertyType));
+            offset += sizeof(propertyType);
+        }
+
+        if (offset >= cbRowData)
+        {
+            return ERROR_INVALID_DATA;
+        }
+
+        unsigned char flag = rowData[offset++];
+        column.flags[row] = flag;
+        if (column.fixedSize != 0)
+        {
+            memset(&column.values[row * column.fixedSize], 0, column.fixedSize);
+        }
+
+        column.refs[row].Offset = 0;
+        column.refs[row].Length = 0;
+        switch (flag)
+        {
+        case VALUE_FLAG_PRESENT:
+            {
+                if (column.fixedSize == 0)
+                {
+                    // Measure the value only; for PtypUnspecified the reference covers the type, the flag and the value.
+                    unsigned long size;
+                    long status = MeasureValue(propertyType, rowData + offset, cbRowData - offset, &size);
+                    if (status != 0)
+                    {
+                        return status;
+                    }
+
+                    offset += size;
+                    column.refs[row].Offset = column.propertyType == PTYP_UNSPECIFIED ? refOffset : offset - size;
+                    column.refs[row].Length = offset - column.refs[row].Offset;
+                }
+                else
+                {
+                    long status = DecodeValue(column, row, propertyType, rowData, cbRowData, offset, offset);
+                    if (status != 0)
+                    {
+                        return status;
+                    }
+                }
+            }
+
+            break;
+
+        case VALUE_FLAG_NOT_PRESENT:
+            break;
+
+        case VALUE_FLAG_ERROR:
+            if (cbRowData - offset < sizeof(uint32_t))
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            column.refs[row].Offset = offset;
+            column.refs[row].Length = sizeof(uint32_t);
+            offset += sizeof(uint32_t);
+            break;
+
+        default:
+            return ERROR_INVALID_DATA;
+        }
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Create a decoder for the rows of a column set, as set by RopSetColumns or requested by RopGetPropertiesSpecific.
+/// </summary>
+/// <param name="propertyTags">The PropertyTagArray of the columns.</param>
+/// <param name="propertyTagCount">The number of columns.</param>
+/// <param name="rowCapacity">The maximum number of rows decoded at a time, typically the RowCount of RopQueryRows.</param>
+/// <param name="decoder">Receives the decoder; release it with RowDecoderDestroy.</param>
+/// <returns>If success, it returns 0. ERROR_NOT_SUPPORTED indicates a column type the decoder does not handle.</returns>
+long __stdcall RowDecoderCreate(const unsigned long *propertyTags, unsigned short propertyTagCount, unsigned long rowCapacity, ROW_DECODER **decoder)
+{
+    if (decoder == NULL || (propertyTags == NULL && propertyTagCount != 0) || rowCapacity == 0)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    ROW_DECODER *created = new ROW_DECODER();
+    created->rowCapacity = rowCapacity;
+    created->rowCount = 0;
+    created->fixedRowWidth = 0;
+    created->columns.resize(propertyTagCount);
+    created->rowOffsets.resize((size_t)rowCapacity + 1);
+
+    bool allFixed = propertyTagCount != 0;
+    for (unsigned short i = 0; i < propertyTagCount; i++)
+    {
+        DecodeColumn &column = created->columns[i];
+        column.propertyTag = propertyTags[i];
+        column.propertyType = (unsigned short)(propertyTags[i] & 0xFFFF);
+        column.fixedSize = FixedSizeOf(column.propertyType);
+
+        // Reject types the decoder cannot measure before any row is seen.
+        unsigned long size;
+        if (column.fixedSize == 0 && column.propertyType != PTYP_UNSPECIFIED && MeasureValue(column.propertyType, NULL, 0, &size) == ERROR_NOT_SUPPORTED)
+        {
+            delete created;
+            return ERROR_NOT_SUPPORTED;
+        }
+
+        if (column.fixedSize != 0)
+        {
+            column.values.resize((size_t)rowCapacity * column.fixedSize);
+            created->fixedRowWidth += column.fixedSize;
+            if (!created->runs.empty() && created->runs.back().width != 0)
+            {
+                created->runs.back().columnCount++;
+                created->runs.back().width += column.fixedSize;
+                column.refs.resize(rowCapacity);
+                column.flags.resize(rowCapacity);
+                continue;
+            }
+
+            DecodeRun run = { i, 1, column.fixedSize };
+            created->runs.push_back(run);
+        }
+        else
+        {
+            allFixed = false;
+            DecodeRun run = { i, 1, 0 };
+            created->runs.push_back(run);
+        }
+
+        column.refs.resize(rowCapacity);
+        column.flags.resize(rowCapacity);
+    }
+
+    if (!allFixed)
+    {
+        created->fixedRowWidth = 0;
+    }
+
+    *decoder = created;
+    return 0;
+}
+
+/// <summary>
+/// Release a decoder and its column buffers.
+/// </summary>
+void __stdcall RowDecoderDestroy(ROW_DECODER *decoder)
+{
+    delete decoder;
+}
+
+/// <summary>
+/// Decode a block of PropertyRow structures into the column buffers, replacing the rows decoded before.
+/// </summary>
+/// <param name="decoder">The decoder of the column set the rows were returned for.</param>
+/// <param name="rowData">The first PropertyRow; value references are relative to it.</param>
+/// <param name="cbRowData">The bytes available from rowData on.</param>
+/// <param name="rowCount">The number of rows to decode.</param>
+/// <param name="pcbConsumed">Receives the size of the decoded rows.</param>
+/// <returns>If success, it returns 0. ERROR_INSUFFICIENT_BUFFER indicates rowCount exceeds the row capacity of the decoder.</returns>
+long __stdcall RowDecoderDecode(ROW_DECODER *decoder, const unsigned char *rowData, unsigned long cbRowData, unsigned long rowCount, unsigned long *pcbConsumed)
+{
+    if (decoder == NULL || pcbConsumed == NULL || (rowData == NULL && cbRowData != 0))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (rowCount > decoder->rowCapacity)
+    {
+        return ERROR_INSUFFICIENT_BUFFER;
+    }
+
+    decoder->rowCount = 0;
+    if (DecodeFixedRows(decoder, rowData, cbRowData, rowCount))
+    {
+        for (unsigned long row = 0; row <= rowCount; row++)
+        {
+            decoder->rowOffsets[row] = row * (1 + decoder->fixedRowWidth);
+        }
+
+        decoder->rowCount = rowCount;
+        *pcbConsumed = rowCount * (1 + decoder->fixedRowWidth);
+        return 0;
+    }
+
+    unsigned long offset = 0;
+    for (unsigned long row = 0; row < rowCount; row++)
+    {
+        if (offset >= cbRowData)
+        {
+            return ERROR_INVALID_DATA;
+        }
+
+        long status;
+        decoder->rowOffsets[row] = offset;
+        unsigned char flag = rowData[offset++];
+        if (flag == ROW_FLAG_STANDARD)
+        {
+            status = DecodeStandardRow(decoder, row, rowData, cbRowData, offset);
+        }
+        else if (flag == ROW_FLAG_FLAGGED)
+        {
+            status = DecodeFlaggedRow(decoder, row, rowData, cbRowData, offset);
+        }
+        else
+        {
+            status = ERROR_INVALID_DATA;
+        }
+
+        if (status != 0)
+        {
+            return status;
+        }
+    }
+
+    decoder->rowOffsets[rowCount] = offset;
+    decoder->rowCount = rowCount;
+    *pcbConsumed = offset;
+    return 0;
+}
+
+/// <summary>
+/// Decode the rows of the RopQueryRows response just read with RopResponseReadRows, and consume them from the reader.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall RowDecoderDecodeQueryRows(ROW_DECODER *decoder, ROP_RESPONSE_READER *reader, ROP_ROWS_RESPONSE *response)
+{
+    if (decoder == NULL || reader == NULL || response == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (response->ReturnValue != 0)
+    {
+        decoder->rowCount = 0;
+        return 0;
+    }
+
+    unsigned long consumed = 0;
+    long status = RowDecoderDecode(decoder, response->RowData, response->RowDataAvailable, response->RowCount, &consumed);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    return RopResponseSkip(reader, consumed);
+}
+
+/// <summary>
+/// Return the buffers of a column. They stay valid until the decoder is destroyed and hold the rows of the last decode.
+/// </summary>
+long __stdcall RowDecoderGetColumn(ROW_DECODER *decoder, unsigned short column, ROW_COLUMN_BUFFER *buffer)
+{
+    if (decoder == NULL || buffer == NULL || column >= decoder->columns.size())
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    DecodeColumn &decoded = decoder->columns[column];
+    buffer->PropertyTag = decoded.propertyTag;
+    buffer->FixedSize = decoded.fixedSize;
+    buffer->Values = decoded.values.empty() ? NULL : &decoded.values[0];
+    buffer->Refs = &decoded.refs[0];
+    buffer->Flags = &decoded.flags[0];
+    return 0;
+}
+
+/// <summary>
+/// Return the number of rows of the last decode.
+/// </summary>
+unsigned long __stdcall RowDecoderGetRowCount(ROW_DECODER *decoder)
+{
+    return decoder == NULL ? 0 : decoder->rowCount;
+}
+
+/// <summary>
+/// Return the offsets of the rows of the last decode, relative to its row data: RowDecoderGetRowCount + 1 entries,
+/// the last of which is the end of the last row. They let a caller keep the PropertyRow bytes of single rows.
+/// </summary>
+long __stdcall RowDecoderGetRowOffsets(ROW_DECODER *decoder, const unsigned long **offsets)
+{
+    if (decoder == NULL || offsets == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    *offsets = &decoder->rowOffsets[0];
+    return 0;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "RopCodec.h"
+
+/// <summary>
+/// The location of a variable-width value, or of the error code of a flagged value, relative to the decoded row data.
+/// </summary>
+typedef struct _ROW_VALUE_REF
+{
+    unsigned long Offset;
+    unsigned long Length;
+} ROW_VALUE_REF;
+
+/// <summary>
+/// The columnar output of one column of a decoded row block. Every array has one entry per decoded row.
+/// </summary>
+typedef struct _ROW_COLUMN_BUFFER
+{
+    unsigned long PropertyTag;
+    unsigned short FixedSize;       // The width of a value in Values, or 0 if the column is variable-width.
+    unsigned char *Values;          // Fixed-width columns only: the values, FixedSize bytes each.
+    ROW_VALUE_REF *Refs;            // Variable-width values, and error codes of any column.
+    unsigned char *Flags;           // 0x00 if the value is present, 0x01 if it is not, 0x0A if Refs locates an error code.
+} ROW_COLUMN_BUFFER;
+
+typedef struct _ROW_DECODER ROW_DECODER;
+
+long __stdcall RowDecoderCreate(const unsigned long *propertyTags, unsigned short propertyTagCount, unsigned long rowCapacity, ROW_DECODER **decoder);
+
+void __stdcall RowDecoderDestroy(ROW_DECODER *decoder);
+
+long __stdcall RowDecoderDecode(ROW_DECODER *decoder, const unsigned char *rowData, unsigned long cbRowData, unsigned long rowCount, unsigned long *pcbConsumed);
+
+long __stdcall RowDecoderDecodeQueryRows(ROW_DECODER *decoder, ROP_RESPONSE_READER *reader, ROP_ROWS_RESPONSE *response);
+
+long __stdcall RowDecoderGetColumn(ROW_DECODER *decoder, unsigned short column, ROW_COLUMN_BUFFER *buffer);
+
+unsigned long __stdcall RowDecoderGetRowCount(ROW_DECODER *decoder);
+
+long __stdcall RowDecoderGetRowOffsets(ROW_DECODER *decoder, const unsigned long **offsets);
@@ -0,0 +1,1074 @@
+#include "RangeSet.h"
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <vector>
+
+// Sets of GLOBCNT values held as sorted, disjoint, non-adjacent ranges, so that a set of millions of change numbers
+// usually takes a handful of ranges. Insertion and removal are O(log n); union of two large sets is a linear merge.
+//
+// The GLOBSET command stream of MS-OXCFXICS section 2.2.2.6 is written straight from the ranges, and decoded by a
+// resumable decoder that accepts the stream in chunks of any size, such as the chunks of a FastTransfer lexer token.
+
+/// <summary>
+/// The GLOBSET commands.
+/// </summary>
+#define GLOBSET_END     0x00
+#define GLOBSET_BITMASK 0x42
+#define GLOBSET_POP     0x50
+#define GLOBSET_RANGE   0x52
+
+/// <summary>
+/// The size of a GLOBCNT, and of the largest GLOBSET command: a Range at an empty stack.
+/// </summary>
+#define GLOBCNT_SIZE 6
+#define GLOBSET_MAX_COMMAND (1 + 2 * GLOBCNT_SIZE)
+
+/// <summary>
+/// Ranges keyed by their low value, mapped to their high value.
+/// </summary>
+typedef std::map<unsigned __int64, unsigned __int64> RangeMap;
+
+struct _RANGE_SET
+{
+    RangeMap ranges;
+};
+
+struct _GLOBSET_DECODER
+{
+    RANGE_SET *set;
+    unsigned char prefix[GLOBCNT_SIZE];         // The common high-order bytes on the stack.
+    unsigned char depth;                        // The number of bytes on the stack.
+    unsigned char pushSizes[GLOBCNT_SIZE];      // The size of every push on the stack, for Pop.
+    unsigned char pushCount;
+    unsigned char pending[GLOBSET_MAX_COMMAND]; // The start of a command split over two chunks.
+    unsigned char pendingSize;
+    bool complete;
+};
+
+/// <summary>
+/// An entry of an IDSET: a REPLGUID or REPLID, and the GLOBCNT values of that replica.
+/// </summary>
+struct IdSetEntry
+{
+    unsigned char key[sizeof(GUID)];
+    RANGE_SET *set;
+};
+
+struct _ID_SET
+{
+    unsigned long keySize;                      // sizeof(GUID) for REPLGUID-based IDSETs, 2 for REPLID-based ones.
+    std::vector<IdSetEntry> entries;            // Sorted by key.
+};
+
+/// <summary>
+/// Byte index of a GLOBCNT, 0 being the high-order byte.
+/// </summary>
+static unsigned char GlobcntByte(unsigned __int64 globcnt, unsigned long index)
+{
+    return (unsigned char)(globcnt >> (8 * (GLOBCNT_SIZE - 1 - index)));
+}
+
+/// <summary>
+/// The number of high-order bytes two GLOBCNT values have in common.
+/// </summary>
+static unsigned long CommonPrefix(unsigned __int64 a, unsigned __int64 b)
+{
+    unsigned long count = 0;
+    while (count < GLOBCNT_SIZE && GlobcntByte(a, count) == GlobcntByte(b, count))
+    {
+        count++;
+    }
+
+    return count;
+}
+
+static void InsertRange(RangeMap &ranges, unsigned __int64 low, unsigned __int64 high)
+{
+    // Merge with a range that overlaps or touches the new one from below.
+    RangeMap::iterator it = ranges.upper_bound(low);
+    if (it != ranges.begin())
+    {
+        RangeMap::iterator previous = std::prev(it);
+        if (previous->second + 1 >= low)
+        {
+            low = previous->first;
+            high = std::max(high, previous->second);
+            ranges.erase(previous);
+        }
+    }
+
+    // Absorb the ranges that overlap or touch it from above.
+    while (it != ranges.end() && it->first <= high + 1)
+    {
+        high = std::max(high, it->second);
+        it = ranges.erase(it);
+    }
+
+    ranges.emplace_hint(it, low, high);
+}
+
+static void RemoveRange(RangeMap &ranges, unsigned __int64 low, unsigned __int64 high)
+{
+    RangeMap::iterator it = ranges.upper_bound(low);
+    if (it != ranges.begin() && std::prev(it)->second >= low)
+    {
+        --it;
+    }
+
+    // At most the first and the last overlapping ranges keep a part outside [low, high].
+    bool keepHead = false;
+    bool keepTail = false;
+    GLOBCNT_RANGE head = { 0, 0 };
+    GLOBCNT_RANGE tail = { 0, 0 };
+    while (it != ranges.end() && it->first <= high)
+    {
+        if (it->first < low)
+        {
+            keepHead = true;
+            head.Low = it->first;
+            head.High = low - 1;
+        }
+
+        if (it->second > high)
+        {
+            keepTail = true;
+            tail.Low = high + 1;
+            tail.High = it->second;
+        }
+
+        it = ranges.erase(it);
+    }
+
+    if (keepHead)
+    {
+        ranges.emplace(head.Low, head.High);
+    }
+
+    if (keepTail)
+    {
+        ranges.emplace(tail.Low, tail.High);
+    }
+}
+
+/// <summary>
+/// Writes a GLOBSET, or only measures it once the buffer is full.
+/// </summary>
+class GlobsetWriter
+{
+public:
+    GlobsetWriter(unsigned char *buffer, unsigned long capacity)
+        : buffer(buffer), capacity(buffer == NULL ? 0 : capacity), size(0)
+    {
+    }
+
+    void Byte(unsigned char value)
+    {
+        if (this->size < this->capacity)
+        {
+            this->buffer[this->size] = value;
+        }
+
+        this->size++;
+    }
+
+    /// <summary>
+    /// Write the bytes from index first up to index last, excluded, of a GLOBCNT.
+    /// </summary>
+    void Bytes(unsigned __int64 globcnt, unsigned long first, unsigned long last)
+    {
+        for (unsigned long i = first; i < last; i++)
+        {
+            this->Byte(GlobcntByte(globcnt, i));
+        }
+    }
+
+    unsigned long Size() const
+    {
+        return this->size;
+    }
+
+    bool Overflow() const
+    {
+        return this->size > this->capacity;
+    }
+
+private:
+    unsigned char *buffer;
+    unsigned long capacity;
+    unsigned long size;
+};
+
+/// <summary>
+/// Write one range below a stack of depth bytes: a Push that completes a GLOBCNT for a singleton, else a Range.
+/// </summary>
+static void EncodeRange(GlobsetWriter &writer, unsigned __int64 low, unsigned __int64 high, unsigned long depth)
+{
+    if (low == high)
+    {
+        writer.Byte((unsigned char)(GLOBCNT_SIZE - depth));
+        writer.Bytes(low, depth, GLOBCNT_SIZE);
+    }
+    else
+    {
+        writer.Byte(GLOBSET_RANGE);
+        writer.Bytes(low, depth, GLOBCNT_SIZE);
+        writer.Bytes(high, depth, GLOBCNT_SIZE);
+    }
+}
+
+/// <summary>
+/// Write ranges that differ in the low-order byte only; runs that span no more than 9 values take one Bitmask.
+/// </summary>
+static void EncodeLastByte(GlobsetWriter &writer, RangeMap::const_iterator first, RangeMap::const_iterator last)
+{
+    RangeMap::const_iterator it = first;
+    while (it != last)
+    {
+        unsigned __int64 start = it->first;
+        unsigned char bitmask = 0;
+        unsigned long count = 0;
+        RangeMap::const_iterator end = it;
+        while (end != last && end->second <= start + 8)
+        {
+            for (unsigned __int64 value = std::max(end->first, start + 1); value <= end->second; value++)
+            {
+                bitmask |= (unsigned char)(1 << (value - start - 1));
+            }
+
+            count++;
+            ++end;
+        }
+
+        if (count < 2)
+        {
+            EncodeRange(writer, it->first, it->second, GLOBCNT_SIZE - 1);
+            ++it;
+            continue;
+        }
+
+        writer.Byte(GLOBSET_BITMASK);
+        writer.Byte(GlobcntByte(start, GLOBCNT_SIZE - 1));
+        writer.Byte(bitmask);
+        it = end;
+    }
+}
+
+/// <summary>
+/// Write ranges that share the depth bytes on the stack. Ranges that also share following bytes are written below a
+/// Push of them; a range that spans several values of the next byte is written as a Range.
+/// </summary>
+static void EncodeRanges(GlobsetWriter &writer, RangeMap::const_iterator first, RangeMap::const_iterator last, unsigned long depth)
+{
+    if (std::next(first) == last)
+    {
+        EncodeRange(writer, first->first, first->second, depth);
+        return;
+    }
+
+    // The ranges are sorted, so the prefix of the lowest and highest values is common to all of them.
+    unsigned long common = CommonPrefix(first->first, std::prev(last)->second);
+    if (common > depth)
+    {
+        writer.Byte((unsigned char)(common - depth));
+        writer.Bytes(first->first, depth, common);
+        EncodeRanges(writer, first, last, common);
+        writer.Byte(GLOBSET_POP);
+        return;
+    }
+
+    if (depth == GLOBCNT_SIZE - 1)
+    {
+        EncodeLastByte(writer, first, last);
+        return;
+    }
+
+    RangeMap::const_iterator it = first;
+    while (it != last)
+    {
+        unsigned char value = GlobcntByte(it->first, depth);
+        if (GlobcntByte(it->second, depth) != value)
+        {
+            EncodeRange(writer, it->first, it->second, depth);
+            ++it;
+            continue;
+        }
+
+        RangeMap::const_iterator end = std::next(it);
+        while (end != last && GlobcntByte(end->first, depth) == value && GlobcntByte(end->second, depth) == value)
+        {
+            ++end;
+        }
+
+        EncodeRanges(writer, it, end, depth);
+        it = end;
+    }
+}
+
+static void EncodeGlobset(GlobsetWriter &writer, const RangeMap &ranges)
+{
+    if (!ranges.empty())
+    {
+        EncodeRanges(writer, ranges.begin(), ranges.end(), 0);
+    }
+
+    writer.Byte(GLOBSET_END);
+}
+
+/// <summary>
+/// The size of the command that starts with an operator, given the bytes on the stack; 0 if the command is not valid there.
+/// </summary>
+static unsigned long CommandSize(unsigned char command, unsigned long depth)
+{
+    if (command >= 0x01 && command <= GLOBCNT_SIZE)
+    {
+        return depth + command <= GLOBCNT_SIZE ? 1 + (unsigned long)command : 0;
+    }
+
+    switch (command)
+    {
+    case GLOBSET_END:
+    case GLOBSET_POP:
+        return 1;
+    case GLOBSET_BITMASK:
+        return depth == GLOBCNT_SIZE - 1 ? 3 : 0;
+    case GLOBSET_RANGE:
+        return 1 + 2 * (GLOBCNT_SIZE - depth);
+    default:
+        return 0;
+    }
+}
+
+/// <summary>
+/// The GLOBCNT made of the bytes on the stack followed by the given low-order bytes.
+/// </summary>
+static unsigned __int64 ComposeGlobcnt(const GLOBSET_DECODER *decoder, const unsigned char *bytes)
+{
+    unsigned __int64 globcnt = 0;
+    for (unsigned long i = 0; i < decoder->depth; i++)
+    {
+        globcnt = (globcnt << 8) | decoder->prefix[i];
+    }
+
+    for (unsigned long i = decoder->depth; i < GLOBCNT_SIZE; i++)
+    {
+        globcnt = (globcnt << 8) | bytes[i - decoder->depth];
+    }
+
+    return globcnt;
+}
+
+/// <summary>
+/// Apply one complete command.
+/// </summary>
+static long ExecuteCommand(GLOBSET_DECODER *decoder, const unsigned char *command)
+{
+    RangeMap &ranges = decoder->set->ranges;
+    switch (command[0])
+    {
+    case GLOBSET_END:
+        decoder->complete = true;
+        return 0;
+    case GLOBSET_POP:
+        if (decoder->pushCount == 0)
+        {
+            return ERROR_INVALID_DATA;
+        }
+
+        decoder->depth -= decoder->pushSizes[--decoder->pushCount];
+        return 0;
+    case GLOBSET_BITMASK:
+        {
+            unsigned char start = command[1];
+            unsigned char bitmask = command[2];
+            if ((unsigned long)start + 8 > 0xFF && (bitmask >> (0xFF - start)) != 0)
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            unsigned __int64 base = ComposeGlobcnt(decoder, &start);
+            InsertRange(ranges, base, base);
+            for (unsigned long i = 0; i < 8; i++)
+            {
+                if ((bitmask & (1 << i)) != 0)
+                {
+                    InsertRange(ranges, base + 1 + i, base + 1 + i);
+                }
+            }
+
+            return 0;
+        }
+    case GLOBSET_RANGE:
+        {
+            unsigned __int64 low = ComposeGlobcnt(decoder, command + 1);
+            unsigned __int64 high = ComposeGlobcnt(decoder, command + 1 + GLOBCNT_SIZE - decoder->depth);
+            if (low > high)
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            InsertRange(ranges, low, high);
+            return 0;
+        }
+    default:
+        {
+            // A Push; one that completes a GLOBCNT is a singleton and leaves the stack as it was.
+            unsigned char count = command[0];
+            if (decoder->depth + count == GLOBCNT_SIZE)
+            {
+                unsigned __int64 globcnt = ComposeGlobcnt(decoder, command + 1);
+                InsertRange(ranges, globcnt, globcnt);
+                return 0;
+            }
+
+            memcpy(decoder->prefix + decoder->depth, command + 1, count);
+            decoder->depth += count;
+            decoder->pushSizes[decoder->pushCount++] = count;
+            return 0;
+        }
+    }
+}
+
+static void ResetDecoder(GLOBSET_DECODER *decoder)
+{
+    decoder->depth = 0;
+    decoder->pushCount = 0;
+    decoder->pendingSize = 0;
+    decoder->complete = false;
+}
+
+/// <summary>
+/// Create an empty set of GLOBCNT values.
+/// </summary>
+/// <param name="set">Receives the set; release it with RangeSetDestroy.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall RangeSetCreate(RANGE_SET **set)
+{
+    if (set == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    *set = new RANGE_SET();
+    return 0;
+}
+
+void __stdcall RangeSetDestroy(RANGE_SET *set)
+{
+    delete set;
+}
+
+void __stdcall RangeSetClear(RANGE_SET *set)
+{
+    if (set != NULL)
+    {
+        set->ranges.clear();
+    }
+}
+
+/// <summary>
+/// Add an inclusive range of GLOBCNT values to a set.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall RangeSetInsert(RANGE_SET *set, unsigned __int64 low, unsigned __int64 high)
+{
+    if (set == NULL || low > high || high > GLOBCNT_MAX)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    InsertRange(set->ranges, low, high);
+    return 0;
+}
+
+/// <summary>
+/// Add the GLOBCNT values of MIDs, FIDs or CNs to a set. The IDs may come in any order.
+/// </summary>
+/// <param name="set">The set.</param>
+/// <param name="ids">The 8-byte IDs; their REPLIDs are ignored.</param>
+/// <param name="count">The number of IDs.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall RangeSetInsertIds(RANGE_SET *set, const unsigned __int64 *ids, unsigned long count)
+{
+    if (set == NULL || (ids == NULL && count != 0))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    // Sort first, so that consecutive values become one insertion.
+    std::vector<unsigned __int64> globcnts(count);
+    for (unsigned long i = 0; i < count; i++)
+    {
+        globcnts[i] = GlobcntFromId(ids[i]);
+    }
+
+    std::sort(globcnts.begin(), globcnts.end());
+    unsigned long i = 0;
+    while (i < count)
+    {
+        unsigned __int64 low = globcnts[i];
+        unsigned __int64 high = low;
+        while (++i < count && globcnts[i] <= high + 1)
+        {
+            high = globcnts[i];
+        }
+
+        InsertRange(set->ranges, low, high);
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Remove an inclusive range of GLOBCNT values from a set.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall RangeSetRemove(RANGE_SET *set, unsigned __int64 low, unsigned __int64 high)
+{
+    if (set == NULL || low > high)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    RemoveRange(set->ranges, low, high);
+    return 0;
+}
+
+BOOL __stdcall RangeSetContains(RANGE_SET *set, unsigned __int64 globcnt)
+{
+    if (set == NULL)
+    {
+        return FALSE;
+    }
+
+    RangeMap::const_iterator it = set->ranges.upper_bound(globcnt);
+    return it != set->ranges.begin() && std::prev(it)->second >= globcnt;
+}
+
+/// <summary>
+/// Add the values of one set to another.
+/// </summary>
+/// <param name="target">The set that receives the values.</param>
+/// <param name="source">The set whose values are added; it is not changed.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall RangeSetUnion(RANGE_SET *target, RANGE_SET *source)
+{
+    if (target == NULL || source == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (target == source)
+    {
+        return 0;
+    }
+
+    // A few ranges are inserted one by one; sets of comparable size are merged in one pass.
+    if (source->ranges.size() * 16 < target->ranges.size())
+    {
+        for (RangeMap::const_iterator it = source->ranges.begin(); it != source->ranges.end(); ++it)
+        {
+            InsertRange(target->ranges, it->first, it->second);
+        }
+
+        return 0;
+    }
+
+    RangeMap merged;
+    RangeMap::const_iterator a = target->ranges.begin();
+    RangeMap::const_iterator b = source->ranges.begin();
+    while (a != target->ranges.end() || b != source->ranges.end())
+    {
+        RangeMap::const_iterator next;
+        if (b == source->ranges.end() || (a != target->ranges.end() && a->first <= b->first))
+        {
+            next = a++;
+        }
+        else
+        {
+            next = b++;
+        }
+
+        // The ranges arrive sorted by low value, so only the last merged range can overlap or touch the next one.
+        if (!merged.empty())
+        {
+            RangeMap::iterator last = std::prev(merged.end());
+            if (last->second + 1 >= next->first)
+            {
+                last->second = std::max(last->second, next->second);
+                continue;
+            }
+        }
+
+        merged.emplace_hint(merged.end(), next->first, next->second);
+    }
+
+    target->ranges.swap(merged);
+    return 0;
+}
+
+/// <summary>
+/// Remove the values of one set from another.
+/// </summary>
+/// <param name="target">The set the values are removed from.</param>
+/// <param name="source">The set whose values are removed; it is not changed.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall RangeSetDifference(RANGE_SET *target, RANGE_SET *source)
+{
+    if (target == NULL || source == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (target == source)
+    {
+        target->ranges.clear();
+        return 0;
+    }
+
+    for (RangeMap::const_iterator it = source->ranges.begin(); it != source->ranges.end() && !target->ranges.empty(); ++it)
+    {
+        RemoveRange(target->ranges, it->first, it->second);
+    }
+
+    return 0;
+}
+
+unsigned long __stdcall RangeSetGetRangeCount(RANGE_SET *set)
+{
+    return set == NULL ? 0 : (unsigned long)set->ranges.size();
+}
+
+/// <summary>
+/// The number of GLOBCNT values in a set.
+/// </summary>
+unsigned __int64 __stdcall RangeSetGetCardinality(RANGE_SET *set)
+{
+    unsigned __int64 count = 0;
+    if (set != NULL)
+    {
+        for (RangeMap::const_iterator it = set->ranges.begin(); it != set->ranges.end(); ++it)
+        {
+            count += it->second - it->first + 1;
+        }
+    }
+
+    return count;
+}
+
+/// <summary>
+/// Copy the ranges of a set, in ascending order.
+/// </summary>
+/// <param name="set">The set.</param>
+/// <param name="ranges">The buffer that receives the ranges.</param>
+/// <param name="capacity">The number of ranges the buffer holds.</param>
+/// <param name="count">Receives the number of ranges of the set.</param>
+/// <returns>If success, it returns 0. ERROR_INSUFFICIENT_BUFFER indicates the buffer is too small; count is still set.</returns>
+long __stdcall RangeSetGetRanges(RANGE_SET *set, GLOBCNT_RANGE *ranges, unsigned long capacity, unsigned long *count)
+{
+    if (set == NULL || count == NULL || (ranges == NULL && capacity != 0))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    *count = (unsigned long)set->ranges.size();
+    if (*count > capacity)
+    {
+        return ERROR_INSUFFICIENT_BUFFER;
+    }
+
+    unsigned long i = 0;
+    for (RangeMap::const_iterator it = set->ranges.begin(); it != set->ranges.end(); ++it, i++)
+    {
+        ranges[i].Low = it->first;
+        ranges[i].High = it->second;
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Write a set as a GLOBSET, as specified in MS-OXCFXICS section 2.2.2.6.
+/// </summary>
+/// <param name="set">The set.</param>
+/// <param name="buffer">The buffer that receives the GLOBSET; NULL to only measure it.</param>
+/// <param name="capacity">The size of the buffer.</param>
+/// <param name="size">Receives the size of the GLOBSET.</param>
+/// <returns>If success, it returns 0. ERROR_INSUFFICIENT_BUFFER indicates the buffer is too small; size is still set.</returns>
+long __stdcall RangeSetEncode(RANGE_SET *set, unsigned char *buffer, unsigned long capacity, unsigned long *size)
+{
+    if (set == NULL || size == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    GlobsetWriter writer(buffer, capacity);
+    EncodeGlobset(writer, set->ranges);
+    *size = writer.Size();
+    return writer.Overflow() ? ERROR_INSUFFICIENT_BUFFER : 0;
+}
+
+/// <summary>
+/// Add the values of a complete GLOBSET to a set.
+/// </summary>
+/// <param name="set">The set.</param>
+/// <param name="data">The GLOBSET.</param>
+/// <param name="size">The bytes available from data on.</param>
+/// <param name="consumed">Receives the size of the GLOBSET, End command included.</param>
+/// <returns>If success, it returns 0. ERROR_INVALID_DATA indicates a malformed or truncated GLOBSET.</returns>
+long __stdcall RangeSetDecode(RANGE_SET *set, const unsigned char *data, unsigned long size, unsigned long *consumed)
+{
+    if (set == NULL || consumed == NULL || (data == NULL && size != 0))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    GLOBSET_DECODER decoder;
+    decoder.set = set;
+    ResetDecoder(&decoder);
+    long status = GlobsetDecoderFeed(&decoder, data, size, consumed);
+    if (status == 0 && !decoder.complete)
+    {
+        status = ERROR_INVALID_DATA;
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Create a decoder that adds the values of a GLOBSET, fed in chunks, to a set.
+/// </summary>
+/// <param name="set">The set the values are added to; it has to outlive the decoder.</param>
+/// <param name="decoder">Receives the decoder; release it with GlobsetDecoderDestroy.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall GlobsetDecoderCreate(RANGE_SET *set, GLOBSET_DECODER **decoder)
+{
+    if (set == NULL || decoder == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    *decoder = new GLOBSET_DECODER();
+    (*decoder)->set = set;
+    ResetDecoder(*decoder);
+    return 0;
+}
+
+void __stdcall GlobsetDecoderDestroy(GLOBSET_DECODER *decoder)
+{
+    delete decoder;
+}
+
+/// <summary>
+/// Decode the next chunk of a GLOBSET. A command split over two chunks is completed by the next call.
+/// </summary>
+/// <param name="decoder">The decoder.</param>
+/// <param name="data">The chunk.</param>
+/// <param name="size">The size of the chunk.</param>
+/// <param name="consumed">Receives the bytes of the chunk that belong to the GLOBSET; less than size once the End command is read.</param>
+/// <returns>If success, it returns 0. ERROR_INVALID_DATA indicates a malformed GLOBSET.</returns>
+long __stdcall GlobsetDecoderFeed(GLOBSET_DECODER *decoder, const unsigned char *data, unsigned long size, unsigned long *consumed)
+{
+    if (decoder == NULL || consumed == NULL || (data == NULL && size != 0))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    unsigned long offset = 0;
+    while (!decoder->complete && offset < size)
+    {
+        const unsigned char *command = data + offset;
+        unsigned char first = decoder->pendingSize != 0 ? decoder->pending[0] : data[offset];
+        unsigned long commandSize = CommandSize(first, decoder->depth);
+        if (commandSize == 0)
+        {
+            *consumed = offset;
+            return ERROR_INVALID_DATA;
+        }
+
+        // Complete a command started by the previous chunk, or keep the start of one that this chunk does not finish.
+        if (decoder->pendingSize != 0 || size - offset < commandSize)
+        {
+            unsigned long count = std::min(commandSize - decoder->pendingSize, size - offset);
+            memcpy(decoder->pending + decoder->pendingSize, data + offset, count);
+            decoder->pendingSize += (unsigned char)count;
+            offset += count;
+            if (decoder->pendingSize < commandSize)
+            {
+                break;
+            }
+
+            command = decoder->pending;
+            decoder->pendingSize = 0;
+        }
+        else
+        {
+            offset += commandSize;
+        }
+
+        long status = ExecuteCommand(decoder, command);
+        if (status != 0)
+        {
+            *consumed = offset;
+            return status;
+        }
+    }
+
+    *consumed = offset;
+    return 0;
+}
+
+/// <summary>
+/// Whether the End command of the GLOBSET was decoded.
+/// </summary>
+BOOL __stdcall GlobsetDecoderIsComplete(GLOBSET_DECODER *decoder)
+{
+    return decoder != NULL && decoder->complete ? TRUE : FALSE;
+}
+
+/// <summary>
+/// Create an empty IDSET, as specified in MS-OXCFXICS section 2.2.2.4.
+/// </summary>
+/// <param name="replGuid">TRUE if the replicas are identified by REPLGUIDs, FALSE if by REPLIDs.</param>
+/// <param name="idset">Receives the IDSET; release it with IdSetDestroy.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall IdSetCreate(BOOL replGuid, ID_SET **idset)
+{
+    if (idset == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    *idset = new ID_SET();
+    (*idset)->keySize = replGuid ? sizeof(GUID) : sizeof(unsigned short);
+    return 0;
+}
+
+void __stdcall IdSetDestroy(ID_SET *idset)
+{
+    if (idset == NULL)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < idset->entries.size(); i++)
+    {
+        RangeSetDestroy(idset->entries[i].set);
+    }
+
+    delete idset;
+}
+
+/// <summary>
+/// Find the position of a key among the sorted entries of an IDSET.
+/// </summary>
+static size_t FindEntry(const ID_SET *idset, const unsigned char *key, bool *found)
+{
+    size_t low = 0;
+    size_t high = idset->entries.size();
+    while (low < high)
+    {
+        size_t middle = (low + high) / 2;
+        int order = memcmp(idset->entries[middle].key, key, idset->keySize);
+        if (order == 0)
+        {
+            *found = true;
+            return middle;
+        }
+
+        if (order < 0)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    *found = false;
+    return low;
+}
+
+/// <summary>
+/// Get the set of GLOBCNT values of one replica of an IDSET.
+/// </summary>
+/// <param name="idset">The IDSET.</param>
+/// <param name="key">The REPLGUID, or the 2-byte little-endian REPLID, of the replica.</param>
+/// <param name="create">TRUE to add an empty set if the replica has none.</param>
+/// <param name="set">Receives the set; it belongs to the IDSET.</param>
+/// <returns>If success, it returns 0. ERROR_NOT_FOUND indicates the replica has no set and create is FALSE.</returns>
+long __stdcall IdSetGetRangeSet(ID_SET *idset, const unsigned char *key, BOOL create, RANGE_SET **set)
+{
+    if (idset == NULL || key == NULL || set == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    bool found;
+    size_t index = FindEntry(idset, key, &found);
+    if (!found)
+    {
+        if (!create)
+        {
+            return ERROR_NOT_FOUND;
+        }
+
+        IdSetEntry entry;
+        memset(entry.key, 0, sizeof(entry.key));
+        memcpy(entry.key, key, idset->keySize);
+        entry.set = new RANGE_SET();
+        idset->entries.insert(idset->entries.begin() + index, entry);
+    }
+
+    *set = idset->entries[index].set;
+    return 0;
+}
+
+unsigned long __stdcall IdSetGetCount(ID_SET *idset)
+{
+    return idset == NULL ? 0 : (unsigned long)idset->entries.size();
+}
+
+/// <summary>
+/// Get one replica of an IDSET, in key order.
+/// </summary>
+/// <param name="idset">The IDSET.</param>
+/// <param name="index">The index of the replica.</param>
+/// <param name="key">Receives the REPLGUID, or the 2-byte REPLID, of the replica.</param>
+/// <param name="set">Receives the set; it belongs to the IDSET.</param>
+/// <returns>If success, it returns 0. ERROR_NO_MORE_ITEMS indicates index is past the last replica.</returns>
+long __stdcall IdSetGetEntry(ID_SET *idset, unsigned long index, unsigned char *key, RANGE_SET **set)
+{
+    if (idset == NULL || key == NULL || set == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (index >= idset->entries.size())
+    {
+        return ERROR_NO_MORE_ITEMS;
+    }
+
+    memcpy(key, idset->entries[index].key, idset->keySize);
+    *set = idset->entries[index].set;
+    return 0;
+}
+
+/// <summary>
+/// Add the values of every replica of one IDSET to another of the same kind.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall IdSetUnion(ID_SET *target, ID_SET *source)
+{
+    if (target == NULL || source == NULL || target->keySize != source->keySize)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    for (size_t i = 0; i < source->entries.size(); i++)
+    {
+        RANGE_SET *set;
+        IdSetGetRangeSet(target, source->entries[i].key, TRUE, &set);
+        RangeSetUnion(set, source->entries[i].set);
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Remove the values of every replica of one IDSET from another of the same kind.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall IdSetDifference(ID_SET *target, ID_SET *source)
+{
+    if (target == NULL || source == NULL || target->keySize != source->keySize)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    for (size_t i = 0; i < source->entries.size(); i++)
+    {
+        RANGE_SET *set;
+        if (IdSetGetRangeSet(target, source->entries[i].key, FALSE, &set) == 0)
+        {
+            RangeSetDifference(set, source->entries[i].set);
+        }
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Write an IDSET: the REPLGUID or REPLID of every replica that has values, each followed by its GLOBSET.
+/// </summary>
+/// <param name="idset">The IDSET.</param>
+/// <param name="buffer">The buffer that receives the IDSET; NULL to only measure it.</param>
+/// <param name="capacity">The size of the buffer.</param>
+/// <param name="size">Receives the size of the IDSET.</param>
+/// <returns>If success, it returns 0. ERROR_INSUFFICIENT_BUFFER indicates the buffer is too small; size is still set.</returns>
+long __stdcall IdSetEncode(ID_SET *idset, unsigned char *buffer, unsigned long capacity, unsigned long *size)
+{
+    if (idset == NULL || size == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    GlobsetWriter writer(buffer, capacity);
+    for (size_t i = 0; i < idset->entries.size(); i++)
+    {
+        if (idset->entries[i].set->ranges.empty())
+        {
+            continue;
+        }
+
+        for (unsigned long k = 0; k < idset->keySize; k++)
+        {
+            writer.Byte(idset->entries[i].key[k]);
+        }
+
+        EncodeGlobset(writer, idset->entries[i].set->ranges);
+    }
+
+    *size = writer.Size();
+    return writer.Overflow() ? ERROR_INSUFFICIENT_BUFFER : 0;
+}
+
+/// <summary>
+/// Add the values of a serialized IDSET, such as the value of MetaTagIdsetGiven or MetaTagCnsetSeen, to an IDSET.
+/// </summary>
+/// <param name="idset">The IDSET.</param>
+/// <param name="data">The serialized IDSET.</param>
+/// <param name="size">The size of the serialized IDSET.</param>
+/// <returns>If success, it returns 0. ERROR_INVALID_DATA indicates a malformed IDSET.</returns>
+long __stdcall IdSetDecode(ID_SET *idset, const unsigned char *data, unsigned long size)
+{
+    if (idset == NULL || (data == NULL && size != 0))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    unsigned long offset = 0;
+    while (offset < size)
+    {
+        if (size - offset < idset->keySize)
+        {
+            return ERROR_INVALID_DATA;
+        }
+
+        RANGE_SET *set;
+        IdSetGetRangeSet(idset, data + offset, TRUE, &set);
+        offset += idset->keySize;
+
+        unsigned long consumed;
+        long status = RangeSetDecode(set, data + offset, size - offset, &consumed);
+        if (status != 0)
+        {
+            return status;
+        }
+
+        offset += consumed;
+    }
+
+    return 0;
+}
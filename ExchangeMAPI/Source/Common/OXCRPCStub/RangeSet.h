@@ -0,0 +1,91 @@
+#pragma once
+
+#include "CodecPlatform.h"
+
+/// <summary>
+/// The largest GLOBCNT value; a GLOBCNT is a 6-byte big-endian counter, as specified in MS-OXCFXICS section 2.2.2.5.
+/// </summary>
+#define GLOBCNT_MAX 0x0000FFFFFFFFFFFFULL
+
+/// <summary>
+/// An inclusive range of GLOBCNT values.
+/// </summary>
+typedef struct _GLOBCNT_RANGE
+{
+    unsigned __int64 Low;
+    unsigned __int64 High;
+} GLOBCNT_RANGE;
+
+/// <summary>
+/// The GLOBCNT of a MID, FID or CN: the six bytes after the 2-byte REPLID of the 8-byte little-endian ID.
+/// </summary>
+inline unsigned __int64 GlobcntFromId(unsigned __int64 id)
+{
+    unsigned __int64 globcnt = 0;
+    for (int i = 2; i < 8; i++)
+    {
+        globcnt = (globcnt << 8) | ((id >> (8 * i)) & 0xFF);
+    }
+
+    return globcnt;
+}
+
+typedef struct _RANGE_SET RANGE_SET;
+
+typedef struct _ID_SET ID_SET;
+
+typedef struct _GLOBSET_DECODER GLOBSET_DECODER;
+
+long __stdcall RangeSetCreate(RANGE_SET **set);
+
+void __stdcall RangeSetDestroy(RANGE_SET *set);
+
+void __stdcall RangeSetClear(RANGE_SET *set);
+
+long __stdcall RangeSetInsert(RANGE_SET *set, unsigned __int64 low, unsigned __int64 high);
+
+long __stdcall RangeSetInsertIds(RANGE_SET *set, const unsigned __int64 *ids, unsigned long count);
+
+long __stdcall RangeSetRemove(RANGE_SET *set, unsigned __int64 low, unsigned __int64 high);
+
+BOOL __stdcall RangeSetContains(RANGE_SET *set, unsigned __int64 globcnt);
+
+long __stdcall RangeSetUnion(RANGE_SET *target, RANGE_SET *source);
+
+long __stdcall RangeSetDifference(RANGE_SET *target, RANGE_SET *source);
+
+unsigned long __stdcall RangeSetGetRangeCount(RANGE_SET *set);
+
+unsigned __int64 __stdcall RangeSetGetCardinality(RANGE_SET *set);
+
+long __stdcall RangeSetGetRanges(RANGE_SET *set, GLOBCNT_RANGE *ranges, unsigned long capacity, unsigned long *count);
+
+long __stdcall RangeSetEncode(RANGE_SET *set, unsigned char *buffer, unsigned long capacity, unsigned long *size);
+
+long __stdcall RangeSetDecode(RANGE_SET *set, const unsigned char *data, unsigned long size, unsigned long *consumed);
+
+long __stdcall GlobsetDecoderCreate(RANGE_SET *set, GLOBSET_DECODER **decoder);
+
+void __stdcall GlobsetDecoderDestroy(GLOBSET_DECODER *decoder);
+
+long __stdcall GlobsetDecoderFeed(GLOBSET_DECODER *decoder, const unsigned char *data, unsigned long size, unsigned long *consumed);
+
+BOOL __stdcall GlobsetDecoderIsComplete(GLOBSET_DECODER *decoder);
+
+long __stdcall IdSetCreate(BOOL replGuid, ID_SET **idset);
+
+void __stdcall IdSetDestroy(ID_SET *idset);
+
+long __stdcall IdSetGetRangeSet(ID_SET *idset, const unsigned char *key, BOOL create, RANGE_SET **set);
+
+unsigned long __stdcall IdSetGetCount(ID_SET *idset);
+
+long __stdcall IdSetGetEntry(ID_SET *idset, unsigned long index, unsigned char *key, RANGE_SET **set);
+
+long __stdcall IdSetUnion(ID_SET *target, ID_SET *source);
+
+long __stdcall IdSetDifference(ID_SET *target, ID_SET *source);
+
+long __stdcall IdSetEncode(ID_SET *idset, unsigned char *buffer, unsigned long capacity, unsigned long *size);
+
+long __stdcall IdSetDecode(ID_SET *idset, const unsigned char *data, unsigned long size);
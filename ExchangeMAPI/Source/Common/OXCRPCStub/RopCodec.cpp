@@ -0,0 +1,548 @@
+#include "RopCodec.h"
+
+using namespace RopCodec;
+
+/// <summary>
+/// Rebuild a C++ writer over the state kept in a ROP_REQUEST_WRITER.
+/// </summary>
+static RopRequestWriter ResumeWriter(ROP_REQUEST_WRITER *writer)
+{
+    RopRequestWriter resumed(writer->Buffer, writer->Capacity, writer->Length);
+    if (writer->Overflow)
+    {
+        resumed.MarkOverflow();
+    }
+
+    return resumed;
+}
+
+/// <summary>
+/// Store the state of a C++ writer back into a ROP_REQUEST_WRITER.
+/// </summary>
+static long SuspendWriter(ROP_REQUEST_WRITER *writer, const RopRequestWriter &resumed, bool appended)
+{
+    if (!appended)
+    {
+        writer->Overflow = TRUE;
+        return ERROR_INSUFFICIENT_BUFFER;
+    }
+
+    writer->Length = resumed.Length();
+    return 0;
+}
+
+/// <summary>
+/// Start a ROP request buffer. The RPC_HEADER_EXT and RopSize fields are reserved and filled in by RopRequestEnd.
+/// </summary>
+/// <param name="writer">The writer state, owned by the caller.</param>
+/// <param name="buffer">The rgbIn buffer to write to.</param>
+/// <param name="capacity">The size of the buffer; at most 0x8008 bytes are sent in one EcDoRpcExt2 call.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall RopRequestBegin(ROP_REQUEST_WRITER *writer, unsigned char *buffer, unsigned long capacity)
+{
+    if (writer == NULL || buffer == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    writer->Buffer = buffer;
+    writer->Capacity = capacity;
+    RopRequestWriter resumed(buffer, capacity);
+    writer->Length = resumed.Length();
+    writer->Overflow = resumed.Remaining() == 0 ? TRUE : FALSE;
+    return writer->Overflow ? ERROR_INSUFFICIENT_BUFFER : 0;
+}
+
+/// <summary>
+/// Append an already serialized ROP request, for ROPs the codec has no layout for.
+/// </summary>
+/// <returns>If success, it returns 0. ERROR_INSUFFICIENT_BUFFER indicates the request does not fit; the writer stays unusable until RopRequestBegin is called again.</returns>
+long __stdcall RopRequestAppendRaw(ROP_REQUEST_WRITER *writer, const unsigned char *rop, unsigned long cbRop)
+{
+    if (writer == NULL || (rop == NULL && cbRop != 0))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    RopRequestWriter resumed = ResumeWriter(writer);
+    return SuspendWriter(writer, resumed, resumed.AppendBytes(rop, cbRop));
+}
+
+long __stdcall RopRequestAppendRelease(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex)
+{
+    if (writer == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    RopRequestWriter resumed = ResumeWriter(writer);
+    return SuspendWriter(writer, resumed, resumed.Append<Release>(logonId, inputHandleIndex));
+}
+
+/// <summary>
+/// Append a RopLogon request. The ESSDN is written with its null terminator, or omitted for a public folders logon.
+/// </summary>
+long __stdcall RopRequestAppendLogon(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char outputHandleIndex, unsigned char logonFlags, unsigned long openFlags, unsigned long storeState, const char *essdn)
+{
+    if (writer == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    size_t essdnSize = essdn == NULL ? 0 : strlen(essdn) + 1;
+    if (essdnSize > 0xFFFF)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    RopRequestWriter resumed = ResumeWriter(writer);
+    bool appended = resumed.Append<Logon>(logonId, outputHandleIndex, logonFlags, openFlags, storeState, (UShort)essdnSize)
+        && resumed.AppendBytes(essdn, essdnSize);
+    return SuspendWriter(writer, resumed, appended);
+}
+
+long __stdcall RopRequestAppendOpenFolder(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, unsigned char outputHandleIndex, unsigned __int64 folderId, unsigned char openModeFlags)
+{
+    if (writer == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    RopRequestWriter resumed = ResumeWriter(writer);
+    return SuspendWriter(writer, resumed, resumed.Append<OpenFolder>(logonId, inputHandleIndex, outputHandleIndex, folderId, openModeFlags));
+}
+
+long __stdcall RopRequestAppendGetContentsTable(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, unsigned char outputHandleIndex, unsigned char tableFlags)
+{
+    if (writer == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    RopRequestWriter resumed = ResumeWriter(writer);
+    return SuspendWriter(writer, resumed, resumed.Append<GetContentsTable>(logonId, inputHandleIndex, outputHandleIndex, tableFlags));
+}
+
+long __stdcall RopRequestAppendGetHierarchyTable(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, unsigned char outputHandleIndex, unsigned char tableFlags)
+{
+    if (writer == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    RopRequestWriter resumed = ResumeWriter(writer);
+    return SuspendWriter(writer, resumed, resumed.Append<GetHierarchyTable>(logonId, inputHandleIndex, outputHandleIndex, tableFlags));
+}
+
+long __stdcall RopRequestAppendGetPropertiesSpecific(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, unsigned short propertySizeLimit, unsigned short wantUnicode, unsigned short propertyTagCount, const unsigned long *propertyTags)
+{
+    if (writer == NULL || (propertyTags == NULL && propertyTagCount != 0))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    RopRequestWriter resumed = ResumeWriter(writer);
+    bool appended = resumed.Append<GetPropertiesSpecific>(logonId, inputHandleIndex, propertySizeLimit, wantUnicode, propertyTagCount)
+        && resumed.AppendULongs(propertyTags, propertyTagCount);
+    return SuspendWriter(writer, resumed, appended);
+}
+
+long __stdcall RopRequestAppendSetColumns(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, unsigned char setColumnsFlags, unsigned short propertyTagCount, const unsigned long *propertyTags)
+{
+    if (writer == NULL || (propertyTags == NULL && propertyTagCount != 0))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    RopRequestWriter resumed = ResumeWriter(writer);
+    bool appended = resumed.Append<SetColumns>(logonId, inputHandleIndex, setColumnsFlags, propertyTagCount)
+        && resumed.AppendULongs(propertyTags, propertyTagCount);
+    return SuspendWriter(writer, resumed, appended);
+}
+
+long __stdcall RopRequestAppendQueryRows(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, unsigned char queryRowsFlags, unsigned char forwardRead, unsigned short rowCount)
+{
+    if (writer == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    RopRequestWriter resumed = ResumeWriter(writer);
+    return SuspendWriter(writer, resumed, resumed.Append<QueryRows>(logonId, inputHandleIndex, queryRowsFlags, forwardRead, rowCount));
+}
+
+long __stdcall RopRequestAppendSeekRow(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, unsigned char origin, long rowCount, unsigned char wantRowMovedCount)
+{
+    if (writer == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    RopRequestWriter resumed = ResumeWriter(writer);
+    return SuspendWriter(writer, resumed, resumed.Append<SeekRow>(logonId, inputHandleIndex, origin, rowCount, wantRowMovedCount));
+}
+
+long __stdcall RopRequestAppendOpenStream(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, unsigned char outputHandleIndex, unsigned long propertyTag, unsigned char openModeFlags)
+{
+    if (writer == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    RopRequestWriter resumed = ResumeWriter(writer);
+    return SuspendWriter(writer, resumed, resumed.Append<OpenStream>(logonId, inputHandleIndex, outputHandleIndex, propertyTag, openModeFlags));
+}
+
+long __stdcall RopRequestAppendReadStream(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, unsigned short byteCount)
+{
+    // 0xBABE asks for MaximumByteCount, which the fixed layout does not carry; use RopRequestAppendRaw for it.
+    if (writer == NULL || byteCount == 0xBABE)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    RopRequestWriter resumed = ResumeWriter(writer);
+    return SuspendWriter(writer, resumed, resumed.Append<ReadStream>(logonId, inputHandleIndex, byteCount));
+}
+
+long __stdcall RopRequestAppendWriteStream(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, const unsigned char *data, unsigned short dataSize)
+{
+    if (writer == NULL || (data == NULL && dataSize != 0))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    RopRequestWriter resumed = ResumeWriter(writer);
+    bool appended = resumed.Append<WriteStream>(logonId, inputHandleIndex, dataSize)
+        && resumed.AppendBytes(data, dataSize);
+    return SuspendWriter(writer, resumed, appended);
+}
+
+/// <summary>
+/// Write the server object handle table and the RPC_HEADER_EXT of a ROP request buffer.
+/// </summary>
+/// <param name="writer">The writer state.</param>
+/// <param name="handles">The server object handle table.</param>
+/// <param name="handleCount">The number of handles in the table.</param>
+/// <param name="pcbIn">Receives the size to pass as cbIn to EcDoRpcExt2.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall RopRequestEnd(ROP_REQUEST_WRITER *writer, const unsigned long *handles, unsigned long handleCount, unsigned long *pcbIn)
+{
+    if (writer == NULL || pcbIn == NULL || (handles == NULL && handleCount != 0))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    RopRequestWriter resumed = ResumeWriter(writer);
+    unsigned long cbIn = resumed.Finish(handles, handleCount);
+    if (cbIn == 0)
+    {
+        writer->Overflow = TRUE;
+        return ERROR_INSUFFICIENT_BUFFER;
+    }
+
+    writer->Length = cbIn;
+    *pcbIn = cbIn;
+    return 0;
+}
+
+/// <summary>
+/// Rebuild a C++ reader positioned at the current ROP response of a ROP_RESPONSE_READER.
+/// </summary>
+static RopResponseReader ResumeReader(ROP_RESPONSE_READER *reader)
+{
+    return RopResponseReader(reader->Buffer + reader->Cursor, reader->Buffer + reader->RopEnd, reader->HandleCount);
+}
+
+/// <summary>
+/// Start reading the ROP responses of an EcDoRpcExt2 rgbOut buffer. Call RopResponseNextBuffer before the first ROP response.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall RopResponseBegin(ROP_RESPONSE_READER *reader, unsigned char *rgbOut, unsigned long cbOut)
+{
+    if (reader == NULL || (rgbOut == NULL && cbOut != 0))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    memset(reader, 0, sizeof(ROP_RESPONSE_READER));
+    reader->Buffer = rgbOut;
+    reader->Size = cbOut;
+    return 0;
+}
+
+/// <summary>
+/// Move to the next RPC_HEADER_EXT buffer of the response and reveal it in place if it is obfuscated. The buffer is
+/// walked by RopResponseReader::NextBuffer, so both interfaces apply the same bounds checks.
+/// </summary>
+/// <returns>If success, it returns 0. ERROR_NO_MORE_ITEMS indicates the Last buffer was already read; ERROR_NOT_SUPPORTED indicates a compressed buffer.</returns>
+long __stdcall RopResponseNextBuffer(ROP_RESPONSE_READER *reader)
+{
+    if (reader == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    RopResponseReader walker(reader->Buffer, reader->Size, reader->NextHeader, reader->Last != FALSE);
+    long status = walker.NextBuffer();
+    if (status != 0)
+    {
+        return status;
+    }
+
+    reader->Cursor = (unsigned long)(walker.Cursor() - reader->Buffer);
+    reader->RopEnd = (unsigned long)(walker.RopEnd() - reader->Buffer);
+    reader->HandleCount = walker.HandleCount();
+    reader->NextHeader = walker.NextHeader();
+    reader->Last = walker.IsLast() ? TRUE : FALSE;
+    return 0;
+}
+
+/// <summary>
+/// Read the RopId and ReturnValue of the next ROP response without consuming it.
+/// </summary>
+/// <returns>If success, it returns 0. ERROR_NO_MORE_ITEMS indicates there are no more ROP responses in the current buffer.</returns>
+long __stdcall RopResponsePeek(ROP_RESPONSE_READER *reader, unsigned char *ropId, unsigned long *returnValue)
+{
+    if (reader == NULL || ropId == NULL || returnValue == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (reader->Cursor >= reader->RopEnd)
+    {
+        return ERROR_NO_MORE_ITEMS;
+    }
+
+    // A response shorter than the common fields still reports its RopId; the caller decides whether it is valid.
+    *ropId = reader->Buffer[reader->Cursor];
+    *returnValue = 0;
+    ULong value = 0;
+    Byte id = 0;
+    if (ResumeReader(reader).Peek(id, value))
+    {
+        *returnValue = value;
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Consume bytes of the current ROP response, such as the rows decoded from a RopQueryRows response.
+/// </summary>
+long __stdcall RopResponseSkip(ROP_RESPONSE_READER *reader, unsigned long count)
+{
+    if (reader == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (count > reader->RopEnd - reader->Cursor)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    reader->Cursor += count;
+    return 0;
+}
+
+/// <summary>
+/// Read a server object handle of the current buffer.
+/// </summary>
+long __stdcall RopResponseGetHandle(ROP_RESPONSE_READER *reader, unsigned long index, unsigned long *handle)
+{
+    if (reader == NULL || handle == NULL || index >= reader->HandleCount)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    ULong value;
+    memcpy(&value, reader->Buffer + reader->RopEnd + index * sizeof(ULong), sizeof(ULong));
+    *handle = value;
+    return 0;
+}
+
+/// <summary>
+/// Read a ROP response that failed, or that consists of the common fields only.
+/// </summary>
+long __stdcall RopResponseReadHeader(ROP_RESPONSE_READER *reader, ROP_HANDLE_RESPONSE *response)
+{
+    if (reader == NULL || response == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    Byte ropId;
+    RopResponseReader resumed = ResumeReader(reader);
+    if (!resumed.ReadLayout<ResponseHeader>(ropId, response->HandleIndex, response->ReturnValue))
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    response->Value = 0;
+    reader->Cursor += ResponseHeader::Size;
+    return 0;
+}
+
+/// <summary>
+/// Read the fixed part of a response of the given ROP, or only its header if it failed.
+/// </summary>
+template <typename TRop, typename... TFields>
+static long ReadResponse(ROP_RESPONSE_READER *reader, Byte &handleIndex, unsigned long &returnValue, TFields &... fields)
+{
+    Byte ropId;
+    RopResponseReader resumed = ResumeReader(reader);
+    if (!resumed.ReadLayout<ResponseHeader>(ropId, handleIndex, returnValue) || ropId != TRop::Id)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    if (returnValue != 0)
+    {
+        reader->Cursor += ResponseHeader::Size;
+        return 0;
+    }
+
+    resumed = ResumeReader(reader);
+    if (!resumed.Read<TRop>(ropId, handleIndex, returnValue, fields...))
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    reader->Cursor += TRop::Response::Size;
+    return 0;
+}
+
+/// <summary>
+/// Read a RopOpenFolder response. The server list of a ghosted folder is left for the caller to skip.
+/// </summary>
+long __stdcall RopResponseReadOpenFolder(ROP_RESPONSE_READER *reader, ROP_HANDLE_RESPONSE *response, unsigned char *hasRules, unsigned char *isGhosted)
+{
+    if (reader == NULL || response == NULL || hasRules == NULL || isGhosted == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    *hasRules = 0;
+    *isGhosted = 0;
+    response->Value = 0;
+    return ReadResponse<OpenFolder>(reader, response->HandleIndex, response->ReturnValue, *hasRules, *isGhosted);
+}
+
+/// <summary>
+/// Read a RopGetContentsTable or RopGetHierarchyTable response; Value receives RowCount.
+/// </summary>
+long __stdcall RopResponseReadTable(ROP_RESPONSE_READER *reader, ROP_HANDLE_RESPONSE *response)
+{
+    if (reader == NULL || response == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    response->Value = 0;
+    if (reader->Cursor < reader->RopEnd && reader->Buffer[reader->Cursor] == GetHierarchyTable::Id)
+    {
+        return ReadResponse<GetHierarchyTable>(reader, response->HandleIndex, response->ReturnValue, response->Value);
+    }
+
+    return ReadResponse<GetContentsTable>(reader, response->HandleIndex, response->ReturnValue, response->Value);
+}
+
+/// <summary>
+/// Read a RopSetColumns response; Value receives TableStatus.
+/// </summary>
+long __stdcall RopResponseReadSetColumns(ROP_RESPONSE_READER *reader, ROP_HANDLE_RESPONSE *response)
+{
+    if (reader == NULL || response == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    Byte tableStatus = 0;
+    long status = ReadResponse<SetColumns>(reader, response->HandleIndex, response->ReturnValue, tableStatus);
+    response->Value = tableStatus;
+    return status;
+}
+
+/// <summary>
+/// Read a RopOpenStream response; Value receives StreamSize.
+/// </summary>
+long __stdcall RopResponseReadOpenStream(ROP_RESPONSE_READER *reader, ROP_HANDLE_RESPONSE *response)
+{
+    if (reader == NULL || response == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    response->Value = 0;
+    return ReadResponse<OpenStream>(reader, response->HandleIndex, response->ReturnValue, response->Value);
+}
+
+/// <summary>
+/// Read a RopReadStream response. Data points into rgbOut and stays valid as long as the buffer does.
+/// </summary>
+long __stdcall RopResponseReadReadStream(ROP_RESPONSE_READER *reader, ROP_STREAM_RESPONSE *response)
+{
+    if (reader == NULL || response == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    // DataSize and Data are present whatever the ReturnValue is.
+    Byte ropId;
+    RopResponseReader resumed = ResumeReader(reader);
+    if (!resumed.Read<ReadStream>(ropId, response->InputHandleIndex, response->ReturnValue, response->DataSize) || ropId != ReadStream::Id)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    response->Data = resumed.Take(response->DataSize);
+    if (response->Data == NULL)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    reader->Cursor += ReadStream::Response::Size + response->DataSize;
+    return 0;
+}
+
+/// <summary>
+/// Read a RopWriteStream response; DataSize receives WrittenSize.
+/// </summary>
+long __stdcall RopResponseReadWriteStream(ROP_RESPONSE_READER *reader, ROP_STREAM_RESPONSE *response)
+{
+    if (reader == NULL || response == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    Byte ropId;
+    RopResponseReader resumed = ResumeReader(reader);
+    if (!resumed.Read<WriteStream>(ropId, response->InputHandleIndex, response->ReturnValue, response->DataSize) || ropId != WriteStream::Id)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    response->Data = NULL;
+    reader->Cursor += WriteStream::Response::Size;
+    return 0;
+}
+
+/// <summary>
+/// Read the fixed part of a RopQueryRows response. The rows are not consumed: decode them from RowData with the
+/// column set of the table, then call RopResponseSkip with the number of bytes the rows occupied.
+/// </summary>
+long __stdcall RopResponseReadRows(ROP_RESPONSE_READER *reader, ROP_ROWS_RESPONSE *response)
+{
+    if (reader == NULL || response == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    response->Origin = 0;
+    response->RowCount = 0;
+    long status = ReadResponse<QueryRows>(reader, response->InputHandleIndex, response->ReturnValue, response->Origin, response->RowCount);
+    response->RowData = reader->Buffer + reader->Cursor;
+    response->RowDataAvailable = reader->RopEnd - reader->Cursor;
+    return status;
+}
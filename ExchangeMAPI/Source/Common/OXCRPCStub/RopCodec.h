@@ -0,0 +1,750 @@
+#pragma once
+
+#include "RpcHeaderExt.h"
+#include <string.h>
+
+// ROP request and response layouts described at compile time. A layout is the ordered list of the fixed-size fields
+// of a ROP, as specified in MS-OXCROPS; its size is a constant expression, and encoding or decoding a layout is a
+// sequence of little-endian stores or loads with no intermediate buffers. Variable-size parts, such as property tag
+// arrays or stream data, are written after the fixed part with RopRequestWriter::AppendBytes, and read in place.
+
+namespace RopCodec
+{
+    /// <summary>
+    /// The fixed-size fields of a ROP buffer, in wire order.
+    /// </summary>
+    template <typename... TFields>
+    struct Layout;
+
+    template <>
+    struct Layout<>
+    {
+        static constexpr size_t Size = 0;
+
+        static unsigned char *Write(unsigned char *cursor)
+        {
+            return cursor;
+        }
+
+        static const unsigned char *Read(const unsigned char *cursor)
+        {
+            return cursor;
+        }
+    };
+
+    template <typename TField, typename... TRest>
+    struct Layout<TField, TRest...>
+    {
+        static constexpr size_t Size = sizeof(TField) + Layout<TRest...>::Size;
+
+        static unsigned char *Write(unsigned char *cursor, TField value, TRest... rest)
+        {
+            memcpy(cursor, &value, sizeof(TField));
+            return Layout<TRest...>::Write(cursor + sizeof(TField), rest...);
+        }
+
+        template <typename TValue, typename... TValues>
+        static const unsigned char *Read(const unsigned char *cursor, TValue &value, TValues &... rest)
+        {
+            TField field;
+            memcpy(&field, cursor, sizeof(TField));
+            value = (TValue)field;
+            return Layout<TRest...>::Read(cursor + sizeof(TField), rest...);
+        }
+    };
+
+    // The field types have the width of the wire on every platform. On Windows, ULong stays unsigned long, which is 32
+    // bits there, so that callers can pass their unsigned long arrays and variables; elsewhere long is 64 bits.
+    typedef unsigned char Byte;
+    typedef unsigned short UShort;
+#ifdef _WIN32
+    typedef unsigned long ULong;
+    typedef long Long;
+#else
+    typedef uint32_t ULong;
+    typedef int32_t Long;
+#endif
+    typedef unsigned __int64 ULongLong;
+
+    /// <summary>
+    /// The fields every ROP response starts with: RopId, InputHandleIndex or OutputHandleIndex, and ReturnValue.
+    /// A response whose ReturnValue is not 0 contains only these fields, unless the ROP specifies otherwise.
+    /// </summary>
+    typedef Layout<Byte, Byte, ULong> ResponseHeader;
+
+    struct Release
+    {
+        static constexpr Byte Id = 0x01;
+
+        // RopId, LogonId, InputHandleIndex. RopRelease has no response.
+        typedef Layout<Byte, Byte, Byte> Request;
+    };
+
+    struct OpenFolder
+    {
+        static constexpr Byte Id = 0x02;
+
+        // RopId, LogonId, InputHandleIndex, OutputHandleIndex, FolderId, OpenModeFlags.
+        typedef Layout<Byte, Byte, Byte, Byte, ULongLong, Byte> Request;
+
+        // RopId, OutputHandleIndex, ReturnValue, HasRules, IsGhosted. Ghosted folders are followed by the server list.
+        typedef Layout<Byte, Byte, ULong, Byte, Byte> Response;
+    };
+
+    struct GetHierarchyTable
+    {
+        static constexpr Byte Id = 0x04;
+
+        // RopId, LogonId, InputHandleIndex, OutputHandleIndex, TableFlags.
+        typedef Layout<Byte, Byte, Byte, Byte, Byte> Request;
+
+        // RopId, OutputHandleIndex, ReturnValue, RowCount.
+        typedef Layout<Byte, Byte, ULong, ULong> Response;
+    };
+
+    struct GetContentsTable
+    {
+        static constexpr Byte Id = 0x05;
+
+        // RopId, LogonId, InputHandleIndex, OutputHandleIndex, TableFlags.
+        typedef Layout<Byte, Byte, Byte, Byte, Byte> Request;
+
+        // RopId, OutputHandleIndex, ReturnValue, RowCount.
+        typedef Layout<Byte, Byte, ULong, ULong> Response;
+    };
+
+    struct GetPropertiesSpecific
+    {
+        static constexpr Byte Id = 0x07;
+
+        // RopId, LogonId, InputHandleIndex, PropertySizeLimit, WantUnicode, PropertyTagCount. Followed by the property tags.
+        typedef Layout<Byte, Byte, Byte, UShort, UShort, UShort> Request;
+
+        // RopId, InputHandleIndex, ReturnValue. Followed by a PropertyRow.
+        typedef ResponseHeader Response;
+    };
+
+    struct SetColumns
+    {
+        static constexpr Byte Id = 0x12;
+
+        // RopId, LogonId, InputHandleIndex, SetColumnsFlags, PropertyTagCount. Followed by the property tags.
+        typedef Layout<Byte, Byte, Byte, Byte, UShort> Request;
+
+        // RopId, InputHandleIndex, ReturnValue, TableStatus.
+        typedef Layout<Byte, Byte, ULong, Byte> Response;
+    };
+
+    struct QueryRows
+    {
+        static constexpr Byte Id = 0x15;
+
+        // RopId, LogonId, InputHandleIndex, QueryRowsFlags, ForwardRead, RowCount.
+        typedef Layout<Byte, Byte, Byte, Byte, Byte, UShort> Request;
+
+        // RopId, InputHandleIndex, ReturnValue, Origin, RowCount. Followed by RowCount PropertyRow structures.
+        typedef Layout<Byte, Byte, ULong, Byte, UShort> Response;
+    };
+
+    struct QueryPosition
+    {
+        static constexpr Byte Id = 0x17;
+
+        // RopId, LogonId, InputHandleIndex.
+        typedef Layout<Byte, Byte, Byte> Request;
+
+        // RopId, InputHandleIndex, ReturnValue, Numerator, Denominator: the cursor position and the row count of the table.
+        typedef Layout<Byte, Byte, ULong, ULong, ULong> Response;
+    };
+
+    struct SeekRow
+    {
+        static constexpr Byte Id = 0x18;
+
+        // RopId, LogonId, InputHandleIndex, Origin, RowCount, WantRowMovedCount.
+        typedef Layout<Byte, Byte, Byte, Byte, Long, Byte> Request;
+
+        // RopId, InputHandleIndex, ReturnValue, HasSoughtLess, RowsSought.
+        typedef Layout<Byte, Byte, ULong, Byte, Long> Response;
+    };
+
+    struct Notify
+    {
+        static constexpr Byte Id = 0x2A;
+
+        // RopId, NotificationHandle, LogonId. Followed by NotificationData. RopNotify is a response without a request.
+        typedef Layout<Byte, ULong, Byte> Response;
+    };
+
+    struct OpenStream
+    {
+        static constexpr Byte Id = 0x2B;
+
+        // RopId, LogonId, InputHandleIndex, OutputHandleIndex, PropertyTag, OpenModeFlags.
+        typedef Layout<Byte, Byte, Byte, Byte, ULong, Byte> Request;
+
+        // RopId, OutputHandleIndex, ReturnValue, StreamSize.
+        typedef Layout<Byte, Byte, ULong, ULong> Response;
+    };
+
+    struct ReadStream
+    {
+        static constexpr Byte Id = 0x2C;
+
+        // RopId, LogonId, InputHandleIndex, ByteCount. A ByteCount of 0xBABE is followed by MaximumByteCount.
+        typedef Layout<Byte, Byte, Byte, UShort> Request;
+
+        // RopId, InputHandleIndex, ReturnValue, DataSize. Followed by DataSize bytes, also when ReturnValue is not 0.
+        typedef Layout<Byte, Byte, ULong, UShort> Response;
+    };
+
+    struct WriteStream
+    {
+        static constexpr Byte Id = 0x2D;
+
+        // RopId, LogonId, InputHandleIndex, DataSize. Followed by DataSize bytes.
+        typedef Layout<Byte, Byte, Byte, UShort> Request;
+
+        // RopId, InputHandleIndex, ReturnValue, WrittenSize. WrittenSize is present also when ReturnValue is not 0.
+        typedef Layout<Byte, Byte, ULong, UShort> Response;
+    };
+
+    struct FastTransferSourceGetBuffer
+    {
+        static constexpr Byte Id = 0x4E;
+
+        // RopId, LogonId, InputHandleIndex, BufferSize. A BufferSize of 0xBABE is followed by MaximumBufferSize.
+        typedef Layout<Byte, Byte, Byte, UShort> Request;
+
+        // RopId, InputHandleIndex, ReturnValue, TransferStatus, InProgressCount, TotalStepCount, Reserved, TransferBufferSize.
+        // Followed by TransferBufferSize bytes. A ReturnValue of 0x00000480 is followed by BackoffTime instead.
+        typedef Layout<Byte, Byte, ULong, UShort, UShort, UShort, Byte, UShort> Response;
+
+        static constexpr ULong ServerBusy = 0x00000480;
+    };
+
+    struct FastTransferDestinationPutBuffer
+    {
+        static constexpr Byte Id = 0x54;
+
+        // RopId, LogonId, InputHandleIndex, TransferDataSize. Followed by TransferDataSize bytes.
+        typedef Layout<Byte, Byte, Byte, UShort> Request;
+
+        // RopId, InputHandleIndex, ReturnValue, TransferStatus, InProgressCount, TotalStepCount, Reserved, BufferUsedSize.
+        // All fields are present whatever the ReturnValue is.
+        typedef Layout<Byte, Byte, ULong, UShort, UShort, UShort, Byte, UShort> Response;
+
+        static constexpr ULong ServerBusy = 0x00000480;
+    };
+
+    struct Pending
+    {
+        static constexpr Byte Id = 0x6E;
+
+        // RopId, SessionIndex. RopPending is a response without a request.
+        typedef Layout<Byte, UShort> Response;
+    };
+
+    struct SynchronizationUploadStateStreamBegin
+    {
+        static constexpr Byte Id = 0x75;
+
+        // RopId, LogonId, InputHandleIndex, StateProperty, TransferBufferSize.
+        typedef Layout<Byte, Byte, Byte, ULong, ULong> Request;
+
+        typedef ResponseHeader Response;
+    };
+
+    struct SynchronizationUploadStateStreamContinue
+    {
+        static constexpr Byte Id = 0x76;
+
+        // RopId, LogonId, InputHandleIndex, StreamDataSize. Followed by StreamDataSize bytes.
+        typedef Layout<Byte, Byte, Byte, ULong> Request;
+
+        typedef ResponseHeader Response;
+    };
+
+    struct SynchronizationUploadStateStreamEnd
+    {
+        static constexpr Byte Id = 0x77;
+
+        // RopId, LogonId, InputHandleIndex.
+        typedef Layout<Byte, Byte, Byte> Request;
+
+        typedef ResponseHeader Response;
+    };
+
+    struct FastTransferDestinationPutBufferExtended
+    {
+        static constexpr Byte Id = 0x9D;
+
+        // RopId, LogonId, InputHandleIndex, TransferDataSize. Followed by TransferDataSize bytes.
+        typedef Layout<Byte, Byte, Byte, UShort> Request;
+
+        // As RopFastTransferDestinationPutBuffer, with 32-bit InProgressCount and TotalStepCount.
+        typedef Layout<Byte, Byte, ULong, UShort, ULong, ULong, Byte, UShort> Response;
+
+        static constexpr ULong ServerBusy = 0x00000480;
+    };
+
+    struct Backoff
+    {
+        static constexpr Byte Id = 0xF9;
+
+        // RopId, LogonId, Duration, BackoffRopCount. Followed by BackoffRopCount RopId and Duration pairs, then
+        // AdditionalDataSize and the additional data. RopBackoff is a response without a request.
+        typedef Layout<Byte, Byte, ULong, Byte> Response;
+
+        // The RopIdBackoff and Duration of an entry of BackoffRopData.
+        typedef Layout<Byte, ULong> Entry;
+    };
+
+    struct Logon
+    {
+        static constexpr Byte Id = 0xFE;
+
+        // RopId, LogonId, OutputHandleIndex, LogonFlags, OpenFlags, StoreState, EssdnSize. Followed by the ESSDN.
+        typedef Layout<Byte, Byte, Byte, Byte, ULong, ULong, UShort> Request;
+
+        // RopId, OutputHandleIndex, ReturnValue, LogonFlags. A private mailbox logon is followed by the FolderIds and the rest of PrivateLogonTail.
+        typedef Layout<Byte, Byte, ULong, Byte> Response;
+
+        // FolderIds[13] are read separately; then ResponseFlags, MailboxGuid, ReplId, ReplGuid, LogonTime, GwartTime, StoreState.
+        static constexpr size_t FolderIdCount = 13;
+        static constexpr size_t PrivateTailSize = 1 + 16 + 2 + 16 + 8 + 8 + 4;
+    };
+
+    /// <summary>
+    /// Writes ROP requests directly into an EcDoRpcExt2 rgbIn buffer: one RPC_HEADER_EXT, the RopSize field,
+    /// the ROP requests and the server object handle table, as specified in MS-OXCRPC section 3.1.4.2.1.1.
+    /// </summary>
+    class RopRequestWriter
+    {
+    public:
+        /// <summary>
+        /// Start a request buffer, or resume one of which length bytes are already written.
+        /// </summary>
+        RopRequestWriter(unsigned char *buffer, unsigned long capacity, unsigned long length = 0)
+            : buffer(buffer), limit(buffer + capacity), cursor(buffer), overflow(false)
+        {
+            unsigned long reserved = sizeof(RPC_HEADER_EXT) + sizeof(UShort);
+            if (capacity < reserved || length > capacity)
+            {
+                this->overflow = true;
+            }
+            else
+            {
+                this->cursor = buffer + (length > reserved ? length : reserved);
+            }
+        }
+
+        /// <summary>
+        /// Append the fixed part of a ROP request. The RopId is filled in from the ROP definition.
+        /// </summary>
+        template <typename TRop, typename... TValues>
+        bool Append(TValues... values)
+        {
+            if (this->overflow || (size_t)(this->limit - this->cursor) < TRop::Request::Size)
+            {
+                this->overflow = true;
+                return false;
+            }
+
+            this->cursor = TRop::Request::Write(this->cursor, TRop::Id, values...);
+            return true;
+        }
+
+        /// <summary>
+        /// Append the variable part of the last ROP request.
+        /// </summary>
+        bool AppendBytes(const void *data, size_t size)
+        {
+            if (this->overflow || (size_t)(this->limit - this->cursor) < size)
+            {
+                this->overflow = true;
+                return false;
+            }
+
+            memcpy(this->cursor, data, size);
+            this->cursor += size;
+            return true;
+        }
+
+        /// <summary>
+        /// Append an array of 32-bit values, such as property tags, as ULong fields.
+        /// </summary>
+        bool AppendULongs(const unsigned long *values, size_t count)
+        {
+            if (this->overflow || (size_t)(this->limit - this->cursor) / sizeof(ULong) < count)
+            {
+                this->overflow = true;
+                return false;
+            }
+
+            for (size_t i = 0; i < count; i++)
+            {
+                ULong value = (ULong)values[i];
+                memcpy(this->cursor, &value, sizeof(ULong));
+                this->cursor += sizeof(ULong);
+            }
+
+            return true;
+        }
+
+        /// <summary>
+        /// Commit bytes already written at the current position, such as data read straight into the request buffer.
+        /// </summary>
+        bool Commit(size_t size)
+        {
+            if (this->overflow || (size_t)(this->limit - this->cursor) < size)
+            {
+                this->overflow = true;
+                return false;
+            }
+
+            this->cursor += size;
+            return true;
+        }
+
+        /// <summary>
+        /// Mark the buffer as too small, as a failed append does, so that every later call fails.
+        /// </summary>
+        void MarkOverflow()
+        {
+            this->overflow = true;
+        }
+
+        /// <summary>
+        /// The number of bytes still available for ROP requests, before the handle table is written.
+        /// </summary>
+        unsigned long Remaining() const
+        {
+            return this->overflow ? 0 : (unsigned long)(this->limit - this->cursor);
+        }
+
+        /// <summary>
+        /// The number of bytes written so far, including the RPC_HEADER_EXT and RopSize fields.
+        /// </summary>
+        unsigned long Length() const
+        {
+            return (unsigned long)(this->cursor - this->buffer);
+        }
+
+        /// <summary>
+        /// Write the server object handle table and fill in RopSize and the RPC_HEADER_EXT.
+        /// </summary>
+        /// <returns>The size of the request payload to pass as cbIn, or 0 if the buffer was too small.</returns>
+        unsigned long Finish(const unsigned long *handles, unsigned long handleCount)
+        {
+            unsigned long ropSize = (unsigned long)(this->cursor - this->buffer) - sizeof(RPC_HEADER_EXT);
+            if (this->overflow || ropSize > 0xFFFF || !this->AppendULongs(handles, handleCount))
+            {
+                return 0;
+            }
+
+            unsigned long payloadSize = (unsigned long)(this->cursor - this->buffer) - sizeof(RPC_HEADER_EXT);
+            if (payloadSize > 0xFFFF)
+            {
+                return 0;
+            }
+
+            RPC_HEADER_EXT header;
+            header.Version = 0x0000;
+            header.Flags = RHE_FLAG_LAST;
+            header.Size = (unsigned short)payloadSize;
+            header.SizeActual = header.Size;
+            memcpy(this->buffer, &header, sizeof(header));
+
+            UShort ropSizeField = (UShort)ropSize;
+            memcpy(this->buffer + sizeof(RPC_HEADER_EXT), &ropSizeField, sizeof(ropSizeField));
+            return (unsigned long)(this->cursor - this->buffer);
+        }
+
+    private:
+        unsigned char *buffer;
+        unsigned char *limit;
+        unsigned char *cursor;
+        bool overflow;
+    };
+
+    /// <summary>
+    /// Reads ROP responses in place from an EcDoRpcExt2 rgbOut buffer, one RPC_HEADER_EXT buffer at a time.
+    /// Obfuscated buffers are revealed in place; compressed buffers are not supported.
+    /// </summary>
+    class RopResponseReader
+    {
+    public:
+        RopResponseReader(unsigned char *buffer, unsigned long size)
+            : buffer(buffer), size(size), nextHeader(0), cursor(NULL), ropEnd(NULL), handleTable(NULL), handleCount(0), last(false)
+        {
+        }
+
+        /// <summary>
+        /// Resume walking the buffers of a response from the RPC_HEADER_EXT at nextHeader.
+        /// </summary>
+        RopResponseReader(unsigned char *buffer, unsigned long size, unsigned long nextHeader, bool last)
+            : buffer(buffer), size(size), nextHeader(nextHeader), cursor(NULL), ropEnd(NULL), handleTable(NULL), handleCount(0), last(last)
+        {
+        }
+
+        /// <summary>
+        /// Resume reading the ROP responses between cursor and ropEnd of a buffer that was already revealed.
+        /// </summary>
+        RopResponseReader(unsigned char *cursor, unsigned char *ropEnd, unsigned long handleCount)
+            : buffer(cursor), size(0), nextHeader(0), cursor(cursor), ropEnd(ropEnd), handleTable(ropEnd), handleCount(handleCount), last(true)
+        {
+        }
+
+        /// <summary>
+        /// Move to the next RPC_HEADER_EXT buffer.
+        /// </summary>
+        /// <returns>0 on success, ERROR_NO_MORE_ITEMS after the Last buffer, or the parse error.</returns>
+        long NextBuffer()
+        {
+            if (this->last || this->nextHeader >= this->size)
+            {
+                return ERROR_NO_MORE_ITEMS;
+            }
+
+            RPC_HEADER_EXT_BUFFER parsed;
+            long status = ParseRpcHeaderExt(this->buffer, this->size, this->nextHeader, &parsed);
+            if (status == 0)
+            {
+                status = RevealRpcHeaderExtPayload(&parsed);
+            }
+
+            if (status != 0)
+            {
+                return status;
+            }
+
+            UShort ropSize = 0;
+            if (parsed.Header.Size < sizeof(UShort))
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            memcpy(&ropSize, parsed.Payload, sizeof(UShort));
+            if (ropSize < sizeof(UShort) || ropSize > parsed.Header.Size || (parsed.Header.Size - ropSize) % sizeof(ULong) != 0)
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            this->cursor = parsed.Payload + sizeof(UShort);
+            this->ropEnd = parsed.Payload + ropSize;
+            this->handleTable = this->ropEnd;
+            this->handleCount = (parsed.Header.Size - ropSize) / sizeof(ULong);
+            this->nextHeader = parsed.Offset + sizeof(RPC_HEADER_EXT) + parsed.Header.Size;
+            this->last = (parsed.Header.Flags & RHE_FLAG_LAST) != 0;
+            return 0;
+        }
+
+        /// <summary>
+        /// The number of bytes of ROP responses left in the current buffer.
+        /// </summary>
+        unsigned long Remaining() const
+        {
+            return (unsigned long)(this->ropEnd - this->cursor);
+        }
+
+        /// <summary>
+        /// Read the RopId and ReturnValue of the next ROP response without consuming it.
+        /// </summary>
+        template <typename TValue>
+        bool Peek(Byte &ropId, TValue &returnValue) const
+        {
+            Byte handleIndex;
+            if (this->Remaining() < ResponseHeader::Size)
+            {
+                return false;
+            }
+
+            ResponseHeader::Read(this->cursor, ropId, handleIndex, returnValue);
+            return true;
+        }
+
+        /// <summary>
+        /// Read the fixed part of a ROP response of the given type.
+        /// </summary>
+        template <typename TRop, typename... TFields>
+        bool Read(TFields &... fields)
+        {
+            if (this->Remaining() < TRop::Response::Size)
+            {
+                return false;
+            }
+
+            this->cursor = (unsigned char *)TRop::Response::Read(this->cursor, fields...);
+            return true;
+        }
+
+        /// <summary>
+        /// Read a fixed layout that is not a whole ROP response, such as the header of a failed response.
+        /// </summary>
+        template <typename TLayout, typename... TFields>
+        bool ReadLayout(TFields &... fields)
+        {
+            if (this->Remaining() < TLayout::Size)
+            {
+                return false;
+            }
+
+            this->cursor = (unsigned char *)TLayout::Read(this->cursor, fields...);
+            return true;
+        }
+
+        /// <summary>
+        /// Consume a variable-size part and return a pointer to it in the response buffer.
+        /// </summary>
+        const unsigned char *Take(size_t count)
+        {
+            if (this->Remaining() < count)
+            {
+                return NULL;
+            }
+
+            const unsigned char *data = this->cursor;
+            this->cursor += count;
+            return data;
+        }
+
+        /// <summary>
+        /// The current position in the response buffer.
+        /// </summary>
+        const unsigned char *Cursor() const
+        {
+            return this->cursor;
+        }
+
+        /// <summary>
+        /// Return a server object handle of the current buffer.
+        /// </summary>
+        template <typename TValue>
+        bool GetHandle(unsigned long index, TValue &handle) const
+        {
+            if (index >= this->handleCount)
+            {
+                return false;
+            }
+
+            ULong value;
+            memcpy(&value, this->handleTable + index * sizeof(ULong), sizeof(ULong));
+            handle = (TValue)value;
+            return true;
+        }
+
+        unsigned long HandleCount() const
+        {
+            return this->handleCount;
+        }
+
+        /// <summary>
+        /// The end of the ROP responses of the current buffer, where its handle table starts.
+        /// </summary>
+        const unsigned char *RopEnd() const
+        {
+            return this->ropEnd;
+        }
+
+        /// <summary>
+        /// The offset of the next RPC_HEADER_EXT, and whether the current buffer is the Last one.
+        /// </summary>
+        unsigned long NextHeader() const
+        {
+            return this->nextHeader;
+        }
+
+        bool IsLast() const
+        {
+            return this->last;
+        }
+
+    private:
+        unsigned char *buffer;
+        unsigned long size;
+        unsigned long nextHeader;
+        unsigned char *cursor;
+        unsigned char *ropEnd;
+        unsigned char *handleTable;
+        unsigned long handleCount;
+        bool last;
+    };
+}
+
+// C interface for the managed side. The writer and reader structures are owned by the caller, typically on the stack
+// or pinned, and refer to caller-owned rgbIn and rgbOut buffers.
+
+typedef struct _ROP_REQUEST_WRITER
+{
+    unsigned char *Buffer;
+    unsigned long Capacity;
+    unsigned long Length;       // Bytes written so far, including the RPC_HEADER_EXT and RopSize fields.
+    BOOL Overflow;
+} ROP_REQUEST_WRITER;
+
+typedef struct _ROP_RESPONSE_READER
+{
+    unsigned char *Buffer;
+    unsigned long Size;
+    unsigned long NextHeader;   // The offset of the next RPC_HEADER_EXT.
+    unsigned long Cursor;       // The offset of the next ROP response.
+    unsigned long RopEnd;       // The offset where the ROP responses of the current buffer end.
+    unsigned long HandleCount;  // The number of server object handles that follow RopEnd.
+    BOOL Last;
+} ROP_RESPONSE_READER;
+
+typedef struct _ROP_STREAM_RESPONSE
+{
+    unsigned char InputHandleIndex;
+    unsigned long ReturnValue;
+    unsigned short DataSize;    // DataSize of RopReadStream, or WrittenSize of RopWriteStream.
+    const unsigned char *Data;  // RopReadStream only; points into rgbOut.
+} ROP_STREAM_RESPONSE;
+
+typedef struct _ROP_HANDLE_RESPONSE
+{
+    unsigned char HandleIndex;
+    unsigned long ReturnValue;
+    unsigned long Value;        // StreamSize of RopOpenStream, RowCount of RopGetContentsTable and RopGetHierarchyTable, TableStatus of RopSetColumns.
+} ROP_HANDLE_RESPONSE;
+
+typedef struct _ROP_ROWS_RESPONSE
+{
+    unsigned char InputHandleIndex;
+    unsigned long ReturnValue;
+    unsigned char Origin;
+    unsigned short RowCount;
+    const unsigned char *RowData;   // Points into rgbOut; pass to the row decoder and consume the decoded size with RopResponseSkip.
+    unsigned long RowDataAvailable; // The bytes left in the current buffer from RowData on.
+} ROP_ROWS_RESPONSE;
+
+long __stdcall RopRequestBegin(ROP_REQUEST_WRITER *writer, unsigned char *buffer, unsigned long capacity);
+long __stdcall RopRequestAppendRaw(ROP_REQUEST_WRITER *writer, const unsigned char *rop, unsigned long cbRop);
+long __stdcall RopRequestAppendRelease(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex);
+long __stdcall RopRequestAppendLogon(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char outputHandleIndex, unsigned char logonFlags, unsigned long openFlags, unsigned long storeState, const char *essdn);
+long __stdcall RopRequestAppendOpenFolder(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, unsigned char outputHandleIndex, unsigned __int64 folderId, unsigned char openModeFlags);
+long __stdcall RopRequestAppendGetContentsTable(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, unsigned char outputHandleIndex, unsigned char tableFlags);
+long __stdcall RopRequestAppendGetHierarchyTable(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, unsigned char outputHandleIndex, unsigned char tableFlags);
+long __stdcall RopRequestAppendGetPropertiesSpecific(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, unsigned short propertySizeLimit, unsigned short wantUnicode, unsigned short propertyTagCount, const unsigned long *propertyTags);
+long __stdcall RopRequestAppendSetColumns(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, unsigned char setColumnsFlags, unsigned short propertyTagCount, const unsigned long *propertyTags);
+long __stdcall RopRequestAppendQueryRows(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, unsigned char queryRowsFlags, unsigned char forwardRead, unsigned short rowCount);
+long __stdcall RopRequestAppendSeekRow(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, unsigned char origin, long rowCount, unsigned char wantRowMovedCount);
+long __stdcall RopRequestAppendOpenStream(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, unsigned char outputHandleIndex, unsigned long propertyTag, unsigned char openModeFlags);
+long __stdcall RopRequestAppendReadStream(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, unsigned short byteCount);
+long __stdcall RopRequestAppendWriteStream(ROP_REQUEST_WRITER *writer, unsigned char logonId, unsigned char inputHandleIndex, const unsigned char *data, unsigned short dataSize);
+long __stdcall RopRequestEnd(ROP_REQUEST_WRITER *writer, const unsigned long *handles, unsigned long handleCount, unsigned long *pcbIn);
+
+long __stdcall RopResponseBegin(ROP_RESPONSE_READER *reader, unsigned char *rgbOut, unsigned long cbOut);
+long __stdcall RopResponseNextBuffer(ROP_RESPONSE_READER *reader);
+long __stdcall RopResponsePeek(ROP_RESPONSE_READER *reader, unsigned char *ropId, unsigned long *returnValue);
+long __stdcall RopResponseSkip(ROP_RESPONSE_READER *reader, unsigned long count);
+long __stdcall RopResponseGetHandle(ROP_RESPONSE_READER *reader, unsigned long index, unsigned long *handle);
+long __stdcall RopResponseReadHeader(ROP_RESPONSE_READER *reader, ROP_HANDLE_RESPONSE *response);
+long __stdcall RopResponseReadOpenFolder(ROP_RESPONSE_READER *reader, ROP_HANDLE_RESPONSE *response, unsigned char *hasRules, unsigned char *isGhosted);
+long __stdcall RopResponseReadTable(ROP_RESPONSE_READER *reader, ROP_HANDLE_RESPONSE *response);
+long __stdcall RopResponseReadSetColumns(ROP_RESPONSE_READER *reader, ROP_HANDLE_RESPONSE *response);
+long __stdcall RopResponseReadOpenStream(ROP_RESPONSE_READER *reader, ROP_HANDLE_RESPONSE *response);
+long __stdcall RopResponseReadReadStream(ROP_RESPONSE_READER *reader, ROP_STREAM_RESPONSE *response);
+long __stdcall RopResponseReadWriteStream(ROP_RESPONSE_READER *reader, ROP_STREAM_RESPONSE *response);
+long __stdcall RopResponseReadRows(ROP_RESPONSE_READER *reader, ROP_ROWS_RESPONSE *response);
@@ -0,0 +1,451 @@
+#include "RpcCapture.h"
+#include "MappedFile.h"
+#include <map>
+#include <vector>
+
+// Capture of the EMSMDB calls of a process, for replay without a server. The traced routines of EcDoConnectEx,
+// EcDoRpcExt2, EcDoAsyncConnectEx and EcDoDisconnect, see TracedCalls, and EcDoAsyncWaitExWrap, report each call with its request,
+// response and timing. The calls are numbered by session: a connect starts a session, the calls on its CXH, or on an
+// ACXH created from it, continue it, and a call on a handle created before the capture started starts one without a
+// connect record. Each record is appended to a memory-mapped file that doubles when it is full, under one lock; the
+// capture copies whole buffers anyway, so it is meant for recording runs rather than for staying on like StubTrace.
+// While capturing is off a call only reads one flag.
+
+/// <summary>
+/// The size a capture file is created with; it doubles as records are added, and is cut to the records on stop.
+/// </summary>
+static const unsigned __int64 InitialFileSize = 16 * 1024 * 1024;
+
+static SRWLOCK m_captureLock = SRWLOCK_INIT;
+static volatile LONG m_capturing = 0;
+static MappedFile *m_file = NULL;
+static long m_writeError = 0;
+static unsigned __int64 m_dataSize = 0;
+static unsigned __int64 m_recordCount = 0;
+static unsigned __int64 m_startTime = 0;
+static LARGE_INTEGER m_frequency;
+static LARGE_INTEGER m_startCounter;
+static std::map<const void *, unsigned long> m_sessions;    // The session of each open CXH and ACXH.
+static std::vector<unsigned long> m_sequences;              // The next sequence of each session; session 0 is unused.
+
+/// <summary>
+/// Convert performance counter ticks to microseconds without overflow.
+/// </summary>
+static unsigned __int64 TicksToMicroseconds(unsigned __int64 ticks)
+{
+    unsigned __int64 frequency = (unsigned __int64)m_frequency.QuadPart;
+    return ticks / frequency * 1000000 + ticks % frequency * 1000000 / frequency;
+}
+
+/// <summary>
+/// Get the session of a handle, starting one if the handle is not known. Called with the capture lock held.
+/// </summary>
+static unsigned long FindSession(const void *handle)
+{
+    std::map<const void *, unsigned long>::const_iterator found = m_sessions.find(handle);
+    if (found != m_sessions.end())
+    {
+        return found->second;
+    }
+
+    unsigned long session = (unsigned long)m_sequences.size();
+    m_sequences.push_back(0);
+    if (handle != NULL)
+    {
+        m_sessions[handle] = session;
+    }
+
+    return session;
+}
+
+/// <summary>
+/// Forget the handles of a session once it is disconnected, so that a handle value the RPC runtime reuses starts a
+/// new session. Called with the capture lock held.
+/// </summary>
+static void CloseSession(unsigned long session)
+{
+    std::map<const void *, unsigned long>::iterator entry = m_sessions.begin();
+    while (entry != m_sessions.end())
+    {
+        if (entry->second == session)
+        {
+            entry = m_sessions.erase(entry);
+        }
+        else
+        {
+            ++entry;
+        }
+    }
+}
+
+/// <summary>
+/// Append a record and its payload to the capture file. A write failure stops the capture of further records and is
+/// returned by RpcCaptureStop.
+/// </summary>
+/// <param name="call">The call, with its kind, handle, request and start time.</param>
+/// <param name="record">The record, with its status and output fields set; the rest is filled in here.</param>
+/// <param name="response">The response, or NULL.</param>
+/// <param name="auxOut">The rgbAuxOut of the call, or NULL.</param>
+/// <param name="handle">The CXH of a connect, or the ACXH of an async connect, that joins the session.</param>
+static void AppendRecord(RPC_CAPTURE_CALL *call, RPC_CAPTURE_RECORD &record, const unsigned char *response, const unsigned char *auxOut, const void *handle)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    record.Kind = call->Kind;
+    record.StartTime = TicksToMicroseconds((unsigned __int64)(call->StartCounter.QuadPart - m_startCounter.QuadPart));
+    unsigned __int64 duration = TicksToMicroseconds((unsigned __int64)(now.QuadPart - call->StartCounter.QuadPart));
+    record.Duration = duration > 0xFFFFFFFF ? 0xFFFFFFFF : (unsigned long)duration;
+    record.FlagsIn = call->FlagsIn;
+    record.RequestSize = call->Request != NULL ? call->RequestSize : 0;
+    if (response == NULL)
+    {
+        record.ResponseSize = 0;
+    }
+
+    if (auxOut == NULL)
+    {
+        record.AuxOutSize = 0;
+    }
+
+    unsigned __int64 size = sizeof(RPC_CAPTURE_RECORD) + (unsigned __int64)record.RequestSize + record.ResponseSize + record.AuxOutSize;
+    size = (size + 7) & ~(unsigned __int64)7;
+    if (size > 0xFFFFFFFF)
+    {
+        return;
+    }
+
+    record.Size = (unsigned long)size;
+    AcquireSRWLockExclusive(&m_captureLock);
+    if (m_capturing && m_writeError == 0)
+    {
+        if (call->Kind == RPC_CAPTURE_CONNECT)
+        {
+            record.Session = FindSession(NULL);
+            if (record.Status == 0 && handle != NULL)
+            {
+                m_sessions[handle] = record.Session;
+            }
+        }
+        else
+        {
+            record.Session = FindSession(call->Session);
+            if (call->Kind == RPC_CAPTURE_ASYNC_CONNECT && record.Status == 0 && handle != NULL)
+            {
+                m_sessions[handle] = record.Session;
+            }
+        }
+
+        record.Sequence = m_sequences[record.Session]++;
+        if (call->Kind == RPC_CAPTURE_DISCONNECT)
+        {
+            CloseSession(record.Session);
+        }
+
+        unsigned __int64 offset = sizeof(RPC_CAPTURE_FILE_HEADER) + m_dataSize;
+        long status = 0;
+        if (offset + size > m_file->Size())
+        {
+            unsigned __int64 grown = m_file->Size() * 2;
+            status = m_file->Extend(grown > offset + size ? grown : offset + size);
+        }
+
+        if (status == 0)
+        {
+            status = m_file->Write(offset, (const unsigned char *)&record, sizeof(record));
+        }
+
+        offset += sizeof(record);
+        if (status == 0 && record.RequestSize > 0)
+        {
+            status = m_file->Write(offset, call->Request, record.RequestSize);
+            offset += record.RequestSize;
+        }
+
+        if (status == 0 && record.ResponseSize > 0)
+        {
+            status = m_file->Write(offset, response, record.ResponseSize);
+            offset += record.ResponseSize;
+        }
+
+        if (status == 0 && record.AuxOutSize > 0)
+        {
+            status = m_file->Write(offset, auxOut, record.AuxOutSize);
+        }
+
+        if (status == 0)
+        {
+            m_dataSize += size;
+            m_recordCount++;
+        }
+        else
+        {
+            m_writeError = status;
+        }
+    }
+    ReleaseSRWLockExclusive(&m_captureLock);
+}
+
+/// <summary>
+/// Start the capture of a call.
+/// </summary>
+/// <param name="call">The state of the call, on the stack of the traced routine.</param>
+/// <param name="kind">One of the RPC_CAPTURE_ kinds.</param>
+/// <param name="session">The CXH or ACXH the call is made on, or NULL for a connect.</param>
+/// <param name="flagsIn">pulFlags of EcDoRpcExt2, or 0.</param>
+/// <param name="request">The request to keep: szUserDN of EcDoConnectEx or rgbIn of EcDoRpcExt2, or NULL.</param>
+/// <param name="requestSize">The size of the request, terminating null included.</param>
+extern "C" void RpcCaptureBegin(RPC_CAPTURE_CALL *call, unsigned long kind, const void *session, unsigned long flagsIn, const unsigned char *request, unsigned long requestSize)
+{
+    call->Enabled = m_capturing;
+    if (!call->Enabled)
+    {
+        return;
+    }
+
+    call->Kind = kind;
+    call->Session = session;
+    call->FlagsIn = flagsIn;
+    call->Request = request;
+    call->RequestSize = requestSize;
+    QueryPerformanceCounter(&call->StartCounter);
+}
+
+/// <summary>
+/// Capture a call that raised an RPC exception. Call it once the handler of the exception has run, never from its
+/// filter: it takes the lock of the capture and may grow the file.
+/// </summary>
+extern "C" void RpcCaptureFault(RPC_CAPTURE_CALL *call, unsigned long exceptionCode)
+{
+    if (call->Enabled)
+    {
+        call->Enabled = 0;
+        RPC_CAPTURE_RECORD record = { 0 };
+        record.Status = (long)exceptionCode;
+        record.Attributes = RPC_CAPTURE_FAULT;
+        AppendRecord(call, record, NULL, NULL, NULL);
+    }
+}
+
+/// <summary>
+/// Capture an EcDoConnectEx call with its output parameters; the pointers of a call that failed may be NULL.
+/// </summary>
+extern "C" void RpcCaptureConnect(
+    RPC_CAPTURE_CALL *call,
+    long status,
+    const void *cxh,
+    const unsigned long *pcmsPollsMax,
+    const unsigned long *pcRetry,
+    const unsigned long *pcmsRetryDelay,
+    const unsigned short *picxr,
+    const unsigned char *szDNPrefix,
+    const unsigned char *szDisplayName,
+    const unsigned short *rgwServerVersion,
+    const unsigned short *rgwBestVersion,
+    const unsigned long *pulTimeStamp,
+    const unsigned char *rgbAuxOut,
+    unsigned long cbAuxOut)
+{
+    if (!call->Enabled)
+    {
+        return;
+    }
+
+    RPC_CAPTURE_CONNECT_OUT out = { 0 };
+    out.PollsMax = pcmsPollsMax != NULL ? *pcmsPollsMax : 0;
+    out.Retry = pcRetry != NULL ? *pcRetry : 0;
+    out.RetryDelay = pcmsRetryDelay != NULL ? *pcmsRetryDelay : 0;
+    out.TimeStamp = pulTimeStamp != NULL ? *pulTimeStamp : 0;
+    out.Icxr = picxr != NULL ? *picxr : 0;
+    for (int i = 0; i < 3; i++)
+    {
+        out.ServerVersion[i] = rgwServerVersion != NULL ? rgwServerVersion[i] : 0;
+        out.BestVersion[i] = rgwBestVersion != NULL ? rgwBestVersion[i] : 0;
+    }
+
+    std::vector<unsigned char> response((const unsigned char *)&out, (const unsigned char *)&out + sizeof(out));
+    const char *strings[2] = { (const char *)szDNPrefix, (const char *)szDisplayName };
+    for (int i = 0; i < 2; i++)
+    {
+        if (status == 0 && strings[i] != NULL)
+        {
+            response.insert(response.end(), strings[i], strings[i] + strlen(strings[i]));
+        }
+
+        response.push_back(0);
+    }
+
+    RPC_CAPTURE_RECORD record = { 0 };
+    record.Status = status;
+    record.ResponseSize = (unsigned long)response.size();
+    record.AuxOutSize = rgbAuxOut != NULL ? cbAuxOut : 0;
+    AppendRecord(call, record, &response[0], rgbAuxOut, cxh);
+}
+
+/// <summary>
+/// Capture an EcDoRpcExt2 call with its output parameters.
+/// </summary>
+extern "C" void RpcCaptureExecute(
+    RPC_CAPTURE_CALL *call,
+    long status,
+    unsigned long flagsOut,
+    const unsigned char *rgbOut,
+    unsigned long cbOut,
+    const unsigned char *rgbAuxOut,
+    unsigned long cbAuxOut,
+    unsigned long transTime)
+{
+    if (!call->Enabled)
+    {
+        return;
+    }
+
+    RPC_CAPTURE_RECORD record = { 0 };
+    record.Status = status;
+    record.FlagsOut = flagsOut;
+    record.TransTime = transTime;
+    record.ResponseSize = rgbOut != NULL ? cbOut : 0;
+    record.AuxOutSize = rgbAuxOut != NULL ? cbAuxOut : 0;
+    AppendRecord(call, record, rgbOut, rgbAuxOut, NULL);
+}
+
+/// <summary>
+/// Capture an EcDoAsyncConnectEx call, and bind the ACXH it created to the session of its CXH.
+/// </summary>
+extern "C" void RpcCaptureAsyncConnect(RPC_CAPTURE_CALL *call, long status, const void *acxh)
+{
+    if (!call->Enabled)
+    {
+        return;
+    }
+
+    RPC_CAPTURE_RECORD record = { 0 };
+    record.Status = status;
+    AppendRecord(call, record, NULL, NULL, acxh);
+}
+
+/// <summary>
+/// Capture a call with no buffers: a completed EcDoAsyncWaitEx or an EcDoDisconnect, which ends its session.
+/// </summary>
+extern "C" void RpcCaptureEnd(RPC_CAPTURE_CALL *call, long status, unsigned long flagsOut)
+{
+    if (!call->Enabled)
+    {
+        return;
+    }
+
+    RPC_CAPTURE_RECORD record = { 0 };
+    record.Status = status;
+    record.FlagsOut = flagsOut;
+    AppendRecord(call, record, NULL, NULL, NULL);
+}
+
+/// <summary>
+/// Start capturing the EMSMDB calls of the process to a new file.
+/// </summary>
+/// <param name="path">The path of the capture file; an existing file is replaced.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long __stdcall RpcCaptureStart(const wchar_t *path)
+{
+    if (path == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    long status = 0;
+    AcquireSRWLockExclusive(&m_captureLock);
+    if (m_capturing)
+    {
+        status = ERROR_ALREADY_INITIALIZED;
+    }
+    else
+    {
+        m_file = new MappedFile();
+        status = m_file->Create(path, InitialFileSize);
+        if (status != 0)
+        {
+            delete m_file;
+            m_file = NULL;
+        }
+        else
+        {
+            FILETIME startTime;
+            GetSystemTimeAsFileTime(&startTime);
+            m_startTime = ((unsigned __int64)startTime.dwHighDateTime << 32) | startTime.dwLowDateTime;
+            QueryPerformanceFrequency(&m_frequency);
+            QueryPerformanceCounter(&m_startCounter);
+            m_writeError = 0;
+            m_dataSize = 0;
+            m_recordCount = 0;
+            m_sessions.clear();
+            m_sequences.assign(1, 0);
+            InterlockedExchange(&m_capturing, 1);
+        }
+    }
+    ReleaseSRWLockExclusive(&m_captureLock);
+    return status;
+}
+
+/// <summary>
+/// Stop capturing, write the header of the capture file and cut the file to its records. Calls in progress are not
+/// captured.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code of the first write that failed</returns>
+long __stdcall RpcCaptureStop()
+{
+    long status = 0;
+    AcquireSRWLockExclusive(&m_captureLock);
+    if (!m_capturing)
+    {
+        status = ERROR_NOT_READY;
+    }
+    else
+    {
+        InterlockedExchange(&m_capturing, 0);
+        RPC_CAPTURE_FILE_HEADER header = { 0 };
+        header.Signature = RPC_CAPTURE_SIGNATURE;
+        header.Version = RPC_CAPTURE_VERSION;
+        header.HeaderSize = sizeof(header);
+        header.SessionCount = (unsigned long)m_sequences.size() - 1;
+        header.RecordCount = m_recordCount;
+        header.DataSize = m_dataSize;
+        header.StartTime = m_startTime;
+        status = m_file->Write(0, (const unsigned char *)&header, sizeof(header));
+        long truncated = m_file->Truncate(sizeof(header) + m_dataSize);
+        if (status == 0)
+        {
+            status = truncated;
+        }
+
+        if (m_writeError != 0)
+        {
+            status = m_writeError;
+        }
+
+        m_file->Close();
+        delete m_file;
+        m_file = NULL;
+        m_sessions.clear();
+    }
+    ReleaseSRWLockExclusive(&m_captureLock);
+    return status;
+}
+
+/// <summary>
+/// Get the counters of the capture.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long __stdcall RpcCaptureGetStats(RPC_CAPTURE_STATS *stats)
+{
+    if (stats == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    AcquireSRWLockShared(&m_captureLock);
+    stats->Enabled = m_capturing;
+    stats->SessionCount = m_sequences.empty() ? 0 : (unsigned long)m_sequences.size() - 1;
+    stats->RecordCount = m_recordCount;
+    stats->DataSize = m_dataSize;
+    ReleaseSRWLockShared(&m_captureLock);
+    return 0;
+}
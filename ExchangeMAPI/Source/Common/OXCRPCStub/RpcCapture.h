@@ -0,0 +1,154 @@
+#pragma once
+
+#include "CodecPlatform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// <summary>
+/// The kinds of capture records.
+/// </summary>
+#define RPC_CAPTURE_CONNECT         1   // EcDoConnectEx; the request is szUserDN, the response an RPC_CAPTURE_CONNECT_OUT.
+#define RPC_CAPTURE_EXECUTE         2   // EcDoRpcExt2; the request is rgbIn, the response rgbOut.
+#define RPC_CAPTURE_ASYNC_CONNECT   3   // EcDoAsyncConnectEx; it binds the ACXH to the session of the CXH.
+#define RPC_CAPTURE_WAIT            4   // EcDoAsyncWaitEx, from its call to its completion.
+#define RPC_CAPTURE_DISCONNECT      5   // EcDoDisconnect.
+
+/// <summary>
+/// The attributes of a capture record.
+/// </summary>
+#define RPC_CAPTURE_FAULT           0x00000001  // The call raised an RPC exception; Status is the exception code.
+
+/// <summary>
+/// The signature of a capture file, "RCAP", and the version of its layout.
+/// </summary>
+#define RPC_CAPTURE_SIGNATURE       0x50414352
+#define RPC_CAPTURE_VERSION         1
+
+/// <summary>
+/// The header of a capture file. The records follow it in the order the calls completed.
+/// </summary>
+typedef struct _RPC_CAPTURE_FILE_HEADER
+{
+    uint32_t Signature;
+    uint32_t Version;
+    uint32_t HeaderSize;
+    uint32_t SessionCount;                  // Session numbers run from 1 to SessionCount.
+    uint64_t RecordCount;
+    uint64_t DataSize;                      // The bytes of the records.
+    uint64_t StartTime;                     // The UTC FILETIME when the capture started.
+} RPC_CAPTURE_FILE_HEADER;
+
+/// <summary>
+/// A capture record. The request, the response and rgbAuxOut follow it, in this order, and the next record starts at
+/// the next multiple of 8 bytes.
+/// </summary>
+typedef struct _RPC_CAPTURE_RECORD
+{
+    uint32_t Size;                          // This structure and its payload, padding included.
+    uint32_t Kind;                          // One of the RPC_CAPTURE_ kinds.
+    uint32_t Session;                       // The number of the session the call belongs to.
+    uint32_t Sequence;                      // The position of the record among the records of its session, from 0.
+    uint64_t StartTime;                     // Microseconds since the capture started.
+    uint32_t Duration;                      // Microseconds the call took.
+    int32_t Status;                         // The return value of the call, or the exception code.
+    uint32_t Attributes;                    // A combination of the RPC_CAPTURE_ attributes.
+    uint32_t FlagsIn;                       // pulFlags of EcDoRpcExt2 on input.
+    uint32_t FlagsOut;                      // pulFlags of EcDoRpcExt2, or pulFlagsOut of EcDoAsyncWaitEx, on output.
+    uint32_t TransTime;                     // pulTransTime of EcDoRpcExt2.
+    uint32_t RequestSize;
+    uint32_t ResponseSize;
+    uint32_t AuxOutSize;
+    uint32_t Reserved;
+} RPC_CAPTURE_RECORD;
+
+/// <summary>
+/// The output parameters of EcDoConnectEx, the response of a connect record. szDNPrefix and szDisplayName follow it,
+/// each with its terminating null.
+/// </summary>
+typedef struct _RPC_CAPTURE_CONNECT_OUT
+{
+    uint32_t PollsMax;
+    uint32_t Retry;
+    uint32_t RetryDelay;
+    uint32_t TimeStamp;
+    unsigned short Icxr;
+    unsigned short ServerVersion[3];
+    unsigned short BestVersion[3];
+    unsigned short Reserved;
+} RPC_CAPTURE_CONNECT_OUT;
+
+/// <summary>
+/// The counters of the capture since it was last started.
+/// </summary>
+typedef struct _RPC_CAPTURE_STATS
+{
+    unsigned long Enabled;                  // 1 while capturing.
+    unsigned long SessionCount;
+    unsigned __int64 RecordCount;
+    unsigned __int64 DataSize;
+} RPC_CAPTURE_STATS;
+
+// The capture itself runs in the stub, on Windows; the layouts above are also read by tools on other platforms.
+#ifdef _WIN32
+
+/// <summary>
+/// The state of a captured call, on the stack of the traced routine that makes it.
+/// </summary>
+typedef struct _RPC_CAPTURE_CALL
+{
+    int Enabled;
+    unsigned long Kind;
+    const void *Session;                    // The CXH or ACXH the call was made on, before the call.
+    unsigned long FlagsIn;
+    const unsigned char *Request;
+    unsigned long RequestSize;
+    LARGE_INTEGER StartCounter;
+} RPC_CAPTURE_CALL;
+
+void RpcCaptureBegin(RPC_CAPTURE_CALL *call, unsigned long kind, const void *session, unsigned long flagsIn, const unsigned char *request, unsigned long requestSize);
+
+void RpcCaptureFault(RPC_CAPTURE_CALL *call, unsigned long exceptionCode);
+
+void RpcCaptureConnect(
+    RPC_CAPTURE_CALL *call,
+    long status,
+    const void *cxh,
+    const unsigned long *pcmsPollsMax,
+    const unsigned long *pcRetry,
+    const unsigned long *pcmsRetryDelay,
+    const unsigned short *picxr,
+    const unsigned char *szDNPrefix,
+    const unsigned char *szDisplayName,
+    const unsigned short *rgwServerVersion,
+    const unsigned short *rgwBestVersion,
+    const unsigned long *pulTimeStamp,
+    const unsigned char *rgbAuxOut,
+    unsigned long cbAuxOut);
+
+void RpcCaptureExecute(
+    RPC_CAPTURE_CALL *call,
+    long status,
+    unsigned long flagsOut,
+    const unsigned char *rgbOut,
+    unsigned long cbOut,
+    const unsigned char *rgbAuxOut,
+    unsigned long cbAuxOut,
+    unsigned long transTime);
+
+void RpcCaptureAsyncConnect(RPC_CAPTURE_CALL *call, long status, const void *acxh);
+
+void RpcCaptureEnd(RPC_CAPTURE_CALL *call, long status, unsigned long flagsOut);
+
+long __stdcall RpcCaptureStart(const wchar_t *path);
+
+long __stdcall RpcCaptureStop();
+
+long __stdcall RpcCaptureGetStats(RPC_CAPTURE_STATS *stats);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,5 @@
+#pragma once
+
+#include <rpc.h>
+
+unsigned long HandleException(RPC_STATUS status);
@@ -0,0 +1,8 @@
+#pragma once
+
+/// <summary>
+/// The pulFlags of EcDoRpcExt2, as specified in MS-OXCRPC section 3.1.4.2.
+/// </summary>
+#define RPCEXT2_FLAG_NO_COMPRESSION     0x00000001
+#define RPCEXT2_FLAG_NO_XORMAGIC        0x00000002
+#define RPCEXT2_FLAG_CHAIN              0x00000004
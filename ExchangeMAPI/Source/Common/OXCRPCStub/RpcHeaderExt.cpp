@@ -0,0 +1,226 @@
+#include "RpcHeaderExt.h"
+#include "Lz77Direct2.h"
+#include <emmintrin.h>
+
+/// <summary>
+/// XOR every byte of a buffer with 0xA5 in place. The same call obfuscates and reveals a payload.
+/// </summary>
+/// <param name="data">The buffer to transform.</param>
+/// <param name="size">The size of the buffer.</param>
+void __stdcall XorObfuscate(unsigned char *data, unsigned long size)
+{
+    unsigned long index = 0;
+    const __m128i magic = _mm_set1_epi8((char)RHE_XOR_MAGIC);
+    for (; index + 16 <= size; index += 16)
+    {
+        __m128i block = _mm_loadu_si128((const __m128i *)(data + index));
+        _mm_storeu_si128((__m128i *)(data + index), _mm_xor_si128(block, magic));
+    }
+
+    for (; index < size; index++)
+    {
+        data[index] ^= RHE_XOR_MAGIC;
+    }
+}
+
+/// <summary>
+/// Parse the RPC_HEADER_EXT at an offset of a payload and locate the buffer that follows it.
+/// </summary>
+/// <param name="buffer">The rgbIn, rgbOut, rgbAuxIn or rgbAuxOut payload.</param>
+/// <param name="cbBuffer">The size of the payload.</param>
+/// <param name="offset">The offset of the RPC_HEADER_EXT; 0 for the first buffer, or the end of the previous buffer.</param>
+/// <param name="result">Receives the header and the location of its buffer.</param>
+/// <returns>If success, it returns 0. ERROR_INVALID_DATA indicates the header is truncated or its Size exceeds the payload.</returns>
+long __stdcall ParseRpcHeaderExt(unsigned char *buffer, unsigned long cbBuffer, unsigned long offset, RPC_HEADER_EXT_BUFFER *result)
+{
+    if (buffer == NULL || result == NULL || offset > cbBuffer || cbBuffer - offset < sizeof(RPC_HEADER_EXT))
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    memcpy(&result->Header, buffer + offset, sizeof(RPC_HEADER_EXT));
+    if (result->Header.Version != 0 || result->Header.Size > cbBuffer - offset - sizeof(RPC_HEADER_EXT))
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    if ((result->Header.Flags & RHE_FLAG_COMPRESSED) == 0 && result->Header.Size != result->Header.SizeActual)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    result->Offset = offset;
+    result->Payload = buffer + offset + sizeof(RPC_HEADER_EXT);
+    return 0;
+}
+
+/// <summary>
+/// Undo the XorMagic obfuscation of a parsed buffer in place and clear the flag, so that it is not revealed twice.
+/// </summary>
+/// <param name="buffer">A buffer returned by ParseRpcHeaderExt.</param>
+/// <returns>If success, it returns 0. ERROR_NOT_SUPPORTED indicates the buffer is compressed; use ExpandRpcHeaderExtChain for such a chain.</returns>
+long __stdcall RevealRpcHeaderExtPayload(RPC_HEADER_EXT_BUFFER *buffer)
+{
+    if ((buffer->Header.Flags & RHE_FLAG_COMPRESSED) != 0)
+    {
+        return ERROR_NOT_SUPPORTED;
+    }
+
+    if ((buffer->Header.Flags & RHE_FLAG_XORMAGIC) != 0)
+    {
+        XorObfuscate(buffer->Payload, buffer->Header.Size);
+        buffer->Header.Flags &= ~RHE_FLAG_XORMAGIC;
+
+        // Write the cleared flag back, so that the payload is not revealed twice if the buffer is parsed again.
+        unsigned char *flags = buffer->Payload - sizeof(RPC_HEADER_EXT) + sizeof(unsigned short);
+        memcpy(flags, &buffer->Header.Flags, sizeof(unsigned short));
+    }
+
+    return 0;
+}
+
+
+/// <summary>
+/// Compress and obfuscate the buffers of an RPC_HEADER_EXT chain, as a client does to rgbIn before it sends it. A
+/// buffer is sent compressed only if that makes it smaller, and buffers that are already compressed or obfuscated are
+/// copied unchanged.
+/// </summary>
+/// <param name="input">The chain to pack; it is not changed.</param>
+/// <param name="cbInput">The size of the chain.</param>
+/// <param name="flags">RHE_FLAG_COMPRESSED, RHE_FLAG_XORMAGIC or both.</param>
+/// <param name="output">The buffer to write the packed chain to; cbInput bytes are always enough.</param>
+/// <param name="cbOutput">The size of the buffer.</param>
+/// <param name="pcbOutput">Receives the size of the packed chain.</param>
+/// <returns>If success, it returns 0. ERROR_INVALID_DATA indicates a malformed chain; ERROR_INSUFFICIENT_BUFFER indicates the packed chain does not fit.</returns>
+long __stdcall PackRpcHeaderExtChain(unsigned char *input, unsigned long cbInput, unsigned short flags, unsigned char *output, unsigned long cbOutput, unsigned long *pcbOutput)
+{
+    if (input == NULL || output == NULL || pcbOutput == NULL || (flags & ~(RHE_FLAG_COMPRESSED | RHE_FLAG_XORMAGIC)) != 0)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    unsigned long offset = 0;
+    unsigned long written = 0;
+    bool last = false;
+    while (!last && offset < cbInput)
+    {
+        RPC_HEADER_EXT_BUFFER parsed;
+        long status = ParseRpcHeaderExt(input, cbInput, offset, &parsed);
+        if (status != 0)
+        {
+            return status;
+        }
+
+        if (cbOutput - written < sizeof(RPC_HEADER_EXT) + parsed.Header.Size)
+        {
+            return ERROR_INSUFFICIENT_BUFFER;
+        }
+
+        RPC_HEADER_EXT header = parsed.Header;
+        unsigned char *payload = output + written + sizeof(RPC_HEADER_EXT);
+        if ((header.Flags & (RHE_FLAG_COMPRESSED | RHE_FLAG_XORMAGIC)) != 0)
+        {
+            memcpy(payload, parsed.Payload, header.Size);
+        }
+        else
+        {
+            unsigned long packedSize = 0;
+            if ((flags & RHE_FLAG_COMPRESSED) != 0 && header.Size > 1
+                && Lz77Direct2Compress(parsed.Payload, header.Size, payload, header.Size - 1, &packedSize) == 0)
+            {
+                header.Flags |= RHE_FLAG_COMPRESSED;
+                header.Size = (unsigned short)packedSize;
+            }
+            else
+            {
+                memcpy(payload, parsed.Payload, header.Size);
+            }
+
+            if ((flags & RHE_FLAG_XORMAGIC) != 0)
+            {
+                XorObfuscate(payload, header.Size);
+                header.Flags |= RHE_FLAG_XORMAGIC;
+            }
+        }
+
+        memcpy(output + written, &header, sizeof(RPC_HEADER_EXT));
+        written += sizeof(RPC_HEADER_EXT) + header.Size;
+        offset += sizeof(RPC_HEADER_EXT) + parsed.Header.Size;
+        last = (header.Flags & RHE_FLAG_LAST) != 0;
+    }
+
+    *pcbOutput = written;
+    return 0;
+}
+
+/// <summary>
+/// Reveal and decompress the buffers of an RPC_HEADER_EXT chain, such as rgbOut or rgbAuxOut, into a buffer of plain
+/// buffers that RopResponseBegin can read. Obfuscated payloads are revealed in place in the input first. The headers
+/// of the output keep only RHE_FLAG_LAST, and their Size is the SizeActual of the input.
+/// </summary>
+/// <param name="input">The chain to expand.</param>
+/// <param name="cbInput">The size of the chain.</param>
+/// <param name="output">The buffer to write the expanded chain to. It MUST NOT overlap the input.</param>
+/// <param name="cbOutput">The size of the buffer.</param>
+/// <param name="pcbOutput">Receives the size of the expanded chain.</param>
+/// <returns>If success, it returns 0. ERROR_INVALID_DATA indicates a malformed chain or payload; ERROR_INSUFFICIENT_BUFFER indicates the expanded chain does not fit.</returns>
+long __stdcall ExpandRpcHeaderExtChain(unsigned char *input, unsigned long cbInput, unsigned char *output, unsigned long cbOutput, unsigned long *pcbOutput)
+{
+    if (input == NULL || output == NULL || pcbOutput == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    unsigned long offset = 0;
+    unsigned long written = 0;
+    bool last = false;
+    while (!last && offset < cbInput)
+    {
+        RPC_HEADER_EXT_BUFFER parsed;
+        long status = ParseRpcHeaderExt(input, cbInput, offset, &parsed);
+        if (status != 0)
+        {
+            return status;
+        }
+
+        RPC_HEADER_EXT header = parsed.Header;
+        if (cbOutput - written < sizeof(RPC_HEADER_EXT) + header.SizeActual)
+        {
+            return ERROR_INSUFFICIENT_BUFFER;
+        }
+
+        if ((header.Flags & RHE_FLAG_XORMAGIC) != 0)
+        {
+            // Clear the flag in the input as RevealRpcHeaderExtPayload does, before the payload is decompressed, so
+            // that a payload that fails to decompress is not left revealed under the flag and revealed twice.
+            XorObfuscate(parsed.Payload, header.Size);
+            unsigned short flags = header.Flags & ~RHE_FLAG_XORMAGIC;
+            memcpy(input + offset + sizeof(unsigned short), &flags, sizeof(unsigned short));
+        }
+
+        unsigned char *payload = output + written + sizeof(RPC_HEADER_EXT);
+        if ((header.Flags & RHE_FLAG_COMPRESSED) != 0)
+        {
+            unsigned long actualSize = 0;
+            status = Lz77Direct2Decompress(parsed.Payload, header.Size, payload, header.SizeActual, &actualSize);
+            if (status != 0 || actualSize != header.SizeActual)
+            {
+                return ERROR_INVALID_DATA;
+            }
+        }
+        else
+        {
+            memcpy(payload, parsed.Payload, header.Size);
+        }
+
+        last = (header.Flags & RHE_FLAG_LAST) != 0;
+        header.Flags &= RHE_FLAG_LAST;
+        header.Size = header.SizeActual;
+        memcpy(output + written, &header, sizeof(RPC_HEADER_EXT));
+        written += sizeof(RPC_HEADER_EXT) + header.Size;
+        offset += sizeof(RPC_HEADER_EXT) + parsed.Header.Size;
+    }
+
+    *pcbOutput = written;
+    return 0;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "CodecPlatform.h"
+
+/// <summary>
+/// The RPC_HEADER_EXT structure that prefixes every buffer of the rgbIn, rgbOut, rgbAuxIn and rgbAuxOut payloads, as specified in MS-OXCRPC section 2.2.2.1.
+/// </summary>
+#pragma pack(push, 1)
+typedef struct _RPC_HEADER_EXT
+{
+    unsigned short Version;     // There is only one version of the header at this time, so this value MUST be 0x0000.
+    unsigned short Flags;       // A combination of RHE_FLAG_COMPRESSED, RHE_FLAG_XORMAGIC and RHE_FLAG_LAST.
+    unsigned short Size;        // The length of the payload that follows the header.
+    unsigned short SizeActual;  // The length of the payload after it is uncompressed.
+} RPC_HEADER_EXT;
+#pragma pack(pop)
+
+#define RHE_FLAG_COMPRESSED 0x0001
+#define RHE_FLAG_XORMAGIC   0x0002
+#define RHE_FLAG_LAST       0x0004
+
+/// <summary>
+/// The value every payload byte is XORed with when the XorMagic flag is set, as specified in MS-OXCRPC section 3.1.7.3.
+/// </summary>
+#define RHE_XOR_MAGIC 0xA5
+
+/// <summary>
+/// One buffer of an RPC_HEADER_EXT chain.
+/// </summary>
+typedef struct _RPC_HEADER_EXT_BUFFER
+{
+    RPC_HEADER_EXT Header;
+    unsigned char *Payload;     // Points into the parsed buffer; the payload is not copied.
+    unsigned long Offset;       // The offset of the RPC_HEADER_EXT in the parsed buffer.
+} RPC_HEADER_EXT_BUFFER;
+
+void __stdcall XorObfuscate(unsigned char *data, unsigned long size);
+
+long __stdcall ParseRpcHeaderExt(unsigned char *buffer, unsigned long cbBuffer, unsigned long offset, RPC_HEADER_EXT_BUFFER *result);
+
+long __stdcall RevealRpcHeaderExtPayload(RPC_HEADER_EXT_BUFFER *buffer);
+
+long __stdcall PackRpcHeaderExtChain(unsigned char *input, unsigned long cbInput, unsigned short flags, unsigned char *output, unsigned long cbOutput, unsigned long *pcbOutput);
+
+long __stdcall ExpandRpcHeaderExtChain(unsigned char *input, unsigned long cbInput, unsigned char *output, unsigned long cbOutput, unsigned long *pcbOutput);
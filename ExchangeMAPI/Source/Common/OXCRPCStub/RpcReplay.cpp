@@ -0,0 +1,437 @@
+#include "RpcReplay.h"
+#include <vector>
+
+// Replay of a capture file of RpcCaptureStart as a stand-in EMSMDB endpoint. The endpoint is a MAPI_SESSION_BACKEND,
+// so a MapiSession given RpcReplayGetBackend runs its whole client path, compression, obfuscation, retries and
+// buffer pooling included, against the captured responses instead of a server. A connect takes the first captured
+// session of its user DN that no other session took yet, and the requests and notification waits of the session are
+// answered with the captured ones in sequence. Each answer is held back for the captured duration of its call divided
+// by the speed, so 100 replays at the original pacing, 1000 ten times faster and 0 without any delay. The file is
+// mapped whole, and the answers are copied from it without a lock.
+
+/// <summary>
+/// A captured session, with its calls in sequence.
+/// </summary>
+struct ReplaySession
+{
+    const RPC_CAPTURE_RECORD *connect;
+    const char *userDN;
+    bool claimed;
+    std::vector<const RPC_CAPTURE_RECORD *> executes;
+    std::vector<const RPC_CAPTURE_RECORD *> waits;
+    size_t nextExecute;
+    size_t nextWait;
+};
+
+/// <summary>
+/// The session context of the replay backend.
+/// </summary>
+struct ReplayContext
+{
+    ReplaySession *session;
+};
+
+static SRWLOCK m_replayLock = SRWLOCK_INIT;
+static HANDLE m_file = INVALID_HANDLE_VALUE;
+static HANDLE m_mapping = NULL;
+static const unsigned char *m_view = NULL;
+static std::vector<ReplaySession> m_replaySessions;
+static unsigned long m_speed = 100;
+static unsigned long m_flags = 0;
+static volatile LONG m_openCount = 0;
+static RPC_REPLAY_STATS m_stats;
+static LARGE_INTEGER m_frequency;
+
+/// <summary>
+/// Get the payload of a record: the request, the response and rgbAuxOut follow each other.
+/// </summary>
+static const unsigned char *Payload(const RPC_CAPTURE_RECORD *record)
+{
+    return (const unsigned char *)(record + 1);
+}
+
+/// <summary>
+/// Wait until the captured duration of a call, divided by the speed, has passed since the replayed call started.
+/// The last millisecond is spun so that short calls keep their pacing.
+/// </summary>
+static void Pace(const RPC_CAPTURE_RECORD *record, const LARGE_INTEGER &start)
+{
+    if (m_speed == 0)
+    {
+        return;
+    }
+
+    unsigned __int64 target = (unsigned __int64)record->Duration * 100 / m_speed;
+    unsigned __int64 targetTicks = target * (unsigned __int64)m_frequency.QuadPart / 1000000;
+    for (;;)
+    {
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        unsigned __int64 elapsed = (unsigned __int64)(now.QuadPart - start.QuadPart);
+        if (elapsed >= targetTicks)
+        {
+            return;
+        }
+
+        unsigned __int64 remaining = (targetTicks - elapsed) * 1000 / (unsigned __int64)m_frequency.QuadPart;
+        if (remaining > 1)
+        {
+            Sleep((DWORD)(remaining - 1));
+        }
+        else
+        {
+            YieldProcessor();
+        }
+    }
+}
+
+/// <summary>
+/// Index the records of a mapped capture file by session. Called with the replay lock held.
+/// </summary>
+/// <returns>If success, it returns 0, else returns ERROR_BAD_FORMAT</returns>
+static long IndexCapture(unsigned __int64 fileSize)
+{
+    const RPC_CAPTURE_FILE_HEADER *header = (const RPC_CAPTURE_FILE_HEADER *)m_view;
+    if (fileSize < sizeof(RPC_CAPTURE_FILE_HEADER)
+        || header->Signature != RPC_CAPTURE_SIGNATURE
+        || header->Version != RPC_CAPTURE_VERSION
+        || header->HeaderSize < sizeof(RPC_CAPTURE_FILE_HEADER)
+        || header->HeaderSize + header->DataSize > fileSize)
+    {
+        return ERROR_BAD_FORMAT;
+    }
+
+    ReplaySession empty = { NULL, NULL, false };
+    m_replaySessions.assign((size_t)header->SessionCount + 1, empty);
+    unsigned __int64 offset = header->HeaderSize;
+    unsigned __int64 end = header->HeaderSize + header->DataSize;
+    while (offset < end)
+    {
+        const RPC_CAPTURE_RECORD *record = (const RPC_CAPTURE_RECORD *)(m_view + offset);
+        if (end - offset < sizeof(RPC_CAPTURE_RECORD)
+            || record->Size > end - offset
+            || record->Size < sizeof(RPC_CAPTURE_RECORD) + (unsigned __int64)record->RequestSize + record->ResponseSize + record->AuxOutSize
+            || record->Session == 0
+            || record->Session > header->SessionCount)
+        {
+            return ERROR_BAD_FORMAT;
+        }
+
+        ReplaySession &session = m_replaySessions[record->Session];
+        switch (record->Kind)
+        {
+        case RPC_CAPTURE_CONNECT:
+            // The user DN is kept with its terminating null; a connect record without one cannot be matched.
+            if (session.connect == NULL && record->RequestSize > 0 && Payload(record)[record->RequestSize - 1] == 0)
+            {
+                session.connect = record;
+                session.userDN = (const char *)Payload(record);
+                m_stats.SessionCount++;
+            }
+
+            break;
+        case RPC_CAPTURE_EXECUTE:
+            session.executes.push_back(record);
+            break;
+        case RPC_CAPTURE_WAIT:
+            session.waits.push_back(record);
+            break;
+        default:
+            break;
+        }
+
+        offset += record->Size;
+    }
+
+    return 0;
+}
+
+static long __stdcall ReplayBackendConnect(const MAPI_SESSION_CONFIG *config, void **context, unsigned long *pcRetry, unsigned long *pcmsRetryDelay)
+{
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+    ReplaySession *session = NULL;
+    AcquireSRWLockExclusive(&m_replayLock);
+    if (m_view == NULL)
+    {
+        ReleaseSRWLockExclusive(&m_replayLock);
+        return ERROR_NOT_READY;
+    }
+
+    for (size_t i = 1; i < m_replaySessions.size(); i++)
+    {
+        ReplaySession &candidate = m_replaySessions[i];
+        if (candidate.connect != NULL && !candidate.claimed && _stricmp(candidate.userDN, config->UserDN) == 0)
+        {
+            candidate.claimed = true;
+            session = &candidate;
+            break;
+        }
+    }
+
+    if (session == NULL)
+    {
+        m_stats.UnmatchedConnectCount++;
+    }
+    else
+    {
+        m_stats.ConnectCount++;
+
+        // A session is counted open from its claim, so that RpcReplayStop cannot unmap the file under a connect.
+        InterlockedIncrement(&m_openCount);
+    }
+    ReleaseSRWLockExclusive(&m_replayLock);
+
+    if (session == NULL)
+    {
+        return ERROR_NOT_FOUND;
+    }
+
+    const RPC_CAPTURE_RECORD *record = session->connect;
+    Pace(record, start);
+    if (record->Status != 0)
+    {
+        InterlockedDecrement(&m_openCount);
+        return record->Status;
+    }
+
+    // The output parameters follow the user DN, so they are copied out rather than read in place.
+    if (record->ResponseSize >= sizeof(RPC_CAPTURE_CONNECT_OUT))
+    {
+        RPC_CAPTURE_CONNECT_OUT out;
+        memcpy(&out, Payload(record) + record->RequestSize, sizeof(out));
+        *pcRetry = out.Retry;
+        *pcmsRetryDelay = out.RetryDelay;
+    }
+
+    ReplayContext *created = new ReplayContext();
+    created->session = session;
+    *context = created;
+    return 0;
+}
+
+static long __stdcall ReplayBackendExecute(
+    void *context,
+    unsigned long *pulFlags,
+    unsigned char *rgbIn,
+    unsigned long cbIn,
+    unsigned char *rgbOut,
+    unsigned long *pcbOut,
+    unsigned char *rgbAuxOut,
+    unsigned long *pcbAuxOut,
+    unsigned long *pulTransTime)
+{
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+    ReplaySession *session = ((ReplayContext *)context)->session;
+    if (session->nextExecute >= session->executes.size())
+    {
+        InterlockedIncrement((volatile LONG *)&m_stats.ExhaustedCount);
+        return ERROR_NO_MORE_ITEMS;
+    }
+
+    // A request refused in strict mode leaves the captured one to be matched by the next request.
+    const RPC_CAPTURE_RECORD *record = session->executes[session->nextExecute];
+    const unsigned char *payload = Payload(record);
+    if (record->RequestSize != cbIn || memcmp(payload, rgbIn, cbIn) != 0)
+    {
+        InterlockedIncrement((volatile LONG *)&m_stats.MismatchCount);
+        if ((m_flags & RPC_REPLAY_STRICT) != 0)
+        {
+            return ERROR_INVALID_DATA;
+        }
+    }
+
+    session->nextExecute++;
+    InterlockedIncrement((volatile LONG *)&m_stats.ExecuteCount);
+    Pace(record, start);
+    if ((record->Attributes & RPC_CAPTURE_FAULT) != 0)
+    {
+        return record->Status;
+    }
+
+    if (record->ResponseSize > *pcbOut || record->AuxOutSize > *pcbAuxOut)
+    {
+        return ERROR_INSUFFICIENT_BUFFER;
+    }
+
+    memcpy(rgbOut, payload + record->RequestSize, record->ResponseSize);
+    memcpy(rgbAuxOut, payload + record->RequestSize + record->ResponseSize, record->AuxOutSize);
+    *pcbOut = record->ResponseSize;
+    *pcbAuxOut = record->AuxOutSize;
+    *pulFlags = record->FlagsOut;
+    *pulTransTime = record->TransTime;
+    InterlockedExchangeAdd64((volatile LONGLONG *)&m_stats.ResponseBytes, record->ResponseSize);
+    return record->Status;
+}
+
+static long __stdcall ReplayBackendNotificationWait(void *context, unsigned long *pulFlagsOut)
+{
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+    ReplaySession *session = ((ReplayContext *)context)->session;
+    if (session->nextWait >= session->waits.size())
+    {
+        InterlockedIncrement((volatile LONG *)&m_stats.ExhaustedCount);
+        return ERROR_NO_MORE_ITEMS;
+    }
+
+    const RPC_CAPTURE_RECORD *record = session->waits[session->nextWait++];
+    InterlockedIncrement((volatile LONG *)&m_stats.WaitCount);
+    Pace(record, start);
+    *pulFlagsOut = record->FlagsOut;
+    return record->Status;
+}
+
+static long __stdcall ReplayBackendDisconnect(void *context)
+{
+    delete (ReplayContext *)context;
+    InterlockedDecrement(&m_openCount);
+    return 0;
+}
+
+static const MAPI_SESSION_BACKEND m_replayBackend =
+{
+    ReplayBackendConnect,
+    ReplayBackendExecute,
+    ReplayBackendNotificationWait,
+    ReplayBackendDisconnect
+};
+
+/// <summary>
+/// Close the capture file of the replay. Called with the replay lock held.
+/// </summary>
+static void CloseCapture()
+{
+    if (m_view != NULL)
+    {
+        UnmapViewOfFile(m_view);
+        m_view = NULL;
+    }
+
+    if (m_mapping != NULL)
+    {
+        CloseHandle(m_mapping);
+        m_mapping = NULL;
+    }
+
+    if (m_file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+
+    m_replaySessions.clear();
+}
+
+/// <summary>
+/// Load a capture file to serve through the backend of RpcReplayGetBackend.
+/// </summary>
+/// <param name="path">The path of a capture file written by RpcCaptureStart and RpcCaptureStop.</param>
+/// <param name="speed">The pacing of the answers in percent of the captured one: 100 for the original pacing, 200 for
+/// twice as fast, or 0 to answer at once.</param>
+/// <param name="flags">0 or RPC_REPLAY_STRICT.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long __stdcall RpcReplayStart(const wchar_t *path, unsigned long speed, unsigned long flags)
+{
+    if (path == NULL || (flags & ~RPC_REPLAY_STRICT) != 0)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    long status = 0;
+    AcquireSRWLockExclusive(&m_replayLock);
+    if (m_view != NULL)
+    {
+        ReleaseSRWLockExclusive(&m_replayLock);
+        return ERROR_ALREADY_INITIALIZED;
+    }
+
+    LARGE_INTEGER size = { 0 };
+    m_file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &size))
+    {
+        status = GetLastError();
+    }
+    else if (size.QuadPart < (LONGLONG)sizeof(RPC_CAPTURE_FILE_HEADER))
+    {
+        status = ERROR_BAD_FORMAT;
+    }
+    else
+    {
+        // The whole file is mapped so that the answers can point into it; the address space bounds the capture size.
+        m_mapping = CreateFileMappingW(m_file, NULL, PAGE_READONLY, 0, 0, NULL);
+        m_view = m_mapping == NULL ? NULL : (const unsigned char *)MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+        if (m_view == NULL)
+        {
+            status = GetLastError();
+        }
+        else
+        {
+            memset(&m_stats, 0, sizeof(m_stats));
+            status = IndexCapture((unsigned __int64)size.QuadPart);
+        }
+    }
+
+    if (status != 0)
+    {
+        CloseCapture();
+    }
+    else
+    {
+        QueryPerformanceFrequency(&m_frequency);
+        m_speed = speed;
+        m_flags = flags;
+    }
+    ReleaseSRWLockExclusive(&m_replayLock);
+    return status;
+}
+
+/// <summary>
+/// Stop the replay and close its capture file. Every replayed session must be disconnected first.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long __stdcall RpcReplayStop()
+{
+    long status = 0;
+    AcquireSRWLockExclusive(&m_replayLock);
+    if (m_view == NULL)
+    {
+        status = ERROR_NOT_READY;
+    }
+    else if (m_openCount != 0)
+    {
+        status = ERROR_BUSY;
+    }
+    else
+    {
+        CloseCapture();
+    }
+    ReleaseSRWLockExclusive(&m_replayLock);
+    return status;
+}
+
+/// <summary>
+/// Return the stand-in EMSMDB endpoint, to set as the Backend of a MAPI_SESSION_CONFIG.
+/// </summary>
+const MAPI_SESSION_BACKEND * __stdcall RpcReplayGetBackend()
+{
+    return &m_replayBackend;
+}
+
+/// <summary>
+/// Get the counters of the replay.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long __stdcall RpcReplayGetStats(RPC_REPLAY_STATS *stats)
+{
+    if (stats == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    AcquireSRWLockShared(&m_replayLock);
+    *stats = m_stats;
+    ReleaseSRWLockShared(&m_replayLock);
+    return 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "MapiSession.h"
+#include "RpcCapture.h"
+
+/// <summary>
+/// The options of RpcReplayStart.
+/// </summary>
+#define RPC_REPLAY_STRICT 0x00000001  // Fail a request whose rgbIn differs from the captured one with ERROR_INVALID_DATA.
+
+/// <summary>
+/// The counters of the replay since it was last started.
+/// </summary>
+typedef struct _RPC_REPLAY_STATS
+{
+    unsigned long SessionCount;             // Captured sessions with a connect record.
+    unsigned long ConnectCount;             // Connects served from a captured session.
+    unsigned long UnmatchedConnectCount;    // Connects of a user with no captured session left.
+    unsigned long ExecuteCount;             // Requests served.
+    unsigned long MismatchCount;            // Requests whose rgbIn differed from the captured one.
+    unsigned long ExhaustedCount;           // Requests past the last captured one of their session.
+    unsigned long WaitCount;                // Notification waits served.
+    unsigned __int64 ResponseBytes;         // rgbOut bytes served.
+} RPC_REPLAY_STATS;
+
+long __stdcall RpcReplayStart(const wchar_t *path, unsigned long speed, unsigned long flags);
+
+long __stdcall RpcReplayStop();
+
+const MAPI_SESSION_BACKEND * __stdcall RpcReplayGetBackend();
+
+long __stdcall RpcReplayGetStats(RPC_REPLAY_STATS *stats);
@@ -0,0 +1,578 @@
+#include "SessionDispatcher.h"
+#include "TracedCalls.h"
+#include "RpcException.h"
+#include <map>
+#include <vector>
+#include <deque>
+
+// MS-OXCRPC does not allow concurrent EcDoRpcExt2 calls on one CXH. The dispatcher keeps one multi-producer,
+// single-consumer queue per session, runs each session's requests strictly in order on at most one worker at a time,
+// and spreads different sessions over a work-stealing pool of worker threads.
+//
+// The worker list only changes in DispatcherStart and DispatcherStop, under the exclusive workers lock. A submit holds
+// the lock shared while it schedules the session, and DispatcherStop refuses further submits before it joins the
+// workers, so the list is never read while it is being torn down; the workers themselves read it without the lock,
+// because it is freed only once they have exited.
+//
+// A request stays pending until its completion routine has returned, so the next request of its session cannot start
+// on another worker while the routine still runs. A completion routine that removes its own session only takes it out
+// of the map; the worker frees it once the routine has returned.
+
+/// <summary>
+/// The maximum number of requests a worker runs for one session before it yields the session back to the pool, so that a busy session does not starve the others.
+/// </summary>
+static const unsigned long SessionBatchSize = 16;
+
+/// <summary>
+/// One queued EcDoRpcExt2 request.
+/// </summary>
+struct DispatchRequest
+{
+    DispatchRequest * volatile next;
+    unsigned long ulFlags;
+    unsigned char *rgbIn;
+    unsigned long cbIn;
+    unsigned char *rgbOut;
+    unsigned long cbOut;
+    DISPATCH_COMPLETION_ROUTINE completion;
+    void *context;
+    LARGE_INTEGER enqueueTime;
+};
+
+/// <summary>
+/// A session context and its request queue. The queue is an intrusive MPSC linked list: producers exchange the head,
+/// the single consumer follows the links from the tail.
+/// </summary>
+struct DispatchSession
+{
+    CXH *pcxh;
+    DispatchRequest stub;
+    DispatchRequest * volatile head;
+    DispatchRequest *tail;
+
+    // Requests queued or running. The producer that raises it from 0 schedules the session, and the consumer stops when it drops to 0.
+    volatile LONG pending;
+    volatile LONG maxPending;
+
+    // Set by DispatcherRemoveSession from the completion routine of the last request; the worker then frees the session.
+    bool removed;
+
+    SRWLOCK statsLock;
+    unsigned long completedCount;
+    unsigned __int64 totalWait;
+    unsigned __int64 maxWait;
+    unsigned __int64 totalService;
+
+    DispatchSession(CXH *handle)
+        : pcxh(handle), tail(&stub), pending(0), maxPending(0), removed(false), completedCount(0), totalWait(0), maxWait(0), totalService(0)
+    {
+        stub.next = NULL;
+        head = &stub;
+        InitializeSRWLock(&statsLock);
+    }
+
+    void Push(DispatchRequest *request)
+    {
+        request->next = NULL;
+        DispatchRequest *previous = (DispatchRequest *)InterlockedExchangePointer((PVOID volatile *)&this->head, request);
+        previous->next = request;
+    }
+
+    /// <summary>
+    /// Remove the oldest request. Returns NULL if the queue is empty or a producer is between its exchange and its link.
+    /// </summary>
+    DispatchRequest *Pop()
+    {
+        DispatchRequest *first = this->tail;
+        DispatchRequest *next = first->next;
+        if (first == &this->stub)
+        {
+            if (next == NULL)
+            {
+                return NULL;
+            }
+
+            this->tail = next;
+            first = next;
+            next = next->next;
+        }
+
+        if (next != NULL)
+        {
+            this->tail = next;
+            return first;
+        }
+
+        if (first != this->head)
+        {
+            return NULL;
+        }
+
+        this->Push(&this->stub);
+        next = first->next;
+        if (next != NULL)
+        {
+            this->tail = next;
+            return first;
+        }
+
+        return NULL;
+    }
+};
+
+/// <summary>
+/// A worker thread and its deque of runnable sessions.
+/// </summary>
+struct DispatchWorker
+{
+    HANDLE thread;
+    CRITICAL_SECTION lock;
+    std::deque<DispatchSession *> runnable;
+    unsigned long index;
+    DispatchSession *running;       // The session whose completion routine the worker is invoking, or NULL.
+};
+
+static std::vector<DispatchWorker *> m_workers;
+static SRWLOCK m_workersLock = SRWLOCK_INIT;
+static std::map<CXH *, DispatchSession *> m_sessions;
+static SRWLOCK m_sessionsLock = SRWLOCK_INIT;
+static HANDLE m_workAvailable = NULL;
+static volatile LONG m_stopping = 0;
+static volatile LONG m_nextWorker = 0;
+static LARGE_INTEGER m_frequency;
+static DWORD m_workerTlsIndex = TLS_OUT_OF_INDEXES;
+
+static unsigned __int64 ElapsedMicroseconds(const LARGE_INTEGER &start, const LARGE_INTEGER &end)
+{
+    return (unsigned __int64)((end.QuadPart - start.QuadPart) * 1000000 / m_frequency.QuadPart);
+}
+
+/// <summary>
+/// Put a session on a worker deque. A worker reschedules onto its own deque, other threads spread sessions round-robin.
+/// </summary>
+static void ScheduleSession(DispatchSession *session)
+{
+    DispatchWorker *worker = (DispatchWorker *)TlsGetValue(m_workerTlsIndex);
+    if (worker == NULL)
+    {
+        worker = m_workers[(unsigned long)InterlockedIncrement(&m_nextWorker) % m_workers.size()];
+    }
+
+    EnterCriticalSection(&worker->lock);
+    worker->runnable.push_back(session);
+    LeaveCriticalSection(&worker->lock);
+    ReleaseSemaphore(m_workAvailable, 1, NULL);
+}
+
+/// <summary>
+/// Take a runnable session, newest first from the own deque, otherwise oldest first from another worker.
+/// </summary>
+static DispatchSession *TakeSession(DispatchWorker *self)
+{
+    DispatchSession *session = NULL;
+    EnterCriticalSection(&self->lock);
+    if (!self->runnable.empty())
+    {
+        session = self->runnable.back();
+        self->runnable.pop_back();
+    }
+    LeaveCriticalSection(&self->lock);
+
+    for (size_t i = 1; session == NULL && i < m_workers.size(); i++)
+    {
+        DispatchWorker *victim = m_workers[(self->index + i) % m_workers.size()];
+        EnterCriticalSection(&victim->lock);
+        if (!victim->runnable.empty())
+        {
+            session = victim->runnable.front();
+            victim->runnable.pop_front();
+        }
+        LeaveCriticalSection(&victim->lock);
+    }
+
+    return session;
+}
+
+/// <summary>
+/// Run one request of a session and invoke its completion routine.
+/// </summary>
+/// <returns>True if it was the last pending request; the session is then no longer owned by the caller.</returns>
+static bool RunRequest(DispatchWorker *self, DispatchSession *session, DispatchRequest *request)
+{
+    LARGE_INTEGER start;
+    LARGE_INTEGER end;
+    QueryPerformanceCounter(&start);
+
+    long reply = 0;
+    unsigned long ulFlags = request->ulFlags;
+    unsigned long cbOut = request->cbOut;
+    unsigned char rgbAuxOut[0x1008];
+    unsigned long cbAuxOut = sizeof(rgbAuxOut);
+    unsigned long ulTransTime = 0;
+
+    RpcTryExcept
+    {
+        reply = TracedEcDoRpcExt2(session->pcxh, &ulFlags, request->rgbIn, request->cbIn, request->rgbOut, &cbOut, NULL, 0, rgbAuxOut, &cbAuxOut, &ulTransTime);
+    }
+    RpcExcept( HandleException(::RpcExceptionCode()) )
+    {
+        reply = ::RpcExceptionCode();
+        cbOut = 0;
+    }
+    RpcEndExcept;
+
+    QueryPerformanceCounter(&end);
+    unsigned __int64 wait = ElapsedMicroseconds(request->enqueueTime, start);
+    unsigned __int64 service = ElapsedMicroseconds(start, end);
+
+    AcquireSRWLockExclusive(&session->statsLock);
+    session->completedCount++;
+    session->totalWait += wait;
+    session->totalService += service;
+    if (wait > session->maxWait)
+    {
+        session->maxWait = wait;
+    }
+    ReleaseSRWLockExclusive(&session->statsLock);
+
+    // The request stays pending while its completion routine runs: a request the routine submits is queued behind it
+    // and runs on this worker once the routine has returned. The session MUST NOT be touched once pending drops to 0,
+    // unless the routine removed it, in which case it is no longer reachable from the map and is freed here.
+    self->running = session;
+    request->completion(request->context, reply, cbOut);
+    self->running = NULL;
+    delete request;
+
+    bool removed = session->removed;
+    if (InterlockedDecrement(&session->pending) != 0)
+    {
+        return false;
+    }
+
+    if (removed)
+    {
+        delete session;
+    }
+
+    return true;
+}
+
+/// <summary>
+/// Run queued requests of a session in order. The caller owns the session until pending drops to 0 or the batch is used up.
+/// </summary>
+static void RunSession(DispatchWorker *self, DispatchSession *session)
+{
+    for (unsigned long i = 0; i < SessionBatchSize; i++)
+    {
+        DispatchRequest *request = session->Pop();
+        while (request == NULL)
+        {
+            // pending is raised before the push is linked, so a short spin covers a producer between its exchange and its link.
+            YieldProcessor();
+            request = session->Pop();
+        }
+
+        if (RunRequest(self, session, request))
+        {
+            return;
+        }
+    }
+
+    ScheduleSession(session);
+}
+
+static DWORD WINAPI DispatcherWorkerProc(LPVOID parameter)
+{
+    DispatchWorker *self = (DispatchWorker *)parameter;
+    TlsSetValue(m_workerTlsIndex, self);
+    while (WaitForSingleObject(m_workAvailable, INFINITE) == WAIT_OBJECT_0 && !m_stopping)
+    {
+        DispatchSession *session = TakeSession(self);
+        if (session != NULL)
+        {
+            RunSession(self, session);
+        }
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Append a request to the session queue and schedule the session if it was idle.
+/// </summary>
+static void EnqueueRequest(DispatchSession *session, DispatchRequest *request)
+{
+    LONG depth = InterlockedIncrement(&session->pending);
+    LONG maxDepth = session->maxPending;
+    while (depth > maxDepth)
+    {
+        LONG observed = InterlockedCompareExchange(&session->maxPending, depth, maxDepth);
+        if (observed == maxDepth)
+        {
+            break;
+        }
+
+        maxDepth = observed;
+    }
+
+    session->Push(request);
+    if (depth == 1)
+    {
+        ScheduleSession(session);
+    }
+}
+
+/// <summary>
+/// Start the dispatcher worker threads.
+/// </summary>
+/// <param name="workerCount">The number of worker threads. 0 means one per processor.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall DispatcherStart(unsigned long workerCount)
+{
+    AcquireSRWLockExclusive(&m_workersLock);
+    if (!m_workers.empty())
+    {
+        ReleaseSRWLockExclusive(&m_workersLock);
+        return ERROR_ALREADY_INITIALIZED;
+    }
+
+    if (workerCount == 0)
+    {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        workerCount = info.dwNumberOfProcessors;
+    }
+
+    if (m_workerTlsIndex == TLS_OUT_OF_INDEXES)
+    {
+        m_workerTlsIndex = TlsAlloc();
+        if (m_workerTlsIndex == TLS_OUT_OF_INDEXES)
+        {
+            ReleaseSRWLockExclusive(&m_workersLock);
+            return GetLastError();
+        }
+    }
+
+    QueryPerformanceFrequency(&m_frequency);
+    m_stopping = 0;
+    m_workAvailable = CreateSemaphore(NULL, 0, MAXLONG, NULL);
+    if (m_workAvailable == NULL)
+    {
+        ReleaseSRWLockExclusive(&m_workersLock);
+        return GetLastError();
+    }
+
+    for (unsigned long i = 0; i < workerCount; i++)
+    {
+        DispatchWorker *worker = new DispatchWorker();
+        worker->index = i;
+        worker->running = NULL;
+        InitializeCriticalSection(&worker->lock);
+        m_workers.push_back(worker);
+    }
+
+    for (unsigned long i = 0; i < workerCount; i++)
+    {
+        m_workers[i]->thread = CreateThread(NULL, 0, DispatcherWorkerProc, m_workers[i], 0, NULL);
+    }
+
+    ReleaseSRWLockExclusive(&m_workersLock);
+    return 0;
+}
+
+/// <summary>
+/// Stop the worker threads. Submits fail with ERROR_NOT_READY from then on; requests still queued are not run, and
+/// their completion routines are invoked on the calling thread with ERROR_CANCELLED, so that callers can release
+/// their buffers.
+/// </summary>
+void __stdcall DispatcherStop()
+{
+    // Once m_stopping is set under the exclusive lock, no submit is scheduling a session and none will start.
+    AcquireSRWLockExclusive(&m_workersLock);
+    if (m_workers.empty() || m_stopping)
+    {
+        ReleaseSRWLockExclusive(&m_workersLock);
+        return;
+    }
+
+    InterlockedExchange(&m_stopping, 1);
+    ReleaseSRWLockExclusive(&m_workersLock);
+
+    ReleaseSemaphore(m_workAvailable, (LONG)m_workers.size(), NULL);
+    for (size_t i = 0; i < m_workers.size(); i++)
+    {
+        WaitForSingleObject(m_workers[i]->thread, INFINITE);
+        CloseHandle(m_workers[i]->thread);
+        DeleteCriticalSection(&m_workers[i]->lock);
+        delete m_workers[i];
+    }
+
+    AcquireSRWLockExclusive(&m_workersLock);
+    m_workers.clear();
+    CloseHandle(m_workAvailable);
+    m_workAvailable = NULL;
+    ReleaseSRWLockExclusive(&m_workersLock);
+
+    // The sessions leave the map before the completion routines run, so a routine that removes its session finds it gone.
+    std::map<CXH *, DispatchSession *> sessions;
+    AcquireSRWLockExclusive(&m_sessionsLock);
+    sessions.swap(m_sessions);
+    ReleaseSRWLockExclusive(&m_sessionsLock);
+
+    for (std::map<CXH *, DispatchSession *>::iterator it = sessions.begin(); it != sessions.end(); ++it)
+    {
+        DispatchRequest *request;
+        while ((request = it->second->Pop()) != NULL)
+        {
+            request->completion(request->context, ERROR_CANCELLED, 0);
+            delete request;
+        }
+
+        delete it->second;
+    }
+}
+
+/// <summary>
+/// Queue an EcDoRpcExt2 request for a session. Requests of one session run in submission order, never concurrently.
+/// The request and response buffers MUST stay valid until the completion routine is invoked.
+/// </summary>
+/// <param name="pcxh">The CXH of the session. The address identifies the session in the dispatcher.</param>
+/// <param name="ulFlags">The pulFlags value passed to EcDoRpcExt2.</param>
+/// <param name="rgbIn">The ROP request payload.</param>
+/// <param name="cbIn">The size of the ROP request payload.</param>
+/// <param name="rgbOut">The buffer that receives the ROP response payload.</param>
+/// <param name="cbOut">The size of rgbOut.</param>
+/// <param name="completion">The routine invoked once the request completes.</param>
+/// <param name="context">The caller context passed back to the completion routine.</param>
+/// <returns>If the request is queued, it returns 0, else returns the error code.</returns>
+long __stdcall DispatcherSubmit(
+    CXH *pcxh,
+    unsigned long ulFlags,
+    unsigned char *rgbIn,
+    unsigned long cbIn,
+    unsigned char *rgbOut,
+    unsigned long cbOut,
+    DISPATCH_COMPLETION_ROUTINE completion,
+    void *context)
+{
+    if (pcxh == NULL || completion == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    AcquireSRWLockShared(&m_workersLock);
+    if (m_workers.empty() || m_stopping)
+    {
+        ReleaseSRWLockShared(&m_workersLock);
+        return ERROR_NOT_READY;
+    }
+
+    DispatchRequest *request = new DispatchRequest();
+    request->ulFlags = ulFlags;
+    request->rgbIn = rgbIn;
+    request->cbIn = cbIn;
+    request->rgbOut = rgbOut;
+    request->cbOut = cbOut;
+    request->completion = completion;
+    request->context = context;
+    QueryPerformanceCounter(&request->enqueueTime);
+
+    // The request is queued while the sessions lock is held, so DispatcherRemoveSession cannot free the session in between.
+    AcquireSRWLockShared(&m_sessionsLock);
+    std::map<CXH *, DispatchSession *>::iterator found = m_sessions.find(pcxh);
+    if (found != m_sessions.end())
+    {
+        EnqueueRequest(found->second, request);
+        ReleaseSRWLockShared(&m_sessionsLock);
+        ReleaseSRWLockShared(&m_workersLock);
+        return 0;
+    }
+    ReleaseSRWLockShared(&m_sessionsLock);
+
+    AcquireSRWLockExclusive(&m_sessionsLock);
+    DispatchSession *&entry = m_sessions[pcxh];
+    if (entry == NULL)
+    {
+        entry = new DispatchSession(pcxh);
+    }
+
+    EnqueueRequest(entry, request);
+    ReleaseSRWLockExclusive(&m_sessionsLock);
+    ReleaseSRWLockShared(&m_workersLock);
+
+    return 0;
+}
+
+/// <summary>
+/// Return the queue depth and wait-time statistics of a session.
+/// </summary>
+/// <param name="pcxh">The CXH address that was passed to DispatcherSubmit.</param>
+/// <param name="stats">Receives the statistics.</param>
+/// <returns>If success, it returns 0. ERROR_NOT_FOUND indicates no request was ever submitted for the session.</returns>
+long __stdcall DispatcherGetSessionStats(CXH *pcxh, SESSION_QUEUE_STATS *stats)
+{
+    if (stats == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    long status = ERROR_NOT_FOUND;
+    AcquireSRWLockShared(&m_sessionsLock);
+    std::map<CXH *, DispatchSession *>::iterator found = m_sessions.find(pcxh);
+    if (found != m_sessions.end())
+    {
+        DispatchSession *session = found->second;
+        stats->QueueDepth = (unsigned long)session->pending;
+        stats->MaxQueueDepth = (unsigned long)session->maxPending;
+
+        AcquireSRWLockShared(&session->statsLock);
+        stats->CompletedCount = session->completedCount;
+        stats->TotalWaitMicroseconds = session->totalWait;
+        stats->MaxWaitMicroseconds = session->maxWait;
+        stats->TotalServiceMicroseconds = session->totalService;
+        ReleaseSRWLockShared(&session->statsLock);
+        status = 0;
+    }
+    ReleaseSRWLockShared(&m_sessionsLock);
+
+    return status;
+}
+
+/// <summary>
+/// Forget a session, typically after EcDoDisconnect. The session MUST have no queued requests; the completion
+/// routine of its last request may remove it, and the session is then freed once that routine returns. A request
+/// submitted for the same CXH afterwards starts a new session.
+/// </summary>
+/// <param name="pcxh">The CXH address that was passed to DispatcherSubmit.</param>
+/// <returns>If success, it returns 0. ERROR_BUSY indicates the session still has requests queued or running.</returns>
+long __stdcall DispatcherRemoveSession(CXH *pcxh)
+{
+    long status = ERROR_NOT_FOUND;
+    AcquireSRWLockExclusive(&m_sessionsLock);
+    std::map<CXH *, DispatchSession *>::iterator found = m_sessions.find(pcxh);
+    if (found != m_sessions.end())
+    {
+        DispatchSession *session = found->second;
+        DispatchWorker *worker = m_workerTlsIndex == TLS_OUT_OF_INDEXES ? NULL : (DispatchWorker *)TlsGetValue(m_workerTlsIndex);
+        if (session->pending == 0)
+        {
+            delete session;
+            m_sessions.erase(found);
+            status = 0;
+        }
+        else if (session->pending == 1 && worker != NULL && worker->running == session)
+        {
+            // Called from the completion routine of the last request; RunRequest frees the session once it returns.
+            session->removed = true;
+            m_sessions.erase(found);
+            status = 0;
+        }
+        else
+        {
+            status = ERROR_BUSY;
+        }
+    }
+    ReleaseSRWLockExclusive(&m_sessionsLock);
+
+    return status;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "MS-OXCRPC.h"
+
+/// <summary>
+/// Completion routine invoked on a dispatcher worker thread when a queued EcDoRpcExt2 request finishes, or on the
+/// thread of DispatcherStop when the request is cancelled. The next request of the session starts once it returns.
+/// </summary>
+/// <param name="context">The caller context passed to DispatcherSubmit.</param>
+/// <param name="reply">The return value of EcDoRpcExt2, the RPC exception code, or ERROR_CANCELLED if DispatcherStop dropped the request.</param>
+/// <param name="cbOut">The size of the ROP response payload written to rgbOut.</param>
+typedef void (__stdcall *DISPATCH_COMPLETION_ROUTINE)(void *context, long reply, unsigned long cbOut);
+
+/// <summary>
+/// Queue statistics of one session context.
+/// </summary>
+typedef struct _SESSION_QUEUE_STATS
+{
+    unsigned long QueueDepth;       // Requests queued or running for the session.
+    unsigned long MaxQueueDepth;    // The highest value QueueDepth has reached.
+    unsigned long CompletedCount;   // Requests that have completed.
+    unsigned __int64 TotalWaitMicroseconds;     // Sum of the time completed requests spent queued before they started.
+    unsigned __int64 MaxWaitMicroseconds;       // The longest time a request spent queued.
+    unsigned __int64 TotalServiceMicroseconds;  // Sum of the EcDoRpcExt2 round trip times.
+} SESSION_QUEUE_STATS;
+
+long __stdcall DispatcherStart(unsigned long workerCount);
+
+void __stdcall DispatcherStop();
+
+long __stdcall DispatcherSubmit(
+    CXH *pcxh,
+    unsigned long ulFlags,
+    unsigned char *rgbIn,
+    unsigned long cbIn,
+    unsigned char *rgbOut,
+    unsigned long cbOut,
+    DISPATCH_COMPLETION_ROUTINE completion,
+    void *context);
+
+long __stdcall DispatcherGetSessionStats(CXH *pcxh, SESSION_QUEUE_STATS *stats);
+
+long __stdcall DispatcherRemoveSession(CXH *pcxh);
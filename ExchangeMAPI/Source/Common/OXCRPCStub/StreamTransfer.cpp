@@ -0,0 +1,415 @@
+#include "StreamTransfer.h"
+#include "PipelinedRpcCall.h"
+#include "MappedFile.h"
+
+// Moves a whole stream opened with RopOpenStream between the server and a file. Each EcDoRpcExt2 call packs as many
+// RopReadStream or RopWriteStream requests as the request and response limits allow, and the file is accessed through
+// a MappedFile, so the memory used does not depend on the size of the stream.
+//
+// While the server processes call k + 1, the response of call k is copied to the file, or the request of call k + 2
+// is copied from it.
+
+/// <summary>
+/// The ByteCount of each RopReadStream; a response of this size still fits in one 0x8000-byte response buffer.
+/// </summary>
+#define STREAM_READ_CHUNK 0x7F00
+
+/// <summary>
+/// Pack RopReadStream requests for up to bytesWanted bytes into a request buffer.
+/// </summary>
+static void PrepareReadCall(PipelinedRpcCall *call, unsigned char logonId, unsigned long streamHandle, unsigned __int64 bytesWanted)
+{
+    // Every response is answered with its fixed part and the data; keep all of them within rgbOut.
+    const unsigned long responseSize = RopCodec::ReadStream::Response::Size + STREAM_READ_CHUNK;
+    const unsigned long bufferOverhead = sizeof(RPC_HEADER_EXT) + sizeof(unsigned short) + sizeof(unsigned long);
+    unsigned long maxRops = (PIPELINED_MAX_RESPONSE - bufferOverhead) / (responseSize + bufferOverhead);
+
+    RopCodec::RopRequestWriter writer(call->rgbIn, sizeof(call->rgbIn));
+    call->ropCount = 0;
+    call->bytesRequested = 0;
+    while (call->ropCount < maxRops && call->bytesRequested < bytesWanted)
+    {
+        unsigned __int64 left = bytesWanted - call->bytesRequested;
+        unsigned short byteCount = left < STREAM_READ_CHUNK ? (unsigned short)left : STREAM_READ_CHUNK;
+        if (!writer.Append<RopCodec::ReadStream>(logonId, (unsigned char)0, byteCount))
+        {
+            break;
+        }
+
+        call->ropCount++;
+        call->bytesRequested += byteCount;
+    }
+
+    call->cbIn = writer.Finish(&streamHandle, 1);
+}
+
+/// <summary>
+/// Pack RopWriteStream requests with the next bytes of the file into a request buffer.
+/// </summary>
+static long PrepareWriteCall(PipelinedRpcCall *call, MappedFile &file, unsigned __int64 offset, unsigned char logonId, unsigned long streamHandle)
+{
+    const unsigned long ropOverhead = RopCodec::WriteStream::Request::Size;
+    RopCodec::RopRequestWriter writer(call->rgbIn, sizeof(call->rgbIn));
+    call->ropCount = 0;
+    call->bytesRequested = 0;
+    while (offset + call->bytesRequested < file.Size())
+    {
+        // Leave room for the handle table.
+        unsigned long remaining = writer.Remaining();
+        if (remaining <= ropOverhead + sizeof(unsigned long))
+        {
+            break;
+        }
+
+        unsigned long room = remaining - ropOverhead - sizeof(unsigned long);
+        unsigned __int64 left = file.Size() - offset - call->bytesRequested;
+        unsigned long dataSize = left < room ? (unsigned long)left : room;
+        if (dataSize > 0xFFFF)
+        {
+            dataSize = 0xFFFF;
+        }
+
+        if (!writer.Append<RopCodec::WriteStream>(logonId, (unsigned char)0, (unsigned short)dataSize))
+        {
+            break;
+        }
+
+        // The data is copied straight from the mapped view into the request buffer.
+        unsigned char *target = call->rgbIn + writer.Length();
+        long status = file.Read(offset + call->bytesRequested, target, dataSize);
+        if (status != 0)
+        {
+            return status;
+        }
+
+        writer.Commit(dataSize);
+        call->ropCount++;
+        call->bytesRequested += dataSize;
+    }
+
+    call->cbIn = writer.Finish(&streamHandle, 1);
+    return call->cbIn == 0 ? ERROR_INSUFFICIENT_BUFFER : 0;
+}
+
+/// <summary>
+/// Copy the data of the RopReadStream responses of a completed call to the file.
+/// </summary>
+/// <param name="endOfStream">Set if a response returned no data before the end of the file. A response with fewer bytes
+/// than its ByteCount is not the end: the server may return less than asked, and the rest is requested again.</param>
+static long ProcessReadResponse(PipelinedRpcCall *call, MappedFile &file, unsigned __int64 &offset, bool &endOfStream, STREAM_TRANSFER_STATS *stats)
+{
+    RopCodec::RopResponseReader reader(call->rgbOut, call->cbOut);
+    unsigned long processed = 0;
+    unsigned long received = 0;
+    long status;
+    while ((status = reader.NextBuffer()) == 0)
+    {
+        RopCodec::Byte ropId;
+        RopCodec::ULong returnValue;
+        while (reader.Peek(ropId, returnValue))
+        {
+            if (ropId != RopCodec::ReadStream::Id)
+            {
+                // RopBufferTooSmall: the server stopped before the remaining ROPs; they are requested again.
+                break;
+            }
+
+            RopCodec::Byte ropIdRead;
+            RopCodec::Byte inputHandleIndex;
+            RopCodec::UShort dataSize;
+            if (!reader.Read<RopCodec::ReadStream>(ropIdRead, inputHandleIndex, returnValue, dataSize))
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            const unsigned char *data = reader.Take(dataSize);
+            if (data == NULL)
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            if (returnValue != 0)
+            {
+                return (long)returnValue;
+            }
+
+            if (dataSize > file.Size() - offset)
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            status = file.Write(offset, data, dataSize);
+            if (status != 0)
+            {
+                return status;
+            }
+
+            offset += dataSize;
+            received += dataSize;
+            processed++;
+            stats->RopCount++;
+            if (dataSize == 0 && offset < file.Size())
+            {
+                endOfStream = true;
+            }
+        }
+    }
+
+    if (status != ERROR_NO_MORE_ITEMS)
+    {
+        return status;
+    }
+
+    stats->BytesTransferred += received;
+    if (processed == 0)
+    {
+        // Not even one RopReadStream was answered; stop rather than loop forever.
+        return ERROR_INVALID_DATA;
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Check the RopWriteStream responses of a completed call.
+/// </summary>
+/// <param name="written">Receives the bytes the server accepted.</param>
+static long ProcessWriteResponse(PipelinedRpcCall *call, unsigned long *written, STREAM_TRANSFER_STATS *stats)
+{
+    RopCodec::RopResponseReader reader(call->rgbOut, call->cbOut);
+    unsigned long processed = 0;
+    long status;
+    *written = 0;
+    while ((status = reader.NextBuffer()) == 0)
+    {
+        RopCodec::Byte ropId;
+        RopCodec::Byte inputHandleIndex;
+        RopCodec::ULong returnValue;
+        RopCodec::UShort writtenSize;
+        while (reader.Peek(ropId, returnValue) && ropId == RopCodec::WriteStream::Id)
+        {
+            if (!reader.Read<RopCodec::WriteStream>(ropId, inputHandleIndex, returnValue, writtenSize))
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            if (returnValue != 0)
+            {
+                return (long)returnValue;
+            }
+
+            *written += writtenSize;
+            processed++;
+            stats->RopCount++;
+        }
+    }
+
+    if (status != ERROR_NO_MORE_ITEMS)
+    {
+        return status;
+    }
+
+    // Every packed RopWriteStream has to be processed in full, or the stream would have a gap.
+    return processed == call->ropCount && *written == call->bytesRequested ? 0 : ERROR_WRITE_FAULT;
+}
+
+/// <summary>
+/// Read a whole stream opened with RopOpenStream into a file.
+/// </summary>
+/// <param name="pcxh">The CXH that was created by calling EcDoConnectEx.</param>
+/// <param name="logonId">The LogonId of the logon the stream belongs to.</param>
+/// <param name="streamHandle">The server object handle of the stream, as returned by RopOpenStream.</param>
+/// <param name="streamSize">The StreamSize returned by RopOpenStream.</param>
+/// <param name="filePath">The file to create; it is replaced if it exists.</param>
+/// <param name="stats">Receives the statistics of the transfer.</param>
+/// <returns>If success, it returns 0, else returns the error code, or the ReturnValue of the failed ROP.</returns>
+long __stdcall StreamTransferRead(
+    CXH *pcxh,
+    unsigned char logonId,
+    unsigned long streamHandle,
+    unsigned __int64 streamSize,
+    const wchar_t *filePath,
+    STREAM_TRANSFER_STATS *stats)
+{
+    if (pcxh == NULL || filePath == NULL || stats == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    memset(stats, 0, sizeof(STREAM_TRANSFER_STATS));
+    DWORD start = GetTickCount();
+
+    MappedFile file;
+    long status = file.Create(filePath, streamSize);
+    if (status != 0 || streamSize == 0)
+    {
+        return status;
+    }
+
+    PipelinedCallRing calls(2);
+    if (!calls.IsValid())
+    {
+        return GetLastError();
+    }
+
+    unsigned __int64 offset = 0;
+    unsigned __int64 requested = 0;
+    bool endOfStream = false;
+    unsigned long k = 0;
+
+    PrepareReadCall(calls[0], logonId, streamHandle, streamSize);
+    requested += calls[0]->bytesRequested;
+    status = BeginPipelinedCall(pcxh, calls[0], PIPELINED_RPC_FLAGS);
+    while (status == 0)
+    {
+        status = EndPipelinedCall(calls[k]);
+        if (status != 0)
+        {
+            break;
+        }
+
+        stats->RequestCount++;
+
+        // Start the next call before the response is copied, so that the copy overlaps the server round trip.
+        bool nextStarted = false;
+        if (requested < streamSize)
+        {
+            PrepareReadCall(calls[k + 1], logonId, streamHandle, streamSize - requested);
+            requested += calls[k + 1]->bytesRequested;
+            status = BeginPipelinedCall(pcxh, calls[k + 1], PIPELINED_RPC_FLAGS);
+            if (status != 0)
+            {
+                break;
+            }
+
+            nextStarted = true;
+        }
+
+        status = ProcessReadResponse(calls[k], file, offset, endOfStream, stats);
+        if (status != 0 || endOfStream)
+        {
+            break;
+        }
+
+        if (!nextStarted)
+        {
+            if (offset >= streamSize)
+            {
+                break;
+            }
+
+            // The server skipped ROPs of the last call; request the rest of the stream without overlap.
+            PrepareReadCall(calls[k + 1], logonId, streamHandle, streamSize - offset);
+            status = BeginPipelinedCall(pcxh, calls[k + 1], PIPELINED_RPC_FLAGS);
+            if (status != 0)
+            {
+                break;
+            }
+        }
+
+        // ROPs the server skipped are requested again by a later call.
+        requested = offset + calls[k + 1]->bytesRequested;
+        k++;
+    }
+
+    // Wait for a call still in flight, so that its buffers are not released while the RPC run-time library uses them.
+    EndPipelinedCall(calls[k + 1]);
+    if (status == 0 && offset < streamSize)
+    {
+        // A RopReadStream returned no data: the stream is shorter than RopOpenStream reported.
+        status = endOfStream ? file.Truncate(offset) : ERROR_INVALID_DATA;
+    }
+
+    stats->ElapsedMilliseconds = GetTickCount() - start;
+    return status;
+}
+
+/// <summary>
+/// Write a whole file to a stream opened with RopOpenStream in write mode. RopCommitStream is left to the caller.
+/// </summary>
+/// <param name="pcxh">The CXH that was created by calling EcDoConnectEx.</param>
+/// <param name="logonId">The LogonId of the logon the stream belongs to.</param>
+/// <param name="streamHandle">The server object handle of the stream, as returned by RopOpenStream.</param>
+/// <param name="filePath">The file to upload.</param>
+/// <param name="stats">Receives the statistics of the transfer.</param>
+/// <returns>If success, it returns 0, else returns the error code, or the ReturnValue of the failed ROP.</returns>
+long __stdcall StreamTransferWrite(
+    CXH *pcxh,
+    unsigned char logonId,
+    unsigned long streamHandle,
+    const wchar_t *filePath,
+    STREAM_TRANSFER_STATS *stats)
+{
+    if (pcxh == NULL || filePath == NULL || stats == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    memset(stats, 0, sizeof(STREAM_TRANSFER_STATS));
+    DWORD start = GetTickCount();
+
+    MappedFile file;
+    long status = file.Open(filePath);
+    if (status != 0 || file.Size() == 0)
+    {
+        return status;
+    }
+
+    PipelinedCallRing calls(2);
+    if (!calls.IsValid())
+    {
+        return GetLastError();
+    }
+
+    unsigned __int64 prepared = 0;
+    unsigned long k = 0;
+
+    status = PrepareWriteCall(calls[0], file, prepared, logonId, streamHandle);
+    if (status == 0)
+    {
+        prepared += calls[0]->bytesRequested;
+        status = BeginPipelinedCall(pcxh, calls[0], PIPELINED_RPC_FLAGS);
+    }
+
+    while (status == 0)
+    {
+        // Copy the next request from the file while the current one is in flight.
+        bool hasNext = prepared < file.Size();
+        if (hasNext)
+        {
+            status = PrepareWriteCall(calls[k + 1], file, prepared, logonId, streamHandle);
+            if (status != 0)
+            {
+                break;
+            }
+
+            prepared += calls[k + 1]->bytesRequested;
+        }
+
+        status = EndPipelinedCall(calls[k]);
+        if (status != 0)
+        {
+            break;
+        }
+
+        stats->RequestCount++;
+        unsigned long written;
+        status = ProcessWriteResponse(calls[k], &written, stats);
+        if (status != 0)
+        {
+            break;
+        }
+
+        stats->BytesTransferred += written;
+        if (!hasNext)
+        {
+            break;
+        }
+
+        k++;
+        status = BeginPipelinedCall(pcxh, calls[k], PIPELINED_RPC_FLAGS);
+    }
+
+    stats->ElapsedMilliseconds = GetTickCount() - start;
+    return status;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "MS-OXCRPC.h"
+
+/// <summary>
+/// The statistics of one stream transfer.
+/// </summary>
+typedef struct _STREAM_TRANSFER_STATS
+{
+    unsigned __int64 BytesTransferred;
+    unsigned long RequestCount;         // The number of EcDoRpcExt2 calls.
+    unsigned long RopCount;             // The number of RopReadStream or RopWriteStream responses processed.
+    unsigned long ElapsedMilliseconds;
+} STREAM_TRANSFER_STATS;
+
+long __stdcall StreamTransferRead(
+    CXH *pcxh,
+    unsigned char logonId,
+    unsigned long streamHandle,
+    unsigned __int64 streamSize,
+    const wchar_t *filePath,
+    STREAM_TRANSFER_STATS *stats);
+
+long __stdcall StreamTransferWrite(
+    CXH *pcxh,
+    unsigned char logonId,
+    unsigned long streamHandle,
+    const wchar_t *filePath,
+    STREAM_TRANSFER_STATS *stats);
@@ -0,0 +1,32 @@
+#include "StubTrace.h"
+#include "StubMetrics.h"
+
+// The entry point of the stub DLLs that compile StubTrace and StubMetrics. Both allocate an FLS index whose callback
+// lives in the DLL; the indexes are freed when the DLL is unloaded, or a thread exiting after FreeLibrary would call
+// into unmapped code.
+
+/// <summary>
+/// The entry point of the DLL.
+/// </summary>
+/// <param name="module">The handle of the DLL.</param>
+/// <param name="reason">The reason the entry point is called.</param>
+/// <param name="reserved">NULL if the DLL is loaded or unloaded dynamically.</param>
+/// <returns>TRUE.</returns>
+BOOL WINAPI DllMain(HINSTANCE module, DWORD reason, LPVOID reserved)
+{
+    UNREFERENCED_PARAMETER(reserved);
+
+    switch (reason)
+    {
+    case DLL_PROCESS_ATTACH:
+        DisableThreadLibraryCalls(module);
+        break;
+
+    case DLL_PROCESS_DETACH:
+        StubTraceDetach();
+        StubMetricsDetach();
+        break;
+    }
+
+    return TRUE;
+}
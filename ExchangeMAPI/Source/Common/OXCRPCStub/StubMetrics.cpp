@@ -0,0 +1,749 @@
+#include "StubMetrics.h"
+#include "StubTrace.h"
+#include <intrin.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <new>
+#include <string>
+
+// Metrics of the calls of a stub, kept whether or not it traces. Each thread counts into a shard of its own, so a call
+// only writes to memory no other thread writes to: 32-bit counters with plain stores and 64-bit sums with an
+// interlocked add that never contends, so that a snapshot reads them whole on x86. The counters of an operation are
+// allocated in a shard the first time the thread calls it. A thread takes a shard on its first call and gives it back
+// when it exits; shards are kept for the life of the process and reused, so their counts keep adding up. A snapshot
+// sums all shards without stopping the threads, so it may miss the calls in progress.
+
+/// <summary>
+/// The counters of one operation in one shard.
+/// </summary>
+struct OperationCounters
+{
+    volatile LONG callCount;
+    volatile LONG faultCount;
+    volatile LONG errorCount;
+    volatile LONG otherErrorCount;
+    volatile LONG maxMicroseconds;
+    volatile LONG errorCodeCount;           // The entries of errorCodes in use; a code is set before its count.
+    volatile LONG errorCodes[STUB_METRICS_ERROR_CODES];
+    volatile LONG errorCounts[STUB_METRICS_ERROR_CODES];
+    volatile LONGLONG requestBytes;
+    volatile LONGLONG responseBytes;
+    volatile LONGLONG totalMicroseconds;
+    volatile LONG buckets[STUB_METRICS_BUCKETS];
+};
+
+/// <summary>
+/// The counters of one thread.
+/// </summary>
+struct MetricsShard
+{
+    MetricsShard *next;                     // The next shard in the list of all shards.
+    volatile LONG owned;                    // 1 while a thread uses the shard.
+    volatile LONGLONG allocationCount;
+    volatile LONGLONG allocationBytes;
+    volatile LONGLONG freeCount;
+    OperationCounters * volatile operations[STUB_METRICS_INTERFACES][STUB_METRICS_OPNUMS];
+};
+
+/// <summary>
+/// The name of an operation in the metrics text.
+/// </summary>
+struct OperationName
+{
+    unsigned char interfaceId;
+    unsigned char opnum;
+    const char *name;
+};
+
+static const OperationName OperationNames[] =
+{
+    { STUB_TRACE_EMSMDB, 1, "EcDoDisconnect" },
+    { STUB_TRACE_EMSMDB, 4, "EcRRegisterPushNotification" },
+    { STUB_TRACE_EMSMDB, 6, "EcDummyRpc" },
+    { STUB_TRACE_EMSMDB, 10, "EcDoConnectEx" },
+    { STUB_TRACE_EMSMDB, 11, "EcDoRpcExt2" },
+    { STUB_TRACE_EMSMDB, 14, "EcDoAsyncConnectEx" },
+    { STUB_TRACE_ASYNCEMSMDB, 0, "EcDoAsyncWaitEx" },
+    { STUB_TRACE_NSPI, 0, "NspiBind" },
+    { STUB_TRACE_NSPI, 1, "NspiUnbind" },
+    { STUB_TRACE_NSPI, 2, "NspiUpdateStat" },
+    { STUB_TRACE_NSPI, 3, "NspiQueryRows" },
+    { STUB_TRACE_NSPI, 4, "NspiSeekEntries" },
+    { STUB_TRACE_NSPI, 5, "NspiGetMatches" },
+    { STUB_TRACE_NSPI, 6, "NspiResortRestriction" },
+    { STUB_TRACE_NSPI, 7, "NspiDNToMId" },
+    { STUB_TRACE_NSPI, 8, "NspiGetPropList" },
+    { STUB_TRACE_NSPI, 9, "NspiGetProps" },
+    { STUB_TRACE_NSPI, 10, "NspiCompareMIds" },
+    { STUB_TRACE_NSPI, 11, "NspiModProps" },
+    { STUB_TRACE_NSPI, 12, "NspiGetSpecialTable" },
+    { STUB_TRACE_NSPI, 13, "NspiGetTemplateInfo" },
+    { STUB_TRACE_NSPI, 14, "NspiModLinkAtt" },
+    { STUB_TRACE_NSPI, 16, "NspiQueryColumns" },
+    { STUB_TRACE_NSPI, 19, "NspiResolveNames" },
+    { STUB_TRACE_NSPI, 20, "NspiResolveNamesW" }
+};
+
+static const char *InterfaceNames[STUB_METRICS_INTERFACES] = { "Unknown", "EMSMDB", "AsyncEMSMDB", "NSPI" };
+
+static VOID WINAPI ReleaseShard(PVOID data);
+
+static MetricsShard * volatile m_shards = NULL;
+static volatile LONG m_shardCount = 0;
+static DWORD m_flsIndex = FlsAlloc(ReleaseShard);
+static volatile LONG m_contextHandles = 0;
+static volatile LONG m_bindingHandles = 0;
+
+/// <summary>
+/// Give the shard of a thread back when the thread exits; its counts stay in the totals.
+/// </summary>
+static VOID WINAPI ReleaseShard(PVOID data)
+{
+    if (data != NULL)
+    {
+        InterlockedExchange(&((MetricsShard *)data)->owned, 0);
+    }
+}
+
+/// <summary>
+/// Get the shard of the calling thread: the one it took, else a shard given back by an exited thread, else a new one.
+/// </summary>
+static MetricsShard *AcquireShard()
+{
+    if (m_flsIndex == FLS_OUT_OF_INDEXES)
+    {
+        return NULL;
+    }
+
+    MetricsShard *shard = (MetricsShard *)FlsGetValue(m_flsIndex);
+    if (shard != NULL)
+    {
+        return shard;
+    }
+
+    for (MetricsShard *candidate = m_shards; candidate != NULL; candidate = candidate->next)
+    {
+        if (candidate->owned == 0 && InterlockedCompareExchange(&candidate->owned, 1, 0) == 0)
+        {
+            shard = candidate;
+            break;
+        }
+    }
+
+    if (shard == NULL)
+    {
+        shard = new (std::nothrow) MetricsShard();
+        if (shard == NULL)
+        {
+            return NULL;
+        }
+
+        shard->owned = 1;
+        MetricsShard *first;
+        do
+        {
+            first = m_shards;
+            shard->next = first;
+        }
+        while (InterlockedCompareExchangePointer((PVOID volatile *)&m_shards, shard, first) != first);
+
+        InterlockedIncrement(&m_shardCount);
+    }
+
+    if (!FlsSetValue(m_flsIndex, shard))
+    {
+        InterlockedExchange(&shard->owned, 0);
+        return NULL;
+    }
+
+    return shard;
+}
+
+/// <summary>
+/// Read a 64-bit counter whole, even while its thread adds to it.
+/// </summary>
+static unsigned __int64 Read64(volatile LONGLONG *value)
+{
+    return (unsigned __int64)InterlockedCompareExchange64(value, 0, 0);
+}
+
+/// <summary>
+/// Get the latency bucket of a duration.
+/// </summary>
+static unsigned long BucketIndex(unsigned long duration)
+{
+    if (duration < 32)
+    {
+        return duration;
+    }
+
+    unsigned long exponent;
+    _BitScanReverse(&exponent, duration);
+    return 32 + (exponent - 5) * 16 + ((duration >> (exponent - 4)) & 15);
+}
+
+/// <summary>
+/// Whether a return value reports success: 0, or 1 for NspiUnbind as specified in MS-OXNSPI section 3.1.4.1.2.
+/// </summary>
+static bool IsSuccess(unsigned char interfaceId, unsigned char opnum, long returnCode)
+{
+    return returnCode == 0 || (interfaceId == STUB_TRACE_NSPI && opnum == 1 && returnCode == 1);
+}
+
+/// <summary>
+/// Count a call in the shard of the calling thread.
+/// </summary>
+/// <param name="interfaceId">One of the STUB_TRACE_ interface values.</param>
+/// <param name="opnum">The opnum of the call.</param>
+/// <param name="fault">Nonzero if the call raised an RPC exception, whose code is returnCode.</param>
+/// <param name="returnCode">The return value of the call, or the exception code.</param>
+/// <param name="requestBytes">The size of the buffers the call sent.</param>
+/// <param name="responseBytes">The size of the buffers the call received.</param>
+/// <param name="duration">The time the call took, in microseconds.</param>
+void StubMetricsRecord(unsigned char interfaceId, unsigned char opnum, int fault, long returnCode, unsigned long requestBytes, unsigned long responseBytes, unsigned long duration)
+{
+    if (interfaceId >= STUB_METRICS_INTERFACES || opnum >= STUB_METRICS_OPNUMS)
+    {
+        return;
+    }
+
+    MetricsShard *shard = AcquireShard();
+    if (shard == NULL)
+    {
+        return;
+    }
+
+    OperationCounters *counters = shard->operations[interfaceId][opnum];
+    if (counters == NULL)
+    {
+        counters = new (std::nothrow) OperationCounters();
+        if (counters == NULL)
+        {
+            return;
+        }
+
+        InterlockedExchangePointer((PVOID volatile *)&shard->operations[interfaceId][opnum], counters);
+    }
+
+    counters->callCount++;
+    if (fault)
+    {
+        counters->faultCount++;
+    }
+    else if (!IsSuccess(interfaceId, opnum, returnCode))
+    {
+        counters->errorCount++;
+        LONG used = counters->errorCodeCount;
+        LONG index = 0;
+        while (index < used && counters->errorCodes[index] != returnCode)
+        {
+            index++;
+        }
+
+        if (index < used)
+        {
+            counters->errorCounts[index]++;
+        }
+        else if (used < STUB_METRICS_ERROR_CODES)
+        {
+            counters->errorCodes[used] = returnCode;
+            counters->errorCounts[used] = 1;
+            InterlockedExchange(&counters->errorCodeCount, used + 1);
+        }
+        else
+        {
+            counters->otherErrorCount++;
+        }
+    }
+
+    if ((unsigned long)counters->maxMicroseconds < duration)
+    {
+        counters->maxMicroseconds = (LONG)duration;
+    }
+
+    counters->buckets[BucketIndex(duration)]++;
+    InterlockedExchangeAdd64(&counters->requestBytes, requestBytes);
+    InterlockedExchangeAdd64(&counters->responseBytes, responseBytes);
+    InterlockedExchangeAdd64(&counters->totalMicroseconds, duration);
+}
+
+/// <summary>
+/// Count a context handle the stub opened, with a delta of 1, or closed, with a delta of -1.
+/// </summary>
+void StubMetricsContextHandle(long delta)
+{
+    InterlockedExchangeAdd(&m_contextHandles, delta);
+}
+
+/// <summary>
+/// Count a binding handle the stub created, with a delta of 1, or freed, with a delta of -1.
+/// </summary>
+void StubMetricsBindingHandle(long delta)
+{
+    InterlockedExchangeAdd(&m_bindingHandles, delta);
+}
+
+/// <summary>
+/// Count a block midl_user_allocate returned.
+/// </summary>
+void StubMetricsAllocate(size_t size)
+{
+    MetricsShard *shard = AcquireShard();
+    if (shard != NULL)
+    {
+        InterlockedExchangeAdd64(&shard->allocationCount, 1);
+        InterlockedExchangeAdd64(&shard->allocationBytes, (LONGLONG)size);
+    }
+}
+
+/// <summary>
+/// Count a block midl_user_free released.
+/// </summary>
+void StubMetricsFree()
+{
+    MetricsShard *shard = AcquireShard();
+    if (shard != NULL)
+    {
+        InterlockedExchangeAdd64(&shard->freeCount, 1);
+    }
+}
+
+/// <summary>
+/// Free the FLS index of the shards when the DLL is unloaded, so that no thread that exits later calls ReleaseShard.
+/// Call it from DllMain only.
+/// </summary>
+void StubMetricsDetach()
+{
+    if (m_flsIndex != FLS_OUT_OF_INDEXES)
+    {
+        FlsFree(m_flsIndex);
+        m_flsIndex = FLS_OUT_OF_INDEXES;
+    }
+}
+
+/// <summary>
+/// Get the largest duration, in microseconds, that falls into a latency bucket.
+/// </summary>
+unsigned long StubMetricsBucketBound(unsigned long bucket)
+{
+    if (bucket < 32)
+    {
+        return bucket;
+    }
+
+    unsigned long exponent = 5 + (bucket - 32) / 16;
+    unsigned __int64 lower = (unsigned __int64)(16 + (bucket - 32) % 16) << (exponent - 4);
+    unsigned __int64 upper = lower + ((unsigned __int64)1 << (exponent - 4)) - 1;
+    return upper > 0xFFFFFFFF ? 0xFFFFFFFF : (unsigned long)upper;
+}
+
+/// <summary>
+/// Get the duration below which the given fraction, in thousandths, of the calls of an operation fall.
+/// </summary>
+static unsigned long Percentile(const STUB_METRICS_OPERATION &operation, unsigned long thousandths)
+{
+    if (operation.CallCount == 0)
+    {
+        return 0;
+    }
+
+    unsigned __int64 rank = (operation.CallCount * thousandths + 999) / 1000;
+    unsigned __int64 seen = 0;
+    for (unsigned long bucket = 0; bucket < STUB_METRICS_BUCKETS; bucket++)
+    {
+        seen += operation.Buckets[bucket];
+        if (seen >= rank && seen > 0)
+        {
+            unsigned long bound = StubMetricsBucketBound(bucket);
+            return bound < operation.MaxMicroseconds ? bound : operation.MaxMicroseconds;
+        }
+    }
+
+    return operation.MaxMicroseconds;
+}
+
+/// <summary>
+/// Add the counters of an operation in one shard to its totals.
+/// </summary>
+static void AddCounters(STUB_METRICS_OPERATION &operation, OperationCounters *counters)
+{
+    operation.CallCount += (unsigned long)counters->callCount;
+    operation.FaultCount += (unsigned long)counters->faultCount;
+    operation.ErrorCount += (unsigned long)counters->errorCount;
+    operation.OtherErrorCount += (unsigned long)counters->otherErrorCount;
+    operation.RequestBytes += Read64(&counters->requestBytes);
+    operation.ResponseBytes += Read64(&counters->responseBytes);
+    operation.TotalMicroseconds += Read64(&counters->totalMicroseconds);
+    if ((unsigned long)counters->maxMicroseconds > operation.MaxMicroseconds)
+    {
+        operation.MaxMicroseconds = (unsigned long)counters->maxMicroseconds;
+    }
+
+    for (unsigned long bucket = 0; bucket < STUB_METRICS_BUCKETS; bucket++)
+    {
+        operation.Buckets[bucket] += (unsigned long)counters->buckets[bucket];
+    }
+
+    // The codes of the shards are merged; a code that does not fit counts as another error.
+    LONG used = counters->errorCodeCount;
+    for (LONG i = 0; i < used; i++)
+    {
+        long code = counters->errorCodes[i];
+        unsigned long count = (unsigned long)counters->errorCounts[i];
+        unsigned short index = 0;
+        while (index < operation.ErrorCodeCount && operation.Errors[index].Code != code)
+        {
+            index++;
+        }
+
+        if (index < operation.ErrorCodeCount)
+        {
+            operation.Errors[index].Count += count;
+        }
+        else if (operation.ErrorCodeCount < STUB_METRICS_ERROR_CODES)
+        {
+            operation.Errors[index].Code = code;
+            operation.Errors[index].Count = count;
+            operation.ErrorCodeCount++;
+        }
+        else
+        {
+            operation.OtherErrorCount += count;
+        }
+    }
+}
+
+/// <summary>
+/// Take a snapshot of the metrics of this stub.
+/// </summary>
+/// <param name="metrics">Receives the metrics that are not kept by operation, and the number of operations called.</param>
+/// <param name="operations">Receives the metrics of each operation called, or NULL to only get their number.</param>
+/// <param name="capacity">The number of entries of operations.</param>
+/// <returns>If success, it returns 0. ERROR_MORE_DATA indicates operations cannot hold metrics->OperationCount entries;
+/// the ones that fit are filled.</returns>
+long __stdcall GetStubMetrics(STUB_METRICS *metrics, STUB_METRICS_OPERATION *operations, unsigned long capacity)
+{
+    if (metrics == NULL || (operations == NULL && capacity != 0))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    memset(metrics, 0, sizeof(STUB_METRICS));
+    metrics->ShardCount = (unsigned long)m_shardCount;
+    metrics->ContextHandles = m_contextHandles;
+    metrics->BindingHandles = m_bindingHandles;
+    for (MetricsShard *shard = m_shards; shard != NULL; shard = shard->next)
+    {
+        metrics->AllocationCount += Read64(&shard->allocationCount);
+        metrics->AllocationBytes += Read64(&shard->allocationBytes);
+        metrics->FreeCount += Read64(&shard->freeCount);
+    }
+
+    for (unsigned char interfaceId = 0; interfaceId < STUB_METRICS_INTERFACES; interfaceId++)
+    {
+        for (unsigned char opnum = 0; opnum < STUB_METRICS_OPNUMS; opnum++)
+        {
+            bool called = false;
+            for (MetricsShard *shard = m_shards; shard != NULL && !called; shard = shard->next)
+            {
+                called = shard->operations[interfaceId][opnum] != NULL;
+            }
+
+            if (!called)
+            {
+                continue;
+            }
+
+            if (metrics->OperationCount < capacity)
+            {
+                STUB_METRICS_OPERATION &operation = operations[metrics->OperationCount];
+                memset(&operation, 0, sizeof(operation));
+                operation.Interface = interfaceId;
+                operation.Opnum = opnum;
+                for (MetricsShard *shard = m_shards; shard != NULL; shard = shard->next)
+                {
+                    OperationCounters *counters = shard->operations[interfaceId][opnum];
+                    if (counters != NULL)
+                    {
+                        AddCounters(operation, counters);
+                    }
+                }
+
+                operation.P50Microseconds = Percentile(operation, 500);
+                operation.P90Microseconds = Percentile(operation, 900);
+                operation.P99Microseconds = Percentile(operation, 990);
+                operation.P999Microseconds = Percentile(operation, 999);
+            }
+
+            metrics->OperationCount++;
+        }
+    }
+
+    return metrics->OperationCount > capacity ? ERROR_MORE_DATA : 0;
+}
+
+/// <summary>
+/// Get the name of an operation, or NULL if it is not known.
+/// </summary>
+static const char *FindOperationName(unsigned char interfaceId, unsigned char opnum)
+{
+    for (size_t i = 0; i < sizeof(OperationNames) / sizeof(OperationNames[0]); i++)
+    {
+        if (OperationNames[i].interfaceId == interfaceId && OperationNames[i].opnum == opnum)
+        {
+            return OperationNames[i].name;
+        }
+    }
+
+    return NULL;
+}
+
+/// <summary>
+/// Get the file name of the stub module without its extension, to tell the metrics of the two stubs apart.
+/// </summary>
+static std::string ModuleName()
+{
+    HMODULE module = NULL;
+    char path[MAX_PATH] = { 0 };
+    if (GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT, (LPCSTR)&GetStubMetrics, &module))
+    {
+        GetModuleFileNameA(module, path, MAX_PATH);
+    }
+
+    std::string name(path);
+    size_t slash = name.find_last_of("\\/");
+    if (slash != std::string::npos)
+    {
+        name.erase(0, slash + 1);
+    }
+
+    size_t dot = name.rfind('.');
+    if (dot != std::string::npos)
+    {
+        name.erase(dot);
+    }
+
+    return name;
+}
+
+/// <summary>
+/// Append formatted text to a string.
+/// </summary>
+static void Append(std::string &text, const char *format, ...)
+{
+    char line[512];
+    va_list arguments;
+    va_start(arguments, format);
+    int length = vsprintf_s(line, sizeof(line), format, arguments);
+    va_end(arguments);
+    if (length > 0)
+    {
+        text.append(line, (size_t)length);
+    }
+}
+
+/// <summary>
+/// Write the metrics in the Prometheus text exposition format. The latency is a histogram whose bounds are one below
+/// each power of two microseconds, which the fine buckets add up to exactly, and the percentiles are gauges.
+/// </summary>
+static void FormatPrometheus(std::string &text, const std::string &module, const STUB_METRICS &metrics, const STUB_METRICS_OPERATION *operations)
+{
+    const char *m = module.c_str();
+    Append(text, "# HELP stub_shards Per-thread counter shards of the stub.\n# TYPE stub_shards gauge\n");
+    Append(text, "stub_shards{module=\"%s\"} %lu\n", m, metrics.ShardCount);
+    Append(text, "# HELP stub_context_handles Context handles the stub has open.\n# TYPE stub_context_handles gauge\n");
+    Append(text, "stub_context_handles{module=\"%s\"} %ld\n", m, metrics.ContextHandles);
+    Append(text, "# HELP stub_binding_handles Binding handles the stub has created.\n# TYPE stub_binding_handles gauge\n");
+    Append(text, "stub_binding_handles{module=\"%s\"} %ld\n", m, metrics.BindingHandles);
+    Append(text, "# HELP stub_allocations_total Blocks returned by midl_user_allocate.\n# TYPE stub_allocations_total counter\n");
+    Append(text, "stub_allocations_total{module=\"%s\"} %I64u\n", m, metrics.AllocationCount);
+    Append(text, "# HELP stub_allocated_bytes_total Bytes returned by midl_user_allocate.\n# TYPE stub_allocated_bytes_total counter\n");
+    Append(text, "stub_allocated_bytes_total{module=\"%s\"} %I64u\n", m, metrics.AllocationBytes);
+    Append(text, "# HELP stub_frees_total Blocks released by midl_user_free.\n# TYPE stub_frees_total counter\n");
+    Append(text, "stub_frees_total{module=\"%s\"} %I64u\n", m, metrics.FreeCount);
+
+    static const char *counters[] =
+    {
+        "stub_calls_total", "Calls of the operation.",
+        "stub_faults_total", "Calls of the operation that raised an RPC exception.",
+        "stub_request_bytes_total", "Bytes sent by the operation.",
+        "stub_response_bytes_total", "Bytes received by the operation."
+    };
+
+    for (int counter = 0; counter < 4; counter++)
+    {
+        Append(text, "# HELP %s %s\n# TYPE %s counter\n", counters[counter * 2], counters[counter * 2 + 1], counters[counter * 2]);
+        for (unsigned long i = 0; i < metrics.OperationCount; i++)
+        {
+            const STUB_METRICS_OPERATION &operation = operations[i];
+            unsigned __int64 values[4] = { operation.CallCount, operation.FaultCount, operation.RequestBytes, operation.ResponseBytes };
+            const char *name = FindOperationName(operation.Interface, operation.Opnum);
+            Append(text, "%s{module=\"%s\",interface=\"%s\",opnum=\"%u\",operation=\"%s\"} %I64u\n", counters[counter * 2], m,
+                InterfaceNames[operation.Interface], operation.Opnum, name != NULL ? name : "", values[counter]);
+        }
+    }
+
+    Append(text, "# HELP stub_errors_total Calls of the operation that returned an error code.\n# TYPE stub_errors_total counter\n");
+    for (unsigned long i = 0; i < metrics.OperationCount; i++)
+    {
+        const STUB_METRICS_OPERATION &operation = operations[i];
+        const char *name = FindOperationName(operation.Interface, operation.Opnum);
+        for (unsigned short e = 0; e < operation.ErrorCodeCount; e++)
+        {
+            Append(text, "stub_errors_total{module=\"%s\",interface=\"%s\",opnum=\"%u\",operation=\"%s\",code=\"0x%08lX\"} %lu\n", m,
+                InterfaceNames[operation.Interface], operation.Opnum, name != NULL ? name : "", (unsigned long)operation.Errors[e].Code, operation.Errors[e].Count);
+        }
+
+        if (operation.OtherErrorCount > 0)
+        {
+            Append(text, "stub_errors_total{module=\"%s\",interface=\"%s\",opnum=\"%u\",operation=\"%s\",code=\"other\"} %I64u\n", m,
+                InterfaceNames[operation.Interface], operation.Opnum, name != NULL ? name : "", operation.OtherErrorCount);
+        }
+    }
+
+    Append(text, "# HELP stub_latency_microseconds Latency of the operation.\n# TYPE stub_latency_microseconds histogram\n");
+    for (unsigned long i = 0; i < metrics.OperationCount; i++)
+    {
+        const STUB_METRICS_OPERATION &operation = operations[i];
+        const char *name = FindOperationName(operation.Interface, operation.Opnum);
+        unsigned __int64 cumulative = 0;
+        unsigned long bucket = 0;
+        for (int exponent = 0; exponent < 32; exponent++)
+        {
+            // The latencies up to 2^exponent - 1 microseconds are the ones of the buckets whose bound is below 2^exponent.
+            unsigned long limit = (unsigned long)1 << exponent;
+            while (bucket < STUB_METRICS_BUCKETS && StubMetricsBucketBound(bucket) < limit)
+            {
+                cumulative += operation.Buckets[bucket++];
+            }
+
+            Append(text, "stub_latency_microseconds_bucket{module=\"%s\",interface=\"%s\",opnum=\"%u\",operation=\"%s\",le=\"%lu\"} %I64u\n", m,
+                InterfaceNames[operation.Interface], operation.Opnum, name != NULL ? name : "", limit - 1, cumulative);
+        }
+
+        Append(text, "stub_latency_microseconds_bucket{module=\"%s\",interface=\"%s\",opnum=\"%u\",operation=\"%s\",le=\"+Inf\"} %I64u\n", m,
+            InterfaceNames[operation.Interface], operation.Opnum, name != NULL ? name : "", operation.CallCount);
+        Append(text, "stub_latency_microseconds_sum{module=\"%s\",interface=\"%s\",opnum=\"%u\",operation=\"%s\"} %I64u\n", m,
+            InterfaceNames[operation.Interface], operation.Opnum, name != NULL ? name : "", operation.TotalMicroseconds);
+        Append(text, "stub_latency_microseconds_count{module=\"%s\",interface=\"%s\",opnum=\"%u\",operation=\"%s\"} %I64u\n", m,
+            InterfaceNames[operation.Interface], operation.Opnum, name != NULL ? name : "", operation.CallCount);
+    }
+
+    Append(text, "# HELP stub_latency_quantile_microseconds Latency percentiles of the operation.\n# TYPE stub_latency_quantile_microseconds gauge\n");
+    for (unsigned long i = 0; i < metrics.OperationCount; i++)
+    {
+        const STUB_METRICS_OPERATION &operation = operations[i];
+        const char *name = FindOperationName(operation.Interface, operation.Opnum);
+        const char *quantiles[5] = { "0.5", "0.9", "0.99", "0.999", "1" };
+        unsigned long values[5] = { operation.P50Microseconds, operation.P90Microseconds, operation.P99Microseconds, operation.P999Microseconds, operation.MaxMicroseconds };
+        for (int q = 0; q < 5; q++)
+        {
+            Append(text, "stub_latency_quantile_microseconds{module=\"%s\",interface=\"%s\",opnum=\"%u\",operation=\"%s\",quantile=\"%s\"} %lu\n", m,
+                InterfaceNames[operation.Interface], operation.Opnum, name != NULL ? name : "", quantiles[q], values[q]);
+        }
+    }
+}
+
+/// <summary>
+/// Write the metrics as a JSON object. The latency buckets are the non-empty fine buckets, as pairs of their largest
+/// duration and their count.
+/// </summary>
+static void FormatJson(std::string &text, const std::string &module, const STUB_METRICS &metrics, const STUB_METRICS_OPERATION *operations)
+{
+    Append(text, "{\"module\":\"%s\",\"shards\":%lu,\"contextHandles\":%ld,\"bindingHandles\":%ld,", module.c_str(), metrics.ShardCount,
+        metrics.ContextHandles, metrics.BindingHandles);
+    Append(text, "\"allocations\":{\"count\":%I64u,\"bytes\":%I64u,\"frees\":%I64u},\"operations\":[", metrics.AllocationCount,
+        metrics.AllocationBytes, metrics.FreeCount);
+    for (unsigned long i = 0; i < metrics.OperationCount; i++)
+    {
+        const STUB_METRICS_OPERATION &operation = operations[i];
+        const char *name = FindOperationName(operation.Interface, operation.Opnum);
+        Append(text, "%s{\"interface\":\"%s\",\"opnum\":%u,\"name\":\"%s\",\"calls\":%I64u,\"faults\":%I64u,\"errors\":%I64u,\"errorCodes\":{",
+            i == 0 ? "" : ",", InterfaceNames[operation.Interface], operation.Opnum, name != NULL ? name : "", operation.CallCount,
+            operation.FaultCount, operation.ErrorCount);
+        for (unsigned short e = 0; e < operation.ErrorCodeCount; e++)
+        {
+            Append(text, "%s\"0x%08lX\":%lu", e == 0 ? "" : ",", (unsigned long)operation.Errors[e].Code, operation.Errors[e].Count);
+        }
+
+        Append(text, "},\"otherErrors\":%I64u,\"requestBytes\":%I64u,\"responseBytes\":%I64u,", operation.OtherErrorCount,
+            operation.RequestBytes, operation.ResponseBytes);
+        Append(text, "\"latency\":{\"totalMicroseconds\":%I64u,\"max\":%lu,\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"p999\":%lu,\"buckets\":[",
+            operation.TotalMicroseconds, operation.MaxMicroseconds, operation.P50Microseconds, operation.P90Microseconds,
+            operation.P99Microseconds, operation.P999Microseconds);
+        bool first = true;
+        for (unsigned long bucket = 0; bucket < STUB_METRICS_BUCKETS; bucket++)
+        {
+            if (operation.Buckets[bucket] != 0)
+            {
+                Append(text, "%s[%lu,%I64u]", first ? "" : ",", StubMetricsBucketBound(bucket), operation.Buckets[bucket]);
+                first = false;
+            }
+        }
+
+        Append(text, "]}}");
+    }
+
+    Append(text, "]}\n");
+}
+
+/// <summary>
+/// Write a snapshot of the metrics of this stub as text, for a dashboard to scrape.
+/// </summary>
+/// <param name="format">STUB_METRICS_FORMAT_PROMETHEUS or STUB_METRICS_FORMAT_JSON.</param>
+/// <param name="buffer">Receives the text and a terminating null, or NULL to only get its size.</param>
+/// <param name="size">On input, the size of buffer; on output, the size of the text and its terminating null.</param>
+/// <returns>If success, it returns 0. ERROR_MORE_DATA indicates the buffer is too small; size is set.</returns>
+long __stdcall GetStubMetricsText(unsigned long format, char *buffer, unsigned long *size)
+{
+    if (size == NULL || (buffer == NULL && *size != 0) || (format != STUB_METRICS_FORMAT_PROMETHEUS && format != STUB_METRICS_FORMAT_JSON))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    STUB_METRICS metrics;
+    STUB_METRICS_OPERATION *operations = NULL;
+    unsigned long capacity = 0;
+    long status = GetStubMetrics(&metrics, NULL, 0);
+    while (status == ERROR_MORE_DATA)
+    {
+        // Operations called for the first time between the two snapshots are left to the next one.
+        delete[] operations;
+        capacity = metrics.OperationCount;
+        operations = new (std::nothrow) STUB_METRICS_OPERATION[capacity];
+        if (operations == NULL)
+        {
+            return ERROR_OUTOFMEMORY;
+        }
+
+        status = GetStubMetrics(&metrics, operations, capacity);
+        if (status == ERROR_MORE_DATA)
+        {
+            metrics.OperationCount = capacity;
+            status = 0;
+        }
+    }
+
+    std::string text;
+    std::string module = ModuleName();
+    if (format == STUB_METRICS_FORMAT_PROMETHEUS)
+    {
+        FormatPrometheus(text, module, metrics, operations);
+    }
+    else
+    {
+        FormatJson(text, module, metrics, operations);
+    }
+
+    delete[] operations;
+    unsigned long required = (unsigned long)text.size() + 1;
+    if (*size < required)
+    {
+        *size = required;
+        return ERROR_MORE_DATA;
+    }
+
+    memcpy(buffer, text.c_str(), required);
+    *size = required;
+    return 0;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <windows.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// <summary>
+/// The operations a stub keeps metrics for: the STUB_TRACE_ interface values, and the opnums within an interface.
+/// </summary>
+#define STUB_METRICS_INTERFACES     4
+#define STUB_METRICS_OPNUMS         32
+
+/// <summary>
+/// The number of distinct error codes counted for an operation; the errors with other codes are counted together.
+/// </summary>
+#define STUB_METRICS_ERROR_CODES    8
+
+/// <summary>
+/// The number of latency buckets. Latencies below 32 microseconds have a bucket each; above, each power of two is
+/// split into 16 buckets, so a bucket is at most 1/16 of its lower bound wide, up to 2^32 microseconds.
+/// </summary>
+#define STUB_METRICS_BUCKETS        464
+
+/// <summary>
+/// The text formats of GetStubMetricsText.
+/// </summary>
+#define STUB_METRICS_FORMAT_PROMETHEUS  0   // The Prometheus text exposition format.
+#define STUB_METRICS_FORMAT_JSON        1
+
+/// <summary>
+/// The number of calls of an operation that returned an error code.
+/// </summary>
+typedef struct _STUB_METRICS_ERROR
+{
+    long Code;
+    unsigned long Count;
+} STUB_METRICS_ERROR;
+
+/// <summary>
+/// The metrics of one operation of a stub, summed over all threads.
+/// </summary>
+typedef struct _STUB_METRICS_OPERATION
+{
+    unsigned char Interface;                // One of the STUB_TRACE_ interface values.
+    unsigned char Opnum;
+    unsigned short ErrorCodeCount;          // The entries of Errors in use.
+    unsigned long MaxMicroseconds;
+    unsigned __int64 CallCount;             // All calls, faults and errors included.
+    unsigned __int64 FaultCount;            // Calls that raised an RPC exception.
+    unsigned __int64 ErrorCount;            // Calls that returned an error code.
+    unsigned __int64 OtherErrorCount;       // Errors whose code did not fit in Errors.
+    unsigned __int64 RequestBytes;
+    unsigned __int64 ResponseBytes;
+    unsigned __int64 TotalMicroseconds;
+    unsigned long P50Microseconds;          // The upper bound of the bucket of the percentile, up to MaxMicroseconds.
+    unsigned long P90Microseconds;
+    unsigned long P99Microseconds;
+    unsigned long P999Microseconds;
+    STUB_METRICS_ERROR Errors[STUB_METRICS_ERROR_CODES];
+    unsigned __int64 Buckets[STUB_METRICS_BUCKETS];     // The calls in each latency bucket; see StubMetricsBucketBound.
+} STUB_METRICS_OPERATION;
+
+/// <summary>
+/// The metrics of a stub that are not kept by operation.
+/// </summary>
+typedef struct _STUB_METRICS
+{
+    unsigned long ShardCount;               // Per-thread counter shards, one per thread that used the stub at a time.
+    unsigned long OperationCount;           // Operations that were called.
+    long ContextHandles;                    // Context handles open: each CXH of EcDoConnectEx and NSPI_HANDLE of NspiBind.
+    long BindingHandles;                    // Binding handles created by BindToServer.
+    unsigned __int64 AllocationCount;       // midl_user_allocate calls that succeeded.
+    unsigned __int64 AllocationBytes;
+    unsigned __int64 FreeCount;             // midl_user_free calls on a block.
+} STUB_METRICS;
+
+void StubMetricsRecord(unsigned char interfaceId, unsigned char opnum, int fault, long returnCode, unsigned long requestBytes, unsigned long responseBytes, unsigned long duration);
+
+void StubMetricsContextHandle(long delta);
+
+void StubMetricsBindingHandle(long delta);
+
+void StubMetricsAllocate(size_t size);
+
+void StubMetricsFree();
+
+void StubMetricsDetach();
+
+unsigned long StubMetricsBucketBound(unsigned long bucket);
+
+long __stdcall GetStubMetrics(STUB_METRICS *metrics, STUB_METRICS_OPERATION *operations, unsigned long capacity);
+
+long __stdcall GetStubMetricsText(unsigned long format, char *buffer, unsigned long *size);
+
+#ifdef __cplusplus
+}
+#endif
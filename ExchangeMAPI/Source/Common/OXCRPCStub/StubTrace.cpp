@@ -0,0 +1,495 @@
+#include "StubTrace.h"
+#include "StubMetrics.h"
+#include <new>
+#include <vector>
+
+// Low-overhead tracing of the RPC calls of a stub. The traced routines around the client stub routines, see TracedCalls
+// and NspiTracedCalls, record each call with StubTraceBegin and StubTraceEnd, or StubTraceFault after the handler of an
+// exception, into a ring of the calling thread. A ring has a single producer, its thread, and a single consumer, the
+// writer thread, so a record costs two counter reads, a copy and one interlocked store. A thread takes a ring on its
+// first traced call and gives it back when it exits; the rings are kept for the life of the process and reused by later
+// threads. The writer thread drains all rings at each flush interval and appends their records to the trace file, and
+// counts the records a full ring had to drop. While tracing is off a call only reads the counter twice and counts
+// itself in the metrics of its thread, see StubMetrics.
+
+/// <summary>
+/// The number of records of a ring; a power of two.
+/// </summary>
+static const unsigned long RingSize = 2048;
+
+/// <summary>
+/// The time between two drains of the rings, in milliseconds, if the caller does not give one.
+/// </summary>
+static const unsigned long DefaultFlushInterval = 100;
+
+/// <summary>
+/// The records of one thread, from the oldest record not yet written, at tail, to the next record to fill, at head.
+/// </summary>
+struct StubTraceRing
+{
+    StubTraceRing *next;                    // The next ring in the list of all rings.
+    volatile LONG owned;                    // 1 while a thread uses the ring.
+    volatile LONG threadId;                 // The thread that last took the ring.
+    volatile LONG head;                     // Written by the owning thread only.
+    volatile LONG tail;                     // Written by the writer thread only.
+    volatile LONG dropped;                  // Records dropped since the writer thread last looked.
+    STUB_TRACE_RECORD records[RingSize];
+};
+
+/// <summary>
+/// Get the frequency of the performance counter, which is fixed at boot.
+/// </summary>
+static unsigned __int64 QueryFrequency()
+{
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    return (unsigned __int64)frequency.QuadPart;
+}
+
+static volatile LONG m_enabled = 0;
+static StubTraceRing * volatile m_rings = NULL;
+static volatile LONG m_ringCount = 0;
+static DWORD m_flsIndex = FLS_OUT_OF_INDEXES;
+static unsigned __int64 m_frequency = QueryFrequency();
+
+static SRWLOCK m_controlLock = SRWLOCK_INIT;
+static HANDLE m_file = INVALID_HANDLE_VALUE;
+static HANDLE m_writerThread = NULL;
+static HANDLE m_stopEvent = NULL;
+static unsigned long m_flushInterval = DefaultFlushInterval;
+static volatile LONG m_writeError = 0;
+static volatile LONGLONG m_recordCount = 0;
+static volatile LONGLONG m_droppedCount = 0;
+static volatile LONGLONG m_fileSize = 0;
+
+/// <summary>
+/// Give the ring of a thread back when the thread exits. The records still in it are written by the next drain.
+/// </summary>
+static VOID WINAPI ReleaseRing(PVOID data)
+{
+    if (data != NULL)
+    {
+        InterlockedExchange(&((StubTraceRing *)data)->owned, 0);
+    }
+}
+
+/// <summary>
+/// Get the ring of the calling thread: the one it took, else a ring given back by an exited thread, else a new one.
+/// </summary>
+static StubTraceRing *AcquireRing()
+{
+    StubTraceRing *ring = (StubTraceRing *)FlsGetValue(m_flsIndex);
+    if (ring != NULL)
+    {
+        return ring;
+    }
+
+    for (StubTraceRing *candidate = m_rings; candidate != NULL; candidate = candidate->next)
+    {
+        if (candidate->owned == 0 && InterlockedCompareExchange(&candidate->owned, 1, 0) == 0)
+        {
+            ring = candidate;
+            break;
+        }
+    }
+
+    if (ring == NULL)
+    {
+        ring = new (std::nothrow) StubTraceRing();
+        if (ring == NULL)
+        {
+            return NULL;
+        }
+
+        ring->owned = 1;
+        StubTraceRing *first;
+        do
+        {
+            first = m_rings;
+            ring->next = first;
+        }
+        while (InterlockedCompareExchangePointer((PVOID volatile *)&m_rings, ring, first) != first);
+
+        InterlockedIncrement(&m_ringCount);
+    }
+
+    InterlockedExchange(&ring->threadId, (LONG)GetCurrentThreadId());
+    if (!FlsSetValue(m_flsIndex, ring))
+    {
+        InterlockedExchange(&ring->owned, 0);
+        return NULL;
+    }
+
+    return ring;
+}
+
+/// <summary>
+/// Set the duration of a call, count it in the metrics and, while tracing, put its record into the ring of the calling
+/// thread.
+/// </summary>
+static void Complete(STUB_TRACE_CALL *call)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    unsigned __int64 elapsed = (unsigned __int64)now.QuadPart - call->Record.StartTime;
+    unsigned __int64 duration = elapsed / m_frequency * 1000000 + elapsed % m_frequency * 1000000 / m_frequency;
+    call->Record.Duration = duration > 0xFFFFFFFF ? 0xFFFFFFFF : (unsigned long)duration;
+    StubMetricsRecord(call->Record.Interface, call->Record.Opnum, call->Record.Kind == STUB_TRACE_KIND_FAULT, call->Record.ReturnCode,
+        call->Record.RequestBytes, call->Record.ResponseBytes, call->Record.Duration);
+    if (!call->Enabled)
+    {
+        return;
+    }
+
+    StubTraceRing *ring = AcquireRing();
+    if (ring == NULL)
+    {
+        return;
+    }
+
+    unsigned long head = (unsigned long)ring->head;
+    if (head - (unsigned long)ring->tail >= RingSize)
+    {
+        InterlockedIncrement(&ring->dropped);
+        return;
+    }
+
+    ring->records[head & (RingSize - 1)] = call->Record;
+    InterlockedExchange(&ring->head, (LONG)(head + 1));
+}
+
+/// <summary>
+/// Get the Flags field of the RPC_HEADER_EXT at the start of a buffer, or 0 if the buffer is too short to hold one.
+/// </summary>
+static unsigned short HeaderFlags(const unsigned char *buffer, unsigned long size)
+{
+    return buffer != NULL && size >= 8 ? (unsigned short)(buffer[2] | (buffer[3] << 8)) : 0;
+}
+
+/// <summary>
+/// Start the trace of a call, before the client stub routine marshals it.
+/// </summary>
+/// <param name="call">The state of the call, on the stack of the traced routine.</param>
+/// <param name="interfaceId">One of the STUB_TRACE_ interface values.</param>
+/// <param name="opnum">The opnum of the call.</param>
+/// <param name="session">The context handle the call is made on, or NULL.</param>
+/// <param name="requestBytes">The size of the buffers the call sends.</param>
+void StubTraceBegin(STUB_TRACE_CALL *call, unsigned char interfaceId, unsigned char opnum, const void *session, unsigned long requestBytes)
+{
+    call->Enabled = m_enabled;
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    memset(&call->Record, 0, sizeof(call->Record));
+    call->Record.StartTime = (unsigned __int64)now.QuadPart;
+    call->Record.Session = (unsigned __int64)(ULONG_PTR)session;
+    call->Record.ThreadId = GetCurrentThreadId();
+    call->Record.RequestBytes = requestBytes;
+    call->Record.Interface = interfaceId;
+    call->Record.Opnum = opnum;
+    call->Record.Kind = STUB_TRACE_KIND_CALL;
+}
+
+/// <summary>
+/// Record the flags of an EcDoRpcExt2 call and the compression and obfuscation flags of its request.
+/// </summary>
+void StubTraceFlags(STUB_TRACE_CALL *call, unsigned long flags, const unsigned char *rgbIn, unsigned long cbIn)
+{
+    if (!call->Enabled)
+    {
+        return;
+    }
+
+    call->Record.Flags = flags;
+    call->Record.RequestHeaderFlags = HeaderFlags(rgbIn, cbIn);
+}
+
+/// <summary>
+/// Record a call that raised an exception. Call it once the handler of the exception has run, never from its filter.
+/// </summary>
+void StubTraceFault(STUB_TRACE_CALL *call, unsigned long exceptionCode)
+{
+    call->Record.Kind = STUB_TRACE_KIND_FAULT;
+    call->Record.ReturnCode = (long)exceptionCode;
+    Complete(call);
+}
+
+/// <summary>
+/// Record an asynchronous call once it has been started; its duration is the time it took to send it.
+/// </summary>
+void StubTraceAsync(STUB_TRACE_CALL *call)
+{
+    call->Record.Kind = STUB_TRACE_KIND_ASYNC;
+    Complete(call);
+}
+
+/// <summary>
+/// Record a call that returned.
+/// </summary>
+/// <param name="call">The state of the call.</param>
+/// <param name="returnCode">The return value of the call.</param>
+/// <param name="session">The context handle the call returned, or NULL to keep the one it was made on. For EcDoDisconnect
+/// and NspiUnbind, the handle after the call: NULL once the call closed it.</param>
+/// <param name="rgbOut">The response buffer of an EcDoRpcExt2 call, or NULL.</param>
+/// <param name="cbOut">The size of the response buffer.</param>
+/// <param name="cbAuxOut">The size of the auxiliary response buffer.</param>
+void StubTraceEnd(STUB_TRACE_CALL *call, long returnCode, const void *session, const unsigned char *rgbOut, unsigned long cbOut, unsigned long cbAuxOut)
+{
+    unsigned char interfaceId = call->Record.Interface;
+    unsigned char opnum = call->Record.Opnum;
+    bool opens = (interfaceId == STUB_TRACE_EMSMDB && opnum == 10) || (interfaceId == STUB_TRACE_NSPI && opnum == 0);
+    bool closes = (interfaceId == STUB_TRACE_EMSMDB && opnum == 1) || (interfaceId == STUB_TRACE_NSPI && opnum == 1);
+    if (opens && session != NULL)
+    {
+        StubMetricsContextHandle(1);
+    }
+    else if (closes && call->Record.Session != 0 && session == NULL)
+    {
+        StubMetricsContextHandle(-1);
+    }
+
+    call->Record.ReturnCode = returnCode;
+    if (session != NULL)
+    {
+        call->Record.Session = (unsigned __int64)(ULONG_PTR)session;
+    }
+
+    call->Record.ResponseBytes = cbOut + cbAuxOut;
+    call->Record.ResponseHeaderFlags = HeaderFlags(rgbOut, cbOut);
+    Complete(call);
+}
+
+/// <summary>
+/// Move the records of all rings to the trace file.
+/// </summary>
+static void DrainRings(std::vector<STUB_TRACE_RECORD> &buffer)
+{
+    buffer.clear();
+    for (StubTraceRing *ring = m_rings; ring != NULL; ring = ring->next)
+    {
+        unsigned long head = (unsigned long)ring->head;
+        unsigned long tail = (unsigned long)ring->tail;
+        for (; tail != head; tail++)
+        {
+            buffer.push_back(ring->records[tail & (RingSize - 1)]);
+        }
+
+        InterlockedExchange(&ring->tail, (LONG)tail);
+        LONG dropped = InterlockedExchange(&ring->dropped, 0);
+        if (dropped != 0)
+        {
+            LARGE_INTEGER now;
+            QueryPerformanceCounter(&now);
+            STUB_TRACE_RECORD record;
+            memset(&record, 0, sizeof(record));
+            record.StartTime = (unsigned __int64)now.QuadPart;
+            record.ThreadId = (unsigned long)ring->threadId;
+            record.RequestBytes = (unsigned long)dropped;
+            record.Kind = STUB_TRACE_KIND_DROPPED;
+            buffer.push_back(record);
+            InterlockedExchangeAdd64(&m_droppedCount, dropped);
+        }
+    }
+
+    if (buffer.empty() || m_writeError != 0)
+    {
+        return;
+    }
+
+    DWORD size = (DWORD)(buffer.size() * sizeof(STUB_TRACE_RECORD));
+    DWORD written = 0;
+    if (!WriteFile(m_file, &buffer[0], size, &written, NULL) || written != size)
+    {
+        InterlockedCompareExchange(&m_writeError, (LONG)(written != size ? ERROR_WRITE_FAULT : GetLastError()), 0);
+        return;
+    }
+
+    InterlockedExchangeAdd64(&m_recordCount, (LONGLONG)buffer.size());
+    InterlockedExchangeAdd64(&m_fileSize, size);
+}
+
+/// <summary>
+/// Drain the rings at each flush interval until tracing stops, and once more after.
+/// </summary>
+static DWORD WINAPI WriterThread(LPVOID)
+{
+    std::vector<STUB_TRACE_RECORD> buffer;
+    buffer.reserve(RingSize);
+    DWORD wait;
+    do
+    {
+        wait = WaitForSingleObject(m_stopEvent, m_flushInterval);
+        DrainRings(buffer);
+    }
+    while (wait == WAIT_TIMEOUT);
+
+    return 0;
+}
+
+/// <summary>
+/// Close the trace file and the writer thread. The caller MUST hold the control lock.
+/// </summary>
+static void CloseTrace()
+{
+    if (m_writerThread != NULL)
+    {
+        SetEvent(m_stopEvent);
+        WaitForSingleObject(m_writerThread, INFINITE);
+        CloseHandle(m_writerThread);
+        m_writerThread = NULL;
+    }
+
+    if (m_stopEvent != NULL)
+    {
+        CloseHandle(m_stopEvent);
+        m_stopEvent = NULL;
+    }
+
+    if (m_file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+}
+
+/// <summary>
+/// Start tracing the calls of this stub to a new file.
+/// </summary>
+/// <param name="path">The trace file; an existing file is replaced.</param>
+/// <param name="flushInterval">The time between two writes to the file in milliseconds, or 0 for the default.</param>
+/// <returns>If success, it returns 0. ERROR_ALREADY_INITIALIZED indicates tracing is already started.</returns>
+long __stdcall StubTraceStart(const wchar_t *path, unsigned long flushInterval)
+{
+    if (path == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    AcquireSRWLockExclusive(&m_controlLock);
+    if (m_file != INVALID_HANDLE_VALUE)
+    {
+        ReleaseSRWLockExclusive(&m_controlLock);
+        return ERROR_ALREADY_INITIALIZED;
+    }
+
+    if (m_flsIndex == FLS_OUT_OF_INDEXES)
+    {
+        m_flsIndex = FlsAlloc(ReleaseRing);
+        if (m_flsIndex == FLS_OUT_OF_INDEXES)
+        {
+            long status = GetLastError();
+            ReleaseSRWLockExclusive(&m_controlLock);
+            return status;
+        }
+    }
+
+    // Records of calls that ended after the last trace stopped belong to no file.
+    for (StubTraceRing *ring = m_rings; ring != NULL; ring = ring->next)
+    {
+        InterlockedExchange(&ring->tail, ring->head);
+        InterlockedExchange(&ring->dropped, 0);
+    }
+
+    m_file = CreateFileW(path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        long status = GetLastError();
+        ReleaseSRWLockExclusive(&m_controlLock);
+        return status;
+    }
+
+    LARGE_INTEGER counter;
+    FILETIME now;
+    QueryPerformanceCounter(&counter);
+    GetSystemTimeAsFileTime(&now);
+    m_flushInterval = flushInterval != 0 ? flushInterval : DefaultFlushInterval;
+
+    STUB_TRACE_FILE_HEADER header;
+    header.Signature = STUB_TRACE_SIGNATURE;
+    header.Version = STUB_TRACE_VERSION;
+    header.RecordSize = sizeof(STUB_TRACE_RECORD);
+    header.ProcessId = GetCurrentProcessId();
+    header.Frequency = m_frequency;
+    header.StartCounter = (unsigned __int64)counter.QuadPart;
+    header.StartTime = ((unsigned __int64)now.dwHighDateTime << 32) | now.dwLowDateTime;
+
+    long status = 0;
+    DWORD written = 0;
+    if (!WriteFile(m_file, &header, sizeof(header), &written, NULL))
+    {
+        status = GetLastError();
+    }
+
+    m_writeError = 0;
+    m_recordCount = 0;
+    m_droppedCount = 0;
+    m_fileSize = written;
+    if (status == 0)
+    {
+        m_stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+        m_writerThread = m_stopEvent == NULL ? NULL : CreateThread(NULL, 0, WriterThread, NULL, 0, NULL);
+        if (m_writerThread == NULL)
+        {
+            status = GetLastError();
+        }
+    }
+
+    if (status != 0)
+    {
+        CloseTrace();
+    }
+    else
+    {
+        InterlockedExchange(&m_enabled, 1);
+    }
+
+    ReleaseSRWLockExclusive(&m_controlLock);
+    return status;
+}
+
+/// <summary>
+/// Stop tracing, write the records still in the rings and close the trace file. A call that is in progress when
+/// tracing stops is not written.
+/// </summary>
+/// <returns>If success, it returns 0, else the error code of the first write to the trace file that failed.</returns>
+long __stdcall StubTraceStop()
+{
+    AcquireSRWLockExclusive(&m_controlLock);
+    InterlockedExchange(&m_enabled, 0);
+    CloseTrace();
+    long status = m_writeError;
+    ReleaseSRWLockExclusive(&m_controlLock);
+    return status;
+}
+
+/// <summary>
+/// Free the FLS index of the rings when the DLL is unloaded, so that no thread that exits later calls ReleaseRing.
+/// Call it from DllMain only.
+/// </summary>
+void StubTraceDetach()
+{
+    InterlockedExchange(&m_enabled, 0);
+    if (m_flsIndex != FLS_OUT_OF_INDEXES)
+    {
+        FlsFree(m_flsIndex);
+        m_flsIndex = FLS_OUT_OF_INDEXES;
+    }
+}
+
+/// <summary>
+/// Get the counters of the tracing of this stub.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall StubTraceGetStats(STUB_TRACE_STATS *stats)
+{
+    if (stats == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    stats->Enabled = (unsigned long)m_enabled;
+    stats->RingCount = (unsigned long)m_ringCount;
+    stats->RecordCount = (unsigned __int64)m_recordCount;
+    stats->DroppedCount = (unsigned __int64)m_droppedCount;
+    stats->FileSize = (unsigned __int64)m_fileSize;
+    return 0;
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <windows.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// <summary>
+/// The interfaces whose calls are traced.
+/// </summary>
+#define STUB_TRACE_EMSMDB           1
+#define STUB_TRACE_ASYNCEMSMDB      2
+#define STUB_TRACE_NSPI             3
+
+/// <summary>
+/// The kinds of trace records.
+/// </summary>
+#define STUB_TRACE_KIND_CALL        0   // A call that returned; ReturnCode is its return value.
+#define STUB_TRACE_KIND_FAULT       1   // A call that raised an RPC exception; ReturnCode is the exception code.
+#define STUB_TRACE_KIND_ASYNC       2   // An asynchronous call that was started; it completes through RpcAsyncCompleteCall.
+#define STUB_TRACE_KIND_DROPPED     3   // RequestBytes records of the thread were dropped because its ring was full.
+
+/// <summary>
+/// The signature of a trace file, "STRC", and the version of its layout.
+/// </summary>
+#define STUB_TRACE_SIGNATURE        0x43525453
+#define STUB_TRACE_VERSION          1
+
+/// <summary>
+/// A trace record, as it is written to the trace file.
+/// </summary>
+typedef struct _STUB_TRACE_RECORD
+{
+    unsigned __int64 StartTime;             // QueryPerformanceCounter when the call began.
+    unsigned __int64 Session;               // The CXH, ACXH or NSPI_HANDLE of the call, or 0.
+    unsigned long Duration;                 // The time the call took, in microseconds.
+    unsigned long ThreadId;
+    unsigned long RequestBytes;             // The buffers sent: rgbIn and rgbAuxIn for EcDoRpcExt2; 0 for NSPI calls.
+    unsigned long ResponseBytes;            // The buffers received: rgbOut and rgbAuxOut for EcDoRpcExt2; 0 for NSPI calls.
+    long ReturnCode;
+    unsigned long Flags;                    // pulFlags of EcDoRpcExt2 on input: NoCompression, NoXorMagic and Chain.
+    unsigned short RequestHeaderFlags;      // Flags of the first RPC_HEADER_EXT of rgbIn: Compressed, XorMagic and Last.
+    unsigned short ResponseHeaderFlags;     // Flags of the first RPC_HEADER_EXT of rgbOut.
+    unsigned char Interface;                // One of the STUB_TRACE_ interface values.
+    unsigned char Opnum;
+    unsigned char Kind;                     // One of the STUB_TRACE_KIND_ values.
+    unsigned char Reserved;
+} STUB_TRACE_RECORD;
+
+/// <summary>
+/// The header of a trace file; the records follow it, in the order the rings were drained rather than by StartTime.
+/// </summary>
+typedef struct _STUB_TRACE_FILE_HEADER
+{
+    unsigned long Signature;
+    unsigned long Version;
+    unsigned long RecordSize;
+    unsigned long ProcessId;
+    unsigned __int64 Frequency;             // QueryPerformanceFrequency.
+    unsigned __int64 StartCounter;          // QueryPerformanceCounter when tracing started.
+    unsigned __int64 StartTime;             // The UTC FILETIME when tracing started.
+} STUB_TRACE_FILE_HEADER;
+
+/// <summary>
+/// The counters of the tracing of this stub since it was last started.
+/// </summary>
+typedef struct _STUB_TRACE_STATS
+{
+    unsigned long Enabled;                  // 1 while tracing.
+    unsigned long RingCount;                // Rings allocated, one per thread that made a call while tracing.
+    unsigned __int64 RecordCount;           // Records written to the file.
+    unsigned __int64 DroppedCount;          // Records dropped because the ring of their thread was full.
+    unsigned __int64 FileSize;
+} STUB_TRACE_STATS;
+
+/// <summary>
+/// The state of a traced call, on the stack of the traced routine that makes it.
+/// </summary>
+typedef struct _STUB_TRACE_CALL
+{
+    int Enabled;
+    STUB_TRACE_RECORD Record;
+} STUB_TRACE_CALL;
+
+void StubTraceBegin(STUB_TRACE_CALL *call, unsigned char interfaceId, unsigned char opnum, const void *session, unsigned long requestBytes);
+
+void StubTraceFlags(STUB_TRACE_CALL *call, unsigned long flags, const unsigned char *rgbIn, unsigned long cbIn);
+
+void StubTraceFault(STUB_TRACE_CALL *call, unsigned long exceptionCode);
+
+void StubTraceAsync(STUB_TRACE_CALL *call);
+
+void StubTraceEnd(STUB_TRACE_CALL *call, long returnCode, const void *session, const unsigned char *rgbOut, unsigned long cbOut, unsigned long cbAuxOut);
+
+void StubTraceDetach();
+
+long __stdcall StubTraceStart(const wchar_t *path, unsigned long flushInterval);
+
+long __stdcall StubTraceStop();
+
+long __stdcall StubTraceGetStats(STUB_TRACE_STATS *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,901 @@
+#include "SyncStateStore.h"
+#include "PipelinedRpcCall.h"
+#include "MappedFile.h"
+#include <map>
+#include <string>
+#include <vector>
+
+// Checkpoints of ICS state are appended to a memory-mapped log; a checkpoint is never changed in place. The file
+// header holds the length of the committed part of the log. SyncStateStoreCommit flushes the new records before it
+// advances that length, so a crash loses the records put since the last commit and never exposes a torn one.
+//
+// Opening the store reads only the record headers of the committed part, to index the latest checkpoint of every
+// folder. State data is read from the mapped file when it is returned or uploaded, straight into the request buffers
+// of the RopSynchronizationUploadStateStream ROPs.
+
+/// <summary>
+/// The signatures of the file header, "ICSS", and of a record, "SREC".
+/// </summary>
+#define SYNC_STATE_SIGNATURE        0x53534349
+#define SYNC_STATE_RECORD_SIGNATURE 0x43455253
+#define SYNC_STATE_VERSION          1
+
+/// <summary>
+/// The minimum growth of the file when a record does not fit.
+/// </summary>
+#define SYNC_STATE_GROWTH (1024 * 1024)
+
+/// <summary>
+/// The largest range flushed at once.
+/// </summary>
+#define SYNC_STATE_FLUSH_CHUNK 0x40000000
+
+/// <summary>
+/// The smallest chunk of state data worth a RopSynchronizationUploadStateStreamContinue at the end of a request buffer.
+/// </summary>
+#define SYNC_STATE_MIN_CHUNK 0x100
+
+struct SyncStateFileHeader
+{
+    unsigned long signature;
+    unsigned long version;
+    unsigned __int64 committedLength;   // The committed records end here; anything after it is ignored.
+};
+
+/// <summary>
+/// The header of a record, followed by propertyCount entries of PropertyTag, Size and Size bytes of data.
+/// A record without properties removes the checkpoint of its folder.
+/// </summary>
+struct SyncStateRecordHeader
+{
+    unsigned long signature;
+    unsigned long size;                 // The size of the record, header included.
+    unsigned __int64 folderId;
+    unsigned long synchronizationType;
+    unsigned long propertyCount;
+    unsigned long checksum;             // The CRC-32 of the bytes after the header.
+    unsigned long reserved;
+};
+
+/// <summary>
+/// The location of the data of one state property in the file.
+/// </summary>
+struct SyncStateLocation
+{
+    unsigned long propertyTag;
+    unsigned long size;
+    unsigned __int64 offset;
+};
+
+/// <summary>
+/// A checkpoint is identified by its folder and by the SynchronizationType it was configured with.
+/// </summary>
+typedef std::pair<unsigned __int64, unsigned long> SyncStateKey;
+
+struct _SYNC_STATE_STORE
+{
+    std::wstring path;
+    MappedFile file;
+    CRITICAL_SECTION lock;
+    std::map<SyncStateKey, unsigned __int64> index;     // The offset of the latest record of every checkpoint.
+    unsigned __int64 committed;
+    unsigned __int64 end;                               // Where the next record is appended.
+    unsigned long activeUploads;                        // Records do not move while an upload reads them.
+};
+
+/// <summary>
+/// The position of an upload in the state properties of a checkpoint.
+/// </summary>
+struct SyncStateUploadCursor
+{
+    std::vector<SyncStateLocation> properties;
+    size_t property;
+    bool begun;                         // The RopSynchronizationUploadStateStreamBegin of the property is packed.
+    unsigned long dataOffset;           // The data of the property packed so far.
+};
+
+struct Crc32Table
+{
+    unsigned long entries[256];
+
+    Crc32Table()
+    {
+        for (unsigned long i = 0; i < 256; i++)
+        {
+            unsigned long value = i;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                value = (value & 1) != 0 ? 0xEDB88320 ^ (value >> 1) : value >> 1;
+            }
+
+            this->entries[i] = value;
+        }
+    }
+};
+
+static unsigned long Crc32Update(unsigned long crc, const unsigned char *data, unsigned long size)
+{
+    static const Crc32Table table;
+    crc = ~crc;
+    for (unsigned long i = 0; i < size; i++)
+    {
+        crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+static long ChecksumRange(MappedFile &file, unsigned __int64 offset, unsigned __int64 size, unsigned long *crc)
+{
+    *crc = 0;
+    while (size > 0)
+    {
+        unsigned long available;
+        const unsigned char *data = file.At(offset, &available);
+        if (data == NULL)
+        {
+            return GetLastError();
+        }
+
+        unsigned long count = size < available ? (unsigned long)size : available;
+        *crc = Crc32Update(*crc, data, count);
+        offset += count;
+        size -= count;
+    }
+
+    return 0;
+}
+
+static long FlushRange(MappedFile &file, unsigned __int64 offset, unsigned __int64 size)
+{
+    while (size > 0)
+    {
+        unsigned long count = size < SYNC_STATE_FLUSH_CHUNK ? (unsigned long)size : SYNC_STATE_FLUSH_CHUNK;
+        long status = file.Flush(offset, count);
+        if (status != 0)
+        {
+            return status;
+        }
+
+        offset += count;
+        size -= count;
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Open the file of a store, initialize it if it is new, and index the committed records.
+/// </summary>
+static long LoadStore(SYNC_STATE_STORE *store)
+{
+    long status = store->file.OpenForUpdate(store->path.c_str());
+    if (status != 0)
+    {
+        return status;
+    }
+
+    SyncStateFileHeader header;
+    memset(&header, 0, sizeof(header));
+    if (store->file.Size() >= sizeof(header))
+    {
+        status = store->file.Read(0, (unsigned char *)&header, sizeof(header));
+        if (status != 0)
+        {
+            return status;
+        }
+    }
+
+    // A file whose header was never flushed is as good as new.
+    if (header.signature == 0)
+    {
+        header.signature = SYNC_STATE_SIGNATURE;
+        header.version = SYNC_STATE_VERSION;
+        header.committedLength = sizeof(header);
+        if ((status = store->file.Extend(SYNC_STATE_GROWTH)) != 0
+            || (status = store->file.Write(0, (const unsigned char *)&header, sizeof(header))) != 0
+            || (status = store->file.Flush(0, sizeof(header))) != 0)
+        {
+            return status;
+        }
+    }
+
+    if (header.signature != SYNC_STATE_SIGNATURE
+        || header.version != SYNC_STATE_VERSION
+        || header.committedLength < sizeof(header)
+        || header.committedLength > store->file.Size())
+    {
+        return ERROR_FILE_CORRUPT;
+    }
+
+    store->committed = header.committedLength;
+    store->end = header.committedLength;
+    store->index.clear();
+    unsigned __int64 offset = sizeof(header);
+    while (offset < store->committed)
+    {
+        SyncStateRecordHeader record;
+        if (store->committed - offset < sizeof(record)
+            || (status = store->file.Read(offset, (unsigned char *)&record, sizeof(record))) != 0)
+        {
+            return status != 0 ? status : ERROR_FILE_CORRUPT;
+        }
+
+        if (record.signature != SYNC_STATE_RECORD_SIGNATURE || record.size < sizeof(record) || record.size > store->committed - offset)
+        {
+            return ERROR_FILE_CORRUPT;
+        }
+
+        SyncStateKey key(record.folderId, record.synchronizationType);
+        if (record.propertyCount == 0)
+        {
+            store->index.erase(key);
+        }
+        else
+        {
+            store->index[key] = offset;
+        }
+
+        offset += record.size;
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Read the property directory of a record, after checking the record against its checksum.
+/// </summary>
+static long ReadRecord(SYNC_STATE_STORE *store, unsigned __int64 offset, std::vector<SyncStateLocation> &properties)
+{
+    SyncStateRecordHeader header;
+    long status = store->file.Read(offset, (unsigned char *)&header, sizeof(header));
+    if (status != 0)
+    {
+        return status;
+    }
+
+    unsigned long crc;
+    status = ChecksumRange(store->file, offset + sizeof(header), header.size - sizeof(header), &crc);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    if (crc != header.checksum)
+    {
+        return ERROR_FILE_CORRUPT;
+    }
+
+    unsigned __int64 cursor = offset + sizeof(header);
+    unsigned __int64 end = offset + header.size;
+    properties.clear();
+    for (unsigned long i = 0; i < header.propertyCount; i++)
+    {
+        unsigned long fields[2];
+        if (end - cursor < sizeof(fields)
+            || (status = store->file.Read(cursor, (unsigned char *)fields, sizeof(fields))) != 0)
+        {
+            return status != 0 ? status : ERROR_FILE_CORRUPT;
+        }
+
+        cursor += sizeof(fields);
+        if (end - cursor < fields[1])
+        {
+            return ERROR_FILE_CORRUPT;
+        }
+
+        SyncStateLocation location = { fields[0], fields[1], cursor };
+        properties.push_back(location);
+        cursor += fields[1];
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Append a record at the end of the log; it is durable once committed.
+/// </summary>
+static long AppendRecord(
+    SYNC_STATE_STORE *store,
+    unsigned __int64 folderId,
+    unsigned long synchronizationType,
+    const SYNC_STATE_PROPERTY *properties,
+    unsigned long propertyCount)
+{
+    unsigned __int64 size = sizeof(SyncStateRecordHeader);
+    for (unsigned long i = 0; i < propertyCount; i++)
+    {
+        size += 2 * sizeof(unsigned long) + properties[i].Size;
+    }
+
+    if (size > 0xFFFFFFFF)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    long status;
+    if (store->end + size > store->file.Size())
+    {
+        unsigned __int64 grown = store->file.Size() * 2;
+        if (grown < store->end + size + SYNC_STATE_GROWTH)
+        {
+            grown = store->end + size + SYNC_STATE_GROWTH;
+        }
+
+        status = store->file.Extend(grown);
+        if (status != 0)
+        {
+            return status;
+        }
+    }
+
+    unsigned __int64 offset = store->end + sizeof(SyncStateRecordHeader);
+    unsigned long crc = 0;
+    for (unsigned long i = 0; i < propertyCount; i++)
+    {
+        unsigned long fields[2] = { properties[i].PropertyTag, properties[i].Size };
+        if ((status = store->file.Write(offset, (const unsigned char *)fields, sizeof(fields))) != 0
+            || (status = store->file.Write(offset + sizeof(fields), properties[i].Data, properties[i].Size)) != 0)
+        {
+            return status;
+        }
+
+        crc = Crc32Update(crc, (const unsigned char *)fields, sizeof(fields));
+        crc = Crc32Update(crc, properties[i].Data, properties[i].Size);
+        offset += sizeof(fields) + properties[i].Size;
+    }
+
+    SyncStateRecordHeader header;
+    header.signature = SYNC_STATE_RECORD_SIGNATURE;
+    header.size = (unsigned long)size;
+    header.folderId = folderId;
+    header.synchronizationType = synchronizationType;
+    header.propertyCount = propertyCount;
+    header.checksum = crc;
+    header.reserved = 0;
+    status = store->file.Write(store->end, (const unsigned char *)&header, sizeof(header));
+    if (status != 0)
+    {
+        return status;
+    }
+
+    SyncStateKey key(folderId, synchronizationType);
+    if (propertyCount == 0)
+    {
+        store->index.erase(key);
+    }
+    else
+    {
+        store->index[key] = store->end;
+    }
+
+    store->end += size;
+    return 0;
+}
+
+/// <summary>
+/// Flush the records appended since the last commit, then the header that makes them part of the log.
+/// </summary>
+static long CommitRecords(SYNC_STATE_STORE *store)
+{
+    if (store->end == store->committed)
+    {
+        return 0;
+    }
+
+    long status = FlushRange(store->file, store->committed, store->end - store->committed);
+    if (status == 0)
+    {
+        status = store->file.Write(offsetof(SyncStateFileHeader, committedLength), (const unsigned char *)&store->end, sizeof(store->end));
+    }
+
+    if (status == 0)
+    {
+        status = store->file.Flush(0, sizeof(SyncStateFileHeader));
+    }
+
+    if (status == 0)
+    {
+        store->committed = store->end;
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Pack the Begin, Continue and End ROPs of the next state data into a request buffer. The data is read from the
+/// mapped file straight into the buffer.
+/// </summary>
+static long PrepareStateCall(
+    SYNC_STATE_STORE *store,
+    PipelinedRpcCall *call,
+    SyncStateUploadCursor &cursor,
+    unsigned char logonId,
+    unsigned long synchronizationHandle)
+{
+    RopCodec::RopRequestWriter writer(call->rgbIn, sizeof(call->rgbIn));
+    call->ropCount = 0;
+    call->bytesRequested = 0;
+    long status = 0;
+    EnterCriticalSection(&store->lock);
+    while (status == 0 && cursor.property < cursor.properties.size())
+    {
+        // Leave room for the handle table.
+        const SyncStateLocation &property = cursor.properties[cursor.property];
+        unsigned long remaining = writer.Remaining();
+        if (remaining <= sizeof(unsigned long))
+        {
+            break;
+        }
+
+        remaining -= sizeof(unsigned long);
+        if (!cursor.begun)
+        {
+            if (remaining < RopCodec::SynchronizationUploadStateStreamBegin::Request::Size)
+            {
+                break;
+            }
+
+            writer.Append<RopCodec::SynchronizationUploadStateStreamBegin>(logonId, (unsigned char)0, property.propertyTag, property.size);
+            cursor.begun = true;
+        }
+        else if (cursor.dataOffset < property.size)
+        {
+            const unsigned long ropOverhead = RopCodec::SynchronizationUploadStateStreamContinue::Request::Size;
+            unsigned long left = property.size - cursor.dataOffset;
+            if (remaining < ropOverhead + (left < SYNC_STATE_MIN_CHUNK ? left : SYNC_STATE_MIN_CHUNK))
+            {
+                break;
+            }
+
+            unsigned long dataSize = left < remaining - ropOverhead ? left : remaining - ropOverhead;
+            writer.Append<RopCodec::SynchronizationUploadStateStreamContinue>(logonId, (unsigned char)0, dataSize);
+            status = store->file.Read(property.offset + cursor.dataOffset, call->rgbIn + writer.Length(), dataSize);
+            writer.Commit(dataSize);
+            cursor.dataOffset += dataSize;
+            call->bytesRequested += dataSize;
+        }
+        else
+        {
+            if (remaining < RopCodec::SynchronizationUploadStateStreamEnd::Request::Size)
+            {
+                break;
+            }
+
+            writer.Append<RopCodec::SynchronizationUploadStateStreamEnd>(logonId, (unsigned char)0);
+            cursor.property++;
+            cursor.begun = false;
+            cursor.dataOffset = 0;
+        }
+
+        call->ropCount++;
+    }
+
+    LeaveCriticalSection(&store->lock);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    call->cbIn = writer.Finish(&synchronizationHandle, 1);
+    return call->cbIn == 0 ? ERROR_INSUFFICIENT_BUFFER : 0;
+}
+
+/// <summary>
+/// Check that every ROP of a completed call succeeded.
+/// </summary>
+static long ProcessStateResponse(PipelinedRpcCall *call)
+{
+    RopCodec::RopResponseReader reader(call->rgbOut, call->cbOut);
+    unsigned long processed = 0;
+    long status;
+    while ((status = reader.NextBuffer()) == 0)
+    {
+        RopCodec::Byte ropId;
+        RopCodec::Byte inputHandleIndex;
+        RopCodec::ULong returnValue;
+        while (processed < call->ropCount && reader.Peek(ropId, returnValue))
+        {
+            if (ropId < RopCodec::SynchronizationUploadStateStreamBegin::Id || ropId > RopCodec::SynchronizationUploadStateStreamEnd::Id)
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            if (!reader.ReadLayout<RopCodec::ResponseHeader>(ropId, inputHandleIndex, returnValue))
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            if (returnValue != 0)
+            {
+                return (long)returnValue;
+            }
+
+            processed++;
+        }
+    }
+
+    if (status != ERROR_NO_MORE_ITEMS)
+    {
+        return status;
+    }
+
+    return processed == call->ropCount ? 0 : ERROR_INVALID_DATA;
+}
+
+/// <summary>
+/// Send the state properties of a checkpoint; the next request is packed while the server processes the current one.
+/// </summary>
+static long RunStateUpload(
+    SYNC_STATE_STORE *store,
+    CXH *pcxh,
+    unsigned char logonId,
+    unsigned long synchronizationHandle,
+    SyncStateUploadCursor &cursor)
+{
+    PipelinedCallRing calls(2);
+    if (!calls.IsValid())
+    {
+        return GetLastError();
+    }
+
+    long status = PrepareStateCall(store, calls[0], cursor, logonId, synchronizationHandle);
+    if (status == 0)
+    {
+        status = BeginPipelinedCall(pcxh, calls[0], PIPELINED_RPC_FLAGS);
+    }
+
+    for (unsigned long k = 0; status == 0; k++)
+    {
+        bool more = cursor.property < cursor.properties.size();
+        if (more)
+        {
+            status = PrepareStateCall(store, calls[k + 1], cursor, logonId, synchronizationHandle);
+            if (status != 0)
+            {
+                break;
+            }
+        }
+
+        status = EndPipelinedCall(calls[k]);
+        if (status == 0)
+        {
+            status = ProcessStateResponse(calls[k]);
+        }
+
+        if (status != 0 || !more)
+        {
+            break;
+        }
+
+        status = BeginPipelinedCall(pcxh, calls[k + 1], PIPELINED_RPC_FLAGS);
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Open a checkpoint store, creating its file if it does not exist.
+/// </summary>
+/// <param name="path">The file of the store.</param>
+/// <param name="store">Receives the store; release it with SyncStateStoreClose.</param>
+/// <returns>If success, it returns 0. ERROR_FILE_CORRUPT indicates the file is not a checkpoint store or is damaged.</returns>
+long __stdcall SyncStateStoreOpen(const wchar_t *path, SYNC_STATE_STORE **store)
+{
+    if (path == NULL || store == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    SYNC_STATE_STORE *created = new SYNC_STATE_STORE();
+    created->path = path;
+    created->committed = 0;
+    created->end = 0;
+    created->activeUploads = 0;
+    InitializeCriticalSection(&created->lock);
+    long status = LoadStore(created);
+    if (status != 0)
+    {
+        SyncStateStoreClose(created);
+        return status;
+    }
+
+    *store = created;
+    return 0;
+}
+
+/// <summary>
+/// Close a checkpoint store. Checkpoints put since the last commit are lost.
+/// </summary>
+void __stdcall SyncStateStoreClose(SYNC_STATE_STORE *store)
+{
+    if (store == NULL)
+    {
+        return;
+    }
+
+    store->file.Close();
+    DeleteCriticalSection(&store->lock);
+    delete store;
+}
+
+/// <summary>
+/// Put the state of a folder, replacing its previous checkpoint once committed.
+/// </summary>
+/// <param name="store">The store.</param>
+/// <param name="folderId">The FID of the folder.</param>
+/// <param name="synchronizationType">The SynchronizationType of the synchronization context: 0x01 for contents, 0x02 for hierarchy.</param>
+/// <param name="properties">The state properties, such as returned by RopSynchronizationGetTransferState.</param>
+/// <param name="propertyCount">The number of state properties.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall SyncStateStorePut(
+    SYNC_STATE_STORE *store,
+    unsigned __int64 folderId,
+    unsigned long synchronizationType,
+    const SYNC_STATE_PROPERTY *properties,
+    unsigned long propertyCount)
+{
+    if (store == NULL || properties == NULL || propertyCount == 0)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    for (unsigned long i = 0; i < propertyCount; i++)
+    {
+        if (properties[i].Data == NULL && properties[i].Size != 0)
+        {
+            return ERROR_INVALID_PARAMETER;
+        }
+    }
+
+    EnterCriticalSection(&store->lock);
+    long status = AppendRecord(store, folderId, synchronizationType, properties, propertyCount);
+    LeaveCriticalSection(&store->lock);
+    return status;
+}
+
+/// <summary>
+/// Remove the checkpoint of a folder, once committed.
+/// </summary>
+/// <returns>If success, it returns 0. ERROR_NOT_FOUND indicates the folder has no checkpoint.</returns>
+long __stdcall SyncStateStoreRemove(SYNC_STATE_STORE *store, unsigned __int64 folderId, unsigned long synchronizationType)
+{
+    if (store == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    EnterCriticalSection(&store->lock);
+    long status = ERROR_NOT_FOUND;
+    if (store->index.find(SyncStateKey(folderId, synchronizationType)) != store->index.end())
+    {
+        status = AppendRecord(store, folderId, synchronizationType, NULL, 0);
+    }
+
+    LeaveCriticalSection(&store->lock);
+    return status;
+}
+
+/// <summary>
+/// Make the checkpoints put and removed since the last commit durable.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall SyncStateStoreCommit(SYNC_STATE_STORE *store)
+{
+    if (store == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    EnterCriticalSection(&store->lock);
+    long status = CommitRecords(store);
+    LeaveCriticalSection(&store->lock);
+    return status;
+}
+
+/// <summary>
+/// Copy one state property of the checkpoint of a folder.
+/// </summary>
+/// <param name="store">The store.</param>
+/// <param name="folderId">The FID of the folder.</param>
+/// <param name="synchronizationType">The SynchronizationType of the checkpoint.</param>
+/// <param name="propertyTag">The state property, such as META_TAG_CNSET_SEEN.</param>
+/// <param name="buffer">The buffer that receives the property value; NULL to only get its size.</param>
+/// <param name="capacity">The size of the buffer.</param>
+/// <param name="size">Receives the size of the property value.</param>
+/// <returns>If success, it returns 0. ERROR_NOT_FOUND indicates there is no such checkpoint or property; ERROR_INSUFFICIENT_BUFFER indicates the buffer is too small, size is still set.</returns>
+long __stdcall SyncStateStoreGet(
+    SYNC_STATE_STORE *store,
+    unsigned __int64 folderId,
+    unsigned long synchronizationType,
+    unsigned long propertyTag,
+    unsigned char *buffer,
+    unsigned long capacity,
+    unsigned long *size)
+{
+    if (store == NULL || size == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    EnterCriticalSection(&store->lock);
+    long status = ERROR_NOT_FOUND;
+    std::map<SyncStateKey, unsigned __int64>::const_iterator it = store->index.find(SyncStateKey(folderId, synchronizationType));
+    std::vector<SyncStateLocation> properties;
+    if (it != store->index.end() && (status = ReadRecord(store, it->second, properties)) == 0)
+    {
+        status = ERROR_NOT_FOUND;
+        for (size_t i = 0; i < properties.size(); i++)
+        {
+            if (properties[i].propertyTag != propertyTag)
+            {
+                continue;
+            }
+
+            *size = properties[i].size;
+            if (buffer == NULL || capacity < properties[i].size)
+            {
+                status = ERROR_INSUFFICIENT_BUFFER;
+            }
+            else
+            {
+                status = store->file.Read(properties[i].offset, buffer, properties[i].size);
+            }
+
+            break;
+        }
+    }
+
+    LeaveCriticalSection(&store->lock);
+    return status;
+}
+
+/// <summary>
+/// Rewrite the store with the latest committed checkpoint of every folder only, and replace the file atomically.
+/// </summary>
+/// <returns>If success, it returns 0. ERROR_BUSY indicates an upload is reading the store.</returns>
+long __stdcall SyncStateStoreCompact(SYNC_STATE_STORE *store)
+{
+    if (store == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    EnterCriticalSection(&store->lock);
+    if (store->activeUploads != 0)
+    {
+        LeaveCriticalSection(&store->lock);
+        return ERROR_BUSY;
+    }
+
+    // Uncommitted checkpoints would become committed by the copy; commit them first.
+    long status = CommitRecords(store);
+    if (status != 0)
+    {
+        LeaveCriticalSection(&store->lock);
+        return status;
+    }
+
+    unsigned __int64 size = sizeof(SyncStateFileHeader);
+    for (std::map<SyncStateKey, unsigned __int64>::const_iterator it = store->index.begin(); it != store->index.end(); ++it)
+    {
+        SyncStateRecordHeader record;
+        status = store->file.Read(it->second, (unsigned char *)&record, sizeof(record));
+        if (status != 0)
+        {
+            LeaveCriticalSection(&store->lock);
+            return status;
+        }
+
+        size += record.size;
+    }
+
+    std::wstring temporary = store->path + L".compact";
+    MappedFile target;
+    status = target.Create(temporary.c_str(), size);
+    SyncStateFileHeader header = { SYNC_STATE_SIGNATURE, SYNC_STATE_VERSION, size };
+    if (status == 0)
+    {
+        status = target.Write(0, (const unsigned char *)&header, sizeof(header));
+    }
+
+    unsigned __int64 offset = sizeof(header);
+    for (std::map<SyncStateKey, unsigned __int64>::const_iterator it = store->index.begin(); status == 0 && it != store->index.end(); ++it)
+    {
+        SyncStateRecordHeader record;
+        status = store->file.Read(it->second, (unsigned char *)&record, sizeof(record));
+        for (unsigned long copied = 0; status == 0 && copied < record.size;)
+        {
+            unsigned long available;
+            const unsigned char *source = store->file.At(it->second + copied, &available);
+            if (source == NULL)
+            {
+                status = GetLastError();
+                break;
+            }
+
+            unsigned long count = record.size - copied < available ? record.size - copied : available;
+            status = target.Write(offset + copied, source, count);
+            copied += count;
+        }
+
+        offset += record.size;
+    }
+
+    if (status == 0)
+    {
+        status = FlushRange(target, 0, size);
+    }
+
+    target.Close();
+    if (status == 0)
+    {
+        store->file.Close();
+        if (!MoveFileExW(temporary.c_str(), store->path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+        {
+            status = GetLastError();
+        }
+
+        // Reopen whichever file is in place now.
+        long loaded = LoadStore(store);
+        status = status != 0 ? status : loaded;
+    }
+    else
+    {
+        DeleteFileW(temporary.c_str());
+    }
+
+    LeaveCriticalSection(&store->lock);
+    return status;
+}
+
+/// <summary>
+/// Upload the checkpoint of a folder to a synchronization context, with RopSynchronizationUploadStateStreamBegin,
+/// Continue and End for every state property.
+/// </summary>
+/// <param name="store">The store.</param>
+/// <param name="pcxh">The CXH that was created by calling EcDoConnectEx.</param>
+/// <param name="logonId">The LogonId of the logon the synchronization context belongs to.</param>
+/// <param name="synchronizationHandle">The server object handle of the context, such as returned by RopSynchronizationConfigure.</param>
+/// <param name="folderId">The FID of the folder.</param>
+/// <param name="synchronizationType">The SynchronizationType of the checkpoint.</param>
+/// <returns>If success, it returns 0. ERROR_NOT_FOUND indicates the folder has no checkpoint; otherwise the error code, or the ReturnValue of the failed ROP.</returns>
+long __stdcall SyncStateStoreUpload(
+    SYNC_STATE_STORE *store,
+    CXH *pcxh,
+    unsigned char logonId,
+    unsigned long synchronizationHandle,
+    unsigned __int64 folderId,
+    unsigned long synchronizationType)
+{
+    if (store == NULL || pcxh == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    SyncStateUploadCursor cursor;
+    cursor.property = 0;
+    cursor.begun = false;
+    cursor.dataOffset = 0;
+
+    EnterCriticalSection(&store->lock);
+    long status = ERROR_NOT_FOUND;
+    std::map<SyncStateKey, unsigned __int64>::const_iterator it = store->index.find(SyncStateKey(folderId, synchronizationType));
+    if (it != store->index.end() && (status = ReadRecord(store, it->second, cursor.properties)) == 0)
+    {
+        store->activeUploads++;
+    }
+
+    LeaveCriticalSection(&store->lock);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    status = RunStateUpload(store, pcxh, logonId, synchronizationHandle, cursor);
+
+    EnterCriticalSection(&store->lock);
+    store->activeUploads--;
+    LeaveCriticalSection(&store->lock);
+    return status;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "MS-OXCRPC.h"
+
+/// <summary>
+/// The ICS state properties, as specified in MS-OXCFXICS section 2.2.1.1.
+/// </summary>
+#define META_TAG_IDSET_GIVEN        0x40170003
+#define META_TAG_CNSET_SEEN         0x67960102
+#define META_TAG_CNSET_SEEN_FAI     0x67DA0102
+#define META_TAG_CNSET_READ         0x67D20102
+
+/// <summary>
+/// One state property of a checkpoint.
+/// </summary>
+typedef struct _SYNC_STATE_PROPERTY
+{
+    unsigned long PropertyTag;
+    const unsigned char *Data;
+    unsigned long Size;
+} SYNC_STATE_PROPERTY;
+
+typedef struct _SYNC_STATE_STORE SYNC_STATE_STORE;
+
+long __stdcall SyncStateStoreOpen(const wchar_t *path, SYNC_STATE_STORE **store);
+
+void __stdcall SyncStateStoreClose(SYNC_STATE_STORE *store);
+
+long __stdcall SyncStateStorePut(
+    SYNC_STATE_STORE *store,
+    unsigned __int64 folderId,
+    unsigned long synchronizationType,
+    const SYNC_STATE_PROPERTY *properties,
+    unsigned long propertyCount);
+
+long __stdcall SyncStateStoreRemove(SYNC_STATE_STORE *store, unsigned __int64 folderId, unsigned long synchronizationType);
+
+long __stdcall SyncStateStoreCommit(SYNC_STATE_STORE *store);
+
+long __stdcall SyncStateStoreGet(
+    SYNC_STATE_STORE *store,
+    unsigned __int64 folderId,
+    unsigned long synchronizationType,
+    unsigned long propertyTag,
+    unsigned char *buffer,
+    unsigned long capacity,
+    unsigned long *size);
+
+long __stdcall SyncStateStoreCompact(SYNC_STATE_STORE *store);
+
+long __stdcall SyncStateStoreUpload(
+    SYNC_STATE_STORE *store,
+    CXH *pcxh,
+    unsigned char logonId,
+    unsigned long synchronizationHandle,
+    unsigned __int64 folderId,
+    unsigned long synchronizationType);
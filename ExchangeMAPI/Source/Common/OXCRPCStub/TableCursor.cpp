@@ -0,0 +1,656 @@
+#include "TableCursor.h"
+#include "PipelinedRpcCall.h"
+#include "PropertyRowDecoder.h"
+#include <deque>
+#include <new>
+#include <vector>
+
+// A client-side cursor over a table object whose columns are already set. Rows are kept in a window of consecutive
+// positions; a read or a seek inside the window is served without a call. A read that leaves the window fetches a
+// block with RopSeekRow, RopQueryRows and RopQueryPosition in one EcDoRpcExt2 call, so the server position and the
+// row count are known after every fetch. The block grows while reads continue where the previous block ended, in
+// either direction, and falls back to the minimum after a jump.
+//
+// The window is dropped when the table changes. TableCursorNotificationRoutine can be subscribed to the notification
+// handle of the table in a notification engine; it only flags the cursor, and the flag is checked by the next call on
+// the thread that owns the cursor. Apart from that flag, a cursor is used by one thread at a time, and the table
+// handle MUST NOT be moved by other ROPs while the cursor is in use.
+
+using namespace RopCodec;
+
+/// <summary>
+/// The Advance value of the QueryRowsFlags field of RopQueryRows.
+/// </summary>
+#define QUERY_ROWS_ADVANCE 0x00
+
+static const unsigned short DefaultMinReadAhead = 16;
+static const unsigned short DefaultMaxReadAhead = 256;
+static const unsigned long DefaultWindowRows = 1024;
+
+struct _TABLE_CURSOR
+{
+    CXH *pcxh;
+    unsigned char logonId;
+    unsigned long tableHandle;
+    ROW_DECODER *decoder;
+    PipelinedRpcCall *call;
+    unsigned short minReadAhead;
+    unsigned short maxReadAhead;
+    unsigned short readAhead;
+    unsigned long windowRows;
+
+    std::deque<std::vector<unsigned char> > rows;  // The PropertyRow at windowStart + i is rows[i].
+    unsigned long windowStart;
+    unsigned long position;
+    bool serverPositionKnown;
+    unsigned long serverPosition;
+    bool rowCountKnown;
+    unsigned long rowCount;
+    volatile LONG invalidated;
+    TABLE_CURSOR_STATS stats;
+};
+
+static unsigned long WindowEnd(TABLE_CURSOR *cursor)
+{
+    return cursor->windowStart + (unsigned long)cursor->rows.size();
+}
+
+static bool InWindow(TABLE_CURSOR *cursor, unsigned long position)
+{
+    return position >= cursor->windowStart && position < WindowEnd(cursor);
+}
+
+/// <summary>
+/// Drop the window if the table changed since the last call.
+/// </summary>
+static void CheckInvalidated(TABLE_CURSOR *cursor)
+{
+    if (InterlockedExchange(&cursor->invalidated, 0) != 0)
+    {
+        cursor->rows.clear();
+        cursor->windowStart = 0;
+        cursor->rowCountKnown = false;
+        cursor->serverPositionKnown = false;
+        cursor->readAhead = cursor->minReadAhead;
+        cursor->stats.InvalidationCount++;
+    }
+}
+
+/// <summary>
+/// Send the prepared request and move to the first response buffer.
+/// </summary>
+static long CallServer(TABLE_CURSOR *cursor, RopResponseReader &reader)
+{
+    PipelinedRpcCall *call = cursor->call;
+    if (call->cbIn == 0)
+    {
+        return ERROR_INSUFFICIENT_BUFFER;
+    }
+
+    // The server position is only trusted again once the response has been read.
+    cursor->serverPositionKnown = false;
+    cursor->stats.RequestCount++;
+    long status = BeginPipelinedCall(cursor->pcxh, call, PIPELINED_RPC_FLAGS);
+    if (status == 0)
+    {
+        status = EndPipelinedCall(call);
+    }
+
+    if (status != 0)
+    {
+        return status;
+    }
+
+    reader = RopResponseReader(call->rgbOut, call->cbOut);
+    status = reader.NextBuffer();
+    return status == ERROR_NO_MORE_ITEMS ? ERROR_INVALID_DATA : status;
+}
+
+/// <summary>
+/// Read a RopSeekRow response.
+/// </summary>
+static long ReadSeekRow(RopResponseReader &reader, long &rowsSought)
+{
+    Byte ropId;
+    Byte inputHandleIndex;
+    ULong returnValue;
+    Byte hasSoughtLess;
+    if (!reader.Peek(ropId, returnValue) || ropId != SeekRow::Id)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    if (returnValue != 0)
+    {
+        return (long)returnValue;
+    }
+
+    return reader.Read<SeekRow>(ropId, inputHandleIndex, returnValue, hasSoughtLess, rowsSought) ? 0 : ERROR_INVALID_DATA;
+}
+
+/// <summary>
+/// Read a RopQueryPosition response and record the server position and the row count.
+/// </summary>
+static long ReadQueryPosition(TABLE_CURSOR *cursor, RopResponseReader &reader)
+{
+    Byte ropId;
+    Byte inputHandleIndex;
+    ULong returnValue;
+    ULong numerator;
+    ULong denominator;
+    if (!reader.Peek(ropId, returnValue) || ropId != QueryPosition::Id)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    if (returnValue != 0)
+    {
+        return (long)returnValue;
+    }
+
+    if (!reader.Read<QueryPosition>(ropId, inputHandleIndex, returnValue, numerator, denominator))
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    cursor->serverPosition = numerator;
+    cursor->serverPositionKnown = true;
+    cursor->rowCount = denominator;
+    cursor->rowCountKnown = true;
+    return 0;
+}
+
+/// <summary>
+/// Add fetched rows that start at first to the window, and trim the window on the side the reads move away from.
+/// </summary>
+static void StoreRows(TABLE_CURSOR *cursor, unsigned long first, const unsigned char *rowData, const unsigned long *offsets, unsigned long count, bool forward)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    if (cursor->rows.empty() || first > WindowEnd(cursor) || first + count < cursor->windowStart)
+    {
+        cursor->rows.clear();
+        cursor->windowStart = first;
+    }
+
+    for (unsigned long i = 0; i < count; i++)
+    {
+        if (first + i == WindowEnd(cursor))
+        {
+            cursor->rows.push_back(std::vector<unsigned char>(rowData + offsets[i], rowData + offsets[i + 1]));
+        }
+    }
+
+    for (unsigned long i = count; i-- > 0;)
+    {
+        if (first + i + 1 == cursor->windowStart)
+        {
+            cursor->rows.push_front(std::vector<unsigned char>(rowData + offsets[i], rowData + offsets[i + 1]));
+            cursor->windowStart--;
+        }
+    }
+
+    while (cursor->rows.size() > cursor->windowRows)
+    {
+        if (forward)
+        {
+            cursor->rows.pop_front();
+            cursor->windowStart++;
+        }
+        else
+        {
+            cursor->rows.pop_back();
+        }
+    }
+}
+
+/// <summary>
+/// Fetch up to count rows from position start into the window.
+/// </summary>
+/// <param name="fetched">Receives the number of rows the server returned; fewer than count at the end of the table or when the response is full.</param>
+static long FetchRows(TABLE_CURSOR *cursor, unsigned long start, unsigned short count, bool forward, unsigned long *fetched)
+{
+    *fetched = 0;
+    PipelinedRpcCall *call = cursor->call;
+    RopRequestWriter writer(call->rgbIn, sizeof(call->rgbIn));
+    bool seek = !cursor->serverPositionKnown || cursor->serverPosition != start;
+    if (seek)
+    {
+        writer.Append<SeekRow>(cursor->logonId, (Byte)0, (Byte)TABLE_SEEK_BEGINNING, (long)start, (Byte)1);
+    }
+
+    writer.Append<QueryRows>(cursor->logonId, (Byte)0, (Byte)QUERY_ROWS_ADVANCE, (Byte)1, count);
+    writer.Append<QueryPosition>(cursor->logonId, (Byte)0);
+    call->cbIn = writer.Finish(&cursor->tableHandle, 1);
+
+    RopResponseReader reader(NULL, 0);
+    long status = CallServer(cursor, reader);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    // A seek past the end stops at the last row; the rows then start where it stopped.
+    unsigned long first = start;
+    if (seek)
+    {
+        long rowsSought = 0;
+        status = ReadSeekRow(reader, rowsSought);
+        if (status != 0)
+        {
+            return status;
+        }
+
+        first = rowsSought < 0 ? 0 : (unsigned long)rowsSought;
+    }
+
+    Byte ropId;
+    Byte inputHandleIndex;
+    ULong returnValue;
+    Byte origin;
+    UShort rowsRead;
+    if (!reader.Peek(ropId, returnValue) || ropId != QueryRows::Id)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    if (returnValue != 0)
+    {
+        return (long)returnValue;
+    }
+
+    if (!reader.Read<QueryRows>(ropId, inputHandleIndex, returnValue, origin, rowsRead) || rowsRead > count)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    unsigned long consumed = 0;
+    const unsigned long *offsets = NULL;
+    status = RowDecoderDecode(cursor->decoder, reader.Cursor(), reader.Remaining(), rowsRead, &consumed);
+    if (status == 0)
+    {
+        status = RowDecoderGetRowOffsets(cursor->decoder, &offsets);
+    }
+
+    if (status != 0)
+    {
+        return status;
+    }
+
+    StoreRows(cursor, first, reader.Take(consumed), offsets, rowsRead, forward);
+    cursor->stats.RowsFetched += rowsRead;
+    *fetched = rowsRead;
+    return ReadQueryPosition(cursor, reader);
+}
+
+/// <summary>
+/// Fetch the block that holds the row at position, reading ahead in the direction of travel.
+/// </summary>
+static long FetchAround(TABLE_CURSOR *cursor, unsigned long position, bool forward, unsigned long wanted)
+{
+    bool sequential = !cursor->rows.empty() && (forward ? position == WindowEnd(cursor) : position + 1 == cursor->windowStart);
+    if (!sequential)
+    {
+        cursor->readAhead = cursor->minReadAhead;
+    }
+    else if (cursor->readAhead < cursor->maxReadAhead)
+    {
+        cursor->readAhead = cursor->readAhead * 2 > cursor->maxReadAhead ? cursor->maxReadAhead : cursor->readAhead * 2;
+    }
+
+    unsigned long count = wanted > cursor->readAhead ? wanted : cursor->readAhead;
+    if (count > cursor->maxReadAhead)
+    {
+        count = cursor->maxReadAhead;
+    }
+
+    unsigned long start = position;
+    if (!forward)
+    {
+        start = position + 1 > count ? position + 1 - count : 0;
+        count = position + 1 - start;
+    }
+
+    // A full response can stop short of a backward block's last row, so keep going until that row is in.
+    for (;;)
+    {
+        unsigned long fetched;
+        long status = FetchRows(cursor, start, (unsigned short)count, forward, &fetched);
+        if (status != 0 || fetched == 0 || fetched >= count || InWindow(cursor, position))
+        {
+            return status;
+        }
+
+        start += fetched;
+        count -= fetched;
+    }
+}
+
+/// <summary>
+/// Move the server cursor and record the position and row count it reports.
+/// </summary>
+static long SeekOnServer(TABLE_CURSOR *cursor, unsigned char origin, long rowCount, long *rowsSought)
+{
+    PipelinedRpcCall *call = cursor->call;
+    RopRequestWriter writer(call->rgbIn, sizeof(call->rgbIn));
+    writer.Append<SeekRow>(cursor->logonId, (Byte)0, origin, rowCount, (Byte)1);
+    writer.Append<QueryPosition>(cursor->logonId, (Byte)0);
+    call->cbIn = writer.Finish(&cursor->tableHandle, 1);
+
+    RopResponseReader reader(NULL, 0);
+    long status = CallServer(cursor, reader);
+    if (status == 0)
+    {
+        status = ReadSeekRow(reader, *rowsSought);
+    }
+
+    if (status == 0)
+    {
+        status = ReadQueryPosition(cursor, reader);
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Create a cursor over a table whose columns were set with RopSetColumns. The cursor starts at the beginning of the table.
+/// </summary>
+/// <param name="pcxh">The session context handle.</param>
+/// <param name="logonId">The LogonId of the ROPs.</param>
+/// <param name="tableHandle">The server object handle of the table.</param>
+/// <param name="propertyTags">The columns set on the table.</param>
+/// <param name="propertyTagCount">The number of columns.</param>
+/// <param name="options">The read-ahead and window sizes; NULL for the defaults.</param>
+/// <param name="cursor">Receives the cursor; release it with TableCursorDestroy.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall TableCursorCreate(
+    CXH *pcxh,
+    unsigned char logonId,
+    unsigned long tableHandle,
+    const unsigned long *propertyTags,
+    unsigned short propertyTagCount,
+    const TABLE_CURSOR_OPTIONS *options,
+    TABLE_CURSOR **cursor)
+{
+    if (pcxh == NULL || cursor == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    *cursor = NULL;
+    unsigned short minReadAhead = options != NULL && options->MinReadAhead != 0 ? options->MinReadAhead : DefaultMinReadAhead;
+    unsigned short maxReadAhead = options != NULL && options->MaxReadAhead != 0 ? options->MaxReadAhead : DefaultMaxReadAhead;
+    unsigned long windowRows = options != NULL && options->WindowRows != 0 ? options->WindowRows : DefaultWindowRows;
+    if (maxReadAhead < minReadAhead)
+    {
+        maxReadAhead = minReadAhead;
+    }
+
+    if (windowRows < maxReadAhead)
+    {
+        windowRows = maxReadAhead;
+    }
+
+    TABLE_CURSOR *created = new (std::nothrow) TABLE_CURSOR();
+    if (created == NULL)
+    {
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    long status = RowDecoderCreate(propertyTags, propertyTagCount, maxReadAhead, &created->decoder);
+    if (status != 0)
+    {
+        delete created;
+        return status;
+    }
+
+    created->call = new (std::nothrow) PipelinedRpcCall();
+    if (created->call == NULL)
+    {
+        TableCursorDestroy(created);
+        return ERROR_NOT_ENOUGH_MEMORY;
+    }
+
+    created->call->pending = false;
+    created->call->completed = CreateEvent(NULL, TRUE, FALSE, NULL);
+    if (created->call->completed == NULL)
+    {
+        status = GetLastError();
+        TableCursorDestroy(created);
+        return status;
+    }
+
+    created->pcxh = pcxh;
+    created->logonId = logonId;
+    created->tableHandle = tableHandle;
+    created->minReadAhead = minReadAhead;
+    created->maxReadAhead = maxReadAhead;
+    created->readAhead = minReadAhead;
+    created->windowRows = windowRows;
+    *cursor = created;
+    return 0;
+}
+
+/// <summary>
+/// Release a cursor. Unsubscribe TableCursorNotificationRoutine first if it was subscribed with this cursor.
+/// </summary>
+void __stdcall TableCursorDestroy(TABLE_CURSOR *cursor)
+{
+    if (cursor == NULL)
+    {
+        return;
+    }
+
+    if (cursor->call != NULL)
+    {
+        if (cursor->call->completed != NULL)
+        {
+            CloseHandle(cursor->call->completed);
+        }
+
+        delete cursor->call;
+    }
+
+    RowDecoderDestroy(cursor->decoder);
+    delete cursor;
+}
+
+/// <summary>
+/// Read rows from the cursor position and move past them, as RopQueryRows with the Advance flag does.
+/// </summary>
+/// <param name="forwardRead">TRUE to read the rows after the position; FALSE to read the rows before it, nearest first.</param>
+/// <param name="rowCount">The maximum number of rows.</param>
+/// <param name="buffer">Receives the PropertyRow structures of the rows, in the order they are returned; decode them with RowDecoderDecode.</param>
+/// <param name="capacity">The size of the buffer.</param>
+/// <param name="rowsReturned">Receives the number of rows; fewer than rowCount at either end of the table or when the buffer is full.</param>
+/// <param name="size">Receives the number of bytes written to the buffer.</param>
+/// <returns>If success, it returns 0. ERROR_INSUFFICIENT_BUFFER indicates the next row does not fit in the buffer.</returns>
+long __stdcall TableCursorQueryRows(
+    TABLE_CURSOR *cursor,
+    BOOL forwardRead,
+    unsigned short rowCount,
+    unsigned char *buffer,
+    unsigned long capacity,
+    unsigned short *rowsReturned,
+    unsigned long *size)
+{
+    if (cursor == NULL || rowsReturned == NULL || size == NULL || (buffer == NULL && capacity != 0))
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    CheckInvalidated(cursor);
+    bool forward = forwardRead != FALSE;
+    unsigned short returned = 0;
+    unsigned long written = 0;
+    long status = 0;
+    while (returned < rowCount)
+    {
+        if (forward ? cursor->rowCountKnown && cursor->position >= cursor->rowCount : cursor->position == 0)
+        {
+            break;
+        }
+
+        unsigned long next = forward ? cursor->position : cursor->position - 1;
+        if (InWindow(cursor, next))
+        {
+            cursor->stats.CacheHits++;
+        }
+        else
+        {
+            status = FetchAround(cursor, next, forward, rowCount - returned);
+            if (status != 0 || !InWindow(cursor, next))
+            {
+                break;
+            }
+        }
+
+        const std::vector<unsigned char> &row = cursor->rows[next - cursor->windowStart];
+        if (row.size() > capacity - written)
+        {
+            if (returned == 0)
+            {
+                status = ERROR_INSUFFICIENT_BUFFER;
+            }
+
+            break;
+        }
+
+        memcpy(buffer + written, &row[0], row.size());
+        written += (unsigned long)row.size();
+        returned++;
+        cursor->position = forward ? cursor->position + 1 : cursor->position - 1;
+    }
+
+    cursor->stats.RowsReturned += returned;
+    *rowsReturned = returned;
+    *size = written;
+    return status;
+}
+
+/// <summary>
+/// Move the cursor position, as RopSeekRow does. The move is computed locally once the row count of the table is known.
+/// </summary>
+/// <param name="origin">TABLE_SEEK_BEGINNING, TABLE_SEEK_CURRENT or TABLE_SEEK_END.</param>
+/// <param name="rowCount">The signed number of rows to move from the origin.</param>
+/// <param name="rowsSought">Receives the signed number of rows actually moved from the origin; it can be NULL.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall TableCursorSeekRow(TABLE_CURSOR *cursor, unsigned char origin, long rowCount, long *rowsSought)
+{
+    if (cursor == NULL || origin > TABLE_SEEK_END)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    CheckInvalidated(cursor);
+    __int64 base = origin == TABLE_SEEK_BEGINNING ? 0 : origin == TABLE_SEEK_CURRENT ? cursor->position : cursor->rowCount;
+    long sought = 0;
+    if (cursor->rowCountKnown)
+    {
+        __int64 target = base + rowCount;
+        target = target < 0 ? 0 : target > (__int64)cursor->rowCount ? (__int64)cursor->rowCount : target;
+        cursor->position = (unsigned long)target;
+        cursor->stats.LocalSeeks++;
+        sought = (long)(target - base);
+    }
+    else
+    {
+        // The server position is past the read-ahead, so a move from the current row is sent as a move from the beginning.
+        if (origin == TABLE_SEEK_CURRENT)
+        {
+            __int64 target = base + rowCount;
+            origin = TABLE_SEEK_BEGINNING;
+            rowCount = target < 0 ? 0 : target > 0x7FFFFFFF ? 0x7FFFFFFF : (long)target;
+        }
+
+        long status = SeekOnServer(cursor, origin, rowCount, &sought);
+        if (status != 0)
+        {
+            return status;
+        }
+
+        if (origin == TABLE_SEEK_END)
+        {
+            base = cursor->rowCount;
+        }
+
+        cursor->position = cursor->serverPosition;
+        sought = (long)((__int64)cursor->position - base);
+    }
+
+    if (rowsSought != NULL)
+    {
+        *rowsSought = sought;
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Return the cursor position and the row count of the table, as RopQueryPosition does.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long __stdcall TableCursorQueryPosition(TABLE_CURSOR *cursor, unsigned long *numerator, unsigned long *denominator)
+{
+    if (cursor == NULL || numerator == NULL || denominator == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    CheckInvalidated(cursor);
+    if (!cursor->rowCountKnown)
+    {
+        long sought;
+        long status = SeekOnServer(cursor, TABLE_SEEK_BEGINNING, (long)cursor->position, &sought);
+        if (status != 0)
+        {
+            return status;
+        }
+
+        cursor->position = cursor->serverPosition;
+    }
+
+    *numerator = cursor->position;
+    *denominator = cursor->rowCount;
+    return 0;
+}
+
+/// <summary>
+/// Drop the rows kept by a cursor. It can be called on any thread; the next call on the cursor refetches.
+/// </summary>
+void __stdcall TableCursorInvalidate(TABLE_CURSOR *cursor)
+{
+    if (cursor != NULL)
+    {
+        InterlockedExchange(&cursor->invalidated, 1);
+    }
+}
+
+/// <summary>
+/// A NOTIFICATION_ROUTINE that drops the rows of the cursor passed as context when its table is modified.
+/// Subscribe it with NotificationEngineSubscribe to the notification handle registered on the table.
+/// </summary>
+void __stdcall TableCursorNotificationRoutine(void *context, const NOTIFICATION *notification)
+{
+    if (notification != NULL && (notification->NotificationFlags & NOTIFICATION_TABLE_MODIFIED) != 0)
+    {
+        TableCursorInvalidate((TABLE_CURSOR *)context);
+    }
+}
+
+long __stdcall TableCursorGetStats(TABLE_CURSOR *cursor, TABLE_CURSOR_STATS *stats)
+{
+    if (cursor == NULL || stats == NULL)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    *stats = cursor->stats;
+    stats->ReadAhead = cursor->readAhead;
+    stats->WindowStart = cursor->windowStart;
+    stats->WindowCount = (unsigned long)cursor->rows.size();
+    return 0;
+}
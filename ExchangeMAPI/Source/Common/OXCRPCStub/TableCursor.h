@@ -0,0 +1,69 @@
+#pragma once
+
+#include "MS-OXCRPC.h"
+#include "NotificationEngine.h"
+
+/// <summary>
+/// The Origin values of RopSeekRow, as specified in MS-OXCROPS section 2.2.5.8.1.
+/// </summary>
+#define TABLE_SEEK_BEGINNING    0x00
+#define TABLE_SEEK_CURRENT      0x01
+#define TABLE_SEEK_END          0x02
+
+/// <summary>
+/// How a table cursor reads ahead and how many rows it keeps.
+/// </summary>
+typedef struct _TABLE_CURSOR_OPTIONS
+{
+    unsigned short MinReadAhead;        // The RowCount of a read that does not follow the previous one; 0 for the default.
+    unsigned short MaxReadAhead;        // The RowCount sequential reads grow to; 0 for the default.
+    unsigned long WindowRows;           // The number of rows kept; at least MaxReadAhead, 0 for the default.
+} TABLE_CURSOR_OPTIONS;
+
+/// <summary>
+/// The statistics of a table cursor.
+/// </summary>
+typedef struct _TABLE_CURSOR_STATS
+{
+    unsigned long RequestCount;         // The number of EcDoRpcExt2 calls.
+    unsigned long RowsReturned;         // Rows returned by TableCursorQueryRows.
+    unsigned long RowsFetched;          // Rows received from the server.
+    unsigned long CacheHits;            // Rows that were already in the window when they were read.
+    unsigned long LocalSeeks;           // TableCursorSeekRow calls served without a call.
+    unsigned long InvalidationCount;    // Times the window was dropped.
+    unsigned short ReadAhead;           // The RowCount of the next read.
+    unsigned long WindowStart;          // The position of the first row kept.
+    unsigned long WindowCount;          // The number of rows kept.
+} TABLE_CURSOR_STATS;
+
+typedef struct _TABLE_CURSOR TABLE_CURSOR;
+
+long __stdcall TableCursorCreate(
+    CXH *pcxh,
+    unsigned char logonId,
+    unsigned long tableHandle,
+    const unsigned long *propertyTags,
+    unsigned short propertyTagCount,
+    const TABLE_CURSOR_OPTIONS *options,
+    TABLE_CURSOR **cursor);
+
+void __stdcall TableCursorDestroy(TABLE_CURSOR *cursor);
+
+long __stdcall TableCursorQueryRows(
+    TABLE_CURSOR *cursor,
+    BOOL forwardRead,
+    unsigned short rowCount,
+    unsigned char *buffer,
+    unsigned long capacity,
+    unsigned short *rowsReturned,
+    unsigned long *size);
+
+long __stdcall TableCursorSeekRow(TABLE_CURSOR *cursor, unsigned char origin, long rowCount, long *rowsSought);
+
+long __stdcall TableCursorQueryPosition(TABLE_CURSOR *cursor, unsigned long *numerator, unsigned long *denominator);
+
+void __stdcall TableCursorInvalidate(TABLE_CURSOR *cursor);
+
+void __stdcall TableCursorNotificationRoutine(void *context, const NOTIFICATION *notification);
+
+long __stdcall TableCursorGetStats(TABLE_CURSOR *cursor, TABLE_CURSOR_STATS *stats);
@@ -0,0 +1,317 @@
+#include "TracedCalls.h"
+#include "StubTrace.h"
+#include "RpcCapture.h"
+#include "Keepalive.h"
+#include <string.h>
+
+// The EMSMDB and AsyncEMSMDB methods as this stub exports them. Each routine traces and captures the call around the
+// client stub routine MIDL generates, which stays as generated: dllexport.def exports these routines under the names
+// of the methods, and the routines of this stub that call a method call it here, so every call is traced whether it
+// comes from the host or from within the stub. The exception filters only classify the exception: a call that raises
+// an RPC exception is recorded as a fault after the handler has run, and the exception is then raised again for the
+// caller.
+
+/// <summary>
+/// Get the size of a string the call sends, terminating null included, or 0 if there is none.
+/// </summary>
+static unsigned long StringSize(const unsigned char *value)
+{
+    return value != NULL ? (unsigned long)strlen((const char *)value) + 1 : 0;
+}
+
+/// <summary>
+/// Record a call that raised an RPC exception and raise the exception again for the caller.
+/// </summary>
+/// <param name="trace">The trace of the call.</param>
+/// <param name="capture">The capture of the call, or NULL if the call is not captured.</param>
+/// <param name="exceptionCode">The code of the exception.</param>
+static void RaiseFault(STUB_TRACE_CALL *trace, RPC_CAPTURE_CALL *capture, unsigned long exceptionCode)
+{
+    StubTraceFault(trace, exceptionCode);
+    if (capture != NULL)
+    {
+        RpcCaptureFault(capture, exceptionCode);
+    }
+
+    RpcRaiseException(exceptionCode);
+}
+
+/// <summary>
+/// Traced EcDoDisconnect, as specified in MS-OXCRPC section 3.1.4.1.
+/// </summary>
+extern "C" long __stdcall TracedEcDoDisconnect(CXH *pcxh)
+{
+    long status = 0;
+    unsigned long exceptionCode = 0;
+    STUB_TRACE_CALL trace;
+    RPC_CAPTURE_CALL capture;
+
+    StubTraceBegin(&trace, STUB_TRACE_EMSMDB, 1, pcxh != NULL ? *pcxh : NULL, 0);
+    RpcCaptureBegin(&capture, RPC_CAPTURE_DISCONNECT, pcxh != NULL ? *pcxh : NULL, 0, NULL, 0);
+    if (pcxh != NULL)
+    {
+        KeepaliveUnbindSession(*pcxh);
+    }
+
+    RpcTryExcept
+    {
+        status = EcDoDisconnect(pcxh);
+    }
+    RpcExcept(RpcExceptionFilter(RpcExceptionCode()))
+    {
+        exceptionCode = RpcExceptionCode();
+    }
+    RpcEndExcept
+
+    if (exceptionCode != 0)
+    {
+        RaiseFault(&trace, &capture, exceptionCode);
+    }
+
+    StubTraceEnd(&trace, status, pcxh != NULL ? *pcxh : NULL, NULL, 0, 0);
+    RpcCaptureEnd(&capture, status, 0);
+    return status;
+}
+
+/// <summary>
+/// Traced EcRRegisterPushNotification, as specified in MS-OXCRPC section 3.1.4.5.
+/// </summary>
+extern "C" long __stdcall TracedEcRRegisterPushNotification(
+    CXH *pcxh,
+    unsigned long iRpc,
+    unsigned char rgbContext[],
+    unsigned short cbContext,
+    unsigned long grbitAdviseBits,
+    unsigned char rgbCallbackAddress[],
+    unsigned short cbCallbackAddress,
+    unsigned long *hNotification)
+{
+    long status = 0;
+    unsigned long exceptionCode = 0;
+    STUB_TRACE_CALL trace;
+
+    StubTraceBegin(&trace, STUB_TRACE_EMSMDB, 4, pcxh != NULL ? *pcxh : NULL, cbContext + cbCallbackAddress);
+    RpcTryExcept
+    {
+        status = EcRRegisterPushNotification(pcxh, iRpc, rgbContext, cbContext, grbitAdviseBits, rgbCallbackAddress, cbCallbackAddress, hNotification);
+    }
+    RpcExcept(RpcExceptionFilter(RpcExceptionCode()))
+    {
+        exceptionCode = RpcExceptionCode();
+    }
+    RpcEndExcept
+
+    if (exceptionCode != 0)
+    {
+        RaiseFault(&trace, NULL, exceptionCode);
+    }
+
+    StubTraceEnd(&trace, status, NULL, NULL, 0, 0);
+    return status;
+}
+
+/// <summary>
+/// Traced EcDummyRpc, as specified in MS-OXCRPC section 3.1.4.6.
+/// </summary>
+extern "C" long __stdcall TracedEcDummyRpc(handle_t hBinding)
+{
+    long status = 0;
+    unsigned long exceptionCode = 0;
+    STUB_TRACE_CALL trace;
+
+    StubTraceBegin(&trace, STUB_TRACE_EMSMDB, 6, NULL, 0);
+    RpcTryExcept
+    {
+        status = EcDummyRpc(hBinding);
+    }
+    RpcExcept(RpcExceptionFilter(RpcExceptionCode()))
+    {
+        exceptionCode = RpcExceptionCode();
+    }
+    RpcEndExcept
+
+    if (exceptionCode != 0)
+    {
+        RaiseFault(&trace, NULL, exceptionCode);
+    }
+
+    StubTraceEnd(&trace, status, NULL, NULL, 0, 0);
+    return status;
+}
+
+/// <summary>
+/// Traced EcDoConnectEx, as specified in MS-OXCRPC section 3.1.4.11.
+/// </summary>
+extern "C" long __stdcall TracedEcDoConnectEx(
+    handle_t hBinding,
+    CXH *pcxh,
+    unsigned char *szUserDN,
+    unsigned long ulFlags,
+    unsigned long ulConMod,
+    unsigned long cbLimit,
+    unsigned long ulCpid,
+    unsigned long ulLcidString,
+    unsigned long ulLcidSort,
+    unsigned long ulIcxrLink,
+    unsigned short usFCanConvertCodePages,
+    unsigned long *pcmsPollsMax,
+    unsigned long *pcRetry,
+    unsigned long *pcmsRetryDelay,
+    unsigned short *picxr,
+    unsigned char **szDNPrefix,
+    unsigned char **szDisplayName,
+    unsigned short rgwClientVersion[3],
+    unsigned short rgwServerVersion[3],
+    unsigned short rgwBestVersion[3],
+    unsigned long *pulTimeStamp,
+    unsigned char rgbAuxIn[],
+    unsigned long cbAuxIn,
+    unsigned char rgbAuxOut[],
+    SMALL_RANGE_ULONG *pcbAuxOut)
+{
+    long status = 0;
+    unsigned long exceptionCode = 0;
+    STUB_TRACE_CALL trace;
+    RPC_CAPTURE_CALL capture;
+
+    StubTraceBegin(&trace, STUB_TRACE_EMSMDB, 10, NULL, StringSize(szUserDN) + cbAuxIn);
+    RpcCaptureBegin(&capture, RPC_CAPTURE_CONNECT, NULL, 0, szUserDN, StringSize(szUserDN));
+    RpcTryExcept
+    {
+        status = EcDoConnectEx(hBinding, pcxh, szUserDN, ulFlags, ulConMod, cbLimit, ulCpid, ulLcidString, ulLcidSort, ulIcxrLink,
+            usFCanConvertCodePages, pcmsPollsMax, pcRetry, pcmsRetryDelay, picxr, szDNPrefix, szDisplayName, rgwClientVersion,
+            rgwServerVersion, rgwBestVersion, pulTimeStamp, rgbAuxIn, cbAuxIn, rgbAuxOut, pcbAuxOut);
+    }
+    RpcExcept(RpcExceptionFilter(RpcExceptionCode()))
+    {
+        exceptionCode = RpcExceptionCode();
+    }
+    RpcEndExcept
+
+    if (exceptionCode != 0)
+    {
+        RaiseFault(&trace, &capture, exceptionCode);
+    }
+
+    if (status == 0 && pcxh != NULL && *pcxh != NULL)
+    {
+        KeepaliveBindSession(*pcxh, hBinding);
+    }
+
+    StubTraceEnd(&trace, status, pcxh != NULL ? *pcxh : NULL, NULL, 0, pcbAuxOut != NULL ? *pcbAuxOut : 0);
+    RpcCaptureConnect(&capture, status, pcxh != NULL ? *pcxh : NULL, pcmsPollsMax, pcRetry, pcmsRetryDelay, picxr,
+        szDNPrefix != NULL ? *szDNPrefix : NULL, szDisplayName != NULL ? *szDisplayName : NULL, rgwServerVersion, rgwBestVersion, pulTimeStamp,
+        rgbAuxOut, pcbAuxOut != NULL ? *pcbAuxOut : 0);
+    return status;
+}
+
+/// <summary>
+/// Traced EcDoRpcExt2, as specified in MS-OXCRPC section 3.1.4.12.
+/// </summary>
+extern "C" long __stdcall TracedEcDoRpcExt2(
+    CXH *pcxh,
+    unsigned long *pulFlags,
+    unsigned char rgbIn[],
+    unsigned long cbIn,
+    unsigned char rgbOut[],
+    BIG_RANGE_ULONG *pcbOut,
+    unsigned char rgbAuxIn[],
+    unsigned long cbAuxIn,
+    unsigned char rgbAuxOut[],
+    SMALL_RANGE_ULONG *pcbAuxOut,
+    unsigned long *pulTransTime)
+{
+    long status = 0;
+    unsigned long exceptionCode = 0;
+    STUB_TRACE_CALL trace;
+    RPC_CAPTURE_CALL capture;
+
+    StubTraceBegin(&trace, STUB_TRACE_EMSMDB, 11, pcxh != NULL ? *pcxh : NULL, cbIn + cbAuxIn);
+    StubTraceFlags(&trace, pulFlags != NULL ? *pulFlags : 0, rgbIn, cbIn);
+    RpcCaptureBegin(&capture, RPC_CAPTURE_EXECUTE, pcxh != NULL ? *pcxh : NULL, pulFlags != NULL ? *pulFlags : 0, rgbIn, cbIn);
+    RpcTryExcept
+    {
+        status = EcDoRpcExt2(pcxh, pulFlags, rgbIn, cbIn, rgbOut, pcbOut, rgbAuxIn, cbAuxIn, rgbAuxOut, pcbAuxOut, pulTransTime);
+    }
+    RpcExcept(RpcExceptionFilter(RpcExceptionCode()))
+    {
+        exceptionCode = RpcExceptionCode();
+    }
+    RpcEndExcept
+
+    if (exceptionCode != 0)
+    {
+        RaiseFault(&trace, &capture, exceptionCode);
+    }
+
+    // The call reached the server whatever it returned, so the binding does not need a keepalive probe.
+    if (pcxh != NULL)
+    {
+        KeepaliveTouchSession(*pcxh);
+    }
+
+    StubTraceEnd(&trace, status, NULL, rgbOut, pcbOut != NULL ? *pcbOut : 0, pcbAuxOut != NULL ? *pcbAuxOut : 0);
+    RpcCaptureExecute(&capture, status, pulFlags != NULL ? *pulFlags : 0, rgbOut, pcbOut != NULL ? *pcbOut : 0,
+        rgbAuxOut, pcbAuxOut != NULL ? *pcbAuxOut : 0, pulTransTime != NULL ? *pulTransTime : 0);
+    return status;
+}
+
+/// <summary>
+/// Traced EcDoAsyncConnectEx, as specified in MS-OXCRPC section 3.1.4.15.
+/// </summary>
+extern "C" long __stdcall TracedEcDoAsyncConnectEx(CXH cxh, ACXH *pacxh)
+{
+    long status = 0;
+    unsigned long exceptionCode = 0;
+    STUB_TRACE_CALL trace;
+    RPC_CAPTURE_CALL capture;
+
+    StubTraceBegin(&trace, STUB_TRACE_EMSMDB, 14, cxh, 0);
+    RpcCaptureBegin(&capture, RPC_CAPTURE_ASYNC_CONNECT, cxh, 0, NULL, 0);
+    RpcTryExcept
+    {
+        status = EcDoAsyncConnectEx(cxh, pacxh);
+    }
+    RpcExcept(RpcExceptionFilter(RpcExceptionCode()))
+    {
+        exceptionCode = RpcExceptionCode();
+    }
+    RpcEndExcept
+
+    if (exceptionCode != 0)
+    {
+        RaiseFault(&trace, &capture, exceptionCode);
+    }
+
+    StubTraceEnd(&trace, status, NULL, NULL, 0, 0);
+    RpcCaptureAsyncConnect(&capture, status, pacxh != NULL ? *pacxh : NULL);
+    return status;
+}
+
+/// <summary>
+/// Traced EcDoAsyncWaitEx, as specified in MS-OXCRPC section 3.3.4.1. Only the start of the call is traced; its
+/// completion is seen by RpcAsyncCompleteCall, and EcDoAsyncWaitExWrap captures the call up to it.
+/// </summary>
+extern "C" void __stdcall TracedEcDoAsyncWaitEx(PRPC_ASYNC_STATE EcDoAsyncWaitEx_AsyncHandle, ACXH acxh, unsigned long ulFlagsIn, unsigned long *pulFlagsOut)
+{
+    unsigned long exceptionCode = 0;
+    STUB_TRACE_CALL trace;
+
+    StubTraceBegin(&trace, STUB_TRACE_ASYNCEMSMDB, 0, acxh, 0);
+    RpcTryExcept
+    {
+        EcDoAsyncWaitEx(EcDoAsyncWaitEx_AsyncHandle, acxh, ulFlagsIn, pulFlagsOut);
+    }
+    RpcExcept(RpcExceptionFilter(RpcExceptionCode()))
+    {
+        exceptionCode = RpcExceptionCode();
+    }
+    RpcEndExcept
+
+    if (exceptionCode != 0)
+    {
+        RaiseFault(&trace, NULL, exceptionCode);
+    }
+
+    StubTraceAsync(&trace);
+}
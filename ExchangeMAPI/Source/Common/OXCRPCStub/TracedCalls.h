@@ -0,0 +1,69 @@
+#pragma once
+
+#include "MS-OXCRPC.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+long __stdcall TracedEcDoDisconnect(CXH *pcxh);
+
+long __stdcall TracedEcRRegisterPushNotification(
+    CXH *pcxh,
+    unsigned long iRpc,
+    unsigned char rgbContext[],
+    unsigned short cbContext,
+    unsigned long grbitAdviseBits,
+    unsigned char rgbCallbackAddress[],
+    unsigned short cbCallbackAddress,
+    unsigned long *hNotification);
+
+long __stdcall TracedEcDummyRpc(handle_t hBinding);
+
+long __stdcall TracedEcDoConnectEx(
+    handle_t hBinding,
+    CXH *pcxh,
+    unsigned char *szUserDN,
+    unsigned long ulFlags,
+    unsigned long ulConMod,
+    unsigned long cbLimit,
+    unsigned long ulCpid,
+    unsigned long ulLcidString,
+    unsigned long ulLcidSort,
+    unsigned long ulIcxrLink,
+    unsigned short usFCanConvertCodePages,
+    unsigned long *pcmsPollsMax,
+    unsigned long *pcRetry,
+    unsigned long *pcmsRetryDelay,
+    unsigned short *picxr,
+    unsigned char **szDNPrefix,
+    unsigned char **szDisplayName,
+    unsigned short rgwClientVersion[3],
+    unsigned short rgwServerVersion[3],
+    unsigned short rgwBestVersion[3],
+    unsigned long *pulTimeStamp,
+    unsigned char rgbAuxIn[],
+    unsigned long cbAuxIn,
+    unsigned char rgbAuxOut[],
+    SMALL_RANGE_ULONG *pcbAuxOut);
+
+long __stdcall TracedEcDoRpcExt2(
+    CXH *pcxh,
+    unsigned long *pulFlags,
+    unsigned char rgbIn[],
+    unsigned long cbIn,
+    unsigned char rgbOut[],
+    BIG_RANGE_ULONG *pcbOut,
+    unsigned char rgbAuxIn[],
+    unsigned long cbAuxIn,
+    unsigned char rgbAuxOut[],
+    SMALL_RANGE_ULONG *pcbAuxOut,
+    unsigned long *pulTransTime);
+
+long __stdcall TracedEcDoAsyncConnectEx(CXH cxh, ACXH *pacxh);
+
+void __stdcall TracedEcDoAsyncWaitEx(PRPC_ASYNC_STATE EcDoAsyncWaitEx_AsyncHandle, ACXH acxh, unsigned long ulFlagsIn, unsigned long *pulFlagsOut);
+
+#ifdef __cplusplus
+}
+#endif
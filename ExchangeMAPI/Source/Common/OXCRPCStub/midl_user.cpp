@@ -2,22 +2,51 @@
 #include "winsock2.h"
 #include "winsock.h"
 #include "MS-OXCRPC.h"
+#include "TracedCalls.h"
+#include "RpcCapture.h"
+#include "StubMetrics.h"
+#include "RpcException.h"
 #pragma   comment(lib,"ws2_32.lib")
 #include <fstream>
+#include <map>
+#include <string>
 #include <tchar.h>
  
 void* __RPC_USER midl_user_allocate(size_t size);
 void __RPC_USER midl_user_free(void* p);
 
 static unsigned long inline Hash(const char *str);
-unsigned long inline HandleException(RPC_STATUS status);
 
 static RPC_BINDING_HANDLE m_hBind=NULL;
 static CXH m_cxh=NULL;
 static SEC_WINNT_AUTH_IDENTITY * m_swai=new SEC_WINNT_AUTH_IDENTITY;
 static RPC_SECURITY_QOS_V2_W m_Qos;
 
-unsigned long __stdcall Connect(CXH *pcxh,const char * szUserDN)
+/// <summary>
+/// The session context link information returned by a successful EcDoConnectEx call.
+/// </summary>
+struct SessionLinkInfo
+{
+	unsigned short iCxr;
+	unsigned long ulTimeStamp;
+};
+
+/// <summary>
+/// The last session context link information of each user DN, used by ConnectLinked.
+/// </summary>
+static std::map<std::string, SessionLinkInfo> m_sessionLinks;
+static SRWLOCK m_sessionLinksLock = SRWLOCK_INIT;
+
+/// <summary>
+/// Call EcDoConnectEx on the current binding.
+/// </summary>
+/// <param name="pcxh">Receives the CXH of the new session context.</param>
+/// <param name="szUserDN">The DN of the user who is calling EcDoConnectEx.</param>
+/// <param name="ulIcxrLink">0xFFFFFFFF, or the session context index of an existing session context to link to.</param>
+/// <param name="pulTimeStamp">On input, 0 or the timestamp returned with the linked session context. On output, the timestamp of the session context.</param>
+/// <param name="piCxr">Receives the session context index of the session context.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+static unsigned long ConnectInternal(CXH *pcxh, const char * szUserDN, unsigned long ulIcxrLink, unsigned long *pulTimeStamp, unsigned short *piCxr)
 {
 	unsigned long status = 0;
 	unsigned long ulFlags = 0x00000000;
@@ -26,7 +55,6 @@ unsigned long __stdcall Connect(CXH *pcxh,const char * szUserDN)
 	unsigned long ulCpid = 0x000004E4; 
 	unsigned long ulLcidString = 0x00000409; 
 	unsigned long ulLcidSort = 0x00000409; 
-	unsigned long ulIcxrLink = 0xFFFFFFFF;
 	unsigned short usFCanConvertCodePages = 0x01;
 
 	unsigned long cmsPollsMax = 0;
@@ -48,8 +76,6 @@ unsigned long __stdcall Connect(CXH *pcxh,const char * szUserDN)
 	memset(rgwServerVersion, 0, sizeof(rgwServerVersion));
 	memset(rgwBestVersion, 0, sizeof(rgwBestVersion));
 
-	unsigned long ulTimeStamp = 0;
-
 	unsigned char * pbAuxIn = NULL;
 	unsigned long cbAuxIn = 0;
 
@@ -61,7 +87,7 @@ unsigned long __stdcall Connect(CXH *pcxh,const char * szUserDN)
 	RpcTryExcept 
 	{
 	
-		status = EcDoConnectEx(
+		status = TracedEcDoConnectEx(
 			m_hBind,		//[in]
 			pcxh,		//[out]
 			(unsigned char*)szUserDN, //[in]
@@ -82,7 +108,7 @@ unsigned long __stdcall Connect(CXH *pcxh,const char * szUserDN)
 			rgwClientVersion,//[in]
 			rgwServerVersion,//[out]
 			rgwBestVersion,	//[out]
-			&ulTimeStamp,	//[in,out]
+			pulTimeStamp,	//[in,out]
 			pbAuxIn,	//[in]
 			cbAuxIn,	//[in]
 			rgbAuxOut,	//[out]
@@ -96,9 +122,119 @@ unsigned long __stdcall Connect(CXH *pcxh,const char * szUserDN)
 	} 
 	RpcEndExcept;
 
+	*piCxr = iCxr;
 	return status;
 }  
 
+/// <summary>
+/// Remember the session context link information of a user DN after a successful EcDoConnectEx call.
+/// </summary>
+static void SaveSessionLink(const char * szUserDN, unsigned short iCxr, unsigned long ulTimeStamp)
+{
+	SessionLinkInfo link;
+	link.iCxr = iCxr;
+	link.ulTimeStamp = ulTimeStamp;
+
+	AcquireSRWLockExclusive(&m_sessionLinksLock);
+	m_sessionLinks[szUserDN] = link;
+	ReleaseSRWLockExclusive(&m_sessionLinksLock);
+}
+
+unsigned long __stdcall Connect(CXH *pcxh,const char * szUserDN)
+{
+	unsigned long ulTimeStamp = 0;
+	unsigned short iCxr = 0;
+	unsigned long status = ConnectInternal(pcxh, szUserDN, 0xFFFFFFFF, &ulTimeStamp, &iCxr);
+	if (status == 0 && szUserDN != NULL)
+	{
+		SaveSessionLink(szUserDN, iCxr, ulTimeStamp);
+	}
+
+	return status;
+}
+
+/// <summary>
+/// Create a session context that is linked to the last session context of the same user DN, as specified for the
+/// ulIcxrLink and pulTimeStamp parameters in MS-OXCRPC section 3.1.4.1. After a transient binding failure this attaches
+/// to the existing server session context in one round trip, so the caller does not have to repeat its logon sequence.
+/// If no earlier session context of the user DN is known, it behaves like Connect.
+/// If the server rejects the cached link, for example because the session context expired or the server restarted,
+/// the link is forgotten and the call falls back to Connect. Every failure of the linked call is treated as a
+/// rejection except RPC_S_SERVER_UNAVAILABLE and RPC_S_SERVER_TOO_BUSY, which mean the server was not reached; these
+/// are returned and the link is kept for the next attempt.
+/// </summary>
+/// <param name="pcxh">Receives the CXH of the new session context.</param>
+/// <param name="szUserDN">The DN of the user who is calling EcDoConnectEx.</param>
+/// <param name="linked">Receives TRUE if the new session context is linked to the cached one, FALSE otherwise.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+unsigned long __stdcall ConnectLinked(CXH *pcxh, const char * szUserDN, BOOL *linked)
+{
+	SessionLinkInfo link;
+	BOOL found = FALSE;
+	if (szUserDN != NULL)
+	{
+		AcquireSRWLockShared(&m_sessionLinksLock);
+		std::map<std::string, SessionLinkInfo>::iterator it = m_sessionLinks.find(szUserDN);
+		if (it != m_sessionLinks.end())
+		{
+			link = it->second;
+			found = TRUE;
+		}
+		ReleaseSRWLockShared(&m_sessionLinksLock);
+	}
+
+	if (linked != NULL)
+	{
+		*linked = found;
+	}
+
+	if (!found)
+	{
+		return Connect(pcxh, szUserDN);
+	}
+
+	unsigned long ulTimeStamp = link.ulTimeStamp;
+	unsigned short iCxr = 0;
+	unsigned long status = ConnectInternal(pcxh, szUserDN, link.iCxr, &ulTimeStamp, &iCxr);
+	if (status == 0)
+	{
+		SaveSessionLink(szUserDN, iCxr, ulTimeStamp);
+	}
+	else if (status != RPC_S_SERVER_UNAVAILABLE && status != RPC_S_SERVER_TOO_BUSY)
+	{
+		// The server rejected the link; a later linked call would fail the same way.
+		AcquireSRWLockExclusive(&m_sessionLinksLock);
+		m_sessionLinks.erase(szUserDN);
+		ReleaseSRWLockExclusive(&m_sessionLinksLock);
+		if (linked != NULL)
+		{
+			*linked = FALSE;
+		}
+
+		status = Connect(pcxh, szUserDN);
+	}
+
+	return status;
+}
+
+/// <summary>
+/// Forget the cached session context link information, for one user DN or for all of them.
+/// </summary>
+/// <param name="szUserDN">The user DN to forget, or NULL to forget all user DNs.</param>
+void __stdcall ClearSessionLinks(const char * szUserDN)
+{
+	AcquireSRWLockExclusive(&m_sessionLinksLock);
+	if (szUserDN == NULL)
+	{
+		m_sessionLinks.clear();
+	}
+	else
+	{
+		m_sessionLinks.erase(szUserDN);
+	}
+	ReleaseSRWLockExclusive(&m_sessionLinksLock);
+}
+
 unsigned long __stdcall BindToServer(const char * server, int encryptionMethod, int authenticationServices, const char *seqType, bool rpchUseSsl, const char *rpchAuthScheme, const char *spnStr, const char *options, bool setUuid)
 {
 	unsigned long status = 0;
@@ -202,6 +338,7 @@ unsigned long __stdcall BindToServer(const char * server, int encryptionMethod,
 			
 		    if (status == 0)
 		    {
+			    StubMetricsBindingHandle(1);
 			    status = RpcEpResolveBinding(m_hBind, emsmdb_v0_81_c_ifspec);
 			    if (status == 0)
 			    {
@@ -299,12 +436,23 @@ handle_t __stdcall GetBindHandle( )
 // Memory allocation function for RPC.
 void* __RPC_USER midl_user_allocate(size_t size)
 {
-    return malloc(size);
+    void *p = malloc(size);
+    if (p != NULL)
+    {
+        StubMetricsAllocate(size);
+    }
+
+    return p;
 }
 
 // Memory deallocation function for RPC.
 void __RPC_USER midl_user_free(void* p)
 {
+    if (p != NULL)
+    {
+        StubMetricsFree();
+    }
+
     free(p);
 }
 
@@ -333,7 +481,13 @@ static unsigned long inline Hash(const char *str)
 	return (1103515243 * value +12345);
 }
 
-unsigned long inline HandleException(RPC_STATUS status)
+/// <summary>
+/// The RPC exception filter of the stub: it handles RPC errors and lets exceptions with the severity bits of a fatal
+/// system error, such as access violations, pass on.
+/// </summary>
+/// <param name="status">The exception code.</param>
+/// <returns>EXCEPTION_CONTINUE_SEARCH or EXCEPTION_EXECUTE_HANDLER.</returns>
+unsigned long HandleException(RPC_STATUS status)
 {
 	if ((status & 0xc0000000) == 0xc0000000)
 		return EXCEPTION_CONTINUE_SEARCH;
@@ -364,6 +518,10 @@ long  __stdcall EcDoAsyncWaitExWrap(
     RPC_STATUS status;
     long reply = 0;
     unsigned int waitTime = 0;
+    RPC_CAPTURE_CALL capture;
+
+    // The call is captured from its start to its completion, which TracedEcDoAsyncWaitEx does not see.
+    RpcCaptureBegin(&capture, RPC_CAPTURE_WAIT, acxh, 0, NULL, 0);
 
     // Invoke RpcAsyncInitializeHandle function to initialize the RPC_ASYNC_STATE structure to be used to make an asynchronous call.
     status = RpcAsyncInitializeHandle(&async, sizeof(async));
@@ -371,7 +529,7 @@ long  __stdcall EcDoAsyncWaitExWrap(
     {
         async.UserInfo = NULL;
         async.NotificationType = RpcNotificationTypeNone;
-        EcDoAsyncWaitEx(&async,acxh, ulFlagsIn, pulFlagsOut);
+        TracedEcDoAsyncWaitEx(&async,acxh, ulFlagsIn, pulFlagsOut);
 
         // Wait until the status of asynchronous remote procedure call is NOT RPC_S_ASYNC_CALL_PENDING or wait time reaches the wait second threshold.
         while(waitTime < waitSecondThreshold)
@@ -395,6 +553,8 @@ long  __stdcall EcDoAsyncWaitExWrap(
     {
         reply = 0x000fffff; // error code, indicates failure in RpcAsyncInitializeHandle
     }
+
+    RpcCaptureEnd(&capture, reply, pulFlagsOut != NULL ? *pulFlagsOut : 0);
     return reply;
 }
 
@@ -454,7 +614,7 @@ long  __stdcall EcRRegisterPushNotificationWrap(
     }
 
     // Invoke EcRRegisterPushNotification to register a callback address with the server for a Session Context.
-    status = EcRRegisterPushNotification(
+    status = TracedEcRRegisterPushNotification(
         pcxh,
         iRpc,
         rgbContext,
@@ -0,0 +1,72 @@
+#include "NspiRowSet.h"
+#include "NdrRowSet.h"
+
+// The NDR serialization of a PropertyRowSet_r, through the routines MIDL generates for NspiRowSet.idl. They run the
+// NDR engine of the RPC runtime on a fixed buffer, without a server, so the benchmarks time the marshalling the NSPI
+// client stub does for the rows of NspiQueryRows. NspiRowSet.h declares the NSPI types again, so this file is kept apart
+// from the files that include MS-OXNSPI.h; the two declarations of PropertyRowSet_r have the same layout.
+
+/// <summary>
+/// Serialize a rowset as NDR.
+/// </summary>
+/// <param name="rows">The rowset.</param>
+/// <param name="buffer">The buffer that receives the serialized rowset. It MUST be aligned on 8 bytes.</param>
+/// <param name="bufferSize">The size of buffer.</param>
+/// <param name="encodedSize">Receives the size of the serialized rowset.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long NdrEncodeRowSet(PropertyRowSet_r *rows, unsigned char *buffer, unsigned long bufferSize, unsigned long *encodedSize)
+{
+    handle_t handle = NULL;
+    long status = MesEncodeFixedBufferHandleCreate((char *)buffer, bufferSize, encodedSize, &handle);
+    if (status != RPC_S_OK)
+    {
+        return status;
+    }
+
+    PropertyRowSetPickle_r pickle = { rows };
+    RpcTryExcept
+    {
+        PropertyRowSetPickle_r_Encode(handle, &pickle);
+    }
+    RpcExcept(EXCEPTION_EXECUTE_HANDLER)
+    {
+        status = RpcExceptionCode();
+    }
+    RpcEndExcept
+
+    MesHandleFree(handle);
+    return status;
+}
+
+/// <summary>
+/// Deserialize a rowset serialized by NdrEncodeRowSet, and free it.
+/// </summary>
+/// <param name="buffer">The serialized rowset. It MUST be aligned on 8 bytes.</param>
+/// <param name="size">The size of the serialized rowset.</param>
+/// <param name="rowCount">Receives the number of rows of the rowset.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+long NdrDecodeRowSet(const unsigned char *buffer, unsigned long size, unsigned long *rowCount)
+{
+    handle_t handle = NULL;
+    long status = MesDecodeBufferHandleCreate((char *)buffer, size, &handle);
+    if (status != RPC_S_OK)
+    {
+        return status;
+    }
+
+    PropertyRowSetPickle_r pickle = { NULL };
+    RpcTryExcept
+    {
+        PropertyRowSetPickle_r_Decode(handle, &pickle);
+        *rowCount = pickle.lpRows != NULL ? pickle.lpRows->cRows : 0;
+        PropertyRowSetPickle_r_Free(handle, &pickle);
+    }
+    RpcExcept(EXCEPTION_EXECUTE_HANDLER)
+    {
+        status = RpcExceptionCode();
+    }
+    RpcEndExcept
+
+    MesHandleFree(handle);
+    return status;
+}
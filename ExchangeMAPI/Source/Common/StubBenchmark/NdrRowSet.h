@@ -0,0 +1,7 @@
+#pragma once
+
+struct _PropertyRowSet_r;
+
+long NdrEncodeRowSet(_PropertyRowSet_r *rows, unsigned char *buffer, unsigned long bufferSize, unsigned long *encodedSize);
+
+long NdrDecodeRowSet(const unsigned char *buffer, unsigned long size, unsigned long *rowCount);
@@ -0,0 +1,1557 @@
+#include "../OXCRPCStub/RpcHeaderExt.h"
+#include "../OXCRPCStub/Lz77Direct2.h"
+#include "../OXCRPCStub/RopCodec.h"
+#include "../OXCRPCStub/PropertyRowDecoder.h"
+#include "../OXCRPCStub/FastTransferLexer.h"
+#include "../OXCRPCStub/RangeSet.h"
+#include "../OXCRPCStub/RpcCapture.h"
+#ifdef STUB_BENCHMARK_NSPI
+#include "../NSPIStub/NspiMapiHttpCodec.h"
+#include "NdrRowSet.h"
+#endif
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Microbenchmarks of the codecs the stubs run on every call: packing and expanding RPC_HEADER_EXT chains, LZ77 and
+// XorMagic, walking a chain, encoding an EcDoRpcExt2 request, decoding PropertyRow blocks of RopQueryRows and the
+// PropertyRowSet_r of an NspiQueryRows response, lexing FastTransfer streams and encoding and decoding IDSETs and
+// GLOBSETs. The RPC buffers come from capture files written by RpcCaptureStart and the FastTransfer streams from files
+// saved by FxDownloadToFile, so the numbers reflect real mailboxes; without them, generated data of the same shape is
+// used. The NDR marshalling of the NSPI rows is timed apart, through the MIDL type serialization of NspiRowSet.idl,
+// which runs the NDR engine of the RPC runtime on a buffer without a server.
+//
+// A benchmark runs its whole corpus once per pass. It first runs one pass to check the codec succeeds, then finds the
+// number of passes that takes at least the minimum sample time, and takes the samples. The results are the time per
+// item, the lowest, the median, the 90th percentile and the highest over the samples, and the throughput at the
+// median; they are printed as a table, as CSV or as JSON, to compare builds.
+//
+// The codecs read and write the wire through fixed-width types, so the benchmarks of RPC_HEADER_EXT, LZ77 and XorMagic,
+// the ROP layouts, the RopQueryRows rows, the FastTransfer lexer and the IDSETs and GLOBSETs build on any platform:
+//
+//     g++ -std=c++14 -O2 -msse2 -o StubBenchmark StubBenchmark.cpp ../OXCRPCStub/RpcHeaderExt.cpp
+//         ../OXCRPCStub/Lz77Direct2.cpp ../OXCRPCStub/RopCodec.cpp ../OXCRPCStub/PropertyRowDecoder.cpp
+//         ../OXCRPCStub/FastTransferLexer.cpp ../OXCRPCStub/RangeSet.cpp
+//
+// The NSPI benchmarks decode into the MIDL types of MS-OXNSPI.idl and run the NDR engine, so they are built only with
+// STUB_BENCHMARK_NSPI, which the Windows project defines.
+//
+// Usage: StubBenchmark [/capture <file>] [/fx <file>] [/filter <text>] [/samples <n>] [/mintime <ms>] [/csv | /json] [/list]
+
+/// <summary>
+/// The number of samples of a benchmark, and the shortest time of a sample in milliseconds, if the caller does not
+/// give them.
+/// </summary>
+static const unsigned long DefaultSamples = 15;
+static const unsigned long DefaultMinimumTime = 20;
+
+/// <summary>
+/// The size of the TransferBuffer the FastTransfer streams are fed to the lexer in, as a server returns them.
+/// </summary>
+static const unsigned long TransferBufferSize = 0x7C00;
+
+/// <summary>
+/// The rows of a generated RopQueryRows or NspiQueryRows response.
+/// </summary>
+static const unsigned long RowsPerBlock = 100;
+
+/// <summary>
+/// The inputs of the benchmarks.
+/// </summary>
+struct Corpus
+{
+    std::string RpcSource;                              // Where the RPC buffers come from.
+    std::string FxSource;                               // Where the FastTransfer streams come from.
+    std::vector<std::vector<unsigned char> > Packed;    // RPC_HEADER_EXT chains as sent or received.
+    std::vector<std::vector<unsigned char> > Plain;     // The same chains, expanded.
+    std::vector<std::vector<unsigned char> > Payloads;  // The payloads of the expanded buffers.
+    std::vector<std::vector<unsigned char> > Compressed;    // The payloads, compressed by Lz77Direct2Compress.
+    std::vector<std::vector<unsigned char> > RopRows;   // The row data of RopQueryRows responses.
+#ifdef STUB_BENCHMARK_NSPI
+    std::vector<std::vector<unsigned char> > NspiRows;  // NspiQueryRows response bodies.
+    std::vector<PropertyRowSet_r *> NspiRowSets;        // The rows of NspiRows, decoded.
+    std::vector<std::vector<unsigned char> > NspiNdr;   // NspiRowSets, serialized as NDR.
+#endif
+    std::vector<std::vector<unsigned char> > FxStreams;
+    std::vector<std::vector<unsigned __int64> > Ids;    // The MIDs of a folder, in ascending order, one list per replica.
+    std::vector<unsigned char> IdSet;                   // The IDSET of Ids, keyed by REPLID.
+    std::vector<unsigned char> Globset;                 // The GLOBSET of the first list of Ids.
+};
+
+/// <summary>
+/// The result of a benchmark.
+/// </summary>
+struct BenchmarkResult
+{
+    std::string Name;
+    std::string Source;
+    long Status;                                        // 0, or the error of the codec in the checking pass.
+    unsigned __int64 Items;                             // The items of one pass: buffers, rows, streams or sets.
+    unsigned __int64 Bytes;                             // The bytes of one pass.
+    unsigned __int64 Passes;                            // The passes of one sample.
+    std::vector<double> Nanoseconds;                    // The time per item of each sample, in ascending order.
+};
+
+/// <summary>
+/// A benchmark: the routine that runs one pass, and what a pass covers.
+/// </summary>
+struct Benchmark
+{
+    const char *Name;
+    const std::string *Source;
+    unsigned __int64 Items;
+    unsigned __int64 Bytes;
+    std::function<long()> Pass;
+};
+
+/// <summary>
+/// A deterministic generator, so that two runs measure the same data.
+/// </summary>
+class Random
+{
+public:
+    explicit Random(unsigned __int64 seed) : state(seed)
+    {
+    }
+
+    unsigned long Next(unsigned long bound)
+    {
+        this->state ^= this->state << 13;
+        this->state ^= this->state >> 7;
+        this->state ^= this->state << 17;
+        return (unsigned long)(this->state % bound);
+    }
+
+private:
+    unsigned __int64 state;
+};
+
+static const char *Words[] =
+{
+    "project", "review", "meeting", "budget", "quarterly", "report", "update", "draft", "contoso", "fabrikam",
+    "schedule", "release", "planning", "notes", "follow", "up", "action", "items", "status", "team",
+    "design", "proposal", "invoice", "travel", "approval", "request", "weekly", "sync", "customer", "feedback"
+};
+
+static const char *Names[] =
+{
+    "Alex", "Sam", "Jordan", "Taylor", "Morgan", "Casey", "Riley", "Jamie", "Avery", "Quinn",
+    "Wilson", "Garcia", "Chen", "Patel", "Kim", "Nguyen", "Smith", "Lopez", "Brown", "Davis"
+};
+
+static void PutUShort(std::vector<unsigned char> &out, unsigned short value)
+{
+    out.push_back((unsigned char)value);
+    out.push_back((unsigned char)(value >> 8));
+}
+
+static void PutULong(std::vector<unsigned char> &out, unsigned long value)
+{
+    PutUShort(out, (unsigned short)value);
+    PutUShort(out, (unsigned short)(value >> 16));
+}
+
+static void PutULongLong(std::vector<unsigned char> &out, unsigned __int64 value)
+{
+    PutULong(out, (unsigned long)value);
+    PutULong(out, (unsigned long)(value >> 32));
+}
+
+static void PutBytes(std::vector<unsigned char> &out, Random &random, unsigned long count)
+{
+    for (unsigned long i = 0; i < count; i++)
+    {
+        out.push_back((unsigned char)random.Next(256));
+    }
+}
+
+/// <summary>
+/// Append a UTF-16LE string with its terminating null.
+/// </summary>
+static void PutWideString(std::vector<unsigned char> &out, const std::string &text)
+{
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        PutUShort(out, (unsigned char)text[i]);
+    }
+
+    PutUShort(out, 0);
+}
+
+/// <summary>
+/// Make a sentence of words, as a subject or a body is.
+/// </summary>
+static std::string MakeText(Random &random, unsigned long words)
+{
+    std::string text;
+    for (unsigned long i = 0; i < words; i++)
+    {
+        if (i != 0)
+        {
+            text += (i % 12 == 0) ? ". " : " ";
+        }
+
+        text += Words[random.Next(sizeof(Words) / sizeof(Words[0]))];
+    }
+
+    return text;
+}
+
+static std::string MakeName(Random &random)
+{
+    return std::string(Names[random.Next(10)]) + " " + Names[10 + random.Next(10)];
+}
+
+static std::string MakeAddress(const std::string &name)
+{
+    std::string address;
+    for (size_t i = 0; i < name.size(); i++)
+    {
+        address += name[i] == ' ' ? '.' : (char)tolower((unsigned char)name[i]);
+    }
+
+    return address + "@contoso.com";
+}
+
+/// <summary>
+/// The columns of the generated rows of a contents table.
+/// </summary>
+static const unsigned long RopColumns[] =
+{
+    0x674A0014,     // PidTagMid
+    0x0037001F,     // PidTagSubject
+    0x0C1A001F,     // PidTagSenderName
+    0x0E060040,     // PidTagMessageDeliveryTime
+    0x0E080003,     // PidTagMessageSize
+    0x0E070003,     // PidTagMessageFlags
+    0x0E1B000B,     // PidTagHasAttachments
+    0x65E00102      // PidTagSourceKey
+};
+
+/// <summary>
+/// Generate the row data of a RopQueryRows response, as specified in MS-OXCDATA section 2.8.1. One row in ten is a
+/// FlaggedPropertyRow whose sender is an error.
+/// </summary>
+static std::vector<unsigned char> MakeRopRows(Random &random, unsigned __int64 firstMid)
+{
+    std::vector<unsigned char> out;
+    for (unsigned long row = 0; row < RowsPerBlock; row++)
+    {
+        bool flagged = random.Next(10) == 0;
+        out.push_back(flagged ? 0x01 : 0x00);
+        for (size_t column = 0; column < sizeof(RopColumns) / sizeof(RopColumns[0]); column++)
+        {
+            if (flagged)
+            {
+                if (RopColumns[column] == 0x0C1A001F)
+                {
+                    out.push_back(0x0A);
+                    PutULong(out, 0x8004010F);
+                    continue;
+                }
+
+                out.push_back(0x00);
+            }
+
+            switch (RopColumns[column] & 0xFFFF)
+            {
+            case 0x0014:
+                PutULongLong(out, ((firstMid + row) << 16) | 1);
+                break;
+            case 0x001F:
+                PutWideString(out, RopColumns[column] == 0x0037001F ? MakeText(random, 3 + random.Next(6)) : MakeName(random));
+                break;
+            case 0x0040:
+                PutULongLong(out, 0x01D9000000000000ULL + random.Next(0x7FFFFFFF));
+                break;
+            case 0x0003:
+                PutULong(out, random.Next(200000));
+                break;
+            case 0x000B:
+                out.push_back((unsigned char)random.Next(2));
+                break;
+            case 0x0102:
+                PutUShort(out, 22);
+                PutBytes(out, random, 22);
+                break;
+            }
+        }
+    }
+
+    return out;
+}
+
+#ifdef STUB_BENCHMARK_NSPI
+/// <summary>
+/// The columns of the generated rows of an address book.
+/// </summary>
+static const unsigned long NspiColumns[] =
+{
+    0x0FFF0102,     // PidTagEntryId
+    0x3001001F,     // PidTagDisplayName
+    0x39FE001F,     // PidTagSmtpAddress
+    0x0FFE0003,     // PidTagObjectType
+    0x39000003,     // PidTagDisplayType
+    0x0FF60102,     // PidTagInstanceKey
+    0x3A06001F      // PidTagGivenName
+};
+
+/// <summary>
+/// Generate the body of an NspiQueryRows response, as specified in MS-OXCMAPIHTTP section 2.2.5.11.
+/// </summary>
+static std::vector<unsigned char> MakeNspiRows(Random &random, unsigned long firstRow)
+{
+    std::vector<unsigned char> out;
+    PutULong(out, 0);                                   // StatusCode
+    PutULong(out, 0);                                   // ErrorCode
+    out.push_back(0xFF);                                // HasState
+    for (int i = 0; i < 9; i++)
+    {
+        PutULong(out, i == 2 ? firstRow + RowsPerBlock : 0);
+    }
+
+    out.push_back(0xFF);                                // HasColumnsAndRows
+    PutULong(out, sizeof(NspiColumns) / sizeof(NspiColumns[0]));
+    for (size_t column = 0; column < sizeof(NspiColumns) / sizeof(NspiColumns[0]); column++)
+    {
+        PutULong(out, NspiColumns[column]);
+    }
+
+    PutULong(out, RowsPerBlock);
+    for (unsigned long row = 0; row < RowsPerBlock; row++)
+    {
+        std::string name = MakeName(random);
+        out.push_back(0x00);                            // A plain AddressBookPropertyRow.
+        out.push_back(0xFF);                            // PidTagEntryId: a permanent entry ID with a DN.
+        std::string dn = "/o=Contoso/ou=Exchange Administrative Group/cn=Recipients/cn=" + MakeAddress(name);
+        PutULong(out, (unsigned long)(28 + dn.size() + 1));
+        PutBytes(out, random, 28);
+        out.insert(out.end(), dn.begin(), dn.end());
+        out.push_back(0);
+        out.push_back(0xFF);
+        PutWideString(out, name);
+        out.push_back(0xFF);
+        PutWideString(out, MakeAddress(name));
+        PutULong(out, 6);
+        PutULong(out, 0);
+        out.push_back(0xFF);
+        PutULong(out, 4);
+        PutULong(out, firstRow + row);
+        out.push_back(0xFF);
+        PutWideString(out, name.substr(0, name.find(' ')));
+    }
+
+    PutULong(out, 0);                                   // AuxiliaryBufferSize
+    return out;
+}
+#endif
+
+/// <summary>
+/// Generate an incremental change stream of messages, as specified in MS-OXCFXICS section 2.2.4.3: a change header,
+/// the properties of each message with a named property, a body, recipients and sometimes an attachment.
+/// </summary>
+static std::vector<unsigned char> MakeFxStream(Random &random, unsigned long messages)
+{
+    static const unsigned char PublicStrings[16] =
+    {
+        0x29, 0x03, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0xC0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x46
+    };
+
+    std::vector<unsigned char> out;
+    for (unsigned long message = 0; message < messages; message++)
+    {
+        std::string subject = MakeText(random, 3 + random.Next(6));
+        std::string body = MakeText(random, 100 + random.Next(1000));
+        PutULong(out, 0x40120003);                      // IncrSyncChg
+        PutULong(out, 0x65E00102);                      // PidTagSourceKey
+        PutULong(out, 22);
+        PutBytes(out, random, 22);
+        PutULong(out, 0x30080040);                      // PidTagLastModificationTime
+        PutULongLong(out, 0x01D9000000000000ULL + random.Next(0x7FFFFFFF));
+        PutULong(out, 0x65E20102);                      // PidTagChangeKey
+        PutULong(out, 22);
+        PutBytes(out, random, 22);
+        PutULong(out, 0x674A0014);                      // PidTagMid
+        PutULongLong(out, ((unsigned __int64)(message + 1) << 16) | 1);
+        PutULong(out, 0x40150003);                      // IncrSyncMessage
+        PutULong(out, 0x0037001F);                      // PidTagSubject
+        PutULong(out, (unsigned long)(subject.size() + 1) * 2);
+        PutWideString(out, subject);
+        PutULong(out, 0x0E070003);                      // PidTagMessageFlags
+        PutULong(out, random.Next(16));
+        PutULong(out, 0x8001000B);                      // A named boolean property of PS_PUBLIC_STRINGS.
+        out.insert(out.end(), PublicStrings, PublicStrings + 16);
+        out.push_back(0x01);
+        PutWideString(out, "Reviewed");
+        PutUShort(out, 1);
+        PutULong(out, 0x1000001F);                      // PidTagBody
+        PutULong(out, (unsigned long)(body.size() + 1) * 2);
+        PutWideString(out, body);
+        PutULong(out, 0x0E04101F);                      // A multi-valued string.
+        PutULong(out, 2);
+        PutULong(out, 2 * 7);
+        PutWideString(out, "Review");
+        PutULong(out, 2 * 6);
+        PutWideString(out, "Sales");
+        unsigned long recipients = 1 + random.Next(4);
+        for (unsigned long recipient = 0; recipient < recipients; recipient++)
+        {
+            std::string name = MakeName(random);
+            PutULong(out, 0x40030003);                  // StartRecip
+            PutULong(out, 0x0C150003);                  // PidTagRecipientType
+            PutULong(out, 1);
+            PutULong(out, 0x3001001F);                  // PidTagDisplayName
+            PutULong(out, (unsigned long)(name.size() + 1) * 2);
+            PutWideString(out, name);
+            PutULong(out, 0x39FE001F);                  // PidTagSmtpAddress
+            PutULong(out, (unsigned long)(MakeAddress(name).size() + 1) * 2);
+            PutWideString(out, MakeAddress(name));
+            PutULong(out, 0x40040003);                  // EndToRecip
+        }
+
+        if (random.Next(4) == 0)
+        {
+            unsigned long size = 1024 + random.Next(64 * 1024);
+            PutULong(out, 0x40000003);                  // NewAttach
+            PutULong(out, 0x0E210003);                  // PidTagAttachNumber
+            PutULong(out, 0);
+            PutULong(out, 0x37010102);                  // PidTagAttachDataBinary
+            PutULong(out, size);
+            PutBytes(out, random, size);
+            PutULong(out, 0x400E0003);                  // EndAttach
+        }
+    }
+
+    PutULong(out, 0x403A0003);                          // IncrSyncStateBegin
+    PutULong(out, 0x67960102);                          // MetaTagCnsetSeen
+    PutULong(out, 0);
+    PutULong(out, 0x403B0003);                          // IncrSyncStateEnd
+    PutULong(out, 0x40140003);                          // IncrSyncEnd
+    return out;
+}
+
+/// <summary>
+/// Generate the MIDs of a folder: long runs of consecutive messages, with the gaps that deletions leave.
+/// </summary>
+static std::vector<unsigned __int64> MakeIds(Random &random, unsigned long count)
+{
+    std::vector<unsigned __int64> ids;
+    unsigned __int64 globcnt = 0x10000 + random.Next(0x10000);
+    while (ids.size() < count)
+    {
+        unsigned long run = 1 + random.Next(random.Next(8) == 0 ? 2 : 200);
+        for (unsigned long i = 0; i < run && ids.size() < count; i++, globcnt++)
+        {
+            // A MID is the REPLID followed by the big-endian GLOBCNT, read as a little-endian 64-bit integer.
+            unsigned __int64 id = 1;
+            for (int b = 0; b < 6; b++)
+            {
+                id |= ((globcnt >> (8 * (5 - b))) & 0xFF) << (16 + 8 * b);
+            }
+
+            ids.push_back(id);
+        }
+
+        globcnt += 1 + random.Next(random.Next(4) == 0 ? 5000 : 20);
+    }
+
+    return ids;
+}
+
+/// <summary>
+/// Generate the request of an EcDoRpcExt2 call that reads a page of a contents table.
+/// </summary>
+static unsigned long MakeRequest(unsigned char *buffer, unsigned long capacity)
+{
+    RopCodec::RopRequestWriter writer(buffer, capacity);
+    writer.Append<RopCodec::SetColumns>((RopCodec::Byte)0, (RopCodec::Byte)1, (RopCodec::Byte)0, (RopCodec::UShort)(sizeof(RopColumns) / sizeof(RopColumns[0])));
+    writer.AppendULongs(RopColumns, sizeof(RopColumns) / sizeof(RopColumns[0]));
+    writer.Append<RopCodec::QueryRows>((RopCodec::Byte)0, (RopCodec::Byte)1, (RopCodec::Byte)0, (RopCodec::Byte)1, (RopCodec::UShort)RowsPerBlock);
+    writer.Append<RopCodec::QueryPosition>((RopCodec::Byte)0, (RopCodec::Byte)1);
+    unsigned long handles[2] = { 0x00000015, 0x0000002A };
+    return writer.Finish(handles, 2);
+}
+
+/// <summary>
+/// Read a whole file.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+static long ReadFileBytes(const char *path, std::vector<unsigned char> &data)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        return ERROR_FILE_NOT_FOUND;
+    }
+
+    unsigned char chunk[65536];
+    size_t read;
+    while ((read = fread(chunk, 1, sizeof(chunk), file)) > 0)
+    {
+        data.insert(data.end(), chunk, chunk + read);
+    }
+
+    bool failed = ferror(file) != 0;
+    fclose(file);
+    return failed ? ERROR_READ_FAULT : 0;
+}
+
+/// <summary>
+/// Add the rgbIn and rgbOut of the EcDoRpcExt2 calls of a capture file to the packed chains.
+/// </summary>
+/// <returns>If success, it returns 0. ERROR_BAD_FORMAT indicates the file is not a capture file.</returns>
+static long LoadCapture(const char *path, Corpus &corpus)
+{
+    std::vector<unsigned char> data;
+    long status = ReadFileBytes(path, data);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    RPC_CAPTURE_FILE_HEADER header;
+    if (data.size() < sizeof(header))
+    {
+        return ERROR_BAD_FORMAT;
+    }
+
+    memcpy(&header, &data[0], sizeof(header));
+    if (header.Signature != RPC_CAPTURE_SIGNATURE || header.Version != RPC_CAPTURE_VERSION || header.HeaderSize > data.size())
+    {
+        return ERROR_BAD_FORMAT;
+    }
+
+    size_t offset = header.HeaderSize;
+    while (data.size() - offset >= sizeof(RPC_CAPTURE_RECORD))
+    {
+        RPC_CAPTURE_RECORD record;
+        memcpy(&record, &data[offset], sizeof(record));
+        if (record.Size < sizeof(record) || record.Size > data.size() - offset
+            || (unsigned __int64)record.RequestSize + record.ResponseSize + record.AuxOutSize > record.Size - sizeof(record))
+        {
+            return ERROR_BAD_FORMAT;
+        }
+
+        const unsigned char *payload = &data[offset + sizeof(record)];
+        if (record.Kind == RPC_CAPTURE_EXECUTE && record.Status == 0 && (record.Attributes & RPC_CAPTURE_FAULT) == 0)
+        {
+            if (record.RequestSize >= sizeof(RPC_HEADER_EXT))
+            {
+                corpus.Packed.push_back(std::vector<unsigned char>(payload, payload + record.RequestSize));
+            }
+
+            if (record.ResponseSize >= sizeof(RPC_HEADER_EXT))
+            {
+                payload += record.RequestSize;
+                corpus.Packed.push_back(std::vector<unsigned char>(payload, payload + record.ResponseSize));
+            }
+        }
+
+        offset += record.Size;
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Derive the plain chains, the payloads and the compressed payloads from the packed chains. Chains that do not expand
+/// are left out.
+/// </summary>
+static void ExpandCorpus(Corpus &corpus)
+{
+    std::vector<std::vector<unsigned char> > packed;
+    for (size_t i = 0; i < corpus.Packed.size(); i++)
+    {
+        std::vector<unsigned char> input = corpus.Packed[i];
+        std::vector<unsigned char> plain(input.size() * 64 + 0x10000);
+        unsigned long size = 0;
+        if (ExpandRpcHeaderExtChain(&input[0], (unsigned long)input.size(), &plain[0], (unsigned long)plain.size(), &size) != 0)
+        {
+            continue;
+        }
+
+        plain.resize(size);
+        packed.push_back(corpus.Packed[i]);
+        for (unsigned long offset = 0; offset < size;)
+        {
+            RPC_HEADER_EXT_BUFFER buffer;
+            if (ParseRpcHeaderExt(&plain[0], size, offset, &buffer) != 0)
+            {
+                break;
+            }
+
+            if (buffer.Header.Size != 0)
+            {
+                corpus.Payloads.push_back(std::vector<unsigned char>(buffer.Payload, buffer.Payload + buffer.Header.Size));
+            }
+
+            offset += sizeof(RPC_HEADER_EXT) + buffer.Header.Size;
+            if ((buffer.Header.Flags & RHE_FLAG_LAST) != 0)
+            {
+                break;
+            }
+        }
+
+        corpus.Plain.push_back(plain);
+    }
+
+    corpus.Packed.swap(packed);
+    for (size_t i = 0; i < corpus.Payloads.size(); i++)
+    {
+        const std::vector<unsigned char> &payload = corpus.Payloads[i];
+        std::vector<unsigned char> compressed(payload.size() + payload.size() / 8 + 16);
+        unsigned long size = 0;
+        if (Lz77Direct2Compress(&payload[0], (unsigned long)payload.size(), &compressed[0], (unsigned long)compressed.size(), &size) == 0)
+        {
+            compressed.resize(size);
+            corpus.Compressed.push_back(compressed);
+        }
+    }
+}
+
+/// <summary>
+/// Generate the RPC buffers when no capture file is given: the requests and the responses of a client that pages
+/// through contents tables, packed as the server sends them.
+/// </summary>
+static void GenerateRpcBuffers(Corpus &corpus)
+{
+    Random random(0x5EED0001);
+    unsigned char request[4096];
+    for (unsigned long i = 0; i < 64; i++)
+    {
+        unsigned long size = MakeRequest(request, sizeof(request));
+        std::vector<unsigned char> packed(size);
+        unsigned long packedSize = 0;
+        PackRpcHeaderExtChain(request, size, RHE_FLAG_XORMAGIC, &packed[0], size, &packedSize);
+        packed.resize(packedSize);
+        corpus.Packed.push_back(packed);
+
+        // A chained response of three pages, each a RopQueryRows and a RopQueryPosition response in a buffer of its own.
+        std::vector<unsigned char> plain;
+        for (unsigned long page = 0; page < 3; page++)
+        {
+            std::vector<unsigned char> rows = MakeRopRows(random, (unsigned __int64)(i * 3 + page) * RowsPerBlock + 1);
+            std::vector<unsigned char> rops;
+            rops.push_back(0x15);
+            rops.push_back(0);
+            PutULong(rops, 0);
+            rops.push_back(1);
+            PutUShort(rops, (unsigned short)RowsPerBlock);
+            rops.insert(rops.end(), rows.begin(), rows.end());
+            rops.push_back(0x17);
+            rops.push_back(0);
+            PutULong(rops, 0);
+            PutULong(rops, (i * 3 + page + 1) * RowsPerBlock);
+            PutULong(rops, 192 * RowsPerBlock);
+            unsigned short bufferSize = (unsigned short)(sizeof(unsigned short) + rops.size() + 4);
+            PutUShort(plain, 0);
+            PutUShort(plain, page == 2 ? RHE_FLAG_LAST : 0);
+            PutUShort(plain, bufferSize);
+            PutUShort(plain, bufferSize);
+            PutUShort(plain, (unsigned short)(sizeof(unsigned short) + rops.size()));
+            plain.insert(plain.end(), rops.begin(), rops.end());
+            PutULong(plain, 0x0000002A);
+        }
+
+        packed.resize(plain.size());
+        PackRpcHeaderExtChain(&plain[0], (unsigned long)plain.size(), RHE_FLAG_COMPRESSED | RHE_FLAG_XORMAGIC, &packed[0], (unsigned long)packed.size(), &packedSize);
+        packed.resize(packedSize);
+        corpus.Packed.push_back(packed);
+    }
+}
+
+/// <summary>
+/// Build the corpus of every benchmark.
+/// </summary>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+static long BuildCorpus(const std::vector<const char *> &captures, const std::vector<const char *> &fxFiles, Corpus &corpus)
+{
+    for (size_t i = 0; i < captures.size(); i++)
+    {
+        long status = LoadCapture(captures[i], corpus);
+        if (status != 0)
+        {
+            fprintf(stderr, "Cannot read the capture file %s: error %ld.\n", captures[i], status);
+            return status;
+        }
+
+        corpus.RpcSource += (i == 0 ? "" : ";") + std::string(captures[i]);
+    }
+
+    if (corpus.Packed.empty())
+    {
+        GenerateRpcBuffers(corpus);
+        corpus.RpcSource = "generated";
+    }
+
+    ExpandCorpus(corpus);
+    for (size_t i = 0; i < fxFiles.size(); i++)
+    {
+        std::vector<unsigned char> stream;
+        long status = ReadFileBytes(fxFiles[i], stream);
+        if (status != 0)
+        {
+            fprintf(stderr, "Cannot read the FastTransfer stream %s: error %ld.\n", fxFiles[i], status);
+            return status;
+        }
+
+        corpus.FxStreams.push_back(stream);
+        corpus.FxSource += (i == 0 ? "" : ";") + std::string(fxFiles[i]);
+    }
+
+    Random random(0x5EED0002);
+    if (corpus.FxStreams.empty())
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            corpus.FxStreams.push_back(MakeFxStream(random, 250));
+        }
+
+        corpus.FxSource = "generated";
+    }
+
+    for (unsigned long i = 0; i < 32; i++)
+    {
+        corpus.RopRows.push_back(MakeRopRows(random, (unsigned __int64)i * RowsPerBlock + 1));
+#ifdef STUB_BENCHMARK_NSPI
+        corpus.NspiRows.push_back(MakeNspiRows(random, i * RowsPerBlock));
+#endif
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        corpus.Ids.push_back(MakeIds(random, 50000));
+    }
+
+    long status = 0;
+#ifdef STUB_BENCHMARK_NSPI
+    // Decode the NSPI rows once, and serialize them as NDR, as the inputs of the NDR benchmarks.
+    for (size_t i = 0; status == 0 && i < corpus.NspiRows.size(); i++)
+    {
+        const std::vector<unsigned char> &body = corpus.NspiRows[i];
+        unsigned long statusCode = 0;
+        long errorCode = 0;
+        STAT stat;
+        PropertyRowSet_r *rows = NULL;
+        status = NspiHttpDecodeQueryRows(&body[0], (unsigned long)body.size(), &statusCode, &errorCode, &stat, &rows);
+        if (status == 0)
+        {
+            unsigned long size = 0;
+            std::vector<unsigned char> ndr(body.size() * 4 + 0x10000);
+            corpus.NspiRowSets.push_back(rows);
+            status = NdrEncodeRowSet(rows, &ndr[0], (unsigned long)ndr.size(), &size);
+            ndr.resize(size);
+            corpus.NspiNdr.push_back(ndr);
+        }
+    }
+
+    if (status != 0)
+    {
+        fprintf(stderr, "Cannot serialize the NSPI rows as NDR: error %ld.\n", status);
+        return status;
+    }
+#endif
+
+    // Encode the sets once with the codec, as the input of the decoding benchmarks.
+    ID_SET *idset = NULL;
+    status = IdSetCreate(FALSE, &idset);
+    for (size_t i = 0; status == 0 && i < corpus.Ids.size(); i++)
+    {
+        unsigned char key[2] = { (unsigned char)(i + 1), 0 };
+        RANGE_SET *set = NULL;
+        status = IdSetGetRangeSet(idset, key, TRUE, &set);
+        if (status == 0)
+        {
+            status = RangeSetInsertIds(set, &corpus.Ids[i][0], (unsigned long)corpus.Ids[i].size());
+        }
+
+        if (status == 0 && i == 0)
+        {
+            unsigned long size = 0;
+            corpus.Globset.resize(1 << 20);
+            status = RangeSetEncode(set, &corpus.Globset[0], (unsigned long)corpus.Globset.size(), &size);
+            corpus.Globset.resize(size);
+        }
+    }
+
+    if (status == 0)
+    {
+        unsigned long size = 0;
+        corpus.IdSet.resize(4 << 20);
+        status = IdSetEncode(idset, &corpus.IdSet[0], (unsigned long)corpus.IdSet.size(), &size);
+        corpus.IdSet.resize(size);
+    }
+
+    if (idset != NULL)
+    {
+        IdSetDestroy(idset);
+    }
+
+    if (status != 0)
+    {
+        fprintf(stderr, "Cannot encode the IDSET corpus: error %ld.\n", status);
+    }
+
+    return status;
+}
+
+static unsigned __int64 TotalSize(const std::vector<std::vector<unsigned char> > &buffers)
+{
+    unsigned __int64 size = 0;
+    for (size_t i = 0; i < buffers.size(); i++)
+    {
+        size += buffers[i].size();
+    }
+
+    return size;
+}
+
+static unsigned __int64 MaximumSize(const std::vector<std::vector<unsigned char> > &buffers)
+{
+    unsigned __int64 size = 0;
+    for (size_t i = 0; i < buffers.size(); i++)
+    {
+        size = std::max<unsigned __int64>(size, buffers[i].size());
+    }
+
+    return size;
+}
+
+/// <summary>
+/// Count the tokens of a FastTransfer stream, so that the lexer does the work a consumer makes it do.
+/// </summary>
+static long __stdcall CountToken(void *context, const FX_TOKEN *token)
+{
+    *(unsigned __int64 *)context += token->DataSize + 1;
+    return 0;
+}
+
+/// <summary>
+/// The working buffers of the benchmarks, allocated once so that the passes measure the codecs only.
+/// </summary>
+struct Workspace
+{
+    std::vector<unsigned char> Input;
+    std::vector<unsigned char> Output;
+    ROW_DECODER *RopDecoder;
+    volatile unsigned __int64 Sink;                     // Keeps the results of the passes alive.
+};
+
+/// <summary>
+/// Define the benchmarks over a corpus.
+/// </summary>
+static std::vector<Benchmark> DefineBenchmarks(Corpus &corpus, Workspace &work)
+{
+    static const std::string Generated = "generated";
+    std::vector<Benchmark> benchmarks;
+    Corpus *c = &corpus;
+    Workspace *w = &work;
+    unsigned __int64 largest = std::max(MaximumSize(corpus.Plain), MaximumSize(corpus.Packed));
+    work.Input.resize((size_t)std::max<unsigned __int64>(largest + 16, 4096));
+    unsigned __int64 output = largest * 2;
+#ifdef STUB_BENCHMARK_NSPI
+    output = std::max(output, MaximumSize(corpus.NspiNdr));
+#endif
+    work.Output.resize((size_t)output + 0x10000);
+
+    unsigned char request[4096];
+    unsigned long requestSize = MakeRequest(request, sizeof(request));
+    benchmarks.push_back(Benchmark{ "rpcext2.request.encode", &Generated, 1000, (unsigned __int64)requestSize * 1000, [w]() -> long
+    {
+        for (int i = 0; i < 1000; i++)
+        {
+            unsigned long size = MakeRequest(&w->Input[0], (unsigned long)std::min<size_t>(w->Input.size(), 4096));
+            unsigned long packed = 0;
+            long status = PackRpcHeaderExtChain(&w->Input[0], size, RHE_FLAG_COMPRESSED | RHE_FLAG_XORMAGIC, &w->Output[0], (unsigned long)w->Output.size(), &packed);
+            if (status != 0 || size == 0)
+            {
+                return status != 0 ? status : (long)ERROR_INSUFFICIENT_BUFFER;
+            }
+
+            w->Sink += packed;
+        }
+
+        return 0;
+    } });
+
+    benchmarks.push_back(Benchmark{ "rhe.parse", &corpus.RpcSource, corpus.Packed.size(), TotalSize(corpus.Packed), [c, w]() -> long
+    {
+        for (size_t i = 0; i < c->Packed.size(); i++)
+        {
+            std::vector<unsigned char> &chain = c->Packed[i];
+            for (unsigned long offset = 0; offset < chain.size();)
+            {
+                RPC_HEADER_EXT_BUFFER buffer;
+                long status = ParseRpcHeaderExt(&chain[0], (unsigned long)chain.size(), offset, &buffer);
+                if (status != 0)
+                {
+                    return status;
+                }
+
+                w->Sink += buffer.Header.SizeActual;
+                offset += sizeof(RPC_HEADER_EXT) + buffer.Header.Size;
+                if ((buffer.Header.Flags & RHE_FLAG_LAST) != 0)
+                {
+                    break;
+                }
+            }
+        }
+
+        return 0;
+    } });
+
+    // Expanding reveals the input in place, so each chain is copied to the input buffer first; the copy is included.
+    benchmarks.push_back(Benchmark{ "rhe.expand", &corpus.RpcSource, corpus.Packed.size(), TotalSize(corpus.Packed), [c, w]() -> long
+    {
+        for (size_t i = 0; i < c->Packed.size(); i++)
+        {
+            const std::vector<unsigned char> &chain = c->Packed[i];
+            memcpy(&w->Input[0], &chain[0], chain.size());
+            unsigned long size = 0;
+            long status = ExpandRpcHeaderExtChain(&w->Input[0], (unsigned long)chain.size(), &w->Output[0], (unsigned long)w->Output.size(), &size);
+            if (status != 0)
+            {
+                return status;
+            }
+
+            w->Sink += size;
+        }
+
+        return 0;
+    } });
+
+    benchmarks.push_back(Benchmark{ "rhe.pack", &corpus.RpcSource, corpus.Plain.size(), TotalSize(corpus.Plain), [c, w]() -> long
+    {
+        for (size_t i = 0; i < c->Plain.size(); i++)
+        {
+            std::vector<unsigned char> &chain = c->Plain[i];
+            unsigned long size = 0;
+            long status = PackRpcHeaderExtChain(&chain[0], (unsigned long)chain.size(), RHE_FLAG_COMPRESSED | RHE_FLAG_XORMAGIC, &w->Output[0], (unsigned long)w->Output.size(), &size);
+            if (status != 0)
+            {
+                return status;
+            }
+
+            w->Sink += size;
+        }
+
+        return 0;
+    } });
+
+    benchmarks.push_back(Benchmark{ "lz77.compress", &corpus.RpcSource, corpus.Payloads.size(), TotalSize(corpus.Payloads), [c, w]() -> long
+    {
+        for (size_t i = 0; i < c->Payloads.size(); i++)
+        {
+            const std::vector<unsigned char> &payload = c->Payloads[i];
+            unsigned long size = 0;
+            long status = Lz77Direct2Compress(&payload[0], (unsigned long)payload.size(), &w->Output[0], (unsigned long)w->Output.size(), &size);
+            if (status != 0)
+            {
+                return status;
+            }
+
+            w->Sink += size;
+        }
+
+        return 0;
+    } });
+
+    // The bytes of a decompression pass are the bytes it produces, as for the other benchmarks on the same payloads.
+    benchmarks.push_back(Benchmark{ "lz77.decompress", &corpus.RpcSource, corpus.Compressed.size(), TotalSize(corpus.Payloads), [c, w]() -> long
+    {
+        for (size_t i = 0; i < c->Compressed.size(); i++)
+        {
+            const std::vector<unsigned char> &compressed = c->Compressed[i];
+            unsigned long size = 0;
+            long status = Lz77Direct2Decompress(&compressed[0], (unsigned long)compressed.size(), &w->Output[0], (unsigned long)w->Output.size(), &size);
+            if (status != 0)
+            {
+                return status;
+            }
+
+            w->Sink += size;
+        }
+
+        return 0;
+    } });
+
+    // Each payload is obfuscated and revealed, so that it is unchanged for the other benchmarks.
+    benchmarks.push_back(Benchmark{ "xor", &corpus.RpcSource, corpus.Payloads.size() * 2, TotalSize(corpus.Payloads) * 2, [c, w]() -> long
+    {
+        for (size_t i = 0; i < c->Payloads.size(); i++)
+        {
+            std::vector<unsigned char> &payload = c->Payloads[i];
+            XorObfuscate(&payload[0], (unsigned long)payload.size());
+            XorObfuscate(&payload[0], (unsigned long)payload.size());
+            w->Sink += payload[0];
+        }
+
+        return 0;
+    } });
+
+    benchmarks.push_back(Benchmark{ "rows.rop.decode", &Generated, corpus.RopRows.size() * RowsPerBlock, TotalSize(corpus.RopRows), [c, w]() -> long
+    {
+        for (size_t i = 0; i < c->RopRows.size(); i++)
+        {
+            const std::vector<unsigned char> &rows = c->RopRows[i];
+            unsigned long consumed = 0;
+            long status = RowDecoderDecode(w->RopDecoder, &rows[0], (unsigned long)rows.size(), RowsPerBlock, &consumed);
+            if (status != 0 || consumed != rows.size())
+            {
+                return status != 0 ? status : (long)ERROR_INVALID_DATA;
+            }
+
+            w->Sink += consumed;
+        }
+
+        return 0;
+    } });
+
+#ifdef STUB_BENCHMARK_NSPI
+    benchmarks.push_back(Benchmark{ "rows.nspi.decode", &Generated, corpus.NspiRows.size() * RowsPerBlock, TotalSize(corpus.NspiRows), [c, w]() -> long
+    {
+        for (size_t i = 0; i < c->NspiRows.size(); i++)
+        {
+            const std::vector<unsigned char> &body = c->NspiRows[i];
+            unsigned long statusCode = 0;
+            long errorCode = 0;
+            STAT stat;
+            PropertyRowSet_r *rows = NULL;
+            long status = NspiHttpDecodeQueryRows(&body[0], (unsigned long)body.size(), &statusCode, &errorCode, &stat, &rows);
+            if (status != 0 || rows == NULL || rows->cRows != RowsPerBlock)
+            {
+                NspiHttpFreeRowSet(rows);
+                return status != 0 ? status : (long)ERROR_INVALID_DATA;
+            }
+
+            w->Sink += rows->aRow[RowsPerBlock - 1].cValues;
+            NspiHttpFreeRowSet(rows);
+        }
+
+        return 0;
+    } });
+
+    benchmarks.push_back(Benchmark{ "rows.nspi.ndr.encode", &Generated, corpus.NspiRowSets.size() * RowsPerBlock, TotalSize(corpus.NspiNdr), [c, w]() -> long
+    {
+        for (size_t i = 0; i < c->NspiRowSets.size(); i++)
+        {
+            unsigned long size = 0;
+            long status = NdrEncodeRowSet(c->NspiRowSets[i], &w->Output[0], (unsigned long)w->Output.size(), &size);
+            if (status != 0)
+            {
+                return status;
+            }
+
+            w->Sink += size;
+        }
+
+        return 0;
+    } });
+
+    benchmarks.push_back(Benchmark{ "rows.nspi.ndr.decode", &Generated, corpus.NspiNdr.size() * RowsPerBlock, TotalSize(corpus.NspiNdr), [c, w]() -> long
+    {
+        for (size_t i = 0; i < c->NspiNdr.size(); i++)
+        {
+            const std::vector<unsigned char> &ndr = c->NspiNdr[i];
+            unsigned long rowCount = 0;
+            long status = NdrDecodeRowSet(&ndr[0], (unsigned long)ndr.size(), &rowCount);
+            if (status != 0 || rowCount != RowsPerBlock)
+            {
+                return status != 0 ? status : (long)ERROR_INVALID_DATA;
+            }
+
+            w->Sink += rowCount;
+        }
+
+        return 0;
+    } });
+#endif
+
+    benchmarks.push_back(Benchmark{ "fx.lex", &corpus.FxSource, corpus.FxStreams.size(), TotalSize(corpus.FxStreams), [c, w]() -> long
+    {
+        for (size_t i = 0; i < c->FxStreams.size(); i++)
+        {
+            const std::vector<unsigned char> &stream = c->FxStreams[i];
+            unsigned __int64 tokens = 0;
+            FX_LEXER *lexer = NULL;
+            long status = FxLexerCreate(CountToken, &tokens, &lexer);
+            for (size_t offset = 0; status == 0 && offset < stream.size(); offset += TransferBufferSize)
+            {
+                status = FxLexerFeed(lexer, &stream[offset], (unsigned long)std::min<size_t>(stream.size() - offset, TransferBufferSize));
+            }
+
+            if (status == 0)
+            {
+                status = FxLexerEnd(lexer);
+            }
+
+            if (lexer != NULL)
+            {
+                FxLexerDestroy(lexer);
+            }
+
+            if (status != 0)
+            {
+                return status;
+            }
+
+            w->Sink += tokens;
+        }
+
+        return 0;
+    } });
+
+    unsigned __int64 idCount = 0;
+    for (size_t i = 0; i < corpus.Ids.size(); i++)
+    {
+        idCount += corpus.Ids[i].size();
+    }
+
+    benchmarks.push_back(Benchmark{ "idset.build", &Generated, idCount, idCount * sizeof(unsigned __int64), [c, w]() -> long
+    {
+        ID_SET *idset = NULL;
+        long status = IdSetCreate(FALSE, &idset);
+        for (size_t i = 0; status == 0 && i < c->Ids.size(); i++)
+        {
+            unsigned char key[2] = { (unsigned char)(i + 1), 0 };
+            RANGE_SET *set = NULL;
+            status = IdSetGetRangeSet(idset, key, TRUE, &set);
+            if (status == 0)
+            {
+                status = RangeSetInsertIds(set, &c->Ids[i][0], (unsigned long)c->Ids[i].size());
+            }
+        }
+
+        if (idset != NULL)
+        {
+            w->Sink += IdSetGetCount(idset);
+            IdSetDestroy(idset);
+        }
+
+        return status;
+    } });
+
+    benchmarks.push_back(Benchmark{ "idset.encode", &Generated, 16, corpus.IdSet.size() * 16, [c, w]() -> long
+    {
+        ID_SET *idset = NULL;
+        long status = IdSetCreate(FALSE, &idset);
+        if (status == 0)
+        {
+            status = IdSetDecode(idset, &c->IdSet[0], (unsigned long)c->IdSet.size());
+        }
+
+        // The set is decoded once per pass and encoded 16 times, so that the encoding dominates the pass.
+        for (int i = 0; status == 0 && i < 16; i++)
+        {
+            unsigned long size = 0;
+            status = IdSetEncode(idset, &w->Output[0], (unsigned long)w->Output.size(), &size);
+            w->Sink += size;
+        }
+
+        if (idset != NULL)
+        {
+            IdSetDestroy(idset);
+        }
+
+        return status;
+    } });
+
+    benchmarks.push_back(Benchmark{ "idset.decode", &Generated, 1, corpus.IdSet.size(), [c, w]() -> long
+    {
+        ID_SET *idset = NULL;
+        long status = IdSetCreate(FALSE, &idset);
+        if (status == 0)
+        {
+            status = IdSetDecode(idset, &c->IdSet[0], (unsigned long)c->IdSet.size());
+            w->Sink += IdSetGetCount(idset);
+            IdSetDestroy(idset);
+        }
+
+        return status;
+    } });
+
+    // A GLOBSET arrives in pieces, so it is fed to the decoder in chunks as a TransferBuffer would carry it.
+    benchmarks.push_back(Benchmark{ "globset.decode", &Generated, 1, corpus.Globset.size(), [c, w]() -> long
+    {
+        RANGE_SET *set = NULL;
+        GLOBSET_DECODER *decoder = NULL;
+        long status = RangeSetCreate(&set);
+        if (status == 0)
+        {
+            status = GlobsetDecoderCreate(set, &decoder);
+        }
+
+        for (size_t offset = 0; status == 0 && offset < c->Globset.size();)
+        {
+            unsigned long consumed = 0;
+            unsigned long chunk = (unsigned long)std::min<size_t>(c->Globset.size() - offset, 4096);
+            status = GlobsetDecoderFeed(decoder, &c->Globset[offset], chunk, &consumed);
+            offset += consumed;
+            if (status == 0 && consumed == 0)
+            {
+                status = ERROR_INVALID_DATA;
+            }
+        }
+
+        if (status == 0 && !GlobsetDecoderIsComplete(decoder))
+        {
+            status = ERROR_INVALID_DATA;
+        }
+
+        if (decoder != NULL)
+        {
+            GlobsetDecoderDestroy(decoder);
+        }
+
+        if (set != NULL)
+        {
+            w->Sink += RangeSetGetRangeCount(set);
+            RangeSetDestroy(set);
+        }
+
+        return status;
+    } });
+
+    return benchmarks;
+}
+
+/// <summary>
+/// Run a benchmark: a checking pass, the calibration of the passes of a sample, and the samples.
+/// </summary>
+static BenchmarkResult Run(const Benchmark &benchmark, unsigned long samples, unsigned long minimumTime)
+{
+    typedef std::chrono::steady_clock Clock;
+    BenchmarkResult result;
+    result.Name = benchmark.Name;
+    result.Source = *benchmark.Source;
+    result.Items = benchmark.Items;
+    result.Bytes = benchmark.Bytes;
+    result.Passes = 1;
+    result.Status = benchmark.Items == 0 ? ERROR_NO_MORE_ITEMS : benchmark.Pass();
+    if (result.Status != 0)
+    {
+        return result;
+    }
+
+    std::chrono::nanoseconds target = std::chrono::milliseconds(minimumTime);
+    for (;;)
+    {
+        Clock::time_point start = Clock::now();
+        for (unsigned __int64 pass = 0; pass < result.Passes; pass++)
+        {
+            benchmark.Pass();
+        }
+
+        std::chrono::nanoseconds elapsed = Clock::now() - start;
+        if (elapsed >= target || result.Passes >= (1ULL << 40))
+        {
+            break;
+        }
+
+        // Aim a little above the target, so that most samples reach it.
+        unsigned __int64 next = elapsed.count() <= 0 ? result.Passes * 10 : (unsigned __int64)(result.Passes * 1.2 * target.count() / elapsed.count()) + 1;
+        result.Passes = std::min(std::max(next, result.Passes + 1), result.Passes * 10);
+    }
+
+    for (unsigned long sample = 0; sample < samples; sample++)
+    {
+        Clock::time_point start = Clock::now();
+        for (unsigned __int64 pass = 0; pass < result.Passes; pass++)
+        {
+            benchmark.Pass();
+        }
+
+        std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+        result.Nanoseconds.push_back(elapsed.count() / (double)(result.Passes * result.Items));
+    }
+
+    std::sort(result.Nanoseconds.begin(), result.Nanoseconds.end());
+    return result;
+}
+
+/// <summary>
+/// Get a percentile of the sorted times of the samples.
+/// </summary>
+static double Percentile(const std::vector<double> &sorted, double fraction)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+
+    size_t index = (size_t)(fraction * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+/// <summary>
+/// Get the throughput at the median, in megabytes per second.
+/// </summary>
+static double Throughput(const BenchmarkResult &result)
+{
+    double median = Percentile(result.Nanoseconds, 0.5);
+    return median <= 0 ? 0 : (double)result.Bytes / result.Items / median * 1000.0;
+}
+
+/// <summary>
+/// Write a string as a JSON string literal.
+/// </summary>
+static void PrintJsonString(const std::string &text)
+{
+    putchar('"');
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        unsigned char ch = (unsigned char)text[i];
+        if (ch == '"' || ch == '\\')
+        {
+            printf("\\%c", ch);
+        }
+        else if (ch < 0x20)
+        {
+            printf("\\u%04x", ch);
+        }
+        else
+        {
+            putchar(ch);
+        }
+    }
+
+    putchar('"');
+}
+
+/// <summary>
+/// Describe the build, so that results of different compilers and options are not compared by mistake.
+/// </summary>
+static std::string BuildDescription()
+{
+    char description[128];
+#if defined(_MSC_VER)
+    snprintf(description, sizeof(description), "msvc %d", _MSC_VER);
+#elif defined(__clang__)
+    snprintf(description, sizeof(description), "clang %d.%d", __clang_major__, __clang_minor__);
+#elif defined(__GNUC__)
+    snprintf(description, sizeof(description), "gcc %d.%d", __GNUC__, __GNUC_MINOR__);
+#else
+    snprintf(description, sizeof(description), "unknown");
+#endif
+    std::string build(description);
+    build += sizeof(void *) == 8 ? " 64-bit" : " 32-bit";
+#ifdef NDEBUG
+    build += " release";
+#else
+    build += " debug";
+#endif
+    return build;
+}
+
+static void PrintResults(const std::vector<BenchmarkResult> &results, bool csv, bool json)
+{
+    if (json)
+    {
+        printf("{\"version\":1,\"build\":");
+        PrintJsonString(BuildDescription());
+        printf(",\"results\":[");
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const BenchmarkResult &result = results[i];
+            printf("%s\n{\"name\":", i == 0 ? "" : ",");
+            PrintJsonString(result.Name);
+            printf(",\"corpus\":");
+            PrintJsonString(result.Source);
+            printf(",\"status\":%ld,\"items\":%llu,\"bytes\":%llu,\"passes\":%llu,\"samples\":%u", result.Status,
+                (unsigned long long)result.Items, (unsigned long long)result.Bytes, (unsigned long long)result.Passes,
+                (unsigned int)result.Nanoseconds.size());
+            if (result.Status == 0)
+            {
+                printf(",\"nsPerItem\":{\"min\":%.2f,\"median\":%.2f,\"p90\":%.2f,\"max\":%.2f},\"mbPerSecond\":%.2f",
+                    Percentile(result.Nanoseconds, 0), Percentile(result.Nanoseconds, 0.5), Percentile(result.Nanoseconds, 0.9),
+                    Percentile(result.Nanoseconds, 1), Throughput(result));
+            }
+
+            printf("}");
+        }
+
+        printf("\n]}\n");
+        return;
+    }
+
+    if (csv)
+    {
+        printf("Name,Corpus,Status,Items,Bytes,Passes,MinNs,MedianNs,P90Ns,MaxNs,MBPerSecond\n");
+    }
+    else
+    {
+        printf("%-24s %10s %12s %12s %12s %12s %10s  %s\n", "Benchmark", "Items", "Min ns", "Median ns", "P90 ns", "Max ns", "MB/s", "Corpus");
+    }
+
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchmarkResult &result = results[i];
+        if (csv)
+        {
+            printf("%s,\"%s\",%ld,%llu,%llu,%llu,%.2f,%.2f,%.2f,%.2f,%.2f\n", result.Name.c_str(), result.Source.c_str(), result.Status,
+                (unsigned long long)result.Items, (unsigned long long)result.Bytes, (unsigned long long)result.Passes,
+                Percentile(result.Nanoseconds, 0), Percentile(result.Nanoseconds, 0.5), Percentile(result.Nanoseconds, 0.9),
+                Percentile(result.Nanoseconds, 1), Throughput(result));
+        }
+        else if (result.Status != 0)
+        {
+            printf("%-24s failed with error %ld  %s\n", result.Name.c_str(), result.Status, result.Source.c_str());
+        }
+        else
+        {
+            printf("%-24s %10llu %12.1f %12.1f %12.1f %12.1f %10.1f  %s\n", result.Name.c_str(), (unsigned long long)result.Items,
+                Percentile(result.Nanoseconds, 0), Percentile(result.Nanoseconds, 0.5), Percentile(result.Nanoseconds, 0.9),
+                Percentile(result.Nanoseconds, 1), Throughput(result), result.Source.c_str());
+        }
+    }
+}
+
+static void PrintUsage()
+{
+    fprintf(stderr,
+        "Usage: StubBenchmark [/capture <file>] [/fx <file>] [/filter <text>] [/samples <n>] [/mintime <ms>] [/csv | /json] [/list]\n"
+        "  /capture  A capture file written by RpcCaptureStart; its EcDoRpcExt2 buffers replace the generated ones.\n"
+        "  /fx       A FastTransfer stream saved by FxDownloadToFile; its streams replace the generated ones.\n"
+        "  /filter   Run only the benchmarks whose name contains the text.\n"
+        "  /samples  The number of samples of each benchmark; %lu by default.\n"
+        "  /mintime  The shortest time of a sample in milliseconds; %lu by default.\n"
+        "  /csv      Print the results as CSV.\n"
+        "  /json     Print the results as JSON.\n"
+        "  /list     Print the names of the benchmarks.\n",
+        DefaultSamples, DefaultMinimumTime);
+}
+
+#ifdef STUB_BENCHMARK_NSPI
+/// <summary>
+/// Midl allocation functions for the NSPI decoder, which returns its rows in a block from midl_user_allocate.
+/// </summary>
+void* __RPC_USER midl_user_allocate(size_t size)
+{
+    return malloc(size);
+}
+
+void __RPC_USER midl_user_free(void* p)
+{
+    free(p);
+}
+#endif
+
+int main(int argc, char *argv[])
+{
+    bool csv = false;
+    bool json = false;
+    bool list = false;
+    const char *filter = NULL;
+    unsigned long samples = DefaultSamples;
+    unsigned long minimumTime = DefaultMinimumTime;
+    std::vector<const char *> captures;
+    std::vector<const char *> fxFiles;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string option(argv[i]);
+        std::transform(option.begin(), option.end(), option.begin(), ::tolower);
+        if (option == "/csv")
+        {
+            csv = true;
+        }
+        else if (option == "/json")
+        {
+            json = true;
+        }
+        else if (option == "/list")
+        {
+            list = true;
+        }
+        else if (option == "/capture" && i + 1 < argc)
+        {
+            captures.push_back(argv[++i]);
+        }
+        else if (option == "/fx" && i + 1 < argc)
+        {
+            fxFiles.push_back(argv[++i]);
+        }
+        else if (option == "/filter" && i + 1 < argc)
+        {
+            filter = argv[++i];
+        }
+        else if (option == "/samples" && i + 1 < argc)
+        {
+            samples = strtoul(argv[++i], NULL, 10);
+        }
+        else if (option == "/mintime" && i + 1 < argc)
+        {
+            minimumTime = strtoul(argv[++i], NULL, 10);
+        }
+        else
+        {
+            PrintUsage();
+            return ERROR_INVALID_PARAMETER;
+        }
+    }
+
+    if ((csv && json) || samples == 0)
+    {
+        PrintUsage();
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    Corpus corpus;
+    long status = BuildCorpus(captures, fxFiles, corpus);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    Workspace work;
+    work.Sink = 0;
+    work.RopDecoder = NULL;
+    status = RowDecoderCreate(RopColumns, sizeof(RopColumns) / sizeof(RopColumns[0]), RowsPerBlock, &work.RopDecoder);
+    if (status != 0)
+    {
+        fprintf(stderr, "Cannot create the row decoder: error %ld.\n", status);
+        return status;
+    }
+
+    std::vector<Benchmark> benchmarks = DefineBenchmarks(corpus, work);
+    std::vector<BenchmarkResult> results;
+    for (size_t i = 0; i < benchmarks.size(); i++)
+    {
+        if (filter != NULL && strstr(benchmarks[i].Name, filter) == NULL)
+        {
+            continue;
+        }
+
+        if (list)
+        {
+            printf("%s\n", benchmarks[i].Name);
+            continue;
+        }
+
+        results.push_back(Run(benchmarks[i], samples, minimumTime));
+        if (results.back().Status != 0)
+        {
+            status = results.back().Status;
+        }
+    }
+
+    RowDecoderDestroy(work.RopDecoder);
+#ifdef STUB_BENCHMARK_NSPI
+    for (size_t i = 0; i < corpus.NspiRowSets.size(); i++)
+    {
+        NspiHttpFreeRowSet(corpus.NspiRowSets[i]);
+    }
+#endif
+
+    if (!list)
+    {
+        PrintResults(results, csv, json);
+    }
+
+    return status;
+}
@@ -0,0 +1,287 @@
+#include "../OXCRPCStub/EmsmdbCoroutineClient.h"
+#include "../NSPIStub/NspiCoroutineClient.h"
+#include <stdio.h>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Tests of the coroutine support of the stubs. It compiles the executor header with both coroutine clients, so a
+// toolset that cannot build them fails here, and drives Task, Spawn, SyncWait and BlockingCallAwaitable on the two
+// executors without a server: results and exceptions reach the caller, a Task<void> completes, a long chain of tasks
+// that complete synchronously does not grow the stack, and a BlockingCallPool never runs more calls at once than it
+// has threads.
+//
+// It prints one line per test and returns the number of tests that failed. Run the Release configuration: debug builds
+// of some compilers do not turn the symmetric transfer into a tail call, and the long chain then overflows the stack.
+
+using namespace StubCoroutines;
+
+static int m_failures = 0;
+
+/// <summary>
+/// Record the outcome of a check.
+/// </summary>
+static void Check(bool condition, const char *test, const char *what)
+{
+    if (!condition)
+    {
+        printf("FAIL %s: %s\n", test, what);
+        m_failures++;
+    }
+}
+
+static Task<int> Value(int value)
+{
+    co_return value;
+}
+
+static Task<int> Sum(int count)
+{
+    int sum = 0;
+    for (int i = 1; i <= count; i++)
+    {
+        sum += co_await Value(i);
+    }
+
+    co_return sum;
+}
+
+static Task<int> Count(int count)
+{
+    int total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        total += co_await Value(1);
+    }
+
+    co_return total;
+}
+
+static Task<int> Throw(const char *message)
+{
+    throw std::runtime_error(message);
+    co_return 0;
+}
+
+static Task<void> Increment(std::atomic<int> *counter)
+{
+    co_await Value(0);
+    (*counter)++;
+}
+
+static Task<void> ThrowVoid()
+{
+    co_await Value(0);
+    throw std::runtime_error("void");
+}
+
+static Task<int> CatchInCoroutine()
+{
+    try
+    {
+        co_await Throw("inner");
+    }
+    catch (const std::runtime_error &)
+    {
+        co_return 1;
+    }
+
+    co_return 0;
+}
+
+/// <summary>
+/// SyncWait returns the result of a task, on both executors.
+/// </summary>
+static void TestSyncWaitValue()
+{
+    WorkStealingExecutor pool(4);
+    Check(SyncWait(pool, Sum(100)) == 5050, "SyncWaitValue", "the work-stealing executor returned a wrong sum");
+
+    RunLoop loop;
+    std::thread runner([&loop] { loop.Run(); });
+    Check(SyncWait(loop, Sum(10)) == 55, "SyncWaitValue", "the run loop returned a wrong sum");
+    loop.Stop();
+    runner.join();
+}
+
+/// <summary>
+/// A Task&lt;void&gt; completes through SyncWait and through Spawn.
+/// </summary>
+static void TestVoidTask()
+{
+    WorkStealingExecutor pool(2);
+    std::atomic<int> counter(0);
+    SyncWait(pool, Increment(&counter));
+    Check(counter == 1, "VoidTask", "SyncWait did not run the task");
+
+    std::mutex mutex;
+    std::condition_variable signal;
+    int completed = 0;
+    for (int i = 0; i < 10; i++)
+    {
+        Spawn(pool, Increment(&counter), [&]()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            completed++;
+            signal.notify_one();
+        });
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    signal.wait(lock, [&] { return completed == 10; });
+    Check(counter == 11, "VoidTask", "Spawn did not run every task");
+}
+
+/// <summary>
+/// An exception a task throws reaches SyncWait, the failure callback of Spawn, or the coroutine that awaits the task.
+/// </summary>
+static void TestExceptions()
+{
+    WorkStealingExecutor pool(2);
+    bool thrown = false;
+    try
+    {
+        SyncWait(pool, Throw("value"));
+    }
+    catch (const std::runtime_error &e)
+    {
+        thrown = std::string(e.what()) == "value";
+    }
+
+    Check(thrown, "Exceptions", "SyncWait did not rethrow the exception of a Task<int>");
+
+    thrown = false;
+    try
+    {
+        SyncWait(pool, ThrowVoid());
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+
+    Check(thrown, "Exceptions", "SyncWait did not rethrow the exception of a Task<void>");
+    Check(SyncWait(pool, CatchInCoroutine()) == 1, "Exceptions", "the awaiting coroutine did not catch the exception");
+
+    std::mutex mutex;
+    std::condition_variable signal;
+    bool failed = false;
+    Spawn<int>(pool, Throw("spawn"), std::function<void(int)>(), [&](std::exception_ptr)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        failed = true;
+        signal.notify_one();
+    });
+
+    std::unique_lock<std::mutex> lock(mutex);
+    signal.wait(lock, [&] { return failed; });
+    Check(failed, "Exceptions", "Spawn did not call the failure callback");
+}
+
+/// <summary>
+/// Awaiting a million tasks that complete synchronously runs in constant stack, through symmetric transfer.
+/// </summary>
+static void TestSymmetricTransfer()
+{
+    RunLoop loop;
+    std::thread runner([&loop] { loop.Run(); });
+    Check(SyncWait(loop, Count(1000000)) == 1000000, "SymmetricTransfer", "the count is wrong");
+    loop.Stop();
+    runner.join();
+}
+
+static Task<long> Blocking(Executor &executor, BlockingCallPool &calls, std::atomic<int> *running, std::atomic<int> *peak)
+{
+    long status = co_await BlockingCallAwaitable<long>(executor, [=]() -> long
+    {
+        int now = ++(*running);
+        int seen = peak->load();
+        while (now > seen && !peak->compare_exchange_weak(seen, now))
+        {
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        (*running)--;
+        return 7;
+    }, calls);
+
+    co_return status;
+}
+
+static Task<long> BlockingThrow(Executor &executor, BlockingCallPool &calls)
+{
+    co_return co_await BlockingCallAwaitable<long>(executor, []() -> long { throw std::runtime_error("blocking"); }, calls);
+}
+
+/// <summary>
+/// Blocking calls run on the threads of their pool, no more at once than it has, and resume on the executor.
+/// </summary>
+static void TestBlockingCallPool()
+{
+    WorkStealingExecutor pool(4);
+    BlockingCallPool calls(2);
+    std::atomic<int> running(0);
+    std::atomic<int> peak(0);
+    std::mutex mutex;
+    std::condition_variable signal;
+    int completed = 0;
+    long sum = 0;
+    for (int i = 0; i < 16; i++)
+    {
+        Spawn<long>(pool, Blocking(pool, calls, &running, &peak), [&](long status)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            sum += status;
+            completed++;
+            signal.notify_one();
+        });
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        signal.wait(lock, [&] { return completed == 16; });
+    }
+
+    Check(sum == 16 * 7, "BlockingCallPool", "a call returned a wrong status");
+    Check(peak.load() <= 2, "BlockingCallPool", "more calls ran at once than the pool has threads");
+
+    bool thrown = false;
+    try
+    {
+        SyncWait(pool, BlockingThrow(pool, calls));
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+
+    Check(thrown, "BlockingCallPool", "the exception of a blocking call did not reach the awaiting coroutine");
+}
+
+int main(int argc, char *argv[])
+{
+    struct
+    {
+        const char *name;
+        void (*run)();
+    } tests[] =
+    {
+        { "SyncWaitValue", TestSyncWaitValue },
+        { "VoidTask", TestVoidTask },
+        { "Exceptions", TestExceptions },
+        { "SymmetricTransfer", TestSymmetricTransfer },
+        { "BlockingCallPool", TestBlockingCallPool },
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+    {
+        int failures = m_failures;
+        tests[i].run();
+        printf("%s %s\n", m_failures == failures ? "PASS" : "FAIL", tests[i].name);
+    }
+
+    return m_failures;
+}
@@ -0,0 +1,507 @@
+#include "LoadGenerator.h"
+#include "../OXCRPCStub/MapiSession.h"
+#include "../OXCRPCStub/PropertyRowDecoder.h"
+
+using namespace RopCodec;
+
+// The EMSMDB side of the load generator. A session is a MapiSession of the MS-OXCRPC stub, over RPC or MAPI/HTTP,
+// logged on to the private mailbox of its user. Each operation is one EcDoRpcExt2 request that opens the objects it
+// needs from the logon and releases them again, so sessions keep no server objects between operations and any
+// session of a user can run any operation. The responses are read in full: the rows are decoded, as a client would
+// decode them, and a RopBackoff the server appends after the responses is counted and its Duration returned.
+//
+// A request that fails in the transport drops the session; it is connected and logged on again before its next
+// operation, and that time counts toward the latency of the operation.
+
+/// <summary>
+/// The size of the request buffer of a session; the requests of the operations are far smaller.
+/// </summary>
+static const unsigned long RequestCapacity = 0x1000;
+
+/// <summary>
+/// The ReturnValue a throttled ROP fails with, ecServerBusy, as specified in MS-OXCDATA section 2.4.1.
+/// </summary>
+static const ULong ServerBusy = 0x00000480;
+
+/// <summary>
+/// The RopLogon parameters of a private mailbox logon, as specified in MS-OXCROPS section 2.2.3.1.1.
+/// </summary>
+static const Byte LogonFlagsPrivate = 0x01;
+static const ULong OpenFlagsUsePerMdbReplidMapping = 0x01000000;
+
+/// <summary>
+/// The indexes of the IPM subtree and the Inbox in the FolderIds of a private mailbox logon.
+/// </summary>
+static const size_t IpmSubtreeFolder = 3;
+static const size_t InboxFolder = 4;
+
+/// <summary>
+/// The columns the operations read.
+/// </summary>
+static const ULong ContentsColumns[] =
+{
+    0x674A0014,     // PidTagMid
+    0x0037001F,     // PidTagSubject
+    0x0042001F,     // PidTagSentRepresentingName
+    0x0E060040,     // PidTagMessageDeliveryTime
+    0x0E070003,     // PidTagMessageFlags
+    0x0E080003      // PidTagMessageSize
+};
+
+static const ULong HierarchyColumns[] =
+{
+    0x67480014,     // PidTagFolderId
+    0x3001001F,     // PidTagDisplayName
+    0x36020003,     // PidTagContentCount
+    0x36030003,     // PidTagContentUnreadCount
+    0x360A000B      // PidTagSubfolders
+};
+
+static const ULong FolderColumns[] =
+{
+    0x3001001F,     // PidTagDisplayName
+    0x36020003,     // PidTagContentCount
+    0x36030003,     // PidTagContentUnreadCount
+    0x0E080003      // PidTagMessageSize
+};
+
+/// <summary>
+/// The MapiSession routines of the MS-OXCRPC stub.
+/// </summary>
+static decltype(&MapiSessionConnect) m_connect = NULL;
+static decltype(&MapiSessionExecute) m_execute = NULL;
+static decltype(&MapiSessionDisconnect) m_disconnect = NULL;
+static decltype(&MapiSessionGetStats) m_getStats = NULL;
+
+/// <summary>
+/// A session logged on to the mailbox of its user.
+/// </summary>
+struct EmsmdbLoadSession
+{
+    const LoadOptions *Options;
+    const LoadUser *User;
+    MAPI_SESSION *Session;                      // NULL once a request failed in the transport.
+    ULong LogonHandle;
+    ULongLong FolderIds[Logon::FolderIdCount];
+    ROW_DECODER *ContentsRows;
+    ROW_DECODER *HierarchyRows;
+    ROW_DECODER *FolderRow;
+    unsigned char Request[RequestCapacity];
+};
+
+/// <summary>
+/// Load the MS-OXCRPC stub and, for RPC sessions, bind it to the server.
+/// </summary>
+/// <param name="options">The settings of the run.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long EmsmdbLoadInitialize(const LoadOptions &options)
+{
+    HMODULE module = LoadLibraryA(options.EmsmdbDll.c_str());
+    if (module == NULL)
+    {
+        return (long)GetLastError();
+    }
+
+    if (!ResolveRoutine(module, "MapiSessionConnect", m_connect)
+        || !ResolveRoutine(module, "MapiSessionExecute", m_execute)
+        || !ResolveRoutine(module, "MapiSessionDisconnect", m_disconnect)
+        || !ResolveRoutine(module, "MapiSessionGetStats", m_getStats))
+    {
+        return ERROR_PROC_NOT_FOUND;
+    }
+
+    return options.MapiHttp ? 0 : LoadBindStub(module, options);
+}
+
+/// <summary>
+/// Decode rows at the current position of a response and consume them.
+/// </summary>
+static bool DecodeRows(RopResponseReader &reader, ROW_DECODER *decoder, unsigned long rowCount)
+{
+    unsigned long consumed = 0;
+    return RowDecoderDecode(decoder, reader.Cursor(), reader.Remaining(), rowCount, &consumed) == 0 && reader.Take(consumed) != NULL;
+}
+
+/// <summary>
+/// Read the response of each ROP of a request, in order, and the RopBackoff responses that follow them.
+/// </summary>
+/// <param name="reader">The reader, on the first RPC_HEADER_EXT buffer of the response.</param>
+/// <param name="ropIds">The ROPs of the request that have a response.</param>
+/// <param name="ropCount">The number of ROPs in ropIds.</param>
+/// <param name="decoder">The decoder of the rows of RopQueryRows or RopGetPropertiesSpecific.</param>
+/// <param name="result">Receives the backoffs.</param>
+/// <returns>0, the first ReturnValue that was not 0, ecServerBusy if a RopBackoff took the place of a response, or ERROR_INVALID_DATA.</returns>
+static long ReadResponses(RopResponseReader &reader, const Byte *ropIds, size_t ropCount, ROW_DECODER *decoder, LoadResult *result)
+{
+    long status = 0;
+    Byte ropId;
+    Byte handleIndex;
+    ULong returnValue;
+    for (size_t i = 0; i < ropCount; i++)
+    {
+        if (!reader.Peek(ropId, returnValue))
+        {
+            return ERROR_INVALID_DATA;
+        }
+
+        if (ropId == Backoff::Id)
+        {
+            status = status == 0 ? (long)ServerBusy : status;
+            break;
+        }
+
+        if (ropId != ropIds[i])
+        {
+            return ERROR_INVALID_DATA;
+        }
+
+        if (returnValue != 0)
+        {
+            result->Backoffs += returnValue == ServerBusy ? 1 : 0;
+            status = status == 0 ? (long)returnValue : status;
+            reader.ReadLayout<ResponseHeader>(ropId, handleIndex, returnValue);
+            continue;
+        }
+
+        bool read;
+        switch (ropId)
+        {
+        case OpenFolder::Id:
+            {
+                // The folders of a private mailbox are never ghosted, so no server list follows.
+                Byte hasRules;
+                Byte isGhosted;
+                read = reader.Read<OpenFolder>(ropId, handleIndex, returnValue, hasRules, isGhosted) && isGhosted == 0;
+            }
+
+            break;
+
+        case GetContentsTable::Id:
+        case GetHierarchyTable::Id:
+            {
+                ULong rowCount;
+                read = reader.Read<GetContentsTable>(ropId, handleIndex, returnValue, rowCount);
+            }
+
+            break;
+
+        case SetColumns::Id:
+            {
+                Byte tableStatus;
+                read = reader.Read<SetColumns>(ropId, handleIndex, returnValue, tableStatus);
+            }
+
+            break;
+
+        case QueryRows::Id:
+            {
+                Byte origin;
+                UShort rowCount;
+                read = reader.Read<QueryRows>(ropId, handleIndex, returnValue, origin, rowCount) && DecodeRows(reader, decoder, rowCount);
+            }
+
+            break;
+
+        case GetPropertiesSpecific::Id:
+            read = reader.Read<GetPropertiesSpecific>(ropId, handleIndex, returnValue) && DecodeRows(reader, decoder, 1);
+            break;
+
+        default:
+            read = false;
+            break;
+        }
+
+        if (!read)
+        {
+            return ERROR_INVALID_DATA;
+        }
+    }
+
+    // A server that throttles the session appends RopBackoff after the responses, as specified in MS-OXCROPS
+    // section 2.2.15.2; the client waits for the longest Duration it names.
+    while (reader.Peek(ropId, returnValue) && ropId == Backoff::Id)
+    {
+        Byte logonId;
+        ULong duration;
+        Byte entryCount;
+        UShort additionalSize;
+        if (!reader.Read<Backoff>(ropId, logonId, duration, entryCount))
+        {
+            return ERROR_INVALID_DATA;
+        }
+
+        for (Byte entry = 0; entry < entryCount; entry++)
+        {
+            Byte backoffRopId;
+            ULong ropDuration;
+            if (!reader.ReadLayout<Backoff::Entry>(backoffRopId, ropDuration))
+            {
+                return ERROR_INVALID_DATA;
+            }
+
+            duration = ropDuration > duration ? ropDuration : duration;
+        }
+
+        if (!reader.ReadLayout<Layout<UShort> >(additionalSize) || reader.Take(additionalSize) == NULL)
+        {
+            return ERROR_INVALID_DATA;
+        }
+
+        result->Backoffs++;
+        result->BackoffMilliseconds = duration > result->BackoffMilliseconds ? duration : result->BackoffMilliseconds;
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Log on to the private mailbox of the user of a connected session, and keep its handle and folder IDs.
+/// </summary>
+static long LogonMailbox(EmsmdbLoadSession *session)
+{
+    const std::string &essdn = session->User->UserDN;
+    RopRequestWriter writer(session->Request, RequestCapacity);
+    writer.Append<Logon>((Byte)0, (Byte)0, LogonFlagsPrivate, OpenFlagsUsePerMdbReplidMapping, (ULong)0, (UShort)(essdn.size() + 1));
+    writer.AppendBytes(essdn.c_str(), essdn.size() + 1);
+    ULong handles[] = { 0xFFFFFFFF };
+    unsigned long cbIn = writer.Finish(handles, 1);
+    if (cbIn == 0)
+    {
+        return ERROR_INSUFFICIENT_BUFFER;
+    }
+
+    unsigned char *rgbOut;
+    unsigned long cbOut;
+    long status = m_execute(session->Session, session->Request, cbIn, &rgbOut, &cbOut);
+    if (status != 0)
+    {
+        return status;
+    }
+
+    RopResponseReader reader(rgbOut, cbOut);
+    status = reader.NextBuffer();
+    if (status != 0)
+    {
+        return status;
+    }
+
+    Byte ropId;
+    Byte handleIndex;
+    Byte logonFlags;
+    ULong returnValue;
+    if (!reader.Peek(ropId, returnValue) || ropId != Logon::Id)
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    if (returnValue != 0)
+    {
+        return (long)returnValue;
+    }
+
+    const unsigned char *folderIds;
+    if (!reader.Read<Logon>(ropId, handleIndex, returnValue, logonFlags)
+        || (folderIds = reader.Take(sizeof(session->FolderIds))) == NULL
+        || !reader.GetHandle(handleIndex, session->LogonHandle))
+    {
+        return ERROR_INVALID_DATA;
+    }
+
+    memcpy(session->FolderIds, folderIds, sizeof(session->FolderIds));
+    return 0;
+}
+
+/// <summary>
+/// Connect the MapiSession of a session and log on.
+/// </summary>
+static long ConnectSession(EmsmdbLoadSession *session)
+{
+    const LoadOptions &options = *session->Options;
+    const LoadUser &user = *session->User;
+    MAPI_SESSION_CONFIG config = {};
+    config.Transport = options.MapiHttp ? MapiTransportMapiHttp : MapiTransportRpc;
+    config.UserDN = user.UserDN.c_str();
+    config.MailStoreUrl = user.MailStoreUrl.c_str();
+    config.Domain = options.Domain.c_str();
+    config.UserName = user.UserName.empty() ? options.UserName.c_str() : user.UserName.c_str();
+    config.Password = user.UserName.empty() ? options.Password.c_str() : user.Password.c_str();
+    config.Flags = MAPI_SESSION_COMPRESS | MAPI_SESSION_XORMAGIC;
+    config.MaxRetries = MAPI_SESSION_SERVER_RETRY;
+    config.RetryDelay = MAPI_SESSION_SERVER_RETRY;
+    long status = m_connect(&config, &session->Session);
+    if (status == 0)
+    {
+        status = LogonMailbox(session);
+        if (status != 0)
+        {
+            m_disconnect(&session->Session);
+        }
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Connect a session for a user and log on to the mailbox.
+/// </summary>
+/// <param name="options">The settings of the run; they must outlive the session.</param>
+/// <param name="user">The user; it must outlive the session.</param>
+/// <param name="session">Receives the session.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long EmsmdbLoadConnect(const LoadOptions &options, const LoadUser &user, EmsmdbLoadSession **session)
+{
+    EmsmdbLoadSession *created = new EmsmdbLoadSession();
+    created->Options = &options;
+    created->User = &user;
+    long status = RowDecoderCreate(ContentsColumns, sizeof(ContentsColumns) / sizeof(ULong), options.RowCount, &created->ContentsRows);
+    if (status == 0)
+    {
+        status = RowDecoderCreate(HierarchyColumns, sizeof(HierarchyColumns) / sizeof(ULong), options.RowCount, &created->HierarchyRows);
+    }
+
+    if (status == 0)
+    {
+        status = RowDecoderCreate(FolderColumns, sizeof(FolderColumns) / sizeof(ULong), 1, &created->FolderRow);
+    }
+
+    if (status == 0)
+    {
+        status = ConnectSession(created);
+    }
+
+    if (status != 0)
+    {
+        EmsmdbLoadDisconnect(created);
+        return status;
+    }
+
+    *session = created;
+    return 0;
+}
+
+/// <summary>
+/// Build the request of an operation: open a folder from the logon into handle index 1, and its table, if any, into
+/// handle index 2.
+/// </summary>
+/// <returns>The size of the request, or 0 if it did not fit.</returns>
+static unsigned long BuildRequest(EmsmdbLoadSession *session, LoadOperation operation, const Byte *&ropIds, size_t &ropCount, ROW_DECODER *&decoder)
+{
+    static const Byte TableRops[] = { OpenFolder::Id, GetContentsTable::Id, SetColumns::Id, QueryRows::Id };
+    static const Byte HierarchyRops[] = { OpenFolder::Id, GetHierarchyTable::Id, SetColumns::Id, QueryRows::Id };
+    static const Byte PropertyRops[] = { OpenFolder::Id, GetPropertiesSpecific::Id };
+
+    RopRequestWriter writer(session->Request, RequestCapacity);
+    switch (operation)
+    {
+    case LoadContents:
+        writer.Append<OpenFolder>((Byte)0, (Byte)0, (Byte)1, session->FolderIds[InboxFolder], (Byte)0);
+        writer.Append<GetContentsTable>((Byte)0, (Byte)1, (Byte)2, (Byte)0);
+        writer.Append<SetColumns>((Byte)0, (Byte)2, (Byte)0, (UShort)(sizeof(ContentsColumns) / sizeof(ULong)));
+        writer.AppendBytes(ContentsColumns, sizeof(ContentsColumns));
+        ropIds = TableRops;
+        ropCount = sizeof(TableRops);
+        decoder = session->ContentsRows;
+        break;
+
+    case LoadHierarchy:
+        writer.Append<OpenFolder>((Byte)0, (Byte)0, (Byte)1, session->FolderIds[IpmSubtreeFolder], (Byte)0);
+        writer.Append<GetHierarchyTable>((Byte)0, (Byte)1, (Byte)2, (Byte)0);
+        writer.Append<SetColumns>((Byte)0, (Byte)2, (Byte)0, (UShort)(sizeof(HierarchyColumns) / sizeof(ULong)));
+        writer.AppendBytes(HierarchyColumns, sizeof(HierarchyColumns));
+        ropIds = HierarchyRops;
+        ropCount = sizeof(HierarchyRops);
+        decoder = session->HierarchyRows;
+        break;
+
+    case LoadFolderProperties:
+        writer.Append<OpenFolder>((Byte)0, (Byte)0, (Byte)1, session->FolderIds[InboxFolder], (Byte)0);
+        writer.Append<GetPropertiesSpecific>((Byte)0, (Byte)1, (UShort)0, (UShort)1, (UShort)(sizeof(FolderColumns) / sizeof(ULong)));
+        writer.AppendBytes(FolderColumns, sizeof(FolderColumns));
+        writer.Append<Release>((Byte)0, (Byte)1);
+        ropIds = PropertyRops;
+        ropCount = sizeof(PropertyRops);
+        decoder = session->FolderRow;
+        break;
+
+    default:
+        return 0;
+    }
+
+    if (operation != LoadFolderProperties)
+    {
+        writer.Append<QueryRows>((Byte)0, (Byte)2, (Byte)0, (Byte)1, session->Options->RowCount);
+        writer.Append<Release>((Byte)0, (Byte)2);
+        writer.Append<Release>((Byte)0, (Byte)1);
+    }
+
+    ULong handles[] = { session->LogonHandle, 0xFFFFFFFF, 0xFFFFFFFF };
+    return writer.Finish(handles, 3);
+}
+
+/// <summary>
+/// Run an EMSMDB operation on a session, connecting it again first if its last request failed in the transport.
+/// </summary>
+/// <param name="session">The session; it is used by one thread at a time.</param>
+/// <param name="operation">One of the EMSMDB operations.</param>
+/// <param name="result">Receives the outcome.</param>
+void EmsmdbLoadExecute(EmsmdbLoadSession *session, LoadOperation operation, LoadResult *result)
+{
+    result->Status = 0;
+    result->Backoffs = 0;
+    result->BackoffMilliseconds = 0;
+    if (session->Session == NULL && (result->Status = ConnectSession(session)) != 0)
+    {
+        return;
+    }
+
+    const Byte *ropIds = NULL;
+    size_t ropCount = 0;
+    ROW_DECODER *decoder = NULL;
+    unsigned long cbIn = BuildRequest(session, operation, ropIds, ropCount, decoder);
+    if (cbIn == 0)
+    {
+        result->Status = ERROR_INSUFFICIENT_BUFFER;
+        return;
+    }
+
+    // The retries MapiSession made under its retry policy are the backoffs of the transport.
+    MAPI_SESSION_STATS before;
+    MAPI_SESSION_STATS after;
+    m_getStats(session->Session, &before);
+    unsigned char *rgbOut;
+    unsigned long cbOut;
+    long status = m_execute(session->Session, session->Request, cbIn, &rgbOut, &cbOut);
+    m_getStats(session->Session, &after);
+    result->Backoffs += after.RetryCount - before.RetryCount;
+    if (status != 0)
+    {
+        if (status != RPC_S_SERVER_TOO_BUSY)
+        {
+            m_disconnect(&session->Session);
+        }
+
+        result->Status = status;
+        return;
+    }
+
+    RopResponseReader reader(rgbOut, cbOut);
+    status = reader.NextBuffer();
+    result->Status = status != 0 ? status : ReadResponses(reader, ropIds, ropCount, decoder, result);
+}
+
+/// <summary>
+/// Disconnect a session and free it.
+/// </summary>
+/// <param name="session">The session.</param>
+void EmsmdbLoadDisconnect(EmsmdbLoadSession *session)
+{
+    if (session->Session != NULL)
+    {
+        m_disconnect(&session->Session);
+    }
+
+    RowDecoderDestroy(session->ContentsRows);
+    RowDecoderDestroy(session->HierarchyRows);
+    RowDecoderDestroy(session->FolderRow);
+    delete session;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <windows.h>
+#include <string>
+
+/// <summary>
+/// The operations of the load mix. The EMSMDB operations are one EcDoRpcExt2 request each, through MapiSession; the
+/// NSPI operations are one NSPI method each.
+/// </summary>
+enum LoadOperation
+{
+    LoadContents = 0,               // Open the Inbox, read a page of its contents table and release both objects.
+    LoadHierarchy,                  // Open the IPM subtree, read a page of its hierarchy table and release both objects.
+    LoadFolderProperties,           // Open the Inbox and read its properties with RopGetPropertiesSpecific.
+    LoadNspiQueryRows,              // Read the next page of the GAL with NspiQueryRows, from the top again at its end.
+    LoadNspiResolveNames,           // Resolve the alias of a user of the run with NspiResolveNamesW.
+    LoadNspiDNToMId,                // Map the DN of a user of the run to its MId with NspiDNToMId.
+    LoadNspiGetProps,               // Read the properties of the user of the session with NspiGetProps.
+    LoadOperationCount
+};
+
+/// <summary>
+/// A mailbox user the sessions log on as. The credentials and mail store URL are used by MAPI/HTTP sessions; RPC
+/// sessions all use the identity given to CreateIdentity.
+/// </summary>
+struct LoadUser
+{
+    std::string UserDN;
+    std::string MailStoreUrl;
+    std::string UserName;               // Empty to use the user name of the run.
+    std::string Password;
+    std::string Alias;                  // The last cn of UserDN, which NspiResolveNamesW resolves.
+    std::wstring WideAlias;
+};
+
+/// <summary>
+/// The settings of a run that the EMSMDB and NSPI sessions use.
+/// </summary>
+struct LoadOptions
+{
+    std::string EmsmdbDll;              // The path of the MS-OXCRPC stub.
+    std::string NspiDll;                // The path of the MS-OXNSPI stub.
+    std::string Server;
+    std::string Sequence;               // The RPC protocol sequence, such as ncacn_ip_tcp or ncacn_http.
+    std::string Spn;                    // The service principal name for Kerberos.
+    std::string RpchAuthScheme;         // Basic or NTLM, for ncacn_http.
+    std::string Domain;
+    std::string UserName;
+    std::string Password;
+    int AuthenticationLevel;
+    int AuthenticationService;
+    bool RpchUseSsl;
+    bool MapiHttp;                      // Connect the EMSMDB sessions over MAPI/HTTP instead of RPC.
+    unsigned short RowCount;            // The rows a page of a table or of the GAL holds.
+};
+
+/// <summary>
+/// The outcome of one operation.
+/// </summary>
+struct LoadResult
+{
+    long Status;                        // 0, the error of the transport, the first ReturnValue that was not 0, or the error of the NSPI method.
+    unsigned long Backoffs;             // RopBackoff responses, ecServerBusy ReturnValues, MapiSession retries and RPC_S_SERVER_TOO_BUSY faults.
+    unsigned long BackoffMilliseconds;  // The longest Duration a RopBackoff asked for.
+};
+
+/// <summary>
+/// The signatures of the binding routines both stubs export.
+/// </summary>
+typedef unsigned long (__stdcall *BIND_TO_SERVER_ROUTINE)(const char *server, int encryptionMethod, int authenticationServices, const char *seqType, bool rpchUseSsl, const char *rpchAuthScheme, const char *spnStr, const char *options, bool setUuid);
+typedef void (__stdcall *CREATE_IDENTITY_ROUTINE)(const char *domain, const char *username, const char *password);
+
+/// <summary>
+/// Get an exported routine of a stub as a typed pointer.
+/// </summary>
+template <typename TRoutine>
+bool ResolveRoutine(HMODULE module, const char *name, TRoutine &routine)
+{
+    routine = (TRoutine)GetProcAddress(module, name);
+    return routine != NULL;
+}
+
+long LoadBindStub(HMODULE module, const LoadOptions &options);
+
+struct EmsmdbLoadSession;
+
+long EmsmdbLoadInitialize(const LoadOptions &options);
+
+long EmsmdbLoadConnect(const LoadOptions &options, const LoadUser &user, EmsmdbLoadSession **session);
+
+void EmsmdbLoadExecute(EmsmdbLoadSession *session, LoadOperation operation, LoadResult *result);
+
+void EmsmdbLoadDisconnect(EmsmdbLoadSession *session);
+
+struct NspiLoadSession;
+
+long NspiLoadInitialize(const LoadOptions &options);
+
+long NspiLoadConnect(const LoadOptions &options, const LoadUser &user, NspiLoadSession **session);
+
+void NspiLoadExecute(NspiLoadSession *session, LoadOperation operation, const LoadUser &target, LoadResult *result);
+
+void NspiLoadDisconnect(NspiLoadSession *session);
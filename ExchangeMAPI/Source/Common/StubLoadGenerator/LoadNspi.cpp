@@ -0,0 +1,315 @@
+#include "LoadGenerator.h"
+#include "../NSPIStub/NspiMemory.h"
+
+// The NSPI side of the load generator. A session is an NSPI context handle of the MS-OXNSPI stub, bound on the one
+// binding handle of the stub, with the MId of its user and its own position in the GAL for NspiQueryRows. The NSPI
+// methods raise RPC exceptions for failures of the transport; these are returned as the status of the operation, and
+// the context handle is then bound again before the next operation of the session. The outputs are freed with the
+// free routines of the stub, so that long runs do not grow the heap.
+
+/// <summary>
+/// The STAT values of a session, as specified in MS-OXNSPI section 2.2.8.
+/// </summary>
+static const DWORD CodePageWesternEuropean = 1252;
+static const DWORD LocaleEnglishUnitedStates = 0x00000409;
+static const DWORD MidBeginningOfTable = 0x00000000;
+
+/// <summary>
+/// The value NspiGetProps returns when some of the properties have no value, as specified in MS-OXNSPI section 2.2.1.2.
+/// </summary>
+static const long ErrorsReturned = 0x00040380;
+
+/// <summary>
+/// The columns the operations read: a PropertyTagArray_r with room for its tags.
+/// </summary>
+static struct
+{
+    DWORD cValues;
+    DWORD aulPropTag[6];
+} m_columns =
+{
+    6,
+    {
+        0x3001001F,     // PidTagDisplayName
+        0x3003001F,     // PidTagEmailAddress
+        0x39FE001F,     // PidTagSmtpAddress
+        0x0FFE0003,     // PidTagObjectType
+        0x39000003,     // PidTagDisplayType
+        0x0FFF0102      // PidTagEntryId
+    }
+};
+
+/// <summary>
+/// The routines of the MS-OXNSPI stub.
+/// </summary>
+static handle_t (__stdcall *m_getBindHandle)() = NULL;
+static decltype(&NspiBind) m_bind = NULL;
+static decltype(&NspiUnbind) m_unbind = NULL;
+static decltype(&NspiQueryRows) m_queryRows = NULL;
+static decltype(&NspiResolveNamesW) m_resolveNamesW = NULL;
+static decltype(&NspiDNToMId) m_dnToMId = NULL;
+static decltype(&NspiGetProps) m_getProps = NULL;
+static decltype(&NspiFreeBuffer) m_freeBuffer = NULL;
+static decltype(&NspiFreeRow) m_freeRow = NULL;
+static decltype(&NspiFreeRowSet) m_freeRowSet = NULL;
+
+/// <summary>
+/// An NSPI session of a user.
+/// </summary>
+struct NspiLoadSession
+{
+    const LoadUser *User;
+    NSPI_HANDLE Handle;                 // NULL once a method failed in the transport.
+    DWORD MId;                          // The MId of the user, for NspiGetProps.
+    DWORD PageSize;                     // The rows NspiQueryRows reads.
+    STAT Stat;                          // The position of the session in the GAL.
+};
+
+/// <summary>
+/// Call an NSPI method, translating an RPC exception into its code.
+/// </summary>
+/// <param name="call">The call.</param>
+/// <param name="fault">Set if the call raised an exception.</param>
+/// <returns>The return value of the method, or the exception code.</returns>
+template <typename TCall>
+static long CallNspi(TCall call, bool &fault)
+{
+    long status = 0;
+    fault = false;
+    RpcTryExcept
+    {
+        status = call();
+    }
+    RpcExcept(EXCEPTION_EXECUTE_HANDLER)
+    {
+        status = RpcExceptionCode();
+        fault = true;
+    }
+    RpcEndExcept;
+    return status;
+}
+
+/// <summary>
+/// Load the MS-OXNSPI stub and bind it to the server.
+/// </summary>
+/// <param name="options">The settings of the run.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long NspiLoadInitialize(const LoadOptions &options)
+{
+    HMODULE module = LoadLibraryA(options.NspiDll.c_str());
+    if (module == NULL)
+    {
+        return (long)GetLastError();
+    }
+
+    if (!ResolveRoutine(module, "GetBindHandle", m_getBindHandle)
+        || !ResolveRoutine(module, "NspiBind", m_bind)
+        || !ResolveRoutine(module, "NspiUnbind", m_unbind)
+        || !ResolveRoutine(module, "NspiQueryRows", m_queryRows)
+        || !ResolveRoutine(module, "NspiResolveNamesW", m_resolveNamesW)
+        || !ResolveRoutine(module, "NspiDNToMId", m_dnToMId)
+        || !ResolveRoutine(module, "NspiGetProps", m_getProps)
+        || !ResolveRoutine(module, "NspiFreeBuffer", m_freeBuffer)
+        || !ResolveRoutine(module, "NspiFreeRow", m_freeRow)
+        || !ResolveRoutine(module, "NspiFreeRowSet", m_freeRowSet))
+    {
+        return ERROR_PROC_NOT_FOUND;
+    }
+
+    return LoadBindStub(module, options);
+}
+
+/// <summary>
+/// Set a STAT to the top of the GAL.
+/// </summary>
+static void ResetStat(STAT *stat)
+{
+    memset(stat, 0, sizeof(STAT));
+    stat->CurrentRec = MidBeginningOfTable;
+    stat->CodePage = CodePageWesternEuropean;
+    stat->TemplateLocale = LocaleEnglishUnitedStates;
+    stat->SortLocale = LocaleEnglishUnitedStates;
+}
+
+/// <summary>
+/// Map a DN to its MId with NspiDNToMId.
+/// </summary>
+static long MapDN(NspiLoadSession *session, const std::string &dn, DWORD *mid, bool &fault)
+{
+    StringsArray_r names;
+    names.Count = 1;
+    names.Strings[0] = (unsigned char *)dn.c_str();
+    PropertyTagArray_r *mids = NULL;
+    NSPI_HANDLE handle = session->Handle;
+    long status = CallNspi([&]() { return m_dnToMId(handle, 0, &names, &mids); }, fault);
+    if (status == 0 && mid != NULL)
+    {
+        *mid = mids != NULL && mids->cValues == 1 ? mids->aulPropTag[0] : 0;
+    }
+
+    m_freeBuffer(mids);
+    return status;
+}
+
+/// <summary>
+/// Bind the context handle of a session and find the MId of its user.
+/// </summary>
+static long BindSession(NspiLoadSession *session)
+{
+    bool fault;
+    STAT stat;
+    ResetStat(&stat);
+    FlatUID_r serverGuid;
+    NSPI_HANDLE *handle = &session->Handle;
+    handle_t binding = m_getBindHandle();
+    long status = CallNspi([&]() { return m_bind(binding, 0, &stat, &serverGuid, handle); }, fault);
+    if (status == 0)
+    {
+        ResetStat(&session->Stat);
+        status = MapDN(session, session->User->UserDN, &session->MId, fault);
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Forget the context handle of a session whose connection failed, without a call to the server.
+/// </summary>
+static void DropSession(NspiLoadSession *session)
+{
+    if (session->Handle != NULL)
+    {
+        RpcSsDestroyClientContext(&session->Handle);
+        session->Handle = NULL;
+    }
+}
+
+/// <summary>
+/// Bind an NSPI session for a user.
+/// </summary>
+/// <param name="options">The settings of the run.</param>
+/// <param name="user">The user; it must outlive the session.</param>
+/// <param name="session">Receives the session.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long NspiLoadConnect(const LoadOptions &options, const LoadUser &user, NspiLoadSession **session)
+{
+    NspiLoadSession *created = new NspiLoadSession();
+    created->User = &user;
+    created->PageSize = options.RowCount;
+    long status = BindSession(created);
+    if (status != 0)
+    {
+        NspiLoadDisconnect(created);
+        return status;
+    }
+
+    *session = created;
+    return 0;
+}
+
+/// <summary>
+/// Run an NSPI operation on a session, binding it again first if its last method failed in the transport.
+/// </summary>
+/// <param name="session">The session; it is used by one thread at a time.</param>
+/// <param name="operation">One of the NSPI operations.</param>
+/// <param name="target">The user NspiResolveNamesW and NspiDNToMId look up.</param>
+/// <param name="result">Receives the outcome.</param>
+void NspiLoadExecute(NspiLoadSession *session, LoadOperation operation, const LoadUser &target, LoadResult *result)
+{
+    result->Status = 0;
+    result->Backoffs = 0;
+    result->BackoffMilliseconds = 0;
+    if (session->Handle == NULL && (result->Status = BindSession(session)) != 0)
+    {
+        DropSession(session);
+        return;
+    }
+
+    bool fault = false;
+    long status;
+    NSPI_HANDLE handle = session->Handle;
+    switch (operation)
+    {
+    case LoadNspiQueryRows:
+        {
+            // The session pages through the GAL, and starts from the top again once a page comes back short.
+            PropertyRowSet_r *rows = NULL;
+            STAT *stat = &session->Stat;
+            DWORD count = session->PageSize;
+            status = CallNspi([&]() { return m_queryRows(handle, 0, stat, 0, NULL, count, (PropertyTagArray_r *)&m_columns, &rows); }, fault);
+            if (status == 0 && (rows == NULL || rows->cRows < count))
+            {
+                ResetStat(stat);
+            }
+
+            m_freeRowSet(rows);
+        }
+
+        break;
+
+    case LoadNspiResolveNames:
+        {
+            STAT stat;
+            ResetStat(&stat);
+            WStringsArray_r names;
+            names.Count = 1;
+            names.Strings[0] = (wchar_t *)target.WideAlias.c_str();
+            PropertyTagArray_r *mids = NULL;
+            PropertyRowSet_r *rows = NULL;
+            status = CallNspi([&]() { return m_resolveNamesW(handle, 0, &stat, (PropertyTagArray_r *)&m_columns, &names, &mids, &rows); }, fault);
+            m_freeBuffer(mids);
+            m_freeRowSet(rows);
+        }
+
+        break;
+
+    case LoadNspiDNToMId:
+        status = MapDN(session, target.UserDN, NULL, fault);
+        break;
+
+    case LoadNspiGetProps:
+        {
+            STAT stat;
+            ResetStat(&stat);
+            stat.CurrentRec = session->MId;
+            PropertyRow_r *row = NULL;
+            status = CallNspi([&]() { return m_getProps(handle, 0, &stat, (PropertyTagArray_r *)&m_columns, &row); }, fault);
+            status = status == ErrorsReturned ? 0 : status;
+            m_freeRow(row);
+        }
+
+        break;
+
+    default:
+        status = ERROR_INVALID_PARAMETER;
+        break;
+    }
+
+    if (fault)
+    {
+        result->Backoffs += status == RPC_S_SERVER_TOO_BUSY ? 1 : 0;
+        if (status != RPC_S_SERVER_TOO_BUSY)
+        {
+            DropSession(session);
+        }
+    }
+
+    result->Status = status;
+}
+
+/// <summary>
+/// Unbind a session and free it.
+/// </summary>
+/// <param name="session">The session.</param>
+void NspiLoadDisconnect(NspiLoadSession *session)
+{
+    if (session->Handle != NULL)
+    {
+        bool fault;
+        NSPI_HANDLE *handle = &session->Handle;
+        CallNspi([&]() { return (long)m_unbind(handle, 0); }, fault);
+        DropSession(session);
+    }
+
+    delete session;
+}
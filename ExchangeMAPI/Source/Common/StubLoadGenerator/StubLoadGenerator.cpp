@@ -0,0 +1,1154 @@
+#include "LoadGenerator.h"
+#include <mmsystem.h>
+#include <intrin.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <random>
+#include <vector>
+
+// Open-loop load generator over the MS-OXCRPC and MS-OXNSPI stubs. It connects N sessions spread over M users, each
+// with a MapiSession logged on to the mailbox of its user and an NSPI context handle, and sends a weighted mix of ROP
+// and NSPI operations at a target rate for a given time.
+//
+// The arrivals are scheduled in advance, at a fixed spacing or as a Poisson process, and do not wait for earlier
+// requests to complete: an arrival is queued at its scheduled time, a worker runs it on the next idle session, and its
+// latency is measured from the scheduled time, not from when it was sent. A slow server therefore shows as latency
+// and queueing rather than as a lower send rate, which a closed loop, one request per session after another, would
+// hide (coordinated omission). An arrival that finds the queue full, or that has not run when the run ends, is counted
+// as dropped. A session that is told to back off is parked until the time the server asked has passed before it takes
+// another request, as a client honoring RopBackoff would wait; the worker that ran it goes on with other sessions.
+//
+// Every interval, and once more for the whole run, it prints by operation the completed operations, their rate, the
+// errors, the backoffs and the dropped arrivals, and the latency percentiles from histograms with the buckets of
+// StubMetrics. /json prints the same as one JSON object per line.
+//
+// Usage: StubLoadGenerator /server <name> (/users <file> | /userdn <dn> ...) [/sessions <n>] [/rate <per second>]
+//        [/duration <seconds>] [/mix <operation>=<weight>,...] [/json] [other options, see PrintUsage]
+
+/// <summary>
+/// The defaults of the options.
+/// </summary>
+static const unsigned long DefaultSessions = 10;
+static const double DefaultRate = 10.0;
+static const unsigned long DefaultDuration = 60;
+static const unsigned long DefaultInterval = 10;
+static const unsigned long DefaultMaxQueue = 100000;
+static const unsigned long MaxWorkers = 512;
+static const unsigned short DefaultRowCount = 50;
+
+/// <summary>
+/// The seconds the requests still queued at the end of the run are given to complete.
+/// </summary>
+static const unsigned long DrainTime = 30;
+
+/// <summary>
+/// The longest a session is parked for a RopBackoff, in milliseconds.
+/// </summary>
+static const unsigned long MaxBackoffTime = 60000;
+
+/// <summary>
+/// The latency buckets, as those of StubMetrics: one per microsecond below 32, then 16 per power of two.
+/// </summary>
+static const unsigned long BucketCount = 464;
+
+/// <summary>
+/// The number of distinct error codes counted for an operation; the errors with other codes are counted together.
+/// </summary>
+static const unsigned long ErrorCodeCount = 8;
+
+/// <summary>
+/// The names of the operations on the command line and in the reports, and their default weights.
+/// </summary>
+static const char *const m_operationNames[LoadOperationCount] =
+{
+    "contents",
+    "hierarchy",
+    "folderprops",
+    "nspi.queryrows",
+    "nspi.resolvenames",
+    "nspi.dntomid",
+    "nspi.getprops"
+};
+
+static const unsigned long m_defaultMix[LoadOperationCount] = { 40, 10, 20, 10, 10, 5, 5 };
+
+/// <summary>
+/// The counters of one operation, over an interval or over the run.
+/// </summary>
+struct OperationStats
+{
+    unsigned __int64 Completed;             // Operations that ran, failed ones included.
+    unsigned __int64 Errors;
+    unsigned __int64 Backoffs;
+    unsigned __int64 Dropped;               // Arrivals that found the queue full or did not run before the end.
+    unsigned __int64 TotalLatency;          // Microseconds from the scheduled time to completion.
+    unsigned __int64 TotalService;          // Microseconds from the start of the request to completion.
+    unsigned long MaxLatency;
+    unsigned long MaxBackoffTime;           // The longest Duration a RopBackoff asked for, in milliseconds.
+    unsigned long ErrorCodesUsed;           // The entries of ErrorCodes in use.
+    long ErrorCodes[ErrorCodeCount];
+    unsigned __int64 ErrorCounts[ErrorCodeCount];
+    unsigned __int64 OtherErrors;           // Errors whose code did not fit in ErrorCodes.
+    unsigned __int64 Buckets[BucketCount];
+};
+
+/// <summary>
+/// The counters a thread records into; the reporter takes them every interval.
+/// </summary>
+struct StatsSlot
+{
+    SRWLOCK Lock;
+    OperationStats Operations[LoadOperationCount];
+};
+
+/// <summary>
+/// A session of a user, with its EMSMDB and NSPI sides; either is NULL if the mix has no operation for it.
+/// </summary>
+struct Session
+{
+    const LoadUser *User;
+    EmsmdbLoadSession *Emsmdb;
+    NspiLoadSession *Nspi;
+    unsigned __int64 NotBefore;             // Performance counter ticks; a parked session takes no request before.
+};
+
+/// <summary>
+/// An arrival waiting for a session.
+/// </summary>
+struct Request
+{
+    LoadOperation Operation;
+    unsigned __int64 Scheduled;             // Performance counter ticks.
+};
+
+/// <summary>
+/// The settings of the run.
+/// </summary>
+static LoadOptions m_options;
+static std::vector<LoadUser> m_users;
+static unsigned long m_sessionCount = DefaultSessions;
+static unsigned long m_workerCount = 0;
+static double m_rate = DefaultRate;
+static unsigned long m_duration = DefaultDuration;
+static unsigned long m_interval = DefaultInterval;
+static unsigned long m_maxQueue = DefaultMaxQueue;
+static unsigned long m_mix[LoadOperationCount];
+static bool m_poisson = true;
+static bool m_json = false;
+
+/// <summary>
+/// The queue of arrivals, the idle sessions and the sessions parked for a RopBackoff, guarded by m_lock; m_ready is
+/// signaled when any of them grows.
+/// </summary>
+static SRWLOCK m_lock = SRWLOCK_INIT;
+static CONDITION_VARIABLE m_ready = CONDITION_VARIABLE_INIT;
+static std::deque<Request> m_requests;
+static std::deque<Session *> m_idle;
+static std::vector<Session *> m_parked;
+static unsigned long m_running = 0;
+static bool m_stopping = false;
+
+/// <summary>
+/// Set when Ctrl+C is pressed, to end the run early.
+/// </summary>
+static HANDLE m_stopEvent = NULL;
+
+/// <summary>
+/// Set when the workers have stopped, for the reporter to print the last interval.
+/// </summary>
+static HANDLE m_reportEvent = NULL;
+
+static std::vector<Session> m_sessions;
+static std::vector<StatsSlot *> m_slots;
+static OperationStats m_totals[LoadOperationCount];
+static unsigned __int64 m_frequency = 0;
+static unsigned __int64 m_start = 0;
+static volatile LONG m_nextSession = -1;
+static volatile LONG m_connectFailures = 0;
+static volatile LONG m_lastConnectError = 0;
+
+/// <summary>
+/// Read the performance counter.
+/// </summary>
+static unsigned __int64 Now()
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return (unsigned __int64)now.QuadPart;
+}
+
+/// <summary>
+/// Convert performance counter ticks to microseconds, up to the range of a bucket.
+/// </summary>
+static unsigned long TicksToMicroseconds(unsigned __int64 ticks)
+{
+    unsigned __int64 microseconds = ticks / m_frequency * 1000000 + ticks % m_frequency * 1000000 / m_frequency;
+    return microseconds > 0xFFFFFFFF ? 0xFFFFFFFF : (unsigned long)microseconds;
+}
+
+/// <summary>
+/// Get the bucket of a latency, in microseconds.
+/// </summary>
+static unsigned long BucketIndex(unsigned long duration)
+{
+    if (duration < 32)
+    {
+        return duration;
+    }
+
+    unsigned long exponent;
+    _BitScanReverse(&exponent, duration);
+    return 32 + (exponent - 5) * 16 + ((duration >> (exponent - 4)) & 15);
+}
+
+/// <summary>
+/// Get the highest latency of a bucket, in microseconds.
+/// </summary>
+static unsigned long BucketBound(unsigned long bucket)
+{
+    if (bucket < 32)
+    {
+        return bucket;
+    }
+
+    unsigned long exponent = 5 + (bucket - 32) / 16;
+    unsigned __int64 lower = (unsigned __int64)(16 + (bucket - 32) % 16) << (exponent - 4);
+    unsigned __int64 upper = lower + ((unsigned __int64)1 << (exponent - 4)) - 1;
+    return upper > 0xFFFFFFFF ? 0xFFFFFFFF : (unsigned long)upper;
+}
+
+/// <summary>
+/// Get the latency below which the given fraction, in thousandths, of the operations fall, in microseconds.
+/// </summary>
+static unsigned long Percentile(const OperationStats &stats, unsigned long thousandths)
+{
+    if (stats.Completed == 0)
+    {
+        return 0;
+    }
+
+    unsigned __int64 rank = (stats.Completed * thousandths + 999) / 1000;
+    unsigned __int64 seen = 0;
+    for (unsigned long bucket = 0; bucket < BucketCount; bucket++)
+    {
+        seen += stats.Buckets[bucket];
+        if (seen >= rank && seen > 0)
+        {
+            unsigned long bound = BucketBound(bucket);
+            return bound < stats.MaxLatency ? bound : stats.MaxLatency;
+        }
+    }
+
+    return stats.MaxLatency;
+}
+
+/// <summary>
+/// Count an error code of an operation.
+/// </summary>
+static void CountErrorCode(OperationStats &stats, long code, unsigned __int64 count)
+{
+    unsigned long index = 0;
+    while (index < stats.ErrorCodesUsed && stats.ErrorCodes[index] != code)
+    {
+        index++;
+    }
+
+    if (index < stats.ErrorCodesUsed)
+    {
+        stats.ErrorCounts[index] += count;
+    }
+    else if (stats.ErrorCodesUsed < ErrorCodeCount)
+    {
+        stats.ErrorCodes[index] = code;
+        stats.ErrorCounts[index] = count;
+        stats.ErrorCodesUsed++;
+    }
+    else
+    {
+        stats.OtherErrors += count;
+    }
+}
+
+/// <summary>
+/// Add the counters of an operation to others.
+/// </summary>
+static void AddStats(OperationStats &total, const OperationStats &part)
+{
+    total.Completed += part.Completed;
+    total.Errors += part.Errors;
+    total.Backoffs += part.Backoffs;
+    total.Dropped += part.Dropped;
+    total.TotalLatency += part.TotalLatency;
+    total.TotalService += part.TotalService;
+    total.MaxLatency = std::max(total.MaxLatency, part.MaxLatency);
+    total.MaxBackoffTime = std::max(total.MaxBackoffTime, part.MaxBackoffTime);
+    for (unsigned long i = 0; i < part.ErrorCodesUsed; i++)
+    {
+        CountErrorCode(total, part.ErrorCodes[i], part.ErrorCounts[i]);
+    }
+
+    total.OtherErrors += part.OtherErrors;
+    for (unsigned long bucket = 0; bucket < BucketCount; bucket++)
+    {
+        total.Buckets[bucket] += part.Buckets[bucket];
+    }
+}
+
+/// <summary>
+/// Count an operation that ran in the slot of the calling thread.
+/// </summary>
+static void Record(StatsSlot *slot, LoadOperation operation, const LoadResult &result, unsigned long latency, unsigned long service)
+{
+    AcquireSRWLockExclusive(&slot->Lock);
+    OperationStats &stats = slot->Operations[operation];
+    stats.Completed++;
+    stats.Backoffs += result.Backoffs;
+    stats.TotalLatency += latency;
+    stats.TotalService += service;
+    stats.MaxLatency = std::max(stats.MaxLatency, latency);
+    stats.MaxBackoffTime = std::max(stats.MaxBackoffTime, result.BackoffMilliseconds);
+    stats.Buckets[BucketIndex(latency)]++;
+    if (result.Status != 0)
+    {
+        stats.Errors++;
+        CountErrorCode(stats, result.Status, 1);
+    }
+
+    ReleaseSRWLockExclusive(&slot->Lock);
+}
+
+/// <summary>
+/// Count arrivals that did not run.
+/// </summary>
+static void RecordDropped(StatsSlot *slot, LoadOperation operation, unsigned __int64 count)
+{
+    AcquireSRWLockExclusive(&slot->Lock);
+    slot->Operations[operation].Dropped += count;
+    ReleaseSRWLockExclusive(&slot->Lock);
+}
+
+/// <summary>
+/// Allocate a zeroed counter slot for a thread.
+/// </summary>
+static StatsSlot *CreateSlot()
+{
+    StatsSlot *slot = new StatsSlot();
+    InitializeSRWLock(&slot->Lock);
+    m_slots.push_back(slot);
+    return slot;
+}
+
+/// <summary>
+/// Whether the mix has EMSMDB operations, or NSPI operations.
+/// </summary>
+static bool MixUses(bool nspi)
+{
+    for (int operation = 0; operation < LoadOperationCount; operation++)
+    {
+        if (m_mix[operation] != 0 && (operation >= LoadNspiQueryRows) == nspi)
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// <summary>
+/// Give a stub the identity of the run and bind it to the server.
+/// </summary>
+/// <param name="module">The stub.</param>
+/// <param name="options">The settings of the run.</param>
+/// <returns>If success, it returns 0, else returns the error code</returns>
+long LoadBindStub(HMODULE module, const LoadOptions &options)
+{
+    CREATE_IDENTITY_ROUTINE createIdentity;
+    BIND_TO_SERVER_ROUTINE bindToServer;
+    if (!ResolveRoutine(module, "CreateIdentity", createIdentity) || !ResolveRoutine(module, "BindToServer", bindToServer))
+    {
+        return ERROR_PROC_NOT_FOUND;
+    }
+
+    createIdentity(options.Domain.c_str(), options.UserName.c_str(), options.Password.c_str());
+    return (long)bindToServer(
+        options.Server.c_str(),
+        options.AuthenticationLevel,
+        options.AuthenticationService,
+        options.Sequence.c_str(),
+        options.RpchUseSsl,
+        options.RpchAuthScheme.c_str(),
+        options.Spn.c_str(),
+        NULL,
+        false);
+}
+
+/// <summary>
+/// Connect the sessions not yet taken by another connecting thread.
+/// </summary>
+static DWORD WINAPI ConnectThread(void *parameter)
+{
+    UNREFERENCED_PARAMETER(parameter);
+    bool emsmdb = MixUses(false);
+    bool nspi = MixUses(true);
+    LONG index;
+    while ((index = InterlockedIncrement(&m_nextSession)) < (LONG)m_sessions.size())
+    {
+        Session &session = m_sessions[index];
+        long status = emsmdb ? EmsmdbLoadConnect(m_options, *session.User, &session.Emsmdb) : 0;
+        if (status == 0 && nspi)
+        {
+            status = NspiLoadConnect(m_options, *session.User, &session.Nspi);
+        }
+
+        if (status != 0)
+        {
+            InterlockedIncrement(&m_connectFailures);
+            InterlockedExchange(&m_lastConnectError, status);
+        }
+    }
+
+    return 0;
+}
+
+/// <summary>
+/// Make the parked sessions whose backoff has passed idle. The caller MUST hold m_lock.
+/// </summary>
+/// <returns>The milliseconds until the next parked session can be made idle, or INFINITE if none is parked.</returns>
+static DWORD WakeParked(unsigned __int64 now)
+{
+    unsigned __int64 next = 0;
+    for (size_t i = 0; i < m_parked.size();)
+    {
+        Session *session = m_parked[i];
+        if (session->NotBefore <= now)
+        {
+            m_idle.push_back(session);
+            m_parked[i] = m_parked.back();
+            m_parked.pop_back();
+            continue;
+        }
+
+        if (next == 0 || session->NotBefore < next)
+        {
+            next = session->NotBefore;
+        }
+
+        i++;
+    }
+
+    return next == 0 ? INFINITE : (DWORD)((next - now) * 1000 / m_frequency) + 1;
+}
+
+/// <summary>
+/// Run arrivals on idle sessions until the run stops.
+/// </summary>
+static DWORD WINAPI WorkerThread(void *parameter)
+{
+    StatsSlot *slot = (StatsSlot *)parameter;
+    std::mt19937 random(GetCurrentThreadId());
+    AcquireSRWLockExclusive(&m_lock);
+    for (;;)
+    {
+        while (!m_stopping)
+        {
+            DWORD wait = WakeParked(Now());
+            if (!m_requests.empty() && !m_idle.empty())
+            {
+                break;
+            }
+
+            SleepConditionVariableSRW(&m_ready, &m_lock, wait, 0);
+        }
+
+        if (m_stopping)
+        {
+            break;
+        }
+
+        Request request = m_requests.front();
+        m_requests.pop_front();
+        Session *session = m_idle.front();
+        m_idle.pop_front();
+        m_running++;
+        ReleaseSRWLockExclusive(&m_lock);
+
+        unsigned __int64 start = Now();
+        LoadResult result;
+        if (request.Operation < LoadNspiQueryRows)
+        {
+            EmsmdbLoadExecute(session->Emsmdb, request.Operation, &result);
+        }
+        else
+        {
+            NspiLoadExecute(session->Nspi, request.Operation, m_users[random() % m_users.size()], &result);
+        }
+
+        unsigned __int64 end = Now();
+        Record(slot, request.Operation, result, TicksToMicroseconds(end - request.Scheduled), TicksToMicroseconds(end - start));
+        AcquireSRWLockExclusive(&m_lock);
+        if (result.BackoffMilliseconds != 0)
+        {
+            session->NotBefore = end + (unsigned __int64)std::min(result.BackoffMilliseconds, MaxBackoffTime) * m_frequency / 1000;
+            m_parked.push_back(session);
+        }
+        else
+        {
+            m_idle.push_back(session);
+        }
+
+        m_running--;
+        WakeConditionVariable(&m_ready);
+    }
+
+    ReleaseSRWLockExclusive(&m_lock);
+    return 0;
+}
+
+/// <summary>
+/// Pick the operation of an arrival by the weights of the mix.
+/// </summary>
+static LoadOperation PickOperation(unsigned long draw)
+{
+    int operation = 0;
+    while (draw >= m_mix[operation])
+    {
+        draw -= m_mix[operation];
+        operation++;
+    }
+
+    return (LoadOperation)operation;
+}
+
+/// <summary>
+/// Queue the arrivals at their scheduled times until the end of the run, or until it is stopped.
+/// </summary>
+static void Schedule(StatsSlot *slot, unsigned __int64 end)
+{
+    unsigned long totalWeight = 0;
+    for (int operation = 0; operation < LoadOperationCount; operation++)
+    {
+        totalWeight += m_mix[operation];
+    }
+
+    std::mt19937_64 random(m_start);
+    std::exponential_distribution<double> spacing(m_rate);
+    std::uniform_int_distribution<unsigned long> draw(0, totalWeight - 1);
+    double offset = 0;
+    for (;;)
+    {
+        unsigned __int64 now = Now();
+        unsigned __int64 scheduled = m_start + (unsigned __int64)(offset * m_frequency);
+        while (scheduled <= now && scheduled < end)
+        {
+            LoadOperation operation = PickOperation(draw(random));
+            AcquireSRWLockExclusive(&m_lock);
+            bool queued = m_requests.size() < m_maxQueue;
+            if (queued)
+            {
+                m_requests.push_back(Request { operation, scheduled });
+                WakeConditionVariable(&m_ready);
+            }
+
+            ReleaseSRWLockExclusive(&m_lock);
+            if (!queued)
+            {
+                RecordDropped(slot, operation, 1);
+            }
+
+            offset += m_poisson ? spacing(random) : 1.0 / m_rate;
+            scheduled = m_start + (unsigned __int64)(offset * m_frequency);
+        }
+
+        if (scheduled >= end)
+        {
+            // Wait out the rest of the run, so that the last interval is as long as the others.
+            scheduled = end;
+        }
+
+        if (now >= end)
+        {
+            return;
+        }
+
+        DWORD wait = (DWORD)((scheduled - now) * 1000 / m_frequency);
+        if (WaitForSingleObject(m_stopEvent, wait) == WAIT_OBJECT_0)
+        {
+            return;
+        }
+    }
+}
+
+/// <summary>
+/// Print the counters of an operation, or of all operations, over an interval or the run.
+/// </summary>
+static void PrintStats(const char *name, const OperationStats &stats, double time, double seconds, bool summary)
+{
+    double perSecond = seconds > 0 ? stats.Completed / seconds : 0;
+    double meanService = stats.Completed != 0 ? stats.TotalService / 1000.0 / stats.Completed : 0;
+    if (m_json)
+    {
+        printf("{\"time\":%.1f,\"operation\":\"%s\",\"summary\":%s,\"completed\":%llu,\"perSecond\":%.2f,\"errors\":%llu,\"backoffs\":%llu,\"dropped\":%llu,"
+            "\"latencyMs\":{\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"p999\":%.3f,\"max\":%.3f},\"serviceMs\":%.3f,\"maxBackoffMs\":%lu",
+            time, name, summary ? "true" : "false", stats.Completed, perSecond, stats.Errors, stats.Backoffs, stats.Dropped,
+            Percentile(stats, 500) / 1000.0, Percentile(stats, 900) / 1000.0, Percentile(stats, 990) / 1000.0, Percentile(stats, 999) / 1000.0,
+            stats.MaxLatency / 1000.0, meanService, stats.MaxBackoffTime);
+        printf(",\"errorCodes\":{");
+        for (unsigned long i = 0; i < stats.ErrorCodesUsed; i++)
+        {
+            printf("%s\"0x%08lX\":%llu", i == 0 ? "" : ",", (unsigned long)stats.ErrorCodes[i], stats.ErrorCounts[i]);
+        }
+
+        if (stats.OtherErrors != 0)
+        {
+            printf(",\"other\":%llu", stats.OtherErrors);
+        }
+
+        printf("}}\n");
+        return;
+    }
+
+    printf("%7.0f  %-18s %9llu %9.1f %7llu %8llu %8llu %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+        time, name, stats.Completed, perSecond, stats.Errors, stats.Backoffs, stats.Dropped,
+        Percentile(stats, 500) / 1000.0, Percentile(stats, 900) / 1000.0, Percentile(stats, 990) / 1000.0, Percentile(stats, 999) / 1000.0,
+        stats.MaxLatency / 1000.0, meanService);
+}
+
+/// <summary>
+/// Print the header of the table of an interval.
+/// </summary>
+static void PrintHeader()
+{
+    if (!m_json)
+    {
+        printf("\n%7s  %-18s %9s %9s %7s %8s %8s %9s %9s %9s %9s %9s %9s\n",
+            "Time", "Operation", "Done", "Ops/s", "Errors", "Backoffs", "Dropped", "P50 ms", "P90 ms", "P99 ms", "P99.9 ms", "Max ms", "Svc ms");
+    }
+}
+
+/// <summary>
+/// Print the operations that had any activity, and the total of all of them.
+/// </summary>
+static void PrintTable(const OperationStats *operations, double time, double seconds, bool summary)
+{
+    PrintHeader();
+    OperationStats *all = new OperationStats();
+    for (int operation = 0; operation < LoadOperationCount; operation++)
+    {
+        if (operations[operation].Completed != 0 || operations[operation].Dropped != 0)
+        {
+            PrintStats(m_operationNames[operation], operations[operation], time, seconds, summary);
+            AddStats(*all, operations[operation]);
+        }
+    }
+
+    PrintStats("all", *all, time, seconds, summary);
+    delete all;
+    fflush(stdout);
+}
+
+/// <summary>
+/// Take the counters of every slot, print them as an interval and add them to the totals, until the workers stop.
+/// </summary>
+static DWORD WINAPI ReportThread(void *parameter)
+{
+    UNREFERENCED_PARAMETER(parameter);
+    OperationStats *interval = new OperationStats[LoadOperationCount];
+    unsigned __int64 last = m_start;
+    bool stopped = false;
+    while (!stopped)
+    {
+        stopped = WaitForSingleObject(m_reportEvent, m_interval * 1000) == WAIT_OBJECT_0;
+        memset(interval, 0, sizeof(OperationStats) * LoadOperationCount);
+        for (size_t i = 0; i < m_slots.size(); i++)
+        {
+            AcquireSRWLockExclusive(&m_slots[i]->Lock);
+            for (int operation = 0; operation < LoadOperationCount; operation++)
+            {
+                AddStats(interval[operation], m_slots[i]->Operations[operation]);
+            }
+
+            memset(m_slots[i]->Operations, 0, sizeof(m_slots[i]->Operations));
+            ReleaseSRWLockExclusive(&m_slots[i]->Lock);
+        }
+
+        unsigned __int64 now = Now();
+        PrintTable(interval, (double)(now - m_start) / m_frequency, (double)(now - last) / m_frequency, false);
+        for (int operation = 0; operation < LoadOperationCount; operation++)
+        {
+            AddStats(m_totals[operation], interval[operation]);
+        }
+
+        last = now;
+    }
+
+    delete[] interval;
+    return 0;
+}
+
+/// <summary>
+/// Wait for threads to end and close them; one at a time, as there can be more than MAXIMUM_WAIT_OBJECTS.
+/// </summary>
+static void WaitForThreads(std::vector<HANDLE> &threads)
+{
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+    }
+
+    threads.clear();
+}
+
+/// <summary>
+/// End the run early on Ctrl+C.
+/// </summary>
+static BOOL WINAPI ConsoleHandler(DWORD controlType)
+{
+    if (controlType == CTRL_C_EVENT || controlType == CTRL_BREAK_EVENT)
+    {
+        SetEvent(m_stopEvent);
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+/// <summary>
+/// Add a user, with the alias NspiResolveNamesW resolves taken from the last cn of its DN.
+/// </summary>
+static void AddUser(const std::string &userDN, const std::string &mailStoreUrl, const std::string &userName, const std::string &password)
+{
+    LoadUser user;
+    user.UserDN = userDN;
+    user.MailStoreUrl = mailStoreUrl;
+    user.UserName = userName;
+    user.Password = password;
+    std::string lower = userDN;
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+    size_t cn = lower.rfind("/cn=");
+    user.Alias = cn == std::string::npos ? userDN : userDN.substr(cn + 4);
+    int length = MultiByteToWideChar(CP_ACP, 0, user.Alias.c_str(), -1, NULL, 0);
+    user.WideAlias.resize(length > 0 ? length - 1 : 0);
+    if (length > 1)
+    {
+        MultiByteToWideChar(CP_ACP, 0, user.Alias.c_str(), -1, &user.WideAlias[0], length);
+    }
+    m_users.push_back(user);
+}
+
+/// <summary>
+/// Read the users of the run from a file: one user per line, the DN and optionally, separated by tabs, the mail store
+/// URL, the user name and the password of a MAPI/HTTP session. Empty lines and lines starting with # are skipped.
+/// </summary>
+static long LoadUsers(const char *path)
+{
+    FILE *file = NULL;
+    if (fopen_s(&file, path, "r") != 0 || file == NULL)
+    {
+        return ERROR_FILE_NOT_FOUND;
+    }
+
+    char line[4096];
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+        {
+            continue;
+        }
+
+        std::string fields[4];
+        char *context = NULL;
+        char *field = strtok_s(line, "\t", &context);
+        for (int i = 0; i < 4 && field != NULL; i++)
+        {
+            fields[i] = field;
+            field = strtok_s(NULL, "\t", &context);
+        }
+
+        AddUser(fields[0], fields[1], fields[2], fields[3]);
+    }
+
+    fclose(file);
+    return 0;
+}
+
+/// <summary>
+/// Parse a mix of operation=weight pairs separated by commas; the operations not named get no weight.
+/// </summary>
+static bool ParseMix(const char *text)
+{
+    memset(m_mix, 0, sizeof(m_mix));
+    std::string mix = text;
+    size_t position = 0;
+    while (position < mix.size())
+    {
+        size_t comma = mix.find(',', position);
+        std::string pair = mix.substr(position, comma == std::string::npos ? std::string::npos : comma - position);
+        position = comma == std::string::npos ? mix.size() : comma + 1;
+        size_t equals = pair.find('=');
+        if (equals == std::string::npos)
+        {
+            return false;
+        }
+
+        std::string name = pair.substr(0, equals);
+        int operation = 0;
+        while (operation < LoadOperationCount && _stricmp(name.c_str(), m_operationNames[operation]) != 0)
+        {
+            operation++;
+        }
+
+        if (operation == LoadOperationCount)
+        {
+            return false;
+        }
+
+        m_mix[operation] = strtoul(pair.c_str() + equals + 1, NULL, 10);
+    }
+
+    return MixUses(false) || MixUses(true);
+}
+
+/// <summary>
+/// Print how to run the tool.
+/// </summary>
+static void PrintUsage()
+{
+    printf(
+        "Usage: StubLoadGenerator /server <name> (/users <file> | /userdn <dn> ...) [options]\n"
+        "\n"
+        "Load:\n"
+        "  /sessions <n>        The sessions, spread over the users in turn. The default is %lu.\n"
+        "  /workers <n>         The operations run at once. The default is the number of sessions, up to %lu.\n"
+        "  /rate <n>            The arrivals per second. The default is %.0f.\n"
+        "  /uniform             Space the arrivals evenly instead of as a Poisson process.\n"
+        "  /duration <s>        The seconds arrivals are scheduled for. The default is %lu.\n"
+        "  /interval <s>        The seconds between reports. The default is %lu.\n"
+        "  /maxqueue <n>        The arrivals that may wait for a session before more are dropped. The default is %lu.\n"
+        "  /mix <op>=<w>,...    The weights of the operations; the default is contents=40,hierarchy=10,folderprops=20,\n"
+        "                       nspi.queryrows=10,nspi.resolvenames=10,nspi.dntomid=5,nspi.getprops=5.\n"
+        "  /rows <n>            The rows a table or GAL page holds. The default is %u.\n"
+        "  /json                Print every report line as a JSON object.\n"
+        "\n"
+        "Connection:\n"
+        "  /users <file>        A user per line: the DN, and for MAPI/HTTP the mail store URL, user name and password,\n"
+        "                       separated by tabs.\n"
+        "  /userdn <dn>         A user; it can be repeated.\n"
+        "  /domain, /user, /password  The identity of the RPC bindings, and of MAPI/HTTP users without one.\n"
+        "  /seq <sequence>      ncacn_ip_tcp, the default, or ncacn_http.\n"
+        "  /authlevel <n>       The RPC authentication level. The default is 6.\n"
+        "  /authservice <n>     The RPC authentication service. The default is 10.\n"
+        "  /spn <spn>           The service principal name for Kerberos.\n"
+        "  /rpchauth <scheme>   Basic, the default, or NTLM, for ncacn_http.\n"
+        "  /ssl                 Use SSL for ncacn_http.\n"
+        "  /mapihttp            Connect the EMSMDB sessions over MAPI/HTTP; NSPI stays on RPC.\n"
+        "  /emsmdb <dll>        The MS-OXCRPC stub. The default is MS-OXCRPC_RPCStub.dll.\n"
+        "  /nspi <dll>          The MS-OXNSPI stub. The default is MS-OXNSPI_Stub.dll.\n",
+        DefaultSessions, MaxWorkers, DefaultRate, DefaultDuration, DefaultInterval, DefaultMaxQueue, DefaultRowCount);
+}
+
+int main(int argc, char *argv[])
+{
+    m_options.EmsmdbDll = "MS-OXCRPC_RPCStub.dll";
+    m_options.NspiDll = "MS-OXNSPI_Stub.dll";
+    m_options.Sequence = "ncacn_ip_tcp";
+    m_options.RpchAuthScheme = "Basic";
+    m_options.AuthenticationLevel = 6;
+    m_options.AuthenticationService = 10;
+    m_options.RpchUseSsl = false;
+    m_options.MapiHttp = false;
+    m_options.RowCount = DefaultRowCount;
+    memcpy(m_mix, m_defaultMix, sizeof(m_mix));
+    for (int i = 1; i < argc; i++)
+    {
+        const char *option = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        bool valid = true;
+        if (_stricmp(option, "/uniform") == 0)
+        {
+            m_poisson = false;
+            continue;
+        }
+        else if (_stricmp(option, "/json") == 0)
+        {
+            m_json = true;
+            continue;
+        }
+        else if (_stricmp(option, "/ssl") == 0)
+        {
+            m_options.RpchUseSsl = true;
+            continue;
+        }
+        else if (_stricmp(option, "/mapihttp") == 0)
+        {
+            m_options.MapiHttp = true;
+            continue;
+        }
+        else if (value == NULL)
+        {
+            valid = false;
+        }
+        else if (_stricmp(option, "/server") == 0)
+        {
+            m_options.Server = value;
+        }
+        else if (_stricmp(option, "/users") == 0)
+        {
+            long status = LoadUsers(value);
+            if (status != 0)
+            {
+                fprintf(stderr, "Cannot read the users file %s: error %ld.\n", value, status);
+                return status;
+            }
+        }
+        else if (_stricmp(option, "/userdn") == 0)
+        {
+            AddUser(value, std::string(), std::string(), std::string());
+        }
+        else if (_stricmp(option, "/domain") == 0)
+        {
+            m_options.Domain = value;
+        }
+        else if (_stricmp(option, "/user") == 0)
+        {
+            m_options.UserName = value;
+        }
+        else if (_stricmp(option, "/password") == 0)
+        {
+            m_options.Password = value;
+        }
+        else if (_stricmp(option, "/seq") == 0)
+        {
+            m_options.Sequence = value;
+        }
+        else if (_stricmp(option, "/authlevel") == 0)
+        {
+            m_options.AuthenticationLevel = atoi(value);
+        }
+        else if (_stricmp(option, "/authservice") == 0)
+        {
+            m_options.AuthenticationService = atoi(value);
+        }
+        else if (_stricmp(option, "/spn") == 0)
+        {
+            m_options.Spn = value;
+        }
+        else if (_stricmp(option, "/rpchauth") == 0)
+        {
+            m_options.RpchAuthScheme = value;
+        }
+        else if (_stricmp(option, "/emsmdb") == 0)
+        {
+            m_options.EmsmdbDll = value;
+        }
+        else if (_stricmp(option, "/nspi") == 0)
+        {
+            m_options.NspiDll = value;
+        }
+        else if (_stricmp(option, "/sessions") == 0)
+        {
+            m_sessionCount = strtoul(value, NULL, 10);
+            valid = m_sessionCount != 0;
+        }
+        else if (_stricmp(option, "/workers") == 0)
+        {
+            m_workerCount = strtoul(value, NULL, 10);
+            valid = m_workerCount != 0;
+        }
+        else if (_stricmp(option, "/rate") == 0)
+        {
+            m_rate = atof(value);
+            valid = m_rate > 0;
+        }
+        else if (_stricmp(option, "/duration") == 0)
+        {
+            m_duration = strtoul(value, NULL, 10);
+            valid = m_duration != 0;
+        }
+        else if (_stricmp(option, "/interval") == 0)
+        {
+            m_interval = strtoul(value, NULL, 10);
+            valid = m_interval != 0;
+        }
+        else if (_stricmp(option, "/maxqueue") == 0)
+        {
+            m_maxQueue = strtoul(value, NULL, 10);
+        }
+        else if (_stricmp(option, "/rows") == 0)
+        {
+            unsigned long rows = strtoul(value, NULL, 10);
+            m_options.RowCount = (unsigned short)rows;
+            valid = rows != 0 && rows <= 0xFFFF;
+        }
+        else if (_stricmp(option, "/mix") == 0)
+        {
+            valid = ParseMix(value);
+        }
+        else
+        {
+            valid = false;
+        }
+
+        if (!valid)
+        {
+            PrintUsage();
+            return ERROR_INVALID_PARAMETER;
+        }
+
+        i++;
+    }
+
+    if (m_users.empty() || (m_options.Server.empty() && !(m_options.MapiHttp && !MixUses(true))))
+    {
+        PrintUsage();
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    long status = MixUses(false) ? EmsmdbLoadInitialize(m_options) : 0;
+    if (status != 0)
+    {
+        fprintf(stderr, "Cannot load or bind the MS-OXCRPC stub %s: error %ld.\n", m_options.EmsmdbDll.c_str(), status);
+        return status;
+    }
+
+    status = MixUses(true) ? NspiLoadInitialize(m_options) : 0;
+    if (status != 0)
+    {
+        fprintf(stderr, "Cannot load or bind the MS-OXNSPI stub %s: error %ld.\n", m_options.NspiDll.c_str(), status);
+        return status;
+    }
+
+    LARGE_INTEGER frequency;
+    QueryPerformanceFrequency(&frequency);
+    m_frequency = (unsigned __int64)frequency.QuadPart;
+    m_workerCount = m_workerCount != 0 ? m_workerCount : std::min(m_sessionCount, MaxWorkers);
+    m_stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    m_reportEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    SetConsoleCtrlHandler(ConsoleHandler, TRUE);
+
+    // Connect the sessions, a user after another, before the load starts.
+    m_sessions.resize(m_sessionCount);
+    for (unsigned long i = 0; i < m_sessionCount; i++)
+    {
+        m_sessions[i].User = &m_users[i % m_users.size()];
+    }
+
+    fprintf(stderr, "Connecting %lu sessions of %u users...\n", m_sessionCount, (unsigned)m_users.size());
+    std::vector<HANDLE> threads;
+    for (unsigned long i = 0; i < std::min(m_workerCount, m_sessionCount); i++)
+    {
+        threads.push_back(CreateThread(NULL, 0, ConnectThread, NULL, 0, NULL));
+    }
+
+    WaitForThreads(threads);
+    for (size_t i = 0; i < m_sessions.size(); i++)
+    {
+        bool connected = (m_sessions[i].Emsmdb != NULL || !MixUses(false)) && (m_sessions[i].Nspi != NULL || !MixUses(true));
+        if (connected)
+        {
+            m_idle.push_back(&m_sessions[i]);
+        }
+    }
+
+    if (m_connectFailures != 0)
+    {
+        fprintf(stderr, "%ld of %lu sessions could not connect; the last error was %ld.\n", m_connectFailures, m_sessionCount, m_lastConnectError);
+    }
+
+    if (m_idle.empty())
+    {
+        return m_lastConnectError;
+    }
+
+    // Run the load: the workers take the arrivals, the reporter prints every interval, and this thread schedules.
+    fprintf(stderr, "Running %.1f operations per second on %u sessions with %lu workers for %lu seconds.\n", m_rate, (unsigned)m_idle.size(), m_workerCount, m_duration);
+    timeBeginPeriod(1);
+    m_start = Now();
+    StatsSlot *schedulerSlot = CreateSlot();
+    for (unsigned long i = 0; i < m_workerCount; i++)
+    {
+        threads.push_back(CreateThread(NULL, 0, WorkerThread, CreateSlot(), 0, NULL));
+    }
+
+    HANDLE reporter = CreateThread(NULL, 0, ReportThread, NULL, 0, NULL);
+    Schedule(schedulerSlot, m_start + (unsigned __int64)m_duration * m_frequency);
+
+    // Give the queued arrivals time to run, then stop the workers and count those left as dropped.
+    unsigned __int64 drainEnd = Now() + (unsigned __int64)DrainTime * m_frequency;
+    for (;;)
+    {
+        AcquireSRWLockShared(&m_lock);
+        bool drained = m_requests.empty() && m_running == 0;
+        ReleaseSRWLockShared(&m_lock);
+        if (drained || Now() >= drainEnd || WaitForSingleObject(m_stopEvent, 100) == WAIT_OBJECT_0)
+        {
+            break;
+        }
+    }
+
+    AcquireSRWLockExclusive(&m_lock);
+    m_stopping = true;
+    WakeAllConditionVariable(&m_ready);
+    ReleaseSRWLockExclusive(&m_lock);
+    SetEvent(m_stopEvent);
+    WaitForThreads(threads);
+    while (!m_requests.empty())
+    {
+        RecordDropped(schedulerSlot, m_requests.front().Operation, 1);
+        m_requests.pop_front();
+    }
+
+    SetEvent(m_reportEvent);
+    WaitForSingleObject(reporter, INFINITE);
+    timeEndPeriod(1);
+    if (!m_json)
+    {
+        printf("\nWhole run:");
+    }
+
+    PrintTable(m_totals, (double)(Now() - m_start) / m_frequency, (double)m_duration, true);
+    if (!m_json)
+    {
+        for (int operation = 0; operation < LoadOperationCount; operation++)
+        {
+            const OperationStats &stats = m_totals[operation];
+            if (stats.Errors == 0)
+            {
+                continue;
+            }
+
+            printf("\nErrors of %s:", m_operationNames[operation]);
+            for (unsigned long i = 0; i < stats.ErrorCodesUsed; i++)
+            {
+                printf(" 0x%08lX x%llu", (unsigned long)stats.ErrorCodes[i], stats.ErrorCounts[i]);
+            }
+
+            if (stats.OtherErrors != 0)
+            {
+                printf(" other x%llu", stats.OtherErrors);
+            }
+        }
+
+        printf("\n");
+    }
+
+    CloseHandle(reporter);
+    for (size_t i = 0; i < m_sessions.size(); i++)
+    {
+        if (m_sessions[i].Emsmdb != NULL)
+        {
+            EmsmdbLoadDisconnect(m_sessions[i].Emsmdb);
+        }
+
+        if (m_sessions[i].Nspi != NULL)
+        {
+            NspiLoadDisconnect(m_sessions[i].Nspi);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,886 @@
+#include <winsock2.h>
+#include <winhttp.h>
+#include "../OXCRPCStub/MapiHttpClient.h"
+#include "../OXCRPCStub/RpcHeaderExt.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Tests of the MAPI/HTTP client against a loopback server. The server is a small Winsock listener on 127.0.0.1 that
+// reads HTTP/1.1 requests with a Content-Length body, records them and answers with the response its handler builds,
+// in chunks with a pause before each one, so the client sees the meta-tags, the additional headers and the body arrive
+// in separate reads, split at any byte. The tests drive MapiHttpConnect, MapiHttpExecute, MapiHttpExecuteEx,
+// MapiHttpNotificationWait and MapiHttpDisconnect as a caller of the stub does: the PROCESSING, PENDING and DONE
+// meta-tags of a chunked response, the request bodies the server receives, the sid and sequence cookies sent back on
+// the next request of their session and only of their session, the reuse of one pooled keep-alive connection by two
+// sessions, and the failures a server reports with X-ResponseCode or an HTTP 503.
+//
+// It prints one line per test and returns the number of tests that failed.
+
+static int m_failures = 0;
+
+/// <summary>
+/// Record the outcome of a check.
+/// </summary>
+static void Check(bool condition, const char *test, const char *what)
+{
+    if (!condition)
+    {
+        printf("FAIL %s: %s\n", test, what);
+        m_failures++;
+    }
+}
+
+/// <summary>
+/// An HTTP request the loopback server received.
+/// </summary>
+struct HttpRequest
+{
+    int Connection;                                 // The TCP connection it came on, numbered from 1.
+    std::string Method;
+    std::string Path;
+    std::map<std::string, std::string> Headers;     // The names are in lower case.
+    std::string Body;
+
+    std::string Header(const char *name) const
+    {
+        std::map<std::string, std::string>::const_iterator it = Headers.find(name);
+        return it == Headers.end() ? std::string() : it->second;
+    }
+};
+
+/// <summary>
+/// A response for the loopback server to send. A chunked response sends each part as one chunk, after a pause of
+/// Delay milliseconds; otherwise the parts are sent as one body with a Content-Length.
+/// </summary>
+struct HttpResponse
+{
+    int Status;
+    std::vector<std::string> Headers;               // Whole header lines, without their CRLF.
+    std::vector<std::string> Parts;
+    bool Chunked;
+    int Delay;
+};
+
+typedef std::function<HttpResponse(const HttpRequest &)> HttpHandler;
+
+/// <summary>
+/// An HTTP/1.1 server on an ephemeral port of 127.0.0.1 that serves each connection on its own thread and keeps it
+/// open between requests.
+/// </summary>
+class LoopbackServer
+{
+public:
+    explicit LoopbackServer(HttpHandler handler)
+        : handler(handler), listener(INVALID_SOCKET), port(0), connectionCount(0)
+    {
+        this->listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        address.sin_port = 0;
+        int size = sizeof(address);
+        if (this->listener == INVALID_SOCKET
+            || bind(this->listener, (const sockaddr *)&address, sizeof(address)) != 0
+            || listen(this->listener, SOMAXCONN) != 0
+            || getsockname(this->listener, (sockaddr *)&address, &size) != 0)
+        {
+            return;
+        }
+
+        this->port = ntohs(address.sin_port);
+        this->acceptor = std::thread([this] { this->Accept(); });
+    }
+
+    ~LoopbackServer()
+    {
+        if (this->listener != INVALID_SOCKET)
+        {
+            closesocket(this->listener);
+        }
+
+        if (this->acceptor.joinable())
+        {
+            this->acceptor.join();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            for (size_t i = 0; i < this->clients.size(); i++)
+            {
+                shutdown(this->clients[i], SD_BOTH);
+            }
+        }
+
+        for (size_t i = 0; i < this->servers.size(); i++)
+        {
+            this->servers[i].join();
+        }
+
+        for (size_t i = 0; i < this->clients.size(); i++)
+        {
+            closesocket(this->clients[i]);
+        }
+    }
+
+    bool Started() const
+    {
+        return this->port != 0;
+    }
+
+    /// <summary>
+    /// The mailbox endpoint URL of the server.
+    /// </summary>
+    std::string Url() const
+    {
+        char url[128];
+        sprintf_s(url, sizeof(url), "http://127.0.0.1:%u/mapi/emsmdb/?MailboxId=user@contoso.com", (unsigned int)this->port);
+        return url;
+    }
+
+    int ConnectionCount()
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->connectionCount;
+    }
+
+    std::vector<HttpRequest> Requests()
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        return this->requests;
+    }
+
+private:
+    void Accept()
+    {
+        for (;;)
+        {
+            SOCKET client = accept(this->listener, NULL, NULL);
+            if (client == INVALID_SOCKET)
+            {
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(this->mutex);
+            int connection = ++this->connectionCount;
+            this->clients.push_back(client);
+            this->servers.push_back(std::thread([this, client, connection] { this->Serve(client, connection); }));
+        }
+    }
+
+    static bool Send(SOCKET client, const std::string &data)
+    {
+        size_t sent = 0;
+        while (sent < data.size())
+        {
+            int count = send(client, data.data() + sent, (int)(data.size() - sent), 0);
+            if (count <= 0)
+            {
+                return false;
+            }
+
+            sent += count;
+        }
+
+        return true;
+    }
+
+    /// <summary>
+    /// Read the requests of a connection and answer each one, until the client closes it.
+    /// </summary>
+    void Serve(SOCKET client, int connection)
+    {
+        std::string pending;
+        char buffer[4096];
+        for (;;)
+        {
+            size_t end;
+            while ((end = pending.find("\r\n\r\n")) == std::string::npos)
+            {
+                int count = recv(client, buffer, sizeof(buffer), 0);
+                if (count <= 0)
+                {
+                    return;
+                }
+
+                pending.append(buffer, count);
+            }
+
+            HttpRequest request;
+            request.Connection = connection;
+            size_t lineEnd = pending.find("\r\n");
+            std::string line = pending.substr(0, lineEnd);
+            size_t space = line.find(' ');
+            request.Method = line.substr(0, space);
+            request.Path = line.substr(space + 1, line.rfind(' ') - space - 1);
+            for (size_t start = lineEnd + 2; start < end; start = lineEnd + 2)
+            {
+                lineEnd = pending.find("\r\n", start);
+                line = pending.substr(start, lineEnd - start);
+                size_t colon = line.find(':');
+                std::string name = line.substr(0, colon);
+                for (size_t i = 0; i < name.size(); i++)
+                {
+                    name[i] = (char)tolower((unsigned char)name[i]);
+                }
+
+                size_t value = line.find_first_not_of(' ', colon + 1);
+                request.Headers[name] = value == std::string::npos ? std::string() : line.substr(value);
+            }
+
+            size_t length = strtoul(request.Header("content-length").c_str(), NULL, 10);
+            while (pending.size() < end + 4 + length)
+            {
+                int count = recv(client, buffer, sizeof(buffer), 0);
+                if (count <= 0)
+                {
+                    return;
+                }
+
+                pending.append(buffer, count);
+            }
+
+            request.Body = pending.substr(end + 4, length);
+            pending.erase(0, end + 4 + length);
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->requests.push_back(request);
+            }
+
+            HttpResponse response = this->handler(request);
+            char status[64];
+            sprintf_s(status, sizeof(status), "HTTP/1.1 %d %s\r\n", response.Status, response.Status == 200 ? "OK" : response.Status == 503 ? "Service Unavailable" : "Error");
+            std::string head = status;
+            std::string body;
+            for (size_t i = 0; i < response.Headers.size(); i++)
+            {
+                head += response.Headers[i] + "\r\n";
+            }
+
+            if (response.Chunked)
+            {
+                head += "Transfer-Encoding: chunked\r\n\r\n";
+            }
+            else
+            {
+                for (size_t i = 0; i < response.Parts.size(); i++)
+                {
+                    body += response.Parts[i];
+                }
+
+                char contentLength[64];
+                sprintf_s(contentLength, sizeof(contentLength), "Content-Length: %u\r\n\r\n", (unsigned int)body.size());
+                head += contentLength;
+            }
+
+            if (!Send(client, head + body))
+            {
+                return;
+            }
+
+            for (size_t i = 0; response.Chunked && i < response.Parts.size(); i++)
+            {
+                Sleep(response.Delay);
+                char size[16];
+                sprintf_s(size, sizeof(size), "%x\r\n", (unsigned int)response.Parts[i].size());
+                if (!Send(client, size + response.Parts[i] + "\r\n"))
+                {
+                    return;
+                }
+            }
+
+            if (response.Chunked && !Send(client, "0\r\n\r\n"))
+            {
+                return;
+            }
+        }
+    }
+
+    HttpHandler handler;
+    SOCKET listener;
+    unsigned short port;
+    std::thread acceptor;
+    std::mutex mutex;
+    int connectionCount;
+    std::vector<SOCKET> clients;
+    std::vector<std::thread> servers;
+    std::vector<HttpRequest> requests;
+};
+
+static void PutULong(std::string &out, unsigned long value)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        out += (char)((value >> (8 * i)) & 0xFF);
+    }
+}
+
+static unsigned long GetULong(const std::string &data, size_t offset)
+{
+    unsigned long value = 0;
+    for (int i = 3; i >= 0 && offset + i < data.size(); i--)
+    {
+        value = (value << 8) | (unsigned char)data[offset + i];
+    }
+
+    return value;
+}
+
+/// <summary>
+/// An RPC_HEADER_EXT buffer whose payload is count bytes starting at first and counting up.
+/// </summary>
+static std::string MakeBuffer(unsigned short flags, unsigned short count, unsigned char first)
+{
+    RPC_HEADER_EXT header;
+    header.Version = 0;
+    header.Flags = flags;
+    header.Size = count;
+    header.SizeActual = count;
+    std::string buffer((const char *)&header, sizeof(header));
+    for (unsigned short i = 0; i < count; i++)
+    {
+        buffer += (char)(first + i);
+    }
+
+    return buffer;
+}
+
+/// <summary>
+/// A MAPI/HTTP response of a request type, as specified in MS-OXCMAPIHTTP section 2.2.7: PROCESSING, pendingCount
+/// PENDING lines and DONE, each in its own chunk, the additional headers split in the middle of a line, and the body
+/// in chunks of at most chunkSize bytes.
+/// </summary>
+static HttpResponse MapiResponse(const HttpRequest &request, const std::string &body, int pendingCount, size_t chunkSize, const std::vector<std::string> &cookies)
+{
+    HttpResponse response;
+    response.Status = 200;
+    response.Chunked = true;
+    response.Delay = 10;
+    response.Headers.push_back("Content-Type: application/mapi-http");
+    response.Headers.push_back("X-RequestType: " + request.Header("x-requesttype"));
+    response.Headers.push_back("X-RequestId: " + request.Header("x-requestid"));
+    response.Headers.push_back("X-ResponseCode: 0");
+    for (size_t i = 0; i < cookies.size(); i++)
+    {
+        response.Headers.push_back("Set-Cookie: " + cookies[i] + "; path=/mapi/emsmdb");
+    }
+
+    response.Parts.push_back("PROCESSING\r\n");
+    for (int i = 0; i < pendingCount; i++)
+    {
+        response.Parts.push_back("PENDING\r\n");
+    }
+
+    response.Parts.push_back("DONE\r\n");
+    response.Parts.push_back("X-ElapsedTime: 7\r\nX-Start");
+    response.Parts.push_back("Time: Mon, 19 Oct 2026 08:00:00 GMT\r\n\r\n");
+    for (size_t offset = 0; offset < body.size(); offset += chunkSize)
+    {
+        response.Parts.push_back(body.substr(offset, chunkSize));
+    }
+
+    return response;
+}
+
+/// <summary>
+/// A failure the server reports before the meta-tags: an X-ResponseCode other than 0, or an HTTP status other than 200.
+/// </summary>
+static HttpResponse FailureResponse(const HttpRequest &request, int status, unsigned long responseCode)
+{
+    char code[32];
+    sprintf_s(code, sizeof(code), "X-ResponseCode: %lu", responseCode);
+    HttpResponse response;
+    response.Status = status;
+    response.Chunked = false;
+    response.Delay = 0;
+    response.Headers.push_back("Content-Type: text/html");
+    response.Headers.push_back("X-RequestType: " + request.Header("x-requesttype"));
+    response.Headers.push_back(code);
+    if (status == 503)
+    {
+        response.Headers.push_back("Retry-After: 1");
+    }
+
+    response.Parts.push_back("<html><body>The request failed.</body></html>");
+    return response;
+}
+
+/// <summary>
+/// The ROP response of every Execute request: two chained RPC_HEADER_EXT buffers.
+/// </summary>
+static std::string RopResponse()
+{
+    return MakeBuffer(0, 40, 0x10) + MakeBuffer(RHE_FLAG_LAST, 24, 0x80);
+}
+
+/// <summary>
+/// A mailbox server on the loopback server. Connect creates a session context named by its sid cookie; each response
+/// sets the sequence cookie of the session to the number of requests the session made. A failure can be set up for the
+/// next request of a type.
+/// </summary>
+class MailboxServer
+{
+public:
+    MailboxServer()
+        : sessionCount(0), failStatus(0), failCode(0), server([this](const HttpRequest &request) { return this->Respond(request); })
+    {
+    }
+
+    LoopbackServer &Server()
+    {
+        return this->server;
+    }
+
+    void FailNext(const char *requestType, int status, unsigned long responseCode)
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->failType = requestType;
+        this->failStatus = status;
+        this->failCode = responseCode;
+    }
+
+private:
+    HttpResponse Respond(const HttpRequest &request)
+    {
+        std::string type = request.Header("x-requesttype");
+        std::string sid;
+        unsigned long sequence = 0;
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (type == this->failType)
+            {
+                this->failType.clear();
+                return FailureResponse(request, this->failStatus, this->failCode);
+            }
+
+            if (type == "Connect")
+            {
+                char name[16];
+                sprintf_s(name, sizeof(name), "S%d", ++this->sessionCount);
+                sid = name;
+            }
+            else
+            {
+                std::string cookie = request.Header("cookie");
+                size_t start = cookie.find("sid=");
+                sid = start == std::string::npos ? std::string() : cookie.substr(start + 4, cookie.find(';', start) - start - 4);
+            }
+
+            sequence = ++this->sequences[sid];
+        }
+
+        char sequenceCookie[32];
+        sprintf_s(sequenceCookie, sizeof(sequenceCookie), "sequence=%lu", sequence);
+        std::vector<std::string> cookies;
+        if (type == "Connect")
+        {
+            cookies.push_back("sid=" + sid);
+        }
+
+        cookies.push_back(sequenceCookie);
+
+        std::string body;
+        PutULong(body, 0);                          // StatusCode
+        PutULong(body, 0);                          // ErrorCode
+        if (type == "Connect")
+        {
+            PutULong(body, 60000);                  // PollsMax
+            PutULong(body, 6);                      // RetryCount
+            PutULong(body, 10000);                  // RetryDelay
+            body += "/o=Contoso/ou=Exchange Administrative Group";
+            body += '\0';
+            const char *name = "Test User";
+            for (size_t i = 0; i <= strlen(name); i++)
+            {
+                body += name[i];
+                body += '\0';
+            }
+
+            PutULong(body, 0);                      // AuxiliaryBufferSize
+            return MapiResponse(request, body, 1, 16, cookies);
+        }
+
+        if (type == "Execute")
+        {
+            std::string rop = RopResponse();
+            PutULong(body, 0);                      // Flags
+            PutULong(body, (unsigned long)rop.size());
+            body += rop;
+            PutULong(body, 4);                      // AuxiliaryBufferSize
+            body += "AUX!";
+
+            // Chunks of 7 bytes split the fields, both RPC_HEADER_EXT headers and both payloads.
+            return MapiResponse(request, body, 3, 7, cookies);
+        }
+
+        if (type == "NotificationWait")
+        {
+            PutULong(body, 1);                      // EventPending
+            PutULong(body, 0);                      // AuxiliaryBufferSize
+            HttpResponse response = MapiResponse(request, body, 5, 64, cookies);
+            response.Delay = 30;
+            return response;
+        }
+
+        PutULong(body, 0);                          // AuxiliaryBufferSize of Disconnect
+        return MapiResponse(request, body, 0, 64, cookies);
+    }
+
+    std::mutex mutex;
+    int sessionCount;
+    std::map<std::string, unsigned long> sequences;
+    std::string failType;
+    int failStatus;
+    unsigned long failCode;
+    LoopbackServer server;
+};
+
+static long Connect(LoopbackServer &server, MAPIHTTP_SESSION **session)
+{
+    std::string url = server.Url();
+    unsigned char userDN[] = "/o=Contoso/ou=Exchange Administrative Group/cn=Recipients/cn=user";
+    unsigned long pollsMax = 0;
+    unsigned long retryCount = 0;
+    unsigned long retryDelay = 0;
+    unsigned long auxOutSize = 0;
+    return MapiHttpConnect(url.c_str(), "CONTOSO", "user", "password", session, userDN, 0, 1252, 1033, 1033, &pollsMax, &retryCount, &retryDelay, NULL, NULL, NULL, 0, NULL, &auxOutSize);
+}
+
+static long Execute(MAPIHTTP_SESSION **session, std::string *ropOut)
+{
+    std::string rop = MakeBuffer(RHE_FLAG_LAST, 10, 0x40);
+    unsigned char rgbOut[0x1000];
+    unsigned long cbOut = sizeof(rgbOut);
+    unsigned long flags = 0;
+    long status = MapiHttpExecute(session, &flags, (unsigned char *)&rop[0], (unsigned long)rop.size(), rgbOut, &cbOut, NULL, 0, NULL, NULL, NULL);
+    if (status == 0 && ropOut != NULL)
+    {
+        ropOut->assign((const char *)rgbOut, cbOut);
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Connect returns the fields of the response body and sends the Connect request body.
+/// </summary>
+static void TestConnect()
+{
+    MailboxServer mailbox;
+    LoopbackServer &server = mailbox.Server();
+    Check(server.Started(), "Connect", "the loopback server did not start");
+    std::string url = server.Url();
+    unsigned char userDN[] = "/o=Contoso/ou=Exchange Administrative Group/cn=Recipients/cn=user";
+    unsigned char auxIn[] = { 1, 2, 3 };
+    unsigned char auxOut[64];
+    unsigned long auxOutSize = sizeof(auxOut);
+    unsigned long pollsMax = 0;
+    unsigned long retryCount = 0;
+    unsigned long retryDelay = 0;
+    unsigned char *prefix = NULL;
+    unsigned char *displayName = NULL;
+    MAPIHTTP_SESSION *session = NULL;
+    long status = MapiHttpConnect(url.c_str(), "CONTOSO", "user", "password", &session, userDN, 0x00000001, 1252, 1036, 1033,
+        &pollsMax, &retryCount, &retryDelay, &prefix, &displayName, auxIn, sizeof(auxIn), auxOut, &auxOutSize);
+    Check(status == 0 && session != NULL, "Connect", "MapiHttpConnect failed");
+    Check(pollsMax == 60000 && retryCount == 6 && retryDelay == 10000, "Connect", "PollsMax, RetryCount or RetryDelay is wrong");
+    Check(prefix != NULL && strcmp((const char *)prefix, "/o=Contoso/ou=Exchange Administrative Group") == 0, "Connect", "DNPrefix is wrong");
+    Check(displayName != NULL && strcmp((const char *)displayName, "Test User") == 0, "Connect", "DisplayName is wrong");
+    Check(auxOutSize == 0, "Connect", "the auxiliary buffer is not empty");
+    midl_user_free(prefix);
+    midl_user_free(displayName);
+
+    std::vector<HttpRequest> requests = server.Requests();
+    Check(requests.size() == 1 && requests[0].Method == "POST" && requests[0].Path == "/mapi/emsmdb/?MailboxId=user@contoso.com", "Connect", "the request line is wrong");
+    if (requests.size() == 1)
+    {
+        const HttpRequest &request = requests[0];
+        size_t dnSize = sizeof(userDN);
+        Check(request.Header("x-requesttype") == "Connect" && request.Header("content-type") == "application/mapi-http", "Connect", "X-RequestType or Content-Type is wrong");
+        Check(!request.Header("x-clientinfo").empty() && !request.Header("x-requestid").empty(), "Connect", "X-ClientInfo or X-RequestId is missing");
+        Check(request.Header("cookie").empty(), "Connect", "the Connect request carries a cookie");
+        Check(request.Body.size() == dnSize + 20 + sizeof(auxIn) && request.Body.compare(0, dnSize, (const char *)userDN, dnSize) == 0, "Connect", "the request body has the wrong size or UserDn");
+        Check(GetULong(request.Body, dnSize) == 1 && GetULong(request.Body, dnSize + 4) == 1252 && GetULong(request.Body, dnSize + 8) == 1033
+            && GetULong(request.Body, dnSize + 12) == 1036 && GetULong(request.Body, dnSize + 16) == sizeof(auxIn), "Connect", "Flags, Cpid, LcidSort, LcidString or AuxiliaryBufferSize is wrong");
+    }
+
+    MAPIHTTP_POOL_STATS stats;
+    MapiHttpGetPoolStats(&stats);
+    Check(stats.SessionCount == 1, "Connect", "the pool does not count the session");
+    Check(MapiHttpDisconnect(&session) == 0 && session == NULL, "Connect", "MapiHttpDisconnect failed");
+    MapiHttpGetPoolStats(&stats);
+    Check(stats.SessionCount == 0, "Connect", "the pool still counts the session");
+    MapiHttpPoolFlush();
+}
+
+struct BufferLog
+{
+    std::vector<std::string> buffers;
+};
+
+static void __stdcall LogBuffer(void *context, unsigned char *buffer, unsigned long size)
+{
+    ((BufferLog *)context)->buffers.push_back(std::string((const char *)buffer, size));
+}
+
+/// <summary>
+/// An Execute response sent as PROCESSING, PENDING and DONE chunks and a body in 7-byte chunks is read into rgbOut and
+/// rgbAuxOut whole, each RPC_HEADER_EXT buffer is reported once it has arrived, and the request body carries rgbIn.
+/// </summary>
+static void TestChunkedExecute()
+{
+    MailboxServer mailbox;
+    LoopbackServer &server = mailbox.Server();
+    MAPIHTTP_SESSION *session = NULL;
+    Check(Connect(server, &session) == 0, "ChunkedExecute", "MapiHttpConnect failed");
+
+    std::string rop = MakeBuffer(RHE_FLAG_LAST, 10, 0x40);
+    unsigned char auxIn[] = { 9, 8 };
+    unsigned char rgbOut[0x1000];
+    unsigned long cbOut = sizeof(rgbOut);
+    unsigned char auxOut[16];
+    unsigned long auxOutSize = sizeof(auxOut);
+    unsigned long flags = 0x00000003;
+    unsigned long transTime = 0;
+    BufferLog log;
+    long status = MapiHttpExecuteEx(&session, &flags, (unsigned char *)&rop[0], (unsigned long)rop.size(), rgbOut, &cbOut, auxIn, sizeof(auxIn), auxOut, &auxOutSize, &transTime, LogBuffer, &log);
+    std::string expected = RopResponse();
+    Check(status == 0, "ChunkedExecute", "MapiHttpExecuteEx failed");
+    Check(cbOut == expected.size() && memcmp(rgbOut, expected.data(), expected.size()) == 0, "ChunkedExecute", "rgbOut is not the RopBuffer of the response");
+    Check(flags == 0, "ChunkedExecute", "the Flags of the response were not returned");
+    Check(auxOutSize == 4 && memcmp(auxOut, "AUX!", 4) == 0, "ChunkedExecute", "rgbAuxOut is not the AuxiliaryBuffer of the response");
+    Check(transTime == 7, "ChunkedExecute", "X-ElapsedTime was not returned");
+    Check(log.buffers.size() == 2 && log.buffers[0] == expected.substr(0, 48) && log.buffers[1] == expected.substr(48), "ChunkedExecute", "the RPC_HEADER_EXT buffers were not reported once each, in order");
+
+    std::vector<HttpRequest> requests = server.Requests();
+    Check(requests.size() == 2 && requests[1].Header("x-requesttype") == "Execute", "ChunkedExecute", "the server did not receive the Execute request");
+    if (requests.size() == 2)
+    {
+        const std::string &body = requests[1].Body;
+        Check(body.size() == 16 + rop.size() + sizeof(auxIn), "ChunkedExecute", "the request body has the wrong size");
+        Check(GetULong(body, 0) == 3 && GetULong(body, 4) == rop.size() && body.compare(8, rop.size(), rop) == 0, "ChunkedExecute", "Flags, RopBufferSize or RopBuffer of the request is wrong");
+        Check(GetULong(body, 8 + rop.size()) == sizeof(rgbOut) && GetULong(body, 12 + rop.size()) == sizeof(auxIn), "ChunkedExecute", "MaxRopOut or AuxiliaryBufferSize of the request is wrong");
+    }
+
+    cbOut = 16;
+    flags = 0;
+    Check(MapiHttpExecute(&session, &flags, (unsigned char *)&rop[0], (unsigned long)rop.size(), rgbOut, &cbOut, NULL, 0, NULL, NULL, NULL) == ERROR_INSUFFICIENT_BUFFER,
+        "ChunkedExecute", "a RopBuffer larger than rgbOut did not fail with ERROR_INSUFFICIENT_BUFFER");
+    Check(Execute(&session, NULL) == 0, "ChunkedExecute", "the session did not recover from a response that did not fit");
+    Check(MapiHttpDisconnect(&session) == 0, "ChunkedExecute", "MapiHttpDisconnect failed");
+    MapiHttpPoolFlush();
+}
+
+/// <summary>
+/// NotificationWait returns once DONE and the body arrive after a series of PENDING lines.
+/// </summary>
+static void TestNotificationWait()
+{
+    MailboxServer mailbox;
+    LoopbackServer &server = mailbox.Server();
+    MAPIHTTP_SESSION *session = NULL;
+    Check(Connect(server, &session) == 0, "NotificationWait", "MapiHttpConnect failed");
+
+    unsigned long flagsOut = 0;
+    Check(MapiHttpNotificationWait(session, 0, &flagsOut) == 0, "NotificationWait", "MapiHttpNotificationWait failed");
+    Check(flagsOut == 0x00000001, "NotificationWait", "EventPending was not returned as NotificationPending");
+
+    std::vector<HttpRequest> requests = server.Requests();
+    Check(requests.size() == 2 && requests[1].Header("x-requesttype") == "NotificationWait" && requests[1].Body.size() == 8
+        && GetULong(requests[1].Body, 0) == 0 && GetULong(requests[1].Body, 4) == 0, "NotificationWait", "the NotificationWait request body is wrong");
+    Check(MapiHttpDisconnect(&session) == 0, "NotificationWait", "MapiHttpDisconnect failed");
+    MapiHttpPoolFlush();
+}
+
+/// <summary>
+/// The sid and sequence cookies of a response come back on the next request of the same session, the newest value of
+/// each, and never on a request of another session; Disconnect sends them too.
+/// </summary>
+static void TestCookies()
+{
+    MailboxServer mailbox;
+    LoopbackServer &server = mailbox.Server();
+    MAPIHTTP_SESSION *first = NULL;
+    MAPIHTTP_SESSION *second = NULL;
+    Check(Connect(server, &first) == 0, "Cookies", "MapiHttpConnect of the first session failed");
+    Check(Execute(&first, NULL) == 0, "Cookies", "Execute of the first session failed");
+    Check(Connect(server, &second) == 0, "Cookies", "MapiHttpConnect of the second session failed");
+    unsigned long flagsOut = 0;
+    Check(MapiHttpNotificationWait(first, 0, &flagsOut) == 0, "Cookies", "NotificationWait of the first session failed");
+    Check(Execute(&second, NULL) == 0, "Cookies", "Execute of the second session failed");
+    Check(MapiHttpDisconnect(&first) == 0, "Cookies", "MapiHttpDisconnect of the first session failed");
+    Check(MapiHttpDisconnect(&second) == 0, "Cookies", "MapiHttpDisconnect of the second session failed");
+
+    static const char *expected[] =
+    {
+        "",                         // Connect of the first session.
+        "sid=S1; sequence=1",       // Execute of the first session.
+        "",                         // Connect of the second session.
+        "sid=S1; sequence=2",       // NotificationWait of the first session.
+        "sid=S2; sequence=1",       // Execute of the second session.
+        "sid=S1; sequence=3",       // Disconnect of the first session.
+        "sid=S2; sequence=2"        // Disconnect of the second session.
+    };
+
+    std::vector<HttpRequest> requests = server.Requests();
+    Check(requests.size() == sizeof(expected) / sizeof(expected[0]), "Cookies", "the server did not receive every request");
+    for (size_t i = 0; i < requests.size() && i < sizeof(expected) / sizeof(expected[0]); i++)
+    {
+        if (requests[i].Header("cookie") != expected[i])
+        {
+            printf("FAIL Cookies: request %u of type %s carries \"%s\", not \"%s\"\n", (unsigned int)i, requests[i].Header("x-requesttype").c_str(), requests[i].Header("cookie").c_str(), expected[i]);
+            m_failures++;
+        }
+    }
+
+    Check(requests.size() > 5 && requests[5].Header("x-requesttype") == "Disconnect" && requests[6].Header("x-requesttype") == "Disconnect", "Cookies", "Disconnect was not sent");
+    MapiHttpPoolFlush();
+}
+
+/// <summary>
+/// Two sessions one after the other share one pooled host and reuse its keep-alive connection: the server accepts a
+/// single TCP connection for all their requests.
+/// </summary>
+static void TestPooledConnection()
+{
+    MailboxServer mailbox;
+    LoopbackServer &server = mailbox.Server();
+    for (int i = 0; i < 2; i++)
+    {
+        MAPIHTTP_SESSION *session = NULL;
+        std::string ropOut;
+        Check(Connect(server, &session) == 0, "PooledConnection", "MapiHttpConnect failed");
+        Check(Execute(&session, &ropOut) == 0 && ropOut == RopResponse(), "PooledConnection", "Execute failed");
+        Check(MapiHttpDisconnect(&session) == 0, "PooledConnection", "MapiHttpDisconnect failed");
+    }
+
+    MAPIHTTP_POOL_STATS stats;
+    MapiHttpGetPoolStats(&stats);
+    Check(stats.HostCount == 1, "PooledConnection", "the two sessions did not share one pooled host");
+    Check(stats.SessionCount == 0, "PooledConnection", "the pool still counts a session");
+    Check(server.Requests().size() == 6, "PooledConnection", "the server did not receive every request");
+    Check(server.ConnectionCount() == 1, "PooledConnection", "the second session did not reuse the keep-alive connection of the first");
+
+    MapiHttpPoolFlush();
+    MapiHttpGetPoolStats(&stats);
+    Check(stats.HostCount == 0, "PooledConnection", "MapiHttpPoolFlush did not close the idle host");
+}
+
+/// <summary>
+/// A response with an X-ResponseCode other than 0 fails the call with ERROR_WINHTTP_INVALID_SERVER_RESPONSE, reports
+/// the code through MapiHttpGetLastResponse, and leaves the session and its connection usable. A failed Connect
+/// returns no session.
+/// </summary>
+static void TestResponseCode()
+{
+    MailboxServer mailbox;
+    LoopbackServer &server = mailbox.Server();
+    MAPIHTTP_SESSION *session = NULL;
+    mailbox.FailNext("Connect", 200, MAPIHTTP_RESPONSE_ANONYMOUS_NOT_ALLOWED);
+    Check(Connect(server, &session) == ERROR_WINHTTP_INVALID_SERVER_RESPONSE, "ResponseCode", "a Connect with X-ResponseCode 8 did not fail");
+    Check(session == NULL, "ResponseCode", "a failed Connect returned a session");
+
+    MAPIHTTP_POOL_STATS stats;
+    MapiHttpGetPoolStats(&stats);
+    Check(stats.SessionCount == 0, "ResponseCode", "the pool counts the session of a failed Connect");
+
+    Check(Connect(server, &session) == 0, "ResponseCode", "MapiHttpConnect failed");
+    mailbox.FailNext("Execute", 200, MAPIHTTP_RESPONSE_CONTEXT_NOT_FOUND);
+    Check(Execute(&session, NULL) == ERROR_WINHTTP_INVALID_SERVER_RESPONSE, "ResponseCode", "an Execute with X-ResponseCode 10 did not fail");
+    unsigned long httpStatus = 0;
+    unsigned long responseCode = 0;
+    Check(MapiHttpGetLastResponse(session, &httpStatus, &responseCode) == 0 && httpStatus == 200 && responseCode == MAPIHTTP_RESPONSE_CONTEXT_NOT_FOUND,
+        "ResponseCode", "MapiHttpGetLastResponse did not report X-ResponseCode 10");
+
+    std::string ropOut;
+    Check(Execute(&session, &ropOut) == 0 && ropOut == RopResponse(), "ResponseCode", "the session did not recover from the failure");
+    Check(MapiHttpGetLastResponse(session, &httpStatus, &responseCode) == 0 && httpStatus == 200 && responseCode == MAPIHTTP_RESPONSE_SUCCESS,
+        "ResponseCode", "MapiHttpGetLastResponse did not report the success");
+    Check(MapiHttpDisconnect(&session) == 0, "ResponseCode", "MapiHttpDisconnect failed");
+    Check(server.ConnectionCount() == 1, "ResponseCode", "the connection was not kept after a failure response");
+    MapiHttpPoolFlush();
+}
+
+/// <summary>
+/// An HTTP 503 fails the call with ERROR_WINHTTP_INVALID_SERVER_RESPONSE and reports the status through
+/// MapiHttpGetLastResponse; the next call of the session succeeds.
+/// </summary>
+static void TestServiceUnavailable()
+{
+    MailboxServer mailbox;
+    LoopbackServer &server = mailbox.Server();
+    MAPIHTTP_SESSION *session = NULL;
+    Check(Connect(server, &session) == 0, "ServiceUnavailable", "MapiHttpConnect failed");
+
+    mailbox.FailNext("NotificationWait", 503, MAPIHTTP_RESPONSE_ENDPOINT_SHUTTING_DOWN);
+    unsigned long flagsOut = 0;
+    Check(MapiHttpNotificationWait(session, 0, &flagsOut) == ERROR_WINHTTP_INVALID_SERVER_RESPONSE, "ServiceUnavailable", "a 503 response did not fail the call");
+    unsigned long httpStatus = 0;
+    unsigned long responseCode = 0;
+    Check(MapiHttpGetLastResponse(session, &httpStatus, &responseCode) == 0 && httpStatus == 503 && responseCode == MAPIHTTP_RESPONSE_ENDPOINT_SHUTTING_DOWN,
+        "ServiceUnavailable", "MapiHttpGetLastResponse did not report the 503");
+
+    mailbox.FailNext("Execute", 503, MAPIHTTP_RESPONSE_SUCCESS);
+    Check(Execute(&session, NULL) == ERROR_WINHTTP_INVALID_SERVER_RESPONSE, "ServiceUnavailable", "a 503 Execute response did not fail the call");
+    Check(MapiHttpGetLastResponse(session, &httpStatus, &responseCode) == 0 && httpStatus == 503, "ServiceUnavailable", "MapiHttpGetLastResponse did not report the 503 of Execute");
+
+    Check(MapiHttpNotificationWait(session, 0, &flagsOut) == 0 && flagsOut == 0x00000001, "ServiceUnavailable", "the session did not recover from the 503");
+    Check(MapiHttpDisconnect(&session) == 0, "ServiceUnavailable", "MapiHttpDisconnect failed");
+    MapiHttpPoolFlush();
+}
+
+/// <summary>
+/// Midl allocation functions for the DNPrefix and DisplayName that MapiHttpConnect returns.
+/// </summary>
+void* __RPC_USER midl_user_allocate(size_t size)
+{
+    return malloc(size);
+}
+
+void __RPC_USER midl_user_free(void* p)
+{
+    free(p);
+}
+
+int main(int argc, char *argv[])
+{
+    WSADATA data;
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0)
+    {
+        printf("FAIL WSAStartup\n");
+        return 1;
+    }
+
+    struct
+    {
+        const char *name;
+        void (*run)();
+    } tests[] =
+    {
+        { "Connect", TestConnect },
+        { "ChunkedExecute", TestChunkedExecute },
+        { "NotificationWait", TestNotificationWait },
+        { "Cookies", TestCookies },
+        { "PooledConnection", TestPooledConnection },
+        { "ResponseCode", TestResponseCode },
+        { "ServiceUnavailable", TestServiceUnavailable },
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+    {
+        int failures = m_failures;
+        tests[i].run();
+        printf("%s %s\n", m_failures == failures ? "PASS" : "FAIL", tests[i].name);
+    }
+
+    WSACleanup();
+    return m_failures;
+}
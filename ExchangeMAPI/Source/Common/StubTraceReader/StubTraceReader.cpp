@@ -0,0 +1,445 @@
+#include "..\OXCRPCStub\StubTrace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <wchar.h>
+#include <algorithm>
+#include <vector>
+
+// Reader of the trace files written by StubTraceStart. It loads one or more files, from one or more processes, puts
+// their records on a common time line and prints either the time line, one call per line, or a summary of the calls
+// of each operation with their latency percentiles. The time of a record is the UTC time its file was started at plus
+// the performance counter ticks from then, so the records of several processes interleave as they happened.
+//
+// Usage: StubTraceReader [/summary] [/csv] [/session <hex>] <trace file> [<trace file> ...]
+
+/// <summary>
+/// A record of a trace file, with the time it starts at on the common time line.
+/// </summary>
+struct TraceEntry
+{
+    unsigned __int64 Time;                  // 100-nanosecond intervals since the earliest file was started.
+    unsigned long ProcessId;
+    STUB_TRACE_RECORD Record;
+};
+
+/// <summary>
+/// The calls of one operation, for the summary.
+/// </summary>
+struct OperationSummary
+{
+    unsigned char Interface;
+    unsigned char Opnum;
+    unsigned long CallCount;
+    unsigned long FaultCount;
+    unsigned long ErrorCount;
+    unsigned __int64 RequestBytes;
+    unsigned __int64 ResponseBytes;
+    std::vector<unsigned long> Durations;
+};
+
+/// <summary>
+/// A trace file, loaded whole.
+/// </summary>
+struct TraceFile
+{
+    STUB_TRACE_FILE_HEADER Header;
+    std::vector<STUB_TRACE_RECORD> Records;
+};
+
+/// <summary>
+/// Get the name of a traced operation.
+/// </summary>
+/// <param name="interfaceId">One of the STUB_TRACE_ interface values.</param>
+/// <param name="opnum">The operation number within the interface.</param>
+/// <returns>The name of the operation, or NULL if it is not known.</returns>
+static const char *OperationName(unsigned char interfaceId, unsigned char opnum)
+{
+    switch (interfaceId)
+    {
+        case STUB_TRACE_EMSMDB:
+            switch (opnum)
+            {
+                case 1: return "EcDoDisconnect";
+                case 4: return "EcRRegisterPushNotification";
+                case 6: return "EcDummyRpc";
+                case 10: return "EcDoConnectEx";
+                case 11: return "EcDoRpcExt2";
+                case 14: return "EcDoAsyncConnectEx";
+            }
+
+            break;
+
+        case STUB_TRACE_ASYNCEMSMDB:
+            if (opnum == 0)
+            {
+                return "EcDoAsyncWaitEx";
+            }
+
+            break;
+
+        case STUB_TRACE_NSPI:
+            switch (opnum)
+            {
+                case 0: return "NspiBind";
+                case 1: return "NspiUnbind";
+                case 2: return "NspiUpdateStat";
+                case 3: return "NspiQueryRows";
+                case 4: return "NspiSeekEntries";
+                case 5: return "NspiGetMatches";
+                case 6: return "NspiResortRestriction";
+                case 7: return "NspiDNToMId";
+                case 8: return "NspiGetPropList";
+                case 9: return "NspiGetProps";
+                case 10: return "NspiCompareMIds";
+                case 11: return "NspiModProps";
+                case 12: return "NspiGetSpecialTable";
+                case 13: return "NspiGetTemplateInfo";
+                case 14: return "NspiModLinkAtt";
+                case 16: return "NspiQueryColumns";
+                case 19: return "NspiResolveNames";
+                case 20: return "NspiResolveNamesW";
+            }
+
+            break;
+    }
+
+    return NULL;
+}
+
+/// <summary>
+/// Format the name of a traced operation, falling back to the interface and opnum if it is not known.
+/// </summary>
+static void FormatOperation(const STUB_TRACE_RECORD &record, char *buffer, size_t size)
+{
+    if (record.Kind == STUB_TRACE_KIND_DROPPED)
+    {
+        sprintf_s(buffer, size, "(dropped)");
+        return;
+    }
+
+    const char *name = OperationName(record.Interface, record.Opnum);
+    if (name != NULL)
+    {
+        sprintf_s(buffer, size, "%s", name);
+    }
+    else
+    {
+        sprintf_s(buffer, size, "Interface%u.Op%u", record.Interface, record.Opnum);
+    }
+}
+
+static const char *KindName(unsigned char kind)
+{
+    switch (kind)
+    {
+        case STUB_TRACE_KIND_CALL: return "call";
+        case STUB_TRACE_KIND_FAULT: return "fault";
+        case STUB_TRACE_KIND_ASYNC: return "async";
+        case STUB_TRACE_KIND_DROPPED: return "dropped";
+    }
+
+    return "unknown";
+}
+
+/// <summary>
+/// Load a trace file. A file cut short by the end of its process is read up to its last whole record.
+/// </summary>
+/// <param name="path">The path of the trace file.</param>
+/// <param name="file">Receives the header and the records of the file.</param>
+/// <returns>If success, it returns 0, else returns the error code.</returns>
+static long LoadTraceFile(const wchar_t *path, TraceFile *file)
+{
+    FILE *stream = NULL;
+    if (_wfopen_s(&stream, path, L"rb") != 0 || stream == NULL)
+    {
+        return ERROR_FILE_NOT_FOUND;
+    }
+
+    long status = 0;
+    if (fread(&file->Header, sizeof(file->Header), 1, stream) != 1
+        || file->Header.Signature != STUB_TRACE_SIGNATURE
+        || file->Header.Version != STUB_TRACE_VERSION
+        || file->Header.RecordSize != sizeof(STUB_TRACE_RECORD)
+        || file->Header.Frequency == 0)
+    {
+        status = ERROR_BAD_FORMAT;
+    }
+    else
+    {
+        STUB_TRACE_RECORD record;
+        while (fread(&record, sizeof(record), 1, stream) == 1)
+        {
+            file->Records.push_back(record);
+        }
+    }
+
+    fclose(stream);
+    return status;
+}
+
+/// <summary>
+/// Convert performance counter ticks to 100-nanosecond intervals without overflow.
+/// </summary>
+static unsigned __int64 TicksToTime(unsigned __int64 ticks, unsigned __int64 frequency)
+{
+    return ticks / frequency * 10000000 + ticks % frequency * 10000000 / frequency;
+}
+
+/// <summary>
+/// Get the duration below which the given percentage of the sorted durations fall.
+/// </summary>
+static unsigned long Percentile(const std::vector<unsigned long> &sorted, unsigned long percent)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+
+    size_t rank = (sorted.size() * percent + 99) / 100;
+    return sorted[rank == 0 ? 0 : rank - 1];
+}
+
+static bool EntryBefore(const TraceEntry &left, const TraceEntry &right)
+{
+    return left.Time < right.Time;
+}
+
+static bool SummaryBefore(const OperationSummary &left, const OperationSummary &right)
+{
+    return left.Interface != right.Interface ? left.Interface < right.Interface : left.Opnum < right.Opnum;
+}
+
+/// <summary>
+/// Print the records one per line, in the order they started.
+/// </summary>
+static void PrintTimeline(const std::vector<TraceEntry> &entries, bool csv)
+{
+    if (csv)
+    {
+        printf("TimeMs,ProcessId,ThreadId,Session,Operation,Kind,DurationUs,RequestBytes,ResponseBytes,Flags,RequestHeaderFlags,ResponseHeaderFlags,ReturnCode\n");
+    }
+    else
+    {
+        printf("%12s %6s %6s %16s %-28s %-7s %10s %10s %10s %8s %4s %4s %10s\n",
+            "TimeMs", "Pid", "Tid", "Session", "Operation", "Kind", "Us", "Request", "Response", "Flags", "ReqH", "RspH", "Return");
+    }
+
+    char operation[64];
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const TraceEntry &entry = entries[i];
+        const STUB_TRACE_RECORD &record = entry.Record;
+        FormatOperation(record, operation, sizeof(operation));
+        printf(
+            csv ? "%I64u.%04I64u,%lu,%lu,%I64X,%s,%s,%lu,%lu,%lu,0x%lX,0x%X,0x%X,0x%lX\n" : "%7I64u.%04I64u %6lu %6lu %16I64X %-28s %-7s %10lu %10lu %10lu %8lX %4X %4X %10lX\n",
+            entry.Time / 10000,
+            entry.Time % 10000,
+            entry.ProcessId,
+            record.ThreadId,
+            record.Session,
+            operation,
+            KindName(record.Kind),
+            record.Duration,
+            record.RequestBytes,
+            record.ResponseBytes,
+            record.Flags,
+            record.RequestHeaderFlags,
+            record.ResponseHeaderFlags,
+            (unsigned long)record.ReturnCode);
+    }
+}
+
+/// <summary>
+/// Print, for each operation, the number of calls, of faults and of errors, the bytes sent and received and the
+/// latency percentiles. Asynchronous calls count their submission time and dropped records only add to a total.
+/// </summary>
+static void PrintSummary(const std::vector<TraceEntry> &entries, bool csv)
+{
+    std::vector<OperationSummary> summaries;
+    unsigned __int64 dropped = 0;
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        const STUB_TRACE_RECORD &record = entries[i].Record;
+        if (record.Kind == STUB_TRACE_KIND_DROPPED)
+        {
+            dropped += record.RequestBytes;
+            continue;
+        }
+
+        size_t index = 0;
+        while (index < summaries.size() && (summaries[index].Interface != record.Interface || summaries[index].Opnum != record.Opnum))
+        {
+            index++;
+        }
+
+        if (index == summaries.size())
+        {
+            OperationSummary summary;
+            summary.Interface = record.Interface;
+            summary.Opnum = record.Opnum;
+            summary.CallCount = 0;
+            summary.FaultCount = 0;
+            summary.ErrorCount = 0;
+            summary.RequestBytes = 0;
+            summary.ResponseBytes = 0;
+            summaries.push_back(summary);
+        }
+
+        OperationSummary &summary = summaries[index];
+        summary.CallCount++;
+        if (record.Kind == STUB_TRACE_KIND_FAULT)
+        {
+            summary.FaultCount++;
+        }
+        else if (record.ReturnCode != 0)
+        {
+            summary.ErrorCount++;
+        }
+
+        summary.RequestBytes += record.RequestBytes;
+        summary.ResponseBytes += record.ResponseBytes;
+        summary.Durations.push_back(record.Duration);
+    }
+
+    std::sort(summaries.begin(), summaries.end(), SummaryBefore);
+    if (csv)
+    {
+        printf("Operation,Calls,Faults,Errors,RequestBytes,ResponseBytes,P50Us,P90Us,P99Us,MaxUs\n");
+    }
+    else
+    {
+        printf("%-28s %8s %6s %6s %12s %12s %8s %8s %8s %8s\n",
+            "Operation", "Calls", "Faults", "Errors", "Request", "Response", "P50Us", "P90Us", "P99Us", "MaxUs");
+    }
+
+    char operation[64];
+    for (size_t i = 0; i < summaries.size(); i++)
+    {
+        OperationSummary &summary = summaries[i];
+        std::sort(summary.Durations.begin(), summary.Durations.end());
+        STUB_TRACE_RECORD record = { 0 };
+        record.Interface = summary.Interface;
+        record.Opnum = summary.Opnum;
+        FormatOperation(record, operation, sizeof(operation));
+        printf(
+            csv ? "%s,%lu,%lu,%lu,%I64u,%I64u,%lu,%lu,%lu,%lu\n" : "%-28s %8lu %6lu %6lu %12I64u %12I64u %8lu %8lu %8lu %8lu\n",
+            operation,
+            summary.CallCount,
+            summary.FaultCount,
+            summary.ErrorCount,
+            summary.RequestBytes,
+            summary.ResponseBytes,
+            Percentile(summary.Durations, 50),
+            Percentile(summary.Durations, 90),
+            Percentile(summary.Durations, 99),
+            summary.Durations.back());
+    }
+
+    if (!csv && dropped > 0)
+    {
+        printf("%I64u records were dropped because a ring was full; the figures above do not include them.\n", dropped);
+    }
+}
+
+static void PrintUsage()
+{
+    fwprintf(stderr, L"Usage: StubTraceReader [/summary] [/csv] [/session <hex>] <trace file> [<trace file> ...]\n");
+    fwprintf(stderr, L"  /summary        Print the calls, errors, bytes and latency percentiles of each operation.\n");
+    fwprintf(stderr, L"  /csv            Print comma-separated values.\n");
+    fwprintf(stderr, L"  /session <hex>  Only include the calls of the given session handle.\n");
+}
+
+int wmain(int argc, wchar_t *argv[])
+{
+    bool summary = false;
+    bool csv = false;
+    bool filterSession = false;
+    unsigned __int64 session = 0;
+    std::vector<const wchar_t *> paths;
+    for (int i = 1; i < argc; i++)
+    {
+        if (_wcsicmp(argv[i], L"/summary") == 0)
+        {
+            summary = true;
+        }
+        else if (_wcsicmp(argv[i], L"/csv") == 0)
+        {
+            csv = true;
+        }
+        else if (_wcsicmp(argv[i], L"/session") == 0 && i + 1 < argc)
+        {
+            filterSession = true;
+            session = _wcstoui64(argv[++i], NULL, 16);
+        }
+        else if (argv[i][0] == L'/')
+        {
+            PrintUsage();
+            return ERROR_INVALID_PARAMETER;
+        }
+        else
+        {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    if (paths.empty())
+    {
+        PrintUsage();
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    std::vector<TraceFile> files(paths.size());
+    unsigned __int64 origin = _UI64_MAX;
+    for (size_t i = 0; i < paths.size(); i++)
+    {
+        long status = LoadTraceFile(paths[i], &files[i]);
+        if (status != 0)
+        {
+            fwprintf(stderr, L"Cannot read the trace file %s: error %ld.\n", paths[i], status);
+            return status;
+        }
+
+        if (files[i].Header.StartTime < origin)
+        {
+            origin = files[i].Header.StartTime;
+        }
+    }
+
+    std::vector<TraceEntry> entries;
+    for (size_t i = 0; i < files.size(); i++)
+    {
+        const STUB_TRACE_FILE_HEADER &header = files[i].Header;
+        for (size_t j = 0; j < files[i].Records.size(); j++)
+        {
+            const STUB_TRACE_RECORD &record = files[i].Records[j];
+            if (filterSession && record.Session != session && record.Kind != STUB_TRACE_KIND_DROPPED)
+            {
+                continue;
+            }
+
+            // A record that began before tracing started, on a call that was already running, is put at the start.
+            TraceEntry entry;
+            entry.Time = header.StartTime - origin;
+            if (record.StartTime > header.StartCounter)
+            {
+                entry.Time += TicksToTime(record.StartTime - header.StartCounter, header.Frequency);
+            }
+
+            entry.ProcessId = header.ProcessId;
+            entry.Record = record;
+            entries.push_back(entry);
+        }
+    }
+
+    std::stable_sort(entries.begin(), entries.end(), EntryBefore);
+    if (summary)
+    {
+        PrintSummary(entries, csv);
+    }
+    else
+    {
+        PrintTimeline(entries, csv);
+    }
+
+    return 0;
+}